@@ -30,6 +30,7 @@
 #include "tls_engine.h"
 #include "tcp_src.h"
 #include "tls_link.h"
+#include "timer_wheel.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +54,7 @@ typedef LIST_HEAD(hdr_list, tlsuv_http_hdr_s) um_header_list;
 typedef struct tlsuv_http_resp_s tlsuv_http_resp_t;
 typedef struct tlsuv_http_req_s tlsuv_http_req_t;
 typedef struct tlsuv_http_s tlsuv_http_t;
+typedef struct tlsuv_http_conn_s tlsuv_http_conn_t;
 typedef struct tlsuv_http_inflater_s tlsuv_http_inflater_t;
 /**
  * HTTP response callback type.
@@ -64,6 +66,25 @@ typedef void (*tlsuv_http_resp_cb)(tlsuv_http_resp_t *resp, void *ctx);
  */
 typedef void (*tlsuv_http_body_cb)(tlsuv_http_req_t *req, const char *body, ssize_t len);
 
+/**
+ * Request body generator callback type.
+ * Fills up to `len` bytes of `buf`, returns number of bytes produced, 0 at the end of the body, or error code.
+ */
+typedef ssize_t (*tlsuv_http_body_read_cb)(tlsuv_http_req_t *req, char *buf, size_t len, void *ctx);
+
+/**
+ * Response body sink completion callback type.
+ * Called once all body data was written, or with error code if response or file write failed.
+ */
+typedef void (*tlsuv_http_sink_cb)(void *ctx, int status, uint64_t written);
+
+/**
+ * Response header callback type, receives headers that are not kept in response header list
+ * (@see tlsuv_http_req_resp_headers). `name` and `value` are not NUL terminated and are only valid during the call.
+ */
+typedef void (*tlsuv_http_hdr_cb)(tlsuv_http_resp_t *resp, const char *name, size_t namelen,
+                                  const char *value, size_t vallen);
+
 typedef void (*tlsuv_http_close_cb)(tlsuv_http_t *);
 /**
  * @brief State of HTTP request.
@@ -76,6 +97,45 @@ typedef enum http_request_state {
     completed
 } http_request_state;
 
+/**
+ * @brief Request priority classes, @see tlsuv_http_req_priority
+ */
+typedef enum tlsuv_http_priority_e {
+    /** same as TLSUV_HTTP_PRIO_NORMAL */
+    TLSUV_HTTP_PRIO_DEFAULT,
+    /** strict class, dispatched ahead of all other requests, e.g. heartbeats */
+    TLSUV_HTTP_PRIO_URGENT,
+    TLSUV_HTTP_PRIO_HIGH,
+    TLSUV_HTTP_PRIO_NORMAL,
+    TLSUV_HTTP_PRIO_BULK,
+} tlsuv_http_priority;
+
+#define TLSUV_HTTP_PRIO_COUNT (TLSUV_HTTP_PRIO_BULK + 1)
+
+/**
+ * @brief Retry and hedging policy, applies to idempotent requests without body (GET, HEAD, OPTIONS, TRACE, PUT, DELETE).
+ */
+typedef struct tlsuv_http_retry_policy_s {
+    /** retries of request that failed with connection error before its response headers, 0 disables retries */
+    unsigned int max_retries;
+    /** delay of the first retry in milliseconds, doubled for each next retry up to `max_backoff` */
+    uint64_t backoff;
+    uint64_t max_backoff;
+    /**
+     * duplicate of the request is sent if its response headers did not arrive within this many milliseconds,
+     * 0 disables hedging. First response is delivered, the other request is cancelled.
+     */
+    uint64_t hedge_delay;
+} tlsuv_http_retry_policy_t;
+
+typedef struct tlsuv_http_retry_stats_s {
+    uint64_t retries;
+    /** duplicate requests sent */
+    uint64_t hedges;
+    /** responses delivered by duplicate requests */
+    uint64_t hedges_won;
+} tlsuv_http_retry_stats_t;
+
 /**
  * @brief HTTP responce object passed into #um_http_resp_cb.
  */
@@ -100,6 +160,8 @@ struct tlsuv_http_resp_s {
 struct tlsuv_http_req_s {
 
     struct tlsuv_http_s *client;
+    /** connection request is active on, NULL while it is queued */
+    struct tlsuv_http_conn_s *conn;
     char *method;
     char *path;
     llhttp_t parser;
@@ -110,6 +172,54 @@ struct tlsuv_http_req_s {
     size_t body_sent_size;
     void *req_body;
     um_header_list req_headers;
+    /** storage of request and response headers, released with the request */
+    struct tlsuv_http_hdr_arena_s *hdr_arena;
+    /** body pulled on demand, @see tlsuv_http_req_body_file */
+    struct http_body_src_s *body_src;
+    /** response body destination, @see tlsuv_http_resp_sink */
+    struct http_body_sink_s *body_sink;
+    /** request body compression, @see tlsuv_http_req_compress */
+    struct http_req_enc_s *body_enc;
+    /** response cache state of GET request, @see tlsuv_http_cache */
+    struct http_cache_req_s *cache;
+    /** response headers kept by the request, client set is used if NULL */
+    struct http_hdr_filter_s *resp_filter;
+    tlsuv_http_hdr_cb resp_hdr_cb;
+
+    /** total and response inactivity timeouts, @see tlsuv_http_req_timeout */
+    tlsuv_timeout_t timeout;
+    tlsuv_timeout_t read_timeout;
+    uint64_t read_timeout_ms;
+
+    /** retry backoff, hedge delay, or wait for `100 Continue` */
+    tlsuv_timeout_t policy_timer;
+    unsigned int retries;
+    bool retry_wait;
+    bool hedged;
+    bool hedge_copy;
+    /** callbacks are dropped, request is cancelled after it lost to its duplicate */
+    bool muted;
+    /** other request of hedged pair */
+    struct tlsuv_http_req_s *hedge;
+    /** body is held until `100 Continue`, @see tlsuv_http_expect_continue */
+    bool expect_wait;
+
+    /** priority class and dispatch order of queued request, @see tlsuv_http_req_priority */
+    tlsuv_http_priority priority;
+    uint64_t prio_tag;
+
+    /**
+     * @brief allow sending request as TLS 1.3 early data (0-RTT) when connection resumes TLS session.
+     * Early data can be replayed, only set it for idempotent requests. Requests with body are never sent as early data.
+     */
+    bool early_data;
+
+    /**
+     * @brief optional callback receiving request phase timestamps, called with request `data` once request is completed or failed.
+     * Connection phases (resolve, connect, handshake) are only set for the request that caused connection to be established.
+     */
+    tlsuv_timing_cb timing_cb;
+    tlsuv_timing_t timing;
 
     /** @brief callback called after server has sent response headers. Called before #body_cb */
     tlsuv_http_resp_cb resp_cb;
@@ -123,6 +233,36 @@ struct tlsuv_http_req_s {
     STAILQ_ENTRY(tlsuv_http_req_s) _next;
 };
 
+/**
+ * @brief connection of HTTP client, with its own link chain and keep-alive state
+ */
+struct tlsuv_http_conn_s {
+    tlsuv_http_t *client;
+    int connected;
+    tlsuv_src_t *src;
+    bool host_change;
+
+    uv_link_t http_link;
+    /** size of next read buffer, adapts to recent reads */
+    struct tlsuv_read_sizer_s read_size;
+    tls_link_t tls_link;
+    tls_engine *engine;
+
+    /** connect, handshake, and idle timeout */
+    tlsuv_timeout_t conn_timer;
+    tlsuv_http_req_t *active;
+    /** requests written after active one, waiting for their responses in order */
+    STAILQ_HEAD(pipeline_q, tlsuv_http_req_s) pipeline;
+    size_t pipeline_count;
+    /** HTTP/2 session if "h2" was negotiated, requests are multiplexed instead of using active/pipeline */
+    struct tlsuv_h2_s *h2;
+    bool early_data_sent;
+    bool read_paused;
+    tlsuv_timing_t conn_timing;
+
+    LIST_ENTRY(tlsuv_http_conn_s) _next;
+};
+
 /**
  * @brief HTTP client struct
  */
@@ -130,27 +270,69 @@ struct tlsuv_http_s {
     char *host;
     char port[6];
     char *prefix;
-    bool host_change;
 
     bool ssl;
     tls_context *tls;
-    tls_engine *engine;
 
     um_header_list headers;
+    /** pre-rendered client headers, dropped when headers change */
+    struct http_hdr_block_s *hdr_block;
+    /** inflater of completed response, reused for the next compressed one */
+    tlsuv_http_inflater_t *inflater;
+    /** response cache, @see tlsuv_http_cache */
+    struct tlsuv_http_cache_s *cache;
+    /** response headers kept by requests, all if NULL */
+    struct http_hdr_filter_s *resp_filter;
 
-    int connected;
     tlsuv_src_t *src;
     bool own_src;
 
-    uv_link_t http_link;
-    tls_link_t tls_link;
-
     long connect_timeout;
     long idle_time;
-    uv_timer_t *conn_timer;
 
-    uv_async_t proc;
-    tlsuv_http_req_t *active;
+    uv_loop_t *loop;
+    /** loop scheduler, client is processed once per loop iteration after it was marked */
+    struct http_sched_s *sched;
+    TAILQ_ENTRY(tlsuv_http_s) _sched_next;
+    bool sched_queued;
+    /** client has pending requests and keeps loop alive */
+    bool sched_ref;
+    /** cross-thread wakeup and request submissions, @see tlsuv_http_req_submit */
+    struct http_remote_s *remote;
+    tlsuv_http_retry_policy_t retry;
+    tlsuv_http_retry_stats_t retry_stats;
+    /** requests waiting for retry backoff */
+    STAILQ_HEAD(retry_q, tlsuv_http_req_s) retry_q;
+    /** body size that is sent with `Expect: 100-continue`, and wait for interim response */
+    size_t expect_min_body;
+    uint64_t expect_timeout;
+    /** weighted fair queueing of non-urgent classes, @see tlsuv_http_priority_weight */
+    unsigned int prio_weight[TLSUV_HTTP_PRIO_COUNT];
+    uint64_t prio_finish[TLSUV_HTTP_PRIO_COUNT];
+    uint64_t prio_vtime;
+
+    /** idle connections limit of the origin if connections are shared, @see tlsuv_http_share_connections */
+    size_t share_max_idle;
+    LIST_ENTRY(tlsuv_http_s) _share_next;
+    bool closing;
+
+    /** first connection, uses client source link */
+    tlsuv_http_conn_t conn;
+    /** all connections including the first one */
+    LIST_HEAD(http_conns, tlsuv_http_conn_s) conns;
+    size_t conn_count;
+    size_t max_conns;
+    /** connections kept open ahead of requests, @see tlsuv_http_preconnect */
+    size_t warm_conns;
+    int warm_flags;
+    bool warm_pending;
+    bool warm_failed;
+    size_t pipeline_depth;
+    bool http2;
+    /** connection links that are still closing, client is released after them */
+    int closing_links;
+    bool proc_closed;
+
     STAILQ_HEAD(req_q, tlsuv_http_req_s) requests;
 
     void *data;
@@ -192,6 +374,26 @@ int tlsuv_http_init_with_src(uv_loop_t *l, tlsuv_http_t *clt, const char *url, t
  */
  int tlsuv_http_set_url(tlsuv_http_t *clt, const char *url);
 
+/**
+ * Sets addresses the client connects to, skipping name resolution.
+ * Host from the URL is still used for `Host` header, SNI, and certificate verification.
+ * Addresses are used for all new connections until cleared (`addr` = NULL) or replaced.
+ *
+ * @param clt client struct
+ * @param addr resolved addresses, each with the port set
+ * @return 0, or UV_EINVAL if client uses custom source link or addr has no usable address
+ */
+int tlsuv_http_set_addr(tlsuv_http_t *clt, const struct addrinfo *addr);
+
+/**
+ * Sets socket options used by client connections, kept across reconnects (@see tcp_src_sockopts_set).
+ *
+ * @param clt client struct
+ * @param opts socket options
+ * @return 0, or UV_EINVAL if client uses custom source link
+ */
+int tlsuv_http_sockopts(tlsuv_http_t *clt, const tcp_src_sockopts *opts);
+
 /**
  * @brief Set path prefix on the client.
  *
@@ -219,6 +421,7 @@ int tlsuv_http_idle_keepalive(tlsuv_http_t *clt, long millis);
  * \brief Set connect timeout.
  *
  * Sets the length of time client wait for connection to be established.
+ * The same timeout is applied to TLS handshake once connection is established.
  * Timeout of 0 will rely on system level timeout.
  * Note: if timeout is larger than system default it has no practical effect.
  * @param clt
@@ -227,6 +430,184 @@ int tlsuv_http_idle_keepalive(tlsuv_http_t *clt, long millis);
  */
 int tlsuv_http_connect_timeout(tlsuv_http_t *clt, long millis);
 
+/**
+ * \brief Set maximum number of connections.
+ *
+ * Queued requests are dispatched to any idle connection, new connections are opened (up to the limit)
+ * when all existing ones are busy. Each connection keeps its own keep-alive/idle state.
+ * Additional connections copy settings of the client TCP source, so custom source links only support one.
+ * @param clt
+ * @param max maximum number of connections, default is 1
+ * @return 0, UV_EINVAL if max is 0, or UV_ENOTSUP if client uses custom source link and max > 1
+ */
+int tlsuv_http_max_connections(tlsuv_http_t *clt, size_t max);
+
+/** warm connections are not closed by idle timeout */
+#define TLSUV_HTTP_PRECONNECT_KEEP 0x1
+/** warm connections closed by idle timeout or server are re-established */
+#define TLSUV_HTTP_PRECONNECT_RECONNECT 0x2
+
+/**
+ * \brief Open connections ahead of requests.
+ *
+ * Connects and handshakes up to `n` pooled connections (capped by #tlsuv_http_max_connections),
+ * so the first request does not wait for DNS, TCP and TLS. Connections that are being established
+ * are picked up by queued requests, like any other pool connection.
+ * Failed connect stops re-establishing until a connection succeeds again, or preconnect is called.
+ * @param clt
+ * @param n number of connections to keep open, 0 clears the setting
+ * @param flags TLSUV_HTTP_PRECONNECT_* options
+ * @return 0, or UV_EINVAL for unknown flags
+ */
+int tlsuv_http_preconnect(tlsuv_http_t *clt, size_t n, int flags);
+
+/**
+ * \brief Enable HTTP/2.
+ *
+ * Client offers "h2" (and "http/1.1") with ALPN, if server selects it all requests are multiplexed as streams
+ * over one connection, otherwise connection continues as HTTP/1.1. Responses report `http_version` "2" and empty status.
+ * Request pause/resume is not supported on HTTP/2 streams, and requests are never sent as early data.
+ * @param clt
+ * @param enable
+ * @return 0, UV_ENOTSUP if library was built without HTTP/2 support(TLSUV_HTTP2)
+ */
+int tlsuv_http_set_http2(tlsuv_http_t *clt, bool enable);
+
+/**
+ * \brief Enable HTTP/1.1 pipelining.
+ *
+ * When all connections are busy, up to `depth` idempotent requests without body (GET, OPTIONS, DELETE)
+ * are written back to back on one connection, responses are matched to requests in order.
+ * Pipelined requests that have not been answered when connection is lost are sent again.
+ * @param clt
+ * @param depth maximum number of requests in flight on a connection, 0 or 1 disables pipelining(default)
+ * @return 0 or error code
+ */
+int tlsuv_http_pipelining(tlsuv_http_t *clt, size_t depth);
+
+/**
+ * \brief Set response headers kept by client requests.
+ *
+ * Only listed headers are stored in response header list, others are dropped while response is parsed,
+ * headers used by the client itself (e.g. `Connection`, `Content-Encoding`, `Content-Length`) are always kept.
+ * @see tlsuv_http_req_resp_headers
+ * @param clt
+ * @param names NULL terminated array of header names, NULL to keep all headers (default)
+ * @return 0 or error code
+ */
+int tlsuv_http_resp_headers(tlsuv_http_t *clt, const char *const *names);
+
+/**
+ * \brief Enable in-memory response cache.
+ *
+ * Responses `200 OK` to GET requests are cached by request target, with decoded body, up to `max_size` bytes
+ * in total, least recently used entries are evicted first.
+ * Fresh entries (`Cache-Control: max-age`) answer requests without sending them, `resp_cb` and `body_cb`
+ * are called as with response from the network. Stale entries with `ETag` or `Last-Modified` are revalidated with
+ * `If-None-Match`/`If-Modified-Since`, and `304 Not Modified` response is delivered as cached `200` response.
+ * Responses with `no-store` or `Vary` other than `Accept-Encoding` are not cached. Requests with `Cache-Control: no-store`,
+ * `Range`, or conditional headers bypass the cache, request headers are not part of the cache key.
+ * Cache is cleared when client host is changed.
+ * @param clt
+ * @param max_size maximum cache size, 0 disables the cache and releases its entries
+ * @return 0 or error code
+ */
+int tlsuv_http_cache(tlsuv_http_t *clt, size_t max_size);
+
+/**
+ * Send HTTP/1.1 requests with body of at least `min_body` bytes, or with chunked body, with `Expect: 100-continue`.
+ * Body is held until server answers with `100 Continue`, or for `timeout` milliseconds if it does not.
+ * If final response (e.g. `401`, `413`, or redirect) arrives first, body is not sent, its chunks are released
+ * with `UV_ECANCELED`, and connection is closed after the response.
+ * @param clt client
+ * @param min_body smallest body size sent with expectation
+ * @param timeout wait for interim response in milliseconds, 0 disables expectations
+ * @return 0 or error code
+ */
+int tlsuv_http_expect_continue(tlsuv_http_t *clt, size_t min_body, uint64_t timeout);
+
+/**
+ * Set relative weight of priority class for requests of the client.
+ * Default weights of high, normal and bulk classes are 8, 4 and 1: while all three have requests queued,
+ * out of 13 requests dispatched 8 are high, 4 normal and 1 bulk. Urgent class is strict and has no weight.
+ * @param clt client
+ * @param prio priority class
+ * @param weight 1 to 256
+ * @return 0 or error code
+ */
+int tlsuv_http_priority_weight(tlsuv_http_t *clt, tlsuv_http_priority prio, unsigned int weight);
+
+/**
+ * Sets retry and hedging policy of client requests.
+ * Hedged request may be completed by its duplicate: callbacks get the duplicate request (with the same `data`),
+ * and the original request is released once response headers of the duplicate are received.
+ * @param clt client
+ * @param policy new policy, NULL disables retries and hedging
+ * @return 0 or error code
+ */
+int tlsuv_http_retry_policy(tlsuv_http_t *clt, const tlsuv_http_retry_policy_t *policy);
+
+int tlsuv_http_retry_stats(tlsuv_http_t *clt, tlsuv_http_retry_stats_t *stats);
+
+/**
+ * Shares idle keep-alive connections with other clients of the same loop that connect to the same origin
+ * (scheme, host, and port) with the same TLS context and HTTP/2 setting.
+ * Instead of opening a new connection client adopts idle connection of another sharing client,
+ * and idle connections of closing client are handed over to a sharing client that has room for them.
+ * Only clients created with #tlsuv_http_init can share connections.
+ * @param clt client
+ * @param max_idle limit of idle connections kept for the origin by all sharing clients, 0 stops sharing
+ * @return 0, or UV_ENOTSUP if client uses custom source
+ */
+int tlsuv_http_share_connections(tlsuv_http_t *clt, size_t max_idle);
+
+/**
+ * @brief Snapshot of TLS traffic counters of the client.
+ *
+ * Counters are summed over client connections, they accumulate over all connections made over each of them
+ * until its TLS engine is recreated (e.g. URL host change).
+ * @param clt
+ * @param stats (out) counters
+ * @return 0, or UV_ENOTSUP if client does not use TLS or TLS engine does not keep counters
+ */
+int tlsuv_http_stats(tlsuv_http_t *clt, tls_traffic_stats *stats);
+
+/**
+ * @brief Pauses delivery of response body of the active request by stopping connection reads.
+ *
+ * Body data already read from the connection may still be delivered to `body_cb`.
+ * Reading is resumed automatically when request completes or fails.
+ * @param req request
+ * @return 0, or UV_EINVAL if request is not the one currently receiving response
+ */
+int tlsuv_http_req_pause(tlsuv_http_req_t *req);
+
+/**
+ * @brief Resumes response body delivery paused with #tlsuv_http_req_pause.
+ * @param req request
+ * @return 0, or UV_EINVAL if request is not the one currently receiving response
+ */
+int tlsuv_http_req_resume(tlsuv_http_req_t *req);
+
+/**
+ * @brief Writes response body to a file instead of delivering it to `body_cb`.
+ *
+ * Call from the response callback. Connection reads are paused while more than `window` bytes
+ * are waiting to be written, see #tlsuv_http_req_pause. With HTTP/2 the streams share connection,
+ * reads are not paused for a single stream.
+ * If response has `Content-Length` and is not compressed, file space is preallocated where supported.
+ * The caller keeps `fd` open until `cb` is called.
+ * @param resp response
+ * @param fd file descriptor
+ * @param offset file offset to write body at
+ * @param window max bytes buffered for writing, 0 for default (1MB)
+ * @param cb called when body is written, or failed
+ * @param ctx passed to `cb`
+ * @return 0 or error code
+ */
+int tlsuv_http_resp_sink(tlsuv_http_resp_t *resp, uv_file fd, int64_t offset, size_t window,
+                         tlsuv_http_sink_cb cb, void *ctx);
+
 /**
  * @brief Set #tls_context on the client.
  *
@@ -276,6 +657,44 @@ tlsuv_http_req_t *tlsuv_http_req(tlsuv_http_t *clt, const char *method, const ch
  */
 int tlsuv_http_req_header(tlsuv_http_req_t *req, const char *name, const char *value);
 
+/**
+ * Set total timeout of the request, counted from this call. Request that is not completed in time
+ * fails with `UV_ETIMEDOUT` the same way as cancelled one (@see tlsuv_http_req_cancel).
+ * @param req
+ * @param millis timeout in milliseconds, 0 to clear it
+ * @return 0 or error code
+ */
+int tlsuv_http_req_timeout(tlsuv_http_req_t *req, uint64_t millis);
+
+/**
+ * Set response inactivity timeout of the request. Request fails with `UV_ETIMEDOUT` if no response data
+ * is received for `millis` after request is sent, or since the last received data.
+ * @param req
+ * @param millis timeout in milliseconds, 0 to clear it
+ * @return 0 or error code
+ */
+int tlsuv_http_req_read_timeout(tlsuv_http_req_t *req, uint64_t millis);
+
+/**
+ * Set priority class of the request, it can only be changed before request is sent.
+ * Queued urgent requests are dispatched first, other classes share connections by their weights
+ * (@see tlsuv_http_priority_weight), requests of the same class are dispatched in order.
+ * Priority also sets weight of HTTP/2 stream of the request.
+ * @param req
+ * @param prio priority class
+ * @return 0 or error code
+ */
+int tlsuv_http_req_priority(tlsuv_http_req_t *req, tlsuv_http_priority prio);
+
+/**
+ * Set response headers kept by the request, overriding client set (@see tlsuv_http_resp_headers).
+ * @param req
+ * @param names NULL terminated array of header names, or NULL to use client set
+ * @param hdr_cb optional callback receiving headers that are not kept
+ * @return 0 or error code
+ */
+int tlsuv_http_req_resp_headers(tlsuv_http_req_t *req, const char *const *names, tlsuv_http_hdr_cb hdr_cb);
+
 /**
  * Write request body. Could be called multiple times. @see tlsuv_http_req_end
  * @param req
@@ -286,6 +705,40 @@ int tlsuv_http_req_header(tlsuv_http_req_t *req, const char *name, const char *v
  */
 int tlsuv_http_req_data(tlsuv_http_req_t *req, const char *body, size_t bodylen, tlsuv_http_body_cb cb);
 
+/**
+ * Send request body from a file. Data is read on demand with bounded read-ahead, and sent with `sendfile()`
+ * when connection uses kernel TLS. The caller keeps `fd` open until request completes.
+ * Sets `Content-Length` header, cannot be combined with #tlsuv_http_req_data.
+ * @param req POST or PUT request
+ * @param fd file descriptor
+ * @param offset file offset of the body
+ * @param length body length
+ * @return 0 or error code
+ */
+int tlsuv_http_req_body_file(tlsuv_http_req_t *req, uv_file fd, int64_t offset, int64_t length);
+
+/**
+ * Send request body produced by a callback. The callback is called from the loop whenever there is room for
+ * more data, the number of buffers waiting to be written is bounded.
+ * Data in memory (e.g. a mapped region) can be sent with #tlsuv_http_req_data directly.
+ * @param req POST or PUT request
+ * @param length body length, or -1 to send it with chunked encoding
+ * @param read_cb generator callback
+ * @param ctx passed to `read_cb`
+ * @return 0 or error code
+ */
+int tlsuv_http_req_body_source(tlsuv_http_req_t *req, int64_t length, tlsuv_http_body_read_cb read_cb, void *ctx);
+
+/**
+ * Compress request body as it is sent. Sets `Content-Encoding` and chunked `Transfer-Encoding`,
+ * so body must be terminated with #tlsuv_http_req_end. Body chunks are released (their callback is called)
+ * once compressed data containing them is written.
+ * @param req request, before any body is sent
+ * @param encoding "gzip" or "zstd"
+ * @return 0, UV_ENOTSUP if encoding is not available, or UV_EINVAL if `Content-Length` was set
+ */
+int tlsuv_http_req_compress(tlsuv_http_req_t *req, const char *encoding);
+
 /**
  * Indicate the end of the request body. Only needed if `Transfer-Encoding` header was set to `chunked`
  * @param req
@@ -310,6 +763,75 @@ int tlsuv_http_req_cancel(tlsuv_http_t *clt, tlsuv_http_req_t *req);
  */
 int tlsuv_http_cancel_all(tlsuv_http_t *clt);
 
+/**
+ * Result of request submitted with #tlsuv_http_req_submit, owned by the receiver, release it with #tlsuv_http_result_free.
+ */
+typedef struct tlsuv_http_result_s {
+    /** HTTP status code, or error code (<0) if request failed */
+    int code;
+    char *status;
+    um_header_list headers;
+    char *body;
+    size_t body_len;
+    /** submission context */
+    void *ctx;
+} tlsuv_http_result_t;
+
+typedef void (*tlsuv_http_result_cb)(tlsuv_http_result_t *res);
+
+typedef struct tlsuv_http_reply_q_s tlsuv_http_reply_q_t;
+
+/**
+ * Request submitted from any thread, it is copied by #tlsuv_http_req_submit.
+ */
+typedef struct tlsuv_http_submit_s {
+    const char *method;
+    const char *path;
+    /** request headers as NULL terminated list of name/value pairs, may be NULL */
+    const char *const *headers;
+    const char *body;
+    size_t body_len;
+    /** request timeout in milliseconds, 0 for none */
+    uint64_t timeout;
+    tlsuv_http_priority priority;
+    /** completion callback, called on loop thread unless result is posted to `reply_q` */
+    tlsuv_http_result_cb cb;
+    tlsuv_http_reply_q_t *reply_q;
+    void *ctx;
+} tlsuv_http_submit_t;
+
+/**
+ * Submits request from any thread, without locking.
+ * Request is started on the loop thread of the client, its result is passed to `sub->cb` on the loop thread,
+ * or pushed to `sub->reply_q`. Client must not be closed while submissions are in flight;
+ * requests submitted before #tlsuv_http_close are completed with UV_ECANCELED.
+ * @param clt client
+ * @param sub request
+ * @return 0, or error code
+ */
+int tlsuv_http_req_submit(tlsuv_http_t *clt, const tlsuv_http_submit_t *sub);
+
+const char *tlsuv_http_result_header(tlsuv_http_result_t *res, const char *name);
+
+void tlsuv_http_result_free(tlsuv_http_result_t *res);
+
+/**
+ * Creates queue receiving results of submitted requests on the consumer thread.
+ * @param notify called on the loop thread after result was pushed to the queue, may be NULL
+ * @param ctx passed to `notify`
+ */
+tlsuv_http_reply_q_t *tlsuv_http_reply_q_new(void (*notify)(void *ctx), void *ctx);
+
+/**
+ * Takes next result from the queue, or returns NULL if it is empty. Only one thread can pop from the queue.
+ */
+tlsuv_http_result_t *tlsuv_http_reply_q_pop(tlsuv_http_reply_q_t *q);
+
+/**
+ * Frees queue and results left in it, no request posting to the queue may be in flight.
+ */
+void tlsuv_http_reply_q_free(tlsuv_http_reply_q_t *q);
+
 /**
  * @brief return response header
  * @param resp HTTP response
@@ -0,0 +1,89 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * @file http_group.h
+ * @brief HTTP client sharded across loop threads
+ *
+ * Group owns N loop threads, each running its own #tlsuv_http_t with its own connections and TLS context.
+ * Requests are submitted from any thread (@see tlsuv_http_req_submit) and are sent by one of the shards,
+ * picked by key affinity or by the least number of outstanding requests.
+ */
+
+#ifndef TLSUV_HTTP_GROUP_H
+#define TLSUV_HTTP_GROUP_H
+
+#include "http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tlsuv_http_group_s tlsuv_http_group_t;
+
+typedef struct tlsuv_http_group_opts_s {
+    /** origin of all requests, same as for #tlsuv_http_init */
+    const char *url;
+    /** number of loop threads, number of CPUs if 0 */
+    unsigned int shards;
+    /** creates TLS context of a shard, `default_tls_context(NULL, 0)` is used if not set */
+    tls_context *(*new_tls)(void *ctx);
+    void *tls_ctx;
+    /** connection limit of each shard, client default if 0 */
+    size_t max_connections;
+    bool http2;
+} tlsuv_http_group_opts_t;
+
+typedef struct tlsuv_http_group_stats_s {
+    unsigned int shards;
+    uint64_t submitted;
+    uint64_t completed;
+    /** completed requests with error code */
+    uint64_t failed;
+    uint64_t outstanding;
+    /** TLS counters of open connections of all shards, sampled when requests complete */
+    tls_traffic_stats traffic;
+} tlsuv_http_group_stats_t;
+
+/**
+ * Creates group and starts its loop threads.
+ * @return group, or NULL if it could not be started
+ */
+tlsuv_http_group_t *tlsuv_http_group_new(const tlsuv_http_group_opts_t *opts);
+
+/**
+ * Submits request from any thread.
+ * Requests with the same `key` go to the same shard (and its connections), requests without key go to the shard
+ * with the least outstanding requests. Result is delivered on the loop thread of the shard, or to `sub->reply_q`.
+ * @return 0, or error code
+ */
+int tlsuv_http_group_submit(tlsuv_http_group_t *g, const char *key, const tlsuv_http_submit_t *sub);
+
+/**
+ * Aggregates counters of all shards, can be called from any thread.
+ */
+int tlsuv_http_group_stats(tlsuv_http_group_t *g, tlsuv_http_group_stats_t *stats);
+
+/**
+ * Stops loop threads and frees the group. Requests in flight are completed with UV_ECANCELED.
+ * Must not be called from a loop thread of the group.
+ */
+void tlsuv_http_group_free(tlsuv_http_group_t *g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TLSUV_HTTP_GROUP_H
@@ -0,0 +1,59 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * @file pipe_src.h
+ * @brief source link over Unix domain socket (or Windows named pipe)
+ *
+ * Can be used with `tlsuv_http_init_with_src()` and `tlsuv_websocket_init_with_src()` to reach local services
+ * without going through loopback TCP. Host from the URL is still used for `Host` header and TLS (SNI, verification).
+ * `http://` URLs give plain HTTP-over-UDS for unencrypted local APIs.
+ */
+
+#ifndef TLSUV_PIPE_SRC_H
+#define TLSUV_PIPE_SRC_H
+
+#include "src_t.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Inherits from `tlsuv_src_t`, connects to local socket/pipe.
+ */
+typedef struct pipe_src_s {
+    tlsuv_SRC_FIELDS
+    char *path;
+    uv_connect_t *conn_req;
+    uv_pipe_t *pipe;
+} pipe_src_t;
+
+/**
+ * Initialize a `pipe_src_t` handle
+ *
+ * @param l the uv loop
+ * @param ps the pipe source to initialize
+ * @param path socket path or pipe name, NULL to use host passed to connect as the path
+ */
+int pipe_src_init(uv_loop_t *l, pipe_src_t *ps, const char *path);
+
+void pipe_src_free(pipe_src_t *ps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_PIPE_SRC_H
@@ -0,0 +1,135 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * @file proxy_src.h
+ * @brief source link that tunnels connections through HTTP (CONNECT) or SOCKS5 proxy
+ *
+ * Can be used with `tlsuv_http_init_with_src()` and `tlsuv_websocket_init_with_src()`.
+ * Host and port passed to connect are the tunnel target, upper layers still use them for `Host` header
+ * and TLS (SNI, verification) with the target.
+ *
+ * Proxy endpoint (`tlsuv_proxy_t`) can be shared by many sources on the same loop. It keeps spare proxy connections:
+ * connections whose CONNECT was rejected without closing them, and connections that were still being established
+ * when their source gave up (e.g. connect timeout). Next connect of any source takes a spare connection instead of
+ * connecting to the proxy again, so that reconnect storms do not multiply proxy connections and handshakes.
+ * Tunnel request is sent as soon as proxy connection is up, SOCKS5 greeting, authentication, and request are sent
+ * together without waiting for each reply.
+ */
+
+#ifndef TLSUV_PROXY_SRC_H
+#define TLSUV_PROXY_SRC_H
+
+#include "src_t.h"
+#include "tls_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    tlsuv_PROXY_HTTP,
+    tlsuv_PROXY_SOCKS5,
+} tlsuv_proxy_type;
+
+typedef struct tlsuv_proxy_s tlsuv_proxy_t;
+
+typedef struct tlsuv_proxy_stats_s {
+    /** connections made to the proxy */
+    uint64_t connects;
+    /** tunnel requests sent over spare connections */
+    uint64_t reused;
+    /** established tunnels */
+    uint64_t tunnels;
+    /** tunnel requests rejected by the proxy or failed */
+    uint64_t failures;
+    /** spare connections currently kept */
+    size_t idle;
+} tlsuv_proxy_stats;
+
+/**
+ * Inherits from `tlsuv_src_t`, connects to its target through the proxy.
+ */
+typedef struct proxy_src_s {
+    tlsuv_SRC_FIELDS
+    tlsuv_proxy_t *proxy;
+    struct proxy_conn_s *conn;
+    char *target_host;
+    char *target_port;
+} proxy_src_t;
+
+/**
+ * Creates proxy endpoint.
+ *
+ * @param loop the uv loop, all sources using the proxy must be on this loop
+ * @param type proxy protocol
+ * @param host proxy host
+ * @param port proxy port
+ * @returns proxy, or NULL if arguments are invalid
+ */
+tlsuv_proxy_t *tlsuv_proxy_new(uv_loop_t *loop, tlsuv_proxy_type type, const char *host, const char *port);
+
+/**
+ * Connections to the proxy are made over TLS (HTTPS proxy).
+ * Proxy host is used for SNI and certificate verification.
+ *
+ * @param proxy proxy endpoint
+ * @param tls TLS context, not owned by the proxy, NULL for plain TCP
+ * @returns 0, or UV_EINVAL for SOCKS5 proxy
+ */
+int tlsuv_proxy_tls(tlsuv_proxy_t *proxy, tls_context *tls);
+
+/**
+ * Sets proxy credentials: `Proxy-Authorization: Basic` for HTTP, username/password (RFC 1929) for SOCKS5.
+ *
+ * @param proxy proxy endpoint
+ * @param user username, NULL clears credentials
+ * @param pass password
+ */
+int tlsuv_proxy_auth(tlsuv_proxy_t *proxy, const char *user, const char *pass);
+
+/**
+ * Sets limits for spare proxy connections.
+ *
+ * @param proxy proxy endpoint
+ * @param max_idle number of spare connections kept (default 4), 0 disables reuse
+ * @param idle_timeout_ms established spare connection is closed after this much time without use (default 30s)
+ */
+int tlsuv_proxy_idle(tlsuv_proxy_t *proxy, size_t max_idle, unsigned int idle_timeout_ms);
+
+int tlsuv_proxy_get_stats(const tlsuv_proxy_t *proxy, tlsuv_proxy_stats *stats);
+
+/**
+ * Releases proxy endpoint, spare connections are closed.
+ * Endpoint memory is kept until all sources using it are freed.
+ */
+void tlsuv_proxy_free(tlsuv_proxy_t *proxy);
+
+/**
+ * Initialize a `proxy_src_t` handle
+ *
+ * @param l the uv loop
+ * @param ps the proxy source to initialize
+ * @param proxy proxy endpoint, referenced until `proxy_src_free()`
+ */
+int proxy_src_init(uv_loop_t *l, proxy_src_t *ps, tlsuv_proxy_t *proxy);
+
+void proxy_src_free(proxy_src_t *ps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_PROXY_SRC_H
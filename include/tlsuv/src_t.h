@@ -22,6 +22,7 @@
 #define TLSUV_SRC_T_H
 
 #include <uv_link_t.h>
+#include "timing.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,7 +45,8 @@ typedef void (*tlsuv_src_release_t)(tlsuv_src_t *sl);
     tlsuv_src_connect_t connect;     \
     tlsuv_src_connect_cb connect_cb; \
     tlsuv_src_cancel_t cancel;       \
-    tlsuv_src_release_t release;
+    tlsuv_src_release_t release;     \
+    tlsuv_timing_t *timing; /* optional, receives resolve/connect marks */
 
 
 struct tlsuv_src_s {
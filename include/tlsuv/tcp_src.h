@@ -27,16 +27,41 @@
 extern "C" {
 #endif
 
+/**
+ * Socket options applied to every connection made by `tcp_src_t`.
+ * Zero value in any field leaves system default for that option.
+ */
+typedef struct tcp_src_sockopts_s {
+    /** SO_SNDBUF (bytes), set before connect so that window scaling can use it */
+    int send_buffer;
+    /** SO_RCVBUF (bytes), set before connect so that window scaling can use it */
+    int recv_buffer;
+    /** TCP_NOTSENT_LOWAT (bytes), limits unsent data queued in the kernel */
+    int notsent_lowat;
+    /** SO_BUSY_POLL (microseconds), Linux only */
+    int busy_poll;
+    /** IP_TOS/IPV6_TCLASS, DSCP value shifted left by two bits */
+    int tos;
+    /** TCP_USER_TIMEOUT (milliseconds), Linux only */
+    unsigned int user_timeout;
+} tcp_src_sockopts;
+
 /**
  * Inherits from um_http_source_t and is used to register source link for `um_http`.
  */
 typedef struct tcp_src_s {
     tlsuv_SRC_FIELDS
             uv_getaddrinfo_t *resolve_req;
-    uv_connect_t *conn_req;
+    uv_link_source_t source;
+    struct tcp_race_s *race;
     uv_tcp_t *conn;
     unsigned int keepalive;
     int nodelay:1;
+    int fast_open;
+    unsigned int attempt_delay;
+    tcp_src_sockopts sockopts;
+    struct sockaddr_storage *addrs;
+    size_t addr_count;
 } tcp_src_t;
 
 /**
@@ -51,8 +76,90 @@ int tcp_src_nodelay(tcp_src_t *ts, int val);
 
 int tcp_src_keepalive(tcp_src_t *ts, int on, unsigned int val);
 
+/**
+ * Sets socket options for current connection (if any) and all subsequent connects.
+ * Options that are not supported by the platform are skipped.
+ *
+ * @param ts tcp source
+ * @param opts socket options, copied
+ * @returns 0, or error setting options on current connection
+ */
+int tcp_src_sockopts_set(tcp_src_t *ts, const tcp_src_sockopts *opts);
+
+/**
+ * Sets delay between staggered connection attempts (Happy Eyeballs, RFC 8305).
+ * Resolved addresses are tried alternating address families, next attempt starts
+ * when previous one fails or the delay passes, first established connection wins.
+ *
+ * @param ts tcp source
+ * @param delay_ms delay in milliseconds, 0 restores default (250ms)
+ */
+int tcp_src_attempt_delay(tcp_src_t *ts, unsigned int delay_ms);
+
+/**
+ * Enables TCP Fast Open (Linux, TCP_FASTOPEN_CONNECT) for subsequent connects.
+ * Connect completes without waiting for SYN-ACK and the first write (TLS ClientHello) is sent with SYN.
+ * Kernel falls back to regular handshake if peer has no TFO cookie or does not support it.
+ * Since TFO connect completes immediately it cannot be raced (@see tcp_src_attempt_delay),
+ * so it is only used when there is a single address to connect to.
+ * If host resolves to multiple addresses, attempts use regular handshake.
+ *
+ * @param ts tcp source
+ * @param on 1 to enable, 0 to disable
+ * @returns 0, or UV_ENOTSUP if platform does not support it
+ */
+int tcp_src_fast_open(tcp_src_t *ts, int on);
+
+/**
+ * Reports whether data sent with SYN was accepted by the peer on current connection.
+ * @returns 1 if TFO was used, 0 if it was not, UV_ENOTCONN, or UV_ENOTSUP
+ */
+int tcp_src_fast_open_used(tcp_src_t *ts);
+
+/**
+ * Sets addresses to connect to, skipping name resolution.
+ * Host name passed to connect is still used by upper layers (e.g. for SNI and certificate verification).
+ * Addresses stay in effect for all subsequent connects until cleared or replaced.
+ *
+ * @param ts tcp source
+ * @param addr resolved addresses (with ports), NULL to resolve host on connect again
+ * @returns 0, or UV_EINVAL if addr does not contain any IPv4/IPv6 address
+ */
+int tcp_src_set_addr(tcp_src_t *ts, const struct addrinfo *addr);
+
+/**
+ * Takes pending connection from a listening socket, replacing current connection (if any).
+ * Keepalive, nodelay and socket options of the source are applied to accepted connection.
+ *
+ * @param ts tcp source
+ * @param server listening TCP handle
+ * @returns 0, or error from uv_accept (UV_EAGAIN if there is no pending connection)
+ */
+int tcp_src_accept(tcp_src_t *ts, uv_stream_t *server);
+
 void tcp_src_free(tcp_src_t *ts);
 
+/**
+ * Enables resolver cache shared by all `tcp_src_t` handles on the loop.
+ * Cached addresses are reused by reconnects instead of resolving the host again.
+ * The cache must be disabled (ttl = 0) before the loop is closed.
+ *
+ * @param loop the uv loop
+ * @param ttl seconds successful results are served from cache, 0 disables and frees the cache
+ * @param negative_ttl seconds resolver failures are cached, 0 does not cache failures
+ * @param stale_ttl seconds expired results are still served while being refreshed in background
+ */
+int tcp_src_dns_cache(uv_loop_t *loop, unsigned int ttl, unsigned int negative_ttl, unsigned int stale_ttl);
+
+/**
+ * Drops cached failures and refreshes cached addresses in background.
+ *
+ * @param loop the uv loop
+ * @param host host to refresh, NULL for all entries
+ * @returns 0 or UV_EINVAL if resolver cache is not enabled on the loop
+ */
+int tcp_src_dns_refresh(uv_loop_t *loop, const char *host);
+
 #ifdef __cplusplus
 }
 #endif
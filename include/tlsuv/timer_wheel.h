@@ -0,0 +1,86 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @file timer_wheel.h
+ * @brief loop-wide timeouts with O(1) start and stop
+ *
+ * Timeouts of a loop share one hierarchical timer wheel driven by a single libuv timer,
+ * so that large number of connections and requests does not grow libuv timer heap.
+ * Resolution is one millisecond of loop time (`uv_now()`). Like unref'ed libuv timers,
+ * active timeouts do not keep the loop alive.
+ */
+
+#ifndef TLSUV_TIMER_WHEEL_H
+#define TLSUV_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tlsuv_timeout_s tlsuv_timeout_t;
+
+typedef void (*tlsuv_timeout_cb)(tlsuv_timeout_t *t);
+
+struct tlsuv_timeout_s {
+    /** user data */
+    void *data;
+
+    /* private fields */
+    struct tlsuv_wheel_s *wheel;
+    tlsuv_timeout_cb cb;
+    // loop time (ms) when timeout fires
+    uint64_t expires;
+    bool active;
+    uint8_t level;
+    uint8_t slot;
+    LIST_ENTRY(tlsuv_timeout_s) _next;
+};
+
+/**
+ * Initialize timeout on the loop wheel, wheel is created with the first timeout of the loop.
+ * @return 0 or error code
+ */
+int tlsuv_timeout_init(uv_loop_t *loop, tlsuv_timeout_t *t);
+
+/**
+ * Start (or restart) timeout, `cb` is called once after `millis` milliseconds.
+ * @return 0, or UV_EINVAL if timeout is not initialized or closed
+ */
+int tlsuv_timeout_start(tlsuv_timeout_t *t, tlsuv_timeout_cb cb, uint64_t millis);
+
+/**
+ * Stop timeout, safe to call on inactive, closed, or zeroed timeout.
+ */
+void tlsuv_timeout_stop(tlsuv_timeout_t *t);
+
+bool tlsuv_timeout_active(const tlsuv_timeout_t *t);
+
+/**
+ * Stop timeout and release its wheel reference, wheel of the loop is closed with its last timeout.
+ * Safe to call on zeroed timeout.
+ */
+void tlsuv_timeout_close(tlsuv_timeout_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_TIMER_WHEEL_H
@@ -0,0 +1,61 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * @file timing.h
+ * @brief connection and request phase timestamps
+ *
+ */
+
+#ifndef TLSUV_TIMING_H
+#define TLSUV_TIMING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TLSUV_TIMING_MAX_FLIGHTS 8
+
+/**
+ * Phase timestamps in `uv_hrtime()` nanoseconds, zero if phase did not happen (e.g. reused connection).
+ */
+typedef struct tlsuv_timing_s {
+    uint64_t resolve_start;
+    uint64_t resolve_end;
+    uint64_t connect_end;
+
+    /**
+     * @brief time handshake data from peer was received, before it was processed.
+     * One mark per read, so a flight split across reads gets several marks.
+     * Own flights (e.g. ClientHello) are not marked.
+     */
+    uint64_t hs_flights[TLSUV_TIMING_MAX_FLIGHTS];
+    int hs_flight_count;
+    uint64_t hs_complete;
+
+    uint64_t req_written;
+    uint64_t first_byte;
+    uint64_t body_complete;
+} tlsuv_timing_t;
+
+typedef void (*tlsuv_timing_cb)(const tlsuv_timing_t *timing, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_TIMING_H
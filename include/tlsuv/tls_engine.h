@@ -17,6 +17,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <uv.h>
 
 #if _WIN32
 #pragma comment (lib, "crypt32.lib")
@@ -42,12 +44,41 @@ enum TLS_RESULT {
     TLS_HAS_WRITE = -5,
 };
 
+typedef enum tls_early_data_st {
+    TLS_EARLY_DATA_NONE,
+    TLS_EARLY_DATA_ACCEPTED,
+    TLS_EARLY_DATA_REJECTED,
+} tls_early_data_status;
+
 enum hash_algo {
     hash_SHA256,
     hash_SHA384,
     hash_SHA512
 };
 
+/**
+ * TLS traffic counters.
+ */
+typedef struct tls_traffic_stats_s {
+    /** application bytes received and sent */
+    uint64_t plain_in;
+    uint64_t plain_out;
+    /** TLS bytes received and sent, including handshake */
+    uint64_t cipher_in;
+    uint64_t cipher_out;
+    /** TLS records received and sent */
+    unsigned long records_in;
+    unsigned long records_out;
+    unsigned long handshakes;
+    unsigned long handshake_failures;
+    /** handshakes that resumed cached session */
+    unsigned long resumptions;
+    /** reads that produced TLS data for the peer(TLS_HAS_WRITE) */
+    unsigned long has_write;
+    /** buffers allocated for TLS data */
+    unsigned long buffer_allocs;
+} tls_traffic_stats;
+
 typedef struct {
 
     tls_handshake_state (*handshake_state)(void *engine);
@@ -107,6 +138,96 @@ typedef struct {
      * @param engine
      */
     int (*reset)(void *engine);
+
+    /**
+     * (Optional) wraps application data from all input buffers in a single pass.
+     * Small buffers are coalesced into shared records.
+     * Produced TLS records are placed into output segments, segments are filled in order.
+     * @param engine
+     * @param bufs application data
+     * @param nbufs number of input buffers
+     * @param out output segments, on input `len` of each segment is its capacity, on return number of bytes placed in it
+     * @param nout (in/out) number of output segments available/used
+     * @returns number of bytes that did not fit into output segments (still pending in the engine), or error code
+     */
+    int (*write_vec)(void *engine, const uv_buf_t *bufs, unsigned int nbufs, uv_buf_t *out, unsigned int *nout);
+
+    /**
+     * (Optional) Queues application data to be sent as TLS 1.3 early data (0-RTT) with the first handshake flight.
+     *
+     * Early data can only be used when resuming a session that permits it, and it can be replayed by an attacker,
+     * so it should only carry idempotent requests. Must be called before handshake is started.
+     * Data is queued whole or not at all.
+     * @param engine
+     * @param data application data
+     * @param len length of data
+     * @returns `len` if data was queued, 0 if early data cannot be used on this connection, or error code
+     */
+    int (*write_early_data)(void *engine, const char *data, size_t len);
+
+    /**
+     * (Optional) Outcome of early data, valid after handshake is complete.
+     * Data that was not accepted by the peer has to be sent again.
+     * @param engine
+     */
+    tls_early_data_status (*early_data_status)(void *engine);
+
+    /**
+     * (Optional) Hands encryption of outbound records over to the kernel (kTLS).
+     * Must be called after handshake is complete, before any application data is written.
+     * On success application data is written to the socket as is, and engine is only used for reading.
+     * @param engine
+     * @param fd connected socket
+     * @returns 0 on success, UV_ENOTSUP if not possible on this connection
+     */
+    int (*ktls_tx)(void *engine, uv_os_fd_t fd);
+
+    /**
+     * (Optional) Checks if handshake() may be called from a worker thread.
+     * Caller guarantees that no other engine method is called while such handshake step is in progress.
+     * @param engine
+     * @returns non-zero if handshake steps can be offloaded
+     */
+    int (*async_handshake)(void *engine);
+
+    /**
+     * (Optional) Traffic counters of this engine. Engine counts resumptions,
+     * tls_link(if used) counts the rest. Counters are kept over reset().
+     * @param engine
+     * @returns counters owned by the engine
+     */
+    tls_traffic_stats *(*stats)(void *engine);
+
+    /**
+     * (Optional) Checks if links should release their buffers as soon as they are idle.
+     * @param engine
+     * @returns non-zero if context is in idle-lean mode
+     */
+    int (*idle_lean)(void *engine);
+
+    /**
+     * (Optional) Approximate memory held by engine buffers (I/O buffers and TLS record buffers).
+     * @param engine
+     * @returns bytes
+     */
+    size_t (*mem_usage)(void *engine);
+
+    /**
+     * (Optional) Overrides ALPN protocols offered by this engine, must be called before handshake.
+     * @param engine
+     * @param protocols protocol names in order of preference
+     * @param len number of protocols
+     * @returns 0 or error code
+     */
+    int (*set_protocols)(void *engine, const char **protocols, int len);
+
+    /**
+     * (Optional) Checks if read() and write_vec() of established connection may be called from a worker thread.
+     * Caller guarantees that no other engine method is called while such call is in progress.
+     * @param engine
+     * @returns non-zero if bulk record encryption/decryption can be offloaded
+     */
+    int (*async_crypto)(void *engine);
 } tls_engine_api;
 
 typedef struct {
@@ -114,7 +235,106 @@ typedef struct {
     tls_engine_api *api;
 } tls_engine;
 
+/**
+ * TLS session resumption cache counters.
+ */
+typedef struct tls_session_stats_s {
+    /** handshakes that offered cached session */
+    unsigned long hits;
+    /** handshakes that started without cached session */
+    unsigned long misses;
+    /** sessions dropped to make room for new ones */
+    unsigned long evictions;
+    /** sessions currently cached */
+    size_t entries;
+} tls_session_stats;
+
+/**
+ * Dynamic TLS record sizing.
+ *
+ * New (or idle) connections send small records that fit into a single TCP segment,
+ * so the peer can start decrypting before whole 16K record arrives.
+ * Once enough data is sent engine switches to full size records for throughput.
+ */
+typedef struct tls_record_sizing_s {
+    /** max payload of records sent during warm-up, 0 disables dynamic sizing */
+    size_t small_record;
+    /** bytes sent in small records before switching to full size records */
+    size_t ramp_bytes;
+    /** idle period (milliseconds) after which engine goes back to small records, 0 never */
+    unsigned int idle_ms;
+} tls_record_sizing;
+
+#define TLS_RECORD_SIZING_DEFAULT { 1369, 1024 * 1024, 1000 }
+
+/**
+ * OCSP revocation checking of peer certificate (client side).
+ */
+typedef enum {
+    /** no revocation checking */
+    TLS_OCSP_OFF,
+    /** peer is rejected only if its certificate is reported revoked */
+    TLS_OCSP_SOFT_FAIL,
+    /** handshake fails unless certificate status is confirmed to be good */
+    TLS_OCSP_REQUIRE,
+} tls_ocsp_mode;
+
+/**
+ * Fetches OCSP response for a peer that did not staple one.
+ * Called during handshake, only if no cached response is valid.
+ * The callback is synchronous: handshake is suspended until it returns with the response (or error).
+ * It runs on the thread that drives the handshake: the loop thread, which is blocked while fetching,
+ * or a libuv threadpool worker if async handshake is enabled (@see tls_context::set_async_handshake).
+ * In the latter case it may be called concurrently for different connections, and must not use the loop.
+ * @param url responder URL from certificate's AIA extension, NULL if certificate does not have one
+ * @param req DER encoded OCSP request
+ * @param req_len request length
+ * @param resp (out) DER encoded OCSP response, allocated with malloc(), released by engine
+ * @param resp_len (out) response length
+ * @param fetch_ctx context from #tls_ocsp_config
+ * @returns 0 on success
+ */
+typedef int (*tls_ocsp_fetch_f)(const char *url, const uint8_t *req, size_t req_len,
+                                uint8_t **resp, size_t *resp_len, void *fetch_ctx);
+
+typedef struct tls_ocsp_config_s {
+    tls_ocsp_mode mode;
+    /** validated responses kept per context, keyed by certificate ID, 0 disables caching */
+    size_t cache_size;
+    /** max seconds to keep validated response, 0 - until its nextUpdate. Responses without nextUpdate are kept for max_age */
+    unsigned int max_age;
+    /** (optional) fetches response when peer did not staple it */
+    tls_ocsp_fetch_f fetch;
+    void *fetch_ctx;
+} tls_ocsp_config;
+
+/**
+ * Cipher suite and key exchange group preference presets.
+ */
+typedef enum tls_cipher_profile_e {
+    /** TLS library defaults */
+    TLS_CIPHERS_DEFAULT,
+    /** AES-GCM first if CPU has AES instructions, ChaCha20-Poly1305 first otherwise */
+    TLS_CIPHERS_AUTO,
+    /** AES-GCM first, for CPUs with AES instructions */
+    TLS_CIPHERS_THROUGHPUT,
+    /** ChaCha20-Poly1305 and X25519 first, for CPUs without crypto extensions */
+    TLS_CIPHERS_LOW_CPU,
+    /** wide set of suites and groups, for older peers */
+    TLS_CIPHERS_COMPAT,
+} tls_cipher_profile;
+
 typedef struct tls_context_s tls_context;
+/**
+ * Signature to check with #tlsuv_public_key_s verify_many()
+ */
+typedef struct tlsuv_verify_item_s {
+    const char *data;
+    size_t datalen;
+    const char *sig;
+    size_t siglen;
+} tlsuv_verify_item;
+
 typedef struct tlsuv_public_key_s *tlsuv_public_key_t;
 typedef struct tlsuv_private_key_s *tlsuv_private_key_t;
 typedef void *tls_cert;
@@ -123,7 +343,11 @@ typedef void *tls_cert;
     void (*free)(struct tlsuv_public_key_s * pubkey);                              \
     int (*to_pem)(struct tlsuv_public_key_s * pubkey, char **pem, size_t *pemlen); \
     int (*verify)(struct tlsuv_public_key_s * pubkey, enum hash_algo md,           \
-                  const char *data, size_t datalen, const char *sig, size_t siglen);
+                  const char *data, size_t datalen, const char *sig, size_t siglen); \
+    /* verifies batch of signatures, results[i] is set like verify() result of item i, \
+       returns 0 if all signatures are valid, -1 otherwise */                      \
+    int (*verify_many)(struct tlsuv_public_key_s * pubkey, enum hash_algo md,      \
+                       const tlsuv_verify_item *items, size_t count, int *results);
 
 #define TLSUV_PRIVKEY_API                                                            \
     void (*free)(struct tlsuv_private_key_s * privkey);                              \
@@ -132,7 +356,8 @@ typedef void *tls_cert;
     struct tlsuv_public_key_s *(*pubkey)(struct tlsuv_private_key_s * privkey);      \
     int (*to_pem)(struct tlsuv_private_key_s * privkey, char **pem, size_t *pemlen); \
     int (*get_certificate)(struct tlsuv_private_key_s * privkey, tls_cert * cert);   \
-    int (*store_certificate)(struct tlsuv_private_key_s *privkey, tls_cert cert);
+    int (*store_certificate)(struct tlsuv_private_key_s *privkey, tls_cert cert);    \
+    int (*refresh)(struct tlsuv_private_key_s * privkey);
 
 struct tlsuv_public_key_s {
     TLSUV_PUBKEY_API
@@ -173,6 +398,8 @@ typedef struct {
      *
      * certificate handle passed into verification callback can be used to verify signature by calling verify_signature()
      * callback function must return 0 for success, and any other value for failure
+     * callback is called during handshake, on libuv threadpool if async handshake is enabled
+     * (it may then run concurrently for different connections and must not use the loop)
      * @param ctx TLS implementation
      * @param verify_f verification callback, receives opaque(implementation specific) certificate handle and custom data
      * @param v_ctx custom data passed into verification callback
@@ -271,8 +498,154 @@ typedef struct {
      */
      const char *(*version)();
 
+    /**
+     * (Optional) Get session resumption cache statistics.
+     *
+     * TLS context caches sessions (including TLS 1.3 tickets) by host and ALPN protocols,
+     * so that new engines created for the same host attempt abbreviated handshake.
+     * @param ctx TLS context
+     * @param stats (out) cache counters
+     */
+    void (*get_session_stats)(tls_context *ctx, tls_session_stats *stats);
+
+    /**
+     * (Optional) Sets I/O buffering mode for engines created after this call.
+     *
+     * With non-zero capacity engines use fixed size ring buffers for TLS data instead of growable memory buffers,
+     * and inbound data is consumed directly from caller buffers. Ring only grows if a single TLS record does not fit.
+     * @param ctx TLS context
+     * @param capacity per direction buffer size, 0 restores default mode
+     * @returns 0 on success, or error code
+     */
+    int (*set_io_buffer)(tls_context *ctx, size_t capacity);
+
+    /**
+     * (Optional) Enables dynamic record sizing for engines created after this call.
+     * @param ctx TLS context
+     * @param sizing record sizing thresholds, NULL disables (all writes use full size records)
+     * @returns 0 on success, or error code
+     */
+    int (*set_record_sizing)(tls_context *ctx, const tls_record_sizing *sizing);
+
+    /**
+     * (Optional) Allows engines to hand outbound record encryption over to the kernel (kTLS) after handshake.
+     * Connections keep user space encryption if cipher or platform does not support it.
+     * OpenSSL: kTLS uses key log callback of the SSL_CTX, callback set before enabling it is still called.
+     * @param ctx TLS context
+     * @param enable non-zero to enable
+     * @returns 0 on success, or error code
+     */
+    int (*set_ktls)(tls_context *ctx, int enable);
+
+    /**
+     * (Optional) Caches successful outcomes of the set_cert_verify() callback, keyed by digest of presented chain.
+     * Handshakes presenting the same chain skip the callback until the entry expires, after `ttl` seconds,
+     * or when a certificate of the chain expires, whichever comes first. Failed verifications are not cached.
+     * Cache is cleared when verify callback is changed.
+     * @param ctx TLS context
+     * @param max_entries cache size, 0 disables caching
+     * @param ttl seconds to keep verification result
+     * @returns 0 on success, or error code
+     */
+    int (*set_verify_cache)(tls_context *ctx, size_t max_entries, unsigned int ttl);
+
+    /**
+     * (Optional) Requests stapled OCSP response from servers and checks peer certificate status during handshake.
+     * Validated responses are cached by certificate ID, so peers that do not staple only trigger
+     * [fetch] callback when cached response expires. Resumed sessions are not checked again.
+     * @param ctx TLS context
+     * @param cfg OCSP settings, NULL disables revocation checking
+     * @returns 0 on success, or error code
+     */
+    int (*set_ocsp)(tls_context *ctx, const tls_ocsp_config *cfg);
+
+    /**
+     * (Optional) Allows engines to run handshake steps (key exchange, certificate verification, signing)
+     * on the libuv threadpool, so that handshakes do not stall the event loop.
+     * User callbacks invoked by handshake steps (set_cert_verify() callback, OCSP fetch) then run on threadpool
+     * threads, concurrently for different connections. Engine internal callbacks (session cache, key log)
+     * only touch per-engine or lock protected state.
+     * @param ctx TLS context
+     * @param enable non-zero to enable
+     * @returns 0 on success, or error code
+     */
+    int (*set_async_handshake)(tls_context *ctx, int enable);
+
+    /**
+     * (Optional) Traffic counters summed over all engines of the context, including already freed ones.
+     * Counters of active engines may be slightly behind if they run on other threads.
+     * @param ctx TLS context
+     * @param stats (out) counters
+     */
+    void (*get_traffic_stats)(tls_context *ctx, tls_traffic_stats *stats);
+
+    /**
+     * (Optional) Sets cipher suite and group preference of subsequently created engines.
+     * @param ctx TLS context
+     * @param profile preset
+     * @returns 0 on success, UV_EINVAL if profile is unknown or not supported by TLS library
+     */
+    int (*set_cipher_profile)(tls_context *ctx, tls_cipher_profile profile);
+
+    /**
+     * (Optional) Keeps up to [max_idle] released engines for reuse by later new_engine() calls.
+     * Pooled engines are reset and bound to the new host (SNI, hostname verification, session).
+     * Changing own cert/key, cipher profile, or IO buffer drops pooled engines.
+     * @param ctx TLS context
+     * @param max_idle pool size, 0 disables pooling
+     * @returns 0 on success
+     */
+    int (*set_engine_pool)(tls_context *ctx, size_t max_idle);
+
+    /**
+     * (Optional) Idle-lean mode for large numbers of mostly idle connections:
+     * TLS record buffers, engine I/O buffers, and link read buffers are released when drained
+     * and allocated again when traffic arrives. Applies to engines created after this call.
+     * @param ctx TLS context
+     * @param enable non-zero to enable
+     * @returns 0 on success
+     */
+    int (*set_idle_lean)(tls_context *ctx, int enable);
+
+    /**
+     * (Optional) Switches engines created after this call to server side (accept) handshake.
+     * Server certificate and key are set with set_own_cert()/set_own_key(). ALPN protocols set on the context
+     * are used to pick client's most preferred protocol that server supports.
+     * Changing mode drops pooled engines.
+     * @param ctx TLS context
+     * @param flags combination of TLS_SERVER_* flags, 0 restores client mode
+     * @returns 0 on success, or error code
+     */
+    int (*set_server_mode)(tls_context *ctx, int flags);
+
+    /**
+     * (Optional) Sets callback selecting context (certificate and key) for server name requested by client(SNI).
+     * Callback runs during handshake, possibly on a worker thread if async handshake is enabled.
+     * Selected context must be a server mode context of the same implementation, and outlive the connection.
+     * @param ctx server TLS context
+     * @param sni_f callback, receives requested name and custom data, returns context to use or NULL to keep [ctx]
+     * @param sni_ctx custom data passed into callback
+     * @returns 0 on success, or error code
+     */
+    int (*set_sni_cb)(tls_context *ctx, tls_context *(*sni_f)(const char *name, void *sni_ctx), void *sni_ctx);
+
+    /**
+     * (Optional) Allows engines to encrypt and decrypt bulk application data on the libuv threadpool.
+     * Large writes and reads of a connection are processed in batches off the loop thread, one batch at a time,
+     * while previous batch is being sent. Small writes and reads stay on the loop thread.
+     * @param ctx TLS context
+     * @param enable non-zero to enable
+     * @returns 0 on success, or error code
+     */
+    int (*set_async_crypto)(tls_context *ctx, int enable);
+
 } tls_context_api;
 
+/** server side engines */
+#define TLS_SERVER_MODE 0x1
+/** server requests client certificate, handshake fails if client does not present a valid one */
+#define TLS_SERVER_VERIFY_CLIENT 0x2
+
 struct tls_context_s {
     void *ctx;
     tls_context_api *api;
@@ -284,6 +657,107 @@ void set_default_tls_impl(tls_context_factory impl);
 
 tls_context *default_tls_context(const char *ca, size_t ca_len);
 
+/**
+ * Verifies batch of signatures spreading it over shared worker threads, each thread checks at least
+ * TLSUV_VERIFY_MIN_CHUNK signatures. Small batches are verified on the calling thread. Worker threads are
+ * started on first use and kept for the life of the process.
+ * Falls back to verify() for key implementations without verify_many().
+ *
+ * @param threads maximum number of threads to use, including the calling thread
+ * @returns 0 if all signatures are valid, -1 otherwise
+ */
+int tlsuv_pubkey_verify_parallel(tlsuv_public_key_t pk, enum hash_algo md,
+                                 const tlsuv_verify_item *items, size_t count, int *results, unsigned int threads);
+
+#define TLSUV_VERIFY_MIN_CHUNK 64
+
+/**
+ * Completion callback of asynchronous key and certificate operations, runs on the loop thread.
+ * @param status result of the synchronous operation, or UV_ECANCELED
+ * @param data user data passed to the operation
+ */
+typedef void (*tlsuv_async_cb)(int status, void *data);
+
+/** maximum number of subject name pairs accepted by tlsuv_generate_csr_to_pem_async() */
+#define TLSUV_CSR_MAX_SUBJECT 8
+
+/*
+ * Asynchronous variants of tls_context_api operations. The operation runs on the libuv threadpool and
+ * `cb` is called on the loop thread. Arguments are copied, output parameters are written right before `cb`
+ * is called and must stay valid until then. `ctx` must not be freed before completion.
+ * All return 0 if operation was queued, UV_ENOTSUP if TLS implementation does not support it,
+ * or error from uv_queue_work().
+ */
+
+/** @see tls_context_api::generate_key() */
+int tlsuv_generate_key_async(uv_loop_t *loop, tls_context *ctx, tlsuv_private_key_t *pk,
+                             tlsuv_async_cb cb, void *data);
+
+/** @see tls_context_api::generate_pkcs11_key() */
+int tlsuv_generate_pkcs11_key_async(uv_loop_t *loop, tls_context *ctx, tlsuv_private_key_t *pk,
+                                    const char *pkcs11driver, const char *slot, const char *pin, const char *label,
+                                    tlsuv_async_cb cb, void *data);
+
+/**
+ * @see tls_context_api::generate_csr_to_pem()
+ * @param ... NULL terminated subject name pairs, up to TLSUV_CSR_MAX_SUBJECT (UV_EINVAL if more are passed)
+ */
+int tlsuv_generate_csr_to_pem_async(uv_loop_t *loop, tls_context *ctx, tlsuv_private_key_t pk,
+                                    char **pem, size_t *pemlen, tlsuv_async_cb cb, void *data, ...);
+
+/** @see tls_context_api::parse_pkcs7_certs() */
+int tlsuv_parse_pkcs7_certs_async(uv_loop_t *loop, tls_context *ctx, tls_cert *chain,
+                                  const char *pkcs7, size_t pkcs7len, tlsuv_async_cb cb, void *data);
+
+enum tlsuv_trace_type {
+    /** TLS record or handshake message sent/received */
+    tlsuv_TRACE_RECORD,
+    /** handshake state change, or handshake failure */
+    tlsuv_TRACE_STATE,
+    /** alert sent/received */
+    tlsuv_TRACE_ALERT,
+};
+
+typedef struct tlsuv_trace_event_s {
+    enum tlsuv_trace_type type;
+    /** host of the connection, NULL for server side connections */
+    const char *host;
+    /** 1 if sent, 0 if received */
+    int outgoing;
+    /** protocol version (0x0303 is TLS 1.2, 0x0304 is TLS 1.3) */
+    int version;
+    /** record content type (20 change_cipher_spec, 21 alert, 22 handshake, 23 application_data) */
+    int content_type;
+    /** handshake message type of handshake records, alert description of alerts */
+    int msg_type;
+    /** alert level: 1 warning, 2 fatal */
+    int alert_level;
+    size_t length;
+    /** engine's description of handshake state (tlsuv_TRACE_STATE) */
+    const char *state;
+} tlsuv_trace_event;
+
+/**
+ * Trace sink, called on the thread driving the connection.
+ */
+typedef void (*tlsuv_trace_cb)(const tlsuv_trace_event *ev, void *data);
+
+/**
+ * Enables protocol tracing of connections to matching hosts. Connections attach trace hooks
+ * on their next handshake/read/write step, so it can be toggled at runtime; untraced connections don't pay for it.
+ * Setting TLS_DEBUG environment variable enables tracing of all connections to the log.
+ *
+ * @param host_filter exact host name, wildcard suffix ("*.example.com"), or NULL for all connections
+ * @param cb trace sink, NULL to log compact events with UM_LOG(TRACE)
+ * @return 0 on success
+ */
+int tlsuv_trace_enable(const char *host_filter, tlsuv_trace_cb cb, void *data);
+
+/**
+ * Disables protocol tracing, connections detach hooks on the next step.
+ */
+void tlsuv_trace_disable(void);
+
 #ifdef __cplusplus
 }
 #endif
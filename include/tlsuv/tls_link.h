@@ -19,14 +19,119 @@
 typedef struct tls_link_s tls_link_t;
 typedef void (*tls_handshake_cb)(tls_link_t *l, int status);
 
+// smallest write or read that is offloaded in async crypto mode, smaller ones are not worth the thread hop
+#define TLSUV_BULK_CRYPTO_MIN (16 * 1024)
+
+// tracks TLS record boundaries in a byte stream
+struct tls_record_scan_s {
+    size_t left;
+    unsigned char hdr[5];
+    unsigned char hdr_len;
+};
+
+// adaptive read buffer size of a link, zero initialized state starts at default size
+struct tlsuv_read_sizer_s {
+    signed char step;
+    unsigned char small_reads;
+};
+
 struct tls_link_s {
     UV_LINK_FIELDS
 
     tls_engine *engine;
     tls_handshake_cb hs_cb;
+
+    // buffer for bytes received from TLS peer
+    char *ssl_buf;
+    size_t ssl_buf_len;
+    struct tlsuv_read_sizer_s read_size;
+
+    // outbound records are encrypted by kernel, application data is passed through
+    int ktls_tx;
+
+    // handshake was kicked off, read_start only resumes reading after that
+    int hs_started;
+
+    // read buffer is returned to the pool after every read (engine is in idle-lean mode, or buffer is shared)
+    int lean;
+
+    // handshake steps are run on this loop's threadpool
+    uv_loop_t *hs_loop;
+    struct tls_hs_job_s *hs_job;
+
+    // bulk application data is encrypted/decrypted on this loop's threadpool
+    uv_loop_t *crypto_loop;
+    // batch being processed by worker thread, and work arriving meanwhile that makes up the next one
+    struct tls_crypto_job_s *crypto_job;
+    struct tls_crypto_job_s *crypto_next;
+    // batches handed to the threadpool
+    unsigned long crypto_batches;
+
+    // optional, receives handshake marks
+    struct tlsuv_timing_s *timing;
+
+    // engine owned traffic counters, NULL if engine does not keep them
+    tls_traffic_stats *stats;
+    struct tls_record_scan_s rec_in;
+    struct tls_record_scan_s rec_out;
 };
 
 
 int tlsuv_tls_link_init(tls_link_t *tls, tls_engine *engine, tls_handshake_cb cb);
 
+/**
+ * Approximate memory held by the link and its engine buffers.
+ * Engine buffers are left out while a handshake step or crypto batch is running on a worker thread.
+ * @param tls TLS link
+ * @returns bytes
+ */
+size_t tlsuv_tls_link_mem_usage(tls_link_t *tls);
+
+/**
+ * Attempts to hand outbound record encryption over to the kernel (kTLS).
+ * Must be called on handshake completion, before any application data is written.
+ * Link silently stays in user space mode if engine, cipher, or platform does not support it.
+ *
+ * @param tls TLS link
+ * @param sock connected socket stream at the bottom of the link chain
+ * @returns 0 if offload is active
+ */
+int tlsuv_tls_link_ktls(tls_link_t *tls, uv_stream_t *sock);
+
+/**
+ * Runs handshake steps (signing, key exchange, peer verification) on the libuv threadpool
+ * instead of the loop thread. Peer data received while a step is running is queued,
+ * writes fail with UV_EAGAIN, and close is deferred until the step completes.
+ * Engine callbacks called from handshake steps (e.g. certificate verification) run on the threadpool as well.
+ * Must be called after tlsuv_tls_link_init().
+ *
+ * @param tls TLS link
+ * @param loop loop to queue handshake work on
+ * @returns 0 if enabled, UV_ENOTSUP if engine does not allow handshake off the loop thread
+ */
+int tlsuv_tls_link_async_handshake(tls_link_t *tls, uv_loop_t *loop);
+
+/**
+ * Encrypts and decrypts bulk application data on the libuv threadpool instead of the loop thread.
+ * Writes and reads of at least TLSUV_BULK_CRYPTO_MIN bytes are processed in batches, one batch at a time.
+ * Writes and reads arriving while a batch is running make up the next batch, which is submitted as soon
+ * as the previous one is handed to the transport, so encryption overlaps with sending.
+ * Next batch smaller than TLSUV_BULK_CRYPTO_MIN is processed on the loop thread.
+ * Data is delivered in order, write callbacks are called once ciphertext is written,
+ * close is deferred until the running batch completes.
+ *
+ * Limits: engine state of a connection is not shared between threads, so a connection never uses more than
+ * one core for its records, no matter how many threadpool workers there are.
+ * Every batch costs a uv_queue_work() round trip (worker wakeup, and loop wakeup to hand the results over),
+ * which is only paid back by batches of many records. Offload helps when the loop thread is busy with
+ * other connections, it does not make a single transfer faster.
+ * It is opt-in: link only offloads if its TLS context was enabled with tls_context_api::set_async_crypto().
+ * Must be called after tlsuv_tls_link_init().
+ *
+ * @param tls TLS link
+ * @param loop loop to queue crypto work on
+ * @returns 0 if enabled, UV_ENOTSUP if engine does not allow record processing off the loop thread
+ */
+int tlsuv_tls_link_async_crypto(tls_link_t *tls, uv_loop_t *loop);
+
 #endif//TLSUV_TLS_LINK_H
@@ -21,6 +21,7 @@
 #include "tcp_src.h"
 #include "tls_engine.h"
 #include "tls_link.h"
+#include "queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,27 +34,131 @@ typedef struct tlsuv_stream_s tlsuv_stream_t;
 typedef void(*tlsuv_log_func)(int level, const char *file, unsigned int line, const char *msg);
 void tlsuv_set_debug(int level, tlsuv_log_func output_f);
 
+/**
+ * Switches logging to asynchronous mode. Log statements capture level, location, timestamp, format and
+ * arguments into a per-thread lock-free ring buffer, a background thread formats records and calls the log function.
+ * Records that do not fit into the ring are dropped and reported.
+ * @param ring_size size of per-thread ring in bytes, 0 selects default (64KB)
+ * @return 0 on success, UV_EALREADY if asynchronous logging is already started
+ */
+int tlsuv_log_async_start(size_t ring_size);
+
+/**
+ * Delivers pending records and switches back to synchronous logging.
+ */
+void tlsuv_log_async_stop(void);
+
+/**
+ * Blocks until records logged before the call are delivered to the log function.
+ */
+void tlsuv_log_flush(void);
+
+typedef struct tlsuv_log_stats_s {
+    /** records captured by asynchronous logger */
+    uint64_t records;
+    /** records dropped because ring was full */
+    uint64_t dropped;
+    /** number of threads with log rings */
+    unsigned int threads;
+} tlsuv_log_stats;
+
+int tlsuv_log_get_stats(tlsuv_log_stats *stats);
+
 int tlsuv_stream_init(uv_loop_t *l, tlsuv_stream_t *clt, tls_context *tls);
 int tlsuv_stream_keepalive(tlsuv_stream_t *clt, int keepalive, unsigned int delay);
 int tlsuv_stream_nodelay(tlsuv_stream_t *clt, int nodelay);
 
+/**
+ * Sets socket options for the stream, kept across reconnects (@see tcp_src_sockopts_set).
+ */
+int tlsuv_stream_sockopts(tlsuv_stream_t *clt, const tcp_src_sockopts *opts);
+
 int tlsuv_stream_connect(uv_connect_t *req, tlsuv_stream_t *clt, const char *host, int port, uv_connect_cb cb);
 
+/**
+ * Connects to pre-resolved addresses, skipping name resolution.
+ * All addresses in the list are tried (@see tcp_src_attempt_delay), each must carry the port.
+ * Server is verified (and SNI is sent) using `addr->ai_canonname` if set, otherwise the host
+ * of the previous connect, or the numeric address as the last resort.
+ *
+ * @return 0, or error code
+ */
 int tlsuv_stream_connect_addr(uv_connect_t *req, tlsuv_stream_t *clt, const struct addrinfo *addr, uv_connect_cb cb);
 
 int tlsuv_stream_read(tlsuv_stream_t *clt, uv_alloc_cb, uv_read_cb);
 
+/**
+ * Stops reading from the socket (backpressure). Data already received by the stream may still be delivered.
+ * @return 0, or UV_ENOTCONN if stream is not connected
+ */
+int tlsuv_stream_read_stop(tlsuv_stream_t *clt);
+
+/**
+ * Resumes reading after [tlsuv_stream_read_stop].
+ * @return 0, or UV_ENOTCONN if stream is not connected
+ */
+int tlsuv_stream_read_start(tlsuv_stream_t *clt);
+
 int tlsuv_stream_write(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_write_cb cb);
 
+/**
+ * Writes gather list of buffers, passed as is to TLS engine (no intermediate copy).
+ * Buffer memory must stay valid until [cb] is called, [bufs] array itself may be released right away.
+ */
+int tlsuv_stream_writev(uv_write_t *req, tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs, uv_write_cb cb);
+
 int tlsuv_stream_close(tlsuv_stream_t *clt, uv_close_cb close_cb);
 
 int tlsuv_stream_free(tlsuv_stream_t *clt);
 
+/**
+ * Records connection phase timestamps (resolve, TCP connect, handshake) for subsequent connects.
+ * Timing is delivered to [cb] right before connect callback, also on connect failure.
+ * @param clt stream
+ * @param cb timing callback, NULL to disable
+ * @param ctx passed into [cb]
+ */
+int tlsuv_stream_set_timing(tlsuv_stream_t *clt, tlsuv_timing_cb cb, void *ctx);
+
+/**
+ * Snapshot of TLS traffic counters of the current (or last) connection.
+ * @param clt stream
+ * @param stats (out) counters
+ * @return 0, or UV_ENOTSUP if stream was not connected or TLS engine does not keep counters
+ */
+int tlsuv_stream_stats(tlsuv_stream_t *clt, tls_traffic_stats *stats);
+
+/**
+ * Approximate memory allocated on behalf of the stream (socket objects, TLS link and engine buffers),
+ * not including the stream struct itself.
+ * @param clt stream
+ * @return bytes
+ */
+size_t tlsuv_stream_mem_usage(tlsuv_stream_t *clt);
+
+/**
+ * Holds back subsequent writes until [tlsuv_stream_uncork] is called.
+ * Corked writes are flushed together, packed into as few TLS records and socket writes as possible.
+ * Every write request still gets its own callback.
+ * @param clt stream
+ */
+int tlsuv_stream_cork(tlsuv_stream_t *clt);
+
+/**
+ * Flushes writes queued since [tlsuv_stream_cork].
+ * @param clt stream
+ * @return 0, or error from submitting coalesced write (write callbacks are called with the same error)
+ */
+int tlsuv_stream_uncork(tlsuv_stream_t *clt);
+
+struct tlsuv_stream_write_s;
+
 struct tlsuv_stream_s {
     UV_LINK_FIELDS
 
     uv_loop_t *loop;
     tcp_src_t *socket;
+    tcp_src_t default_src;
     tls_link_t tls_link;
 
     tls_context *tls;
@@ -62,9 +167,195 @@ struct tlsuv_stream_s {
     char *host;
     uv_connect_t *conn_req; //a place to stash a connection request
     uv_close_cb close_cb;
+
+    tlsuv_timing_t timing;
+    tlsuv_timing_cb timing_cb;
+    void *timing_ctx;
+
+    int corked;
+    unsigned int corked_count;
+    STAILQ_HEAD(corked_q, tlsuv_stream_write_s) corked_writes;
+};
+
+typedef struct tlsuv_server_s tlsuv_server_t;
+
+/**
+ * Called when listening socket has a pending connection, or failed with [status].
+ */
+typedef void (*tlsuv_connection_cb)(tlsuv_server_t *srv, int status);
+
+/** bind with SO_REUSEPORT, so that several loops (threads) can listen on the same address */
+#define TLSUV_SERVER_REUSEPORT 0x1
+
+/**
+ * Initializes TLS server.
+ * @param l loop
+ * @param srv server
+ * @param tls TLS context in server mode (@see tls_context_api::set_server_mode) with server cert and key
+ * @return 0, UV_EINVAL if [tls] is not set, or UV_ENOTSUP if TLS implementation does not support server mode
+ */
+int tlsuv_server_init(uv_loop_t *l, tlsuv_server_t *srv, tls_context *tls);
+
+/**
+ * Binds server to local address.
+ * With TLSUV_SERVER_REUSEPORT every loop listening on the address gets its own server and
+ * kernel distributes incoming connections between them (Linux, *BSD).
+ * @param srv server
+ * @param addr local address
+ * @param flags TLSUV_SERVER_* flags
+ * @return 0, UV_ENOTSUP if SO_REUSEPORT is not available, or bind error
+ */
+int tlsuv_server_bind(tlsuv_server_t *srv, const struct sockaddr *addr, unsigned int flags);
+
+int tlsuv_server_listen(tlsuv_server_t *srv, int backlog, tlsuv_connection_cb cb);
+
+/**
+ * Accepts pending connection into the stream and starts server side TLS handshake.
+ * Stream must be initialized (@see tlsuv_stream_init) on the server's loop, it is switched to server's TLS context.
+ * [cb] is called when handshake completes, after that the stream is used as a connected one.
+ * @param srv server
+ * @param clt stream
+ * @param req accept request
+ * @param cb handshake callback
+ * @return 0, or error accepting connection
+ */
+int tlsuv_server_accept(tlsuv_server_t *srv, tlsuv_stream_t *clt, uv_connect_t *req, uv_connect_cb cb);
+
+int tlsuv_server_close(tlsuv_server_t *srv, uv_close_cb close_cb);
+
+struct tlsuv_server_s {
+    void *data;
+    uv_loop_t *loop;
+    tls_context *tls;
+    uv_tcp_t listener;
+    tlsuv_connection_cb connection_cb;
+    uv_close_cb close_cb;
 };
 
 size_t tlsuv_base64url_decode(const char *in, char **out, size_t *out_len);
+
+/** use URL and filename safe alphabet (RFC 4648, section 5) */
+#define TLSUV_BASE64_URL   0x1
+/** do not add '=' padding when encoding */
+#define TLSUV_BASE64_NOPAD 0x2
+
+/**
+ * Length of base64 encoding of [len] bytes, not including NUL terminator.
+ */
+size_t tlsuv_base64_encoded_len(size_t len, int flags);
+
+/**
+ * Maximum number of bytes produced by decoding [len] base64 characters.
+ */
+size_t tlsuv_base64_decoded_len(size_t len);
+
+/**
+ * Encodes [in] into caller provided buffer. Output is NUL terminated if buffer has room for it.
+ * @param out_len in: size of [out], out: number of encoded characters
+ * @param flags combination of TLSUV_BASE64_URL and TLSUV_BASE64_NOPAD
+ * @return 0 on success, UV_ENOBUFS if [out] is too small
+ */
+int tlsuv_base64_encode(const void *in, size_t len, char *out, size_t *out_len, int flags);
+
+/**
+ * Decodes [len] characters of [in] into caller provided buffer without allocating.
+ * Padding is optional, whitespace (e.g. line breaks in PEM bodies) is skipped.
+ * @param out_len in: size of [out], out: number of decoded bytes
+ * @param flags TLSUV_BASE64_URL selects URL safe alphabet
+ * @return 0 on success, UV_EINVAL on malformed input, UV_ENOBUFS if [out] is too small
+ */
+int tlsuv_base64_decode(const char *in, size_t len, void *out, size_t *out_len, int flags);
+
+/**
+ * Compiles PEM bundle into indexed DER trust store file.
+ * Path of the compiled file can be used as CA bundle of #default_tls_context, it is memory-mapped
+ * and only certificates needed for chain verification are decoded.
+ * @return number of certificates written, UV_EINVAL if bundle has no certificates, or other UV error
+ */
+int tlsuv_trust_store_compile(const char *pem_file, const char *out_file);
+
+/**
+ * Usage of internal buffer pool size class.
+ */
+typedef struct tlsuv_pool_stats_s {
+    size_t block_size;
+    unsigned long allocs;
+    /** allocations served from free list */
+    unsigned long reused;
+    size_t in_use;
+    /** max number of blocks in use at the same time */
+    size_t high_water;
+    /** blocks kept on free list */
+    size_t cached;
+} tlsuv_pool_stats;
+
+/**
+ * Get buffer pool statistics of the calling (loop) thread.
+ * @param stats array of size class stats
+ * @param count size of stats array
+ * @returns number of size classes filled
+ */
+int tlsuv_pool_get_stats(tlsuv_pool_stats *stats, int count);
+
+/**
+ * Release unused memory cached by the buffer pool of the calling (loop) thread.
+ */
+void tlsuv_pool_trim(void);
+
+/**
+ * Sets up one read buffer shared by all connections of the calling (loop) thread, the way libuv servers do.
+ * Received data is decrypted or parsed before read callback returns, so idle connections do not hold a read buffer.
+ * Read that arrives while shared buffer is in use gets a pool buffer.
+ * Must be called from the loop thread.
+ * @param size buffer size, 0 releases shared buffer
+ * @returns 0 on success, UV_ENOMEM
+ */
+int tlsuv_pool_set_shared_read(size_t size);
+
+/**
+ * Replaces memory allocation functions used by the library, in the same way as `uv_replace_allocator()`.
+ * Functions are also installed into OpenSSL (if it has not allocated any memory yet) or mbedTLS
+ * (if it is built with MBEDTLS_PLATFORM_MEMORY), so call it at startup before any TLS context is created.
+ * Memory allocated before the call is released with the new free function.
+ * Buffers returned to the caller for release with free() (PEM output, tlsuv_base64url_decode) are not affected.
+ * @return 0 or UV_EINVAL if any of the functions is NULL
+ */
+int tlsuv_set_allocator(uv_malloc_func malloc_f, uv_realloc_func realloc_f, uv_calloc_func calloc_f,
+                        uv_free_func free_f);
+
+/**
+ * Subsystems of library memory counters, @see tlsuv_mem_get_stats
+ */
+typedef enum tlsuv_mem_subsys_e {
+    /** streams, sources (TCP, pipe, proxy), DNS cache, buffer pool, logging */
+    TLSUV_MEM_CORE,
+    /** TLS engines and links, keys, certificates, session and verification caches */
+    TLSUV_MEM_TLS,
+    /** HTTP client, HTTP/2, response cache and compression */
+    TLSUV_MEM_HTTP,
+    /** websocket client */
+    TLSUV_MEM_WEBSOCKET,
+    /** allocations of TLS library itself (OpenSSL/mbedTLS) */
+    TLSUV_MEM_CRYPTO,
+} tlsuv_mem_subsys;
+
+#define TLSUV_MEM_SUBSYS_COUNT (TLSUV_MEM_CRYPTO + 1)
+
+typedef struct tlsuv_mem_stats_s {
+    unsigned long allocs;
+    unsigned long frees;
+    /** total bytes requested, including growth of reallocated blocks */
+    uint64_t bytes_allocated;
+    size_t bytes_in_use;
+} tlsuv_mem_stats;
+
+/**
+ * Get allocation counters of library subsystem.
+ * @param sub subsystem
+ * @param stats receives counters
+ * @return 0, UV_EINVAL for unknown subsystem, UV_ENOTSUP if library was built without TLSUV_ALLOC_STATS
+ */
+int tlsuv_mem_get_stats(tlsuv_mem_subsys sub, tlsuv_mem_stats *stats);
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,43 @@ extern "C" {
 
 typedef struct tlsuv_websocket_s tlsuv_websocket_t;
 
+/** largest received message collected in memory, unless changed with tlsuv_websocket_set_max_message() */
+#define TLSUV_WS_DEFAULT_MAX_MESSAGE (64 * 1024 * 1024)
+
+struct ws_write_s;
+
+/**
+ * @brief Websocket message type
+ */
+typedef enum {
+    TLSUV_WS_TEXT = 1,
+    TLSUV_WS_BINARY = 2,
+} tlsuv_ws_msg_type;
+
+/**
+ * @brief Receives data messages in pieces as they arrive (@see tlsuv_websocket_set_fragment_cb)
+ * @param ws websocket
+ * @param type message type
+ * @param data piece of message payload, valid only during the call
+ * @param len length of the piece, may be 0
+ * @param fin this piece completes the message
+ */
+typedef void (*tlsuv_ws_fragment_cb)(tlsuv_websocket_t *ws, tlsuv_ws_msg_type type,
+                                     const char *data, size_t len, bool fin);
+
+/**
+ * @brief keepalive ping statistics, times are in nanoseconds (`uv_hrtime()` units)
+ */
+typedef struct tlsuv_ws_ping_stats_s {
+    unsigned long pings_sent;
+    unsigned long pongs_received;
+    /** round trip time of the latest ping, 0 until first pong is received */
+    uint64_t rtt_last;
+    uint64_t rtt_min;
+    /** smoothed RTT, exponentially weighted moving average with 1/8 gain */
+    uint64_t rtt_ewma;
+} tlsuv_ws_ping_stats;
+
 /**
  * @brief Websocket object.
  */
@@ -37,6 +74,34 @@ struct tlsuv_websocket_s {
     char *host;
 
     uv_connect_t *conn_req;
+    /** frame parser state across reads */
+    struct ws_parser_s *parser;
+    /** size of next read buffer, adapts to recent reads */
+    struct tlsuv_read_sizer_s read_size;
+    /** masking key generator state */
+    uint64_t mask_state;
+    /** permessage-deflate offer/state, NULL if compression is not used */
+    struct ws_deflate_s *deflate;
+    /** streamed message is being sent, and opcode of its next frame */
+    bool send_msg;
+    unsigned int send_op;
+    /** bytes of frames submitted and not written yet */
+    size_t write_queue_size;
+    /** receives data messages in pieces, NULL to receive whole messages with read_cb */
+    tlsuv_ws_fragment_cb fragment_cb;
+    /** frames written during current loop iteration, submitted together as single write */
+    STAILQ_HEAD(ws_batch_q, ws_write_s) batch;
+    unsigned int batch_bufs;
+    size_t batch_size;
+    uv_timer_t *flush_timer;
+    bool nodelay;
+    /** keepalive ping interval and pong timeout (ms), 0 if disabled */
+    unsigned int ping_interval;
+    unsigned int pong_timeout;
+    tlsuv_timeout_t ping_timer;
+    /** uv_hrtime() when outstanding ping was sent, 0 if no ping is outstanding */
+    uint64_t ping_sent;
+    tlsuv_ws_ping_stats ping_stats;
 
     tlsuv_src_t *src;
     tcp_src_t default_src;
@@ -73,6 +138,23 @@ void tlsuv_websocket_set_tls(tlsuv_websocket_t *ws, tls_context *ctx);
  */
 void tlsuv_websocket_set_header(tlsuv_websocket_t *ws, const char *name, const char *value);
 
+/** compressor state is dropped after every sent message */
+#define TLSUV_WS_CLIENT_NO_CONTEXT_TAKEOVER 0x1
+/** ask server to compress every message independently */
+#define TLSUV_WS_SERVER_NO_CONTEXT_TAKEOVER 0x2
+
+/**
+ * @brief offer permessage-deflate compression (RFC 7692) in websocket handshake
+ *
+ * Must be called before #tlsuv_websocket_connect. Messages are compressed only if server accepts the offer.
+ * @param ws websocket
+ * @param client_max_window_bits LZ77 window for sent messages, 9-15, 0 lets the server choose (up to 15)
+ * @param server_max_window_bits window requested for received messages, 8-15, 0 for server default
+ * @param flags TLSUV_WS_CLIENT_NO_CONTEXT_TAKEOVER | TLSUV_WS_SERVER_NO_CONTEXT_TAKEOVER
+ * @return 0, UV_EINVAL if window bits are out of range or websocket is connected, UV_ENOTSUP if zlib is not available
+ */
+int tlsuv_websocket_set_deflate(tlsuv_websocket_t *ws, int client_max_window_bits, int server_max_window_bits, int flags);
+
 /**
  * @brief Connect websocket to a service with given URL
  * @param req connect request
@@ -94,6 +176,100 @@ int tlsuv_websocket_connect(uv_connect_t *req, tlsuv_websocket_t *ws, const char
  */
 int tlsuv_websocket_write(uv_write_t *req, tlsuv_websocket_t *ws, uv_buf_t *buf, uv_write_cb cb);
 
+/**
+ * @brief start streamed message
+ *
+ * Message is sent as a sequence of frames produced by #tlsuv_websocket_msg_write and #tlsuv_websocket_msg_end,
+ * so it does not need to be in memory at once. Other messages cannot be sent until it is finished.
+ * @param ws websocket
+ * @param type message type
+ * @return 0, UV_EBUSY if another streamed message is in progress, UV_EINVAL for invalid type
+ */
+int tlsuv_websocket_msg_begin(tlsuv_websocket_t *ws, tlsuv_ws_msg_type type);
+
+/**
+ * @brief send next fragment of streamed message
+ *
+ * Fragment is sent as a frame right away. Buffer can be reused once the call returns.
+ * Writers should keep #tlsuv_websocket_write_queue_size bounded by waiting for write callbacks.
+ * @param req write request
+ * @param ws websocket
+ * @param buf fragment data
+ * @param cb callback called after the fragment is written or failed
+ * @return error code, UV_EINVAL if message was not started
+ */
+int tlsuv_websocket_msg_write(uv_write_t *req, tlsuv_websocket_t *ws, const uv_buf_t *buf, uv_write_cb cb);
+
+/**
+ * @brief send final fragment and finish streamed message
+ * @param req write request
+ * @param ws websocket
+ * @param buf final data, may be NULL
+ * @param cb callback called after the fragment is written or failed
+ * @return error code, UV_EINVAL if message was not started
+ */
+int tlsuv_websocket_msg_end(uv_write_t *req, tlsuv_websocket_t *ws, const uv_buf_t *buf, uv_write_cb cb);
+
+/**
+ * @brief disable write batching
+ *
+ * By default frames written during the same loop iteration are submitted together at the start of the next one,
+ * packed into as few TLS records and socket writes as possible. Every write request still gets its own callback.
+ * With `nodelay` every frame is submitted as soon as it is written.
+ * @param ws websocket
+ * @param nodelay true to disable batching, frames already batched are submitted right away
+ * @return 0
+ */
+int tlsuv_websocket_set_nodelay(tlsuv_websocket_t *ws, bool nodelay);
+
+/**
+ * @brief enable keepalive pings
+ *
+ * Ping is sent every `interval_ms` milliseconds once websocket is connected. If pong does not arrive within
+ * `pong_timeout_ms` connection is considered dead, and `data_cb` gets UV_ETIMEDOUT.
+ * @param ws websocket
+ * @param interval_ms ping interval, 0 disables keepalive
+ * @param pong_timeout_ms time to wait for pong, 0 uses `interval_ms`
+ * @return 0
+ */
+int tlsuv_websocket_set_keepalive(tlsuv_websocket_t *ws, unsigned int interval_ms, unsigned int pong_timeout_ms);
+
+/**
+ * @brief keepalive ping counters and round trip times
+ * @param ws websocket
+ * @param stats (out) statistics
+ * @return 0, or UV_EINVAL
+ */
+int tlsuv_websocket_ping_stats(const tlsuv_websocket_t *ws, tlsuv_ws_ping_stats *stats);
+
+/**
+ * @brief number of bytes submitted for sending that are not written yet
+ */
+size_t tlsuv_websocket_write_queue_size(const tlsuv_websocket_t *ws);
+
+/**
+ * @brief deliver received data messages in pieces as they arrive
+ *
+ * Messages are not collected in memory, every frame (or part of it available in a read) is passed to `cb`.
+ * Close and errors are still reported with connect `data_cb`. Should be set before websocket is connected.
+ * @param ws websocket
+ * @param cb fragment callback, NULL to go back to whole messages
+ */
+void tlsuv_websocket_set_fragment_cb(tlsuv_websocket_t *ws, tlsuv_ws_fragment_cb cb);
+
+/**
+ * @brief limit size of received messages
+ *
+ * Messages, or decompressed messages, larger than `max_size` are not collected: websocket sends
+ * close frame with status 1009 (message too big), and `data_cb` gets UV_E2BIG.
+ * With fragment callback the limit applies to decompressed size of every delivered piece,
+ * since messages are not collected.
+ * @param ws websocket
+ * @param max_size limit in bytes, 0 for no limit
+ * @return 0
+ */
+int tlsuv_websocket_set_max_message(tlsuv_websocket_t *ws, size_t max_size);
+
 /**
  * @brief close websocket
  * @param ws websocket
@@ -0,0 +1,705 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// handshake stress: runs a local TLS echo server on its own loop thread, then opens and closes tlsuv_stream_t
+// connections against it at a controlled rate while a set of established "victim" streams keep exchanging pings.
+// Reports handshakes/s, handshake latency percentiles and victim round trip latency for every mode,
+// a baseline victim run without handshake storm comes first.
+// modes:
+//   full    - full handshakes, connection is closed before session ticket arrives so nothing is cached
+//   resume  - session resumption
+//   mtls    - full handshakes with client certificate and key from files
+//   pkcs11  - full handshakes with client key on PKCS#11 token (e.g. SoftHSM), server trusts token certificate
+// usage: handshake-stress [-m mode[,mode...]] [-r rate] [-c concurrency] [-d seconds] [-v victims] [-i ping_ms]
+//                         [-P pkcs11_driver] [-S slot] [-p pin] [-I key_id] [-l key_label]
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include <tlsuv/tlsuv.h>
+
+#define xstr(s) str__(s)
+#define str__(s) #s
+
+#if defined(BENCH_CERT_DIR)
+#define DEFAULT_CERT xstr(BENCH_CERT_DIR) "/server.crt"
+#define DEFAULT_KEY xstr(BENCH_CERT_DIR) "/server.key"
+#define DEFAULT_CA xstr(BENCH_CERT_DIR) "/ca.pem"
+#else
+#define DEFAULT_CERT "server.crt"
+#define DEFAULT_KEY "server.key"
+#define DEFAULT_CA "ca.pem"
+#endif
+
+#define STRESS_HOST "127.0.0.1"
+#define MAX_MODES 8
+#define MAX_SAMPLES (1 << 20)
+#define PING_SIZE 64
+#define GREETING "!"
+
+enum mode {
+    MODE_FULL,
+    MODE_RESUME,
+    MODE_MTLS,
+    MODE_PKCS11,
+};
+
+static const char *const mode_names[] = {
+        [MODE_FULL] = "full",
+        [MODE_RESUME] = "resume",
+        [MODE_MTLS] = "mtls",
+        [MODE_PKCS11] = "pkcs11",
+};
+
+static struct {
+    enum mode modes[MAX_MODES];
+    int mode_count;
+    double rate;
+    unsigned int concurrency;
+    double seconds;
+    unsigned int victims;
+    unsigned int ping_ms;
+    const char *cert;
+    const char *key;
+    const char *ca;
+    const char *p11_driver;
+    const char *p11_slot;
+    const char *p11_pin;
+    const char *p11_id;
+    const char *p11_label;
+} opts = {
+        .modes = { MODE_FULL, MODE_RESUME, MODE_MTLS },
+        .mode_count = 3,
+        .concurrency = 32,
+        .seconds = 5,
+        .victims = 16,
+        .ping_ms = 10,
+        .cert = DEFAULT_CERT,
+        .key = DEFAULT_KEY,
+        .ca = DEFAULT_CA,
+};
+
+// server side, runs on its own loop thread
+// listeners: plain and client certificate verifying
+enum { SRV_PLAIN, SRV_MTLS, SRV_KINDS };
+
+static struct {
+    uv_thread_t thread;
+    uv_loop_t loop;
+    uv_async_t stop;
+    tls_context *tls[SRV_KINDS];
+    tlsuv_server_t listener[SRV_KINDS];
+    int port[SRV_KINDS];
+} server;
+
+struct srv_conn {
+    tlsuv_stream_t stream;
+    uv_connect_t req;
+};
+
+// client side
+struct storm_conn {
+    tlsuv_stream_t stream;
+    uv_connect_t req;
+    uint64_t start;
+};
+
+struct victim {
+    tlsuv_stream_t stream;
+    uv_connect_t req;
+    bool ready;
+    bool greeted;
+    bool waiting;
+    size_t received;
+    uint64_t sent;
+    char ping[PING_SIZE];
+};
+
+struct samples {
+    uint64_t *v;
+    size_t count;
+};
+
+static struct {
+    int phase;          // -1 is baseline
+    bool launching;
+    uint64_t start;
+    uint64_t started;
+    unsigned int in_flight;
+    unsigned long completed;
+    unsigned long failed;
+    unsigned long resumed;
+    struct samples hs;
+    struct samples victim_rtt;
+} run;
+
+static uv_loop_t *loop;
+static uv_timer_t tick_timer;
+static uv_timer_t ping_timer;
+static uv_timer_t phase_timer;
+static tls_context *client_tls[4];
+static tls_context *victim_tls;
+static struct victim *victims;
+static unsigned int victims_ready;
+
+static void start_phase(void);
+
+static void alloc_cb(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    buf->base = malloc(suggested);
+    buf->len = suggested;
+}
+
+static void sample_add(struct samples *s, uint64_t v) {
+    if (s->count < MAX_SAMPLES) {
+        s->v[s->count++] = v;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// sorts samples, returns value at [pct] percentile in milliseconds
+static double pct_ms(struct samples *s, unsigned int pct) {
+    if (s->count == 0) {
+        return 0;
+    }
+    size_t idx = s->count * pct / 100;
+    if (idx >= s->count) idx = s->count - 1;
+    return (double) s->v[idx] / 1e6;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = calloc(1, (size_t) size + 1);
+    *len = fread(buf, 1, (size_t) size, f);
+    fclose(f);
+    return buf;
+}
+
+/*************** server ***************/
+
+static void srv_conn_closed(uv_handle_t *h) {
+    struct srv_conn *c = (struct srv_conn *) h;
+    tlsuv_stream_free(&c->stream);
+    free(c);
+}
+
+static void srv_write_cb(uv_write_t *wr, int status) {
+    free(wr->data);
+    free(wr);
+}
+
+static void srv_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    tlsuv_stream_t *stream = (tlsuv_stream_t *) s;
+    if (nread < 0) {
+        tlsuv_stream_close(stream, srv_conn_closed);
+    } else if (nread > 0) {
+        uv_write_t *wr = calloc(1, sizeof(*wr));
+        wr->data = buf->base;
+        uv_buf_t b = uv_buf_init(buf->base, (unsigned int) nread);
+        if (tlsuv_stream_write(wr, stream, &b, srv_write_cb) == 0) {
+            return;
+        }
+        free(wr);
+    }
+    free(buf->base);
+}
+
+static void srv_handshake(uv_connect_t *req, int status) {
+    tlsuv_stream_t *stream = (tlsuv_stream_t *) req->handle;
+    if (status != 0) {
+        tlsuv_stream_close(stream, srv_conn_closed);
+        return;
+    }
+
+    // client waits for the greeting, session tickets are sent before it
+    uv_write_t *wr = calloc(1, sizeof(*wr));
+    wr->data = strdup(GREETING);
+    uv_buf_t b = uv_buf_init(wr->data, (unsigned int) strlen(GREETING));
+    if (tlsuv_stream_write(wr, stream, &b, srv_write_cb) != 0) {
+        srv_write_cb(wr, -1);
+    }
+}
+
+static void srv_connection(tlsuv_server_t *srv, int status) {
+    if (status != 0) {
+        return;
+    }
+
+    struct srv_conn *c = calloc(1, sizeof(*c));
+    tlsuv_stream_init(srv->loop, &c->stream, srv->tls);
+    if (tlsuv_server_accept(srv, &c->stream, &c->req, srv_handshake) != 0) {
+        tlsuv_stream_free(&c->stream);
+        free(c);
+        return;
+    }
+    tlsuv_stream_nodelay(&c->stream, 1);
+    tlsuv_stream_read(&c->stream, alloc_cb, srv_read);
+}
+
+static void srv_stop(uv_async_t *a) {
+    for (int k = 0; k < SRV_KINDS; k++) {
+        if (server.tls[k]) {
+            tlsuv_server_close(&server.listener[k], NULL);
+        }
+    }
+    uv_close((uv_handle_t *) a, NULL);
+}
+
+static void srv_run(void *arg) {
+    uv_run(&server.loop, UV_RUN_DEFAULT);
+}
+
+static tls_context *srv_context(const char *ca, size_t ca_len, int flags) {
+    tls_context *tls = default_tls_context(ca, ca_len);
+    tlsuv_private_key_t pk = NULL;
+    if (tls->api->set_server_mode == NULL || tls->api->set_server_mode(tls, flags) != 0) {
+        fprintf(stderr, "TLS library does not support server mode\n");
+        exit(1);
+    }
+    if (tls->api->load_key(&pk, opts.key, strlen(opts.key)) != 0 ||
+        tls->api->set_own_cert(tls->ctx, opts.cert, strlen(opts.cert)) != 0 ||
+        tls->api->set_own_key(tls->ctx, pk) != 0) {
+        fprintf(stderr, "failed to load server cert[%s]/key[%s]\n", opts.cert, opts.key);
+        exit(1);
+    }
+    return tls;
+}
+
+static int srv_listen(int kind, const char *ca, size_t ca_len, int flags) {
+    struct sockaddr_in addr;
+    uv_ip4_addr(STRESS_HOST, 0, &addr);
+
+    server.tls[kind] = srv_context(ca, ca_len, flags);
+    tlsuv_server_t *srv = &server.listener[kind];
+    tlsuv_server_init(&server.loop, srv, server.tls[kind]);
+    int rc = tlsuv_server_bind(srv, (const struct sockaddr *) &addr, 0);
+    if (rc == 0) {
+        rc = tlsuv_server_listen(srv, 1024, srv_connection);
+    }
+    if (rc != 0) {
+        fprintf(stderr, "failed to start server: %s\n", uv_strerror(rc));
+        return rc;
+    }
+
+    struct sockaddr_in bound;
+    int len = sizeof(bound);
+    uv_tcp_getsockname(&srv->listener, (struct sockaddr *) &bound, &len);
+    server.port[kind] = ntohs(bound.sin_port);
+    return 0;
+}
+
+/*************** victims ***************/
+
+static void victim_write_cb(uv_write_t *wr, int status) {
+    free(wr);
+}
+
+static void victim_ping(uv_timer_t *t) {
+    for (unsigned int i = 0; i < opts.victims; i++) {
+        struct victim *v = &victims[i];
+        if (!v->ready || v->waiting) {
+            continue;
+        }
+
+        uv_write_t *wr = calloc(1, sizeof(*wr));
+        uv_buf_t b = uv_buf_init(v->ping, PING_SIZE);
+        v->sent = uv_hrtime();
+        v->received = 0;
+        v->waiting = true;
+        if (tlsuv_stream_write(wr, &v->stream, &b, victim_write_cb) != 0) {
+            free(wr);
+            v->ready = false;
+        }
+    }
+}
+
+static void victim_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    struct victim *v = (struct victim *) s;
+    if (nread < 0) {
+        if (v->ready) {
+            fprintf(stderr, "victim stream failed: %s\n", uv_strerror((int) nread));
+        }
+        v->ready = false;
+    } else if (nread > 0) {
+        size_t n = (size_t) nread;
+        if (!v->greeted) {
+            v->greeted = true;
+            n -= strlen(GREETING);
+            if (++victims_ready == opts.victims) {
+                uv_timer_start(&ping_timer, victim_ping, 0, opts.ping_ms);
+                start_phase();
+            }
+        }
+        v->received += n;
+        if (v->waiting && v->received >= PING_SIZE) {
+            sample_add(&run.victim_rtt, uv_hrtime() - v->sent);
+            v->waiting = false;
+        }
+    }
+    free(buf->base);
+}
+
+static void victim_connected(uv_connect_t *req, int status) {
+    struct victim *v = (struct victim *) req->handle;
+    if (status != 0) {
+        fprintf(stderr, "victim failed to connect: %s\n", uv_strerror(status));
+        exit(1);
+    }
+    v->ready = true;
+    tlsuv_stream_read(&v->stream, alloc_cb, victim_read);
+}
+
+static void victim_closed(uv_handle_t *h) {
+    tlsuv_stream_free((tlsuv_stream_t *) h);
+}
+
+/*************** storm ***************/
+
+static void report_phase(void) {
+    double secs = (double) (uv_hrtime() - run.start) / 1e9;
+    const char *name = run.phase < 0 ? "baseline" : mode_names[opts.modes[run.phase]];
+    qsort(run.hs.v, run.hs.count, sizeof(uint64_t), cmp_u64);
+    qsort(run.victim_rtt.v, run.victim_rtt.count, sizeof(uint64_t), cmp_u64);
+
+    printf("%-9s %9.0f %8lu %6lu %8lu %8.2f %8.2f %8.2f %8.2f | %8.2f %8.2f %8.2f\n", name,
+           (double) run.completed / secs, run.completed, run.failed, run.resumed,
+           pct_ms(&run.hs, 50), pct_ms(&run.hs, 90), pct_ms(&run.hs, 99), pct_ms(&run.hs, 100),
+           pct_ms(&run.victim_rtt, 50), pct_ms(&run.victim_rtt, 99), pct_ms(&run.victim_rtt, 100));
+    fflush(stdout);
+}
+
+static void end_phase(void) {
+    report_phase();
+    run.phase++;
+    start_phase();
+}
+
+static void storm_closed(uv_handle_t *h) {
+    struct storm_conn *c = (struct storm_conn *) h;
+    tlsuv_stream_free(&c->stream);
+    free(c);
+
+    run.in_flight--;
+    if (!run.launching && run.in_flight == 0) {
+        end_phase();
+    }
+}
+
+static void storm_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    free(buf->base);
+    if (nread != 0) {
+        tlsuv_stream_close((tlsuv_stream_t *) s, storm_closed);
+    }
+}
+
+static void storm_connected(uv_connect_t *req, int status) {
+    struct storm_conn *c = (struct storm_conn *) req->handle;
+    if (status != 0) {
+        run.failed++;
+        tlsuv_stream_close(&c->stream, storm_closed);
+        return;
+    }
+
+    sample_add(&run.hs, uv_hrtime() - c->start);
+    run.completed++;
+    tls_traffic_stats stats;
+    if (tlsuv_stream_stats(&c->stream, &stats) == 0 && stats.resumptions > 0) {
+        run.resumed++;
+    }
+
+    if (opts.modes[run.phase] == MODE_RESUME) {
+        // greeting arrives after session ticket
+        tlsuv_stream_read(&c->stream, alloc_cb, storm_read);
+    } else {
+        tlsuv_stream_close(&c->stream, storm_closed);
+    }
+}
+
+static void storm_launch(enum mode m) {
+    int kind = (m == MODE_MTLS || m == MODE_PKCS11) ? SRV_MTLS : SRV_PLAIN;
+
+    struct storm_conn *c = calloc(1, sizeof(*c));
+    tlsuv_stream_init(loop, &c->stream, client_tls[m]);
+    tlsuv_stream_nodelay(&c->stream, 1);
+    c->start = uv_hrtime();
+    run.started++;
+    run.in_flight++;
+    int rc = tlsuv_stream_connect(&c->req, &c->stream, STRESS_HOST, server.port[kind], storm_connected);
+    if (rc != 0) {
+        run.failed++;
+        tlsuv_stream_close(&c->stream, storm_closed);
+    }
+}
+
+static void storm_tick(uv_timer_t *t) {
+    if (!run.launching) {
+        return;
+    }
+
+    enum mode m = opts.modes[run.phase];
+    uint64_t due = UINT64_MAX;
+    if (opts.rate > 0) {
+        due = (uint64_t) ((double) (uv_hrtime() - run.start) / 1e9 * opts.rate);
+    }
+    while (run.started < due && run.in_flight < opts.concurrency) {
+        storm_launch(m);
+    }
+}
+
+static void phase_done(uv_timer_t *t) {
+    run.launching = false;
+    if (run.in_flight == 0) {
+        end_phase();
+    }
+}
+
+static void start_phase(void) {
+    if (run.phase == opts.mode_count) {
+        uv_timer_stop(&ping_timer);
+        uv_timer_stop(&tick_timer);
+        for (unsigned int i = 0; i < opts.victims; i++) {
+            victims[i].ready = false;
+            tlsuv_stream_close(&victims[i].stream, victim_closed);
+        }
+        uv_async_send(&server.stop);
+        return;
+    }
+
+    if (run.phase < 0) {
+        printf("%-9s %9s %8s %6s %8s %8s %8s %8s %8s | %8s %8s %8s\n", "mode", "hs/s", "ok", "failed", "resumed",
+               "p50(ms)", "p90", "p99", "max", "victim50", "p99", "max");
+    }
+    run.start = uv_hrtime();
+    run.started = 0;
+    run.completed = 0;
+    run.failed = 0;
+    run.resumed = 0;
+    run.hs.count = 0;
+    run.victim_rtt.count = 0;
+    run.launching = run.phase >= 0;
+    uv_timer_start(&phase_timer, phase_done, (uint64_t) (opts.seconds * 1000), 0);
+}
+
+/*************** setup ***************/
+
+static tls_context *client_context(enum mode m) {
+    tls_context *tls = default_tls_context(opts.ca, strlen(opts.ca));
+    tlsuv_private_key_t pk = NULL;
+    int rc = 0;
+
+    if (m == MODE_MTLS) {
+        rc = tls->api->load_key(&pk, opts.key, strlen(opts.key));
+        if (rc == 0) rc = tls->api->set_own_cert(tls->ctx, opts.cert, strlen(opts.cert));
+        if (rc == 0) rc = tls->api->set_own_key(tls->ctx, pk);
+    } else if (m == MODE_PKCS11) {
+        // key's certificate on token is set as client certificate
+        rc = tls->api->load_pkcs11_key(&pk, opts.p11_driver, opts.p11_slot, opts.p11_pin, opts.p11_id, opts.p11_label);
+        if (rc == 0) rc = tls->api->set_own_key(tls->ctx, pk);
+    }
+
+    if (rc != 0) {
+        fprintf(stderr, "failed to set up %s client key: %d\n", mode_names[m], rc);
+        exit(1);
+    }
+    return tls;
+}
+
+// server verifying client certificates trusts test CA, and certificate stored with PKCS#11 key
+static char *mtls_trust(size_t *len) {
+    char *ca = read_file(opts.ca, len);
+    if (ca == NULL || client_tls[MODE_PKCS11] == NULL) {
+        return ca;
+    }
+
+    tls_context *tls = client_tls[MODE_PKCS11];
+    tlsuv_private_key_t pk = NULL;
+    tls_cert cert = NULL;
+    char *pem = NULL;
+    size_t pem_len = 0;
+    if (tls->api->load_pkcs11_key(&pk, opts.p11_driver, opts.p11_slot, opts.p11_pin, opts.p11_id, opts.p11_label) != 0 ||
+        pk->get_certificate == NULL || pk->get_certificate(pk, &cert) != 0 ||
+        tls->api->write_cert_to_pem(cert, 0, &pem, &pem_len) != 0) {
+        fprintf(stderr, "failed to get certificate of PKCS#11 key\n");
+        exit(1);
+    }
+
+    ca = realloc(ca, *len + pem_len + 2);
+    ca[(*len)++] = '\n';
+    memcpy(ca + *len, pem, pem_len);
+    *len += pem_len;
+    ca[*len] = 0;
+
+    free(pem);
+    tls->api->free_cert(&cert);
+    pk->free(pk);
+    return ca;
+}
+
+static int parse_modes(char *list) {
+    opts.mode_count = 0;
+    for (char *p = strtok(list, ","); p && opts.mode_count < MAX_MODES; p = strtok(NULL, ",")) {
+        int m;
+        for (m = 0; m < (int) (sizeof(mode_names) / sizeof(mode_names[0])); m++) {
+            if (strcmp(p, mode_names[m]) == 0) break;
+        }
+        if (m == (int) (sizeof(mode_names) / sizeof(mode_names[0]))) {
+            return -1;
+        }
+        opts.modes[opts.mode_count++] = (enum mode) m;
+    }
+    return opts.mode_count > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-m mode[,mode...]] [-r rate] [-c concurrency] [-d seconds] [-v victims] [-i ping_ms]\n"
+                    "       [-P pkcs11_driver] [-S slot] [-p pin] [-I key_id] [-l key_label]\n"
+                    "modes: full, resume, mtls, pkcs11\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] != '-' || strlen(a) != 2 || i + 1 == argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        char *v = argv[++i];
+        switch (a[1]) {
+            case 'm':
+                if (parse_modes(v) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r': opts.rate = strtod(v, NULL); break;
+            case 'c': opts.concurrency = (unsigned int) strtoul(v, NULL, 10); break;
+            case 'd': opts.seconds = strtod(v, NULL); break;
+            case 'v': opts.victims = (unsigned int) strtoul(v, NULL, 10); break;
+            case 'i': opts.ping_ms = (unsigned int) strtoul(v, NULL, 10); break;
+            case 'P': opts.p11_driver = v; break;
+            case 'S': opts.p11_slot = v; break;
+            case 'p': opts.p11_pin = v; break;
+            case 'I': opts.p11_id = v; break;
+            case 'l': opts.p11_label = v; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (opts.concurrency == 0 || opts.seconds <= 0 || opts.ping_ms == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+#if !defined(_WIN32)
+    // server writes to connections closed by storm clients
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    loop = uv_default_loop();
+    for (int i = 0; i < opts.mode_count; i++) {
+        enum mode m = opts.modes[i];
+        if (m == MODE_PKCS11 && opts.p11_driver == NULL) {
+            fprintf(stderr, "pkcs11 mode requires PKCS#11 driver(-P)\n");
+            return 1;
+        }
+        if (client_tls[m] == NULL) {
+            client_tls[m] = client_context(m);
+        }
+    }
+    // victims cache session tickets, keep them away from full handshake context
+    victim_tls = client_context(MODE_FULL);
+
+    uv_loop_init(&server.loop);
+    uv_async_init(&server.loop, &server.stop, srv_stop);
+    if (srv_listen(SRV_PLAIN, NULL, 0, TLS_SERVER_MODE) != 0) {
+        return 1;
+    }
+    if (client_tls[MODE_MTLS] || client_tls[MODE_PKCS11]) {
+        size_t trust_len = 0;
+        char *trust = mtls_trust(&trust_len);
+        if (trust == NULL) {
+            fprintf(stderr, "failed to read CA[%s]\n", opts.ca);
+            return 1;
+        }
+        int rc = srv_listen(SRV_MTLS, trust, trust_len, TLS_SERVER_MODE | TLS_SERVER_VERIFY_CLIENT);
+        free(trust);
+        if (rc != 0) {
+            return 1;
+        }
+    }
+    uv_thread_create(&server.thread, srv_run, NULL);
+
+    printf("TLS: %s, rate: %s, concurrency: %u, victims: %u (ping every %ums)\n",
+           victim_tls->api->version(), opts.rate > 0 ? "limited" : "unlimited",
+           opts.concurrency, opts.victims, opts.ping_ms);
+    if (opts.rate > 0) {
+        printf("target rate: %.0f handshakes/s\n", opts.rate);
+    }
+
+    run.phase = -1;
+    run.hs.v = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    run.victim_rtt.v = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    uv_timer_init(loop, &tick_timer);
+    uv_timer_init(loop, &ping_timer);
+    uv_timer_init(loop, &phase_timer);
+    uv_timer_start(&tick_timer, storm_tick, 0, 1);
+
+    // victims are established first, baseline phase starts when all of them are connected
+    victims = calloc(opts.victims, sizeof(struct victim));
+    for (unsigned int i = 0; i < opts.victims; i++) {
+        struct victim *v = &victims[i];
+        memset(v->ping, 'v', PING_SIZE);
+        tlsuv_stream_init(loop, &v->stream, victim_tls);
+        tlsuv_stream_nodelay(&v->stream, 1);
+        tlsuv_stream_connect(&v->req, &v->stream, STRESS_HOST, server.port[SRV_PLAIN], victim_connected);
+    }
+    if (opts.victims == 0) {
+        start_phase();
+    }
+
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_close((uv_handle_t *) &tick_timer, NULL);
+    uv_close((uv_handle_t *) &ping_timer, NULL);
+    uv_close((uv_handle_t *) &phase_timer, NULL);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_thread_join(&server.thread);
+
+    for (int k = 0; k < SRV_KINDS; k++) {
+        if (server.tls[k]) server.tls[k]->api->free_ctx(server.tls[k]);
+    }
+    for (int m = 0; m < 4; m++) {
+        if (client_tls[m]) client_tls[m]->api->free_ctx(client_tls[m]);
+    }
+    victim_tls->api->free_ctx(victim_tls);
+    free(victims);
+    free(run.hs.v);
+    free(run.victim_rtt.v);
+    uv_loop_close(&server.loop);
+    uv_loop_close(loop);
+    return 0;
+}
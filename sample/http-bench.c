@@ -0,0 +1,413 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// HTTP client load generator: keeps `concurrency` requests in flight for `duration` seconds (optionally capped at
+// `rate` requests/s) and reports throughput and latency histograms of connect, TLS handshake, TTFB and total time
+// usage: http-bench [-c concurrency] [-n connections] [-d seconds] [-r rate] [-s body_size] [-k 0|1]
+//                   [-p pipeline_depth] [-2] [-a ca_file] [-v] URL
+// e.g. against tests/test_server: http-bench -c 50 -n 8 -a tests/certs/ca.pem https://localhost:8443/get
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include <tlsuv/http.h>
+#include <tlsuv/tlsuv.h>
+
+#include "common.h"
+
+// log-linear histogram of microsecond values, HIST_SUB buckets per power of two (~3% precision)
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct hist_s {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+enum phase {
+    PHASE_CONNECT,
+    PHASE_TLS,
+    PHASE_TTFB,
+    PHASE_TOTAL,
+    PHASE_COUNT,
+};
+
+static const char *phase_names[PHASE_COUNT] = {"connect", "tls", "ttfb", "total"};
+
+struct slot_s {
+    tlsuv_http_req_t *req;
+    uv_timer_t timer;
+    uint64_t start;
+    uint64_t next_start;
+};
+
+static struct {
+    size_t concurrency;
+    size_t connections;
+    double seconds;
+    double rate;
+    size_t body_size;
+    int keep_alive;
+    size_t pipeline;
+    bool http2;
+    const char *ca;
+    const char *url;
+    const char *path;
+} opts = {
+        .concurrency = 10,
+        .connections = 0,
+        .seconds = 10,
+        .keep_alive = 1,
+        .path = "/",
+};
+
+static struct {
+    uint64_t start;
+    uint64_t end;
+    bool running;
+    bool finished;
+    size_t active;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t non_2xx;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    hist_t phases[PHASE_COUNT];
+} bench;
+
+static tlsuv_http_t clt;
+static tls_context *tls;
+static uv_timer_t stop_timer;
+static struct slot_s *slots;
+static char *body;
+
+static unsigned int hist_index(uint64_t v) {
+    if (v < 2 * HIST_SUB) {
+        return (unsigned int) v;
+    }
+    unsigned int msb = 63;
+    while ((v >> msb) == 0) msb--;
+    unsigned int shift = msb - HIST_SUB_BITS;
+    unsigned int idx = (shift + 1) * HIST_SUB + (unsigned int) ((v >> shift) - HIST_SUB);
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+static uint64_t hist_value(unsigned int idx) {
+    if (idx < 2 * HIST_SUB) {
+        return idx;
+    }
+    unsigned int shift = idx / HIST_SUB - 1;
+    return ((uint64_t) (idx % HIST_SUB) + HIST_SUB) << shift;
+}
+
+static void hist_add(hist_t *h, uint64_t usec) {
+    h->count++;
+    h->sum += usec;
+    if (usec > h->max) h->max = usec;
+    h->buckets[hist_index(usec)]++;
+}
+
+static uint64_t hist_quantile(const hist_t *h, double q) {
+    uint64_t rank = (uint64_t) (q * (double) h->count);
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            uint64_t v = hist_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void send_next(struct slot_s *s);
+
+static void slot_timer_cb(uv_timer_t *t) {
+    send_next(t->data);
+}
+
+static void finish_cb(uv_timer_t *t) {
+    bench.end = uv_hrtime();
+    uv_close((uv_handle_t *) &stop_timer, NULL);
+    for (size_t i = 0; i < opts.concurrency; i++) {
+        uv_close((uv_handle_t *) &slots[i].timer, NULL);
+    }
+    tlsuv_http_close(&clt, NULL);
+}
+
+// client is not closed from its own callbacks
+static void finish(void) {
+    if (!bench.finished) {
+        bench.finished = true;
+        uv_timer_start(&stop_timer, finish_cb, 0, 0);
+    }
+}
+
+static void complete(struct slot_s *s, tlsuv_http_req_t *req, bool ok) {
+    if (s->req != req) {
+        return;
+    }
+    s->req = NULL;
+
+    uint64_t now = uv_hrtime();
+    bench.requests++;
+    if (!ok) {
+        bench.errors++;
+    }
+    hist_add(&bench.phases[PHASE_TOTAL], (now - s->start) / 1000);
+    bench.active--;
+
+    if (!bench.running) {
+        if (bench.active == 0) {
+            finish();
+        }
+        return;
+    }
+
+    // under rate limit each slot sends on its own schedule, latency is counted from the scheduled time
+    // so that server stalls are not hidden by the client waiting for them (coordinated omission)
+    uint64_t delay = 0;
+    if (opts.rate > 0) {
+        s->next_start += (uint64_t) ((double) opts.concurrency * 1e9 / opts.rate);
+        delay = s->next_start > now ? (s->next_start - now) / 1000000 : 0;
+    }
+    uv_timer_start(&s->timer, slot_timer_cb, delay, 0);
+}
+
+static void on_resp(tlsuv_http_resp_t *resp, void *data) {
+    struct slot_s *s = data;
+    if (resp->code < 0) {
+        if (opts.rate == 0 && bench.errors == 0) {
+            fprintf(stderr, "request failed: %d(%s)\n", resp->code, uv_strerror(resp->code));
+        }
+        complete(s, resp->req, false);
+        return;
+    }
+    if (resp->code < 200 || resp->code >= 300) {
+        bench.non_2xx++;
+    }
+}
+
+static void on_body(tlsuv_http_req_t *req, const char *b, ssize_t len) {
+    if (len > 0) {
+        bench.bytes_in += (uint64_t) len;
+        return;
+    }
+    complete(req->data, req, len == UV_EOF);
+}
+
+static void on_timing(const tlsuv_timing_t *t, void *data) {
+    if (t->connect_end > 0) {
+        uint64_t start = t->resolve_start > 0 ? t->resolve_start : t->resolve_end;
+        if (start > 0) {
+            hist_add(&bench.phases[PHASE_CONNECT], (t->connect_end - start) / 1000);
+        }
+        if (t->hs_complete > 0) {
+            hist_add(&bench.phases[PHASE_TLS], (t->hs_complete - t->connect_end) / 1000);
+        }
+    }
+    if (t->req_written > 0 && t->first_byte > t->req_written) {
+        hist_add(&bench.phases[PHASE_TTFB], (t->first_byte - t->req_written) / 1000);
+    }
+}
+
+static void send_next(struct slot_s *s) {
+    if (!bench.running) {
+        if (bench.active == 0) {
+            finish();
+        }
+        return;
+    }
+
+    // timers have millisecond resolution and may fire just before scheduled time
+    uint64_t now = uv_hrtime();
+    s->start = opts.rate > 0 && s->next_start < now ? s->next_start : now;
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, opts.body_size > 0 ? "POST" : "GET", opts.path, on_resp, s);
+    req->resp.body_cb = on_body;
+    req->timing_cb = on_timing;
+    if (!opts.keep_alive) {
+        tlsuv_http_req_header(req, "Connection", "close");
+    }
+    if (opts.body_size > 0) {
+        tlsuv_http_req_data(req, body, opts.body_size, NULL);
+        bench.bytes_out += opts.body_size;
+    }
+    s->req = req;
+    bench.active++;
+}
+
+static void stop_cb(uv_timer_t *t) {
+    if (bench.running) {
+        bench.running = false;
+        // give requests in flight a few seconds to complete
+        uv_timer_start(t, stop_cb, 5000, 0);
+        if (bench.active == 0) {
+            finish();
+        }
+        return;
+    }
+    fprintf(stderr, "cancelling %zu requests in flight\n", bench.active);
+    tlsuv_http_cancel_all(&clt);
+}
+
+static void report(void) {
+    double secs = (double) (bench.end - bench.start) / 1e9;
+    printf("%-8s %s\n", "url", opts.url);
+    printf("%-8s concurrency=%zu connections=%zu keep-alive=%s http2=%s pipeline=%zu body=%zu rate=%.0f\n", "config",
+           opts.concurrency, opts.connections, opts.keep_alive ? "on" : "off", opts.http2 ? "on" : "off",
+           opts.pipeline, opts.body_size, opts.rate);
+    printf("%-8s %llu in %.2fs, %llu errors, %llu non-2xx\n", "requests",
+           (unsigned long long) bench.requests, secs,
+           (unsigned long long) bench.errors, (unsigned long long) bench.non_2xx);
+    printf("%-8s %.1f req/s, in %.2f MB/s, out %.2f MB/s\n\n", "rate",
+           (double) bench.requests / secs, (double) bench.bytes_in / secs / 1e6, (double) bench.bytes_out / secs / 1e6);
+
+    printf("%-8s %10s %10s %10s %10s %10s %10s %10s\n", "latency", "count", "avg(us)",
+           "p50", "p90", "p99", "p99.9", "max");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const hist_t *h = &bench.phases[p];
+        if (h->count == 0) {
+            printf("%-8s %10d\n", phase_names[p], 0);
+            continue;
+        }
+        printf("%-8s %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n", phase_names[p],
+               (unsigned long long) h->count,
+               (unsigned long long) (h->sum / h->count),
+               (unsigned long long) hist_quantile(h, 0.5),
+               (unsigned long long) hist_quantile(h, 0.9),
+               (unsigned long long) hist_quantile(h, 0.99),
+               (unsigned long long) hist_quantile(h, 0.999),
+               (unsigned long long) h->max);
+    }
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-c concurrency] [-n connections] [-d seconds] [-r rate] [-s body_size] [-k 0|1]\n"
+                    "       [-p pipeline_depth] [-2] [-a ca_file] [-v] URL\n", prog);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int verbose = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] != '-') {
+            opts.url = a;
+        } else if (strcmp(a, "-2") == 0) {
+            opts.http2 = true;
+        } else if (strcmp(a, "-v") == 0) {
+            verbose++;
+        } else if (i + 1 < argc) {
+            const char *v = argv[++i];
+            switch (a[1]) {
+                case 'c': opts.concurrency = strtoul(v, NULL, 10); break;
+                case 'n': opts.connections = strtoul(v, NULL, 10); break;
+                case 'd': opts.seconds = strtod(v, NULL); break;
+                case 'r': opts.rate = strtod(v, NULL); break;
+                case 's': opts.body_size = strtoul(v, NULL, 10); break;
+                case 'k': opts.keep_alive = (int) strtol(v, NULL, 10); break;
+                case 'p': opts.pipeline = strtoul(v, NULL, 10); break;
+                case 'a': opts.ca = v; break;
+                default: return usage(argv[0]);
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (opts.url == NULL || opts.concurrency == 0 || opts.seconds <= 0) {
+        return usage(argv[0]);
+    }
+    if (opts.connections == 0) {
+        opts.connections = opts.concurrency;
+    }
+
+    struct tlsuv_url_s u;
+    if (tlsuv_parse_url(&u, opts.url) != 0 || u.hostname == NULL) {
+        fprintf(stderr, "invalid URL: %s\n", opts.url);
+        return 1;
+    }
+    // client is initialized with scheme://host:port, the rest is request path
+    char base[1024];
+    int len = snprintf(base, sizeof(base), "%.*s://%.*s", (int) u.scheme_len, u.scheme,
+                       (int) u.hostname_len, u.hostname);
+    if (u.port != 0) {
+        snprintf(base + len, sizeof(base) - len, ":%d", u.port);
+    }
+    if (u.path != NULL) {
+        opts.path = u.path;
+    }
+
+    if (verbose) {
+        tlsuv_set_debug(verbose + 2, logger);
+    }
+
+    uv_loop_t *loop = uv_default_loop();
+    if (tlsuv_http_init(loop, &clt, base) != 0) {
+        fprintf(stderr, "failed to initialize client for %s\n", base);
+        return 1;
+    }
+    if (opts.ca) {
+        tls = default_tls_context(opts.ca, strlen(opts.ca));
+        tlsuv_http_set_ssl(&clt, tls);
+    }
+    tlsuv_http_max_connections(&clt, opts.connections);
+    tlsuv_http_idle_keepalive(&clt, opts.keep_alive ? 60000 : 0);
+    if (opts.pipeline > 1) {
+        tlsuv_http_pipelining(&clt, opts.pipeline);
+    }
+    if (opts.http2 && tlsuv_http_set_http2(&clt, true) != 0) {
+        fprintf(stderr, "HTTP/2 is not supported by this build\n");
+        return 1;
+    }
+
+    if (opts.body_size > 0) {
+        body = malloc(opts.body_size);
+        memset(body, 'b', opts.body_size);
+    }
+    slots = calloc(opts.concurrency, sizeof(struct slot_s));
+
+    bench.running = true;
+    bench.start = uv_hrtime();
+    uv_timer_init(loop, &stop_timer);
+    uv_timer_start(&stop_timer, stop_cb, (uint64_t) (opts.seconds * 1000), 0);
+    for (size_t i = 0; i < opts.concurrency; i++) {
+        struct slot_s *s = &slots[i];
+        uv_timer_init(loop, &s->timer);
+        s->timer.data = s;
+        // spread rate limited slots evenly over the first interval
+        s->next_start = bench.start;
+        if (opts.rate > 0) {
+            s->next_start += (uint64_t) ((double) i * 1e9 / opts.rate);
+            uv_timer_start(&s->timer, slot_timer_cb, (s->next_start - bench.start) / 1000000, 0);
+        } else {
+            send_next(s);
+        }
+    }
+
+    uv_run(loop, UV_RUN_DEFAULT);
+    report();
+
+    if (tls) {
+        tls->api->free_ctx(tls);
+    }
+    free(slots);
+    free(body);
+    uv_loop_close(loop);
+    return bench.errors > 0 ? 2 : 0;
+}
@@ -0,0 +1,395 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// idle connection memory: opens N connections of every type against the test server, leaves them idle
+// and reports heap and RSS growth per connection. Heap is taken from library allocation counters broken down
+// by subsystem (library built with TLSUV_ALLOC_STATS), otherwise only RSS is available.
+// Exits with status 2 if growth per connection exceeds the budget of its type (heap, or RSS without counters),
+// or 1 if any connection failed.
+// types:
+//   stream - tlsuv_stream_t with TLS session, reading
+//   http   - tlsuv_http_t keep-alive connection after one request
+//   ws     - tlsuv_websocket_t, server must accept websocket upgrade
+// usage: idle-mem [-n connections] [-t type[,type...]] [-u https_url] [-w wss_url] [-a ca_file]
+//                 [-s settle_ms] [-b type=bytes[,type=bytes...]]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include <tlsuv/tlsuv.h>
+#include <tlsuv/http.h>
+#include <tlsuv/websocket.h>
+
+#define xstr(s) str__(s)
+#define str__(s) #s
+
+#if defined(BENCH_CERT_DIR)
+#define DEFAULT_CA xstr(BENCH_CERT_DIR) "/ca.pem"
+#else
+#define DEFAULT_CA "ca.pem"
+#endif
+
+// connections that do not complete by then are counted as failed
+#define CONNECT_TIMEOUT 30000
+
+enum conn_type {
+    TYPE_STREAM,
+    TYPE_HTTP,
+    TYPE_WS,
+    TYPE_COUNT,
+};
+
+static const char *const type_names[] = {
+        [TYPE_STREAM] = "stream",
+        [TYPE_HTTP] = "http",
+        [TYPE_WS] = "ws",
+};
+
+static const char *const subsys_names[TLSUV_MEM_SUBSYS_COUNT] = {
+        [TLSUV_MEM_CORE] = "core",
+        [TLSUV_MEM_TLS] = "tls",
+        [TLSUV_MEM_HTTP] = "http",
+        [TLSUV_MEM_WEBSOCKET] = "ws",
+        [TLSUV_MEM_CRYPTO] = "crypto",
+};
+
+static struct {
+    size_t connections;
+    bool types[TYPE_COUNT];
+    const char *url;
+    const char *ws_url;
+    const char *ca;
+    unsigned int settle_ms;
+    size_t budget[TYPE_COUNT];
+} opts = {
+        .connections = 100,
+        .types = { true, true, false },
+        .url = "https://localhost:8443/json",
+        .ws_url = "wss://localhost:8443/websocket/echo",
+        .ca = DEFAULT_CA,
+        .settle_ms = 500,
+};
+
+struct snapshot {
+    size_t rss;
+    bool heap;
+    size_t in_use[TLSUV_MEM_SUBSYS_COUNT];
+};
+
+union conn {
+    struct {
+        tlsuv_stream_t s;
+        uv_connect_t req;
+    } stream;
+    tlsuv_http_t http;
+    struct {
+        tlsuv_websocket_t ws;
+        uv_connect_t req;
+    } ws;
+};
+
+static uv_loop_t *loop;
+static tls_context *tls;
+static uv_timer_t timer;
+
+static struct {
+    enum conn_type type;
+    union conn *conns;
+    size_t done;
+    size_t failed;
+    struct snapshot before;
+    bool over_budget;
+    bool conn_failed;
+} run;
+
+static void snapshot(struct snapshot *s) {
+    uv_resident_set_memory(&s->rss);
+    s->heap = true;
+    for (int i = 0; i < TLSUV_MEM_SUBSYS_COUNT; i++) {
+        tlsuv_mem_stats st;
+        if (tlsuv_mem_get_stats((tlsuv_mem_subsys) i, &st) != 0) {
+            s->heap = false;
+            return;
+        }
+        s->in_use[i] = st.bytes_in_use;
+    }
+}
+
+static double per_conn(size_t after, size_t before, size_t count) {
+    return after > before && count > 0 ? (double) (after - before) / (double) count : 0.0;
+}
+
+static void close_all(void);
+
+static void measure(uv_timer_t *t) {
+    struct snapshot after;
+    snapshot(&after);
+    size_t connected = opts.connections - run.failed;
+
+    double rss = per_conn(after.rss, run.before.rss, connected);
+    double heap = 0;
+    printf("%-8s %6zu %6zu %10.0f", type_names[run.type], connected, run.failed, rss);
+    if (after.heap) {
+        size_t total_before = 0, total_after = 0;
+        for (int i = 0; i < TLSUV_MEM_SUBSYS_COUNT; i++) {
+            total_before += run.before.in_use[i];
+            total_after += after.in_use[i];
+        }
+        heap = per_conn(total_after, total_before, connected);
+        printf(" %10.0f", heap);
+        for (int i = 0; i < TLSUV_MEM_SUBSYS_COUNT; i++) {
+            printf(" %8.0f", per_conn(after.in_use[i], run.before.in_use[i], connected));
+        }
+    } else {
+        printf(" %10s", "n/a");
+    }
+
+    size_t budget = opts.budget[run.type];
+    double used = after.heap ? heap : rss;
+    bool over = budget > 0 && (connected == 0 || used > (double) budget);
+    if (budget > 0) {
+        printf("  budget %zu %s", budget, over ? "EXCEEDED" : "ok");
+    }
+    printf("\n");
+    run.over_budget |= over;
+    run.conn_failed |= run.failed > 0;
+
+    close_all();
+}
+
+static void conn_done(int status) {
+    if (status != 0) {
+        run.failed++;
+    }
+    if (++run.done == opts.connections) {
+        // let responses finish and buffers go back before measuring
+        uv_timer_start(&timer, measure, opts.settle_ms, 0);
+    }
+}
+
+static void alloc_cb(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    buf->base = malloc(suggested);
+    buf->len = suggested;
+}
+
+static void stream_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    free(buf->base);
+}
+
+static void stream_connected(uv_connect_t *req, int status) {
+    if (status == 0) {
+        tlsuv_stream_read((tlsuv_stream_t *) req->handle, alloc_cb, stream_read);
+    } else {
+        fprintf(stderr, "stream failed to connect: %d(%s)\n", status, uv_strerror(status));
+    }
+    conn_done(status);
+}
+
+static void stream_closed(uv_handle_t *h) {
+    tlsuv_stream_free((tlsuv_stream_t *) h);
+}
+
+static void http_resp(tlsuv_http_resp_t *resp, void *data) {
+    if (resp->code < 0) {
+        fprintf(stderr, "http request failed: %d(%s)\n", resp->code, uv_strerror(resp->code));
+    }
+    conn_done(resp->code < 0 ? resp->code : 0);
+}
+
+static void ws_connected(uv_connect_t *req, int status) {
+    if (status != 0) {
+        fprintf(stderr, "websocket failed to connect: %d(%s)\n", status, uv_strerror(status));
+    }
+    conn_done(status);
+}
+
+static void ws_data(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+}
+
+static void close_all(void) {
+    uv_timer_stop(&timer);
+    for (size_t i = 0; i < opts.connections; i++) {
+        union conn *c = &run.conns[i];
+        switch (run.type) {
+            case TYPE_STREAM:
+                tlsuv_stream_close(&c->stream.s, stream_closed);
+                break;
+            case TYPE_HTTP:
+                tlsuv_http_close(&c->http, NULL);
+                break;
+            case TYPE_WS:
+                tlsuv_websocket_close(&c->ws.ws, NULL);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void connect_timeout(uv_timer_t *t) {
+    fprintf(stderr, "%s: %zu connections did not complete\n", type_names[run.type], opts.connections - run.done);
+    run.failed += opts.connections - run.done;
+    measure(t);
+}
+
+static int open_conns(enum conn_type type) {
+    struct tlsuv_url_s url;
+    if (tlsuv_parse_url(&url, opts.url) != 0) {
+        fprintf(stderr, "invalid URL: %s\n", opts.url);
+        return -1;
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int) url.hostname_len, url.hostname);
+    char origin[512];
+    snprintf(origin, sizeof(origin), "%.*s://%s:%d", (int) url.scheme_len, url.scheme, host, url.port);
+    char path[512];
+    snprintf(path, sizeof(path), "%.*s", (int) url.path_len, url.path_len > 0 ? url.path : "/");
+
+    for (size_t i = 0; i < opts.connections; i++) {
+        union conn *c = &run.conns[i];
+        int rc = 0;
+        switch (type) {
+            case TYPE_STREAM:
+                tlsuv_stream_init(loop, &c->stream.s, tls);
+                rc = tlsuv_stream_connect(&c->stream.req, &c->stream.s, host, url.port, stream_connected);
+                break;
+            case TYPE_HTTP:
+                tlsuv_http_init(loop, &c->http, origin);
+                tlsuv_http_set_ssl(&c->http, tls);
+                tlsuv_http_idle_keepalive(&c->http, -1);
+                tlsuv_http_req(&c->http, "GET", path, http_resp, NULL);
+                break;
+            case TYPE_WS:
+                tlsuv_websocket_init(loop, &c->ws.ws);
+                tlsuv_websocket_set_tls(&c->ws.ws, tls);
+                rc = tlsuv_websocket_connect(&c->ws.req, &c->ws.ws, opts.ws_url, ws_connected, ws_data);
+                break;
+            default:
+                break;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "%s: failed to start connection: %d(%s)\n", type_names[type], rc, uv_strerror(rc));
+            conn_done(rc);
+        }
+    }
+    return 0;
+}
+
+static void run_type(enum conn_type type) {
+    memset(&run.conns[0], 0, opts.connections * sizeof(union conn));
+    run.type = type;
+    run.done = 0;
+    run.failed = 0;
+
+    snapshot(&run.before);
+    uv_timer_start(&timer, connect_timeout, CONNECT_TIMEOUT, 0);
+    if (open_conns(type) != 0) {
+        uv_timer_stop(&timer);
+        return;
+    }
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+static int parse_types(char *list) {
+    memset(opts.types, 0, sizeof(opts.types));
+    for (char *p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+        int t;
+        for (t = 0; t < TYPE_COUNT && strcmp(p, type_names[t]) != 0; t++);
+        if (t == TYPE_COUNT) return -1;
+        opts.types[t] = true;
+    }
+    return 0;
+}
+
+static int parse_budgets(char *list) {
+    for (char *p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+        char *eq = strchr(p, '=');
+        if (eq == NULL) return -1;
+        *eq = 0;
+        int t;
+        for (t = 0; t < TYPE_COUNT && strcmp(p, type_names[t]) != 0; t++);
+        if (t == TYPE_COUNT) return -1;
+        opts.budget[t] = strtoul(eq + 1, NULL, 10);
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n connections] [-t type[,type...]] [-u https_url] [-w wss_url] [-a ca_file]\n"
+                    "       [-s settle_ms] [-b type=bytes[,type=bytes...]]\n"
+                    "types: stream, http, ws\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] != '-' || strlen(a) != 2 || i + 1 == argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        char *v = argv[++i];
+        int rc = 0;
+        switch (a[1]) {
+            case 'n': opts.connections = strtoul(v, NULL, 10); break;
+            case 't': rc = parse_types(v); break;
+            case 'u': opts.url = v; break;
+            case 'w': opts.ws_url = v; break;
+            case 'a': opts.ca = v; break;
+            case 's': opts.settle_ms = (unsigned int) strtoul(v, NULL, 10); break;
+            case 'b': rc = parse_budgets(v); break;
+            default: rc = -1; break;
+        }
+        if (rc != 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.connections == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    loop = uv_default_loop();
+    tls = default_tls_context(opts.ca, strlen(opts.ca));
+    uv_timer_init(loop, &timer);
+    run.conns = calloc(opts.connections, sizeof(union conn));
+
+    struct snapshot probe;
+    snapshot(&probe);
+    printf("%s, %zu connections per type, bytes per connection\n", tls->api->version(), opts.connections);
+    printf("%-8s %6s %6s %10s %10s", "type", "conns", "failed", "rss", "heap");
+    if (probe.heap) {
+        for (int i = 0; i < TLSUV_MEM_SUBSYS_COUNT; i++) {
+            printf(" %8s", subsys_names[i]);
+        }
+    }
+    printf("\n");
+
+    for (int t = 0; t < TYPE_COUNT; t++) {
+        if (opts.types[t]) {
+            run_type((enum conn_type) t);
+        }
+    }
+
+    uv_close((uv_handle_t *) &timer, NULL);
+    uv_run(loop, UV_RUN_DEFAULT);
+    free(run.conns);
+    tls->api->free_ctx(tls);
+    uv_loop_close(loop);
+    return run.over_budget ? 2 : run.conn_failed ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// TLS echo server, every thread runs its own loop and listener bound with SO_REUSEPORT
+// usage: tls-server <cert> <key> [port] [threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tlsuv/tlsuv.h>
+#include <uv.h>
+
+#include "common.h"
+
+#define MAX_THREADS 64
+
+struct worker {
+    uv_thread_t thread;
+    uv_loop_t loop;
+    tlsuv_server_t server;
+    unsigned long accepted;
+};
+
+struct conn {
+    tlsuv_stream_t stream;
+    uv_connect_t req;
+};
+
+static struct {
+    const char *cert;
+    const char *key;
+    int port;
+    int threads;
+} opts = {
+        .port = 8443,
+        .threads = 4,
+};
+
+static void alloc_cb(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    buf->base = malloc(suggested);
+    buf->len = suggested;
+}
+
+static void on_conn_close(uv_handle_t *h) {
+    struct conn *c = (struct conn *) h;
+    tlsuv_stream_free(&c->stream);
+    free(c);
+}
+
+static void on_echo_write(uv_write_t *wr, int status) {
+    free(wr->data);
+    free(wr);
+}
+
+static void on_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    tlsuv_stream_t *stream = (tlsuv_stream_t *) s;
+    if (nread < 0) {
+        tlsuv_stream_close(stream, on_conn_close);
+    } else if (nread > 0) {
+        uv_write_t *wr = calloc(1, sizeof(*wr));
+        wr->data = buf->base;
+        uv_buf_t b = uv_buf_init(buf->base, (unsigned int) nread);
+        if (tlsuv_stream_write(wr, stream, &b, on_echo_write) == 0) {
+            return;
+        }
+        free(wr);
+    }
+    free(buf->base);
+}
+
+static void on_handshake(uv_connect_t *req, int status) {
+    tlsuv_stream_t *stream = (tlsuv_stream_t *) req->handle;
+    if (status != 0) {
+        fprintf(stderr, "handshake failed: %s\n", uv_strerror(status));
+        tlsuv_stream_close(stream, on_conn_close);
+    }
+}
+
+static void on_connection(tlsuv_server_t *srv, int status) {
+    struct worker *w = srv->data;
+    if (status != 0) {
+        return;
+    }
+
+    struct conn *c = calloc(1, sizeof(*c));
+    tlsuv_stream_init(srv->loop, &c->stream, srv->tls);
+    if (tlsuv_server_accept(srv, &c->stream, &c->req, on_handshake) != 0) {
+        tlsuv_stream_free(&c->stream);
+        free(c);
+        return;
+    }
+    tlsuv_stream_read(&c->stream, alloc_cb, on_read);
+    w->accepted++;
+}
+
+static void run_worker(void *arg) {
+    struct worker *w = arg;
+    uv_run(&w->loop, UV_RUN_DEFAULT);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <cert> <key> [port] [threads]\n", argv[0]);
+        return 1;
+    }
+    opts.cert = argv[1];
+    opts.key = argv[2];
+    if (argc > 3) opts.port = atoi(argv[3]);
+    if (argc > 4) opts.threads = atoi(argv[4]);
+    if (opts.threads < 1 || opts.threads > MAX_THREADS) {
+        fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    tlsuv_set_debug(3, logger);
+
+    // context is shared by all loops
+    tls_context *tls = default_tls_context(NULL, 0);
+    tlsuv_private_key_t pk;
+    if (tls->api->set_server_mode == NULL ||
+        tls->api->set_server_mode(tls, TLS_SERVER_MODE) != 0) {
+        fprintf(stderr, "TLS library does not support server mode\n");
+        return 1;
+    }
+    if (tls->api->load_key(&pk, opts.key, strlen(opts.key)) != 0 ||
+        tls->api->set_own_cert(tls->ctx, opts.cert, strlen(opts.cert)) != 0 ||
+        tls->api->set_own_key(tls->ctx, pk) != 0) {
+        fprintf(stderr, "failed to load server cert/key\n");
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("0.0.0.0", opts.port, &addr);
+
+    struct worker *workers = calloc(opts.threads, sizeof(*workers));
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *w = &workers[i];
+        uv_loop_init(&w->loop);
+        tlsuv_server_init(&w->loop, &w->server, tls);
+        w->server.data = w;
+
+        int rc = tlsuv_server_bind(&w->server, (const struct sockaddr *) &addr,
+                                   opts.threads > 1 ? TLSUV_SERVER_REUSEPORT : 0);
+        if (rc == 0) {
+            rc = tlsuv_server_listen(&w->server, 128, on_connection);
+        }
+        if (rc != 0) {
+            fprintf(stderr, "failed to listen on port %d: %s\n", opts.port, uv_strerror(rc));
+            return 1;
+        }
+    }
+
+    printf("listening on port %d with %d loop(s)\n", opts.port, opts.threads);
+    for (int i = 0; i < opts.threads; i++) {
+        uv_thread_create(&workers[i].thread, run_worker, &workers[i]);
+    }
+    for (int i = 0; i < opts.threads; i++) {
+        uv_thread_join(&workers[i].thread);
+    }
+
+    free(workers);
+    tls->api->free_ctx(tls);
+    return 0;
+}
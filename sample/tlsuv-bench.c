@@ -0,0 +1,307 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// measures TLS engine throughput, small record latency and handshake cost with client and server engines
+// connected through memory buffers, one JSON object per result line
+// usage: tlsuv-bench [-t seconds] [-c cert] [-k key] [-a ca]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include <tlsuv/tls_engine.h>
+
+#define xstr(s) str__(s)
+#define str__(s) #s
+
+#if defined(BENCH_CERT_DIR)
+#define DEFAULT_CERT xstr(BENCH_CERT_DIR) "/server.crt"
+#define DEFAULT_KEY xstr(BENCH_CERT_DIR) "/server.key"
+#define DEFAULT_CA xstr(BENCH_CERT_DIR) "/ca.pem"
+#else
+#define DEFAULT_CERT "server.crt"
+#define DEFAULT_KEY "server.key"
+#define DEFAULT_CA "ca.pem"
+#endif
+
+#define BENCH_HOST "localhost"
+#define BUF_SIZE (256 * 1024)
+#define LATENCY_MSG 64
+#define MAX_SAMPLES 200000
+
+static struct {
+    double seconds;
+    const char *cert;
+    const char *key;
+    const char *ca;
+} opts = {
+        .seconds = 1.0,
+        .cert = DEFAULT_CERT,
+        .key = DEFAULT_KEY,
+        .ca = DEFAULT_CA,
+};
+
+static const struct {
+    const char *name;
+    tls_cipher_profile profile;
+} profiles[] = {
+        {"default", TLS_CIPHERS_DEFAULT},
+        {"aes-gcm", TLS_CIPHERS_THROUGHPUT},
+        {"chacha20", TLS_CIPHERS_LOW_CPU},
+};
+
+static const size_t record_sizes[] = { 256, 1024, 4096, 16384 };
+
+static char c2s[BUF_SIZE];
+static char s2c[BUF_SIZE];
+static char plain[BUF_SIZE];
+static const char *lib_version;
+
+static tls_context *server_ctx(tls_cipher_profile profile) {
+    tls_context *tls = default_tls_context(NULL, 0);
+    tlsuv_private_key_t pk = NULL;
+    if (tls->api->set_server_mode == NULL || tls->api->set_server_mode(tls, TLS_SERVER_MODE) != 0) {
+        fprintf(stderr, "TLS library does not support server mode\n");
+        exit(1);
+    }
+    if (tls->api->load_key(&pk, opts.key, strlen(opts.key)) != 0 ||
+        tls->api->set_own_cert(tls->ctx, opts.cert, strlen(opts.cert)) != 0 ||
+        tls->api->set_own_key(tls->ctx, pk) != 0) {
+        fprintf(stderr, "failed to load server cert[%s]/key[%s]\n", opts.cert, opts.key);
+        exit(1);
+    }
+    if (tls->api->set_cipher_profile) {
+        tls->api->set_cipher_profile(tls, profile);
+    }
+    return tls;
+}
+
+static tls_context *client_ctx(tls_cipher_profile profile) {
+    tls_context *tls = default_tls_context(opts.ca, strlen(opts.ca));
+    if (tls->api->set_cipher_profile) {
+        tls->api->set_cipher_profile(tls, profile);
+    }
+    return tls;
+}
+
+// runs handshake between engines, delivers post-handshake messages (session tickets) to client
+static int handshake(tls_engine *clt, tls_engine *srv) {
+    size_t c_len = 0, s_len = 0;
+    tls_handshake_state cs = clt->api->handshake(clt->engine, NULL, 0, c2s, &c_len, BUF_SIZE);
+    tls_handshake_state ss = TLS_HS_BEFORE;
+    for (int i = 0; i < 16 && (cs != TLS_HS_COMPLETE || ss != TLS_HS_COMPLETE); i++) {
+        if (ss != TLS_HS_COMPLETE) {
+            ss = srv->api->handshake(srv->engine, c2s, c_len, s2c, &s_len, BUF_SIZE);
+            c_len = 0;
+        }
+        if (cs != TLS_HS_COMPLETE) {
+            cs = clt->api->handshake(clt->engine, s2c, s_len, c2s, &c_len, BUF_SIZE);
+            s_len = 0;
+        }
+        if (cs == TLS_HS_ERROR || ss == TLS_HS_ERROR) {
+            return -1;
+        }
+    }
+    if (cs != TLS_HS_COMPLETE || ss != TLS_HS_COMPLETE) {
+        return -1;
+    }
+
+    if (s_len > 0) {
+        size_t n;
+        if (clt->api->read(clt->engine, s2c, s_len, plain, &n, BUF_SIZE) < TLS_OK &&
+            clt->api->handshake_state(clt->engine) != TLS_HS_COMPLETE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// encrypts on one engine, decrypts on the other, returns number of plaintext bytes delivered
+static long transfer(tls_engine *from, tls_engine *to, const char *data, size_t len, char *wire) {
+    size_t n = 0;
+    if (from->api->write(from->engine, data, len, wire, &n, BUF_SIZE) < 0) {
+        return -1;
+    }
+
+    long got = 0;
+    const char *in = wire;
+    for (;;) {
+        size_t out = 0;
+        int rc = to->api->read(to->engine, in, n, plain, &out, BUF_SIZE);
+        got += (long) out;
+        in = NULL;
+        n = 0;
+        if (rc == TLS_MORE_AVAILABLE) continue;
+        if (rc == TLS_ERR || rc == TLS_EOF) return -1;
+        break;
+    }
+    return got;
+}
+
+// exchanges close notify, sessions of connections that are not shut down cleanly are not resumable
+static void unpair(tls_context *clt_tls, tls_engine *clt, tls_context *srv_tls, tls_engine *srv) {
+    size_t n = 0, out = 0;
+    clt->api->close(clt->engine, c2s, &n, BUF_SIZE);
+    srv->api->read(srv->engine, c2s, n, plain, &out, BUF_SIZE);
+    srv->api->close(srv->engine, s2c, &n, BUF_SIZE);
+    clt_tls->api->free_engine(clt);
+    srv_tls->api->free_engine(srv);
+}
+
+static void pair(tls_context *clt_tls, tls_context *srv_tls, tls_engine **clt, tls_engine **srv) {
+    *clt = clt_tls->api->new_engine(clt_tls->ctx, BENCH_HOST);
+    *srv = srv_tls->api->new_engine(srv_tls->ctx, NULL);
+    if (handshake(*clt, *srv) != 0) {
+        fprintf(stderr, "handshake failed: %s\n", (*clt)->api->strerror((*clt)->engine));
+        exit(1);
+    }
+}
+
+static void bench_bulk(const char *profile, tls_context *clt_tls, tls_context *srv_tls) {
+    tls_engine *clt, *srv;
+    pair(clt_tls, srv_tls, &clt, &srv);
+
+    char *data = malloc(record_sizes[sizeof(record_sizes) / sizeof(record_sizes[0]) - 1]);
+    memset(data, 'x', record_sizes[sizeof(record_sizes) / sizeof(record_sizes[0]) - 1]);
+    for (size_t i = 0; i < sizeof(record_sizes) / sizeof(record_sizes[0]); i++) {
+        size_t len = record_sizes[i];
+        uint64_t bytes = 0;
+        uint64_t start = uv_hrtime();
+        uint64_t deadline = start + (uint64_t) (opts.seconds * 1e9);
+        uint64_t now;
+        do {
+            for (int j = 0; j < 64; j++) {
+                long n = transfer(clt, srv, data, len, c2s);
+                if (n < 0) {
+                    fprintf(stderr, "transfer failed\n");
+                    exit(1);
+                }
+                bytes += (uint64_t) n;
+            }
+            now = uv_hrtime();
+        } while (now < deadline);
+
+        double secs = (double) (now - start) / 1e9;
+        printf("{\"lib\":\"%s\",\"ciphers\":\"%s\",\"test\":\"bulk\",\"record_size\":%zu,"
+               "\"bytes\":%llu,\"seconds\":%.3f,\"mb_per_sec\":%.1f}\n",
+               lib_version, profile, len, (unsigned long long) bytes, secs, (double) bytes / secs / 1e6);
+    }
+    free(data);
+    unpair(clt_tls, clt, srv_tls, srv);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_latency(const char *profile, tls_context *clt_tls, tls_context *srv_tls) {
+    tls_engine *clt, *srv;
+    pair(clt_tls, srv_tls, &clt, &srv);
+
+    char msg[LATENCY_MSG];
+    memset(msg, 'p', sizeof(msg));
+    uint64_t *samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    size_t count = 0;
+    uint64_t deadline = uv_hrtime() + (uint64_t) (opts.seconds * 1e9);
+    while (count < MAX_SAMPLES) {
+        uint64_t t0 = uv_hrtime();
+        if (t0 >= deadline) break;
+        // request and response
+        if (transfer(clt, srv, msg, sizeof(msg), c2s) != sizeof(msg) ||
+            transfer(srv, clt, msg, sizeof(msg), s2c) != sizeof(msg)) {
+            fprintf(stderr, "ping-pong failed\n");
+            exit(1);
+        }
+        samples[count++] = uv_hrtime() - t0;
+    }
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += samples[i];
+    qsort(samples, count, sizeof(uint64_t), cmp_u64);
+    printf("{\"lib\":\"%s\",\"ciphers\":\"%s\",\"test\":\"latency\",\"msg_size\":%d,\"round_trips\":%zu,"
+           "\"avg_us\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f}\n",
+           lib_version, profile, LATENCY_MSG, count,
+           (double) total / (double) count / 1e3,
+           (double) samples[count / 2] / 1e3,
+           (double) samples[count * 99 / 100] / 1e3);
+    free(samples);
+    unpair(clt_tls, clt, srv_tls, srv);
+}
+
+// full handshakes alternate servers, so session offered by client is always unknown to the server
+static void bench_handshake(const char *profile, tls_context *clt_tls, tls_context *srv_tls[2], int resume) {
+    unsigned long count = 0, resumed = 0;
+    uint64_t start = uv_hrtime();
+    uint64_t deadline = start + (uint64_t) (opts.seconds * 1e9);
+    uint64_t now;
+    do {
+        tls_context *s = srv_tls[resume ? 0 : (count + 1) % 2];
+        tls_engine *clt = clt_tls->api->new_engine(clt_tls->ctx, BENCH_HOST);
+        tls_engine *srv = s->api->new_engine(s->ctx, NULL);
+        if (handshake(clt, srv) != 0) {
+            fprintf(stderr, "handshake failed: %s\n", clt->api->strerror(clt->engine));
+            exit(1);
+        }
+        if (clt->api->stats && clt->api->stats(clt->engine)->resumptions > 0) {
+            resumed++;
+        }
+        unpair(clt_tls, clt, s, srv);
+        count++;
+        now = uv_hrtime();
+    } while (now < deadline);
+
+    double secs = (double) (now - start) / 1e9;
+    printf("{\"lib\":\"%s\",\"ciphers\":\"%s\",\"test\":\"%s\",\"handshakes\":%lu,\"resumed\":%lu,"
+           "\"per_sec\":%.1f,\"avg_us\":%.1f}\n",
+           lib_version, profile, resume ? "handshake_resumed" : "handshake_full", count, resumed,
+           (double) count / secs, secs * 1e6 / (double) count);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            opts.seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opts.cert = argv[++i];
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opts.key = argv[++i];
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            opts.ca = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-t seconds] [-c cert] [-k key] [-a ca]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opts.seconds <= 0) {
+        opts.seconds = 1.0;
+    }
+
+    for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        tls_context *clt_tls = client_ctx(profiles[p].profile);
+        tls_context *srv_tls[2] = { server_ctx(profiles[p].profile), server_ctx(profiles[p].profile) };
+        lib_version = clt_tls->api->version();
+
+        bench_bulk(profiles[p].name, clt_tls, srv_tls[0]);
+        bench_latency(profiles[p].name, clt_tls, srv_tls[0]);
+        bench_handshake(profiles[p].name, clt_tls, srv_tls, 0);
+        bench_handshake(profiles[p].name, clt_tls, srv_tls, 1);
+
+        clt_tls->api->free_ctx(clt_tls);
+        srv_tls[0]->api->free_ctx(srv_tls[0]);
+        srv_tls[1]->api->free_ctx(srv_tls[1]);
+    }
+    return 0;
+}
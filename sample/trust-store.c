@@ -0,0 +1,49 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// compiles PEM CA bundle into memory-mapped trust store, that can be passed to default_tls_context()
+// instead of the bundle, and compares time it takes to create TLS context from either of them.
+// usage: trust-store bundle.pem out_file
+
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+
+#include <tlsuv/tlsuv.h>
+
+static double ctx_load_ms(const char *ca) {
+    uint64_t start = uv_hrtime();
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    uint64_t elapsed = uv_hrtime() - start;
+    tls->api->free_ctx(tls);
+    return (double) elapsed / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s bundle.pem out_file\n", argv[0]);
+        return 1;
+    }
+
+    int count = tlsuv_trust_store_compile(argv[1], argv[2]);
+    if (count < 0) {
+        fprintf(stderr, "failed to compile %s: %d(%s)\n", argv[1], count, uv_strerror(count));
+        return 1;
+    }
+    printf("%s: %d certificates\n", argv[2], count);
+    printf("context from %s: %.2fms\n", argv[1], ctx_load_ms(argv[1]));
+    printf("context from %s: %.2fms\n", argv[2], ctx_load_ms(argv[2]));
+    return 0;
+}
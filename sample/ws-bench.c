@@ -0,0 +1,317 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// websocket echo benchmark: opens N connections to an echo server, then for every message size keeps `window`
+// messages in flight per connection for `duration` seconds. Reports messages/s, round trip latency,
+// CPU time per message and resident memory per connection. Pass both ws:// and wss:// URLs to compare TLS cost.
+// usage: ws-bench [-n connections] [-d seconds] [-w window] [-s size[,size...]] [-a ca_file] URL [URL...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include <tlsuv/tlsuv.h>
+#include <tlsuv/websocket.h>
+
+#define MAX_SIZES 16
+#define MAX_SAMPLES (1 << 20)
+
+struct conn_s {
+    tlsuv_websocket_t ws;
+    uv_connect_t conn_req;
+    unsigned int in_flight;
+    bool failed;
+};
+
+static struct {
+    size_t connections;
+    double seconds;
+    unsigned int window;
+    size_t sizes[MAX_SIZES];
+    size_t size_count;
+    const char *ca;
+} opts = {
+        .connections = 10,
+        .seconds = 5,
+        .window = 1,
+        .sizes = { 16, 256, 4096, 65536 },
+        .size_count = 4,
+};
+
+static struct {
+    const char *url;
+    struct conn_s *conns;
+    size_t connected;
+    size_t failed;
+    size_t rss_before;
+
+    size_t size_idx;
+    bool done;
+    char *payload;
+    bool sending;
+    size_t in_flight;
+    uint64_t start;
+    uv_rusage_t ru_start;
+    uint64_t messages;
+    uint64_t *rtt;
+    size_t rtt_count;
+} run;
+
+static uv_loop_t *loop;
+static uv_timer_t phase_timer;
+static tls_context *tls;
+
+static void start_phase(void);
+
+static void write_cb(uv_write_t *req, int status) {
+    free(req);
+}
+
+static void send_msg(struct conn_s *c) {
+    size_t len = opts.sizes[run.size_idx];
+    // sender's timestamp travels in the payload, echo carries it back
+    uint64_t now = uv_hrtime();
+    memcpy(run.payload, &now, sizeof(now));
+
+    uv_write_t *wr = malloc(sizeof(uv_write_t));
+    uv_buf_t b = uv_buf_init(run.payload, (unsigned int) len);
+    if (tlsuv_websocket_write(wr, &c->ws, &b, write_cb) == 0) {
+        c->in_flight++;
+        run.in_flight++;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double cpu_usec(const uv_rusage_t *r) {
+    return (double) (r->ru_utime.tv_sec + r->ru_stime.tv_sec) * 1e6 +
+           (double) (r->ru_utime.tv_usec + r->ru_stime.tv_usec);
+}
+
+static void end_phase(void) {
+    uint64_t elapsed = uv_hrtime() - run.start;
+    uv_rusage_t ru;
+    uv_getrusage(&ru);
+    double cpu = cpu_usec(&ru) - cpu_usec(&run.ru_start);
+    double secs = (double) elapsed / 1e9;
+    size_t len = opts.sizes[run.size_idx];
+
+    double avg = 0, p50 = 0, p99 = 0, max = 0;
+    if (run.rtt_count > 0) {
+        qsort(run.rtt, run.rtt_count, sizeof(uint64_t), cmp_u64);
+        uint64_t total = 0;
+        for (size_t i = 0; i < run.rtt_count; i++) total += run.rtt[i];
+        avg = (double) total / (double) run.rtt_count / 1e3;
+        p50 = (double) run.rtt[run.rtt_count / 2] / 1e3;
+        p99 = (double) run.rtt[run.rtt_count * 99 / 100] / 1e3;
+        max = (double) run.rtt[run.rtt_count - 1] / 1e3;
+    }
+    printf("%-36s %8zu %12.0f %10.2f %9.1f %9.1f %9.1f %9.1f %9.2f\n", run.url, len,
+           (double) run.messages / secs, (double) (run.messages * len) / secs / 1e6,
+           avg, p50, p99, max, run.messages > 0 ? cpu / (double) run.messages : 0.0);
+
+    run.size_idx++;
+    start_phase();
+}
+
+static void phase_timer_cb(uv_timer_t *t) {
+    run.sending = false;
+    if (run.in_flight == 0) {
+        end_phase();
+    }
+}
+
+static void on_data(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    struct conn_s *c = (struct conn_s *) s;
+    if (run.done || c->failed) {
+        return;
+    }
+    if (nread < 0) {
+        // connection is closed with the rest of them
+        fprintf(stderr, "connection failed: %zd(%s)\n", nread, uv_strerror((int) nread));
+        c->failed = true;
+        run.in_flight -= c->in_flight;
+        c->in_flight = 0;
+        if (!run.sending && run.in_flight == 0) {
+            end_phase();
+        }
+        return;
+    }
+
+    if (c->in_flight == 0) {
+        return;
+    }
+    c->in_flight--;
+    run.in_flight--;
+    run.messages++;
+    if ((size_t) nread >= sizeof(uint64_t) && run.rtt_count < MAX_SAMPLES) {
+        uint64_t sent;
+        memcpy(&sent, buf->base, sizeof(sent));
+        run.rtt[run.rtt_count++] = uv_hrtime() - sent;
+    }
+
+    if (run.sending) {
+        send_msg(c);
+    } else if (run.in_flight == 0) {
+        end_phase();
+    }
+}
+
+static void close_all(void) {
+    run.done = true;
+    for (size_t i = 0; i < opts.connections; i++) {
+        tlsuv_websocket_close(&run.conns[i].ws, NULL);
+    }
+}
+
+static void start_phase(void) {
+    if (run.size_idx == opts.size_count || run.connected == 0) {
+        close_all();
+        return;
+    }
+
+    size_t len = opts.sizes[run.size_idx];
+    free(run.payload);
+    run.payload = malloc(len);
+    memset(run.payload, 'w', len);
+
+    run.messages = 0;
+    run.rtt_count = 0;
+    run.sending = true;
+    run.start = uv_hrtime();
+    uv_getrusage(&run.ru_start);
+    uv_timer_start(&phase_timer, phase_timer_cb, (uint64_t) (opts.seconds * 1000), 0);
+
+    for (size_t i = 0; i < opts.connections; i++) {
+        struct conn_s *c = &run.conns[i];
+        if (c->failed) continue;
+        for (unsigned int w = 0; w < opts.window; w++) {
+            send_msg(c);
+        }
+    }
+}
+
+static void on_connect(uv_connect_t *req, int status) {
+    struct conn_s *c = (struct conn_s *) req->handle;
+    if (status != 0) {
+        fprintf(stderr, "failed to connect to %s: %d(%s)\n", run.url, status, uv_strerror(status));
+        c->failed = true;
+        run.failed++;
+    } else {
+        run.connected++;
+    }
+
+    if (run.connected + run.failed < opts.connections) {
+        return;
+    }
+
+    size_t rss = 0;
+    uv_resident_set_memory(&rss);
+    printf("%-36s connections=%zu failed=%zu memory/conn=%.1fKB\n", run.url, run.connected, run.failed,
+           run.connected > 0 && rss > run.rss_before ? (double) (rss - run.rss_before) / 1024.0 / (double) run.connected : 0.0);
+    printf("%-36s %8s %12s %10s %9s %9s %9s %9s %9s\n", "", "size", "msg/s", "MB/s",
+           "avg(us)", "p50", "p99", "max", "cpu(us)");
+    start_phase();
+}
+
+static int bench_url(const char *url) {
+    memset(&run, 0, sizeof(run));
+    run.url = url;
+    run.rtt = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    run.conns = calloc(opts.connections, sizeof(struct conn_s));
+    uv_resident_set_memory(&run.rss_before);
+
+    for (size_t i = 0; i < opts.connections; i++) {
+        struct conn_s *c = &run.conns[i];
+        tlsuv_websocket_init(loop, &c->ws);
+        // context set on websocket is used regardless of URL scheme
+        if (tls && strncmp(url, "wss:", 4) == 0) {
+            tlsuv_websocket_set_tls(&c->ws, tls);
+        }
+        tlsuv_websocket_set_nodelay(&c->ws, true);
+        int rc = tlsuv_websocket_connect(&c->conn_req, &c->ws, url, on_connect, on_data);
+        if (rc != 0) {
+            fprintf(stderr, "failed to connect to %s: %d(%s)\n", url, rc, uv_strerror(rc));
+            return rc;
+        }
+    }
+
+    uv_run(loop, UV_RUN_DEFAULT);
+    free(run.conns);
+    free(run.payload);
+    free(run.rtt);
+    return run.failed > 0 ? 1 : 0;
+}
+
+static int parse_sizes(char *list) {
+    opts.size_count = 0;
+    for (char *p = strtok(list, ","); p && opts.size_count < MAX_SIZES; p = strtok(NULL, ",")) {
+        size_t s = strtoul(p, NULL, 10);
+        // room for timestamp
+        opts.sizes[opts.size_count++] = s < sizeof(uint64_t) ? sizeof(uint64_t) : s;
+    }
+    return opts.size_count > 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *urls[16];
+    int url_count = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] != '-') {
+            if (url_count < 16) urls[url_count++] = a;
+        } else if (i + 1 < argc && strlen(a) == 2) {
+            char *v = argv[++i];
+            switch (a[1]) {
+                case 'n': opts.connections = strtoul(v, NULL, 10); break;
+                case 'd': opts.seconds = strtod(v, NULL); break;
+                case 'w': opts.window = (unsigned int) strtoul(v, NULL, 10); break;
+                case 's': if (parse_sizes(v) != 0) url_count = 0; break;
+                case 'a': opts.ca = v; break;
+                default: url_count = 0; i = argc; break;
+            }
+        } else {
+            url_count = 0;
+            break;
+        }
+    }
+    if (url_count == 0 || opts.connections == 0 || opts.window == 0 || opts.seconds <= 0) {
+        fprintf(stderr, "usage: %s [-n connections] [-d seconds] [-w window] [-s size[,size...]] [-a ca_file] URL [URL...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    loop = uv_default_loop();
+    if (opts.ca) {
+        tls = default_tls_context(opts.ca, strlen(opts.ca));
+    }
+
+    int rc = 0;
+    for (int i = 0; i < url_count; i++) {
+        uv_timer_init(loop, &phase_timer);
+        rc |= bench_url(urls[i]);
+        uv_close((uv_handle_t *) &phase_timer, NULL);
+        uv_run(loop, UV_RUN_DEFAULT);
+    }
+
+    if (tls) {
+        tls->api->free_ctx(tls);
+    }
+    uv_loop_close(loop);
+    return rc;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// compares websocket masking throughput of byte loop and selected kernel
+// usage: ws-mask-bench [payload_size [iterations]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "ws_mask.h"
+
+typedef void (*mask_fn)(char *dst, const char *src, size_t len, const uint8_t mask[4], uint64_t offset);
+
+static double run(mask_fn fn, char *dst, const char *src, size_t len, long iterations) {
+    const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    uint64_t start = uv_hrtime();
+    for (long i = 0; i < iterations; i++) {
+        // odd offset exercises unaligned start and rotated key
+        fn(dst + 1, src + 1, len, mask, (uint64_t) i);
+    }
+    double secs = (double) (uv_hrtime() - start) / 1e9;
+    return (double) len * (double) iterations / secs / (1024.0 * 1024.0);
+}
+
+int main(int argc, char *argv[]) {
+    size_t len = argc > 1 ? strtoul(argv[1], NULL, 10) : 64 * 1024;
+    long iterations = argc > 2 ? strtol(argv[2], NULL, 10) : 20000;
+
+    char *src = malloc(len + 1);
+    char *dst = malloc(len + 1);
+    char *check = malloc(len + 1);
+    for (size_t i = 0; i <= len; i++) {
+        src[i] = (char) (i * 31);
+    }
+
+    const uint8_t mask[4] = { 0xde, 0xad, 0xbe, 0xef };
+    ws_mask_bytes(check, src, len + 1, mask, 3);
+    ws_mask(dst, src, len + 1, mask, 3);
+    if (memcmp(check, dst, len + 1) != 0) {
+        fprintf(stderr, "%s kernel output does not match byte loop\n", ws_mask_impl());
+        return 1;
+    }
+
+    double bytes = run(ws_mask_bytes, dst, src, len, iterations);
+    double fast = run(ws_mask, dst, src, len, iterations);
+    printf("payload=%zu iterations=%ld\n", len, iterations);
+    printf("%-8s %10.1f MB/s\n", "bytes", bytes);
+    printf("%-8s %10.1f MB/s (x%.1f)\n", ws_mask_impl(), fast, fast / bytes);
+
+    free(src);
+    free(dst);
+    free(check);
+    return 0;
+}
@@ -0,0 +1,268 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "alloc.h"
+#include "atomics.h"
+#include "um_debug.h"
+
+#if defined(USE_OPENSSL)
+#include <openssl/crypto.h>
+#elif defined(USE_MBEDTLS)
+#include <mbedtls/platform.h>
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO) && !defined(MBEDTLS_PLATFORM_FREE_MACRO)
+#define MBEDTLS_HOOKS 1
+#endif
+#endif
+
+static struct {
+    uv_malloc_func malloc_f;
+    uv_realloc_func realloc_f;
+    uv_calloc_func calloc_f;
+    uv_free_func free_f;
+} allocator = {
+        malloc,
+        realloc,
+        calloc,
+        free,
+};
+
+static int crypto_hooks_install(void);
+
+#if defined(TLSUV_ALLOC_STATS)
+
+// keeps block size and subsystem for counters, union keeps payload aligned as malloc() result
+typedef union block_hdr_u {
+    struct {
+        size_t size;
+        unsigned int sub;
+    } h;
+    long double ld;
+    void *p;
+    uint64_t u;
+} block_hdr;
+
+static struct mem_counter_s {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;
+    int64_t in_use;
+} counters[TLSUV_MEM_SUBSYS_COUNT];
+
+static uv_once_t stats_once = UV_ONCE_INIT;
+
+// TLS library allocations are only counted if hooks are in place before it allocates anything
+static void stats_init(void) {
+    (void) crypto_hooks_install();
+}
+
+static void *block_init(block_hdr *b, tlsuv_mem_subsys sub, size_t size) {
+    if (b == NULL) {
+        return NULL;
+    }
+    b->h.size = size;
+    b->h.sub = (unsigned int) sub;
+    struct mem_counter_s *c = &counters[sub];
+    tlsuv_atomic_add(&c->allocs, 1);
+    tlsuv_atomic_add(&c->bytes, (uint64_t) size);
+    tlsuv_atomic_add(&c->in_use, (int64_t) size);
+    return b + 1;
+}
+
+void *tlsuv__malloc_sub(tlsuv_mem_subsys sub, size_t size) {
+    uv_once(&stats_once, stats_init);
+    if (size > SIZE_MAX - sizeof(block_hdr)) {
+        return NULL;
+    }
+    return block_init(allocator.malloc_f(sizeof(block_hdr) + size), sub, size);
+}
+
+void *tlsuv__calloc_sub(tlsuv_mem_subsys sub, size_t count, size_t size) {
+    uv_once(&stats_once, stats_init);
+    if (size != 0 && count > (SIZE_MAX - sizeof(block_hdr)) / size) {
+        return NULL;
+    }
+    return block_init(allocator.calloc_f(1, sizeof(block_hdr) + count * size), sub, count * size);
+}
+
+void *tlsuv__realloc_sub(tlsuv_mem_subsys sub, void *p, size_t size) {
+    if (p == NULL) {
+        return tlsuv__malloc_sub(sub, size);
+    }
+    if (size == 0) {
+        tlsuv__free(p);
+        return NULL;
+    }
+    if (size > SIZE_MAX - sizeof(block_hdr)) {
+        return NULL;
+    }
+
+    block_hdr *b = (block_hdr *) p - 1;
+    size_t old = b->h.size;
+    b = allocator.realloc_f(b, sizeof(block_hdr) + size);
+    if (b == NULL) {
+        return NULL;
+    }
+    // block keeps subsystem it was allocated for
+    struct mem_counter_s *c = &counters[b->h.sub];
+    b->h.size = size;
+    if (size > old) {
+        tlsuv_atomic_add(&c->bytes, (uint64_t) (size - old));
+    }
+    tlsuv_atomic_add(&c->in_use, (int64_t) size - (int64_t) old);
+    return b + 1;
+}
+
+void tlsuv__free(void *p) {
+    if (p == NULL) {
+        return;
+    }
+    block_hdr *b = (block_hdr *) p - 1;
+    struct mem_counter_s *c = &counters[b->h.sub];
+    tlsuv_atomic_add(&c->frees, 1);
+    tlsuv_atomic_add(&c->in_use, -(int64_t) b->h.size);
+    allocator.free_f(b);
+}
+
+int tlsuv_mem_get_stats(tlsuv_mem_subsys sub, tlsuv_mem_stats *stats) {
+    if (stats == NULL || (unsigned int) sub >= TLSUV_MEM_SUBSYS_COUNT) {
+        return UV_EINVAL;
+    }
+    struct mem_counter_s *c = &counters[sub];
+    stats->allocs = (unsigned long) tlsuv_atomic_load(&c->allocs);
+    stats->frees = (unsigned long) tlsuv_atomic_load(&c->frees);
+    stats->bytes_allocated = (uint64_t) tlsuv_atomic_load(&c->bytes);
+    int64_t in_use = tlsuv_atomic_load(&c->in_use);
+    stats->bytes_in_use = in_use > 0 ? (size_t) in_use : 0;
+    return 0;
+}
+
+#else
+
+void *tlsuv__malloc_sub(tlsuv_mem_subsys sub, size_t size) {
+    return allocator.malloc_f(size);
+}
+
+void *tlsuv__calloc_sub(tlsuv_mem_subsys sub, size_t count, size_t size) {
+    return allocator.calloc_f(count, size);
+}
+
+void *tlsuv__realloc_sub(tlsuv_mem_subsys sub, void *p, size_t size) {
+    // same as uv__realloc(), size of 0 releases the block
+    if (size == 0) {
+        tlsuv__free(p);
+        return NULL;
+    }
+    return allocator.realloc_f(p, size);
+}
+
+void tlsuv__free(void *p) {
+    if (p != NULL) {
+        allocator.free_f(p);
+    }
+}
+
+int tlsuv_mem_get_stats(tlsuv_mem_subsys sub, tlsuv_mem_stats *stats) {
+    return UV_ENOTSUP;
+}
+
+#endif
+
+char *tlsuv__strdup_sub(tlsuv_mem_subsys sub, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = tlsuv__malloc_sub(sub, len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+char *tlsuv__strndup_sub(tlsuv_mem_subsys sub, const char *s, size_t n) {
+    const char *end = memchr(s, 0, n);
+    size_t len = end ? (size_t) (end - s) : n;
+    char *copy = tlsuv__malloc_sub(sub, len + 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = 0;
+    }
+    return copy;
+}
+
+#if defined(USE_OPENSSL)
+static void *crypto_malloc(size_t size, const char *file, int line) {
+    return tlsuv__malloc_sub(TLSUV_MEM_CRYPTO, size);
+}
+
+static void *crypto_realloc(void *p, size_t size, const char *file, int line) {
+    return tlsuv__realloc_sub(TLSUV_MEM_CRYPTO, p, size);
+}
+
+static void crypto_free(void *p, const char *file, int line) {
+    tlsuv__free(p);
+}
+#elif defined(MBEDTLS_HOOKS)
+static void *crypto_calloc(size_t count, size_t size) {
+    return tlsuv__calloc_sub(TLSUV_MEM_CRYPTO, count, size);
+}
+
+static void crypto_free(void *p) {
+    tlsuv__free(p);
+}
+#endif
+
+static int crypto_hooks_install(void) {
+    static int installed;
+    if (installed) {
+        return 0;
+    }
+#if defined(USE_OPENSSL)
+    // OpenSSL refuses the change once it has allocated memory
+    if (CRYPTO_set_mem_functions(crypto_malloc, crypto_realloc, crypto_free) != 1) {
+        return UV_EBUSY;
+    }
+    installed = 1;
+    return 0;
+#elif defined(MBEDTLS_HOOKS)
+    mbedtls_platform_set_calloc_free(crypto_calloc, crypto_free);
+    installed = 1;
+    return 0;
+#else
+    return UV_ENOTSUP;
+#endif
+}
+
+int tlsuv_set_allocator(uv_malloc_func malloc_f, uv_realloc_func realloc_f, uv_calloc_func calloc_f,
+                        uv_free_func free_f) {
+    if (malloc_f == NULL || realloc_f == NULL || calloc_f == NULL || free_f == NULL) {
+        return UV_EINVAL;
+    }
+
+    allocator.malloc_f = malloc_f;
+    allocator.realloc_f = realloc_f;
+    allocator.calloc_f = calloc_f;
+    allocator.free_f = free_f;
+
+    int rc = crypto_hooks_install();
+    if (rc == UV_EBUSY) {
+        UM_LOG(WARN, "TLS library has already allocated memory, its allocations will not use this allocator");
+    } else if (rc == UV_ENOTSUP) {
+        UM_LOG(VERB, "TLS library allocations cannot be routed to this allocator");
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_ALLOC_H
+#define TLSUV_ALLOC_H
+
+#include <stddef.h>
+
+#include "tlsuv/tlsuv.h"
+
+/*
+ * Library allocation functions, routed to allocator set with tlsuv_set_allocator().
+ *
+ * Every source file tags its allocations with a subsystem by defining TLSUV_ALLOC_SUBSYS before including this
+ * header (core if not defined), counters are kept per subsystem when library is built with TLSUV_ALLOC_STATS.
+ * Memory returned to the API caller for release with free() (PEM buffers, decoded base64url) is allocated
+ * with plain malloc().
+ */
+
+#ifndef TLSUV_ALLOC_SUBSYS
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *tlsuv__malloc_sub(tlsuv_mem_subsys sub, size_t size);
+void *tlsuv__calloc_sub(tlsuv_mem_subsys sub, size_t count, size_t size);
+void *tlsuv__realloc_sub(tlsuv_mem_subsys sub, void *p, size_t size);
+void tlsuv__free(void *p);
+char *tlsuv__strdup_sub(tlsuv_mem_subsys sub, const char *s);
+char *tlsuv__strndup_sub(tlsuv_mem_subsys sub, const char *s, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define tlsuv__malloc(size) tlsuv__malloc_sub(TLSUV_ALLOC_SUBSYS, (size))
+#define tlsuv__calloc(count, size) tlsuv__calloc_sub(TLSUV_ALLOC_SUBSYS, (count), (size))
+#define tlsuv__realloc(p, size) tlsuv__realloc_sub(TLSUV_ALLOC_SUBSYS, (p), (size))
+#define tlsuv__strdup(s) tlsuv__strdup_sub(TLSUV_ALLOC_SUBSYS, (s))
+#define tlsuv__strndup(s, n) tlsuv__strndup_sub(TLSUV_ALLOC_SUBSYS, (s), (n))
+
+#endif//TLSUV_ALLOC_H
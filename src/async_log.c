@@ -0,0 +1,547 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tlsuv/tlsuv.h>
+#include "async_log.h"
+#include "atomics.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
+#define DEFAULT_RING_SIZE (64 * 1024)
+#define MIN_RING_SIZE 4096
+// max size of captured arguments, same as message limit of synchronous logging
+#define MAX_ARGS_SIZE 1024
+#define MAX_MSG_SIZE 1024
+// consumer wakes up at least this often
+#define DRAIN_INTERVAL_NS (20 * 1000 * 1000)
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+enum {
+    REC_WRAP = 1,  // filler at the end of ring, next record starts at offset 0
+    REC_TEXT = 2,  // message formatted by producer, argument blob is NUL terminated text
+};
+
+struct log_rec {
+    uint32_t size;
+    uint8_t flags;
+    uint8_t level;
+    uint16_t args_len;
+    uint32_t line;
+    uint64_t ts;
+    const char *file;
+    const char *fmt;
+};
+
+/*
+ * Single producer (owning thread) single consumer (log thread) ring.
+ * head/tail are running byte counters, only owner of each counter writes it.
+ */
+struct log_ring {
+    struct log_ring *next;
+    uint8_t *buf;
+    size_t size;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t records;
+    uint64_t dropped;
+    // consumer only
+    uint64_t dropped_reported;
+    uint64_t end;
+};
+
+static struct log_ring consumer_mark;
+
+static uv_once_t init_once = UV_ONCE_INIT;
+static uv_key_t ring_key;
+static uv_mutex_t lock;
+static uv_cond_t wakeup;
+static uv_cond_t flushed;
+
+// rings are never freed, producer may be writing after async logging is stopped
+static struct log_ring *rings;
+static size_t ring_size = DEFAULT_RING_SIZE;
+static int64_t active;
+static int running;
+static uv_thread_t consumer_thread;
+static uint64_t flush_req;
+static uint64_t flush_done;
+
+static void init(void) {
+    uv_key_create(&ring_key);
+    uv_mutex_init(&lock);
+    uv_cond_init(&wakeup);
+    uv_cond_init(&flushed);
+}
+
+int async_log_active(void) {
+    return tlsuv_atomic_load(&active) != 0;
+}
+
+static struct log_ring *get_ring(void) {
+    struct log_ring *r = uv_key_get(&ring_key);
+    if (r != NULL) {
+        return r;
+    }
+
+    r = tlsuv__calloc(1, sizeof(*r));
+    uv_mutex_lock(&lock);
+    r->size = ring_size;
+    r->buf = tlsuv__malloc(r->size);
+    r->next = rings;
+    tlsuv_atomic_store_ptr(&rings, r);
+    uv_mutex_unlock(&lock);
+    uv_key_set(&ring_key, r);
+    return r;
+}
+
+enum arg_type {
+    A_PERCENT,
+    A_INT,
+    A_LONG,
+    A_LLONG,
+    A_SIZE,
+    A_INTMAX,
+    A_PTRDIFF,
+    A_DOUBLE,
+    A_LDOUBLE,
+    A_PTR,
+    A_STR,
+    A_BAD,
+};
+
+struct fmt_spec {
+    const char *start;
+    size_t len;
+    int width_star;
+    int prec_star;
+    int prec;   // literal precision, -1 if none
+    enum arg_type type;
+};
+
+// finds next conversion in format string, returns NULL when there are no more
+static const char *next_spec(const char *p, struct fmt_spec *spec) {
+    p = strchr(p, '%');
+    if (p == NULL) {
+        return NULL;
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+    spec->prec = -1;
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if (*p == '*') {
+        spec->width_star = 1;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->prec_star = 1;
+            p++;
+        } else {
+            spec->prec = 0;
+            while (*p >= '0' && *p <= '9') spec->prec = spec->prec * 10 + (*p++ - '0');
+        }
+    }
+
+    enum arg_type int_type = A_INT;
+    enum arg_type float_type = A_DOUBLE;
+    switch (*p) {
+        case 'h':
+            p++;
+            if (*p == 'h') p++;
+            break;
+        case 'l':
+            p++;
+            int_type = A_LONG;
+            if (*p == 'l') {
+                p++;
+                int_type = A_LLONG;
+            }
+            break;
+        case 'z': p++; int_type = A_SIZE; break;
+        case 'j': p++; int_type = A_INTMAX; break;
+        case 't': p++; int_type = A_PTRDIFF; break;
+        case 'L': p++; float_type = A_LDOUBLE; break;
+        default: break;
+    }
+
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            spec->type = int_type;
+            break;
+        case 'c':
+            spec->type = int_type == A_INT ? A_INT : A_BAD;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->type = float_type;
+            break;
+        case 'p':
+            spec->type = A_PTR;
+            break;
+        case 's':
+            spec->type = int_type == A_INT ? A_STR : A_BAD;
+            break;
+        case '%':
+            spec->type = A_PERCENT;
+            break;
+        default:
+            // %n, wide strings, unknown or truncated conversion
+            spec->type = A_BAD;
+            return NULL;
+    }
+    p++;
+    spec->len = (size_t) (p - spec->start);
+    return p;
+}
+
+#define PUT(T, val) do { T v__ = (val); \
+    if (o + sizeof(T) > end) return -1;    \
+    memcpy(o, &v__, sizeof(T)); o += sizeof(T); } while(0)
+
+// copies arguments into blob, returns captured size or -1 if arguments can't be captured
+static int capture_args(const char *fmt, va_list args, uint8_t *blob, size_t cap) {
+    uint8_t *o = blob;
+    uint8_t *end = blob + cap;
+    struct fmt_spec spec = { .type = A_PERCENT };
+    const char *p = fmt;
+    while ((p = next_spec(p, &spec)) != NULL) {
+        int prec = spec.prec;
+        if (spec.width_star) PUT(int, va_arg(args, int));
+        if (spec.prec_star) {
+            prec = va_arg(args, int);
+            PUT(int, prec);
+        }
+        switch (spec.type) {
+            case A_PERCENT: break;
+            case A_INT: PUT(int, va_arg(args, int)); break;
+            case A_LONG: PUT(long, va_arg(args, long)); break;
+            case A_LLONG: PUT(long long, va_arg(args, long long)); break;
+            case A_SIZE: PUT(size_t, va_arg(args, size_t)); break;
+            case A_INTMAX: PUT(intmax_t, va_arg(args, intmax_t)); break;
+            case A_PTRDIFF: PUT(ptrdiff_t, va_arg(args, ptrdiff_t)); break;
+            case A_DOUBLE: PUT(double, va_arg(args, double)); break;
+            case A_LDOUBLE: PUT(long double, va_arg(args, long double)); break;
+            case A_PTR: PUT(void*, va_arg(args, void*)); break;
+            case A_STR: {
+                const char *s = va_arg(args, const char*);
+                if (s == NULL) s = "(null)";
+                size_t len;
+                if (prec >= 0) {
+                    const char *nul = memchr(s, 0, (size_t) prec);
+                    len = nul ? (size_t) (nul - s) : (size_t) prec;
+                } else {
+                    len = strlen(s);
+                }
+                if (o + sizeof(uint32_t) + 1 > end) return -1;
+                // long strings are cut, as they would be by the message size limit
+                if (len > (size_t) (end - o) - sizeof(uint32_t) - 1) {
+                    len = (size_t) (end - o) - sizeof(uint32_t) - 1;
+                }
+                PUT(uint32_t, (uint32_t) len);
+                memcpy(o, s, len);
+                o += len;
+                *o++ = 0;
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    if (spec.type == A_BAD) {
+        return -1;
+    }
+    return (int) (o - blob);
+}
+
+int async_log_record(int lvl, const char *file, unsigned int line, const char *fmt, va_list args) {
+    uv_once(&init_once, init);
+    struct log_ring *r = get_ring();
+    if (r == &consumer_mark) {
+        // called from log function
+        return -1;
+    }
+
+    uint8_t blob[MAX_ARGS_SIZE];
+    struct log_rec rec = {
+            .level = (uint8_t) lvl,
+            .line = line,
+            .ts = uv_hrtime(),
+            .file = file,
+            .fmt = fmt,
+    };
+
+    va_list copy;
+    va_copy(copy, args);
+    int len = capture_args(fmt, copy, blob, sizeof(blob));
+    va_end(copy);
+    if (len < 0) {
+        len = vsnprintf((char *) blob, sizeof(blob), fmt, args);
+        if (len < 0) {
+            return 0;
+        }
+        len = len + 1 > (int) sizeof(blob) ? (int) sizeof(blob) : len + 1;
+        blob[len - 1] = 0;
+        rec.flags = REC_TEXT;
+    }
+    rec.args_len = (uint16_t) len;
+    rec.size = (uint32_t) ALIGN8(sizeof(rec) + (size_t) len);
+
+    uint64_t head = r->head;
+    uint64_t tail = tlsuv_atomic_load(&r->tail);
+    size_t pos = (size_t) (head % r->size);
+    size_t contig = r->size - pos;
+    size_t need = rec.size <= contig ? rec.size : contig + rec.size;
+    if (head + need - tail > r->size) {
+        tlsuv_atomic_store(&r->dropped, r->dropped + 1);
+        return 0;
+    }
+
+    if (rec.size > contig) {
+        struct log_rec wrap = { .size = (uint32_t) contig, .flags = REC_WRAP };
+        memcpy(r->buf + pos, &wrap, offsetof(struct log_rec, level));
+        head += contig;
+        pos = 0;
+    }
+    memcpy(r->buf + pos, &rec, sizeof(rec));
+    memcpy(r->buf + pos + sizeof(rec), blob, (size_t) len);
+    tlsuv_atomic_store(&r->records, r->records + 1);
+    tlsuv_atomic_store(&r->head, head + rec.size);
+    return 0;
+}
+
+static void format_rec(const struct log_rec *rec, const uint8_t *a, char *msg, size_t cap) {
+    if (rec->flags & REC_TEXT) {
+        snprintf(msg, cap, "%s", (const char *) a);
+        return;
+    }
+
+    char *o = msg;
+    char *end = msg + cap - 1;
+    const char *p = rec->fmt;
+    struct fmt_spec spec;
+    const char *next;
+    while ((next = next_spec(p, &spec)) != NULL && o < end) {
+        size_t lit = (size_t) (spec.start - p);
+        if (lit > (size_t) (end - o)) lit = (size_t) (end - o);
+        memcpy(o, p, lit);
+        o += lit;
+        p = next;
+
+        char sb[32];
+        if (spec.len >= sizeof(sb)) {
+            continue;
+        }
+        memcpy(sb, spec.start, spec.len);
+        sb[spec.len] = 0;
+
+        int w = 0, pr = 0;
+        if (spec.width_star) { memcpy(&w, a, sizeof(w)); a += sizeof(w); }
+        if (spec.prec_star) { memcpy(&pr, a, sizeof(pr)); a += sizeof(pr); }
+        size_t room = (size_t) (end - o) + 1;
+        int n = 0;
+
+#define EMIT(val) do {                                                                  \
+    if (spec.width_star && spec.prec_star) n = snprintf(o, room, sb, w, pr, val);   \
+    else if (spec.width_star) n = snprintf(o, room, sb, w, val);                    \
+    else if (spec.prec_star) n = snprintf(o, room, sb, pr, val);                    \
+    else n = snprintf(o, room, sb, val);                                            \
+} while(0)
+
+        switch (spec.type) {
+            case A_PERCENT: *o = '%'; n = 1; break;
+            case A_INT: { int v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_LONG: { long v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_LLONG: { long long v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_SIZE: { size_t v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_INTMAX: { intmax_t v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_PTRDIFF: { ptrdiff_t v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_DOUBLE: { double v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_LDOUBLE: { long double v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_PTR: { void *v; memcpy(&v, a, sizeof(v)); a += sizeof(v); EMIT(v); break; }
+            case A_STR: {
+                uint32_t len;
+                memcpy(&len, a, sizeof(len));
+                const char *v = (const char *) a + sizeof(len);
+                a += sizeof(len) + len + 1;
+                EMIT(v);
+                break;
+            }
+            default:
+                break;
+        }
+#undef EMIT
+        if (n > 0) {
+            o += (size_t) n < room ? (size_t) n : room - 1;
+        }
+    }
+    if (o < end) {
+        size_t lit = strlen(p);
+        if (lit > (size_t) (end - o)) lit = (size_t) (end - o);
+        memcpy(o, p, lit);
+        o += lit;
+    }
+    *o = 0;
+}
+
+// next record of the ring, skipping wrap fillers
+static const struct log_rec *peek(struct log_ring *r) {
+    while (r->tail < r->end) {
+        size_t pos = (size_t) (r->tail % r->size);
+        const struct log_rec *rec = (const struct log_rec *) (r->buf + pos);
+        if (!(rec->flags & REC_WRAP)) {
+            return rec;
+        }
+        r->tail += rec->size;
+        tlsuv_atomic_store(&r->tail, r->tail);
+    }
+    return NULL;
+}
+
+static void drain(void) {
+    static char msg[MAX_MSG_SIZE];
+    struct log_ring *head = tlsuv_atomic_load_ptr(&rings);
+    for (struct log_ring *r = head; r != NULL; r = r->next) {
+        r->end = tlsuv_atomic_load(&r->head);
+        uint64_t dropped = tlsuv_atomic_load(&r->dropped);
+        if (dropped != r->dropped_reported) {
+            snprintf(msg, sizeof(msg), "%llu log records dropped",
+                     (unsigned long long) (dropped - r->dropped_reported));
+            um_log_output(WARN, __FILE__, __LINE__, msg);
+            r->dropped_reported = dropped;
+        }
+    }
+
+    // deliver in timestamp order across threads
+    for (;;) {
+        struct log_ring *next = NULL;
+        const struct log_rec *rec = NULL;
+        for (struct log_ring *r = head; r != NULL; r = r->next) {
+            const struct log_rec *c = peek(r);
+            if (c && (rec == NULL || c->ts < rec->ts)) {
+                rec = c;
+                next = r;
+            }
+        }
+        if (rec == NULL) {
+            break;
+        }
+
+        format_rec(rec, (const uint8_t *) (rec + 1), msg, sizeof(msg));
+        um_log_output(rec->level, rec->file, rec->line, msg);
+        next->tail += rec->size;
+        tlsuv_atomic_store(&next->tail, next->tail);
+    }
+}
+
+static void consumer(void *arg) {
+    (void) arg;
+    uv_key_set(&ring_key, &consumer_mark);
+
+    uv_mutex_lock(&lock);
+    while (running) {
+        uint64_t req = flush_req;
+        uv_mutex_unlock(&lock);
+
+        drain();
+
+        uv_mutex_lock(&lock);
+        flush_done = req;
+        uv_cond_broadcast(&flushed);
+        if (running && flush_req == req) {
+            uv_cond_timedwait(&wakeup, &lock, DRAIN_INTERVAL_NS);
+        }
+    }
+    uv_mutex_unlock(&lock);
+    drain();
+}
+
+int tlsuv_log_async_start(size_t size) {
+    uv_once(&init_once, init);
+    uv_mutex_lock(&lock);
+    if (running) {
+        uv_mutex_unlock(&lock);
+        return UV_EALREADY;
+    }
+
+    size_t sz = MIN_RING_SIZE;
+    while (sz < size) sz <<= 1;
+    ring_size = size == 0 ? DEFAULT_RING_SIZE : sz;
+    running = 1;
+    int rc = uv_thread_create(&consumer_thread, consumer, NULL);
+    if (rc != 0) {
+        running = 0;
+        uv_mutex_unlock(&lock);
+        UM_LOG(WARN, "failed to start log thread: %d/%s", rc, uv_strerror(rc));
+        return rc;
+    }
+    tlsuv_atomic_store(&active, 1);
+    uv_mutex_unlock(&lock);
+    return 0;
+}
+
+void tlsuv_log_async_stop(void) {
+    uv_once(&init_once, init);
+    uv_mutex_lock(&lock);
+    if (!running) {
+        uv_mutex_unlock(&lock);
+        return;
+    }
+    tlsuv_atomic_store(&active, 0);
+    running = 0;
+    uv_cond_signal(&wakeup);
+    uv_mutex_unlock(&lock);
+    uv_thread_join(&consumer_thread);
+}
+
+void tlsuv_log_flush(void) {
+    uv_once(&init_once, init);
+    if (uv_key_get(&ring_key) == &consumer_mark) {
+        return;
+    }
+
+    uv_mutex_lock(&lock);
+    uint64_t req = ++flush_req;
+    uv_cond_signal(&wakeup);
+    while (running && flush_done < req) {
+        uv_cond_wait(&flushed, &lock);
+    }
+    uv_mutex_unlock(&lock);
+}
+
+int tlsuv_log_get_stats(tlsuv_log_stats *stats) {
+    if (stats == NULL) {
+        return UV_EINVAL;
+    }
+
+    uv_once(&init_once, init);
+    memset(stats, 0, sizeof(*stats));
+    for (struct log_ring *r = tlsuv_atomic_load_ptr(&rings); r != NULL; r = r->next) {
+        stats->records += (uint64_t) tlsuv_atomic_load(&r->records);
+        stats->dropped += (uint64_t) tlsuv_atomic_load(&r->dropped);
+        stats->threads++;
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_ASYNC_LOG_H
+#define TLSUV_ASYNC_LOG_H
+
+#include <stdarg.h>
+
+/**
+ * @return non-zero if asynchronous logging is active
+ */
+int async_log_active(void);
+
+/**
+ * Captures log record into the calling thread's ring buffer.
+ * [file] and [fmt] must be string literals (or otherwise outlive the record).
+ * @return 0 if record was captured or dropped, -1 if it has to be logged synchronously
+ *         (in which case [args] was not used)
+ */
+int async_log_record(int lvl, const char *file, unsigned int line, const char *fmt, va_list args);
+
+/**
+ * Delivers formatted message to user log function (um_debug.c).
+ */
+void um_log_output(int lvl, const char *file, unsigned int line, const char *msg);
+
+#endif //TLSUV_ASYNC_LOG_H
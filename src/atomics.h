@@ -0,0 +1,49 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_ATOMICS_H
+#define TLSUV_ATOMICS_H
+
+#include <stdint.h>
+
+/**
+ * Minimal atomic operations, library is built as C99 without <stdatomic.h>.
+ * Exchange, add, and init are full barriers, loads acquire, stores release.
+ */
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define tlsuv_atomic_xchg_ptr(p, v) InterlockedExchangePointer((PVOID volatile *) (p), (v))
+#define tlsuv_atomic_load_ptr(p) InterlockedCompareExchangePointer((PVOID volatile *) (p), NULL, NULL)
+#define tlsuv_atomic_store_ptr(p, v) ((void) InterlockedExchangePointer((PVOID volatile *) (p), (v)))
+#define tlsuv_atomic_xchg_int(p, v) InterlockedExchange((LONG volatile *) (p), (v))
+// sets *p to v if it is NULL, evaluates to true on success
+#define tlsuv_atomic_init_ptr(p, v) (InterlockedCompareExchangePointer((PVOID volatile *) (p), (v), NULL) == NULL)
+// 64-bit counters
+#define tlsuv_atomic_add(p, v) InterlockedExchangeAdd64((LONG64 volatile *) (p), (v))
+#define tlsuv_atomic_load(p) InterlockedCompareExchange64((LONG64 volatile *) (p), 0, 0)
+#define tlsuv_atomic_store(p, v) ((void) InterlockedExchange64((LONG64 volatile *) (p), (v)))
+#else
+#define tlsuv_atomic_xchg_ptr(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define tlsuv_atomic_load_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define tlsuv_atomic_store_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define tlsuv_atomic_xchg_int(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define tlsuv_atomic_init_ptr(p, v) __sync_bool_compare_and_swap((p), NULL, (v))
+#define tlsuv_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define tlsuv_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define tlsuv_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+#endif //TLSUV_ATOMICS_H
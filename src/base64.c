@@ -12,8 +12,494 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tlsuv/tlsuv.h>
+#include "cpu_features.h"
 #include "um_debug.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define B64_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define SSSE3_TARGET
+#define AVX2_TARGET
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define B64_NEON 1
+#include <arm_neon.h>
+#endif
+
+// decode table markers
+#define B64_INVALID 0xff
+#define B64_SPACE   0xfe
+#define B64_PAD     0xfd
+
+struct b64_alphabet {
+    const char *chars;
+    uint8_t dec[256];
+#if B64_X86
+    // SIMD lookup tables, see encode_ssse3()/decode_ssse3()
+    int8_t enc_shift[16];
+    int8_t dec_lo[16];
+    int8_t dec_hi[16];
+    int8_t dec_roll[16];
+    char special;         // character with the same high nibble as other range, needs extra adjustment
+    int8_t special_delta;
+#endif
+};
+
+static struct b64_alphabet b64_std = {
+        .chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+#if B64_X86
+        .enc_shift = { 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, },
+        // bit set in dec_lo[lo nibble] & dec_hi[hi nibble] marks invalid character
+        .dec_lo = { 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a, },
+        .dec_hi = { 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, },
+        .dec_roll = { 0, 0, 62 - '+', 52 - '0', -'A', -'A', 26 - 'a', 26 - 'a', 0, 0, 0, 0, 0, 0, 0, 0, },
+        .special = '/',
+        .special_delta = (63 - '/') - (62 - '+'),
+#endif
+};
+
+static struct b64_alphabet b64_url = {
+        .chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_",
+#if B64_X86
+        .enc_shift = { 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0, },
+        .dec_lo = { 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x3b, 0x3b, 0x3a, 0x3b, 0x1b, },
+        .dec_hi = { 0x10, 0x10, 0x01, 0x02, 0x04, 0x20, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, },
+        .dec_roll = { 0, 0, 62 - '-', 52 - '0', -'A', -'A', 26 - 'a', 26 - 'a', 0, 0, 0, 0, 0, 0, 0, 0, },
+        .special = '_',
+        .special_delta = (63 - '_') + 'A',
+#endif
+};
+
+enum b64_impl {
+    b64_scalar,
+    b64_ssse3,
+    b64_avx2,
+    b64_neon,
+};
+
+static uv_once_t b64_once = UV_ONCE_INIT;
+static enum b64_impl impl = b64_scalar;
+
+static void init_alphabet(struct b64_alphabet *a) {
+    memset(a->dec, B64_INVALID, sizeof(a->dec));
+    for (int i = 0; i < 64; i++) {
+        a->dec[(uint8_t) a->chars[i]] = (uint8_t) i;
+    }
+    a->dec[' '] = a->dec['\t'] = a->dec['\r'] = a->dec['\n'] = B64_SPACE;
+    a->dec['='] = B64_PAD;
+}
+
+static void b64_init(void) {
+    init_alphabet(&b64_std);
+    init_alphabet(&b64_url);
+#if B64_X86
+    if (tlsuv_cpu_has_avx2()) {
+        impl = b64_avx2;
+    } else if (tlsuv_cpu_has_ssse3()) {
+        impl = b64_ssse3;
+    }
+#elif B64_NEON
+    impl = b64_neon;
+#endif
+    UM_LOG(VERB, "base64 codec: %s",
+           impl == b64_avx2 ? "avx2" : impl == b64_ssse3 ? "ssse3" : impl == b64_neon ? "neon" : "scalar");
+}
+
+/*
+ * SIMD kernels only process complete blocks and advance the pointers past them,
+ * remaining input (or a block with whitespace/padding/invalid characters) is left to the scalar code.
+ * Kernels may read/write a whole vector past the block, callers guarantee the margin.
+ */
+#if B64_X86
+
+SSSE3_TARGET
+static inline __m128i enc_reshuffle_ssse3(__m128i in) {
+    // 12 input bytes -> 16 6-bit indices (Mula's multiply-shift)
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+SSSE3_TARGET
+static inline __m128i enc_translate_ssse3(__m128i idx, __m128i shift_lut) {
+    __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, r), idx);
+}
+
+SSSE3_TARGET
+static void encode_ssse3(const uint8_t **in, const uint8_t *in_end, char **out, const struct b64_alphabet *a) {
+    __m128i shift_lut = _mm_loadu_si128((const __m128i *) a->enc_shift);
+    const uint8_t *s = *in;
+    char *o = *out;
+    while (in_end - s >= 16) {
+        __m128i idx = enc_reshuffle_ssse3(_mm_loadu_si128((const __m128i *) s));
+        _mm_storeu_si128((__m128i *) o, enc_translate_ssse3(idx, shift_lut));
+        s += 12;
+        o += 16;
+    }
+    *in = s;
+    *out = o;
+}
+
+SSSE3_TARGET
+static inline int dec_translate_ssse3(__m128i chars, __m128i *vals, const struct b64_alphabet *a,
+                                      __m128i lut_lo, __m128i lut_hi, __m128i lut_roll) {
+    __m128i hi_nib = _mm_and_si128(_mm_srli_epi32(chars, 4), _mm_set1_epi8(0x0f));
+    __m128i lo_nib = _mm_and_si128(chars, _mm_set1_epi8(0x0f));
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nib);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nib);
+    __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(bad) != 0xffff) {
+        return -1;
+    }
+    __m128i special = _mm_and_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(a->special)),
+                                    _mm_set1_epi8(a->special_delta));
+    __m128i roll = _mm_add_epi8(_mm_shuffle_epi8(lut_roll, hi_nib), special);
+    *vals = _mm_add_epi8(chars, roll);
+    return 0;
+}
+
+SSSE3_TARGET
+static inline __m128i dec_pack_ssse3(__m128i vals) {
+    // 16 6-bit values -> 12 bytes in the low part of the vector
+    __m128i ab_bc = _mm_maddubs_epi16(vals, _mm_set1_epi32(0x01400140));
+    __m128i out = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+SSSE3_TARGET
+static void decode_ssse3(const uint8_t **in, const uint8_t *in_end, uint8_t **out, const uint8_t *out_end,
+                         const struct b64_alphabet *a) {
+    __m128i lut_lo = _mm_loadu_si128((const __m128i *) a->dec_lo);
+    __m128i lut_hi = _mm_loadu_si128((const __m128i *) a->dec_hi);
+    __m128i lut_roll = _mm_loadu_si128((const __m128i *) a->dec_roll);
+    const uint8_t *s = *in;
+    uint8_t *o = *out;
+    while (in_end - s >= 16 && out_end - o >= 16) {
+        __m128i vals;
+        if (dec_translate_ssse3(_mm_loadu_si128((const __m128i *) s), &vals, a, lut_lo, lut_hi, lut_roll) != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) o, dec_pack_ssse3(vals));
+        s += 16;
+        o += 12;
+    }
+    *in = s;
+    *out = o;
+}
+
+AVX2_TARGET
+static void encode_avx2(const uint8_t **in, const uint8_t *in_end, char **out, const struct b64_alphabet *a) {
+    __m256i shift_lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) a->enc_shift));
+    const __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const uint8_t *s = *in;
+    char *o = *out;
+    while (in_end - s >= 32) {
+        // 12 bytes into each 128-bit lane
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) s)),
+                                            _mm_loadu_si128((const __m128i *) (s + 12)), 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+
+        __m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+        r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        r = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, r), idx);
+        _mm256_storeu_si256((__m256i *) o, r);
+        s += 24;
+        o += 32;
+    }
+    *in = s;
+    *out = o;
+}
+
+AVX2_TARGET
+static void decode_avx2(const uint8_t **in, const uint8_t *in_end, uint8_t **out, const uint8_t *out_end,
+                        const struct b64_alphabet *a) {
+    __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) a->dec_lo));
+    __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) a->dec_hi));
+    __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) a->dec_roll));
+    __m256i special = _mm256_set1_epi8(a->special);
+    __m256i special_delta = _mm256_set1_epi8(a->special_delta);
+    __m256i nib_mask = _mm256_set1_epi8(0x0f);
+    const uint8_t *s = *in;
+    uint8_t *o = *out;
+    while (in_end - s >= 32 && out_end - o >= 32) {
+        __m256i chars = _mm256_loadu_si256((const __m256i *) s);
+        __m256i hi_nib = _mm256_and_si256(_mm256_srli_epi32(chars, 4), nib_mask);
+        __m256i lo_nib = _mm256_and_si256(chars, nib_mask);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nib);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nib);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i roll = _mm256_add_epi8(_mm256_shuffle_epi8(lut_roll, hi_nib),
+                                       _mm256_and_si256(_mm256_cmpeq_epi8(chars, special), special_delta));
+        __m256i vals = _mm256_add_epi8(chars, roll);
+
+        __m256i ab_bc = _mm256_maddubs_epi16(vals, _mm256_set1_epi32(0x01400140));
+        __m256i packed = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+        packed = _mm256_shuffle_epi8(packed, _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        // join 12 byte groups of both lanes
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i *) o, packed);
+        s += 32;
+        o += 24;
+    }
+    *in = s;
+    *out = o;
+}
+
+#elif B64_NEON
+
+static inline uint8x16x4_t load_table(const uint8_t *t) {
+    uint8x16x4_t r;
+    r.val[0] = vld1q_u8(t);
+    r.val[1] = vld1q_u8(t + 16);
+    r.val[2] = vld1q_u8(t + 32);
+    r.val[3] = vld1q_u8(t + 48);
+    return r;
+}
+
+static void encode_neon(const uint8_t **in, const uint8_t *in_end, char **out, const struct b64_alphabet *a) {
+    uint8x16x4_t lut = load_table((const uint8_t *) a->chars);
+    uint8x16_t mask6 = vdupq_n_u8(0x3f);
+    const uint8_t *s = *in;
+    char *o = *out;
+    while (in_end - s >= 48) {
+        uint8x16x3_t v = vld3q_u8(s);
+        uint8x16x4_t r;
+        r.val[0] = vshrq_n_u8(v.val[0], 2);
+        r.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[0], 4), vshrq_n_u8(v.val[1], 4)), mask6);
+        r.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[1], 2), vshrq_n_u8(v.val[2], 6)), mask6);
+        r.val[3] = vandq_u8(v.val[2], mask6);
+        r.val[0] = vqtbl4q_u8(lut, r.val[0]);
+        r.val[1] = vqtbl4q_u8(lut, r.val[1]);
+        r.val[2] = vqtbl4q_u8(lut, r.val[2]);
+        r.val[3] = vqtbl4q_u8(lut, r.val[3]);
+        vst4q_u8((uint8_t *) o, r);
+        s += 48;
+        o += 64;
+    }
+    *in = s;
+    *out = o;
+}
+
+static inline uint8x16_t dec_lookup_neon(uint8x16_t c, uint8x16x4_t lo, uint8x16x4_t hi) {
+    // characters outside of table range keep invalid marker
+    uint8x16_t v = vqtbx4q_u8(vdupq_n_u8(B64_INVALID), lo, c);
+    return vqtbx4q_u8(v, hi, vsubq_u8(c, vdupq_n_u8(64)));
+}
+
+static void decode_neon(const uint8_t **in, const uint8_t *in_end, uint8_t **out, const uint8_t *out_end,
+                        const struct b64_alphabet *a) {
+    uint8x16x4_t lo = load_table(a->dec);
+    uint8x16x4_t hi = load_table(a->dec + 64);
+    const uint8_t *s = *in;
+    uint8_t *o = *out;
+    while (in_end - s >= 64 && out_end - o >= 48) {
+        uint8x16x4_t c = vld4q_u8(s);
+        uint8x16_t v0 = dec_lookup_neon(c.val[0], lo, hi);
+        uint8x16_t v1 = dec_lookup_neon(c.val[1], lo, hi);
+        uint8x16_t v2 = dec_lookup_neon(c.val[2], lo, hi);
+        uint8x16_t v3 = dec_lookup_neon(c.val[3], lo, hi);
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(v0, v1), vorrq_u8(v2, v3))) > 63) {
+            break;
+        }
+        uint8x16x3_t r;
+        r.val[0] = vorrq_u8(vshlq_n_u8(v0, 2), vshrq_n_u8(v1, 4));
+        r.val[1] = vorrq_u8(vshlq_n_u8(v1, 4), vshrq_n_u8(v2, 2));
+        r.val[2] = vorrq_u8(vshlq_n_u8(v2, 6), v3);
+        vst3q_u8(o, r);
+        s += 64;
+        o += 48;
+    }
+    *in = s;
+    *out = o;
+}
+
+#endif
+
+size_t tlsuv_base64_encoded_len(size_t len, int flags) {
+    if (flags & TLSUV_BASE64_NOPAD) {
+        return len / 3 * 4 + (len % 3 == 0 ? 0 : len % 3 + 1);
+    }
+    return (len + 2) / 3 * 4;
+}
+
+size_t tlsuv_base64_decoded_len(size_t len) {
+    return (len + 3) / 4 * 3;
+}
+
+int tlsuv_base64_encode(const void *in, size_t len, char *out, size_t *out_len, int flags) {
+    if ((in == NULL && len > 0) || out == NULL || out_len == NULL) {
+        return UV_EINVAL;
+    }
+
+    size_t need = tlsuv_base64_encoded_len(len, flags);
+    if (*out_len < need) {
+        return UV_ENOBUFS;
+    }
+
+    uv_once(&b64_once, b64_init);
+    const struct b64_alphabet *a = (flags & TLSUV_BASE64_URL) ? &b64_url : &b64_std;
+    const uint8_t *s = in;
+    const uint8_t *end = s + len;
+    char *o = out;
+
+    switch (impl) {
+#if B64_X86
+        case b64_avx2:
+            encode_avx2(&s, end, &o, a);
+            // fall through, SSSE3 kernel handles the shorter tail
+        case b64_ssse3:
+            encode_ssse3(&s, end, &o, a);
+            break;
+#elif B64_NEON
+        case b64_neon:
+            encode_neon(&s, end, &o, a);
+            break;
+#endif
+        default:
+            break;
+    }
+
+    const char *chars = a->chars;
+    for (; end - s >= 3; s += 3) {
+        uint32_t v = (uint32_t) s[0] << 16 | (uint32_t) s[1] << 8 | s[2];
+        *o++ = chars[(v >> 18) & 0x3f];
+        *o++ = chars[(v >> 12) & 0x3f];
+        *o++ = chars[(v >> 6) & 0x3f];
+        *o++ = chars[v & 0x3f];
+    }
+    if (s < end) {
+        uint32_t v = (uint32_t) s[0] << 16 | (end - s > 1 ? (uint32_t) s[1] << 8 : 0);
+        *o++ = chars[(v >> 18) & 0x3f];
+        *o++ = chars[(v >> 12) & 0x3f];
+        if (end - s > 1) {
+            *o++ = chars[(v >> 6) & 0x3f];
+        } else if (!(flags & TLSUV_BASE64_NOPAD)) {
+            *o++ = '=';
+        }
+        if (!(flags & TLSUV_BASE64_NOPAD)) {
+            *o++ = '=';
+        }
+    }
+
+    // terminate if there is room, so output can be used as a string
+    if (*out_len > need) {
+        *o = '\0';
+    }
+    *out_len = need;
+    return 0;
+}
+
+static inline void decode_simd(const uint8_t **s, const uint8_t *end, uint8_t **o, const uint8_t *out_end,
+                               const struct b64_alphabet *a) {
+    switch (impl) {
+#if B64_X86
+        case b64_avx2:
+            decode_avx2(s, end, o, out_end, a);
+            // fall through
+        case b64_ssse3:
+            decode_ssse3(s, end, o, out_end, a);
+            break;
+#elif B64_NEON
+        case b64_neon:
+            decode_neon(s, end, o, out_end, a);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+int tlsuv_base64_decode(const char *in, size_t len, void *out, size_t *out_len, int flags) {
+    if ((in == NULL && len > 0) || out == NULL || out_len == NULL) {
+        return UV_EINVAL;
+    }
+
+    uv_once(&b64_once, b64_init);
+    const struct b64_alphabet *a = (flags & TLSUV_BASE64_URL) ? &b64_url : &b64_std;
+    const uint8_t *s = (const uint8_t *) in;
+    const uint8_t *end = s + len;
+    uint8_t *o = out;
+    uint8_t *out_end = o + *out_len;
+
+    uint32_t acc = 0;
+    int q = 0;
+    int pad = 0;
+    while (s < end) {
+        if (q == 0 && pad == 0) {
+            decode_simd(&s, end, &o, out_end, a);
+            if (s == end) break;
+        }
+
+        uint8_t v = a->dec[*s++];
+        if (v < 64) {
+            if (pad > 0) {
+                return UV_EINVAL;
+            }
+            acc = acc << 6 | v;
+            if (++q == 4) {
+                if (out_end - o < 3) {
+                    return UV_ENOBUFS;
+                }
+                *o++ = (uint8_t) (acc >> 16);
+                *o++ = (uint8_t) (acc >> 8);
+                *o++ = (uint8_t) acc;
+                acc = 0;
+                q = 0;
+            }
+        } else if (v == B64_PAD) {
+            if (q < 2 || q + ++pad > 4) {
+                return UV_EINVAL;
+            }
+        } else if (v != B64_SPACE) {
+            return UV_EINVAL;
+        }
+    }
+
+    if (q == 1 || (pad > 0 && q + pad != 4)) {
+        return UV_EINVAL;
+    }
+    if (q > 1) {
+        if (out_end - o < q - 1) {
+            return UV_ENOBUFS;
+        }
+        acc <<= 6 * (4 - q);
+        *o++ = (uint8_t) (acc >> 16);
+        if (q == 3) {
+            *o++ = (uint8_t) (acc >> 8);
+        }
+    }
+    *out_len = (size_t) (o - (uint8_t *) out);
+    return 0;
+}
+
 /*
 Copyright 2020 NetFoundry, Inc.
 
@@ -30,8 +516,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
-#include <stdlib.h>
-
+// legacy decoder: accepts both alphabets and stops at the first non-base64 character
 static const unsigned char pr2six[256] = {
     64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
     64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
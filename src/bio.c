@@ -22,32 +22,65 @@
 #endif
 #include "bio.h"
 
-struct msg {
-    size_t len;
-    uint8_t *buf;
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
 
-    STAILQ_ENTRY(msg) next;
+struct bio_seg {
+    size_t len;
+    STAILQ_ENTRY(bio_seg) next;
+    uint8_t data[TLSUV_BIO_SEG_SIZE];
 };
 
+static struct bio_seg *seg_get(tlsuv_BIO *bio) {
+    struct bio_seg *s = STAILQ_FIRST(&bio->spare);
+    if (s) {
+        STAILQ_REMOVE_HEAD(&bio->spare, next);
+        bio->spare_count--;
+    } else {
+        s = tlsuv__malloc(sizeof(struct bio_seg));
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+    s->len = 0;
+    return s;
+}
+
+static void seg_release(tlsuv_BIO *bio, struct bio_seg *s) {
+    if (bio->spare_count < TLSUV_BIO_MAX_SPARE) {
+        STAILQ_INSERT_HEAD(&bio->spare, s, next);
+        bio->spare_count++;
+    } else {
+        tlsuv__free(s);
+    }
+}
+
 tlsuv_BIO *tlsuv_BIO_new() {
-    tlsuv_BIO * bio = calloc(1, sizeof(tlsuv_BIO));
+    tlsuv_BIO * bio = tlsuv__calloc(1, sizeof(tlsuv_BIO));
     bio->available = 0;
     bio->headoffset = 0;
     bio->qlen = 0;
+    bio->spare_count = 0;
+    bio->tail = NULL;
 
-    STAILQ_INIT(&bio->message_q);
+    STAILQ_INIT(&bio->segments);
+    STAILQ_INIT(&bio->spare);
     return bio;
 }
 
 void tlsuv_BIO_free(tlsuv_BIO *bio) {
-    while(!STAILQ_EMPTY(&bio->message_q)) {
-        struct msg *m = STAILQ_FIRST(&bio->message_q);
-        STAILQ_REMOVE_HEAD(&bio->message_q, next);
-        free(m->buf);
-        free(m);
+    while(!STAILQ_EMPTY(&bio->segments)) {
+        struct bio_seg *s = STAILQ_FIRST(&bio->segments);
+        STAILQ_REMOVE_HEAD(&bio->segments, next);
+        tlsuv__free(s);
+    }
+    while(!STAILQ_EMPTY(&bio->spare)) {
+        struct bio_seg *s = STAILQ_FIRST(&bio->spare);
+        STAILQ_REMOVE_HEAD(&bio->spare, next);
+        tlsuv__free(s);
     }
 
-    free(bio);
+    tlsuv__free(bio);
 }
 
 size_t tlsuv_BIO_available(tlsuv_BIO *bio) {
@@ -55,48 +88,99 @@ size_t tlsuv_BIO_available(tlsuv_BIO *bio) {
 }
 
 int tlsuv_BIO_put(tlsuv_BIO *bio, const uint8_t *buf, size_t len) {
-    struct msg *m = malloc(sizeof(struct msg));
-    if (m == NULL) {
-        return -1;
-    }
+    struct bio_seg *tail = bio->tail;
+
+    while (len > 0) {
+        if (tail == NULL || tail->len == TLSUV_BIO_SEG_SIZE) {
+            tail = seg_get(bio);
+            if (tail == NULL) {
+                return -1;
+            }
+            STAILQ_INSERT_TAIL(&bio->segments, tail, next);
+            bio->tail = tail;
+            bio->qlen += 1;
+        }
 
-    m->buf = malloc(len);
-    if (m->buf == NULL) {
-        free(m);
-        return -1;
+        size_t n = MIN(len, TLSUV_BIO_SEG_SIZE - tail->len);
+        memcpy(tail->data + tail->len, buf, n);
+        tail->len += n;
+        bio->available += n;
+        buf += n;
+        len -= n;
     }
-    memcpy(m->buf, buf, len);
-
-    m->len = len;
-
-    STAILQ_INSERT_TAIL(&bio->message_q, m, next);
-    bio->available += len;
-    bio->qlen += 1;
 
     return 0;
 }
 
-int tlsuv_BIO_read(tlsuv_BIO *bio, uint8_t *buf, size_t len) {
+size_t tlsuv_BIO_peek(tlsuv_BIO *bio, const uint8_t **data) {
+    struct bio_seg *s = STAILQ_FIRST(&bio->segments);
+    if (s == NULL || s->len == bio->headoffset) {
+        *data = NULL;
+        return 0;
+    }
 
-    size_t total = 0;
+    *data = s->data + bio->headoffset;
+    return s->len - bio->headoffset;
+}
 
-    while (! STAILQ_EMPTY(&bio->message_q) && total < len) {
-        struct msg *m = STAILQ_FIRST(&bio->message_q);
+void tlsuv_BIO_consume(tlsuv_BIO *bio, size_t len) {
+    while (len > 0 && !STAILQ_EMPTY(&bio->segments)) {
+        struct bio_seg *s = STAILQ_FIRST(&bio->segments);
 
-        size_t recv_size = MIN(len - total, m->len - bio->headoffset);
-        memcpy(buf + total, m->buf + bio->headoffset, recv_size);
-        bio->headoffset += recv_size;
-        bio->available -= recv_size;
-        total += recv_size;
+        size_t n = MIN(len, s->len - bio->headoffset);
+        bio->headoffset += n;
+        bio->available -= n;
+        len -= n;
 
-        if (bio->headoffset == m->len) {
-            STAILQ_REMOVE_HEAD(&bio->message_q, next);
+        if (bio->headoffset == s->len) {
             bio->headoffset = 0;
+            if (STAILQ_NEXT(s, next) == NULL) {
+                // last segment: rewind in place instead of recycling
+                s->len = 0;
+                break;
+            }
+            STAILQ_REMOVE_HEAD(&bio->segments, next);
             bio->qlen -= 1;
+            seg_release(bio, s);
+        }
+    }
+}
 
-            free(m->buf);
-            free(m);
+void tlsuv_BIO_shrink(tlsuv_BIO *bio) {
+    while (!STAILQ_EMPTY(&bio->spare)) {
+        struct bio_seg *s = STAILQ_FIRST(&bio->spare);
+        STAILQ_REMOVE_HEAD(&bio->spare, next);
+        tlsuv__free(s);
+    }
+    bio->spare_count = 0;
+
+    if (bio->available == 0) {
+        while (!STAILQ_EMPTY(&bio->segments)) {
+            struct bio_seg *s = STAILQ_FIRST(&bio->segments);
+            STAILQ_REMOVE_HEAD(&bio->segments, next);
+            tlsuv__free(s);
         }
+        bio->qlen = 0;
+        bio->headoffset = 0;
+        bio->tail = NULL;
+    }
+}
+
+size_t tlsuv_BIO_mem(tlsuv_BIO *bio) {
+    return (bio->qlen + bio->spare_count) * sizeof(struct bio_seg);
+}
+
+int tlsuv_BIO_read(tlsuv_BIO *bio, uint8_t *buf, size_t len) {
+
+    size_t total = 0;
+    const uint8_t *data;
+    size_t avail;
+
+    while (total < len && (avail = tlsuv_BIO_peek(bio, &data)) > 0) {
+        size_t recv_size = MIN(len - total, avail);
+        memcpy(buf + total, data, recv_size);
+        tlsuv_BIO_consume(bio, recv_size);
+        total += recv_size;
     }
 
     return (int) total;
@@ -16,13 +16,36 @@
 #define TLSUV_BIO_H
 
 #include "tlsuv/queue.h"
+#include <stddef.h>
 #include <stdint.h>
 
+// size of a single BIO segment
+#ifndef TLSUV_BIO_SEG_SIZE
+#define TLSUV_BIO_SEG_SIZE 4096
+#endif
+
+// number of drained segments kept for reuse
+#ifndef TLSUV_BIO_MAX_SPARE
+#define TLSUV_BIO_MAX_SPARE 4
+#endif
+
+/*
+ * Chunked ring buffer: data is kept in a chain of fixed size segments.
+ * Drained segments are moved to the spare list and recycled by subsequent writes,
+ * so steady state traffic does not hit the allocator.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct tlsuv_bio_s {
     size_t available;
     size_t headoffset;
     unsigned int qlen;
-    STAILQ_HEAD(msgq, msg) message_q;
+    unsigned int spare_count;
+    struct bio_seg *tail;
+    STAILQ_HEAD(segq, bio_seg) segments;
+    STAILQ_HEAD(spareq, bio_seg) spare;
 } tlsuv_BIO;
 
 // create new BIO
@@ -33,4 +56,29 @@ int tlsuv_BIO_put(tlsuv_BIO *bio, const uint8_t *buf, size_t len);
 int tlsuv_BIO_read(tlsuv_BIO *bio, uint8_t *buf, size_t len);
 size_t tlsuv_BIO_available(tlsuv_BIO *bio);
 
+/**
+ * Returns contiguous readable region at the head of the BIO without copying.
+ * @return length of the region, 0 if BIO is empty
+ */
+size_t tlsuv_BIO_peek(tlsuv_BIO *bio, const uint8_t **data);
+
+/**
+ * Drops `len` bytes from the head of the BIO, typically after tlsuv_BIO_peek().
+ */
+void tlsuv_BIO_consume(tlsuv_BIO *bio, size_t len);
+
+/**
+ * Frees spare segments, and the last segment if BIO is empty.
+ */
+void tlsuv_BIO_shrink(tlsuv_BIO *bio);
+
+/**
+ * @return bytes of segment storage held by the BIO (including spare segments)
+ */
+size_t tlsuv_BIO_mem(tlsuv_BIO *bio);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif//TLSUV_BIO_H
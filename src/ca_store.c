@@ -0,0 +1,186 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <uv.h>
+
+#include "ca_store.h"
+#include "tlsuv/queue.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
+
+enum ca_source {
+    ca_system,
+    ca_file,
+    ca_pem,
+};
+
+struct ca_entry {
+    tlsuv_ca_load_f load;
+    tlsuv_ca_free_f release;
+    enum ca_source source;
+
+    // file path or PEM content
+    char *key;
+    size_t key_len;
+    uint64_t hash;
+    int64_t mtime;
+    int64_t size;
+
+    void *store;
+    unsigned int refs;
+
+    LIST_ENTRY(ca_entry) _next;
+};
+
+static LIST_HEAD(ca_entries, ca_entry) entries = LIST_HEAD_INITIALIZER(entries);
+static uv_mutex_t lock;
+static uv_once_t lock_once = UV_ONCE_INIT;
+
+static void lock_init(void) {
+    uv_mutex_init(&lock);
+}
+
+// FNV-1a, only used to pick candidates, keys are compared in full
+static uint64_t hash_bytes(const char *buf, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t) buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int entry_matches(const struct ca_entry *e, const struct ca_entry *k) {
+    return e->load == k->load && e->source == k->source &&
+           e->hash == k->hash && e->mtime == k->mtime && e->size == k->size &&
+           e->key_len == k->key_len && memcmp(e->key, k->key, k->key_len) == 0;
+}
+
+#ifndef S_ISREG
+#define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
+#endif
+
+#define CA_PATH_MAX 4096
+
+int tlsuv_ca_is_file(const char *buf, size_t len, struct stat *st) {
+    // length may include terminating NUL
+    while (len > 0 && buf[len - 1] == '\0') len--;
+
+    // PEM content is not NUL terminated, stat() only gets a bounded copy
+    if (len == 0 || len >= CA_PATH_MAX || memchr(buf, '\0', len) != NULL ||
+        memchr(buf, '\n', len) != NULL) {
+        return 0;
+    }
+
+    char path[CA_PATH_MAX];
+    memcpy(path, buf, len);
+    path[len] = '\0';
+    struct stat s;
+    if (st == NULL) st = &s;
+    return stat(path, st) == 0 && S_ISREG(st->st_mode);
+}
+
+void *tlsuv_ca_store_acquire(const char *buf, size_t len, tlsuv_ca_load_f load, tlsuv_ca_free_f release) {
+    uv_once(&lock_once, lock_init);
+
+    struct ca_entry k = {
+            .load = load,
+            .source = ca_system,
+            .key = (char *) "",
+            .key_len = 0,
+    };
+
+    struct stat st;
+    if (buf != NULL) {
+        if (tlsuv_ca_is_file(buf, len, &st)) {
+            k.source = ca_file;
+            k.key_len = strnlen(buf, len);
+            k.mtime = (int64_t) st.st_mtime;
+            k.size = (int64_t) st.st_size;
+        } else {
+            k.source = ca_pem;
+            k.key_len = len;
+        }
+        k.key = (char *) buf;
+    }
+    k.hash = hash_bytes(k.key, k.key_len);
+
+    uv_mutex_lock(&lock);
+    struct ca_entry *e;
+    LIST_FOREACH(e, &entries, _next) {
+        if (entry_matches(e, &k)) {
+            e->refs++;
+            uv_mutex_unlock(&lock);
+            UM_LOG(VERB, "using shared CA store[%p] refs[%u]", e->store, e->refs);
+            return e->store;
+        }
+    }
+
+    // parsed under lock, so that contexts created concurrently do not load the same bundle twice
+    void *store = load(buf, len);
+    if (store == NULL) {
+        uv_mutex_unlock(&lock);
+        return NULL;
+    }
+
+    e = tlsuv__calloc(1, sizeof(*e));
+    *e = k;
+    e->release = release;
+    e->key = tlsuv__malloc(k.key_len + 1);
+    memcpy(e->key, k.key, k.key_len);
+    e->key[k.key_len] = 0;
+    e->store = store;
+    e->refs = 1;
+    LIST_INSERT_HEAD(&entries, e, _next);
+    uv_mutex_unlock(&lock);
+
+    UM_LOG(DEBG, "loaded CA store[%p] from %s", store,
+           k.source == ca_system ? "system bundle" : k.source == ca_file ? e->key : "PEM");
+    return store;
+}
+
+void tlsuv_ca_store_release(void *store) {
+    if (store == NULL) return;
+
+    uv_once(&lock_once, lock_init);
+    uv_mutex_lock(&lock);
+    struct ca_entry *e;
+    LIST_FOREACH(e, &entries, _next) {
+        if (e->store == store) {
+            break;
+        }
+    }
+
+    if (e == NULL || --e->refs > 0) {
+        uv_mutex_unlock(&lock);
+        return;
+    }
+    LIST_REMOVE(e, _next);
+    uv_mutex_unlock(&lock);
+
+    UM_LOG(DEBG, "releasing CA store[%p]", store);
+    if (e->release) {
+        e->release(e->store);
+    }
+    tlsuv__free(e->key);
+    tlsuv__free(e);
+}
@@ -0,0 +1,63 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_CA_STORE_H
+#define TLSUV_CA_STORE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process-wide cache of parsed trust stores, shared by TLS contexts.
+ *
+ * Stores are keyed by loader and source: system store (buf == NULL), bundle file (path, size and mtime),
+ * or PEM content. Engine supplies functions to parse and release its own store type.
+ * Entries are ref-counted and released when the last context lets go of them.
+ */
+
+struct stat;
+
+/**
+ * Checks if CA source names a regular file. `buf` is only read up to `len`, PEM content is never passed to stat().
+ * @param buf bundle path or PEM content
+ * @param len length of `buf`
+ * @param st (optional, out) file status
+ * @returns 1 if `buf` is a path to a regular file, 0 otherwise
+ */
+int tlsuv_ca_is_file(const char *buf, size_t len, struct stat *st);
+
+typedef void *(*tlsuv_ca_load_f)(const char *buf, size_t len);
+typedef void (*tlsuv_ca_free_f)(void *store);
+
+/**
+ * Returns shared store for the given source, parsing it on first use.
+ * @param buf bundle path, PEM content, or NULL for system store
+ * @param len length of `buf`
+ */
+void *tlsuv_ca_store_acquire(const char *buf, size_t len, tlsuv_ca_load_f load, tlsuv_ca_free_f release);
+
+/**
+ * Drops reference obtained with tlsuv_ca_store_acquire().
+ */
+void tlsuv_ca_store_release(void *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_CA_STORE_H
@@ -15,12 +15,16 @@
 
 #include <uv.h>
 #include <zlib.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include "um_debug.h"
 
 #include "compression.h"
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
 #define NO_GZIP (1 << 16)
 
 static uv_once_t init_guard;
@@ -30,26 +34,97 @@ static unsigned long (*zlib_flags)(void);
 static int (*inflateEnd_f)(z_streamp strm);
 static int (*inflateInit_f)(z_streamp strm, const char *version, int stream_size);
 static int (*inflateInit2_f) (z_streamp strm, int  windowBits, const char *version, int stream_size);
+static int (*inflateReset2_f)(z_streamp strm, int windowBits);
 static int (*inflate_f)(z_streamp strm, int flush);
+static int (*deflateInit2_f)(z_streamp strm, int level, int method, int windowBits, int memLevel, int strategy,
+                             const char *version, int stream_size);
+static int (*deflate_f)(z_streamp strm, int flush);
+static int (*deflateEnd_f)(z_streamp strm);
+static int (*deflateReset_f)(z_streamp strm);
 static const char * (*zError_f) (int);
 
 static const char *ZLibVersion;
+static bool zlib_ok;
+static bool zlib_deflate_ok;
+static char encodings_buf[32];
 static char *encodings;
 
+// brotli and zstd decoders are optional, loaded at runtime, declarations below match their public APIs
+typedef enum {
+    BROTLI_DECODER_RESULT_ERROR = 0,
+    BROTLI_DECODER_RESULT_SUCCESS = 1,
+    BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT = 2,
+    BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT = 3
+} BrotliDecoderResult;
+
+static uv_lib_t brotli;
+static bool brotli_ok;
+static void *(*BrotliDecoderCreateInstance_f)(void *alloc, void *free, void *opaque);
+static void (*BrotliDecoderDestroyInstance_f)(void *state);
+static BrotliDecoderResult (*BrotliDecoderDecompressStream_f)(void *state,
+                                                              size_t *avail_in, const uint8_t **next_in,
+                                                              size_t *avail_out, uint8_t **next_out,
+                                                              size_t *total_out);
+
+typedef struct { const void *src; size_t size; size_t pos; } zstd_in_buf;
+typedef struct { void *dst; size_t size; size_t pos; } zstd_out_buf;
+
+static uv_lib_t zstd;
+static bool zstd_ok;
+static void *(*ZSTD_createDStream_f)(void);
+static size_t (*ZSTD_freeDStream_f)(void *ds);
+static size_t (*ZSTD_decompressStream_f)(void *ds, zstd_out_buf *out, zstd_in_buf *in);
+static size_t (*ZSTD_initDStream_f)(void *ds);
+static bool zstd_deflate_ok;
+static void *(*ZSTD_createCStream_f)(void);
+static size_t (*ZSTD_freeCStream_f)(void *cs);
+static size_t (*ZSTD_compressStream2_f)(void *cs, zstd_out_buf *out, zstd_in_buf *in, int end_op);
+#define ZSTD_e_continue 0
+#define ZSTD_e_end 2
+static unsigned (*ZSTD_isError_f)(size_t code);
+static const char *(*ZSTD_getErrorName_f)(size_t code);
+
+enum codec {
+    CODEC_ZLIB,
+    CODEC_BROTLI,
+    CODEC_ZSTD,
+};
+
 struct tlsuv_http_inflater_s {
-    z_stream s;
+    enum codec codec;
+    union {
+        z_stream z;
+        void *brotli;
+        void *zstd;
+    } s;
     int complete;
+    int error;
+    // raw deflate window (permessage-deflate), 0 for wrapped streams
+    int raw_bits;
 
     data_cb cb;
     void *cb_ctx;
+
+    // output buffer lives with inflater, reused across calls and responses
+    uint8_t out[32 * 1024];
+};
+
+struct tlsuv_http_deflater_s {
+    enum codec codec;
+    union {
+        z_stream z;
+        void *zstd;
+    } s;
+
+    uint8_t out[16 * 1024];
 };
 
 static void* comp_alloc(void *ctx, unsigned int c, unsigned int s) {
-    return calloc(c, s);
+    return tlsuv__calloc(c, s);
 }
 
 static void comp_free(void *ctx, void *p) {
-    free(p);
+    tlsuv__free(p);
 }
 
 #if __linux__
@@ -60,8 +135,34 @@ static void comp_free(void *ctx, void *p) {
 
 #endif
 
-static void init() {
+#if _WIN32
+static const char *const BROTLI_LIBS[] = { "brotlidec.dll", NULL };
+static const char *const ZSTD_LIBS[] = { "zstd.dll", "libzstd.dll", NULL };
+#elif defined(__APPLE__)
+static const char *const BROTLI_LIBS[] = { "libbrotlidec.1.dylib", "libbrotlidec.dylib", NULL };
+static const char *const ZSTD_LIBS[] = { "libzstd.1.dylib", "libzstd.dylib", NULL };
+#else
+static const char *const BROTLI_LIBS[] = { "libbrotlidec.so.1", "libbrotlidec.so", NULL };
+static const char *const ZSTD_LIBS[] = { "libzstd.so.1", "libzstd.so", NULL };
+#endif
+
+static int load_lib(uv_lib_t *lib, const char *const *names) {
+    for (int i = 0; names[i] != NULL; i++) {
+        if (uv_dlopen(names[i], lib) == 0) {
+            return 0;
+        }
+        UM_LOG(TRACE, "%s", uv_dlerror(lib));
+        uv_dlclose(lib);
+    }
+    return -1;
+}
+
+#define CHECK_DL(op) do{ \
+if ((op) != 0)           \
+goto on_error;           \
+} while(0)
 
+static void init_zlib() {
 #if _WIN32
     // on WIN32 zlib is not usually available
     // so we link it statically and set functions pointers directly
@@ -69,41 +170,103 @@ static void init() {
     zlib_flags = zlibCompileFlags;
     inflateInit_f = inflateInit_;
     inflateInit2_f = inflateInit2_;
+    inflateReset2_f = inflateReset2;
     inflateEnd_f = inflateEnd;
     inflate_f = inflate;
     zError_f = zError;
+    deflateInit2_f = deflateInit2_;
+    deflate_f = deflate;
+    deflateEnd_f = deflateEnd;
+    deflateReset_f = deflateReset;
 #else
-#define CHECK_DL(op) do{ \
-if ((op) != 0)           \
-goto on_error;           \
-} while(0)
-
     CHECK_DL(uv_dlopen(SO_lib(libz), &zlib));
     CHECK_DL(uv_dlsym(&zlib, "zlibVersion", (void **) &zlib_ver));
     CHECK_DL(uv_dlsym(&zlib, "zlibCompileFlags", (void **) &zlib_flags));
     CHECK_DL(uv_dlsym(&zlib, "inflateEnd", (void **) &inflateEnd_f));
     CHECK_DL(uv_dlsym(&zlib, "inflateInit_", (void **) &inflateInit_f));
     CHECK_DL(uv_dlsym(&zlib, "inflateInit2_", (void **) &inflateInit2_f));
+    CHECK_DL(uv_dlsym(&zlib, "inflateReset2", (void **) &inflateReset2_f));
     CHECK_DL(uv_dlsym(&zlib, "inflate", (void **) &inflate_f));
     CHECK_DL(uv_dlsym(&zlib, "zError", (void **) &zError_f));
 #endif
 
     ZLibVersion = zlib_ver();
-    if (ZLibVersion[0] != ZLIB_VERSION[0]) {
-        return;
-    }
-    if (zlib_flags() & NO_GZIP) {
-        encodings = "deflate";
-    } else {
-        encodings = "gzip, deflate";
-    }
-    goto done;
+    zlib_ok = ZLibVersion[0] == ZLIB_VERSION[0];
+#if _WIN32
+    zlib_deflate_ok = zlib_ok;
+#else
+    zlib_deflate_ok = zlib_ok &&
+                      uv_dlsym(&zlib, "deflateInit2_", (void **) &deflateInit2_f) == 0 &&
+                      uv_dlsym(&zlib, "deflate", (void **) &deflate_f) == 0 &&
+                      uv_dlsym(&zlib, "deflateEnd", (void **) &deflateEnd_f) == 0 &&
+                      uv_dlsym(&zlib, "deflateReset", (void **) &deflateReset_f) == 0;
+#endif
+    return;
 
+#if !_WIN32
     on_error:
     UM_LOG(ERR, "failed to initialize HTTP decompression: %s", uv_dlerror(&zlib));
+#endif
+}
 
-    done:
+static void init_brotli() {
+    CHECK_DL(load_lib(&brotli, BROTLI_LIBS));
+    CHECK_DL(uv_dlsym(&brotli, "BrotliDecoderCreateInstance", (void **) &BrotliDecoderCreateInstance_f));
+    CHECK_DL(uv_dlsym(&brotli, "BrotliDecoderDestroyInstance", (void **) &BrotliDecoderDestroyInstance_f));
+    CHECK_DL(uv_dlsym(&brotli, "BrotliDecoderDecompressStream", (void **) &BrotliDecoderDecompressStream_f));
+    brotli_ok = true;
     return;
+
+    on_error:
+    UM_LOG(VERB, "brotli decoding is not available");
+}
+
+static void init_zstd() {
+    CHECK_DL(load_lib(&zstd, ZSTD_LIBS));
+    CHECK_DL(uv_dlsym(&zstd, "ZSTD_createDStream", (void **) &ZSTD_createDStream_f));
+    CHECK_DL(uv_dlsym(&zstd, "ZSTD_freeDStream", (void **) &ZSTD_freeDStream_f));
+    CHECK_DL(uv_dlsym(&zstd, "ZSTD_decompressStream", (void **) &ZSTD_decompressStream_f));
+    CHECK_DL(uv_dlsym(&zstd, "ZSTD_initDStream", (void **) &ZSTD_initDStream_f));
+    CHECK_DL(uv_dlsym(&zstd, "ZSTD_isError", (void **) &ZSTD_isError_f));
+    CHECK_DL(uv_dlsym(&zstd, "ZSTD_getErrorName", (void **) &ZSTD_getErrorName_f));
+    zstd_ok = true;
+
+    zstd_deflate_ok = uv_dlsym(&zstd, "ZSTD_createCStream", (void **) &ZSTD_createCStream_f) == 0 &&
+                      uv_dlsym(&zstd, "ZSTD_freeCStream", (void **) &ZSTD_freeCStream_f) == 0 &&
+                      uv_dlsym(&zstd, "ZSTD_compressStream2", (void **) &ZSTD_compressStream2_f) == 0;
+    return;
+
+    on_error:
+    UM_LOG(VERB, "zstd decoding is not available");
+}
+
+static void add_encoding(const char *enc) {
+    if (encodings_buf[0] != 0) {
+        strcat(encodings_buf, ", ");
+    }
+    strcat(encodings_buf, enc);
+}
+
+static void init() {
+    init_zlib();
+    init_brotli();
+    init_zstd();
+
+    if (zlib_ok) {
+        if ((zlib_flags() & NO_GZIP) == 0) {
+            add_encoding("gzip");
+        }
+        add_encoding("deflate");
+    }
+    if (brotli_ok) {
+        add_encoding("br");
+    }
+    if (zstd_ok) {
+        add_encoding("zstd");
+    }
+    if (encodings_buf[0] != 0) {
+        encodings = encodings_buf;
+    }
 }
 
 const char *um_available_encoding() {
@@ -117,15 +280,26 @@ const char *um_available_encoding() {
 http_inflater_t *um_get_inflater(const char *encoding, data_cb cb, void *ctx) {
     um_available_encoding();
 
-    http_inflater_t *inf = calloc(1, sizeof(http_inflater_t));
-    inf->s.zalloc = comp_alloc;
-    inf->s.zfree = comp_free;
-    if (strcmp(encoding, "gzip") == 0)
-        inflateInit2(&inf->s, 16 + MAX_WBITS);
-    else if (strcmp(encoding, "deflate") == 0)
-        inflateInit(&inf->s);
+    http_inflater_t *inf = tlsuv__calloc(1, sizeof(http_inflater_t));
+    if (zlib_ok && (strcmp(encoding, "gzip") == 0 || strcmp(encoding, "deflate") == 0)) {
+        inf->codec = CODEC_ZLIB;
+        inf->s.z.zalloc = comp_alloc;
+        inf->s.z.zfree = comp_free;
+        if (strcmp(encoding, "gzip") == 0)
+            inflateInit2(&inf->s.z, 16 + MAX_WBITS);
+        else
+            inflateInit(&inf->s.z);
+    }
+    else if (brotli_ok && strcmp(encoding, "br") == 0) {
+        inf->codec = CODEC_BROTLI;
+        inf->s.brotli = BrotliDecoderCreateInstance_f(NULL, NULL, NULL);
+    }
+    else if (zstd_ok && strcmp(encoding, "zstd") == 0) {
+        inf->codec = CODEC_ZSTD;
+        inf->s.zstd = ZSTD_createDStream_f();
+    }
     else {
-        free(inf);
+        tlsuv__free(inf);
         return NULL;
     }
 
@@ -136,23 +310,62 @@ http_inflater_t *um_get_inflater(const char *encoding, data_cb cb, void *ctx) {
 
 void um_free_inflater(http_inflater_t *inflater) {
     if (inflater) {
-        inflateEnd_f(&inflater->s);
-        free(inflater);
+        switch (inflater->codec) {
+            case CODEC_ZLIB:
+                inflateEnd_f(&inflater->s.z);
+                break;
+            case CODEC_BROTLI:
+                BrotliDecoderDestroyInstance_f(inflater->s.brotli);
+                break;
+            case CODEC_ZSTD:
+                ZSTD_freeDStream_f(inflater->s.zstd);
+                break;
+        }
+        tlsuv__free(inflater);
     }
 }
 
-int um_inflate(http_inflater_t *inflater, const char *compressed, size_t len) {
-    inflater->s.next_in = (uint8_t *)compressed;
-    inflater->s.avail_in = len;
-    uint8_t decompressed[32 * 1024];
-    while(inflater->s.avail_in > 0) {
-        inflater->s.next_out = decompressed;
-        inflater->s.avail_out = sizeof(decompressed);
-        int rc = inflate_f(&inflater->s, Z_FULL_FLUSH);
+int um_reset_inflater(http_inflater_t *inflater, const char *encoding, data_cb cb, void *ctx) {
+    switch (inflater->codec) {
+        case CODEC_ZLIB:
+            if (strcmp(encoding, "gzip") == 0) {
+                if (inflateReset2_f(&inflater->s.z, 16 + MAX_WBITS) != Z_OK) return -1;
+            } else if (strcmp(encoding, "deflate") == 0) {
+                if (inflateReset2_f(&inflater->s.z, MAX_WBITS) != Z_OK) return -1;
+            } else {
+                return -1;
+            }
+            break;
+        case CODEC_ZSTD:
+            if (strcmp(encoding, "zstd") != 0 || ZSTD_isError_f(ZSTD_initDStream_f(inflater->s.zstd))) return -1;
+            break;
+        default: // brotli decoder has no reset
+            return -1;
+    }
+
+    inflater->complete = 0;
+    inflater->error = 0;
+    inflater->cb = cb;
+    inflater->cb_ctx = ctx;
+    return 0;
+}
+
+static int zlib_inflate(http_inflater_t *inflater, const char *compressed, size_t len) {
+    inflater->s.z.next_in = (uint8_t *)compressed;
+    inflater->s.z.avail_in = len;
+    uint8_t *decompressed = inflater->out;
+    // keep going while output buffer gets filled, inflater may hold more
+    do {
+        inflater->s.z.next_out = decompressed;
+        inflater->s.z.avail_out = sizeof(inflater->out);
+        int rc = inflate_f(&inflater->s.z, Z_NO_FLUSH);
         if (rc == Z_DATA_ERROR) {
             return -1;
         }
-        size_t decomp_count = sizeof(decompressed) - inflater->s.avail_out;
+        if (rc == Z_BUF_ERROR) { // no progress possible
+            break;
+        }
+        size_t decomp_count = sizeof(inflater->out) - inflater->s.z.avail_out;
         if (decomp_count > 0) {
             inflater->cb(inflater->cb_ctx, (const char*)decompressed, (ssize_t)decomp_count);
         }
@@ -160,12 +373,217 @@ int um_inflate(http_inflater_t *inflater, const char *compressed, size_t len) {
             inflater->complete = 1;
             return 1;
         }
+    } while (inflater->s.z.avail_in > 0 || inflater->s.z.avail_out == 0);
+    return 0;
+}
+
+static int brotli_inflate(http_inflater_t *inflater, const char *compressed, size_t len) {
+    const uint8_t *next_in = (const uint8_t *) compressed;
+    size_t avail_in = len;
+    uint8_t *decompressed = inflater->out;
+    BrotliDecoderResult rc;
+    do {
+        uint8_t *next_out = decompressed;
+        size_t avail_out = sizeof(inflater->out);
+        rc = BrotliDecoderDecompressStream_f(inflater->s.brotli, &avail_in, &next_in, &avail_out, &next_out, NULL);
+        if (rc == BROTLI_DECODER_RESULT_ERROR) {
+            inflater->error = 1;
+            return -1;
+        }
+        size_t decomp_count = sizeof(inflater->out) - avail_out;
+        if (decomp_count > 0) {
+            inflater->cb(inflater->cb_ctx, (const char*)decompressed, (ssize_t)decomp_count);
+        }
+        if (rc == BROTLI_DECODER_RESULT_SUCCESS) {
+            inflater->complete = 1;
+            return 1;
+        }
+    } while (rc == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT || avail_in > 0);
+    return 0;
+}
+
+static int zstd_inflate(http_inflater_t *inflater, const char *compressed, size_t len) {
+    zstd_in_buf in = { compressed, len, 0 };
+    uint8_t *decompressed = inflater->out;
+    bool flush = false;
+    while (in.pos < in.size || flush) {
+        zstd_out_buf out = { decompressed, sizeof(inflater->out), 0 };
+        size_t rc = ZSTD_decompressStream_f(inflater->s.zstd, &out, &in);
+        if (ZSTD_isError_f(rc)) {
+            UM_LOG(WARN, "zstd decoding failed: %s", ZSTD_getErrorName_f(rc));
+            inflater->error = 1;
+            return -1;
+        }
+        if (out.pos > 0) {
+            inflater->cb(inflater->cb_ctx, (const char*)decompressed, (ssize_t)out.pos);
+        }
+        if (rc == 0) { // frame is decoded and flushed
+            inflater->complete = 1;
+            return 1;
+        }
+        // decoder may hold more output than fit the buffer
+        flush = out.pos == out.size;
+    }
+    return 0;
+}
+
+int um_inflate(http_inflater_t *inflater, const char *compressed, size_t len) {
+    switch (inflater->codec) {
+        case CODEC_BROTLI:
+            return brotli_inflate(inflater, compressed, len);
+        case CODEC_ZSTD:
+            return zstd_inflate(inflater, compressed, len);
+        case CODEC_ZLIB:
+        default:
+            return zlib_inflate(inflater, compressed, len);
     }
+}
+
+http_inflater_t *um_get_raw_inflater(int window_bits, data_cb cb, void *ctx) {
+    um_available_encoding();
+    if (!zlib_ok) {
+        return NULL;
+    }
+
+    http_inflater_t *inf = tlsuv__calloc(1, sizeof(http_inflater_t));
+    inf->codec = CODEC_ZLIB;
+    inf->raw_bits = window_bits;
+    inf->s.z.zalloc = comp_alloc;
+    inf->s.z.zfree = comp_free;
+    if (inflateInit2(&inf->s.z, -window_bits) != Z_OK) {
+        tlsuv__free(inf);
+        return NULL;
+    }
+    inf->cb = cb;
+    inf->cb_ctx = ctx;
+    return inf;
+}
+
+int um_reset_raw_inflater(http_inflater_t *inflater) {
+    if (inflater->raw_bits == 0 || inflateReset2_f(&inflater->s.z, -inflater->raw_bits) != Z_OK) {
+        return -1;
+    }
+    inflater->complete = 0;
+    inflater->error = 0;
     return 0;
 }
 
 int um_inflate_state(http_inflater_t *inflater) {
-    if (inflater->s.msg) return -1;
+    if (inflater->error) return -1;
+    if (inflater->codec == CODEC_ZLIB && inflater->s.z.msg) return -1;
 
     return inflater->complete;
 }
+
+http_deflater_t *um_get_deflater(const char *encoding) {
+    um_available_encoding();
+
+    http_deflater_t *def = tlsuv__calloc(1, sizeof(http_deflater_t));
+    if (zlib_deflate_ok && strcmp(encoding, "gzip") == 0) {
+        def->codec = CODEC_ZLIB;
+        def->s.z.zalloc = comp_alloc;
+        def->s.z.zfree = comp_free;
+        if (deflateInit2_f(&def->s.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY,
+                           ZLIB_VERSION, (int) sizeof(z_stream)) == Z_OK) {
+            return def;
+        }
+    }
+    else if (zstd_deflate_ok && strcmp(encoding, "zstd") == 0) {
+        def->codec = CODEC_ZSTD;
+        def->s.zstd = ZSTD_createCStream_f();
+        if (def->s.zstd) {
+            return def;
+        }
+    }
+
+    tlsuv__free(def);
+    return NULL;
+}
+
+http_deflater_t *um_get_raw_deflater(int window_bits) {
+    um_available_encoding();
+    if (!zlib_deflate_ok) {
+        return NULL;
+    }
+
+    http_deflater_t *def = tlsuv__calloc(1, sizeof(http_deflater_t));
+    def->codec = CODEC_ZLIB;
+    def->s.z.zalloc = comp_alloc;
+    def->s.z.zfree = comp_free;
+    if (deflateInit2_f(&def->s.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY,
+                       ZLIB_VERSION, (int) sizeof(z_stream)) != Z_OK) {
+        tlsuv__free(def);
+        return NULL;
+    }
+    return def;
+}
+
+int um_reset_raw_deflater(http_deflater_t *deflater) {
+    if (deflater->codec != CODEC_ZLIB) {
+        return -1;
+    }
+    return deflateReset_f(&deflater->s.z) == Z_OK ? 0 : -1;
+}
+
+void um_free_deflater(http_deflater_t *deflater) {
+    if (deflater) {
+        if (deflater->codec == CODEC_ZLIB) {
+            deflateEnd_f(&deflater->s.z);
+        } else {
+            ZSTD_freeCStream_f(deflater->s.zstd);
+        }
+        tlsuv__free(deflater);
+    }
+}
+
+static int zlib_deflate(http_deflater_t *deflater, const char *input, size_t len, int flush, data_cb cb, void *ctx) {
+    z_stream *z = &deflater->s.z;
+    z->next_in = (uint8_t *) input;
+    z->avail_in = len;
+    int finish = flush == Z_FINISH;
+    int rc;
+    do {
+        z->next_out = deflater->out;
+        z->avail_out = sizeof(deflater->out);
+        rc = deflate_f(z, flush);
+        if (rc == Z_STREAM_ERROR) {
+            return -1;
+        }
+        size_t count = sizeof(deflater->out) - z->avail_out;
+        if (count > 0) {
+            cb(ctx, (const char *) deflater->out, (ssize_t) count);
+        }
+    } while (z->avail_out == 0 || (finish && rc != Z_STREAM_END));
+    return 0;
+}
+
+static int zstd_deflate(http_deflater_t *deflater, const char *input, size_t len, int finish, data_cb cb, void *ctx) {
+    zstd_in_buf in = { input, len, 0 };
+    size_t rc;
+    do {
+        zstd_out_buf out = { deflater->out, sizeof(deflater->out), 0 };
+        rc = ZSTD_compressStream2_f(deflater->s.zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError_f(rc)) {
+            UM_LOG(WARN, "zstd encoding failed: %s", ZSTD_getErrorName_f(rc));
+            return -1;
+        }
+        if (out.pos > 0) {
+            cb(ctx, (const char *) deflater->out, (ssize_t) out.pos);
+        }
+    } while (finish ? rc != 0 : in.pos < in.size);
+    return 0;
+}
+
+int um_deflate(http_deflater_t *deflater, const char *input, size_t len, int finish, data_cb cb, void *ctx) {
+    if (deflater->codec == CODEC_ZSTD) {
+        return zstd_deflate(deflater, input, len, finish, cb, ctx);
+    }
+    return zlib_deflate(deflater, input, len, finish ? Z_FINISH : Z_NO_FLUSH, cb, ctx);
+}
+
+int um_deflate_flush(http_deflater_t *deflater, const char *input, size_t len, data_cb cb, void *ctx) {
+    if (deflater->codec != CODEC_ZLIB) {
+        return -1;
+    }
+    return zlib_deflate(deflater, input, len, Z_SYNC_FLUSH, cb, ctx);
+}
@@ -30,6 +30,7 @@ typedef intptr_t ssize_t;
 #endif
 
 typedef struct tlsuv_http_inflater_s http_inflater_t;
+typedef struct tlsuv_http_deflater_s http_deflater_t;
 
 #if __cplusplus
 extern "C" {
@@ -40,9 +41,26 @@ extern const char *um_available_encoding();
 extern http_inflater_t* um_get_inflater(const char *encoding, data_cb cb, void *ctx);
 extern int um_inflate_state(http_inflater_t *inflater);
 extern void um_free_inflater(http_inflater_t *inflater);
+// prepares used inflater for another stream, keeping its allocations. returns -1 if encoding needs a new inflater
+extern int um_reset_inflater(http_inflater_t *inflater, const char *encoding, data_cb cb, void *ctx);
 
 extern int um_inflate(http_inflater_t *inflater, const char* input, size_t input_len);
 
+// request body encoder, only "gzip" and "zstd" are supported. returns NULL if encoding is not available
+extern http_deflater_t *um_get_deflater(const char *encoding);
+extern void um_free_deflater(http_deflater_t *deflater);
+// compresses input and passes output to `cb`, `finish` flushes and terminates the stream. returns 0 or -1 on error
+extern int um_deflate(http_deflater_t *deflater, const char *input, size_t input_len, int finish, data_cb cb, void *ctx);
+
+// raw deflate streams (no zlib/gzip wrapper) for websocket permessage-deflate. return NULL if zlib is not available
+extern http_inflater_t *um_get_raw_inflater(int window_bits, data_cb cb, void *ctx);
+extern http_deflater_t *um_get_raw_deflater(int window_bits);
+// compresses input and flushes output to byte boundary (Z_SYNC_FLUSH), stream stays open. returns 0 or -1 on error
+extern int um_deflate_flush(http_deflater_t *deflater, const char *input, size_t input_len, data_cb cb, void *ctx);
+// drop LZ77 history, next message is compressed/decompressed independently. return 0 or -1
+extern int um_reset_raw_deflater(http_deflater_t *deflater);
+extern int um_reset_raw_inflater(http_inflater_t *inflater);
+
 
 #if __cplusplus
 }
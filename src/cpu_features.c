@@ -0,0 +1,79 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "cpu_features.h"
+#include "um_debug.h"
+
+#include <uv.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__) && (defined(__aarch64__) || defined(__arm__))
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+static int has_aes;
+static int has_avx2;
+static int has_ssse3;
+static uv_once_t detect_once = UV_ONCE_INIT;
+
+static void detect(void) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 1);
+    has_aes = (info[2] & (1 << 25)) != 0;
+    has_ssse3 = (info[2] & (1 << 9)) != 0;
+    // AVX2 needs OS support for saving YMM state (OSXSAVE + XCR0 bits 1,2)
+    if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    has_aes = __builtin_cpu_supports("aes");
+    has_avx2 = __builtin_cpu_supports("avx2");
+    has_ssse3 = __builtin_cpu_supports("ssse3");
+#elif defined(_WIN32) && defined(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE)
+    has_aes = IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE);
+#elif defined(__APPLE__) && defined(__aarch64__)
+    has_aes = 1;
+#elif defined(__linux__) && defined(__aarch64__)
+    has_aes = (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#elif defined(__linux__) && defined(__arm__) && defined(HWCAP2_AES)
+    has_aes = (getauxval(AT_HWCAP2) & HWCAP2_AES) != 0;
+#else
+    has_aes = 0;
+#endif
+    UM_LOG(VERB, "hardware AES support: %s", has_aes ? "yes" : "no");
+    UM_LOG(VERB, "AVX2 support: %s", has_avx2 ? "yes" : "no");
+}
+
+int tlsuv_cpu_has_aes(void) {
+    uv_once(&detect_once, detect);
+    return has_aes;
+}
+
+int tlsuv_cpu_has_avx2(void) {
+    uv_once(&detect_once, detect);
+    return has_avx2;
+}
+
+int tlsuv_cpu_has_ssse3(void) {
+    uv_once(&detect_once, detect);
+    return has_ssse3;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_CPU_FEATURES_H
+#define TLSUV_CPU_FEATURES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Detects AES instructions (AES-NI on x86, ARMv8 crypto extension on ARM).
+ * Result is computed once and cached.
+ * @return non-zero if AES is hardware accelerated
+ */
+int tlsuv_cpu_has_aes(void);
+
+/**
+ * Detects AVX2 instructions usable by the current OS (x86 only).
+ * Result is computed once and cached.
+ * @return non-zero if AVX2 code paths can be used
+ */
+int tlsuv_cpu_has_avx2(void);
+
+/**
+ * Detects SSSE3 instructions (x86 only).
+ * Result is computed once and cached.
+ * @return non-zero if SSSE3 code paths can be used
+ */
+int tlsuv_cpu_has_ssse3(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_CPU_FEATURES_H
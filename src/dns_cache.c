@@ -0,0 +1,312 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_cache.h"
+#include "tlsuv/queue.h"
+#include "tlsuv/tcp_src.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
+struct dns_refresh_s;
+
+struct dns_entry {
+    char *host;
+    char *service;
+
+    // 0 or resolver error
+    int status;
+    // loop time (ms)
+    uint64_t expires;
+    uint64_t stale_until;
+
+    size_t count;
+    struct sockaddr_storage *addrs;
+
+    // background refresh in flight
+    struct dns_refresh_s *refresh;
+
+    TAILQ_ENTRY(dns_entry) _next;
+};
+
+struct dns_refresh_s {
+    uv_getaddrinfo_t req;
+    // NULL if entry was dropped while refresh was in flight
+    struct dns_entry *entry;
+    tlsuv_dns_cache *cache;
+};
+
+struct tlsuv_dns_cache_s {
+    uv_loop_t *loop;
+    // milliseconds
+    uint64_t ttl;
+    uint64_t negative_ttl;
+    uint64_t stale_ttl;
+
+    size_t count;
+    // most recently used first
+    TAILQ_HEAD(dns_list, dns_entry) entries;
+
+    LIST_ENTRY(tlsuv_dns_cache_s) _next;
+};
+
+static LIST_HEAD(dns_caches, tlsuv_dns_cache_s) caches = LIST_HEAD_INITIALIZER(caches);
+static uv_mutex_t caches_lock;
+static uv_once_t caches_once = UV_ONCE_INIT;
+
+static void init_caches_lock(void) {
+    uv_mutex_init(&caches_lock);
+}
+
+static const struct addrinfo stream_hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+};
+
+static void free_entry(tlsuv_dns_cache *cache, struct dns_entry *e) {
+    TAILQ_REMOVE(&cache->entries, e, _next);
+    cache->count--;
+    if (e->refresh) {
+        e->refresh->entry = NULL;
+    }
+    tlsuv__free(e->host);
+    tlsuv__free(e->service);
+    tlsuv__free(e->addrs);
+    tlsuv__free(e);
+}
+
+static struct dns_entry *find_entry(tlsuv_dns_cache *cache, const char *host, const char *service) {
+    struct dns_entry *e;
+    TAILQ_FOREACH(e, &cache->entries, _next) {
+        if (strcmp(e->host, host) == 0 && strcmp(e->service, service) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void set_result(tlsuv_dns_cache *cache, struct dns_entry *e, int status,
+                       struct sockaddr_storage *addrs, size_t count) {
+    uint64_t now = uv_now(cache->loop);
+    tlsuv__free(e->addrs);
+    e->status = status;
+    e->addrs = addrs;
+    e->count = count;
+    if (status == 0) {
+        e->expires = now + cache->ttl;
+        e->stale_until = e->expires + cache->stale_ttl;
+    } else {
+        e->expires = e->stale_until = now + cache->negative_ttl;
+    }
+}
+
+static void refresh_cb(uv_getaddrinfo_t *req, int status, struct addrinfo *ai) {
+    struct dns_refresh_s *r = (struct dns_refresh_s *) req;
+    struct dns_entry *e = r->entry;
+
+    if (e != NULL) {
+        e->refresh = NULL;
+        struct sockaddr_storage *addrs = NULL;
+        size_t count = status == 0 ? tlsuv_dns_addrs(ai, &addrs) : 0;
+        if (count > 0) {
+            UM_LOG(VERB, "refreshed '%s:%s': %zd address(es)", e->host, e->service, count);
+            set_result(r->cache, e, 0, addrs, count);
+        } else {
+            // keep serving stale result until it runs out
+            UM_LOG(VERB, "failed to refresh '%s:%s': %d(%s)", e->host, e->service, status, uv_strerror(status));
+        }
+    }
+
+    uv_freeaddrinfo(ai);
+    tlsuv__free(r);
+}
+
+static void start_refresh(tlsuv_dns_cache *cache, struct dns_entry *e) {
+    if (e->refresh) return;
+
+    struct dns_refresh_s *r = tlsuv__calloc(1, sizeof(*r));
+    r->entry = e;
+    r->cache = cache;
+    int rc = uv_getaddrinfo(cache->loop, &r->req, refresh_cb, e->host, e->service, &stream_hints);
+    if (rc != 0) {
+        UM_LOG(WARN, "failed to start refresh of '%s:%s': %d(%s)", e->host, e->service, rc, uv_strerror(rc));
+        tlsuv__free(r);
+        return;
+    }
+    e->refresh = r;
+}
+
+tlsuv_dns_cache *tlsuv_dns_cache_get(uv_loop_t *loop) {
+    uv_once(&caches_once, init_caches_lock);
+
+    tlsuv_dns_cache *cache;
+    uv_mutex_lock(&caches_lock);
+    LIST_FOREACH(cache, &caches, _next) {
+        if (cache->loop == loop) break;
+    }
+    uv_mutex_unlock(&caches_lock);
+    return cache;
+}
+
+int tlsuv_dns_cache_lookup(tlsuv_dns_cache *cache, const char *host, const char *service,
+                           struct sockaddr_storage **addrs, size_t *count) {
+    struct dns_entry *e = find_entry(cache, host, service);
+    if (e == NULL) {
+        return UV_EAGAIN;
+    }
+
+    uint64_t now = uv_now(cache->loop);
+    if (now >= e->stale_until) {
+        free_entry(cache, e);
+        return UV_EAGAIN;
+    }
+
+    TAILQ_REMOVE(&cache->entries, e, _next);
+    TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+
+    if (e->status != 0) {
+        return e->status;
+    }
+
+    if (now >= e->expires) {
+        UM_LOG(VERB, "serving stale result for '%s:%s'", host, service);
+        start_refresh(cache, e);
+    }
+
+    *addrs = tlsuv__calloc(e->count, sizeof(**addrs));
+    memcpy(*addrs, e->addrs, e->count * sizeof(**addrs));
+    *count = e->count;
+    return 0;
+}
+
+void tlsuv_dns_cache_put(tlsuv_dns_cache *cache, const char *host, const char *service,
+                         int status, const struct addrinfo *ai) {
+    // transient failures
+    if (status == UV_EAI_AGAIN || status == UV_EAI_MEMORY || status == UV_ECANCELED || status == UV_EAI_CANCELED) {
+        return;
+    }
+
+    struct sockaddr_storage *addrs = NULL;
+    size_t count = 0;
+    if (status == 0) {
+        count = tlsuv_dns_addrs(ai, &addrs);
+        if (count == 0) status = UV_EAI_NODATA;
+    }
+
+    if (status != 0 && cache->negative_ttl == 0) {
+        return;
+    }
+
+    struct dns_entry *e = find_entry(cache, host, service);
+    if (e == NULL) {
+        if (cache->count >= TLSUV_DNS_CACHE_SIZE) {
+            free_entry(cache, TAILQ_LAST(&cache->entries, dns_list));
+        }
+        e = tlsuv__calloc(1, sizeof(*e));
+        e->host = tlsuv__strdup(host);
+        e->service = tlsuv__strdup(service);
+        TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+        cache->count++;
+    }
+    set_result(cache, e, status, addrs, count);
+}
+
+size_t tlsuv_dns_addrs(const struct addrinfo *ai, struct sockaddr_storage **out) {
+    size_t count = 0;
+    for (const struct addrinfo *a = ai; a; a = a->ai_next) {
+        if (a->ai_family == AF_INET || a->ai_family == AF_INET6) count++;
+    }
+
+    *out = NULL;
+    if (count == 0) {
+        return 0;
+    }
+
+    struct sockaddr_storage *addrs = tlsuv__calloc(count, sizeof(*addrs));
+    size_t n = 0;
+    for (const struct addrinfo *a = ai; a; a = a->ai_next) {
+        if (a->ai_family == AF_INET || a->ai_family == AF_INET6) {
+            memcpy(&addrs[n++], a->ai_addr, a->ai_addrlen);
+        }
+    }
+    *out = addrs;
+    return count;
+}
+
+int tcp_src_dns_cache(uv_loop_t *loop, unsigned int ttl, unsigned int negative_ttl, unsigned int stale_ttl) {
+    tlsuv_dns_cache *cache = tlsuv_dns_cache_get(loop);
+
+    if (ttl == 0) {
+        if (cache) {
+            uv_mutex_lock(&caches_lock);
+            LIST_REMOVE(cache, _next);
+            uv_mutex_unlock(&caches_lock);
+
+            while (!TAILQ_EMPTY(&cache->entries)) {
+                free_entry(cache, TAILQ_FIRST(&cache->entries));
+            }
+            tlsuv__free(cache);
+        }
+        return 0;
+    }
+
+    if (cache == NULL) {
+        cache = tlsuv__calloc(1, sizeof(*cache));
+        cache->loop = loop;
+        TAILQ_INIT(&cache->entries);
+
+        uv_mutex_lock(&caches_lock);
+        LIST_INSERT_HEAD(&caches, cache, _next);
+        uv_mutex_unlock(&caches_lock);
+    }
+
+    cache->ttl = (uint64_t) ttl * 1000;
+    cache->negative_ttl = (uint64_t) negative_ttl * 1000;
+    cache->stale_ttl = (uint64_t) stale_ttl * 1000;
+    return 0;
+}
+
+int tcp_src_dns_refresh(uv_loop_t *loop, const char *host) {
+    tlsuv_dns_cache *cache = tlsuv_dns_cache_get(loop);
+    if (cache == NULL) {
+        return UV_EINVAL;
+    }
+
+    uint64_t now = uv_now(loop);
+    struct dns_entry *e = TAILQ_FIRST(&cache->entries);
+    while (e != NULL) {
+        struct dns_entry *next = TAILQ_NEXT(e, _next);
+        if (host != NULL && strcmp(e->host, host) != 0) {
+            e = next;
+            continue;
+        }
+
+        if (e->status != 0) {
+            free_entry(cache, e);
+        } else {
+            if (e->expires > now) {
+                e->stale_until -= e->expires - now;
+                e->expires = now;
+            }
+            start_refresh(cache, e);
+        }
+        e = next;
+    }
+    return 0;
+}
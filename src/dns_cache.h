@@ -0,0 +1,67 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_DNS_CACHE_H
+#define TLSUV_DNS_CACHE_H
+
+#include <stddef.h>
+
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TLSUV_DNS_CACHE_SIZE 256
+
+/**
+ * Loop-local cache of resolver results keyed by (host, service), shared by all tcp_src handles on the loop.
+ * Successful results are served for `ttl` seconds, failures for `negative_ttl` seconds.
+ * Expired successful results are served for another `stale_ttl` seconds while being refreshed in background.
+ */
+typedef struct tlsuv_dns_cache_s tlsuv_dns_cache;
+
+/**
+ * @returns cache enabled for the loop or NULL
+ */
+tlsuv_dns_cache *tlsuv_dns_cache_get(uv_loop_t *loop);
+
+/**
+ * Finds cached result for host/service.
+ *
+ * @param addrs on hit receives copy of cached addresses in resolver order, caller must release it with tlsuv__free()
+ * @returns 0 on hit, cached resolver error on negative hit, UV_EAGAIN if there is no usable entry
+ */
+int tlsuv_dns_cache_lookup(tlsuv_dns_cache *cache, const char *host, const char *service,
+                           struct sockaddr_storage **addrs, size_t *count);
+
+/**
+ * Stores resolver result for host/service, replacing existing entry.
+ * Transient failures are not cached.
+ */
+void tlsuv_dns_cache_put(tlsuv_dns_cache *cache, const char *host, const char *service,
+                         int status, const struct addrinfo *ai);
+
+/**
+ * Flattens resolver result into array of stream socket addresses.
+ * @returns number of addresses, *out must be released with tlsuv__free() if it is not zero
+ */
+size_t tlsuv_dns_addrs(const struct addrinfo *ai, struct sockaddr_storage **out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_DNS_CACHE_H
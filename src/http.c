@@ -15,18 +15,29 @@
 #include "tlsuv/http.h"
 #include "tlsuv/tcp_src.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "um_debug.h"
 #include "win32_compat.h"
 #include "http_req.h"
+#include "http2.h"
+#include "http_cache.h"
+#include "http_sched.h"
+#include "http_submit.h"
 #include "compression.h"
+#include "pool.h"
+#include "read_sizing.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
 
 #define DEFAULT_IDLE_TIMEOUT 0
 
 extern tls_context *get_default_tls();
 
+static void http_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf);
 static void http_read_cb(uv_link_t *link, ssize_t nread, const uv_buf_t *buf);
 
 static int http_status_cb(llhttp_t *parser, const char *status, size_t len);
@@ -41,9 +52,13 @@ static int http_header_value_cb(llhttp_t *parser, const char *v, size_t len);
 
 static int http_headers_complete_cb(llhttp_t *p);
 
-static void fail_active_request(tlsuv_http_t *c, int code, const char *msg);
+static void fail_active_request(tlsuv_http_conn_t *conn, int code, const char *msg);
+
+static void report_timing(tlsuv_http_req_t *req);
+
+static void close_connection(tlsuv_http_conn_t *conn);
 
-static void close_connection(tlsuv_http_t *c);
+static void handshake_timeout(tlsuv_timeout_t *t);
 
 static void free_http(tlsuv_http_t *clt);
 
@@ -57,143 +72,396 @@ enum status {
 static const uv_link_methods_t http_methods = {
         .close = uv_link_default_close,
         .read_start = uv_link_default_read_start,
+        .read_stop = uv_link_default_read_stop,
         .write = uv_link_default_write,
-        .alloc_cb_override = uv_link_default_alloc_cb_override,
+        .alloc_cb_override = http_alloc,
         .read_cb_override = http_read_cb
 };
 
+// read buffers are sized by recent reads and released to the pool by http_read_cb
+static void http_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf) {
+    tlsuv_http_conn_t *conn = l->data;
+    size_t len;
+    buf->base = tlsuv_pool_read_alloc(read_sizer_size(&conn->read_size), &len);
+    buf->len = len;
+}
+
 static void http_read_cb(uv_link_t *link, ssize_t nread, const uv_buf_t *buf) {
-    tlsuv_http_t *c = link->data;
+    tlsuv_http_conn_t *conn = link->data;
+    tlsuv_http_t *c = conn->client;
 
     if (nread < 0) {
-        if (c->active) {
+        if (conn->active || conn->h2) {
             const char *err = uv_strerror((int)nread);
             UM_LOG(ERR, "connection error before active request could complete %zd (%s)", nread, err);
-            fail_active_request(c, (int)nread, err);
+            fail_active_request(conn, (int)nread, err);
         }
 
-        close_connection(c);
-        uv_async_send(&c->proc);
+        close_connection(conn);
+        http_sched_mark(c);
         if (buf && buf->base) {
-            free(buf->base);
+            tlsuv_pool_free(buf->base);
+        }
+        return;
+    }
+    read_sizer_update(&conn->read_size, nread, buf->len);
+
+    if (conn->h2) {
+        int rc = nread > 0 ? h2_session_read(conn, buf->base, nread) : 0;
+        if (rc != 0) {
+            h2_session_close(conn, rc, uv_strerror(rc));
+            close_connection(conn);
         }
+        http_sched_mark(c);
+        tlsuv_pool_free(buf->base);
         return;
     }
 
-    if (c->active != NULL) {
+    const char *data = buf->base;
+    ssize_t left = nread;
+    while (conn->active != NULL) {
 
-        if (nread > 0) {
-            if (http_req_process(c->active, buf->base, nread) < 0) {
+        if (left > 0) {
+            if (conn->active->timing_cb && conn->active->timing.first_byte == 0) {
+                conn->active->timing.first_byte = uv_hrtime();
+            }
+            ssize_t processed = http_req_process(conn->active, data, left);
+            if (processed < 0) {
                 UM_LOG(WARN, "failed to parse HTTP response");
-                fail_active_request(c, UV_EINVAL, "failed to parse HTTP response");
-                close_connection(c);
-                free(buf->base);
-
+                fail_active_request(conn, UV_EINVAL, "failed to parse HTTP response");
+                close_connection(conn);
+                tlsuv_pool_free(buf->base);
+                return;
             }
+            data += processed;
+            left -= processed;
         }
 
-		if (c->active->state == completed) {
-            tlsuv_http_req_t *hr = c->active;
-            c->active = NULL;
+		if (conn->active->state != completed) {
+            break;
+        }
+
+        tlsuv_http_req_t *hr = conn->active;
+        conn->active = NULL;
 
-            bool keep_alive = true;
-            const char *keep_alive_hdr = tlsuv_http_resp_header(&hr->resp, "Connection");
-            if (strcmp(hr->resp.http_version, "1.1") == 0) {
-                if (keep_alive_hdr && strcasecmp("close", keep_alive_hdr) == 0)
-                    keep_alive = false;
-            } else if (strcmp(hr->resp.http_version, "1.0") == 0) {
-                keep_alive = keep_alive_hdr && strcasecmp("keep-alive", keep_alive_hdr) == 0;
-            } else {
-                UM_LOG(WARN, "unexpected HTTP version(%s)", hr->resp.http_version);
+        if (hr->timing_cb) {
+            hr->timing.body_complete = uv_hrtime();
+            report_timing(hr);
+        }
+
+        bool keep_alive = true;
+        const char *keep_alive_hdr = tlsuv_http_resp_header(&hr->resp, "Connection");
+        if (strcmp(hr->resp.http_version, "1.1") == 0) {
+            if (keep_alive_hdr && strcasecmp("close", keep_alive_hdr) == 0)
                 keep_alive = false;
-            }
+        } else if (strcmp(hr->resp.http_version, "1.0") == 0) {
+            keep_alive = keep_alive_hdr && strcasecmp("keep-alive", keep_alive_hdr) == 0;
+        } else {
+            UM_LOG(WARN, "unexpected HTTP version(%s)", hr->resp.http_version);
+            keep_alive = false;
+        }
+        // server got headers only, and may still expect the body
+        if (hr->expect_wait) {
+            UM_LOG(VERB, "request[%s] body was not sent, closing connection", hr->path);
+            http_req_clear_body(hr, UV_ECANCELED);
+            keep_alive = false;
+        }
 
-            http_req_free(hr);
-            free(hr);
+        http_req_free(hr);
+        tlsuv__free(hr);
 
-            if (!keep_alive) {
-                close_connection(c);
-            }
-            else {
-                uv_async_send(&c->proc);
-            }
+        if (conn->read_paused && keep_alive) {
+            conn->read_paused = false;
+            uv_link_read_start(&conn->http_link);
         }
-    } else if (nread > 0) {
-        UM_LOG(ERR, "received %zd bytes without active request", nread);
+
+        if (!keep_alive) {
+            // pipelined requests are sent again on another connection
+            close_connection(conn);
+            left = 0;
+            break;
+        }
+
+        // next response belongs to the first pipelined request
+        conn->active = STAILQ_FIRST(&conn->pipeline);
+        if (conn->active) {
+            STAILQ_REMOVE_HEAD(&conn->pipeline, _next);
+            conn->pipeline_count--;
+        }
+        http_sched_mark(c);
+    }
+
+    if (left > 0) {
+        UM_LOG(ERR, "received %zd bytes without active request", left);
     }
 
     if (buf && buf->base) {
-        free(buf->base);
+        tlsuv_pool_free(buf->base);
     }
 }
 
-static void clear_req_body(tlsuv_http_req_t *req, int code) {
-    struct body_chunk_s *chunk = req->req_body, *next;
-    while(chunk) {
-        next = chunk->next;
-        if (chunk->cb) {
-            chunk->cb(req, chunk->chunk, code);
-        }
-        free(chunk);
+static void report_timing(tlsuv_http_req_t *req) {
+    if (req->timing_cb) {
+        req->timing_cb(&req->timing, req->data);
+    }
+}
 
-        chunk = next;
+// connection phases are attributed to the request that triggered connect
+static void copy_conn_timing(tlsuv_http_conn_t *conn) {
+    tlsuv_http_req_t *req = conn->active;
+    if (req == NULL || req->timing_cb == NULL) {
+        return;
     }
-    req->req_body = NULL;
+
+    tlsuv_timing_t t = conn->conn_timing;
+    t.req_written = req->timing.req_written;
+    t.first_byte = req->timing.first_byte;
+    t.body_complete = req->timing.body_complete;
+    req->timing = t;
 }
 
-static void fail_active_request(tlsuv_http_t *c, int code, const char *msg) {
-    if (c->active != NULL && c->active->resp_cb != NULL) {
-        c->active->resp.code = code;
-        c->active->resp.status = strdup(msg);
-        c->active->resp_cb(&c->active->resp, c->active->data);
-        clear_req_body(c->active, code);
-        http_req_free(c->active);
-        free(c->active);
-        c->active = NULL;
+static void fail_conn_request(tlsuv_http_conn_t *conn, int code, const char *msg) {
+    if (conn->active != NULL && http_retry_intercept(conn->active, code)) {
+        conn->active = NULL;
+        return;
+    }
+    if (conn->active != NULL && conn->active->resp_cb != NULL) {
+        conn->active->resp.code = code;
+        conn->active->resp.status = tlsuv__strdup(msg);
+        conn->active->resp_cb(&conn->active->resp, conn->active->data);
+        report_timing(conn->active);
+        http_req_clear_body(conn->active, code);
+        http_req_free(conn->active);
+        tlsuv__free(conn->active);
+        conn->active = NULL;
     }
+}
 
+static void fail_queued_requests(tlsuv_http_t *c, int code, const char *msg) {
     tlsuv_http_req_t *r;
     while (!STAILQ_EMPTY(&c->requests)) {
         r = STAILQ_FIRST(&c->requests);
         STAILQ_REMOVE_HEAD(&c->requests, _next);
+        if (http_retry_intercept(r, code)) {
+            continue;
+        }
         if (r->resp_cb != NULL) {
             r->resp.code = code;
-            r->resp.status = strdup(msg);
+            r->resp.status = tlsuv__strdup(msg);
             r->resp_cb(&r->resp, r->data);
-            uv_unref((uv_handle_t *) &c->proc);
+            if (STAILQ_EMPTY(&c->retry_q)) {
+                http_sched_ref(c, false);
+            }
         }
-        clear_req_body(r, code);
+        http_req_clear_body(r, code);
         http_req_free(r);
-        free(r);
+        tlsuv__free(r);
+    }
+}
+
+// queued requests are ordered by strict urgent class, then by virtual finish tags of weighted fair queueing
+#define PRIO_UNIT 0x10000
+
+static bool prio_before(const tlsuv_http_req_t *a, const tlsuv_http_req_t *b) {
+    bool a_urgent = a->priority == TLSUV_HTTP_PRIO_URGENT;
+    bool b_urgent = b->priority == TLSUV_HTTP_PRIO_URGENT;
+    if (a_urgent != b_urgent) {
+        return a_urgent;
+    }
+    return a->prio_tag < b->prio_tag;
+}
+
+static void prio_tag(tlsuv_http_t *c, tlsuv_http_req_t *r) {
+    uint64_t *finish = &c->prio_finish[r->priority];
+    if (r->priority == TLSUV_HTTP_PRIO_URGENT) {
+        r->prio_tag = ++*finish;
+        return;
+    }
+    uint64_t start = *finish > c->prio_vtime ? *finish : c->prio_vtime;
+    *finish = start + PRIO_UNIT / c->prio_weight[r->priority];
+    r->prio_tag = *finish;
+}
+
+void http_req_enqueue(tlsuv_http_t *c, tlsuv_http_req_t *r) {
+    if (STAILQ_EMPTY(&c->requests)) {
+        STAILQ_INSERT_HEAD(&c->requests, r, _next);
+        return;
+    }
+
+    // queue head keeps address of the last link
+    tlsuv_http_req_t *last = (tlsuv_http_req_t *) ((char *) c->requests.stqh_last - offsetof(tlsuv_http_req_t, _next));
+    if (!prio_before(r, last)) {
+        STAILQ_INSERT_TAIL(&c->requests, r, _next);
+        return;
+    }
+
+    tlsuv_http_req_t *prev = STAILQ_FIRST(&c->requests);
+    if (prio_before(r, prev)) {
+        STAILQ_INSERT_HEAD(&c->requests, r, _next);
+        return;
+    }
+    while (STAILQ_NEXT(prev, _next) != NULL && !prio_before(r, STAILQ_NEXT(prev, _next))) {
+        prev = STAILQ_NEXT(prev, _next);
+    }
+    STAILQ_INSERT_AFTER(&c->requests, prev, r, _next);
+}
+
+// removes the head of the queue for dispatch, it advances virtual time of weighted classes
+static tlsuv_http_req_t *dequeue_req(tlsuv_http_t *c) {
+    tlsuv_http_req_t *r = STAILQ_FIRST(&c->requests);
+    STAILQ_REMOVE_HEAD(&c->requests, _next);
+    if (r->priority != TLSUV_HTTP_PRIO_URGENT && r->prio_tag > c->prio_vtime) {
+        c->prio_vtime = r->prio_tag;
+    }
+    return r;
+}
+
+// puts unanswered pipelined requests back to the client queue
+static void requeue_pipeline(tlsuv_http_conn_t *conn) {
+    tlsuv_http_t *c = conn->client;
+    tlsuv_http_req_t *r;
+
+    while (!STAILQ_EMPTY(&conn->pipeline)) {
+        r = STAILQ_FIRST(&conn->pipeline);
+        STAILQ_REMOVE_HEAD(&conn->pipeline, _next);
+        if (r->resp.code == UV_ECANCELED) { // cancelled while in flight
+            http_req_free(r);
+            tlsuv__free(r);
+            continue;
+        }
+
+        UM_LOG(VERB, "retrying pipelined request[%s]", r->path);
+        r->conn = NULL;
+        r->state = created;
+        r->timing.req_written = 0;
+        // dispatched requests have older tags than the queued ones of their class
+        http_req_enqueue(c, r);
+    }
+    conn->pipeline_count = 0;
+}
+
+// queued requests fail too, unless another connection can still serve them
+static void fail_active_request(tlsuv_http_conn_t *conn, int code, const char *msg) {
+    h2_session_close(conn, code, msg);
+    fail_conn_request(conn, code, msg);
+
+    bool usable = false;
+    tlsuv_http_conn_t *other;
+    LIST_FOREACH(other, &conn->client->conns, _next) {
+        if (other != conn && other->connected != Disconnected) {
+            usable = true;
+            break;
+        }
+    }
+    if (!usable) {
+        fail_queued_requests(conn->client, code, msg);
+    }
+    requeue_pipeline(conn);
+}
+
+static void fail_all_requests(tlsuv_http_t *c, int code, const char *msg) {
+    tlsuv_http_conn_t *conn;
+    LIST_FOREACH(conn, &c->conns, _next) {
+        h2_session_close(conn, code, msg);
+        fail_conn_request(conn, code, msg);
+        requeue_pipeline(conn);
+    }
+    fail_queued_requests(c, code, msg);
+    http_retry_fail_all(c, code);
+}
+
+// sends active request headers with the first TLS flight if request allows it
+static void send_early_data(tlsuv_http_conn_t *conn) {
+    tlsuv_http_req_t *req = conn->active;
+    tls_engine *engine = conn->engine;
+    if (req == NULL || !req->early_data || req->state >= headers_sent ||
+        req->req_chunked || req->req_body != NULL || req->req_body_size > 0 ||
+        engine->api->write_early_data == NULL || engine->api->early_data_status == NULL) {
+        return;
+    }
+
+    http_req_wire *w = http_req_serialize(req);
+    char *buf = http_req_wire_flatten(w);
+    size_t len = w->len;
+    http_req_wire_free(w);
+    if (engine->api->write_early_data(engine->engine, buf, len) == (int) len) {
+        UM_LOG(VERB, "sending request[%s] headers as early data", req->path);
+        req->state = headers_sent;
+        http_req_written(req);
+        conn->early_data_sent = true;
+    }
+    tlsuv_pool_free(buf);
+}
+
+// re-sends active request if server did not take it as early data
+static void check_early_data(tlsuv_http_conn_t *conn) {
+    tls_early_data_status st = conn->engine->api->early_data_status(conn->engine->engine);
+    tlsuv_http_req_t *req = conn->active;
+    if (st != TLS_EARLY_DATA_ACCEPTED && req != NULL && req->state == headers_sent) {
+        UM_LOG(VERB, "early data was not accepted(%d), replaying request[%s]", st, req->path);
+        req->state = created;
+    }
+}
+
+static void submit_h2(tlsuv_http_conn_t *conn, tlsuv_http_req_t *r) {
+    r->conn = conn;
+    int rc = h2_session_submit(conn, r);
+    if (rc != 0) {
+        conn->active = r;
+        fail_conn_request(conn, rc, uv_strerror(rc));
     }
 }
 
 static void on_tls_handshake(tls_link_t *tls, int status) {
-    tlsuv_http_t *clt = tls->data;
+    tlsuv_http_conn_t *conn = tls->data;
+    tlsuv_http_t *clt = conn->client;
 
+    tlsuv_timeout_stop(&conn->conn_timer);
     switch (status) {
         case TLS_HS_COMPLETE:
-            clt->connected = Connected;
-            uv_async_send(&clt->proc);
+            conn->connected = Connected;
+            clt->warm_failed = false;
+            copy_conn_timing(conn);
+            if (clt->own_src) {
+                tlsuv_tls_link_ktls(tls, (uv_stream_t *) ((tcp_src_t *) conn->src)->conn);
+            }
+            if (conn->early_data_sent) {
+                conn->early_data_sent = false;
+                check_early_data(conn);
+            }
+            if (clt->http2 && tls->engine->api->get_alpn &&
+                strcmp(tls->engine->api->get_alpn(tls->engine->engine), "h2") == 0 &&
+                h2_session_start(conn) == 0) {
+                // request that triggered connect becomes first stream
+                tlsuv_http_req_t *r = conn->active;
+                conn->active = NULL;
+                if (r) {
+                    submit_h2(conn, r);
+                }
+            }
+            http_sched_mark(clt);
             break;
 
         case TLS_HS_ERROR: {
             const char *err = tls->engine->api->strerror(tls->engine->engine);
             UM_LOG(ERR, "handshake failed status[%d]: %s", status, tls->engine->api->strerror(tls->engine->engine));
-            close_connection(clt);
-            fail_active_request(clt, UV_ECONNABORTED, err);
+            copy_conn_timing(conn);
+            clt->warm_failed = true;
+            close_connection(conn);
+            fail_active_request(conn, UV_ECONNABORTED, err);
             break;
         }
 
         default:
             UM_LOG(ERR, "unexpected handshake status[%d]", status);
-            close_connection(clt);
+            close_connection(conn);
     }
 }
 
-static void make_links(tlsuv_http_t *clt, uv_link_t *conn_src) {
-    uv_link_init(&clt->http_link, &http_methods);
-    clt->http_link.data = clt;
+static void make_links(tlsuv_http_conn_t *conn, uv_link_t *conn_src) {
+    tlsuv_http_t *clt = conn->client;
+    uv_link_init(&conn->http_link, &http_methods);
+    conn->http_link.data = conn;
 
     if (clt->ssl) {
         if (clt->tls == NULL) {
@@ -201,80 +469,125 @@ static void make_links(tlsuv_http_t *clt, uv_link_t *conn_src) {
             UM_LOG(VERB, "using TLS[%s]", clt->tls->api->version());
         }
 
-        if (clt->host_change) {
-            clt->tls->api->free_engine(clt->engine);
-            clt->engine = NULL;
-            clt->host_change = false;
+        if (conn->host_change) {
+            clt->tls->api->free_engine(conn->engine);
+            conn->engine = NULL;
+            conn->host_change = false;
         }
 
-        if (!clt->engine) {
-            clt->engine = clt->tls->api->new_engine(clt->tls->ctx, clt->host);
+        if (!conn->engine) {
+            conn->engine = clt->tls->api->new_engine(clt->tls->ctx, clt->host);
         }
 
-        tlsuv_tls_link_init(&clt->tls_link, clt->engine, on_tls_handshake);
-        clt->tls_link.data = clt;
+        tlsuv_tls_link_init(&conn->tls_link, conn->engine, on_tls_handshake);
+        tlsuv_tls_link_async_handshake(&conn->tls_link, clt->loop);
+        tlsuv_tls_link_async_crypto(&conn->tls_link, clt->loop);
+        conn->tls_link.timing = &conn->conn_timing;
+        conn->tls_link.data = conn;
+        conn->early_data_sent = false;
+        if (clt->http2 && conn->engine->api->set_protocols) {
+            static const char *protocols[] = {"h2", "http/1.1"};
+            conn->engine->api->set_protocols(conn->engine->engine, protocols, 2);
+        } else {
+            // early data is written as HTTP/1.1, it can't be used before protocol is known
+            send_early_data(conn);
+        }
 
-        uv_link_chain(conn_src, (uv_link_t *) &clt->tls_link);
-        uv_link_chain((uv_link_t *) &clt->tls_link, &clt->http_link);
-        clt->connected = Handshaking;
+        uv_link_chain(conn_src, (uv_link_t *) &conn->tls_link);
+        uv_link_chain((uv_link_t *) &conn->tls_link, &conn->http_link);
+        conn->connected = Handshaking;
+        if (clt->connect_timeout > 0) {
+            tlsuv_timeout_start(&conn->conn_timer, handshake_timeout, clt->connect_timeout);
+        }
     }
     else {
-        uv_link_chain(conn_src, &clt->http_link);
+        uv_link_chain(conn_src, &conn->http_link);
     }
 
-    uv_link_read_start(&clt->http_link);
+    uv_link_read_start(&conn->http_link);
 
     if (!clt->ssl) {
-        clt->connected = Connected;
-        uv_async_send(&clt->proc);
+        conn->connected = Connected;
+        clt->warm_failed = false;
+        copy_conn_timing(conn);
+        http_sched_mark(clt);
+    }
+}
+
+static void client_closed(tlsuv_http_t *clt) {
+    clt->tls = NULL;
+    free_http(clt);
+    if (clt->close_cb) {
+        clt->close_cb(clt);
     }
 }
 
 static void link_close_cb(uv_link_t *l) {
-    tlsuv_http_t *clt = l->data;
-    if (clt) {
-        clt->src->release(clt->src);
-        uv_async_send(&clt->proc);
+    tlsuv_http_conn_t *conn = l->data;
+    if (conn) {
+        tlsuv_http_t *clt = conn->client;
+        conn->src->release(conn->src);
+        if (clt->closing && conn->engine != NULL) {
+            clt->tls->api->free_engine(conn->engine);
+            conn->engine = NULL;
+        }
+        clt->closing_links--;
+        if (!clt->closing) {
+            http_sched_mark(clt);
+        } else if (clt->proc_closed && clt->closing_links == 0) {
+            client_closed(clt);
+        }
     }
 }
 
 static void src_connect_cb(tlsuv_src_t *src, int status, void *ctx) {
     UM_LOG(VERB, "src connected status = %d", status);
-    tlsuv_http_t *clt = ctx;
-    uv_timer_stop(clt->conn_timer);
+    tlsuv_http_conn_t *conn = ctx;
+    tlsuv_timeout_stop(&conn->conn_timer);
     if (status == 0) {
-        switch (clt->connected) {
+        switch (conn->connected) {
             case Connecting:
-                make_links(clt, (uv_link_t *) src->link);
+                make_links(conn, (uv_link_t *) src->link);
                 break;
 
             case Disconnected:
-                UM_LOG(WARN, "src connected after timeout: state = %d", clt->connected);
-                clt->src->cancel(clt->src);
+                UM_LOG(WARN, "src connected after timeout: state = %d", conn->connected);
+                conn->src->cancel(conn->src);
                 break;
 
             default:
-                UM_LOG(ERR, "src connected for client in state[%d]", clt->connected);
+                UM_LOG(ERR, "src connected for client in state[%d]", conn->connected);
         }
     } 
     else {
         UM_LOG(DEBG, "failed to connect: %d(%s)", status, uv_strerror(status));
-        clt->connected = Disconnected;
-        fail_active_request(clt, status, uv_strerror(status));
-        uv_async_send(&clt->proc);
+        conn->connected = Disconnected;
+        conn->client->warm_failed = true;
+        copy_conn_timing(conn);
+        fail_active_request(conn, status, uv_strerror(status));
+        http_sched_mark(conn->client);
     }
 }
 
-static void src_connect_timeout(uv_timer_t *t) {
-    tlsuv_http_t *clt = t->data;
+static void src_connect_timeout(tlsuv_timeout_t *t) {
+    tlsuv_http_conn_t *conn = t->data;
+
+    src_connect_cb(conn->src, UV_ETIMEDOUT, conn);
+    conn->src->cancel(conn->src);
+}
 
-    src_connect_cb(clt->src, UV_ETIMEDOUT, clt);
-    clt->src->cancel(clt->src);
+static void handshake_timeout(tlsuv_timeout_t *t) {
+    tlsuv_http_conn_t *conn = t->data;
+    UM_LOG(DEBG, "TLS handshake timed out");
+    copy_conn_timing(conn);
+    conn->client->warm_failed = true;
+    close_connection(conn);
+    fail_active_request(conn, UV_ETIMEDOUT, uv_strerror(UV_ETIMEDOUT));
 }
 
-static void req_write_cb(uv_link_t *source, int status, void *arg) {
+static void req_head_write_cb(uv_link_t *source, int status, void *arg) {
     UM_LOG(VERB, "request write completed: %d", status);
-    free(arg);
+    http_req_wire_free(arg);
 }
 
 static void req_write_body_cb(uv_link_t *source, int status, void *arg) {
@@ -283,19 +596,81 @@ static void req_write_body_cb(uv_link_t *source, int status, void *arg) {
     if (chunk->cb) {
         chunk->cb(chunk->req, chunk->chunk, status);
     }
-    free(chunk);
+    tlsuv__free(chunk);
+}
+
+// max body chunks coalesced into single write
+#define CHUNK_BATCH 16
+
+// chunk size lines, payloads, and trailers of consecutive body chunks written together
+struct chunked_write_s {
+    struct body_chunk_s *chunks;
+    unsigned int nbufs;
+    uv_buf_t bufs[3 * CHUNK_BATCH + 1];
+    char sizes[CHUNK_BATCH][20];
+};
+
+static void chunked_write_cb(uv_link_t *l, int status, void *arg) {
+    UM_LOG(VERB, "request body write completed: %d", status);
+    struct chunked_write_s *wr = arg;
+    while (wr->chunks) {
+        struct body_chunk_s *chunk = wr->chunks;
+        wr->chunks = chunk->next;
+        if (chunk->cb) {
+            chunk->cb(chunk->req, chunk->chunk, status);
+        }
+        tlsuv__free(chunk);
+    }
+    tlsuv_pool_free(wr);
 }
 
-static void chunk_hdr_wcb(uv_link_t *l, int status, void *arg) {
-    if (arg != NULL) {
-        free(arg);
+// takes queued chunks off the request and emits them as one multi-buffer write
+static void send_chunks(tlsuv_http_req_t *req) {
+    tlsuv_http_conn_t *conn = req->conn;
+    struct chunked_write_s *wr = tlsuv_pool_alloc(sizeof(*wr));
+    struct body_chunk_s **tail = &wr->chunks;
+    wr->chunks = NULL;
+    wr->nbufs = 0;
+
+    unsigned int count = 0;
+    while (req->req_body != NULL && count < CHUNK_BATCH) {
+        struct body_chunk_s *b = req->req_body;
+        req->req_body = b->next;
+        b->next = NULL;
+        UM_LOG(VERB, "sending body chunk %ld bytes", b->len);
+        req->body_sent_size += b->len;
+
+        if (b->len > 0) {
+            char *size = wr->sizes[count++];
+            wr->bufs[wr->nbufs++] = uv_buf_init(size, snprintf(size, sizeof(wr->sizes[0]), "%zx\r\n", b->len));
+            wr->bufs[wr->nbufs++] = uv_buf_init((char *) b->chunk, b->len);
+            wr->bufs[wr->nbufs++] = uv_buf_init("\r\n", 2);
+            *tail = b;
+            tail = &b->next;
+        } else { // last chunk
+            wr->bufs[wr->nbufs++] = uv_buf_init("0\r\n\r\n", 5);
+            tlsuv__free(b);
+            req->state = body_sent;
+            break;
+        }
     }
+
+    uv_link_write((uv_link_t *) &conn->http_link, wr->bufs, wr->nbufs, NULL, chunked_write_cb, wr);
 }
 
 static void send_body(tlsuv_http_req_t *req) {
-    tlsuv_http_t *clt = req->client;
-    if (clt->active != req) {
+    tlsuv_http_conn_t *conn = req->conn;
+    if (conn == NULL || conn->active != req) {
         UM_LOG(ERR, "attempt to send body for inactive request");
+        return;
+    }
+
+    http_req_encode_body(req);
+    if (req->req_chunked) {
+        while (req->req_body != NULL) {
+            send_chunks(req);
+        }
+        return;
     }
 
     uv_buf_t buf;
@@ -305,142 +680,532 @@ static void send_body(tlsuv_http_req_t *req) {
         UM_LOG(VERB, "sending body chunk %ld bytes", b->len);
         req->body_sent_size += b->len;
 
-        if (req->req_chunked) {
-            if (b->len > 0) {
-                buf.base = malloc(10);
-                buf.len = snprintf(buf.base, 10, "%zx\r\n", b->len);
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, chunk_hdr_wcb, buf.base);
-
-                buf.base = (char*)b->chunk;
-                buf.len = b->len;
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, req_write_body_cb, b);
-
-                buf.base = "\r\n";
-                buf.len = 2;
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, chunk_hdr_wcb, NULL);
-            } else { // last chunk
-                buf.base = "0\r\n\r\n";
-                buf.len = 5;
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, chunk_hdr_wcb, NULL);
-                free(b);
-                req->state = body_sent;
-            }
+        buf = uv_buf_init((char*)b->chunk, b->len);
+        uv_link_write((uv_link_t *) &conn->http_link, &buf, 1, NULL, req_write_body_cb, b);
+        if (req->body_sent_size > req->req_body_size) {
+            UM_LOG(WARN, "Supplied data[%ld] is larger than provided Content-Length[%ld]",
+                    req->body_sent_size, req->req_body_size);
         }
-        else {
-            buf = uv_buf_init((char*)b->chunk, b->len);
-            uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, req_write_body_cb, b);
-            if (req->body_sent_size > req->req_body_size) {
-                UM_LOG(WARN, "Supplied data[%ld] is larger than provided Content-Length[%ld]",
-                        req->body_sent_size, req->req_body_size);
-            }
 
-            if (req->body_sent_size >= req->req_body_size) {
-                req->state = body_sent;
-            }
+        if (req->body_sent_size >= req->req_body_size) {
+            req->state = body_sent;
         }
     }
 }
 
-static void close_connection(tlsuv_http_t *c) {
-    uv_timer_stop(c->conn_timer);
-    switch (c->connected) {
+static void close_connection(tlsuv_http_conn_t *conn) {
+    tlsuv_timeout_stop(&conn->conn_timer);
+    conn->read_paused = false;
+    requeue_pipeline(conn);
+    h2_session_close(conn, UV_ECONNABORTED, uv_strerror(UV_ECONNABORTED));
+    switch (conn->connected) {
         case Handshaking:
         case Connected:
             UM_LOG(VERB, "closing connection");
-            uv_link_close((uv_link_t *) &c->http_link, link_close_cb);
+            conn->client->closing_links++;
+            uv_link_close((uv_link_t *) &conn->http_link, link_close_cb);
         case Connecting:
-            c->connected = Disconnected;
+            conn->connected = Disconnected;
             break;
     }
 }
 
-static void idle_timeout(uv_timer_t *t) {
+static void idle_timeout(tlsuv_timeout_t *t) {
     UM_LOG(VERB, "idle timeout triggered");
-    tlsuv_http_t *clt = t->data;
-    close_connection(clt);
+    tlsuv_http_conn_t *conn = t->data;
+    close_connection(conn);
+}
+
+static void init_conn(tlsuv_http_t *c, tlsuv_http_conn_t *conn, uv_loop_t *l, tlsuv_src_t *src) {
+    conn->client = c;
+    conn->connected = Disconnected;
+    conn->src = src;
+    conn->host_change = false;
+    conn->engine = NULL;
+    conn->active = NULL;
+    conn->h2 = NULL;
+    STAILQ_INIT(&conn->pipeline);
+    conn->pipeline_count = 0;
+    conn->early_data_sent = false;
+    conn->read_paused = false;
+    memset(&conn->read_size, 0, sizeof(conn->read_size));
+
+    tlsuv_timeout_init(l, &conn->conn_timer);
+    conn->conn_timer.data = conn;
+
+    LIST_INSERT_HEAD(&c->conns, conn, _next);
+    c->conn_count++;
 }
 
-static void process_requests(uv_async_t *ar) {
-    tlsuv_http_t *c = ar->data;
+// additional connection with TCP source configured the same way as the client one
+static tlsuv_http_conn_t *new_conn(tlsuv_http_t *c) {
+    const tcp_src_t *proto = (const tcp_src_t *) c->src;
+    tcp_src_t *src = tlsuv__calloc(1, sizeof(tcp_src_t));
+    tcp_src_init(c->loop, src);
+    src->nodelay = proto->nodelay;
+    src->keepalive = proto->keepalive;
+    src->fast_open = proto->fast_open;
+    src->attempt_delay = proto->attempt_delay;
+    src->sockopts = proto->sockopts;
+    if (proto->addr_count > 0) {
+        src->addrs = tlsuv__calloc(proto->addr_count, sizeof(*src->addrs));
+        memcpy(src->addrs, proto->addrs, proto->addr_count * sizeof(*src->addrs));
+        src->addr_count = proto->addr_count;
+    }
 
-    if (c->active == NULL && !STAILQ_EMPTY(&c->requests)) {
-        c->active = STAILQ_FIRST(&c->requests);
-        STAILQ_REMOVE_HEAD(&c->requests, _next);
+    tlsuv_http_conn_t *conn = tlsuv__calloc(1, sizeof(tlsuv_http_conn_t));
+    init_conn(c, conn, c->loop, (tlsuv_src_t *) src);
+    UM_LOG(VERB, "opening connection %zd/%zd", c->conn_count, c->max_conns);
+    return conn;
+}
+
+static bool same_origin(tlsuv_http_t *a, tlsuv_http_t *b) {
+    if (a->ssl != b->ssl || a->http2 != b->http2 || strcmp(a->port, b->port) != 0 ||
+        a->host == NULL || b->host == NULL || strcasecmp(a->host, b->host) != 0) {
+        return false;
     }
 
-    if (c->active == NULL) {
-        if (c->connected == Connected && c->idle_time >= 0) {
-            UM_LOG(VERB, "no more requests, scheduling idle(%ld) close", c->idle_time);
-            uv_timer_start(c->conn_timer, idle_timeout, c->idle_time, 0);
+    // engines are created by TLS context of the client, which is resolved on first connect
+    return !a->ssl || (a->tls ? a->tls : get_default_tls()) == (b->tls ? b->tls : get_default_tls());
+}
+
+// connection with its own source, connected and without requests
+static bool conn_idle(tlsuv_http_t *c, tlsuv_http_conn_t *conn) {
+    return conn != &c->conn && conn->connected == Connected && conn->active == NULL &&
+           STAILQ_EMPTY(&conn->pipeline) && (conn->h2 == NULL || h2_session_streams(conn) == 0);
+}
+
+static size_t shared_idle_count(tlsuv_http_t *c) {
+    size_t count = 0;
+    tlsuv_http_t *o;
+    LIST_FOREACH(o, http_sched_shared(c), _share_next) {
+        if (o != c && !same_origin(o, c)) continue;
+
+        tlsuv_http_conn_t *conn;
+        LIST_FOREACH(conn, &o->conns, _next) {
+            if (conn_idle(o, conn)) count++;
         }
-        uv_unref((uv_handle_t *) &c->proc);
-        return;
+    }
+    return count;
+}
+
+static void move_conn(tlsuv_http_conn_t *conn, tlsuv_http_t *to) {
+    tlsuv_http_t *from = conn->client;
+    UM_LOG(VERB, "moving idle connection to %s:%s between clients", to->host, to->port);
+    tlsuv_timeout_stop(&conn->conn_timer);
+    LIST_REMOVE(conn, _next);
+    from->conn_count--;
+
+    conn->client = to;
+    LIST_INSERT_HEAD(&to->conns, conn, _next);
+    to->conn_count++;
+}
+
+// takes idle connection of another sharing client, HTTP/2 session if `h2` is set
+static tlsuv_http_conn_t *adopt_conn(tlsuv_http_t *c, bool h2) {
+    if (c->share_max_idle == 0 || c->conn_count >= c->max_conns) {
+        return NULL;
+    }
+
+    tlsuv_http_t *o;
+    LIST_FOREACH(o, http_sched_shared(c), _share_next) {
+        if (o == c || !same_origin(o, c)) continue;
+
+        tlsuv_http_conn_t *conn;
+        LIST_FOREACH(conn, &o->conns, _next) {
+            if (conn_idle(o, conn) && (conn->h2 != NULL) == h2) {
+                move_conn(conn, c);
+                return conn;
+            }
+        }
+    }
+    return NULL;
+}
+
+// hands idle connection of closing client over to another sharing client
+static bool pass_conn(tlsuv_http_conn_t *conn) {
+    tlsuv_http_t *c = conn->client;
+    if (c->share_max_idle == 0 || !conn_idle(c, conn) || shared_idle_count(c) > c->share_max_idle) {
+        return false;
+    }
+
+    tlsuv_http_t *o;
+    LIST_FOREACH(o, http_sched_shared(c), _share_next) {
+        if (o == c || o->closing || o->conn_count >= o->max_conns || !same_origin(o, c)) continue;
+
+        move_conn(conn, o);
+        if (o->idle_time >= 0) {
+            tlsuv_timeout_start(&conn->conn_timer, idle_timeout, o->idle_time);
+        }
+        http_sched_mark(o);
+        return true;
+    }
+    return false;
+}
+
+int tlsuv_http_share_connections(tlsuv_http_t *clt, size_t max_idle) {
+    if (!clt->own_src) {
+        return UV_ENOTSUP;
+    }
+
+    struct http_share_list *shared = http_sched_shared(clt);
+    if (shared == NULL) {
+        return UV_EINVAL;
+    }
+
+    bool sharing = clt->share_max_idle > 0;
+    clt->share_max_idle = max_idle;
+    if (sharing == (max_idle > 0)) {
+        return 0;
     }
 
-    if (c->connected == Disconnected) {
-        c->connected = Connecting;
+    tlsuv_http_conn_t *first = &clt->conn;
+    if (sharing) {
+        LIST_REMOVE(clt, _share_next);
+        if (first->client == NULL) {
+            init_conn(clt, first, clt->loop, clt->src);
+        }
+        return 0;
+    }
+
+    LIST_INSERT_HEAD(shared, clt, _share_next);
+    // connection embedded in the client can't be handed over, only separate connections are used while sharing
+    if (first->client == clt && first->connected == Disconnected && first->active == NULL) {
+        LIST_REMOVE(first, _next);
+        clt->conn_count--;
+        first->client = NULL;
+        if (first->engine != NULL) {
+            clt->tls->api->free_engine(first->engine);
+            first->engine = NULL;
+        }
+        tlsuv_timeout_close(&first->conn_timer);
+    }
+    return 0;
+}
+
+// connected idle connection is preferred, then one that is being (re)connected,
+// new connection is only added if pool limit allows it
+static tlsuv_http_conn_t *pick_conn(tlsuv_http_t *c) {
+    tlsuv_http_conn_t *conn, *pending = NULL, *disconnected = NULL;
+    LIST_FOREACH(conn, &c->conns, _next) {
+        if (conn->active != NULL || conn->h2 != NULL) continue;
+
+        if (conn->connected == Connected) return conn;
+        if (conn->connected == Disconnected) {
+            if (disconnected == NULL) disconnected = conn;
+        } else if (pending == NULL) {
+            pending = conn;
+        }
+    }
+
+    if ((conn = adopt_conn(c, false)) != NULL) return conn;
+    if (pending) return pending;
+    if (disconnected) return disconnected;
+    if (c->conn_count < c->max_conns) return new_conn(c);
+    return NULL;
+}
+
+static void process_conn(tlsuv_http_conn_t *conn) {
+    tlsuv_http_t *c = conn->client;
+
+    if (conn->connected == Disconnected) {
+        conn->connected = Connecting;
         UM_LOG(VERB, "client not connected, starting connect sequence");
         if (c->connect_timeout > 0) {
-            uv_timer_start(c->conn_timer, src_connect_timeout, c->connect_timeout, 0);
+            tlsuv_timeout_start(&conn->conn_timer, src_connect_timeout, c->connect_timeout);
         }
-        int rc = c->src->connect(c->src, c->host, c->port, src_connect_cb, c);
+        memset(&conn->conn_timing, 0, sizeof(conn->conn_timing));
+        conn->src->timing = &conn->conn_timing;
+        int rc = conn->src->connect(conn->src, c->host, c->port, src_connect_cb, conn);
         if (rc != 0) {
-            src_connect_cb(c->src, rc, c);
+            src_connect_cb(conn->src, rc, conn);
         }
     }
-    else if (c->connected == Connected) {
-        UM_LOG(VERB, "client connected, processing request[%s] state[%d]", c->active->path, c->active->state);
-        if (c->active->state < headers_sent) {
-            UM_LOG(VERB, "sending request[%s] headers", c->active->path);
-            uv_buf_t req;
-            req.base = malloc(8196);
-            req.len = http_req_write(c->active, req.base, 8196);
-            UM_LOG(TRACE, "writing request >>> %*.*s", req.len, req.len, req.base);
-            uv_link_write((uv_link_t *) &c->http_link, &req, 1, NULL, req_write_cb, req.base);
-            c->active->state = headers_sent;
+    else if (conn->connected == Connected) {
+        UM_LOG(VERB, "client connected, processing request[%s] state[%d]", conn->active->path, conn->active->state);
+        if (conn->active->state < headers_sent) {
+            UM_LOG(VERB, "sending request[%s] headers", conn->active->path);
+            http_req_wire *w = http_req_serialize(conn->active);
+            UM_LOG(TRACE, "writing request >>> %*.*s", w->bufs[0].len, w->bufs[0].len, w->bufs[0].base);
+            uv_link_write((uv_link_t *) &conn->http_link, w->bufs, w->nbufs, NULL, req_head_write_cb, w);
+            conn->active->state = headers_sent;
+            http_req_written(conn->active);
         }
 
-        // send body
-        if (c->active->state < body_sent) {
-            UM_LOG(VERB, "sending request[%s] body", c->active->path);
-            send_body(c->active);
+        // send body, unless it waits for interim response
+        if (conn->active->state < body_sent && !conn->active->expect_wait) {
+            UM_LOG(VERB, "sending request[%s] body", conn->active->path);
+            send_body(conn->active);
+        }
+
+        tlsuv_http_req_t *r;
+        STAILQ_FOREACH(r, &conn->pipeline, _next) {
+            if (r->state < headers_sent) {
+                UM_LOG(VERB, "sending pipelined request[%s]", r->path);
+                http_req_wire *w = http_req_serialize(r);
+                uv_link_write((uv_link_t *) &conn->http_link, w->bufs, w->nbufs, NULL, req_head_write_cb, w);
+                r->state = body_sent;
+                http_req_written(r);
+            }
         }
     }
 }
 
-static void on_clt_close(uv_handle_t *h) {
-    tlsuv_http_t *clt = h->data;
-    free_http(clt);
-    if (clt->close_cb) {
-        clt->close_cb(clt);
+static size_t open_conns(tlsuv_http_t *c) {
+    size_t count = 0;
+    tlsuv_http_conn_t *conn;
+    LIST_FOREACH(conn, &c->conns, _next) {
+        if (conn->connected != Disconnected) count++;
+    }
+    return count;
+}
+
+// starts connecting pool connections until preconnect target is open
+static void warm_up(tlsuv_http_t *c) {
+    size_t target = c->warm_conns < c->max_conns ? c->warm_conns : c->max_conns;
+    for (size_t open = open_conns(c); open < target; open++) {
+        tlsuv_http_conn_t *conn, *idle = NULL;
+        LIST_FOREACH(conn, &c->conns, _next) {
+            if (conn->connected == Disconnected && conn->active == NULL) {
+                idle = conn;
+                break;
+            }
+        }
+        if (idle == NULL) {
+            if (c->conn_count >= c->max_conns) break;
+            idle = new_conn(c);
+        }
+
+        UM_LOG(VERB, "preconnecting %zd/%zd", open + 1, target);
+        process_conn(idle);
+        // synchronous connect failure
+        if (c->warm_failed) break;
+    }
+}
+
+// idempotent request without body, safe to send again if connection is lost before response
+static bool can_pipeline(const tlsuv_http_req_t *r) {
+    return (strcmp(r->method, "GET") == 0 || strcmp(r->method, "OPTIONS") == 0 ||
+            strcmp(r->method, "DELETE") == 0) &&
+           !r->req_chunked && r->req_body_size <= 0 && r->req_body == NULL;
+}
+
+static tlsuv_http_conn_t *pick_h2_conn(tlsuv_http_t *c) {
+    tlsuv_http_conn_t *conn;
+    LIST_FOREACH(conn, &c->conns, _next) {
+        if (conn->h2 != NULL && h2_session_available(conn)) {
+            return conn;
+        }
+    }
+    return c->http2 ? adopt_conn(c, true) : NULL;
+}
+
+// TLS connection is being (or about to be) established, its protocol is not known yet
+static bool h2_negotiating(tlsuv_http_t *c) {
+    if (!c->ssl) {
+        return false;
+    }
+
+    tlsuv_http_conn_t *conn;
+    LIST_FOREACH(conn, &c->conns, _next) {
+        if (conn->active != NULL && conn->connected != Connected) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// connection with the shortest pipeline that can take one more request
+static tlsuv_http_conn_t *pick_pipeline_conn(tlsuv_http_t *c) {
+    tlsuv_http_conn_t *conn, *best = NULL;
+    LIST_FOREACH(conn, &c->conns, _next) {
+        if (conn->active == NULL || conn->connected == Disconnected ||
+            !can_pipeline(conn->active) || conn->pipeline_count + 1 >= c->pipeline_depth) {
+            continue;
+        }
+        if (best == NULL || conn->pipeline_count < best->pipeline_count) {
+            best = conn;
+        }
+    }
+    return best;
+}
+
+// answers queued requests that have fresh cached response, callbacks may change the queue
+static void serve_cached(tlsuv_http_t *c) {
+    tlsuv_http_req_t *r;
+    do {
+        STAILQ_FOREACH(r, &c->requests, _next) {
+            if (http_cache_lookup(c, r)) break;
+        }
+        if (r != NULL) {
+            STAILQ_REMOVE(&c->requests, r, tlsuv_http_req_s, _next);
+            http_cache_respond(r);
+            if (r->timing_cb) {
+                r->timing.body_complete = uv_hrtime();
+                report_timing(r);
+            }
+            http_req_free(r);
+            tlsuv__free(r);
+        }
+    } while (r != NULL);
+}
+
+void http_client_run(tlsuv_http_t *c) {
+    http_submit_drain(c);
+    if (c->closing) {
+        c->proc_closed = true;
+        // connections still closing release client when they are done
+        if (c->closing_links == 0) {
+            client_closed(c);
+        }
+        return;
+    }
+
+    if (c->cache) {
+        serve_cached(c);
+    }
+
+    while (!STAILQ_EMPTY(&c->requests)) {
+        tlsuv_http_req_t *r = STAILQ_FIRST(&c->requests);
+        tlsuv_http_conn_t *conn = pick_h2_conn(c);
+        if (conn != NULL) {
+            dequeue_req(c);
+            tlsuv_timeout_stop(&conn->conn_timer);
+            submit_h2(conn, r);
+            continue;
+        }
+
+        // wait for protocol negotiation, HTTP/2 connection would take all requests
+        if (c->http2 && h2_negotiating(c)) {
+            break;
+        }
+
+        bool pipelined = false;
+        conn = pick_conn(c);
+        if (conn == NULL && c->pipeline_depth > 1 && can_pipeline(r)) {
+            conn = pick_pipeline_conn(c);
+            pipelined = true;
+        }
+        if (conn == NULL) {
+            break;
+        }
+
+        dequeue_req(c);
+        r->conn = conn;
+        if (pipelined) {
+            STAILQ_INSERT_TAIL(&conn->pipeline, r, _next);
+            conn->pipeline_count++;
+        } else {
+            tlsuv_timeout_stop(&conn->conn_timer);
+            conn->active = r;
+        }
+    }
+
+    // without KEEP zero idle timeout would close re-established connections right away
+    bool reconnect = (c->warm_flags & TLSUV_HTTP_PRECONNECT_RECONNECT) && !c->warm_failed &&
+                     ((c->warm_flags & TLSUV_HTTP_PRECONNECT_KEEP) || c->idle_time != 0);
+    if (c->warm_conns > 0 && (c->warm_pending || reconnect)) {
+        c->warm_pending = false;
+        warm_up(c);
+    }
+
+    // warm connections are exempt from idle timeout, connections with running timer are already leaving
+    size_t keep_open = 0;
+    if (c->warm_flags & TLSUV_HTTP_PRECONNECT_KEEP) {
+        keep_open = open_conns(c);
+        tlsuv_http_conn_t *conn;
+        LIST_FOREACH(conn, &c->conns, _next) {
+            if (conn->connected == Connected && conn->active == NULL && h2_session_streams(conn) == 0 &&
+                tlsuv_timeout_active(&conn->conn_timer) && keep_open > 0) {
+                keep_open--;
+            }
+        }
+    }
+
+    bool busy = false;
+    tlsuv_http_conn_t *conn, *next;
+    for (conn = LIST_FIRST(&c->conns); conn != NULL; conn = next) {
+        next = LIST_NEXT(conn, _next);
+        if (conn->h2 != NULL) {
+            h2_session_flush(conn);
+        }
+
+        if (h2_session_streams(conn) > 0) {
+            busy = true;
+        } else if (conn->active != NULL) {
+            busy = true;
+            process_conn(conn);
+        } else if (conn->connected == Connected && c->idle_time >= 0 &&
+                   !tlsuv_timeout_active(&conn->conn_timer)) {
+            if (c->share_max_idle > 0 && conn_idle(c, conn) && shared_idle_count(c) > c->share_max_idle) {
+                UM_LOG(VERB, "idle connections limit(%zd) of shared origin reached", c->share_max_idle);
+                close_connection(conn);
+                continue;
+            }
+            if (keep_open > 0 && keep_open <= c->warm_conns) {
+                UM_LOG(VERB, "keeping warm connection open");
+                continue;
+            }
+            keep_open = keep_open > 0 ? keep_open - 1 : 0;
+            UM_LOG(VERB, "no more requests, scheduling idle(%ld) close", c->idle_time);
+            tlsuv_timeout_start(&conn->conn_timer, idle_timeout, c->idle_time);
+        }
+    }
+
+    // requests waiting for retry keep the loop running
+    if (!busy && STAILQ_EMPTY(&c->requests) && STAILQ_EMPTY(&c->retry_q)) {
+        http_sched_ref(c, false);
     }
 }
 
 int tlsuv_http_close(tlsuv_http_t *clt, tlsuv_http_close_cb close_cb) {
-    uv_close((uv_handle_t *) &clt->proc, on_clt_close);
+    tlsuv_http_conn_t *conn, *next;
+    if (clt->share_max_idle > 0) {
+        // idle connections are handed over before their sessions are shut down
+        for (conn = LIST_FIRST(&clt->conns); conn != NULL; conn = next) {
+            next = LIST_NEXT(conn, _next);
+            pass_conn(conn);
+        }
+        LIST_REMOVE(clt, _share_next);
+        clt->share_max_idle = 0;
+    }
 
-    fail_active_request(clt, UV_ECANCELED, uv_strerror(UV_ECANCELED));
-    close_connection(clt);
+    fail_all_requests(clt, UV_ECANCELED, uv_strerror(UV_ECANCELED));
 
-    if (clt->engine != NULL) {
-        clt->tls->api->free_engine(clt->engine);
-        clt->engine = NULL;
+    // connections are closed first, client is released after their link close callbacks
+    LIST_FOREACH(conn, &clt->conns, _next) {
+        if (conn->connected == Connecting) {
+            conn->src->cancel(conn->src);
+        }
+        // TLS link may still be using the engine on a worker thread, it is released in link close callback
+        bool linked = conn->connected == Handshaking || conn->connected == Connected;
+        close_connection(conn);
+
+        if (!linked && conn->engine != NULL) {
+            clt->tls->api->free_engine(conn->engine);
+            conn->engine = NULL;
+        }
+        tlsuv_timeout_close(&conn->conn_timer);
     }
-    clt->tls = NULL;
 
     clt->close_cb = close_cb;
-    uv_close((uv_handle_t *) clt->conn_timer, (uv_close_cb) free);
+    clt->closing = true;
+    // submitted requests that were not started yet
+    http_submit_drain(clt);
+    // loop runs until client is released
+    http_sched_ref(clt, true);
+    http_sched_mark(clt);
     return 0;
 }
 
 static void http_set_prefix(tlsuv_http_t *clt, const char *pfx, size_t pfx_len) {
     if (clt->prefix) {
-        free(clt->prefix);
+        tlsuv__free(clt->prefix);
         clt->prefix = NULL;
     }
 
     if (pfx) {
-        clt->prefix = calloc(1, pfx_len + 1);
+        clt->prefix = tlsuv__calloc(1, pfx_len + 1);
         strncpy(clt->prefix, pfx, pfx_len);
     }
 }
@@ -475,12 +1240,18 @@ int tlsuv_http_set_url(tlsuv_http_t *clt, const char *url) {
     }
 
     if (clt->host) {
-        clt->host_change = true;
-        free(clt->host);
+        tlsuv_http_conn_t *conn;
+        LIST_FOREACH(conn, &clt->conns, _next) {
+            conn->host_change = true;
+        }
+        if (strncasecmp(clt->host, u.hostname, u.hostname_len) != 0 || clt->host[u.hostname_len] != 0) {
+            http_cache_clear(clt);
+        }
+        tlsuv__free(clt->host);
     }
-    set_http_header(&clt->headers, "Host", NULL);
+    tlsuv_http_header(clt, "Host", NULL);
 
-    clt->host = strndup(u.hostname, u.hostname_len);
+    clt->host = tlsuv__strndup(u.hostname, u.hostname_len);
     tlsuv_http_header(clt, "Host", clt->host);
 
 
@@ -496,20 +1267,62 @@ int tlsuv_http_set_url(tlsuv_http_t *clt, const char *url) {
     return 0;
 }
 
+int tlsuv_http_set_addr(tlsuv_http_t *clt, const struct addrinfo *addr) {
+    if (!clt->own_src) {
+        UM_LOG(WARN, "addresses can not be set on custom source link");
+        return UV_EINVAL;
+    }
+    return tcp_src_set_addr((tcp_src_t *) clt->src, addr);
+}
+
+int tlsuv_http_sockopts(tlsuv_http_t *clt, const tcp_src_sockopts *opts) {
+    if (!clt->own_src) {
+        UM_LOG(WARN, "socket options can not be set on custom source link");
+        return UV_EINVAL;
+    }
+    return tcp_src_sockopts_set((tcp_src_t *) clt->src, opts);
+}
+
 int tlsuv_http_init_with_src(uv_loop_t *l, tlsuv_http_t *clt, const char *url, tlsuv_src_t *src) {
     STAILQ_INIT(&clt->requests);
     LIST_INIT(&clt->headers);
+    LIST_INIT(&clt->conns);
 
     clt->own_src = false;
     clt->ssl = false;
     clt->tls = NULL;
-    clt->engine = NULL;
-    clt->active = NULL;
-    clt->connected = Disconnected;
     clt->src = src;
-    clt->host_change = false;
+    clt->conn_count = 0;
+    clt->max_conns = 1;
+    clt->warm_conns = 0;
+    clt->warm_flags = 0;
+    clt->warm_pending = false;
+    clt->warm_failed = false;
+    clt->pipeline_depth = 1;
+    clt->http2 = false;
+    clt->closing_links = 0;
+    clt->proc_closed = false;
+    clt->closing = false;
+    clt->sched = NULL;
+    clt->remote = NULL;
+    clt->share_max_idle = 0;
+    memset(&clt->retry, 0, sizeof(clt->retry));
+    memset(&clt->retry_stats, 0, sizeof(clt->retry_stats));
+    STAILQ_INIT(&clt->retry_q);
+    memset(clt->prio_weight, 0, sizeof(clt->prio_weight));
+    clt->prio_weight[TLSUV_HTTP_PRIO_HIGH] = 8;
+    clt->prio_weight[TLSUV_HTTP_PRIO_NORMAL] = 4;
+    clt->prio_weight[TLSUV_HTTP_PRIO_BULK] = 1;
+    memset(clt->prio_finish, 0, sizeof(clt->prio_finish));
+    clt->prio_vtime = 0;
+    clt->expect_min_body = 0;
+    clt->expect_timeout = 0;
     clt->host = NULL;
     clt->prefix = NULL;
+    clt->cache = NULL;
+    clt->resp_filter = NULL;
+    clt->hdr_block = NULL;
+    clt->inflater = NULL;
 
     int rc = tlsuv_http_set_url(clt, url);
     if (rc != 0) {
@@ -518,19 +1331,14 @@ int tlsuv_http_init_with_src(uv_loop_t *l, tlsuv_http_t *clt, const char *url, t
 
     clt->connect_timeout = 0;
     clt->idle_time = DEFAULT_IDLE_TIMEOUT;
-    clt->conn_timer = calloc(1, sizeof(uv_timer_t));
-    uv_timer_init(l, clt->conn_timer);
-    uv_unref((uv_handle_t *) clt->conn_timer);
-    clt->conn_timer->data = clt;
+    init_conn(clt, &clt->conn, l, src);
 
     tlsuv_http_header(clt, "Connection", "keep-alive");
     if (um_available_encoding() != NULL) {
         tlsuv_http_header(clt, "Accept-Encoding", um_available_encoding());
     }
 
-    uv_async_init(l, &clt->proc, process_requests);
-    uv_unref((uv_handle_t *) &clt->proc);
-    clt->proc.data = clt;
+    http_sched_attach(clt, l);
 
     return 0;
 }
@@ -540,7 +1348,7 @@ void tlsuv_http_set_path_prefix(tlsuv_http_t *clt, const char *prefix) {
 }
 
 int tlsuv_http_init(uv_loop_t *l, tlsuv_http_t *clt, const char *url) {
-    tcp_src_t *src = calloc(1, sizeof(tcp_src_t));
+    tcp_src_t *src = tlsuv__calloc(1, sizeof(tcp_src_t));
     tcp_src_init(l, src);
     tcp_src_nodelay(src, 1);
     tcp_src_keepalive(src, 1, 3);
@@ -554,6 +1362,73 @@ int tlsuv_http_connect_timeout(tlsuv_http_t *clt, long millis) {
     return 0;
 }
 
+int tlsuv_http_set_http2(tlsuv_http_t *clt, bool enable) {
+#if defined(TLSUV_HTTP2)
+    clt->http2 = enable;
+    return 0;
+#else
+    return enable ? UV_ENOTSUP : 0;
+#endif
+}
+
+int tlsuv_http_pipelining(tlsuv_http_t *clt, size_t depth) {
+    clt->pipeline_depth = depth;
+    return 0;
+}
+
+int tlsuv_http_max_connections(tlsuv_http_t *clt, size_t max) {
+    if (max == 0) {
+        return UV_EINVAL;
+    }
+    if (max > 1 && !clt->own_src) {
+        return UV_ENOTSUP;
+    }
+    clt->max_conns = max;
+    return 0;
+}
+
+int tlsuv_http_preconnect(tlsuv_http_t *clt, size_t n, int flags) {
+    if (flags & ~(TLSUV_HTTP_PRECONNECT_KEEP | TLSUV_HTTP_PRECONNECT_RECONNECT)) {
+        return UV_EINVAL;
+    }
+    clt->warm_conns = n;
+    clt->warm_flags = n > 0 ? flags : 0;
+    clt->warm_pending = n > 0;
+    clt->warm_failed = false;
+    if (n > 0) {
+        http_sched_mark(clt);
+    }
+    return 0;
+}
+
+int tlsuv_http_stats(tlsuv_http_t *clt, tls_traffic_stats *stats) {
+    if (!clt->ssl) {
+        return UV_ENOTSUP;
+    }
+
+    int found = 0;
+    memset(stats, 0, sizeof(*stats));
+    tlsuv_http_conn_t *conn;
+    LIST_FOREACH(conn, &clt->conns, _next) {
+        if (conn->engine == NULL || conn->engine->api->stats == NULL) continue;
+
+        const tls_traffic_stats *s = conn->engine->api->stats(conn->engine->engine);
+        stats->plain_in += s->plain_in;
+        stats->plain_out += s->plain_out;
+        stats->cipher_in += s->cipher_in;
+        stats->cipher_out += s->cipher_out;
+        stats->records_in += s->records_in;
+        stats->records_out += s->records_out;
+        stats->handshakes += s->handshakes;
+        stats->handshake_failures += s->handshake_failures;
+        stats->resumptions += s->resumptions;
+        stats->has_write += s->has_write;
+        stats->buffer_allocs += s->buffer_allocs;
+        found = 1;
+    }
+    return found ? 0 : UV_ENOTSUP;
+}
+
 int tlsuv_http_idle_keepalive(tlsuv_http_t *clt, long millis) {
     clt->idle_time = millis;
     return 0;
@@ -564,61 +1439,168 @@ void tlsuv_http_set_ssl(tlsuv_http_t *clt, tls_context *tls) {
 }
 
 tlsuv_http_req_t *tlsuv_http_req(tlsuv_http_t *clt, const char *method, const char *path, tlsuv_http_resp_cb resp_cb, void *ctx) {
-    tlsuv_http_req_t *r = calloc(1, sizeof(tlsuv_http_req_t));
+    tlsuv_http_req_t *r = tlsuv__calloc(1, sizeof(tlsuv_http_req_t));
     http_req_init(r, method, path);
 
     r->client = clt;
     r->resp_cb = resp_cb;
     r->data = ctx;
 
-    // copy client headers
-    tlsuv_http_hdr *h;
-    LIST_FOREACH(h, &clt->headers, _next) {
-        set_http_header(&r->req_headers, h->name, h->value);
+    prio_tag(clt, r);
+    http_req_enqueue(clt, r);
+    http_sched_ref(clt, true);
+    http_sched_mark(clt);
+
+    return r;
+}
+
+int tlsuv_http_req_priority(tlsuv_http_req_t *req, tlsuv_http_priority prio) {
+    tlsuv_http_t *clt = req->client;
+    if (prio < TLSUV_HTTP_PRIO_DEFAULT || prio > TLSUV_HTTP_PRIO_BULK) {
+        return UV_EINVAL;
+    }
+    if (clt == NULL || req->state != created || req->conn != NULL) {
+        return UV_EINVAL;
+    }
+    if (prio == TLSUV_HTTP_PRIO_DEFAULT) {
+        prio = TLSUV_HTTP_PRIO_NORMAL;
+    }
+    if (prio == req->priority) {
+        return 0;
     }
 
-    STAILQ_INSERT_TAIL(&clt->requests, r, _next);
-    uv_timer_stop(clt->conn_timer);
-    uv_ref((uv_handle_t *) &clt->proc);
-    uv_async_send(&clt->proc);
+    // give back the share of the last request tagged in the old class
+    if (req->priority != TLSUV_HTTP_PRIO_URGENT && req->prio_tag == clt->prio_finish[req->priority]) {
+        clt->prio_finish[req->priority] -= PRIO_UNIT / clt->prio_weight[req->priority];
+    }
+    req->priority = prio;
+    prio_tag(clt, req);
+    // request waiting for retry is queued again with its new tag
+    if (!req->retry_wait) {
+        STAILQ_REMOVE(&clt->requests, req, tlsuv_http_req_s, _next);
+        http_req_enqueue(clt, req);
+    }
+    return 0;
+}
 
-    return r;
+int tlsuv_http_expect_continue(tlsuv_http_t *clt, size_t min_body, uint64_t timeout) {
+    clt->expect_min_body = min_body;
+    clt->expect_timeout = timeout;
+    return 0;
+}
+
+int tlsuv_http_priority_weight(tlsuv_http_t *clt, tlsuv_http_priority prio, unsigned int weight) {
+    if (prio == TLSUV_HTTP_PRIO_DEFAULT) {
+        prio = TLSUV_HTTP_PRIO_NORMAL;
+    }
+    if (prio <= TLSUV_HTTP_PRIO_URGENT || prio > TLSUV_HTTP_PRIO_BULK || weight < 1 || weight > 256) {
+        return UV_EINVAL;
+    }
+    clt->prio_weight[prio] = weight;
+    return 0;
 }
 
 int tlsuv_http_cancel_all(tlsuv_http_t *clt) {
-    fail_active_request(clt, UV_ECANCELED, uv_strerror(UV_ECANCELED));
-    close_connection(clt);
+    fail_all_requests(clt, UV_ECANCELED, uv_strerror(UV_ECANCELED));
+    tlsuv_http_conn_t *conn;
+    LIST_FOREACH(conn, &clt->conns, _next) {
+        close_connection(conn);
+    }
+    return 0;
+}
+
+int tlsuv_http_req_pause(tlsuv_http_req_t *req) {
+    tlsuv_http_conn_t *conn = req->conn;
+    if (conn == NULL || conn->active != req) {
+        return UV_EINVAL;
+    }
+
+    if (!conn->read_paused && conn->connected != Disconnected) {
+        conn->read_paused = true;
+        return uv_link_read_stop(&conn->http_link);
+    }
+    return 0;
+}
+
+int tlsuv_http_req_resume(tlsuv_http_req_t *req) {
+    tlsuv_http_conn_t *conn = req->conn;
+    if (conn == NULL || conn->active != req) {
+        return UV_EINVAL;
+    }
+
+    if (conn->read_paused) {
+        conn->read_paused = false;
+        return uv_link_read_start(&conn->http_link);
+    }
     return 0;
 }
 
 int tlsuv_http_req_cancel(tlsuv_http_t *clt, tlsuv_http_req_t *req) {
+    return http_req_abort(clt, req, UV_ECANCELED);
+}
+
+int http_req_abort(tlsuv_http_t *clt, tlsuv_http_req_t *req, int code) {
     tlsuv_http_req_t *r = NULL;
     STAILQ_FOREACH(r, &clt->requests, _next) {
         if (r == req) break;
     }
+    if (http_retry_dequeue(req)) {
+        r = req;
+        STAILQ_INSERT_HEAD(&clt->requests, req, _next);
+    }
+
+    tlsuv_http_conn_t *conn = req->conn;
+    bool active = conn != NULL && conn->active == req;
+
+    if (r != req && !active && conn != NULL && conn->h2 != NULL) {
+        return h2_session_cancel(conn, req, code);
+    }
 
-    if (r == req || req == clt->active) { // req is in the queue
-        if (req == clt->active) {
-            clt->active = NULL;
+    if (r != req && !active && conn != NULL) {
+        STAILQ_FOREACH(r, &conn->pipeline, _next) {
+            if (r == req) break;
+        }
+        if (r == req) {
+            // request is already on the wire, its response is discarded when it arrives
+            http_req_stop_timeouts(req);
+            req->resp.code = code;
+            req->resp.status = tlsuv__strdup(uv_strerror(req->resp.code));
+            if (req->resp_cb) {
+                req->resp_cb(&req->resp, req->data);
+            }
+            tlsuv__free(req->resp.status);
+            req->resp.status = NULL;
+            req->resp_cb = NULL;
+            req->resp.body_cb = NULL;
+            req->timing_cb = NULL;
+            return 0;
+        }
+    }
+
+    if (r == req || active) { // req is in the queue
+        if (active) {
+            conn->active = NULL;
             // since active request is being cancelled we don't want to consume what's left on the wire for it
             // and need to close connection
-            close_connection(clt);
+            close_connection(conn);
         } else {
             STAILQ_REMOVE(&clt->requests, req, tlsuv_http_req_s, _next);
         }
 
-        req->resp.code = UV_ECANCELED;
-        req->resp.status = strdup(uv_strerror(req->resp.code));
-        clear_req_body(req, req->resp.code);
+        req->resp.code = code;
+        req->resp.status = tlsuv__strdup(uv_strerror(req->resp.code));
+        http_req_clear_body(req, req->resp.code);
 
         if (req->state < headers_received) { // resp_cb has not been called yet
-            req->resp_cb(&r->resp, r->data);
+            if (req->resp_cb) {
+                req->resp_cb(&req->resp, req->data);
+            }
         } else if (req->resp.body_cb) {
             req->resp.body_cb(req, NULL, req->resp.code);
         }
 
         http_req_free(req);
-        free(req);
+        tlsuv__free(req);
         return 0;
     } else {
         return UV_EINVAL;
@@ -628,6 +1610,9 @@ int tlsuv_http_req_cancel(tlsuv_http_t *clt, tlsuv_http_req_t *req) {
 
 void tlsuv_http_header(tlsuv_http_t *clt, const char *name, const char *value) {
     set_http_header(&clt->headers, name, value);
+    // requests already written keep their reference to the old block
+    http_hdr_block_unref(clt->hdr_block);
+    clt->hdr_block = NULL;
 }
 
 int tlsuv_http_req_header(tlsuv_http_req_t *req, const char *name, const char *value) {
@@ -651,13 +1636,13 @@ int tlsuv_http_req_header(tlsuv_http_req_t *req, const char *name, const char *v
         req->req_chunked = false;
     }
 
-    set_http_header(&req->req_headers, name, value);
+    http_req_set_header(req, &req->req_headers, name, value);
     return 0;
 }
 
 void tlsuv_http_req_end(tlsuv_http_req_t *req) {
     if (req->req_chunked) {
-        struct body_chunk_s *chunk = calloc(1, sizeof(struct body_chunk_s));
+        struct body_chunk_s *chunk = tlsuv__calloc(1, sizeof(struct body_chunk_s));
 
         chunk->len = 0;
         chunk->next = NULL;
@@ -675,7 +1660,7 @@ void tlsuv_http_req_end(tlsuv_http_req_t *req) {
             prev->next = chunk;
         }
 
-        uv_async_send(&req->client->proc);
+        http_sched_mark(req->client);
     }
 }
 
@@ -688,7 +1673,7 @@ int tlsuv_http_req_data(tlsuv_http_req_t *req, const char *body, size_t bodylen,
         return UV_EINVAL;
     }
 
-    struct body_chunk_s *chunk = calloc(1, sizeof(struct body_chunk_s));
+    struct body_chunk_s *chunk = tlsuv__calloc(1, sizeof(struct body_chunk_s));
     chunk->chunk = body;
     chunk->len = bodylen;
     chunk->cb = cb;
@@ -707,32 +1692,60 @@ int tlsuv_http_req_data(tlsuv_http_req_t *req, const char *body, size_t bodylen,
         prev->next = chunk;
     }
 
-    uv_async_send(&req->client->proc);
+    http_sched_mark(req->client);
     return 0;
 }
 
 static void free_http(tlsuv_http_t *clt) {
+    http_submit_drain(clt);
+    http_sched_detach(clt);
     free_hdr_list(&clt->headers);
-    free(clt->host);
-    if (clt->prefix) free(clt->prefix);
+    http_hdr_block_unref(clt->hdr_block);
+    clt->hdr_block = NULL;
+    tlsuv__free(clt->host);
+    if (clt->prefix) tlsuv__free(clt->prefix);
+
+    tlsuv_http_conn_t *conn, *next;
+    for (conn = LIST_FIRST(&clt->conns); conn != NULL; conn = next) {
+        next = LIST_NEXT(conn, _next);
+        if (conn->active) {
+            http_req_free(conn->active);
+            tlsuv__free(conn->active);
+            conn->active = NULL;
+        }
+        while (!STAILQ_EMPTY(&conn->pipeline)) {
+            tlsuv_http_req_t *req = STAILQ_FIRST(&conn->pipeline);
+            STAILQ_REMOVE_HEAD(&conn->pipeline, _next);
+            http_req_free(req);
+            tlsuv__free(req);
+        }
 
-    if (clt->active) {
-        http_req_free(clt->active);
-        free(clt->active);
-        clt->active = NULL;
+        LIST_REMOVE(conn, _next);
+        clt->conn_count--;
+        if (conn != &clt->conn) {
+            conn->src->release(conn->src);
+            tcp_src_free((tcp_src_t *) conn->src);
+            tlsuv__free(conn->src);
+            tlsuv__free(conn);
+        }
     }
 
     while (!STAILQ_EMPTY(&clt->requests)) {
         tlsuv_http_req_t *req = STAILQ_FIRST(&clt->requests);
         STAILQ_REMOVE_HEAD(&clt->requests, _next);
         http_req_free(req);
-        free(req);
+        tlsuv__free(req);
     }
+    um_free_inflater(clt->inflater);
+    clt->inflater = NULL;
+    http_cache_free(clt);
+    tlsuv__free(clt->resp_filter);
+    clt->resp_filter = NULL;
 
     if (clt->own_src && clt->src) {
         clt->src->release(clt->src);
         tcp_src_free((tcp_src_t *) clt->src);
-        free(clt->src);
+        tlsuv__free(clt->src);
         clt->src = NULL;
     }
 }
@@ -0,0 +1,547 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "http2.h"
+#include "http_sched.h"
+#include "um_debug.h"
+
+#if defined(TLSUV_HTTP2)
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nghttp2/nghttp2.h>
+
+#include "http_req.h"
+#include "win32_compat.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+// receive window of each stream and of the connection
+#define H2_WINDOW_SIZE (1024 * 1024)
+#define H2_WRITE_CHUNK (16 * 1024)
+
+struct h2_stream {
+    int32_t id;
+    tlsuv_http_req_t *req;
+    LIST_ENTRY(h2_stream) _next;
+};
+
+struct tlsuv_h2_s {
+    nghttp2_session *session;
+    tlsuv_http_conn_t *conn;
+
+    LIST_HEAD(h2_streams, h2_stream) streams;
+    size_t stream_count;
+
+    // nested calls into nghttp2, session can only be released by the outermost one
+    int depth;
+    // session was closed while nghttp2 was running callbacks
+    bool closed;
+};
+
+static void h2_enter(struct tlsuv_h2_s *h2) {
+    h2->depth++;
+}
+
+// returns true if session was released
+static bool h2_leave(struct tlsuv_h2_s *h2) {
+    if (--h2->depth == 0 && h2->closed) {
+        nghttp2_session_del(h2->session);
+        tlsuv__free(h2);
+        return true;
+    }
+    return false;
+}
+
+static void h2_fail_req(tlsuv_http_req_t *req, int code, const char *msg) {
+    if (req->state < headers_received) { // resp_cb has not been called yet
+        req->resp.code = code;
+        tlsuv__free(req->resp.status);
+        req->resp.status = tlsuv__strdup(msg);
+        if (req->resp_cb) {
+            req->resp_cb(&req->resp, req->data);
+        }
+    } else if (req->resp.body_cb) {
+        req->resp.body_cb(req, NULL, code);
+    }
+    http_req_clear_body(req, code);
+}
+
+static void h2_finish_req(tlsuv_http_req_t *req) {
+    if (req->timing_cb) {
+        req->timing.body_complete = uv_hrtime();
+        req->timing_cb(&req->timing, req->data);
+    }
+    http_req_free(req);
+    tlsuv__free(req);
+}
+
+static tlsuv_http_req_t *h2_detach(struct tlsuv_h2_s *h2, struct h2_stream *st) {
+    tlsuv_http_req_t *req = st->req;
+    nghttp2_session_set_stream_user_data(h2->session, st->id, NULL);
+    LIST_REMOVE(st, _next);
+    h2->stream_count--;
+    tlsuv__free(st);
+    return req;
+}
+
+static void h2_write_cb(uv_link_t *l, int status, void *arg) {
+    tlsuv__free(arg);
+}
+
+// collects pending frames into one write
+static void h2_send(struct tlsuv_h2_s *h2) {
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+
+    h2_enter(h2);
+    while (!h2->closed) {
+        const uint8_t *data;
+        ssize_t n = nghttp2_session_mem_send(h2->session, &data);
+        if (n < 0) {
+            UM_LOG(WARN, "HTTP/2 send failed: %s", nghttp2_strerror((int) n));
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        if (len + n > cap) {
+            cap = cap * 2 > len + n ? cap * 2 : len + n;
+            if (cap < H2_WRITE_CHUNK) cap = H2_WRITE_CHUNK;
+            buf = tlsuv__realloc(buf, cap);
+        }
+        memcpy(buf + len, data, n);
+        len += n;
+    }
+
+    if (len > 0 && !h2->closed) {
+        uv_buf_t b = uv_buf_init(buf, (unsigned int) len);
+        uv_link_write(&h2->conn->http_link, &b, 1, NULL, h2_write_cb, buf);
+    } else {
+        tlsuv__free(buf);
+    }
+    h2_leave(h2);
+}
+
+static int on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                     const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen,
+                     uint8_t flags, void *ctx) {
+    struct tlsuv_h2_s *h2 = ctx;
+    if (h2->closed || frame->hd.type != NGHTTP2_HEADERS) {
+        return 0;
+    }
+
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (st == NULL || st->req->state >= headers_received) { // unknown stream or trailers
+        return 0;
+    }
+
+    tlsuv_http_req_t *req = st->req;
+    // nghttp2 guarantees name and value are NUL terminated
+    if (namelen == 7 && memcmp(name, ":status", 7) == 0) {
+        req->resp.code = atoi((const char *) value);
+        snprintf(req->resp.http_version, sizeof(req->resp.http_version), "2");
+        if (req->resp.status == NULL) {
+            req->resp.status = tlsuv__strdup(""); // HTTP/2 has no reason phrase
+        }
+    } else if (name[0] != ':') {
+        http_req_resp_header(req, (const char *) name, namelen, (const char *) value, valuelen);
+    }
+    return 0;
+}
+
+static int on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame, void *ctx) {
+    struct tlsuv_h2_s *h2 = ctx;
+    if (h2->closed) {
+        return 0;
+    }
+
+    switch (frame->hd.type) {
+        case NGHTTP2_HEADERS: {
+            struct h2_stream *st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+            if (st == NULL || st->req->state >= headers_received) {
+                break;
+            }
+
+            tlsuv_http_req_t *req = st->req;
+            if (req->resp.code / 100 == 1) { // informational response, final one follows
+                http_req_clear_headers(req, &req->resp.headers);
+                break;
+            }
+
+            if (req->timing_cb && req->timing.first_byte == 0) {
+                req->timing.first_byte = uv_hrtime();
+            }
+            http_req_headers_complete(req);
+            break;
+        }
+
+        case NGHTTP2_GOAWAY:
+            UM_LOG(VERB, "received GOAWAY last_stream[%d] error[%s]", frame->goaway.last_stream_id,
+                   nghttp2_http2_strerror(frame->goaway.error_code));
+            break;
+
+        default:
+            break;
+    }
+    return 0;
+}
+
+static int on_data_chunk(nghttp2_session *session, uint8_t flags, int32_t stream_id,
+                         const uint8_t *data, size_t len, void *ctx) {
+    struct tlsuv_h2_s *h2 = ctx;
+    if (h2->closed) {
+        return 0;
+    }
+
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (st != NULL) {
+        http_req_body(st->req, (const char *) data, len);
+    }
+    return 0;
+}
+
+static int on_stream_close(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *ctx) {
+    struct tlsuv_h2_s *h2 = ctx;
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (st == NULL) {
+        return 0;
+    }
+
+    tlsuv_http_req_t *req = h2_detach(h2, st);
+    if (error_code == NGHTTP2_NO_ERROR && req->state >= headers_received) {
+        http_req_message_complete(req);
+    } else {
+        UM_LOG(DEBG, "stream[%d] closed before response completed: %s", stream_id, nghttp2_http2_strerror(error_code));
+        if (http_retry_intercept(req, UV_ECONNRESET)) {
+            req = NULL;
+        } else {
+            h2_fail_req(req, UV_ECONNRESET, nghttp2_http2_strerror(error_code));
+        }
+    }
+    if (req) {
+        h2_finish_req(req);
+    }
+
+    if (!h2->closed) {
+        http_sched_mark(h2->conn->client);
+    }
+    return 0;
+}
+
+// request body is taken from queued chunks, stream is deferred until more chunks arrive
+static ssize_t read_body(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                         uint32_t *data_flags, nghttp2_data_source *source, void *ctx) {
+    struct h2_stream *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (st == NULL) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+
+    tlsuv_http_req_t *req = st->req;
+    http_req_encode_body(req);
+    size_t n = 0;
+    while (req->req_body != NULL && n < length) {
+        struct body_chunk_s *b = req->req_body;
+        if (b->len == 0) { // empty chunk terminates chunked body
+            req->req_body = b->next;
+            if (req->req_chunked) {
+                req->state = body_sent;
+            }
+            tlsuv__free(b);
+            continue;
+        }
+
+        size_t count = b->len - b->offset;
+        if (count > length - n) {
+            count = length - n;
+        }
+        memcpy(buf + n, b->chunk + b->offset, count);
+        n += count;
+        b->offset += count;
+        req->body_sent_size += count;
+
+        if (b->offset == b->len) {
+            req->req_body = b->next;
+            if (b->cb) {
+                b->cb(req, b->chunk, 0);
+            }
+            tlsuv__free(b);
+        }
+    }
+
+    if (!req->req_chunked && req->body_sent_size >= (size_t) req->req_body_size) {
+        req->state = body_sent;
+    }
+
+    if (req->state >= body_sent) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    } else if (n == 0) {
+        return NGHTTP2_ERR_DEFERRED;
+    }
+    return (ssize_t) n;
+}
+
+static bool skip_header(const char *name) {
+    // connection specific headers are not allowed in HTTP/2, Host is sent as :authority
+    static const char *skipped[] = {
+            "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "host", "te", NULL
+    };
+    for (int i = 0; skipped[i] != NULL; i++) {
+        if (strcasecmp(name, skipped[i]) == 0) return true;
+    }
+    return false;
+}
+
+static void set_nv(nghttp2_nv *nv, const char *name, const char *value) {
+    nv->name = (uint8_t *) name;
+    nv->namelen = strlen(name);
+    nv->value = (uint8_t *) value;
+    nv->valuelen = strlen(value);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+}
+
+int h2_session_start(tlsuv_http_conn_t *conn) {
+    nghttp2_session_callbacks *cbs;
+    if (nghttp2_session_callbacks_new(&cbs) != 0) {
+        return UV_ENOMEM;
+    }
+    nghttp2_session_callbacks_set_on_header_callback(cbs, on_header);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, on_frame_recv);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cbs, on_data_chunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback(cbs, on_stream_close);
+
+    struct tlsuv_h2_s *h2 = tlsuv__calloc(1, sizeof(*h2));
+    h2->conn = conn;
+    LIST_INIT(&h2->streams);
+
+    int rc = nghttp2_session_client_new(&h2->session, cbs, h2);
+    nghttp2_session_callbacks_del(cbs);
+    if (rc != 0) {
+        UM_LOG(WARN, "failed to create HTTP/2 session: %s", nghttp2_strerror(rc));
+        tlsuv__free(h2);
+        return UV_ENOMEM;
+    }
+
+    nghttp2_settings_entry settings[] = {
+            {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+            {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, H2_WINDOW_SIZE},
+    };
+    nghttp2_submit_settings(h2->session, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0]));
+    nghttp2_session_set_local_window_size(h2->session, NGHTTP2_FLAG_NONE, 0, H2_WINDOW_SIZE);
+
+    UM_LOG(VERB, "starting HTTP/2 session");
+    conn->h2 = h2;
+    h2_send(h2);
+    return 0;
+}
+
+int h2_session_read(tlsuv_http_conn_t *conn, const char *data, size_t len) {
+    struct tlsuv_h2_s *h2 = conn->h2;
+    h2_enter(h2);
+    ssize_t rc = nghttp2_session_mem_recv(h2->session, (const uint8_t *) data, len);
+    if (h2_leave(h2)) { // closed by one of the callbacks
+        return 0;
+    }
+
+    if (rc < 0) {
+        UM_LOG(WARN, "HTTP/2 session error: %s", nghttp2_strerror((int) rc));
+        return UV_EPROTO;
+    }
+
+    h2_send(h2);
+    if (!nghttp2_session_want_read(h2->session) && !nghttp2_session_want_write(h2->session)) {
+        UM_LOG(VERB, "HTTP/2 session is done");
+        return UV_EOF;
+    }
+    return 0;
+}
+
+int h2_session_submit(tlsuv_http_conn_t *conn, tlsuv_http_req_t *req) {
+    struct tlsuv_h2_s *h2 = conn->h2;
+    tlsuv_http_t *clt = conn->client;
+
+    http_req_body_length(req);
+
+    // client headers first, unless request replaces them
+    const um_header_list *lists[] = { &clt->headers, &req->req_headers };
+    size_t count = 0;
+    tlsuv_http_hdr *h;
+    for (int l = 0; l < 2; l++) {
+        LIST_FOREACH(h, lists[l], _next) {
+            count++;
+        }
+    }
+
+    const char *authority = clt->host;
+    nghttp2_nv *nva = tlsuv__calloc(count + 4, sizeof(nghttp2_nv));
+    char **names = tlsuv__calloc(count + 1, sizeof(char *));
+    size_t n = 4, i = 0;
+    for (int l = 0; l < 2; l++) {
+        LIST_FOREACH(h, lists[l], _next) {
+            if (l == 0 && !http_req_client_header_used(req, h->name)) continue;
+            if (strcasecmp(h->name, "host") == 0) {
+                authority = h->value;
+            }
+            if (skip_header(h->name)) continue;
+
+            // header names must be lowercase
+            names[i] = tlsuv__strdup(h->name);
+            for (char *p = names[i]; *p; p++) *p = (char) tolower((unsigned char) *p);
+            set_nv(&nva[n++], names[i++], h->value);
+        }
+    }
+
+    char *target = http_req_target(req);
+    set_nv(&nva[0], ":method", req->method);
+    set_nv(&nva[1], ":scheme", clt->ssl ? "https" : "http");
+    set_nv(&nva[2], ":authority", authority);
+    set_nv(&nva[3], ":path", target);
+
+    struct h2_stream *st = tlsuv__calloc(1, sizeof(*st));
+    st->req = req;
+
+    bool has_body = req->req_chunked || req->req_body_size > 0;
+    nghttp2_data_provider body = {
+            .source.ptr = req,
+            .read_callback = read_body,
+    };
+    nghttp2_priority_spec pri;
+    int32_t weight = req->priority == TLSUV_HTTP_PRIO_URGENT ? NGHTTP2_MAX_WEIGHT : (int32_t) clt->prio_weight[req->priority];
+    nghttp2_priority_spec_init(&pri, 0, weight, 0);
+    int32_t id = nghttp2_submit_request(h2->session, &pri, nva, n, has_body ? &body : NULL, st);
+
+    tlsuv__free(target);
+    for (i = 0; names[i] != NULL; i++) tlsuv__free(names[i]);
+    tlsuv__free(names);
+    tlsuv__free(nva);
+
+    if (id < 0) {
+        UM_LOG(WARN, "failed to submit request[%s]: %s", req->path, nghttp2_strerror(id));
+        tlsuv__free(st);
+        return UV_EINVAL;
+    }
+
+    UM_LOG(VERB, "request[%s] sent on stream[%d]", req->path, id);
+    st->id = id;
+    LIST_INSERT_HEAD(&h2->streams, st, _next);
+    h2->stream_count++;
+    req->state = has_body ? headers_sent : body_sent;
+    http_req_written(req);
+
+    h2_send(h2);
+    return 0;
+}
+
+void h2_session_flush(tlsuv_http_conn_t *conn) {
+    struct tlsuv_h2_s *h2 = conn->h2;
+    struct h2_stream *st;
+    LIST_FOREACH(st, &h2->streams, _next) {
+        if (st->req->state < body_sent && st->req->req_body != NULL) {
+            nghttp2_session_resume_data(h2->session, st->id);
+        }
+    }
+    h2_send(h2);
+}
+
+bool h2_session_available(tlsuv_http_conn_t *conn) {
+    struct tlsuv_h2_s *h2 = conn->h2;
+    return nghttp2_session_check_request_allowed(h2->session) &&
+           h2->stream_count < nghttp2_session_get_remote_settings(h2->session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+}
+
+size_t h2_session_streams(tlsuv_http_conn_t *conn) {
+    return conn->h2 ? conn->h2->stream_count : 0;
+}
+
+int h2_session_cancel(tlsuv_http_conn_t *conn, tlsuv_http_req_t *req, int code) {
+    struct tlsuv_h2_s *h2 = conn->h2;
+    struct h2_stream *st;
+    LIST_FOREACH(st, &h2->streams, _next) {
+        if (st->req == req) break;
+    }
+    if (st == NULL) {
+        return UV_EINVAL;
+    }
+
+    nghttp2_submit_rst_stream(h2->session, NGHTTP2_FLAG_NONE, st->id, NGHTTP2_CANCEL);
+    h2_detach(h2, st);
+
+    h2_enter(h2);
+    h2_fail_req(req, code, uv_strerror(code));
+    http_req_free(req);
+    tlsuv__free(req);
+    if (!h2_leave(h2)) {
+        h2_send(h2);
+    }
+    return 0;
+}
+
+void h2_session_close(tlsuv_http_conn_t *conn, int code, const char *msg) {
+    struct tlsuv_h2_s *h2 = conn->h2;
+    if (h2 == NULL || h2->closed) {
+        return;
+    }
+
+    conn->h2 = NULL;
+    h2->closed = true;
+    h2_enter(h2);
+    while (!LIST_EMPTY(&h2->streams)) {
+        tlsuv_http_req_t *req = h2_detach(h2, LIST_FIRST(&h2->streams));
+        if (http_retry_intercept(req, code)) {
+            continue;
+        }
+        h2_fail_req(req, code, msg);
+        h2_finish_req(req);
+    }
+    h2_leave(h2);
+}
+
+#else
+
+int h2_session_start(tlsuv_http_conn_t *conn) {
+    return UV_ENOTSUP;
+}
+
+int h2_session_read(tlsuv_http_conn_t *conn, const char *data, size_t len) {
+    return UV_ENOTSUP;
+}
+
+int h2_session_submit(tlsuv_http_conn_t *conn, tlsuv_http_req_t *req) {
+    return UV_ENOTSUP;
+}
+
+void h2_session_flush(tlsuv_http_conn_t *conn) {
+}
+
+bool h2_session_available(tlsuv_http_conn_t *conn) {
+    return false;
+}
+
+size_t h2_session_streams(tlsuv_http_conn_t *conn) {
+    return 0;
+}
+
+int h2_session_cancel(tlsuv_http_conn_t *conn, tlsuv_http_req_t *req, int code) {
+    return UV_EINVAL;
+}
+
+void h2_session_close(tlsuv_http_conn_t *conn, int code, const char *msg) {
+}
+
+#endif
@@ -0,0 +1,66 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_HTTP2_H
+#define TLSUV_HTTP2_H
+
+#include <stdbool.h>
+#include <tlsuv/http.h>
+
+/*
+ * HTTP/2 session of a client connection (ALPN "h2"), requests are multiplexed as streams.
+ * Built with nghttp2 when TLSUV_HTTP2 is defined, otherwise session cannot be started.
+ */
+
+/**
+ * Starts HTTP/2 session on connected connection, sends connection preface and settings.
+ * @returns 0, or UV_ENOTSUP if library is built without HTTP/2
+ */
+int h2_session_start(tlsuv_http_conn_t *conn);
+
+/**
+ * Feeds data received on the connection to the session.
+ * @returns 0, or error code if connection has to be closed
+ */
+int h2_session_read(tlsuv_http_conn_t *conn, const char *data, size_t len);
+
+/**
+ * Opens stream for the request. Request is owned by the session until it completes or fails.
+ */
+int h2_session_submit(tlsuv_http_conn_t *conn, tlsuv_http_req_t *req);
+
+/**
+ * Resumes request bodies that got new data and writes pending frames.
+ */
+void h2_session_flush(tlsuv_http_conn_t *conn);
+
+/** Checks if session can take another stream (peer concurrency limit, GOAWAY) */
+bool h2_session_available(tlsuv_http_conn_t *conn);
+
+/** Number of open streams */
+size_t h2_session_streams(tlsuv_http_conn_t *conn);
+
+/**
+ * Resets stream of the request, request fails with `code`.
+ * @returns 0, or UV_EINVAL if request is not on this session
+ */
+int h2_session_cancel(tlsuv_http_conn_t *conn, tlsuv_http_req_t *req, int code);
+
+/**
+ * Fails all open streams with `code` and releases the session.
+ */
+void h2_session_close(tlsuv_http_conn_t *conn, int code, const char *msg);
+
+#endif//TLSUV_HTTP2_H
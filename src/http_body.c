@@ -0,0 +1,496 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_req.h"
+#include "pool.h"
+#include "um_debug.h"
+#include <tlsuv/tcp_src.h>
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+// read-ahead is bounded by number of buffers waiting to be written
+#define BODY_SRC_BUF_SZ (32 * 1024)
+#define BODY_SRC_BUFFERS 4
+// max bytes handed to single sendfile() call
+#define BODY_SRC_SENDFILE_SZ (1024 * 1024)
+
+struct http_body_src_s {
+    // NULL once request is released, source is freed when its reads and writes are done
+    tlsuv_http_req_t *req;
+    uv_loop_t *loop;
+    uv_timer_t *tick;
+
+    uv_file fd;
+    int64_t offset;
+    tlsuv_http_body_read_cb read_cb;
+    void *ctx;
+
+    // bytes left to produce, -1 if generator length is unknown (chunked encoding)
+    int64_t remaining;
+    unsigned int buffers;
+    bool busy;
+    bool eof;
+    bool use_sendfile;
+    // sendfile() would block, next buffer goes through the link to wait for socket to drain
+    bool sendfile_blocked;
+    uv_fs_t fs;
+    struct src_buf_s *reading;
+};
+
+struct src_buf_s {
+    struct http_body_src_s *src;
+    char data[];
+};
+
+static void src_tick(uv_timer_t *t);
+
+static void src_schedule(struct http_body_src_s *src) {
+    uv_timer_start(src->tick, src_tick, 0, 0);
+}
+
+static void src_free(struct http_body_src_s *src) {
+    uv_close((uv_handle_t *) src->tick, (uv_close_cb) tlsuv__free);
+    tlsuv__free(src);
+}
+
+static void src_fail(struct http_body_src_s *src, int err) {
+    tlsuv_http_req_t *req = src->req;
+    UM_LOG(WARN, "request[%s] body source failed: %d(%s)", req->path, err, uv_strerror(err));
+    src->eof = true;
+    tlsuv_http_req_cancel(req->client, req);
+}
+
+static void src_buf_cb(tlsuv_http_req_t *req, const char *chunk, ssize_t status) {
+    struct src_buf_s *b = (struct src_buf_s *) (chunk - offsetof(struct src_buf_s, data));
+    struct http_body_src_s *src = b->src;
+    tlsuv_pool_free(b);
+
+    src->buffers--;
+    if (status < 0) {
+        src->eof = true;
+    }
+    src_schedule(src);
+}
+
+static void src_produced(struct http_body_src_s *src, struct src_buf_s *b, ssize_t len) {
+    if (len == 0) {
+        tlsuv_pool_free(b);
+        src->eof = true;
+        if (src->remaining > 0) {
+            src_fail(src, UV_EOF);
+        } else if (src->req->req_chunked) {
+            tlsuv_http_req_end(src->req);
+        }
+        return;
+    }
+
+    if (src->remaining > 0) {
+        src->remaining -= len;
+        src->eof = src->remaining == 0;
+    }
+    src->offset += len;
+    src->buffers++;
+    src->sendfile_blocked = false;
+    tlsuv_http_req_data(src->req, b->data, len, src_buf_cb);
+
+    if (src->eof && src->req->req_chunked) {
+        tlsuv_http_req_end(src->req);
+    }
+}
+
+static void src_read_cb(uv_fs_t *fs) {
+    struct http_body_src_s *src = fs->data;
+    struct src_buf_s *b = src->reading;
+    ssize_t rc = fs->result;
+    uv_fs_req_cleanup(fs);
+    src->reading = NULL;
+    src->busy = false;
+
+    if (src->req == NULL) {
+        tlsuv_pool_free(b);
+    } else if (rc < 0) {
+        tlsuv_pool_free(b);
+        src_fail(src, (int) rc);
+    } else {
+        src_produced(src, b, rc);
+    }
+    src_schedule(src);
+}
+
+// kTLS encrypts in kernel, so file pages can go to the socket without passing through user space
+static uv_os_fd_t ktls_socket(struct http_body_src_s *src) {
+    tlsuv_http_req_t *req = src->req;
+    tlsuv_http_conn_t *conn = req->conn;
+    uv_os_fd_t sock;
+    if (!src->use_sendfile || src->sendfile_blocked || req->req_chunked ||
+        conn == NULL || conn->active != req || conn->h2 != NULL || req->state < headers_sent || req->expect_wait ||
+        req->req_body != NULL || src->buffers > 0 ||
+        !conn->client->own_src || !conn->tls_link.ktls_tx) {
+        return (uv_os_fd_t) -1;
+    }
+
+    uv_stream_t *s = (uv_stream_t *) ((tcp_src_t *) conn->src)->conn;
+    if (s == NULL || uv_stream_get_write_queue_size(s) > 0 || uv_fileno((uv_handle_t *) s, &sock) != 0) {
+        return (uv_os_fd_t) -1;
+    }
+    return sock;
+}
+
+static void src_sendfile_cb(uv_fs_t *fs) {
+    struct http_body_src_s *src = fs->data;
+    ssize_t rc = fs->result;
+    uv_fs_req_cleanup(fs);
+    src->busy = false;
+
+    if (src->req == NULL) {
+        src_schedule(src);
+        return;
+    }
+
+    if (rc > 0) {
+        UM_LOG(VERB, "request[%s] sent %zd body bytes with sendfile", src->req->path, rc);
+        src->offset += rc;
+        src->remaining -= rc;
+        src->req->body_sent_size += rc;
+        if (src->remaining == 0) {
+            src->eof = true;
+            src->req->state = body_sent;
+        }
+    } else if (rc == UV_EAGAIN || rc == 0) {
+        src->sendfile_blocked = true;
+    } else {
+        UM_LOG(VERB, "sendfile failed: %zd(%s), falling back to buffered writes", rc, uv_strerror((int) rc));
+        src->use_sendfile = false;
+    }
+    src_schedule(src);
+}
+
+static void src_tick(uv_timer_t *t) {
+    struct http_body_src_s *src = t->data;
+    if (src->req == NULL) {
+        if (!src->busy && src->buffers == 0) {
+            src_free(src);
+        }
+        return;
+    }
+
+    while (!src->eof && !src->busy && src->buffers < BODY_SRC_BUFFERS) {
+        uv_os_fd_t sock = ktls_socket(src);
+        if (sock != (uv_os_fd_t) -1) {
+            size_t len = src->remaining < BODY_SRC_SENDFILE_SZ ? (size_t) src->remaining : BODY_SRC_SENDFILE_SZ;
+            src->busy = true;
+            src->fs.data = src;
+            int rc = uv_fs_sendfile(src->loop, &src->fs, (uv_file) sock, src->fd, src->offset, len, src_sendfile_cb);
+            if (rc != 0) {
+                src->busy = false;
+                src->use_sendfile = false;
+                continue;
+            }
+            return;
+        }
+
+        size_t len = BODY_SRC_BUF_SZ;
+        if (src->remaining >= 0 && (int64_t) len > src->remaining) {
+            len = (size_t) src->remaining;
+        }
+        struct src_buf_s *b = tlsuv_pool_alloc(sizeof(struct src_buf_s) + len);
+        b->src = src;
+
+        if (src->read_cb) {
+            ssize_t rc = src->read_cb(src->req, b->data, len, src->ctx);
+            if (rc < 0) {
+                tlsuv_pool_free(b);
+                src_fail(src, (int) rc);
+                return;
+            }
+            src_produced(src, b, rc);
+        } else {
+            uv_buf_t buf = uv_buf_init(b->data, (unsigned int) len);
+            src->busy = true;
+            src->reading = b;
+            src->fs.data = src;
+            int rc = uv_fs_read(src->loop, &src->fs, src->fd, &buf, 1, src->offset, src_read_cb);
+            if (rc != 0) {
+                src->busy = false;
+                src->reading = NULL;
+                tlsuv_pool_free(b);
+                src_fail(src, rc);
+            }
+            return;
+        }
+    }
+}
+
+static int src_start(tlsuv_http_req_t *req, int64_t length, struct http_body_src_s *src) {
+    if (strcmp(req->method, "POST") != 0 && strcmp(req->method, "PUT") != 0) {
+        return UV_EINVAL;
+    }
+    if (req->body_src != NULL || req->req_body != NULL || req->state > created) {
+        return UV_EINVAL;
+    }
+
+    int rc;
+    if (length >= 0) {
+        char len_str[24];
+        snprintf(len_str, sizeof(len_str), "%" PRId64, length);
+        rc = tlsuv_http_req_header(req, "Content-Length", len_str);
+    } else {
+        rc = tlsuv_http_req_header(req, "Transfer-Encoding", "chunked");
+    }
+    if (rc != 0) {
+        return rc;
+    }
+
+    struct http_body_src_s *s = tlsuv__calloc(1, sizeof(*s));
+    *s = *src;
+    s->req = req;
+    s->loop = req->client->loop;
+    s->remaining = length;
+    s->eof = length == 0;
+    s->tick = tlsuv__calloc(1, sizeof(uv_timer_t));
+    uv_timer_init(s->loop, s->tick);
+    s->tick->data = s;
+    req->body_src = s;
+
+    // start reading ahead while connection is being established
+    src_schedule(s);
+    return 0;
+}
+
+int tlsuv_http_req_body_file(tlsuv_http_req_t *req, uv_file fd, int64_t offset, int64_t length) {
+    if (length < 0) {
+        return UV_EINVAL;
+    }
+    struct http_body_src_s src = {
+            .fd = fd,
+            .offset = offset,
+            .use_sendfile = true,
+    };
+    return src_start(req, length, &src);
+}
+
+int tlsuv_http_req_body_source(tlsuv_http_req_t *req, int64_t length, tlsuv_http_body_read_cb read_cb, void *ctx) {
+    if (read_cb == NULL) {
+        return UV_EINVAL;
+    }
+    struct http_body_src_s src = {
+            .fd = -1,
+            .read_cb = read_cb,
+            .ctx = ctx,
+    };
+    return src_start(req, length, &src);
+}
+
+void http_body_src_release(struct http_body_src_s *src) {
+    src->req = NULL;
+    src->eof = true;
+    src_schedule(src);
+}
+
+// default amount of response body waiting for disk before connection reads are paused
+#define BODY_SINK_WINDOW (1024 * 1024)
+
+struct http_body_sink_s {
+    // NULL once response is complete, sink is freed when its writes are done
+    tlsuv_http_req_t *req;
+    uv_loop_t *loop;
+    uv_file fd;
+    int64_t offset;
+    uint64_t written;
+
+    size_t window;
+    size_t pending;
+    unsigned int ops;
+    bool paused;
+    bool done;
+    int status;
+
+    tlsuv_http_sink_cb cb;
+    void *ctx;
+};
+
+struct sink_write_s {
+    uv_fs_t fs;
+    struct http_body_sink_s *sink;
+    size_t len;
+    char data[];
+};
+
+static void sink_check_done(struct http_body_sink_s *sink) {
+    if (!sink->done || sink->ops > 0) {
+        return;
+    }
+    if (sink->cb) {
+        sink->cb(sink->ctx, sink->status, sink->written);
+    }
+    tlsuv__free(sink);
+}
+
+static void sink_stop(struct http_body_sink_s *sink, int status) {
+    if (sink->req) {
+        sink->req->body_sink = NULL;
+        sink->req = NULL;
+    }
+    if (sink->status == 0) {
+        sink->status = status;
+    }
+    sink->done = true;
+    sink_check_done(sink);
+}
+
+static void sink_write_cb(uv_fs_t *fs) {
+    struct sink_write_s *wr = fs->data;
+    struct http_body_sink_s *sink = wr->sink;
+    ssize_t rc = fs->result;
+    uv_fs_req_cleanup(fs);
+
+    sink->ops--;
+    sink->pending -= wr->len;
+    tlsuv_pool_free(wr);
+
+    if (rc < 0) {
+        UM_LOG(WARN, "response body write failed: %zd(%s)", rc, uv_strerror((int) rc));
+        if (sink->status == 0) {
+            sink->status = (int) rc;
+        }
+        if (sink->req) {
+            tlsuv_http_req_t *req = sink->req;
+            sink_stop(sink, (int) rc);
+            tlsuv_http_req_cancel(req->client, req);
+            return;
+        }
+    } else {
+        sink->written += rc;
+    }
+
+    if (sink->paused && sink->req && sink->pending <= sink->window / 2) {
+        sink->paused = false;
+        tlsuv_http_req_resume(sink->req);
+    }
+    sink_check_done(sink);
+}
+
+static void sink_body_cb(tlsuv_http_req_t *req, const char *body, ssize_t len) {
+    struct http_body_sink_s *sink = req->body_sink;
+    if (sink == NULL) {
+        return;
+    }
+
+    if (len < 0) {
+        sink_stop(sink, len == UV_EOF ? 0 : (int) len);
+        return;
+    }
+
+    struct sink_write_s *wr = tlsuv_pool_alloc(sizeof(struct sink_write_s) + len);
+    memcpy(wr->data, body, len);
+    wr->len = len;
+    wr->sink = sink;
+    wr->fs.data = wr;
+
+    uv_buf_t buf = uv_buf_init(wr->data, (unsigned int) len);
+    int rc = uv_fs_write(sink->loop, &wr->fs, sink->fd, &buf, 1, sink->offset, sink_write_cb);
+    if (rc != 0) {
+        tlsuv_pool_free(wr);
+        sink_stop(sink, rc);
+        tlsuv_http_req_cancel(req->client, req);
+        return;
+    }
+    sink->offset += len;
+    sink->pending += len;
+    sink->ops++;
+
+    if (!sink->paused && sink->pending >= sink->window) {
+        UM_LOG(VERB, "request[%s] %zu body bytes waiting for disk, pausing reads", req->path, sink->pending);
+        sink->paused = tlsuv_http_req_pause(req) == 0;
+    }
+}
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#include <fcntl.h>
+
+struct sink_alloc_s {
+    uv_work_t work;
+    struct http_body_sink_s *sink;
+    int64_t offset;
+    int64_t len;
+};
+
+static void sink_alloc_work(uv_work_t *w) {
+    struct sink_alloc_s *a = (struct sink_alloc_s *) w;
+    // advisory, file is extended by writes anyway
+    (void) posix_fallocate(a->sink->fd, a->offset, a->len);
+}
+
+static void sink_alloc_done(uv_work_t *w, int status) {
+    struct sink_alloc_s *a = (struct sink_alloc_s *) w;
+    struct http_body_sink_s *sink = a->sink;
+    tlsuv__free(a);
+    sink->ops--;
+    sink_check_done(sink);
+}
+
+static void sink_preallocate(struct http_body_sink_s *sink, int64_t len) {
+    struct sink_alloc_s *a = tlsuv__calloc(1, sizeof(*a));
+    a->sink = sink;
+    a->offset = sink->offset;
+    a->len = len;
+    if (uv_queue_work(sink->loop, &a->work, sink_alloc_work, sink_alloc_done) == 0) {
+        sink->ops++;
+    } else {
+        tlsuv__free(a);
+    }
+}
+#else
+static void sink_preallocate(struct http_body_sink_s *sink, int64_t len) {
+}
+#endif
+
+int tlsuv_http_resp_sink(tlsuv_http_resp_t *resp, uv_file fd, int64_t offset, size_t window,
+                         tlsuv_http_sink_cb cb, void *ctx) {
+    tlsuv_http_req_t *req = resp->req;
+    if (req == NULL || req->body_sink != NULL || req->state >= completed) {
+        return UV_EINVAL;
+    }
+
+    struct http_body_sink_s *sink = tlsuv__calloc(1, sizeof(*sink));
+    sink->req = req;
+    sink->loop = req->client->loop;
+    sink->fd = fd;
+    sink->offset = offset;
+    sink->window = window > 0 ? window : BODY_SINK_WINDOW;
+    sink->cb = cb;
+    sink->ctx = ctx;
+    req->body_sink = sink;
+    resp->body_cb = sink_body_cb;
+
+    // decoded length is not known in advance for compressed bodies
+    const char *length = tlsuv_http_resp_header(resp, "Content-Length");
+    if (length && tlsuv_http_resp_header(resp, "Content-Encoding") == NULL) {
+        int64_t len = strtoll(length, NULL, 10);
+        if (len > 0) {
+            sink_preallocate(sink, len);
+        }
+    }
+    return 0;
+}
+
+void http_body_sink_release(struct http_body_sink_s *sink) {
+    sink_stop(sink, UV_ECANCELED);
+}
@@ -0,0 +1,516 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_cache.h"
+#include "http_req.h"
+#include "um_debug.h"
+#include "win32_compat.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+struct http_cache_entry_s {
+    // request key: method and request target
+    char *key;
+    int code;
+    char *status;
+    char http_version[8];
+    um_header_list headers;
+    char *body;
+    size_t body_len;
+    // accounted size of the entry
+    size_t size;
+
+    // freshness lifetime and loop time (ms) when entry becomes stale
+    uint64_t lifetime;
+    uint64_t expires;
+
+    // cache holds one reference while entry is linked, requests using it hold the others
+    int refs;
+    bool linked;
+    TAILQ_ENTRY(http_cache_entry_s) _next;
+};
+
+struct tlsuv_http_cache_s {
+    size_t max_size;
+    size_t size;
+    // incremented when cache is cleared, responses requested before are not stored
+    unsigned int gen;
+    TAILQ_HEAD(cache_lru, http_cache_entry_s) lru;
+};
+
+// cache state of GET request
+struct http_cache_req_s {
+    // entry answering or being revalidated by the request
+    struct http_cache_entry_s *entry;
+    unsigned int gen;
+    bool bypass;
+    bool revalidated;
+
+    // captured response body
+    bool capturing;
+    tlsuv_http_body_cb body_cb;
+    uint64_t lifetime;
+    char *body;
+    size_t len;
+    size_t cap;
+};
+
+struct cache_control {
+    bool no_store;
+    bool no_cache;
+    // seconds, -1 if not set
+    long max_age;
+};
+
+static void parse_cache_control(const char *val, struct cache_control *cc) {
+    cc->no_store = false;
+    cc->no_cache = false;
+    cc->max_age = -1;
+
+    const char *p = val;
+    while (p && *p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t) (end - p) : strlen(p);
+
+        if (len >= 8 && strncasecmp(p, "no-store", 8) == 0) {
+            cc->no_store = true;
+        } else if (len >= 8 && strncasecmp(p, "no-cache", 8) == 0) {
+            cc->no_cache = true;
+        } else if (len > 8 && strncasecmp(p, "max-age=", 8) == 0) {
+            cc->max_age = strtol(p + 8, NULL, 10);
+        }
+        p = end;
+    }
+}
+
+static const char *find_header(const um_header_list *hl, const char *name) {
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, hl, _next) {
+        if (strcasecmp(h->name, name) == 0) return h->value;
+    }
+    return NULL;
+}
+
+// stored body is decoded, and its framing is set when it is served
+static bool stored_header(const char *name) {
+    static const char *skip[] = {
+            "connection",
+            "content-encoding",
+            "content-length",
+            "keep-alive",
+            "transfer-encoding",
+    };
+    for (size_t i = 0; i < sizeof(skip) / sizeof(skip[0]); i++) {
+        if (strcasecmp(name, skip[i]) == 0) return false;
+    }
+    return true;
+}
+
+bool http_cache_header(const char *name) {
+    static const char *used[] = {
+            "age",
+            "cache-control",
+            "etag",
+            "last-modified",
+            "vary",
+    };
+    for (size_t i = 0; i < sizeof(used) / sizeof(used[0]); i++) {
+        if (strcasecmp(name, used[i]) == 0) return true;
+    }
+    return false;
+}
+
+// only variance by Accept-Encoding is supported, cached body is already decoded
+static bool vary_supported(const char *vary) {
+    const char *p = vary;
+    while (p && *p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        const char *end = p;
+        while (*end && *end != ',' && *end != ' ' && *end != '\t') end++;
+        if (end > p && !((size_t) (end - p) == strlen("accept-encoding") &&
+                         strncasecmp(p, "accept-encoding", end - p) == 0)) {
+            return false;
+        }
+        p = end;
+    }
+    return true;
+}
+
+static uint64_t cache_now(tlsuv_http_t *clt) {
+    return uv_now(clt->loop);
+}
+
+static void entry_unref(struct http_cache_entry_s *e) {
+    if (e == NULL || --e->refs > 0) return;
+
+    free_hdr_list(&e->headers);
+    tlsuv__free(e->key);
+    tlsuv__free(e->status);
+    tlsuv__free(e->body);
+    tlsuv__free(e);
+}
+
+static void entry_unlink(struct tlsuv_http_cache_s *cache, struct http_cache_entry_s *e) {
+    TAILQ_REMOVE(&cache->lru, e, _next);
+    cache->size -= e->size;
+    e->linked = false;
+    entry_unref(e);
+}
+
+static struct http_cache_entry_s *cache_find(struct tlsuv_http_cache_s *cache, const char *key) {
+    struct http_cache_entry_s *e;
+    TAILQ_FOREACH(e, &cache->lru, _next) {
+        if (strcmp(e->key, key) == 0) return e;
+    }
+    return NULL;
+}
+
+static char *request_key(tlsuv_http_req_t *req) {
+    char *target = http_req_target(req);
+    size_t len = strlen(req->method) + 1 + strlen(target) + 1;
+    char *key = tlsuv__malloc(len);
+    snprintf(key, len, "%s %s", req->method, target);
+    tlsuv__free(target);
+    return key;
+}
+
+// Cache-Control lifetime adjusted by Age, or 0 if response must be revalidated
+static uint64_t response_lifetime(tlsuv_http_resp_t *resp, const struct cache_control *cc) {
+    if (cc->no_cache || cc->max_age <= 0) {
+        return 0;
+    }
+    long age = 0;
+    const char *age_hdr = tlsuv_http_resp_header(resp, "Age");
+    if (age_hdr) {
+        age = strtol(age_hdr, NULL, 10);
+    }
+    return cc->max_age > age ? (uint64_t) (cc->max_age - age) * 1000 : 0;
+}
+
+static void copy_headers(um_header_list *to, const um_header_list *from) {
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, from, _next) {
+        if (!stored_header(h->name)) continue;
+
+        tlsuv_http_hdr *c = tlsuv__malloc(sizeof(*c));
+        c->name = tlsuv__strdup(h->name);
+        c->value = tlsuv__strdup(h->value);
+        LIST_INSERT_HEAD(to, c, _next);
+    }
+}
+
+static void set_resp_headers(tlsuv_http_req_t *req, const struct http_cache_entry_s *e) {
+    tlsuv_http_resp_t *resp = &req->resp;
+    // connection state of revalidating response is kept, arena memory of old headers stays valid
+    const char *connection = tlsuv_http_resp_header(resp, "Connection");
+    http_req_clear_headers(req, &resp->headers);
+
+    // entry list is kept in reverse order, inserting at the head restores original one
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, &e->headers, _next) {
+        http_req_add_header(req, &resp->headers, h->name, strlen(h->name), h->value, strlen(h->value));
+    }
+    char len_str[24];
+    snprintf(len_str, sizeof(len_str), "%zu", e->body_len);
+    http_req_set_header(req, &resp->headers, "Content-Length", len_str);
+    if (connection) {
+        http_req_set_header(req, &resp->headers, "Connection", connection);
+    }
+
+    resp->code = e->code;
+    tlsuv__free(resp->status);
+    resp->status = tlsuv__strdup(e->status);
+}
+
+static void add_conditional_headers(tlsuv_http_req_t *req, const struct http_cache_entry_s *e) {
+    const char *etag = find_header(&e->headers, "ETag");
+    const char *modified = find_header(&e->headers, "Last-Modified");
+    if (etag) {
+        http_req_set_header(req, &req->req_headers, "If-None-Match", etag);
+    }
+    if (modified) {
+        http_req_set_header(req, &req->req_headers, "If-Modified-Since", modified);
+    }
+}
+
+bool http_cache_lookup(tlsuv_http_t *clt, tlsuv_http_req_t *req) {
+    struct tlsuv_http_cache_s *cache = clt->cache;
+    if (cache == NULL || req->cache != NULL || strcmp(req->method, "GET") != 0) {
+        return false;
+    }
+
+    struct http_cache_req_s *cr = tlsuv__calloc(1, sizeof(*cr));
+    cr->gen = cache->gen;
+    req->cache = cr;
+
+    // conditional and partial requests are handled by the application
+    struct cache_control cc = {0};
+    const char *req_cc = find_header(&req->req_headers, "Cache-Control");
+    if (req_cc) {
+        parse_cache_control(req_cc, &cc);
+    }
+    if (cc.no_store ||
+        find_header(&req->req_headers, "If-None-Match") ||
+        find_header(&req->req_headers, "If-Modified-Since") ||
+        find_header(&req->req_headers, "Range")) {
+        cr->bypass = true;
+        return false;
+    }
+    if (cc.no_cache) {
+        return false;
+    }
+
+    char *key = request_key(req);
+    struct http_cache_entry_s *e = cache_find(cache, key);
+    tlsuv__free(key);
+    if (e == NULL) {
+        return false;
+    }
+
+    TAILQ_REMOVE(&cache->lru, e, _next);
+    TAILQ_INSERT_HEAD(&cache->lru, e, _next);
+    e->refs++;
+    cr->entry = e;
+
+    if (cache_now(clt) < e->expires) {
+        UM_LOG(VERB, "cache hit: %s", e->key);
+        return true;
+    }
+
+    UM_LOG(VERB, "revalidating cached response: %s", e->key);
+    add_conditional_headers(req, e);
+    return false;
+}
+
+void http_cache_respond(tlsuv_http_req_t *req) {
+    struct http_cache_entry_s *e = req->cache->entry;
+
+    set_resp_headers(req, e);
+    memcpy(req->resp.http_version, e->http_version, sizeof(req->resp.http_version));
+    req->state = headers_received;
+    if (req->resp_cb) {
+        req->resp_cb(&req->resp, req->data);
+    }
+
+    req->state = completed;
+    if (req->resp.body_cb) {
+        if (e->body_len > 0) {
+            req->resp.body_cb(req, e->body, (ssize_t) e->body_len);
+        }
+        req->resp.body_cb(req, NULL, UV_EOF);
+    }
+}
+
+void http_cache_headers(tlsuv_http_req_t *req) {
+    struct http_cache_req_s *cr = req->cache;
+    if (cr == NULL || cr->entry == NULL || req->resp.code != 304) {
+        return;
+    }
+
+    struct http_cache_entry_s *e = cr->entry;
+    UM_LOG(VERB, "cached response is not modified: %s", e->key);
+
+    // not modified response updates freshness of the entry
+    const char *resp_cc = tlsuv_http_resp_header(&req->resp, "Cache-Control");
+    if (resp_cc) {
+        struct cache_control cc;
+        parse_cache_control(resp_cc, &cc);
+        e->lifetime = response_lifetime(&req->resp, &cc);
+    }
+    tlsuv_http_t *clt = req->client;
+    e->expires = cache_now(clt) + e->lifetime;
+
+    set_resp_headers(req, e);
+    cr->revalidated = true;
+}
+
+static void free_capture(struct http_cache_req_s *cr) {
+    tlsuv__free(cr->body);
+    cr->body = NULL;
+    cr->len = cr->cap = 0;
+    cr->capturing = false;
+}
+
+static void cache_store(tlsuv_http_req_t *req) {
+    struct http_cache_req_s *cr = req->cache;
+    tlsuv_http_t *clt = req->client;
+    struct tlsuv_http_cache_s *cache = clt->cache;
+
+    struct http_cache_entry_s *e = tlsuv__calloc(1, sizeof(*e));
+    e->key = request_key(req);
+    e->code = req->resp.code;
+    e->status = tlsuv__strdup(req->resp.status ? req->resp.status : "");
+    memcpy(e->http_version, req->resp.http_version, sizeof(e->http_version));
+    copy_headers(&e->headers, &req->resp.headers);
+    e->body = cr->body;
+    e->body_len = cr->len;
+    e->lifetime = cr->lifetime;
+    e->expires = cache_now(clt) + cr->lifetime;
+    e->refs = 1;
+    e->linked = true;
+    cr->body = NULL;
+    cr->capturing = false;
+
+    e->size = sizeof(*e) + strlen(e->key) + e->body_len;
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, &e->headers, _next) {
+        e->size += sizeof(*h) + strlen(h->name) + strlen(h->value) + 2;
+    }
+    if (e->size > cache->max_size) {
+        e->linked = false;
+        entry_unref(e);
+        return;
+    }
+
+    struct http_cache_entry_s *old = cache_find(cache, e->key);
+    if (old) {
+        entry_unlink(cache, old);
+    }
+
+    TAILQ_INSERT_HEAD(&cache->lru, e, _next);
+    cache->size += e->size;
+    while (cache->size > cache->max_size) {
+        struct http_cache_entry_s *last = TAILQ_LAST(&cache->lru, cache_lru);
+        UM_LOG(VERB, "evicting cached response: %s", last->key);
+        entry_unlink(cache, last);
+    }
+    UM_LOG(VERB, "cached response: %s (%zu bytes)", e->key, e->body_len);
+}
+
+static void capture_body_cb(tlsuv_http_req_t *req, const char *body, ssize_t len) {
+    struct http_cache_req_s *cr = req->cache;
+    struct tlsuv_http_cache_s *cache = req->client->cache;
+
+    if (cr->capturing && (cache == NULL || cache->gen != cr->gen)) {
+        free_capture(cr);
+    }
+
+    if (cr->capturing && len > 0) {
+        if (cr->len + len > cache->max_size) { // would never fit
+            free_capture(cr);
+        } else {
+            if (cr->len + len > cr->cap) {
+                size_t cap = cr->cap ? cr->cap * 2 : 4096;
+                while (cap < cr->len + len) cap *= 2;
+                cr->body = tlsuv__realloc(cr->body, cap);
+                cr->cap = cap;
+            }
+            memcpy(cr->body + cr->len, body, len);
+            cr->len += len;
+        }
+    } else if (cr->capturing && len == UV_EOF) {
+        cache_store(req);
+    } else if (len < 0) {
+        free_capture(cr);
+    }
+
+    if (cr->body_cb) {
+        cr->body_cb(req, body, len);
+    }
+}
+
+void http_cache_capture(tlsuv_http_req_t *req) {
+    struct http_cache_req_s *cr = req->cache;
+    tlsuv_http_t *clt = req->client;
+    if (cr == NULL) {
+        return;
+    }
+
+    if (cr->revalidated) {
+        struct http_cache_entry_s *e = cr->entry;
+        if (req->resp.body_cb && e->body_len > 0) {
+            req->resp.body_cb(req, e->body, (ssize_t) e->body_len);
+        }
+        return;
+    }
+
+    if (cr->bypass || clt == NULL || clt->cache == NULL || req->resp.code != 200) {
+        return;
+    }
+
+    struct cache_control cc = {0};
+    cc.max_age = -1;
+    const char *resp_cc = tlsuv_http_resp_header(&req->resp, "Cache-Control");
+    if (resp_cc) {
+        parse_cache_control(resp_cc, &cc);
+    }
+    const char *vary = tlsuv_http_resp_header(&req->resp, "Vary");
+    if (cc.no_store || (vary && !vary_supported(vary))) {
+        return;
+    }
+
+    // without lifetime entry is only useful if it can be revalidated
+    cr->lifetime = response_lifetime(&req->resp, &cc);
+    if (cr->lifetime == 0 &&
+        tlsuv_http_resp_header(&req->resp, "ETag") == NULL &&
+        tlsuv_http_resp_header(&req->resp, "Last-Modified") == NULL) {
+        return;
+    }
+
+    cr->capturing = true;
+    cr->body_cb = req->resp.body_cb;
+    req->resp.body_cb = capture_body_cb;
+}
+
+void http_cache_req_free(tlsuv_http_req_t *req) {
+    struct http_cache_req_s *cr = req->cache;
+    if (cr == NULL) return;
+
+    entry_unref(cr->entry);
+    tlsuv__free(cr->body);
+    tlsuv__free(cr);
+    req->cache = NULL;
+}
+
+void http_cache_clear(tlsuv_http_t *clt) {
+    struct tlsuv_http_cache_s *cache = clt->cache;
+    if (cache == NULL) return;
+
+    while (!TAILQ_EMPTY(&cache->lru)) {
+        entry_unlink(cache, TAILQ_FIRST(&cache->lru));
+    }
+    cache->gen++;
+}
+
+void http_cache_free(tlsuv_http_t *clt) {
+    http_cache_clear(clt);
+    tlsuv__free(clt->cache);
+    clt->cache = NULL;
+}
+
+int tlsuv_http_cache(tlsuv_http_t *clt, size_t max_size) {
+    if (max_size == 0) {
+        http_cache_free(clt);
+        return 0;
+    }
+
+    if (clt->cache == NULL) {
+        clt->cache = tlsuv__calloc(1, sizeof(*clt->cache));
+        TAILQ_INIT(&clt->cache->lru);
+    }
+
+    struct tlsuv_http_cache_s *cache = clt->cache;
+    cache->max_size = max_size;
+    while (cache->size > cache->max_size) {
+        entry_unlink(cache, TAILQ_LAST(&cache->lru, cache_lru));
+    }
+    return 0;
+}
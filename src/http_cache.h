@@ -0,0 +1,50 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_HTTP_CACHE_H
+#define TLSUV_HTTP_CACHE_H
+
+#include <tlsuv/http.h>
+
+/**
+ * Client response cache, @see tlsuv_http_cache.
+ * Entries are kept in LRU order, entries still used by requests are released with their last request.
+ */
+
+// looks up queued request, returns true if fresh entry can answer it
+// stale entry is kept with the request to revalidate it with conditional headers
+bool http_cache_lookup(tlsuv_http_t *clt, tlsuv_http_req_t *req);
+
+// answers request from its fresh entry without sending it: resp_cb, then body_cb with cached body and UV_EOF
+void http_cache_respond(tlsuv_http_req_t *req);
+
+// called when response headers are received, turns `304 Not Modified` into cached response
+void http_cache_headers(tlsuv_http_req_t *req);
+
+// called after resp_cb, delivers body of revalidated entry or starts capturing cacheable response body
+void http_cache_capture(tlsuv_http_req_t *req);
+
+// checks if response header is used by the cache
+bool http_cache_header(const char *name);
+
+// releases cache state of request
+void http_cache_req_free(tlsuv_http_req_t *req);
+
+// drops all entries, responses in flight are not stored
+void http_cache_clear(tlsuv_http_t *clt);
+
+void http_cache_free(tlsuv_http_t *clt);
+
+#endif //TLSUV_HTTP_CACHE_H
@@ -0,0 +1,306 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tlsuv/http_group.h>
+
+#include "atomics.h"
+#include "http_submit.h"
+#include "pool.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+struct group_shard_s {
+    tlsuv_http_group_t *group;
+    unsigned int id;
+
+    uv_loop_t loop;
+    uv_thread_t thread;
+    bool started;
+    // ref'ed, keeps loop running until group is stopped
+    uv_async_t stop;
+
+    tlsuv_http_t clt;
+    tls_context *tls;
+
+    int64_t outstanding;
+    uv_mutex_t stats_lock;
+    tls_traffic_stats traffic;
+};
+
+struct tlsuv_http_group_s {
+    unsigned int count;
+    int64_t submitted;
+    int64_t completed;
+    int64_t failed;
+    // rotates start of least outstanding scan, so that idle shards share the load
+    int64_t next;
+    struct group_shard_s shards[];
+};
+
+struct group_req_s {
+    struct group_shard_s *shard;
+    tlsuv_http_result_cb cb;
+    tlsuv_http_reply_q_t *reply_q;
+    void *ctx;
+};
+
+static void shard_thread(void *arg) {
+    struct group_shard_s *s = arg;
+    uv_run(&s->loop, UV_RUN_DEFAULT);
+    tlsuv_pool_release();
+}
+
+static void shard_stop_cb(uv_async_t *a) {
+    struct group_shard_s *s = a->data;
+    tlsuv_http_close(&s->clt, NULL);
+    uv_close((uv_handle_t *) a, NULL);
+}
+
+static void group_done(tlsuv_http_result_t *res) {
+    struct group_req_s *gr = res->ctx;
+    struct group_shard_s *s = gr->shard;
+    tlsuv_http_group_t *g = s->group;
+
+    tlsuv_atomic_add(&s->outstanding, -1);
+    tlsuv_atomic_add(&g->completed, 1);
+    if (res->code < 0) {
+        tlsuv_atomic_add(&g->failed, 1);
+    }
+
+    tls_traffic_stats traffic;
+    if (tlsuv_http_stats(&s->clt, &traffic) == 0) {
+        uv_mutex_lock(&s->stats_lock);
+        s->traffic = traffic;
+        uv_mutex_unlock(&s->stats_lock);
+    }
+
+    res->ctx = gr->ctx;
+    tlsuv_http_result_cb cb = gr->cb;
+    tlsuv_http_reply_q_t *q = gr->reply_q;
+    tlsuv__free(gr);
+
+    if (q != NULL) {
+        http_reply_q_post(q, res);
+    } else if (cb != NULL) {
+        cb(res);
+    } else {
+        tlsuv_http_result_free(res);
+    }
+}
+
+static int shard_init(tlsuv_http_group_t *g, struct group_shard_s *s, const tlsuv_http_group_opts_t *opts) {
+    s->group = g;
+    int rc = uv_loop_init(&s->loop);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = tlsuv_http_init(&s->loop, &s->clt, opts->url);
+    if (rc != 0) {
+        uv_loop_close(&s->loop);
+        return rc;
+    }
+
+    s->tls = opts->new_tls ? opts->new_tls(opts->tls_ctx) : default_tls_context(NULL, 0);
+    tlsuv_http_set_ssl(&s->clt, s->tls);
+    if (opts->max_connections > 0) {
+        tlsuv_http_max_connections(&s->clt, opts->max_connections);
+    }
+    if (opts->http2) {
+        tlsuv_http_set_http2(&s->clt, true);
+    }
+
+    uv_mutex_init(&s->stats_lock);
+    uv_async_init(&s->loop, &s->stop, shard_stop_cb);
+    s->stop.data = s;
+
+    rc = uv_thread_create(&s->thread, shard_thread, s);
+    if (rc == 0) {
+        s->started = true;
+    }
+    return rc;
+}
+
+// shard thread must have been signalled to stop already
+static void shard_free(struct group_shard_s *s) {
+    if (s->started) {
+        uv_thread_join(&s->thread);
+    } else {
+        // thread was not started, shard is stopped on this thread
+        uv_async_send(&s->stop);
+    }
+    uv_run(&s->loop, UV_RUN_DEFAULT);
+
+    int rc = uv_loop_close(&s->loop);
+    if (rc != 0) {
+        UM_LOG(WARN, "shard[%u] loop close failed: %d/%s", s->id, rc, uv_strerror(rc));
+    }
+    if (s->tls) {
+        s->tls->api->free_ctx(s->tls);
+    }
+    uv_mutex_destroy(&s->stats_lock);
+}
+
+tlsuv_http_group_t *tlsuv_http_group_new(const tlsuv_http_group_opts_t *opts) {
+    if (opts == NULL || opts->url == NULL) {
+        return NULL;
+    }
+
+    unsigned int count = opts->shards;
+    if (count == 0) {
+        uv_cpu_info_t *cpus;
+        int n;
+        if (uv_cpu_info(&cpus, &n) == 0) {
+            uv_free_cpu_info(cpus, n);
+            count = (unsigned int) n;
+        }
+        if (count == 0) {
+            count = 1;
+        }
+    }
+
+    tlsuv_http_group_t *g = tlsuv__calloc(1, sizeof(*g) + count * sizeof(g->shards[0]));
+    for (unsigned int i = 0; i < count; i++) {
+        struct group_shard_s *s = &g->shards[i];
+        s->id = i;
+        int rc = shard_init(g, s, opts);
+        if (rc != 0) {
+            UM_LOG(WARN, "failed to start shard[%u]: %d/%s", i, rc, uv_strerror(rc));
+            // shard that failed to start its thread is released with the others
+            g->count = s->tls != NULL ? i + 1 : i;
+            tlsuv_http_group_free(g);
+            return NULL;
+        }
+        g->count = i + 1;
+    }
+    UM_LOG(DEBG, "started HTTP group with %u shards", count);
+    return g;
+}
+
+static uint64_t key_hash(const char *key) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (; *key; key++) {
+        h ^= (uint8_t) *key;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct group_shard_s *pick_shard(tlsuv_http_group_t *g, const char *key) {
+    if (key != NULL) {
+        return &g->shards[key_hash(key) % g->count];
+    }
+
+    unsigned int start = (unsigned int) ((uint64_t) tlsuv_atomic_add(&g->next, 1) % g->count);
+    struct group_shard_s *best = NULL;
+    int64_t min = 0;
+    for (unsigned int i = 0; i < g->count; i++) {
+        struct group_shard_s *s = &g->shards[(start + i) % g->count];
+        int64_t out = tlsuv_atomic_load(&s->outstanding);
+        if (best == NULL || out < min) {
+            best = s;
+            min = out;
+        }
+    }
+    return best;
+}
+
+int tlsuv_http_group_submit(tlsuv_http_group_t *g, const char *key, const tlsuv_http_submit_t *sub) {
+    if (g == NULL || sub == NULL) {
+        return UV_EINVAL;
+    }
+
+    struct group_shard_s *s = pick_shard(g, key);
+    struct group_req_s *gr = tlsuv__malloc(sizeof(*gr));
+    if (gr == NULL) {
+        return UV_ENOMEM;
+    }
+    gr->shard = s;
+    gr->cb = sub->cb;
+    gr->reply_q = sub->reply_q;
+    gr->ctx = sub->ctx;
+
+    // shard completes request first, then passes result on
+    tlsuv_http_submit_t shard_sub = *sub;
+    shard_sub.cb = group_done;
+    shard_sub.reply_q = NULL;
+    shard_sub.ctx = gr;
+
+    tlsuv_atomic_add(&s->outstanding, 1);
+    int rc = tlsuv_http_req_submit(&s->clt, &shard_sub);
+    if (rc != 0) {
+        tlsuv_atomic_add(&s->outstanding, -1);
+        tlsuv__free(gr);
+        return rc;
+    }
+    tlsuv_atomic_add(&g->submitted, 1);
+    return 0;
+}
+
+int tlsuv_http_group_stats(tlsuv_http_group_t *g, tlsuv_http_group_stats_t *stats) {
+    if (g == NULL || stats == NULL) {
+        return UV_EINVAL;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->shards = g->count;
+    stats->submitted = (uint64_t) tlsuv_atomic_load(&g->submitted);
+    stats->completed = (uint64_t) tlsuv_atomic_load(&g->completed);
+    stats->failed = (uint64_t) tlsuv_atomic_load(&g->failed);
+
+    for (unsigned int i = 0; i < g->count; i++) {
+        struct group_shard_s *s = &g->shards[i];
+        stats->outstanding += (uint64_t) tlsuv_atomic_load(&s->outstanding);
+
+        uv_mutex_lock(&s->stats_lock);
+        const tls_traffic_stats *t = &s->traffic;
+        stats->traffic.plain_in += t->plain_in;
+        stats->traffic.plain_out += t->plain_out;
+        stats->traffic.cipher_in += t->cipher_in;
+        stats->traffic.cipher_out += t->cipher_out;
+        stats->traffic.records_in += t->records_in;
+        stats->traffic.records_out += t->records_out;
+        stats->traffic.handshakes += t->handshakes;
+        stats->traffic.handshake_failures += t->handshake_failures;
+        stats->traffic.resumptions += t->resumptions;
+        stats->traffic.has_write += t->has_write;
+        stats->traffic.buffer_allocs += t->buffer_allocs;
+        uv_mutex_unlock(&s->stats_lock);
+    }
+    return 0;
+}
+
+void tlsuv_http_group_free(tlsuv_http_group_t *g) {
+    if (g == NULL) {
+        return;
+    }
+
+    // signal all shards first, so that they close in parallel
+    for (unsigned int i = 0; i < g->count; i++) {
+        if (g->shards[i].started) {
+            uv_async_send(&g->shards[i].stop);
+        }
+    }
+    for (unsigned int i = 0; i < g->count; i++) {
+        shard_free(&g->shards[i]);
+    }
+    tlsuv__free(g);
+}
@@ -18,6 +18,46 @@
 #include <string.h>
 #include <ctype.h>
 #include "compression.h"
+#include "http_cache.h"
+#include "http_sched.h"
+#include "pool.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+// first arena block is allocated with the arena, larger header sets chain more blocks
+#define HDR_ARENA_BLOCK 2048
+
+struct hdr_block {
+    struct hdr_block *next;
+    size_t cap;
+    size_t used;
+    char data[];
+};
+
+// response headers looked up by the library itself, indexed on insert
+enum known_header {
+    HDR_CONNECTION,
+    HDR_CONTENT_ENCODING,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_KEEP_ALIVE,
+    HDR_LOCATION,
+    HDR_TRANSFER_ENCODING,
+    HDR_UPGRADE,
+    HDR_KNOWN_COUNT
+};
+
+struct tlsuv_http_hdr_arena_s {
+    struct hdr_block *blocks;
+    tlsuv_http_hdr *known[HDR_KNOWN_COUNT];
+};
+
+// names of response headers to keep, strings are stored after the array
+struct http_hdr_filter_s {
+    size_t count;
+    const char *names[];
+};
 
 static void free_hdr(tlsuv_http_hdr *hdr);
 
@@ -27,6 +67,8 @@ static int http_header_value_cb(llhttp_t *parser, const char *v, size_t len);
 static int http_status_cb(llhttp_t *parser, const char *status, size_t len);
 static int http_message_cb(llhttp_t *parser);
 static int http_body_cb(llhttp_t *parser, const char *body, size_t len);
+static void free_body_enc(tlsuv_http_req_t *req);
+static void expect_continue(tlsuv_http_req_t *req);
 
 static llhttp_settings_t HTTP_PROC = {
         .on_header_field = http_header_field_cb,
@@ -38,10 +80,33 @@ static llhttp_settings_t HTTP_PROC = {
 };
 
 void http_req_init(tlsuv_http_req_t *r, const char *method, const char *path) {
-    r->method = strdup(method);
-    r->path = strdup(path);
+    r->method = tlsuv__strdup(method);
+    r->path = tlsuv__strdup(path);
     r->req_body = NULL;
+    r->hdr_arena = NULL;
+    r->body_src = NULL;
+    r->body_sink = NULL;
+    r->body_enc = NULL;
+    r->cache = NULL;
+    r->resp_filter = NULL;
+    r->resp_hdr_cb = NULL;
+    memset(&r->timeout, 0, sizeof(r->timeout));
+    memset(&r->read_timeout, 0, sizeof(r->read_timeout));
+    r->read_timeout_ms = 0;
+    memset(&r->policy_timer, 0, sizeof(r->policy_timer));
+    r->retries = 0;
+    r->retry_wait = false;
+    r->hedged = false;
+    r->hedge_copy = false;
+    r->muted = false;
+    r->hedge = NULL;
+    r->expect_wait = false;
+    r->priority = TLSUV_HTTP_PRIO_NORMAL;
+    r->prio_tag = 0;
     r->req_chunked = false;
+    r->early_data = false;
+    r->timing_cb = NULL;
+    memset(&r->timing, 0, sizeof(r->timing));
     r->req_body_size = -1;
     r->body_sent_size = 0;
     r->state = created;
@@ -51,19 +116,370 @@ void http_req_init(tlsuv_http_req_t *r, const char *method, const char *path) {
     r->parser.data = r;
 }
 
+void http_req_reset(tlsuv_http_req_t *r) {
+    tlsuv_timeout_stop(&r->read_timeout);
+    http_req_clear_headers(r, &r->resp.headers);
+    r->resp.curr_header = NULL;
+    tlsuv__free(r->resp.status);
+    r->resp.status = NULL;
+    r->resp.code = 0;
+    r->conn = NULL;
+    r->body_sent_size = 0;
+    r->timing.req_written = 0;
+    r->state = created;
+
+    llhttp_init(&r->parser, HTTP_RESPONSE, &HTTP_PROC);
+    r->parser.data = r;
+}
+
+static int known_header(const char *name) {
+    static const char *names[HDR_KNOWN_COUNT] = {
+            [HDR_CONNECTION] = "connection",
+            [HDR_CONTENT_ENCODING] = "content-encoding",
+            [HDR_CONTENT_LENGTH] = "content-length",
+            [HDR_CONTENT_TYPE] = "content-type",
+            [HDR_KEEP_ALIVE] = "keep-alive",
+            [HDR_LOCATION] = "location",
+            [HDR_TRANSFER_ENCODING] = "transfer-encoding",
+            [HDR_UPGRADE] = "upgrade",
+    };
+    // only names that can match are compared
+    int from, to;
+    switch (tolower((unsigned char) name[0])) {
+        case 'c': from = HDR_CONNECTION; to = HDR_CONTENT_TYPE; break;
+        case 'k': from = to = HDR_KEEP_ALIVE; break;
+        case 'l': from = to = HDR_LOCATION; break;
+        case 't': from = to = HDR_TRANSFER_ENCODING; break;
+        case 'u': from = to = HDR_UPGRADE; break;
+        default: return -1;
+    }
+    for (int i = from; i <= to; i++) {
+        if (strcasecmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static struct tlsuv_http_hdr_arena_s *hdr_arena(tlsuv_http_req_t *req) {
+    if (req->hdr_arena == NULL) {
+        struct tlsuv_http_hdr_arena_s *a = tlsuv_pool_calloc(sizeof(*a) + sizeof(struct hdr_block) + HDR_ARENA_BLOCK);
+        a->blocks = (struct hdr_block *) (a + 1);
+        a->blocks->cap = HDR_ARENA_BLOCK;
+        req->hdr_arena = a;
+    }
+    return req->hdr_arena;
+}
+
+static void *arena_alloc(tlsuv_http_req_t *req, size_t size) {
+    struct tlsuv_http_hdr_arena_s *a = hdr_arena(req);
+    size = (size + 7) & ~(size_t) 7;
+
+    struct hdr_block *b = a->blocks;
+    if (b->cap - b->used < size) {
+        size_t cap = size > HDR_ARENA_BLOCK ? size : HDR_ARENA_BLOCK;
+        b = tlsuv_pool_alloc(sizeof(struct hdr_block) + cap);
+        b->cap = cap;
+        b->used = 0;
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+static char *arena_strndup(tlsuv_http_req_t *req, const char *str, size_t len) {
+    char *p = arena_alloc(req, len + 1);
+    memcpy(p, str, len);
+    p[len] = 0;
+    return p;
+}
+
+// returns last allocation back to the arena
+static void arena_unwind(tlsuv_http_req_t *req, void *p) {
+    struct hdr_block *b = req->hdr_arena ? req->hdr_arena->blocks : NULL;
+    if (b && (char *) p >= b->data && (char *) p < b->data + b->used) {
+        b->used = (char *) p - b->data;
+    }
+}
+
+static void arena_free(tlsuv_http_req_t *req) {
+    struct tlsuv_http_hdr_arena_s *a = req->hdr_arena;
+    if (a == NULL) return;
+
+    struct hdr_block *first = (struct hdr_block *) (a + 1);
+    while (a->blocks != first) {
+        struct hdr_block *b = a->blocks;
+        a->blocks = b->next;
+        tlsuv_pool_free(b);
+    }
+    tlsuv_pool_free(a);
+    req->hdr_arena = NULL;
+}
+
+static void index_header(tlsuv_http_req_t *req, um_header_list *hl, tlsuv_http_hdr *h) {
+    int k;
+    if (hl == &req->resp.headers && (k = known_header(h->name)) >= 0) {
+        hdr_arena(req)->known[k] = h;
+    }
+}
+
+static void unindex_header(tlsuv_http_req_t *req, um_header_list *hl, tlsuv_http_hdr *h) {
+    int k;
+    if (hl != &req->resp.headers || req->hdr_arena == NULL || (k = known_header(h->name)) < 0 ||
+        req->hdr_arena->known[k] != h) {
+        return;
+    }
+
+    // next header with the same name takes its place
+    tlsuv_http_hdr *n;
+    req->hdr_arena->known[k] = NULL;
+    LIST_FOREACH(n, hl, _next) {
+        if (n != h && strcasecmp(n->name, h->name) == 0) {
+            req->hdr_arena->known[k] = n;
+            break;
+        }
+    }
+}
+
+static void add_header(tlsuv_http_req_t *req, um_header_list *hl, char *name, const char *value, size_t vallen) {
+    tlsuv_http_hdr *h = arena_alloc(req, sizeof(tlsuv_http_hdr));
+    h->name = name;
+    h->value = arena_strndup(req, value, vallen);
+    LIST_INSERT_HEAD(hl, h, _next);
+    index_header(req, hl, h);
+}
+
+void http_req_add_header(tlsuv_http_req_t *req, um_header_list *hl,
+                         const char *name, size_t namelen, const char *value, size_t vallen) {
+    add_header(req, hl, arena_strndup(req, name, namelen), value, vallen);
+}
+
+static struct http_hdr_filter_s *hdr_filter_new(const char *const *names) {
+    size_t count = 0, len = 0;
+    for (; names[count] != NULL; count++) {
+        len += strlen(names[count]) + 1;
+    }
+
+    struct http_hdr_filter_s *f = tlsuv__malloc(sizeof(*f) + count * sizeof(f->names[0]) + len);
+    char *p = (char *) (f->names + count);
+    f->count = count;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = strlen(names[i]) + 1;
+        memcpy(p, names[i], n);
+        f->names[i] = p;
+        p += n;
+    }
+    return f;
+}
+
+struct http_hdr_filter_s *http_hdr_filter_dup(const struct http_hdr_filter_s *f) {
+    size_t size = sizeof(*f) + f->count * sizeof(f->names[0]);
+    for (size_t i = 0; i < f->count; i++) {
+        size += strlen(f->names[i]) + 1;
+    }
+    struct http_hdr_filter_s *dup = tlsuv__malloc(size);
+    memcpy(dup, f, size);
+    for (size_t i = 0; i < f->count; i++) {
+        dup->names[i] = (const char *) dup + (f->names[i] - (const char *) f);
+    }
+    return dup;
+}
+
+int tlsuv_http_resp_headers(tlsuv_http_t *clt, const char *const *names) {
+    tlsuv__free(clt->resp_filter);
+    clt->resp_filter = names ? hdr_filter_new(names) : NULL;
+    return 0;
+}
+
+int tlsuv_http_req_resp_headers(tlsuv_http_req_t *req, const char *const *names, tlsuv_http_hdr_cb hdr_cb) {
+    if (req->state >= headers_received) {
+        return UV_EINVAL;
+    }
+    tlsuv__free(req->resp_filter);
+    req->resp_filter = names ? hdr_filter_new(names) : NULL;
+    req->resp_hdr_cb = hdr_cb;
+    return 0;
+}
+
+// headers used by the library are always kept
+static bool keep_resp_header(tlsuv_http_req_t *req, const char *name) {
+    const struct http_hdr_filter_s *f = req->resp_filter;
+    if (f == NULL && req->client) {
+        f = req->client->resp_filter;
+    }
+    if (f == NULL || known_header(name) >= 0 || (req->cache && http_cache_header(name))) {
+        return true;
+    }
+
+    for (size_t i = 0; i < f->count; i++) {
+        if (strcasecmp(name, f->names[i]) == 0) return true;
+    }
+    return false;
+}
+
+void http_req_resp_header(tlsuv_http_req_t *req, const char *name, size_t namelen, const char *value, size_t vallen) {
+    if (keep_resp_header(req, name)) {
+        http_req_add_header(req, &req->resp.headers, name, namelen, value, vallen);
+    } else if (req->resp_hdr_cb) {
+        req->resp_hdr_cb(&req->resp, name, namelen, value, vallen);
+    }
+}
+
+void http_req_set_header(tlsuv_http_req_t *req, um_header_list *hl, const char *name, const char *value) {
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, hl, _next) {
+        if (strcasecmp(h->name, name) == 0) {
+            break;
+        }
+    }
+
+    if (h != NULL) { // arena memory is released with the request
+        unindex_header(req, hl, h);
+        LIST_REMOVE(h, _next);
+    }
+
+    if (value != NULL) {
+        http_req_add_header(req, hl, name, strlen(name), value, strlen(value));
+    }
+}
+
+void http_req_clear_headers(tlsuv_http_req_t *req, um_header_list *hl) {
+    if (hl == &req->resp.headers && req->hdr_arena) {
+        memset(req->hdr_arena->known, 0, sizeof(req->hdr_arena->known));
+    }
+    LIST_INIT(hl);
+}
+
 void http_req_free(tlsuv_http_req_t *req) {
     if (req == NULL) return;
 
-    free_hdr_list(&req->req_headers);
-    free_hdr_list(&req->resp.headers);
+    if (req->body_src) {
+        http_body_src_release(req->body_src);
+        req->body_src = NULL;
+    }
+    if (req->body_sink) {
+        http_body_sink_release(req->body_sink);
+    }
+    free_body_enc(req);
+    http_cache_req_free(req);
+    tlsuv_timeout_close(&req->timeout);
+    tlsuv_timeout_close(&req->read_timeout);
+    http_retry_release(req);
+    tlsuv__free(req->resp_filter);
+    req->resp_filter = NULL;
+    LIST_INIT(&req->req_headers);
+    LIST_INIT(&req->resp.headers);
+    req->resp.curr_header = NULL;
+    arena_free(req);
     if (req->resp.status) {
-        free(req->resp.status);
+        tlsuv__free(req->resp.status);
     }
     if (req->inflater) {
-        um_free_inflater(req->inflater);
+        // keep one for the next response of this client
+        if (req->client && req->client->inflater == NULL) {
+            req->client->inflater = req->inflater;
+        } else {
+            um_free_inflater(req->inflater);
+        }
+        req->inflater = NULL;
+    }
+    tlsuv__free(req->path);
+    tlsuv__free(req->method);
+}
+
+static void req_timeout_cb(tlsuv_timeout_t *t) {
+    tlsuv_http_req_t *req = t->data;
+    UM_LOG(DEBG, "request[%s] timed out", req->path);
+    http_req_abort(req->client, req, UV_ETIMEDOUT);
+}
+
+static int req_timer(tlsuv_http_req_t *req, tlsuv_timeout_t *t) {
+    if (req->client == NULL) {
+        return UV_EINVAL;
+    }
+    if (t->wheel == NULL) {
+        tlsuv_timeout_init(req->client->loop, t);
+        t->data = req;
+    }
+    return 0;
+}
+
+// body is sent after interim response, or without it once the wait is over
+static void expect_done(tlsuv_http_req_t *req) {
+    req->expect_wait = false;
+    tlsuv_timeout_stop(&req->policy_timer);
+    http_sched_mark(req->client);
+}
+
+static void expect_timeout_cb(tlsuv_timeout_t *t) {
+    tlsuv_http_req_t *req = t->data;
+    UM_LOG(VERB, "request[%s] no interim response, sending body", req->path);
+    expect_done(req);
+}
+
+static void expect_continue(tlsuv_http_req_t *req) {
+    tlsuv_http_t *clt = req->client;
+    if (clt == NULL || clt->expect_timeout == 0 || req->state >= headers_sent) {
+        return;
+    }
+    if (!req->req_chunked && (req->req_body_size <= 0 || (size_t) req->req_body_size < clt->expect_min_body)) {
+        return;
+    }
+
+    http_req_set_header(req, &req->req_headers, "Expect", "100-continue");
+    req->expect_wait = true;
+    req_timer(req, &req->policy_timer);
+    tlsuv_timeout_start(&req->policy_timer, expect_timeout_cb, clt->expect_timeout);
+}
+
+int tlsuv_http_req_timeout(tlsuv_http_req_t *req, uint64_t millis) {
+    if (req->state == completed) {
+        return UV_EINVAL;
+    }
+    if (millis == 0) {
+        tlsuv_timeout_stop(&req->timeout);
+        return 0;
+    }
+
+    int rc = req_timer(req, &req->timeout);
+    return rc ? rc : tlsuv_timeout_start(&req->timeout, req_timeout_cb, millis);
+}
+
+int tlsuv_http_req_read_timeout(tlsuv_http_req_t *req, uint64_t millis) {
+    if (req->state == completed) {
+        return UV_EINVAL;
+    }
+    req->read_timeout_ms = millis;
+    if (millis == 0) {
+        tlsuv_timeout_stop(&req->read_timeout);
+        return 0;
+    }
+
+    int rc = req_timer(req, &req->read_timeout);
+    // already sent request is timed from now
+    if (rc == 0 && req->state >= headers_sent) {
+        rc = tlsuv_timeout_start(&req->read_timeout, req_timeout_cb, millis);
+    }
+    return rc;
+}
+
+// restarts inactivity timeout
+static void req_read_activity(tlsuv_http_req_t *req) {
+    if (req->read_timeout_ms > 0) {
+        tlsuv_timeout_start(&req->read_timeout, req_timeout_cb, req->read_timeout_ms);
     }
-    free(req->path);
-    free(req->method);
+}
+
+void http_req_written(tlsuv_http_req_t *req) {
+    req->timing.req_written = uv_hrtime();
+    req_read_activity(req);
+    http_retry_written(req);
+}
+
+void http_req_stop_timeouts(tlsuv_http_req_t *req) {
+    tlsuv_timeout_stop(&req->timeout);
+    tlsuv_timeout_stop(&req->read_timeout);
 }
 
 static int printable_len(const unsigned char* buf, size_t len) {
@@ -79,6 +495,9 @@ ssize_t http_req_process(tlsuv_http_req_t *req, const char* buf, ssize_t len) {
     if (err == HPE_OK) {
         processed = len;
         UM_LOG(VERB, "processed %z of %zd", processed, len);
+    } else if (err == HPE_PAUSED) { // end of message, rest of the data belongs to the next response
+        processed = llhttp_get_error_pos(&req->parser) - buf;
+        UM_LOG(VERB, "message complete: processed %zd out of %zd", processed, len);
     } else if (err == HPE_PAUSED_UPGRADE) {
         processed = llhttp_get_error_pos(&req->parser) - buf;
         UM_LOG(VERB, "websocket upgrade: processed %zd out of %zd", processed, len);
@@ -90,8 +509,8 @@ ssize_t http_req_process(tlsuv_http_req_t *req, const char* buf, ssize_t len) {
 }
 
 static void free_hdr(tlsuv_http_hdr *hdr) {
-    free(hdr->name);
-    free(hdr->value);
+    tlsuv__free(hdr->name);
+    tlsuv__free(hdr->value);
 }
 
 void free_hdr_list(um_header_list *l) {
@@ -101,7 +520,7 @@ void free_hdr_list(um_header_list *l) {
         LIST_REMOVE(h, _next);
 
         free_hdr(h);
-        free(h);
+        tlsuv__free(h);
     }
 }
 
@@ -122,19 +541,20 @@ static size_t write_url_encoded(char *buf, const char *url) {
     return p - buf;
 }
 
-size_t http_req_write(tlsuv_http_req_t *req, char *buf, size_t maxlen) {
+char *http_req_target(tlsuv_http_req_t *req) {
     const char *pfx = "";
     if (req->client && req->client->prefix) {
         pfx = req->client->prefix;
     }
 
-    size_t len = 0;
-    len += snprintf(buf, maxlen, "%s ", req->method);
-    len += write_url_encoded(buf + len, pfx);
-    len += write_url_encoded(buf + len, req->path);
-    len += snprintf(buf + len, maxlen - len, " HTTP/1.1\r\n");
-
+    char *target = tlsuv__malloc(3 * (strlen(pfx) + strlen(req->path)) + 1);
+    size_t len = write_url_encoded(target, pfx);
+    len += write_url_encoded(target + len, req->path);
+    target[len] = 0;
+    return target;
+}
 
+void http_req_body_length(tlsuv_http_req_t *req) {
     if (strcmp(req->method, "POST") == 0 ||
         strcmp(req->method, "PUT") == 0 ||
         strcmp(req->method, "PATCH") == 0) {
@@ -148,27 +568,308 @@ size_t http_req_write(tlsuv_http_req_t *req, char *buf, size_t maxlen) {
             req->req_body_size = req_len;
             char length_str[16];
             sprintf(length_str, "%ld", req_len);
-            set_http_header(&req->req_headers, "Content-Length", length_str);
+            http_req_set_header(req, &req->req_headers, "Content-Length", length_str);
+        }
+    }
+}
+
+// request body compression state
+struct http_req_enc_s {
+    http_deflater_t *deflater;
+    bool finished;
+    // chunks already compressed, released with the next compressed chunk that is written
+    struct body_chunk_s *consumed;
+    struct body_chunk_s **consumed_tail;
+};
+
+// compressed data of one or more body chunks
+struct enc_buf_s {
+    struct body_chunk_s *consumed;
+    size_t len;
+    size_t cap;
+    char data[];
+};
+
+static void enc_append(void *ctx, const char *data, ssize_t len) {
+    struct enc_buf_s **bp = ctx;
+    struct enc_buf_s *b = *bp;
+    size_t need = (b ? b->len : 0) + len;
+    if (b == NULL || need > b->cap) {
+        size_t cap = b ? b->cap * 2 : 16 * 1024;
+        while (cap < need) cap *= 2;
+        b = tlsuv__realloc(b, sizeof(*b) + cap);
+        if (*bp == NULL) {
+            b->len = 0;
+        }
+        b->cap = cap;
+        *bp = b;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void release_chunks(tlsuv_http_req_t *req, struct body_chunk_s *chunk, int status) {
+    while (chunk) {
+        struct body_chunk_s *next = chunk->next;
+        if (chunk->cb) {
+            chunk->cb(req, chunk->chunk, status);
+        }
+        tlsuv__free(chunk);
+        chunk = next;
+    }
+}
+
+static void enc_chunk_cb(tlsuv_http_req_t *req, const char *data, ssize_t status) {
+    struct enc_buf_s *b = (struct enc_buf_s *) (data - offsetof(struct enc_buf_s, data));
+    release_chunks(req, b->consumed, (int) status);
+    tlsuv__free(b);
+}
+
+int tlsuv_http_req_compress(tlsuv_http_req_t *req, const char *encoding) {
+    if (req->body_enc != NULL || req->state > created) {
+        return UV_EINVAL;
+    }
+    http_deflater_t *deflater = um_get_deflater(encoding);
+    if (deflater == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    // compressed size is not known upfront
+    int rc = tlsuv_http_req_header(req, "Transfer-Encoding", "chunked");
+    if (rc != 0) {
+        um_free_deflater(deflater);
+        return rc;
+    }
+    http_req_set_header(req, &req->req_headers, "Content-Encoding", encoding);
+
+    struct http_req_enc_s *enc = tlsuv__calloc(1, sizeof(*enc));
+    enc->deflater = deflater;
+    enc->consumed_tail = &enc->consumed;
+    req->body_enc = enc;
+    return 0;
+}
+
+void http_req_encode_body(tlsuv_http_req_t *req) {
+    struct http_req_enc_s *enc = req->body_enc;
+    if (enc == NULL) {
+        return;
+    }
+
+    struct body_chunk_s **pp = (struct body_chunk_s **) &req->req_body;
+    while (*pp != NULL && !enc->finished) {
+        struct body_chunk_s *b = *pp;
+        if (b->cb == enc_chunk_cb) { // already compressed
+            pp = &b->next;
+            continue;
+        }
+
+        // compress run of queued chunks into one
+        struct enc_buf_s *out = NULL;
+        while (b != NULL && b->cb != enc_chunk_cb && b->len > 0) {
+            struct body_chunk_s *next = b->next;
+            if (um_deflate(enc->deflater, b->chunk, b->len, 0, enc_append, &out) != 0) {
+                UM_LOG(WARN, "failed to compress request[%s] body", req->path);
+            }
+            b->next = NULL;
+            *enc->consumed_tail = b;
+            enc->consumed_tail = &b->next;
+            b = next;
+        }
+        if (b != NULL && b->len == 0 && b->cb != enc_chunk_cb) { // end of body, flush compressor
+            um_deflate(enc->deflater, NULL, 0, 1, enc_append, &out);
+            enc->finished = true;
+        }
+
+        if (out != NULL && out->len > 0) {
+            out->consumed = enc->consumed;
+            enc->consumed = NULL;
+            enc->consumed_tail = &enc->consumed;
+
+            struct body_chunk_s *c = tlsuv__calloc(1, sizeof(*c));
+            c->chunk = out->data;
+            c->len = out->len;
+            c->cb = enc_chunk_cb;
+            c->req = req;
+            c->next = b;
+            *pp = c;
+            pp = &c->next;
+        } else {
+            tlsuv__free(out);
+            *pp = b;
         }
     }
+}
+
+static void free_body_enc(tlsuv_http_req_t *req) {
+    struct http_req_enc_s *enc = req->body_enc;
+    if (enc) {
+        release_chunks(req, enc->consumed, UV_ECANCELED);
+        um_free_deflater(enc->deflater);
+        tlsuv__free(enc);
+        req->body_enc = NULL;
+    }
+}
 
+void http_req_clear_body(tlsuv_http_req_t *req, int code) {
+    struct body_chunk_s *chunk = req->req_body, *next;
+    while(chunk) {
+        next = chunk->next;
+        if (chunk->cb) {
+            chunk->cb(req, chunk->chunk, code);
+        }
+        tlsuv__free(chunk);
+
+        chunk = next;
+    }
+    req->req_body = NULL;
+}
+
+static size_t url_encoded_len(const char *url) {
+    static char unsafe[] = "\"<>%{}|\\^`";
+    size_t len = 0;
+    for(; *url != 0; url++) {
+        len += (*url <= ' ' || strchr(unsafe, *url) != NULL) ? 3 : 1;
+    }
+    return len;
+}
+
+static tlsuv_http_hdr *find_header(const um_header_list *hl, const char *name) {
     tlsuv_http_hdr *h;
-    LIST_FOREACH(h, &req->req_headers, _next) {
-        len += snprintf(buf + len, maxlen - len, "%s: %s\r\n", h->name, h->value);
+    LIST_FOREACH(h, hl, _next) {
+        if (strcasecmp(h->name, name) == 0) return h;
     }
+    return NULL;
+}
 
-    len += snprintf(buf + len, maxlen - len, "\r\n");
+bool http_req_client_header_used(tlsuv_http_req_t *req, const char *name) {
+    return find_header(&req->req_headers, name) == NULL;
+}
+
+// size of `name: value\r\n` lines, headers also present in `skip` are not counted
+static size_t headers_len(const um_header_list *hl, const um_header_list *skip) {
+    size_t len = 0;
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, hl, _next) {
+        if (skip && find_header(skip, h->name)) continue;
+        len += strlen(h->name) + 2 + strlen(h->value) + 2;
+    }
     return len;
 }
 
-void add_http_header(um_header_list *hl, const char* name, const char *value, size_t vallen) {
+static size_t render_headers(char *buf, const um_header_list *hl, const um_header_list *skip) {
+    char *p = buf;
     tlsuv_http_hdr *h;
+    LIST_FOREACH(h, hl, _next) {
+        if (skip && find_header(skip, h->name)) continue;
+        size_t n = strlen(h->name);
+        memcpy(p, h->name, n); p += n;
+        *p++ = ':'; *p++ = ' ';
+        n = strlen(h->value);
+        memcpy(p, h->value, n); p += n;
+        *p++ = '\r'; *p++ = '\n';
+    }
+    return p - buf;
+}
 
-    h = malloc(sizeof(tlsuv_http_hdr));
-    h->name = strdup(name);
-    LIST_INSERT_HEAD(hl, h, _next);
+struct http_hdr_block_s *http_hdr_block_new(const um_header_list *hl) {
+    size_t len = headers_len(hl, NULL);
+    struct http_hdr_block_s *b = tlsuv__malloc(sizeof(*b) + len);
+    b->refs = 1;
+    b->len = render_headers(b->data, hl, NULL);
+    return b;
+}
 
-    h->value = strndup(value, vallen);
+void http_hdr_block_unref(struct http_hdr_block_s *b) {
+    if (b && --b->refs == 0) {
+        tlsuv__free(b);
+    }
+}
+
+static const char HTTP_VERSION_LINE[] = " HTTP/1.1\r\n";
+
+http_req_wire *http_req_serialize(tlsuv_http_req_t *req) {
+    tlsuv_http_t *clt = req->client;
+    const char *pfx = "";
+    if (clt && clt->prefix) {
+        pfx = clt->prefix;
+    }
+
+    http_req_body_length(req);
+    expect_continue(req);
+
+    size_t line_len = strlen(req->method) + 1 + url_encoded_len(pfx) + url_encoded_len(req->path) +
+                      sizeof(HTTP_VERSION_LINE) - 1;
+    size_t hdr_len = headers_len(&req->req_headers, NULL) + 2;
+
+    // client headers are rendered once and shared, unless request replaces some of them
+    struct http_hdr_block_s *block = NULL;
+    const um_header_list *client_hdrs = NULL;
+    if (clt && !LIST_EMPTY(&clt->headers)) {
+        bool replaced = false;
+        tlsuv_http_hdr *h;
+        LIST_FOREACH(h, &clt->headers, _next) {
+            if (find_header(&req->req_headers, h->name)) {
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            if (clt->hdr_block == NULL) {
+                clt->hdr_block = http_hdr_block_new(&clt->headers);
+            }
+            block = clt->hdr_block;
+            block->refs++;
+        } else {
+            client_hdrs = &clt->headers;
+            hdr_len += headers_len(client_hdrs, &req->req_headers);
+        }
+    }
+
+    http_req_wire *w = tlsuv_pool_alloc(sizeof(http_req_wire) + line_len + hdr_len);
+    w->block = block;
+    char *p = w->data;
+
+    size_t n = strlen(req->method);
+    memcpy(p, req->method, n); p += n;
+    *p++ = ' ';
+    p += write_url_encoded(p, pfx);
+    p += write_url_encoded(p, req->path);
+    memcpy(p, HTTP_VERSION_LINE, sizeof(HTTP_VERSION_LINE) - 1);
+    p += sizeof(HTTP_VERSION_LINE) - 1;
+
+    char *hdrs = p;
+    if (client_hdrs) {
+        p += render_headers(p, client_hdrs, &req->req_headers);
+    }
+    p += render_headers(p, &req->req_headers, NULL);
+    *p++ = '\r'; *p++ = '\n';
+
+    w->len = p - w->data + (block ? block->len : 0);
+    if (block) {
+        w->bufs[0] = uv_buf_init(w->data, (unsigned int) line_len);
+        w->bufs[1] = uv_buf_init(block->data, (unsigned int) block->len);
+        w->bufs[2] = uv_buf_init(hdrs, (unsigned int) (p - hdrs));
+        w->nbufs = 3;
+    } else {
+        w->bufs[0] = uv_buf_init(w->data, (unsigned int) (p - w->data));
+        w->nbufs = 1;
+    }
+    return w;
+}
+
+char *http_req_wire_flatten(const http_req_wire *w) {
+    char *buf = tlsuv_pool_alloc(w->len);
+    char *p = buf;
+    for (unsigned int i = 0; i < w->nbufs; i++) {
+        memcpy(p, w->bufs[i].base, w->bufs[i].len);
+        p += w->bufs[i].len;
+    }
+    return buf;
+}
+
+void http_req_wire_free(http_req_wire *w) {
+    http_hdr_block_unref(w->block);
+    tlsuv_pool_free(w);
 }
 
 void set_http_header(um_header_list *hl, const char* name, const char *value) {
@@ -182,25 +883,32 @@ void set_http_header(um_header_list *hl, const char* name, const char *value) {
     if (value == NULL) {
         if (h != NULL) {
             LIST_REMOVE(h, _next);
-            free(h->value);
-            free(h->name);
-            free(h);
+            tlsuv__free(h->value);
+            tlsuv__free(h->name);
+            tlsuv__free(h);
         }
         return;
     }
 
     if (h == NULL) {
-        h = malloc(sizeof(tlsuv_http_hdr));
-        h->name = strdup(name);
+        h = tlsuv__malloc(sizeof(tlsuv_http_hdr));
+        h->name = tlsuv__strdup(name);
         LIST_INSERT_HEAD(hl, h, _next);
     } else {
-        free(h->value);
+        tlsuv__free(h->value);
     }
 
-    h->value = strdup(value);
+    h->value = tlsuv__strdup(value);
 }
 
 const char*tlsuv_http_resp_header(tlsuv_http_resp_t *resp, const char *name) {
+    tlsuv_http_req_t *req = resp->req;
+    int k;
+    if (req && &req->resp == resp && (k = known_header(name)) >= 0) {
+        tlsuv_http_hdr *h = req->hdr_arena ? req->hdr_arena->known[k] : NULL;
+        return h ? h->value : NULL;
+    }
+
     tlsuv_http_hdr *h;
     LIST_FOREACH(h, &resp->headers, _next) {
         if (strcasecmp(h->name, name) == 0) {
@@ -210,29 +918,62 @@ const char*tlsuv_http_resp_header(tlsuv_http_resp_t *resp, const char *name) {
     return NULL;
 }
 
+// informational response other than upgrade, final response follows it
+static bool interim_response(const llhttp_t *p) {
+    return p->status_code >= 100 && p->status_code < 200 && p->status_code != 101;
+}
+
 static int http_headers_complete_cb(llhttp_t *p) {
+    tlsuv_http_req_t *req = p->data;
+    if (interim_response(p)) {
+        UM_LOG(VERB, "interim response %d", p->status_code);
+        http_req_clear_headers(req, &req->resp.headers);
+        req->resp.curr_header = NULL;
+        tlsuv__free(req->resp.status);
+        req->resp.status = NULL;
+        req->resp.code = 0;
+        if (p->status_code == 100 && req->expect_wait) {
+            expect_done(req);
+        }
+        return 0;
+    }
+
     UM_LOG(VERB, "headers complete");
+    http_req_headers_complete(req);
+    return 0;
+}
 
-    tlsuv_http_req_t *req = p->data;
+void http_req_headers_complete(tlsuv_http_req_t *req) {
+    http_retry_headers(req);
     req->state = headers_received;
+    req_read_activity(req);
+    http_cache_headers(req);
 
     const char *compression = tlsuv_http_resp_header(&req->resp, "content-encoding");
     if (compression) {
-        set_http_header(&req->resp.headers, "content-length", NULL);
-        set_http_header(&req->resp.headers, "transfer-encoding", "chunked");
+        http_req_set_header(req, &req->resp.headers, "content-length", NULL);
+        http_req_set_header(req, &req->resp.headers, "transfer-encoding", "chunked");
     }
     if (req->resp_cb != NULL) {
         req->resp_cb(&req->resp, req->data);
     }
+    // cached body is captured after decoding
+    http_cache_capture(req);
     if (compression && req->resp.body_cb) {
-        req->inflater = um_get_inflater(compression, (data_cb) req->resp.body_cb, req);
+        tlsuv_http_t *clt = req->client;
+        if (clt && clt->inflater &&
+            um_reset_inflater(clt->inflater, compression, (data_cb) req->resp.body_cb, req) == 0) {
+            req->inflater = clt->inflater;
+            clt->inflater = NULL;
+        } else {
+            req->inflater = um_get_inflater(compression, (data_cb) req->resp.body_cb, req);
+        }
     }
-    return 0;
 }
 
 static int http_header_field_cb(llhttp_t *parser, const char *f, size_t len) {
     tlsuv_http_req_t *req = parser->data;
-    req->resp.curr_header = strndup(f, len);
+    req->resp.curr_header = arena_strndup(req, f, len);
     return 0;
 }
 
@@ -240,13 +981,19 @@ static int http_header_value_cb(llhttp_t *parser, const char *v, size_t len) {
     tlsuv_http_req_t *req = parser->data;
 
     if (len > 0) {
-        if (req->resp.curr_header) {
-            add_http_header(&req->resp.headers, req->resp.curr_header, v, len);
+        char *name = req->resp.curr_header;
+        if (name && keep_resp_header(req, name)) {
+            add_header(req, &req->resp.headers, name, v, len);
+        } else if (name) {
+            // name is not needed past this point
+            if (req->resp_hdr_cb) {
+                req->resp_hdr_cb(&req->resp, name, strlen(name), v, len);
+            }
+            arena_unwind(req, name);
         } else {
             UM_LOG(WARN, "Invalid HTTP parsing state, received header value[%.*s] without header name", (int)len, v);
         }
     }
-    if (req->resp.curr_header) free(req->resp.curr_header);
     req->resp.curr_header = NULL;
     return 0;
 }
@@ -256,15 +1003,25 @@ static int http_status_cb(llhttp_t *parser, const char *status, size_t len) {
     tlsuv_http_req_t *r = parser->data;
     r->resp.code = (int) parser->status_code;
     snprintf(r->resp.http_version, sizeof(r->resp.http_version), "%1d.%1d", parser->http_major, parser->http_minor);
-    r->resp.status = calloc(1, len+1);
+    r->resp.status = tlsuv__calloc(1, len+1);
     strncpy(r->resp.status, status, len);
     return 0;
 }
 
 static int http_message_cb(llhttp_t *parser) {
+    if (interim_response(parser)) {
+        return 0;
+    }
     UM_LOG(VERB, "message complete");
-    tlsuv_http_req_t *r = parser->data;
+    http_req_message_complete(parser->data);
+
+    // stop at message boundary so that pipelined responses are not parsed into this request
+    return llhttp_get_upgrade(parser) ? 0 : HPE_PAUSED;
+}
+
+void http_req_message_complete(tlsuv_http_req_t *r) {
     r->state = completed;
+    http_req_stop_timeouts(r);
     if (r->resp.body_cb) {
         if (r->inflater == NULL || um_inflate_state(r->inflater) == 1) {
             r->resp.body_cb(r, NULL, UV_EOF);
@@ -273,12 +1030,15 @@ static int http_message_cb(llhttp_t *parser) {
             r->resp.body_cb(r, NULL, UV_EINVAL);
         }
     }
+}
 
+static int http_body_cb(llhttp_t *parser, const char *body, size_t len) {
+    http_req_body(parser->data, body, len);
     return 0;
 }
 
-static int http_body_cb(llhttp_t *parser, const char *body, size_t len) {
-    tlsuv_http_req_t *r = parser->data;
+void http_req_body(tlsuv_http_req_t *r, const char *body, size_t len) {
+    req_read_activity(r);
     if (r->inflater) {
         um_inflate(r->inflater, body, len);
     } else {
@@ -286,5 +1046,4 @@ static int http_body_cb(llhttp_t *parser, const char *body, size_t len) {
             r->resp.body_cb(r, body, len);
         }
     }
-    return 0;
 }
\ No newline at end of file
@@ -17,25 +17,120 @@
 
 #include <tlsuv/http.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void http_req_init(tlsuv_http_req_t *req, const char *method, const char *path);
 void http_req_free(tlsuv_http_req_t *r);
+// returns request to its initial state to be sent again
+void http_req_reset(tlsuv_http_req_t *r);
 ssize_t http_req_process(tlsuv_http_req_t *req, const char* buf, ssize_t len);
 
-// write request header
-size_t http_req_write(tlsuv_http_req_t *req, char *buf, size_t maxlen);
+// client-wide headers rendered once, shared by requests being written
+struct http_hdr_block_s {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+struct http_hdr_block_s *http_hdr_block_new(const um_header_list *hl);
+void http_hdr_block_unref(struct http_hdr_block_s *b);
+
+// serialized request head: request line, client headers block, and request headers
+typedef struct http_req_wire_s {
+    struct http_hdr_block_s *block;
+    uv_buf_t bufs[3];
+    unsigned int nbufs;
+    size_t len;
+    char data[];
+} http_req_wire;
+
+// renders request head with exact size, release with http_req_wire_free() once it is written
+http_req_wire *http_req_serialize(tlsuv_http_req_t *req);
+// copies serialized head into one pool buffer of `w->len` bytes
+char *http_req_wire_flatten(const http_req_wire *w);
+void http_req_wire_free(http_req_wire *w);
+
+// replaces queued body chunks with their compressed data, if request body is compressed
+void http_req_encode_body(tlsuv_http_req_t *req);
+
+// detaches body source from request being released
+void http_body_src_release(struct http_body_src_s *src);
+// detaches response sink from request being released, sink completes when pending writes are done
+void http_body_sink_release(struct http_body_sink_s *sink);
+
+// checks if client-wide header is sent with the request (not replaced by request header)
+bool http_req_client_header_used(tlsuv_http_req_t *req, const char *name);
+
+// URL encoded request target (client path prefix and request path), caller frees it
+char *http_req_target(tlsuv_http_req_t *req);
+
+// sets Content-Length of request with body from queued chunks, unless request is chunked or length is set
+void http_req_body_length(tlsuv_http_req_t *req);
+
+// drops queued body chunks, calling their callbacks with `code`
+void http_req_clear_body(tlsuv_http_req_t *req, int code);
+
+// marks request as written, starts response inactivity timeout
+void http_req_written(tlsuv_http_req_t *req);
+void http_req_stop_timeouts(tlsuv_http_req_t *req);
+
+// fails queued or active request with `code`, same as cancel (@see tlsuv_http_req_cancel)
+int http_req_abort(tlsuv_http_t *clt, tlsuv_http_req_t *req, int code);
+
+// queues request by its priority class and tag
+void http_req_enqueue(tlsuv_http_t *clt, tlsuv_http_req_t *req);
+
+// retry and hedging of idempotent requests, @see tlsuv_http_retry_policy
+// takes over request that failed with `code` before its response headers: schedules retry, or releases request
+// if its duplicate carries on. Returns false if request has to be failed as usual
+bool http_retry_intercept(tlsuv_http_req_t *req, int code);
+// request was written, starts hedge delay
+void http_retry_written(tlsuv_http_req_t *req);
+// response headers received, the other request of hedged pair is cancelled
+void http_retry_headers(tlsuv_http_req_t *req);
+// request is being released, its duplicate is not needed anymore
+void http_retry_release(tlsuv_http_req_t *req);
+// takes request out of retry backoff queue, returns false if it is not waiting there
+bool http_retry_dequeue(tlsuv_http_req_t *req);
+// fails all requests waiting for retry
+void http_retry_fail_all(tlsuv_http_t *clt, int code);
+
+struct http_hdr_filter_s *http_hdr_filter_dup(const struct http_hdr_filter_s *f);
+
+// response events, shared by HTTP/1.1 parser and HTTP/2 streams
+void http_req_headers_complete(tlsuv_http_req_t *req);
+void http_req_body(tlsuv_http_req_t *req, const char *body, size_t len);
+void http_req_message_complete(tlsuv_http_req_t *req);
 
 void free_hdr_list(um_header_list *l);
 void set_http_header(um_header_list *hl, const char* name, const char *value);
 void set_http_headern(um_header_list *hl, const char* name, const char *value, size_t vallen);
 
+// request and response headers are stored in arena of the request, released by http_req_free()
+void http_req_add_header(tlsuv_http_req_t *req, um_header_list *hl,
+                         const char *name, size_t namelen, const char *value, size_t vallen);
+// replaces header with the same name, NULL value removes it
+void http_req_set_header(tlsuv_http_req_t *req, um_header_list *hl, const char *name, const char *value);
+void http_req_clear_headers(tlsuv_http_req_t *req, um_header_list *hl);
+// adds received response header (NUL terminated `name`), unless it is filtered out by request or client header set
+void http_req_resp_header(tlsuv_http_req_t *req, const char *name, size_t namelen, const char *value, size_t vallen);
+
 struct body_chunk_s {
     const char *chunk;
     size_t len;
     tlsuv_http_body_cb cb;
 
     tlsuv_http_req_t *req;
+    // bytes already taken from this chunk
+    size_t offset;
 
     struct body_chunk_s *next;
 };
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //UV_MBED_HTTP_REQ_H
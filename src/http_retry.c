@@ -0,0 +1,251 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_req.h"
+#include "http_sched.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+static bool retryable(const tlsuv_http_req_t *r) {
+    static const char *methods[] = {"GET", "HEAD", "OPTIONS", "TRACE", "PUT", "DELETE"};
+    if (r->req_chunked || r->req_body_size > 0 || r->req_body != NULL || r->body_src != NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strcmp(r->method, methods[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void policy_timer(tlsuv_http_req_t *req, tlsuv_timeout_cb cb, uint64_t millis) {
+    if (req->policy_timer.wheel == NULL) {
+        tlsuv_timeout_init(req->client->loop, &req->policy_timer);
+        req->policy_timer.data = req;
+    }
+    tlsuv_timeout_start(&req->policy_timer, cb, millis);
+}
+
+static void cancel_cb(tlsuv_timeout_t *t) {
+    tlsuv_http_req_t *req = t->data;
+    http_req_abort(req->client, req, UV_ECANCELED);
+}
+
+// loser of hedged pair is cancelled from the loop, not from callbacks of the winner
+static void mute(tlsuv_http_req_t *req) {
+    UM_LOG(VERB, "cancelling request[%s] of hedged pair", req->path);
+    req->muted = true;
+    req->resp_cb = NULL;
+    req->resp.body_cb = NULL;
+    req->resp_hdr_cb = NULL;
+    req->timing_cb = NULL;
+    policy_timer(req, cancel_cb, 0);
+}
+
+static void unlink_pair(tlsuv_http_req_t *req) {
+    if (req->hedge) {
+        req->hedge->hedge = NULL;
+        req->hedge = NULL;
+    }
+}
+
+// surviving request of hedged pair takes over remaining total timeout
+static void take_timeout(tlsuv_http_req_t *to, tlsuv_http_req_t *from) {
+    if (!tlsuv_timeout_active(&from->timeout)) {
+        return;
+    }
+    uint64_t now = uv_now(to->client->loop);
+    uint64_t left = from->timeout.expires > now ? from->timeout.expires - now : 1;
+    tlsuv_http_req_timeout(to, left);
+}
+
+static void retry_cb(tlsuv_timeout_t *t) {
+    tlsuv_http_req_t *req = t->data;
+    tlsuv_http_t *clt = req->client;
+
+    http_retry_dequeue(req);
+    UM_LOG(DEBG, "retrying request[%s] %u/%u", req->path, req->retries, clt->retry.max_retries);
+    // request keeps its tag, it goes ahead of requests of its class queued later
+    http_req_enqueue(clt, req);
+    http_sched_ref(clt, true);
+    http_sched_mark(clt);
+}
+
+bool http_retry_intercept(tlsuv_http_req_t *req, int code) {
+    tlsuv_http_t *clt = req->client;
+    if (req->muted) {
+        http_req_free(req);
+        tlsuv__free(req);
+        return true;
+    }
+    if (clt == NULL || req->state >= headers_received || code == UV_ECANCELED || clt->closing) {
+        return false;
+    }
+
+    tlsuv_http_req_t *other = req->hedge;
+    if (other != NULL) {
+        // duplicate carries on alone
+        UM_LOG(DEBG, "request[%s] of hedged pair failed: %d/%s", req->path, code, uv_strerror(code));
+        unlink_pair(req);
+        take_timeout(other, req);
+        http_req_free(req);
+        tlsuv__free(req);
+        return true;
+    }
+
+    if (req->retries >= clt->retry.max_retries || !retryable(req)) {
+        return false;
+    }
+
+    uint64_t delay = clt->retry.backoff;
+    for (unsigned int i = 0; i < req->retries && delay < clt->retry.max_backoff; i++) {
+        delay *= 2;
+    }
+    if (clt->retry.max_backoff > 0 && delay > clt->retry.max_backoff) {
+        delay = clt->retry.max_backoff;
+    }
+    req->retries++;
+    clt->retry_stats.retries++;
+    UM_LOG(DEBG, "request[%s] failed: %d/%s, retry in %" PRIu64 "ms",
+           req->path, code, uv_strerror(code), delay);
+
+    // request is sent again from scratch
+    http_req_reset(req);
+
+    req->retry_wait = true;
+    STAILQ_INSERT_TAIL(&clt->retry_q, req, _next);
+    policy_timer(req, retry_cb, delay);
+    http_sched_ref(clt, true);
+    return true;
+}
+
+static void hedge_cb(tlsuv_timeout_t *t) {
+    tlsuv_http_req_t *req = t->data;
+    tlsuv_http_t *clt = req->client;
+    if (req->state >= headers_received || req->hedged || req->muted || clt->closing) {
+        return;
+    }
+
+    tlsuv_http_req_t *dup = tlsuv_http_req(clt, req->method, req->path, req->resp_cb, req->data);
+    // keep original header order, list is built by prepending
+    size_t count = 0;
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, &req->req_headers, _next) count++;
+    if (count > 0) {
+        tlsuv_http_hdr **hdrs = tlsuv__malloc(count * sizeof(*hdrs));
+        size_t i = 0;
+        LIST_FOREACH(h, &req->req_headers, _next) hdrs[i++] = h;
+        while (i-- > 0) {
+            tlsuv_http_req_header(dup, hdrs[i]->name, hdrs[i]->value);
+        }
+        tlsuv__free(hdrs);
+    }
+    dup->early_data = req->early_data;
+    dup->timing_cb = req->timing_cb;
+    dup->resp_hdr_cb = req->resp_hdr_cb;
+    dup->resp_filter = req->resp_filter ? http_hdr_filter_dup(req->resp_filter) : NULL;
+    if (req->read_timeout_ms > 0) {
+        tlsuv_http_req_read_timeout(dup, req->read_timeout_ms);
+    }
+
+    // duplicate takes place of the original in the queue
+    STAILQ_REMOVE(&clt->requests, dup, tlsuv_http_req_s, _next);
+    dup->priority = req->priority;
+    dup->prio_tag = req->prio_tag;
+    http_req_enqueue(clt, dup);
+
+    req->hedged = dup->hedged = true;
+    dup->hedge_copy = true;
+    req->hedge = dup;
+    dup->hedge = req;
+    clt->retry_stats.hedges++;
+    UM_LOG(DEBG, "no response to request[%s] after %" PRIu64 "ms, sending duplicate", req->path, clt->retry.hedge_delay);
+}
+
+void http_retry_written(tlsuv_http_req_t *req) {
+    tlsuv_http_t *clt = req->client;
+    if (clt == NULL || clt->retry.hedge_delay == 0 || req->hedged || req->muted || !retryable(req)) {
+        return;
+    }
+    policy_timer(req, hedge_cb, clt->retry.hedge_delay);
+}
+
+void http_retry_headers(tlsuv_http_req_t *req) {
+    tlsuv_timeout_stop(&req->policy_timer);
+    if (req->muted) {
+        return;
+    }
+    if (req->hedge_copy) {
+        req->client->retry_stats.hedges_won++;
+    }
+
+    tlsuv_http_req_t *other = req->hedge;
+    if (other != NULL) {
+        unlink_pair(req);
+        if (req->hedge_copy) {
+            take_timeout(req, other);
+        }
+        mute(other);
+    }
+}
+
+void http_retry_release(tlsuv_http_req_t *req) {
+    tlsuv_http_req_t *other = req->hedge;
+    if (other != NULL) {
+        unlink_pair(req);
+        mute(other);
+    }
+    tlsuv_timeout_close(&req->policy_timer);
+}
+
+bool http_retry_dequeue(tlsuv_http_req_t *req) {
+    if (!req->retry_wait) {
+        return false;
+    }
+    STAILQ_REMOVE(&req->client->retry_q, req, tlsuv_http_req_s, _next);
+    req->retry_wait = false;
+    tlsuv_timeout_stop(&req->policy_timer);
+    return true;
+}
+
+void http_retry_fail_all(tlsuv_http_t *clt, int code) {
+    while (!STAILQ_EMPTY(&clt->retry_q)) {
+        http_req_abort(clt, STAILQ_FIRST(&clt->retry_q), code);
+    }
+}
+
+int tlsuv_http_retry_policy(tlsuv_http_t *clt, const tlsuv_http_retry_policy_t *policy) {
+    if (policy == NULL) {
+        memset(&clt->retry, 0, sizeof(clt->retry));
+        return 0;
+    }
+    if (policy->max_backoff > 0 && policy->max_backoff < policy->backoff) {
+        return UV_EINVAL;
+    }
+    clt->retry = *policy;
+    return 0;
+}
+
+int tlsuv_http_retry_stats(tlsuv_http_t *clt, tlsuv_http_retry_stats_t *stats) {
+    *stats = clt->retry_stats;
+    return 0;
+}
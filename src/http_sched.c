@@ -0,0 +1,233 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "http_sched.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+struct http_sched_s {
+    uv_loop_t *loop;
+    // drains run queue after I/O of each iteration
+    uv_check_t check;
+    // keeps loop from blocking in poll while run queue is not empty
+    uv_idle_t idle;
+    // wakes the loop for clients marked from other threads
+    uv_async_t async;
+    int closing_handles;
+
+    size_t clients;
+    // clients keeping the loop alive
+    size_t refs;
+    TAILQ_HEAD(run_q, tlsuv_http_s) run_queue;
+    size_t queued;
+
+    // inboxes of clients woken from other threads
+    struct mpsc_queue remote;
+
+    struct http_share_list shared;
+
+    LIST_ENTRY(http_sched_s) _next;
+};
+
+static LIST_HEAD(scheds, http_sched_s) scheds = LIST_HEAD_INITIALIZER(scheds);
+static uv_mutex_t scheds_lock;
+static uv_once_t scheds_once = UV_ONCE_INIT;
+
+static void init_scheds_lock(void) {
+    uv_mutex_init(&scheds_lock);
+}
+
+static void sched_check_cb(uv_check_t *check) {
+    struct http_sched_s *s = check->data;
+
+    // clients marked while draining are left for the next iteration
+    size_t count = s->queued;
+    while (count-- > 0 && !TAILQ_EMPTY(&s->run_queue)) {
+        tlsuv_http_t *clt = TAILQ_FIRST(&s->run_queue);
+        TAILQ_REMOVE(&s->run_queue, clt, _sched_next);
+        clt->sched_queued = false;
+        s->queued--;
+        http_client_run(clt);
+    }
+
+    if (TAILQ_EMPTY(&s->run_queue)) {
+        uv_idle_stop(&s->idle);
+    }
+}
+
+static void sched_idle_cb(uv_idle_t *idle) {
+    // nothing to do, run queue is drained by check handle
+}
+
+#define remote_of(n) ((struct http_remote_s *) ((char *) (n) - offsetof(struct http_remote_s, node)))
+
+static void drain_remote(struct http_sched_s *s) {
+    struct mpsc_node *n;
+    while ((n = mpsc_pop(&s->remote)) != NULL) {
+        struct http_remote_s *r = remote_of(n);
+        if (r->clt == NULL) {
+            tlsuv__free(r);
+            continue;
+        }
+        // wakeups after this point queue inbox again
+        tlsuv_atomic_xchg_int(&r->queued, 0);
+        http_sched_mark(r->clt);
+    }
+}
+
+static void sched_async_cb(uv_async_t *async) {
+    drain_remote(async->data);
+}
+
+static void sched_handle_closed(uv_handle_t *h) {
+    struct http_sched_s *s = h->data;
+    if (--s->closing_handles == 0) {
+        // release inboxes of detached clients
+        drain_remote(s);
+        tlsuv__free(s);
+    }
+}
+
+void http_sched_attach(tlsuv_http_t *clt, uv_loop_t *loop) {
+    uv_once(&scheds_once, init_scheds_lock);
+
+    struct http_sched_s *s;
+    uv_mutex_lock(&scheds_lock);
+    LIST_FOREACH(s, &scheds, _next) {
+        if (s->loop == loop) break;
+    }
+
+    if (s == NULL) {
+        s = tlsuv__calloc(1, sizeof(*s));
+        s->loop = loop;
+        TAILQ_INIT(&s->run_queue);
+        mpsc_init(&s->remote);
+        LIST_INIT(&s->shared);
+
+        uv_check_init(loop, &s->check);
+        s->check.data = s;
+        uv_check_start(&s->check, sched_check_cb);
+        uv_unref((uv_handle_t *) &s->check);
+
+        uv_idle_init(loop, &s->idle);
+        s->idle.data = s;
+        uv_unref((uv_handle_t *) &s->idle);
+
+        uv_async_init(loop, &s->async, sched_async_cb);
+        s->async.data = s;
+        uv_unref((uv_handle_t *) &s->async);
+
+        LIST_INSERT_HEAD(&scheds, s, _next);
+    }
+    s->clients++;
+    uv_mutex_unlock(&scheds_lock);
+
+    clt->loop = loop;
+    clt->sched = s;
+    clt->sched_queued = false;
+    clt->sched_ref = false;
+
+    clt->remote = tlsuv__calloc(1, sizeof(*clt->remote));
+    clt->remote->clt = clt;
+    mpsc_init(&clt->remote->submits);
+}
+
+void http_sched_detach(tlsuv_http_t *clt) {
+    struct http_sched_s *s = clt->sched;
+    if (s == NULL) {
+        return;
+    }
+
+    http_sched_ref(clt, false);
+    if (clt->sched_queued) {
+        TAILQ_REMOVE(&s->run_queue, clt, _sched_next);
+        clt->sched_queued = false;
+        s->queued--;
+    }
+
+    // inbox still linked in wakeup queue is freed when it is popped
+    struct http_remote_s *r = clt->remote;
+    clt->remote = NULL;
+    r->clt = NULL;
+    if (tlsuv_atomic_xchg_int(&r->queued, 1) == 0) {
+        tlsuv__free(r);
+    }
+    clt->sched = NULL;
+
+    uv_mutex_lock(&scheds_lock);
+    bool last = --s->clients == 0;
+    if (last) {
+        LIST_REMOVE(s, _next);
+    }
+    uv_mutex_unlock(&scheds_lock);
+
+    if (last) {
+        s->closing_handles = 3;
+        uv_close((uv_handle_t *) &s->check, sched_handle_closed);
+        uv_close((uv_handle_t *) &s->idle, sched_handle_closed);
+        uv_close((uv_handle_t *) &s->async, sched_handle_closed);
+    }
+}
+
+void http_sched_mark(tlsuv_http_t *clt) {
+    struct http_sched_s *s = clt->sched;
+    if (s == NULL || clt->sched_queued) {
+        return;
+    }
+
+    TAILQ_INSERT_TAIL(&s->run_queue, clt, _sched_next);
+    clt->sched_queued = true;
+    if (s->queued++ == 0) {
+        uv_idle_start(&s->idle, sched_idle_cb);
+    }
+}
+
+void http_sched_wakeup(tlsuv_http_t *clt) {
+    struct http_sched_s *s = clt->sched;
+    struct http_remote_s *r = clt->remote;
+    if (s == NULL || r == NULL) {
+        return;
+    }
+
+    if (tlsuv_atomic_xchg_int(&r->queued, 1) == 0) {
+        mpsc_push(&s->remote, &r->node);
+        uv_async_send(&s->async);
+    }
+}
+
+void http_sched_ref(tlsuv_http_t *clt, bool ref) {
+    struct http_sched_s *s = clt->sched;
+    if (s == NULL || clt->sched_ref == ref) {
+        return;
+    }
+
+    clt->sched_ref = ref;
+    if (ref) {
+        if (s->refs++ == 0) {
+            uv_ref((uv_handle_t *) &s->check);
+        }
+    } else if (--s->refs == 0) {
+        uv_unref((uv_handle_t *) &s->check);
+    }
+}
+
+struct http_share_list *http_sched_shared(tlsuv_http_t *clt) {
+    return clt->sched ? &clt->sched->shared : NULL;
+}
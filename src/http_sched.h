@@ -0,0 +1,60 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_HTTP_SCHED_H
+#define TLSUV_HTTP_SCHED_H
+
+#include <tlsuv/http.h>
+#include "mpsc.h"
+
+/**
+ * Per-loop scheduler of HTTP clients.
+ * Clients that have work are put on the run queue, which is drained once per loop iteration from a check handle.
+ * One set of handles serves all clients of the loop, it is released with the last client.
+ */
+
+// cross-thread inbox of a client, allocated on attach
+struct http_remote_s {
+    // link in wakeup queue of the scheduler
+    struct mpsc_node node;
+    // NULL once client is detached, inbox is freed by the scheduler then
+    tlsuv_http_t *clt;
+    // set while node is in wakeup queue
+    int queued;
+    // requests submitted from other threads, @see tlsuv_http_req_submit
+    struct mpsc_queue submits;
+};
+
+LIST_HEAD(http_share_list, tlsuv_http_s);
+
+// implemented by the HTTP client, called from the scheduler
+void http_client_run(tlsuv_http_t *clt);
+
+void http_sched_attach(tlsuv_http_t *clt, uv_loop_t *loop);
+void http_sched_detach(tlsuv_http_t *clt);
+
+// queues client to be processed in this (or the next) loop iteration, loop thread only
+void http_sched_mark(tlsuv_http_t *clt);
+
+// same as http_sched_mark() for any thread, lock-free, client must stay attached until it is processed
+void http_sched_wakeup(tlsuv_http_t *clt);
+
+// loop is kept alive while any of its clients holds a reference
+void http_sched_ref(tlsuv_http_t *clt, bool ref);
+
+// clients of the loop that share idle connections, @see tlsuv_http_share_connections
+struct http_share_list *http_sched_shared(tlsuv_http_t *clt);
+
+#endif //TLSUV_HTTP_SCHED_H
@@ -0,0 +1,279 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_req.h"
+#include "http_sched.h"
+#include "http_submit.h"
+#include "um_debug.h"
+#include "win32_compat.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_HTTP
+#include "alloc.h"
+
+struct tlsuv_http_reply_q_s {
+    struct mpsc_queue q;
+    void (*notify)(void *ctx);
+    void *notify_ctx;
+};
+
+struct http_result_s {
+    struct mpsc_node node;
+    size_t body_cap;
+    tlsuv_http_result_t res;
+};
+
+// submission copied into one block: header pointers, then strings and body
+struct http_submit_s {
+    struct mpsc_node node;
+    tlsuv_http_result_cb cb;
+    tlsuv_http_reply_q_t *reply_q;
+    void *ctx;
+    uint64_t timeout;
+    tlsuv_http_priority priority;
+
+    const char *method;
+    const char *path;
+    const char **headers;
+    const char *body;
+    size_t body_len;
+
+    struct http_result_s *result;
+    char data[];
+};
+
+#define node_to(type, n) ((type *) ((char *) (n) - offsetof(type, node)))
+#define result_of(res) ((struct http_result_s *) ((char *) (res) - offsetof(struct http_result_s, res)))
+
+static char *copy_str(char **p, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *d = memcpy(*p, s, len);
+    *p += len;
+    return d;
+}
+
+int tlsuv_http_req_submit(tlsuv_http_t *clt, const tlsuv_http_submit_t *sub) {
+    if (clt == NULL || sub == NULL || sub->method == NULL || sub->path == NULL ||
+        (sub->body == NULL && sub->body_len > 0)) {
+        return UV_EINVAL;
+    }
+
+    struct http_remote_s *inbox = clt->remote;
+    if (inbox == NULL) {
+        return UV_EINVAL;
+    }
+
+    size_t count = 0;
+    size_t len = strlen(sub->method) + strlen(sub->path) + 2 + sub->body_len;
+    if (sub->headers) {
+        for (; sub->headers[count] != NULL; count++) {
+            len += strlen(sub->headers[count]) + 1;
+        }
+        if (count % 2 != 0) {
+            return UV_EINVAL;
+        }
+    }
+
+    size_t ptrs = (count + 1) * sizeof(char *);
+    struct http_submit_s *s = tlsuv__malloc(sizeof(*s) + ptrs + len);
+    if (s == NULL) {
+        return UV_ENOMEM;
+    }
+
+    s->cb = sub->cb;
+    s->reply_q = sub->reply_q;
+    s->ctx = sub->ctx;
+    s->timeout = sub->timeout;
+    s->priority = sub->priority;
+    s->result = NULL;
+
+    s->headers = (const char **) s->data;
+    char *p = s->data + ptrs;
+    for (size_t i = 0; i < count; i++) {
+        s->headers[i] = copy_str(&p, sub->headers[i]);
+    }
+    s->headers[count] = NULL;
+    s->method = copy_str(&p, sub->method);
+    s->path = copy_str(&p, sub->path);
+    s->body_len = sub->body_len;
+    s->body = sub->body_len > 0 ? memcpy(p, sub->body, sub->body_len) : NULL;
+
+    mpsc_push(&inbox->submits, &s->node);
+    http_sched_wakeup(clt);
+    return 0;
+}
+
+static void submit_complete(struct http_submit_s *s, int code) {
+    struct http_result_s *r = s->result;
+    if (r == NULL) {
+        r = tlsuv__calloc(1, sizeof(*r));
+    }
+    if (code < 0) {
+        r->res.code = code;
+    }
+    r->res.ctx = s->ctx;
+
+    tlsuv_http_reply_q_t *q = s->reply_q;
+    tlsuv_http_result_cb cb = s->cb;
+    tlsuv__free(s);
+
+    if (q != NULL) {
+        http_reply_q_post(q, &r->res);
+    } else if (cb != NULL) {
+        cb(&r->res);
+    } else {
+        tlsuv_http_result_free(&r->res);
+    }
+}
+
+static void submit_body_cb(tlsuv_http_req_t *req, const char *body, ssize_t len) {
+    struct http_submit_s *s = req->data;
+    struct http_result_s *r = s->result;
+
+    if (len < 0) {
+        submit_complete(s, len == UV_EOF ? 0 : (int) len);
+        return;
+    }
+
+    tlsuv_http_result_t *res = &r->res;
+    if (res->body_len + (size_t) len > r->body_cap) {
+        size_t cap = r->body_cap ? r->body_cap : 1024;
+        while (cap < res->body_len + (size_t) len) {
+            cap *= 2;
+        }
+        res->body = tlsuv__realloc(res->body, cap + 1);
+        r->body_cap = cap;
+    }
+    memcpy(res->body + res->body_len, body, len);
+    res->body_len += len;
+    res->body[res->body_len] = 0;
+}
+
+static void submit_resp_cb(tlsuv_http_resp_t *resp, void *ctx) {
+    struct http_submit_s *s = ctx;
+    if (resp->code < 0) {
+        submit_complete(s, resp->code);
+        return;
+    }
+
+    struct http_result_s *r = tlsuv__calloc(1, sizeof(*r));
+    s->result = r;
+    r->res.code = resp->code;
+    r->res.status = resp->status ? tlsuv__strdup(resp->status) : NULL;
+
+    // keep received order
+    tlsuv_http_hdr *h, *last = NULL;
+    LIST_FOREACH(h, &resp->headers, _next) {
+        tlsuv_http_hdr *c = tlsuv__malloc(sizeof(*c));
+        c->name = tlsuv__strdup(h->name);
+        c->value = tlsuv__strdup(h->value);
+        if (last == NULL) {
+            LIST_INSERT_HEAD(&r->res.headers, c, _next);
+        } else {
+            LIST_INSERT_AFTER(last, c, _next);
+        }
+        last = c;
+    }
+
+    resp->body_cb = submit_body_cb;
+}
+
+static void submit_start(tlsuv_http_t *clt, struct http_submit_s *s) {
+    tlsuv_http_req_t *req = tlsuv_http_req(clt, s->method, s->path, submit_resp_cb, s);
+    for (size_t i = 0; s->headers[i] != NULL; i += 2) {
+        tlsuv_http_req_header(req, s->headers[i], s->headers[i + 1]);
+    }
+    tlsuv_http_req_priority(req, s->priority);
+    if (s->timeout > 0) {
+        tlsuv_http_req_timeout(req, s->timeout);
+    }
+    if (s->body_len > 0) {
+        tlsuv_http_req_data(req, s->body, s->body_len, NULL);
+    }
+}
+
+void http_submit_drain(tlsuv_http_t *clt) {
+    struct http_remote_s *inbox = clt->remote;
+    if (inbox == NULL) {
+        return;
+    }
+
+    struct mpsc_node *n;
+    while ((n = mpsc_pop(&inbox->submits)) != NULL) {
+        struct http_submit_s *s = node_to(struct http_submit_s, n);
+        if (clt->closing) {
+            submit_complete(s, UV_ECANCELED);
+        } else {
+            submit_start(clt, s);
+        }
+    }
+}
+
+const char *tlsuv_http_result_header(tlsuv_http_result_t *res, const char *name) {
+    tlsuv_http_hdr *h;
+    LIST_FOREACH(h, &res->headers, _next) {
+        if (strcasecmp(h->name, name) == 0) {
+            return h->value;
+        }
+    }
+    return NULL;
+}
+
+void tlsuv_http_result_free(tlsuv_http_result_t *res) {
+    if (res == NULL) {
+        return;
+    }
+
+    struct http_result_s *r = result_of(res);
+    free_hdr_list(&res->headers);
+    tlsuv__free(res->status);
+    tlsuv__free(res->body);
+    tlsuv__free(r);
+}
+
+tlsuv_http_reply_q_t *tlsuv_http_reply_q_new(void (*notify)(void *ctx), void *ctx) {
+    tlsuv_http_reply_q_t *q = tlsuv__calloc(1, sizeof(*q));
+    mpsc_init(&q->q);
+    q->notify = notify;
+    q->notify_ctx = ctx;
+    return q;
+}
+
+void http_reply_q_post(tlsuv_http_reply_q_t *q, tlsuv_http_result_t *res) {
+    struct http_result_s *r = result_of(res);
+    mpsc_push(&q->q, &r->node);
+    if (q->notify) {
+        q->notify(q->notify_ctx);
+    }
+}
+
+tlsuv_http_result_t *tlsuv_http_reply_q_pop(tlsuv_http_reply_q_t *q) {
+    struct mpsc_node *n = mpsc_pop(&q->q);
+    return n ? &node_to(struct http_result_s, n)->res : NULL;
+}
+
+void tlsuv_http_reply_q_free(tlsuv_http_reply_q_t *q) {
+    if (q == NULL) {
+        return;
+    }
+
+    tlsuv_http_result_t *res;
+    while ((res = tlsuv_http_reply_q_pop(q)) != NULL) {
+        tlsuv_http_result_free(res);
+    }
+    tlsuv__free(q);
+}
@@ -0,0 +1,27 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_HTTP_SUBMIT_H
+#define TLSUV_HTTP_SUBMIT_H
+
+#include <tlsuv/http.h>
+
+// starts requests submitted from other threads, or fails them if client is closing, loop thread only
+void http_submit_drain(tlsuv_http_t *clt);
+
+// delivers result to reply queue and notifies its consumer
+void http_reply_q_post(tlsuv_http_reply_q_t *q, tlsuv_http_result_t *res);
+
+#endif //TLSUV_HTTP_SUBMIT_H
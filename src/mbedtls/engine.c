@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 #include <mbedtls/x509_csr.h>
 #include <mbedtls/ssl.h>
 #include <mbedtls/debug.h>
@@ -33,10 +34,19 @@
 
 #include "keys.h"
 #include "../bio.h"
+#include "../session_cache.h"
+#include "../ca_store.h"
+#include "../trust_store.h"
+#include "../verify_cache.h"
+#include "../record_sizing.h"
+#include "../cpu_features.h"
 #include "mbed_p11.h"
 #include "../um_debug.h"
 #include <tlsuv/tlsuv.h>
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "../alloc.h"
+
 #if _WIN32
 #include <wincrypt.h>
 #pragma comment (lib, "crypt32.lib")
@@ -58,6 +68,10 @@ const char *const caFiles[] = {
 };
 #define NUM_CAFILES (sizeof(caFiles) / sizeof(char *))
 
+#if defined(MBEDTLS_SSL_EARLY_DATA) && defined(MBEDTLS_SSL_CLI_C)
+#define TLSUV_EARLY_DATA 1
+#endif
+
 struct mbedtls_context {
     mbedtls_ssl_config config;
     struct priv_key_s *own_key;
@@ -65,11 +79,26 @@ struct mbedtls_context {
     const char **alpn_protocols;
     int (*cert_verify_f)(void *cert, void *v_ctx);
     void *verify_ctx;
+    tlsuv_verify_cache *verified;
+    size_t verify_cache_size;
+    unsigned int verify_cache_ttl;
+
+    tlsuv_session_cache *sessions;
+    char *alpn_key;
+    tls_record_sizing record_sizing;
+
+    bool lean;
+
+    // released engines kept for reuse
+    SLIST_HEAD(idle_engines, mbedtls_engine) idle;
+    size_t idle_count;
+    size_t pool_max;
 };
 
 struct mbedtls_engine {
+    struct mbedtls_context *ctx;
     mbedtls_ssl_context *ssl;
-    mbedtls_ssl_session *session;
+    char *host;
     tlsuv_BIO *in;
     tlsuv_BIO *out;
     int error;
@@ -78,6 +107,15 @@ struct mbedtls_engine {
     struct in6_addr addr;
     int (*cert_verify_f)(void *cert, void *v_ctx);
     void *verify_ctx;
+
+    char *early_data;
+    size_t early_len;
+
+    struct record_sizer sizer;
+
+    tls_traffic_stats stats;
+    tls_engine *self;
+    SLIST_ENTRY(mbedtls_engine) _next;
 };
 
 static void mbedtls_set_alpn_protocols(void *ctx, const char** protos, int len);
@@ -97,6 +135,9 @@ mbedtls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *
 static const char* mbedtls_get_alpn(void *engine);
 
 static int mbedtls_write(void *engine, const char *data, size_t data_len, char *out, size_t *out_bytes, size_t maxout);
+static int mbedtls_write_vec(void *engine, const uv_buf_t *bufs, unsigned int nbufs, uv_buf_t *out, unsigned int *nout);
+static int mbedtls_write_early_data(void *engine, const char *data, size_t len);
+static tls_early_data_status mbedtls_early_data_status(void *engine);
 
 static int
 mbedtls_read(void *engine, const char *ssl_in, size_t ssl_in_len, char *out, size_t *out_bytes, size_t maxout);
@@ -128,6 +169,17 @@ static int generate_csr(tlsuv_private_key_t key, char **pem, size_t *pemlen, ...
 
 static int mbedtls_load_cert(tls_cert *c, const char *cert, size_t certlen);
 
+static void mbedtls_get_session_stats(tls_context *ctx, tls_session_stats *stats);
+static int mbedtls_set_record_sizing(tls_context *ctx, const tls_record_sizing *sizing);
+static int mbedtls_set_verify_cache(tls_context *ctx, size_t max_entries, unsigned int ttl);
+static int mbedtls_set_cipher_profile(tls_context *ctx, tls_cipher_profile profile);
+static int mbedtls_set_engine_pool(tls_context *ctx, size_t max_idle);
+static int mbedtls_set_idle_lean(tls_context *ctx, int enable);
+static int mbedtls_idle_lean(void *engine);
+static size_t mbedtls_mem_usage(void *engine);
+static void engine_destroy(struct mbedtls_engine *e);
+static void engine_pool_flush(struct mbedtls_context *c);
+
 static tls_context_api mbedtls_context_api = {
         .version = mbedtls_version,
         .strerror = mbedtls_error,
@@ -147,8 +199,19 @@ static tls_context_api mbedtls_context_api = {
         .load_pkcs11_key = load_key_p11,
         .load_cert = mbedtls_load_cert,
         .generate_csr_to_pem = generate_csr,
+        .get_session_stats = mbedtls_get_session_stats,
+        .set_record_sizing = mbedtls_set_record_sizing,
+        .set_verify_cache = mbedtls_set_verify_cache,
+        .set_cipher_profile = mbedtls_set_cipher_profile,
+        .set_engine_pool = mbedtls_set_engine_pool,
+        .set_idle_lean = mbedtls_set_idle_lean,
 };
 
+static tls_traffic_stats *mbedtls_engine_stats(void *engine) {
+    struct mbedtls_engine *eng = engine;
+    return &eng->stats;
+}
+
 static tls_engine_api mbedtls_engine_api = {
         .handshake_state = mbedtls_hs_state,
         .handshake = mbedtls_continue_hs,
@@ -157,7 +220,13 @@ static tls_engine_api mbedtls_engine_api = {
         .write = mbedtls_write,
         .read = mbedtls_read,
         .reset = mbedtls_reset,
-        .strerror = mbedtls_eng_error
+        .strerror = mbedtls_eng_error,
+        .write_vec = mbedtls_write_vec,
+        .write_early_data = mbedtls_write_early_data,
+        .early_data_status = mbedtls_early_data_status,
+        .stats = mbedtls_engine_stats,
+        .idle_lean = mbedtls_idle_lean,
+        .mem_usage = mbedtls_mem_usage,
 };
 
 
@@ -183,11 +252,37 @@ static const char *mbedtls_eng_error(void *eng) {
     return mbedtls_error(e->error);
 }
 
+static void free_session(void *s) {
+    mbedtls_ssl_session_free(s);
+    tlsuv__free(s);
+}
+
+static const char *session_alpn_key(struct mbedtls_context *c) {
+    return c->alpn_key ? c->alpn_key : "";
+}
+
+// saves current connection session into the context cache
+static void save_session(struct mbedtls_engine *eng) {
+    if (eng->host == NULL) {
+        return;
+    }
+
+    mbedtls_ssl_session *session = tlsuv__calloc(1, sizeof(mbedtls_ssl_session));
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_get_session(eng->ssl, session) == 0) {
+        tlsuv_session_cache_put(eng->ctx->sessions, eng->host, session_alpn_key(eng->ctx), session);
+    } else {
+        free_session(session);
+    }
+}
+
 tls_context *new_mbedtls_ctx(const char *ca, size_t ca_len) {
-    tls_context *ctx = calloc(1, sizeof(tls_context));
+    tls_context *ctx = tlsuv__calloc(1, sizeof(tls_context));
     ctx->api = &mbedtls_context_api;
-    struct mbedtls_context *c = calloc(1, sizeof(struct mbedtls_context));
+    struct mbedtls_context *c = tlsuv__calloc(1, sizeof(struct mbedtls_context));
     init_ssl_context(&c->config, ca, ca_len);
+    c->sessions = tlsuv_session_cache_new(TLSUV_SESSION_CACHE_SIZE, free_session);
+    SLIST_INIT(&c->idle);
     ctx->ctx = c;
 
     return ctx;
@@ -195,32 +290,24 @@ tls_context *new_mbedtls_ctx(const char *ca, size_t ca_len) {
 
 static void tls_debug_f(void *ctx, int level, const char *file, int line, const char *str);
 
-static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf, size_t cabuf_len) {
-    char *tls_debug = getenv("MBEDTLS_DEBUG");
-    if (tls_debug != NULL) {
-        int level = (int) strtol(tls_debug, NULL, 10);
-        mbedtls_debug_set_threshold(level);
-    }
-
-    mbedtls_ssl_config_init(ssl_config);
-    mbedtls_ssl_conf_dbg(ssl_config, tls_debug_f, stdout);
-    mbedtls_ssl_config_defaults(ssl_config,
-                                MBEDTLS_SSL_IS_CLIENT,
-                                MBEDTLS_SSL_TRANSPORT_STREAM,
-                                MBEDTLS_SSL_PRESET_DEFAULT);
-    mbedtls_ssl_conf_renegotiation(ssl_config, MBEDTLS_SSL_RENEGOTIATION_ENABLED);
-    mbedtls_ssl_conf_authmode(ssl_config, MBEDTLS_SSL_VERIFY_REQUIRED);
-    mbedtls_ctr_drbg_context *drbg = calloc(1, sizeof(mbedtls_ctr_drbg_context));
-    mbedtls_entropy_context *entropy = calloc(1, sizeof(mbedtls_entropy_context));
-    mbedtls_ctr_drbg_init(drbg);
-    mbedtls_entropy_init(entropy);
-    unsigned char *seed = malloc(MBEDTLS_ENTROPY_MAX_SEED_SIZE); // uninitialized memory
-    mbedtls_ctr_drbg_seed(drbg, mbedtls_entropy_func, entropy, seed, MBEDTLS_ENTROPY_MAX_SEED_SIZE);
-    mbedtls_ssl_conf_rng(ssl_config, mbedtls_ctr_drbg_random, drbg);
-    mbedtls_x509_crt *ca = calloc(1, sizeof(mbedtls_x509_crt));
+static void *load_ca_chain(const char *cabuf, size_t cabuf_len) {
+    mbedtls_x509_crt *ca = tlsuv__calloc(1, sizeof(mbedtls_x509_crt));
     mbedtls_x509_crt_init(ca);
 
-    if (cabuf != NULL) {
+    tlsuv_trust_store *ts = cabuf ? tlsuv_trust_store_open(cabuf) : NULL;
+    if (ts != NULL) {
+        // chain is a parsed list, but DER is decoded directly from mapping without PEM/base64 pass
+        size_t len;
+        const uint8_t *der;
+        for (size_t idx = 0; (der = tlsuv_trust_store_cert(ts, idx, NULL, &len)) != NULL; idx++) {
+            int rc = mbedtls_x509_crt_parse_der(ca, der, len);
+            if (rc != 0) {
+                UM_LOG(WARN, "mbedtls_engine: trust store cert[%zd]: %s", idx, mbedtls_error(rc));
+            }
+        }
+        tlsuv_trust_store_close(ts);
+    }
+    else if (cabuf != NULL) {
         int rc = cabuf_len > 0 ? mbedtls_x509_crt_parse(ca, (const unsigned char *)cabuf, cabuf_len) : 0;
         if (rc < 0) {
             UM_LOG(WARN, "mbedtls_engine: %s\n", mbedtls_error(rc));
@@ -238,7 +325,7 @@ static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf,
         if (!(hCertStore = CertOpenSystemStore(0, "ROOT")))
         {
             printf("The first system store did not open.");
-            return;
+            return ca;
         }
         while (pCertContext = CertEnumCertificatesInStore(hCertStore, pCertContext)) {
             mbedtls_x509_crt_parse(ca, pCertContext->pbCertEncoded, pCertContext->cbCertEncoded);
@@ -254,10 +341,89 @@ static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf,
         }
 #endif
     }
+    return ca;
+}
 
+static void free_ca_chain(void *chain) {
+    mbedtls_x509_crt_free(chain);
+    tlsuv__free(chain);
+}
 
+static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf, size_t cabuf_len) {
+    char *tls_debug = getenv("MBEDTLS_DEBUG");
+    if (tls_debug != NULL) {
+        int level = (int) strtol(tls_debug, NULL, 10);
+        mbedtls_debug_set_threshold(level);
+    }
+
+    mbedtls_ssl_config_init(ssl_config);
+    mbedtls_ssl_conf_dbg(ssl_config, tls_debug_f, stdout);
+    mbedtls_ssl_config_defaults(ssl_config,
+                                MBEDTLS_SSL_IS_CLIENT,
+                                MBEDTLS_SSL_TRANSPORT_STREAM,
+                                MBEDTLS_SSL_PRESET_DEFAULT);
+    mbedtls_ssl_conf_renegotiation(ssl_config, MBEDTLS_SSL_RENEGOTIATION_ENABLED);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(ssl_config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && MBEDTLS_VERSION_NUMBER >= 0x03060000
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(ssl_config, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+#endif
+#if defined(TLSUV_EARLY_DATA)
+    mbedtls_ssl_conf_early_data(ssl_config, MBEDTLS_SSL_EARLY_DATA_ENABLED);
+#endif
+    mbedtls_ssl_conf_authmode(ssl_config, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ctr_drbg_context *drbg = tlsuv__calloc(1, sizeof(mbedtls_ctr_drbg_context));
+    mbedtls_entropy_context *entropy = tlsuv__calloc(1, sizeof(mbedtls_entropy_context));
+    mbedtls_ctr_drbg_init(drbg);
+    mbedtls_entropy_init(entropy);
+    unsigned char *seed = tlsuv__malloc(MBEDTLS_ENTROPY_MAX_SEED_SIZE); // uninitialized memory
+    mbedtls_ctr_drbg_seed(drbg, mbedtls_entropy_func, entropy, seed, MBEDTLS_ENTROPY_MAX_SEED_SIZE);
+    mbedtls_ssl_conf_rng(ssl_config, mbedtls_ctr_drbg_random, drbg);
+    mbedtls_x509_crt *ca = tlsuv_ca_store_acquire(cabuf, cabuf_len, load_ca_chain, free_ca_chain);
     mbedtls_ssl_conf_ca_chain(ssl_config, ca, NULL);
-    free(seed);
+    tlsuv__free(seed);
+}
+
+static int64_t x509_time_to_epoch(const mbedtls_x509_time *t) {
+    int year = t->MBEDTLS_PRIVATE(year);
+    int mon = t->MBEDTLS_PRIVATE(mon);
+    int day = t->MBEDTLS_PRIVATE(day);
+
+    // days from civil date (proleptic Gregorian calendar)
+    int y = year - (mon <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t) era * 146097 + doe - 719468;
+    return days * 86400 + t->MBEDTLS_PRIVATE(hour) * 3600 + t->MBEDTLS_PRIVATE(min) * 60 + t->MBEDTLS_PRIVATE(sec);
+}
+
+// seconds until the first cert of the presented chain expires
+static int64_t chain_valid_for(const mbedtls_x509_crt *crt) {
+    int64_t now = (int64_t) time(NULL);
+    int64_t valid = INT64_MAX;
+    for (; crt != NULL && crt->raw.len > 0; crt = crt->next) {
+        int64_t left = x509_time_to_epoch(&crt->valid_to) - now;
+        if (left < valid) valid = left;
+    }
+    return valid;
+}
+
+// digest of peer host name and presented chain, result for one host does not apply to another
+static int chain_digest(const char *host, const mbedtls_x509_crt *crt, uint8_t key[TLSUV_VERIFY_KEY_LEN]) {
+    mbedtls_md_context_t md;
+    mbedtls_md_init(&md);
+    int rc = mbedtls_md_setup(&md, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+    if (rc == 0) rc = mbedtls_md_starts(&md);
+    if (rc == 0) rc = mbedtls_md_update(&md, (const unsigned char *) (host ? host : ""), host ? strlen(host) + 1 : 1);
+    for (; rc == 0 && crt != NULL && crt->raw.len > 0; crt = crt->next) {
+        rc = mbedtls_md_update(&md, crt->raw.p, crt->raw.len);
+    }
+    if (rc == 0) rc = mbedtls_md_finish(&md, key);
+    mbedtls_md_free(&md);
+    return rc;
 }
 
 static int internal_cert_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags) {
@@ -285,7 +451,15 @@ static int internal_cert_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uin
         if (depth > 0) {
             *flags &= ~MBEDTLS_X509_BADCERT_NOT_TRUSTED;
         } else {
-            int rc = eng->cert_verify_f(crt, eng->verify_ctx);
+            tlsuv_verify_cache *cache = eng->ctx->verified;
+            uint8_t key[TLSUV_VERIFY_KEY_LEN];
+            bool cacheable = cache != NULL && chain_digest(eng->host, crt, key) == 0;
+
+            int rc = cacheable && tlsuv_verify_cache_check(cache, key) ? 0 :
+                     eng->cert_verify_f(crt, eng->verify_ctx);
+            if (rc == 0 && cacheable) {
+                tlsuv_verify_cache_put(cache, key, chain_valid_for(crt));
+            }
             if (rc == 0) {
                 *flags &= ~MBEDTLS_X509_BADCERT_NOT_TRUSTED;
             } else {
@@ -298,22 +472,35 @@ static int internal_cert_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uin
 
 tls_engine *new_mbedtls_engine(void *ctx, const char *host) {
     struct mbedtls_context *context = ctx;
-    mbedtls_ssl_context *ssl = calloc(1, sizeof(mbedtls_ssl_context));
-    mbedtls_ssl_init(ssl);
-    mbedtls_ssl_setup(ssl, &context->config);
-    mbedtls_ssl_set_hostname(ssl, host);
-
-    tls_engine *engine = calloc(1, sizeof(tls_engine));
-    struct mbedtls_engine *mbed_eng = calloc(1, sizeof(struct mbedtls_engine));
-    engine->engine = mbed_eng;
-    mbed_eng->ssl = ssl;
-    mbed_eng->in = tlsuv_BIO_new();
-    mbed_eng->out = tlsuv_BIO_new();
-    mbedtls_ssl_set_bio(ssl, mbed_eng, mbed_ssl_send, mbed_ssl_recv, NULL);
-    engine->api = &mbedtls_engine_api;
-
-    mbedtls_ssl_set_verify(ssl, internal_cert_verify, mbed_eng);
+    tls_engine *engine;
+    struct mbedtls_engine *mbed_eng = SLIST_FIRST(&context->idle);
+
+    if (mbed_eng) {
+        SLIST_REMOVE_HEAD(&context->idle, _next);
+        context->idle_count--;
+        engine = mbed_eng->self;
+    } else {
+        mbedtls_ssl_context *ssl = tlsuv__calloc(1, sizeof(mbedtls_ssl_context));
+        mbedtls_ssl_init(ssl);
+        mbedtls_ssl_setup(ssl, &context->config);
+
+        engine = tlsuv__calloc(1, sizeof(tls_engine));
+        mbed_eng = tlsuv__calloc(1, sizeof(struct mbedtls_engine));
+        engine->engine = mbed_eng;
+        mbed_eng->self = engine;
+        mbed_eng->ctx = context;
+        mbed_eng->ssl = ssl;
+        mbed_eng->in = tlsuv_BIO_new();
+        mbed_eng->out = tlsuv_BIO_new();
+        mbedtls_ssl_set_bio(ssl, mbed_eng, mbed_ssl_send, mbed_ssl_recv, NULL);
+        engine->api = &mbedtls_engine_api;
+
+        mbedtls_ssl_set_verify(ssl, internal_cert_verify, mbed_eng);
+    }
 
+    mbedtls_ssl_set_hostname(mbed_eng->ssl, host);
+    mbed_eng->host = host ? tlsuv__strdup(host) : NULL;
+    mbed_eng->ip_len = 0;
     if (uv_inet_pton(AF_INET6, host, &mbed_eng->addr) == 0) {
         mbed_eng->ip_len = 16;
     } else if (uv_inet_pton(AF_INET, host, &mbed_eng->addr) == 0) {
@@ -322,6 +509,7 @@ tls_engine *new_mbedtls_engine(void *ctx, const char *host) {
 
     mbed_eng->cert_verify_f = context->cert_verify_f;
     mbed_eng->verify_ctx = context->verify_ctx;
+    record_sizer_init(&mbed_eng->sizer, &context->record_sizing);
 
     return engine;
 }
@@ -330,6 +518,19 @@ static void mbedtls_set_cert_verify(tls_context *ctx, int (*verify_f)(void *cert
     struct mbedtls_context *c = ctx->ctx;
     c->cert_verify_f = verify_f;
     c->verify_ctx = v_ctx;
+
+    // results of previous callback do not apply
+    tlsuv_verify_cache_free(c->verified);
+    c->verified = tlsuv_verify_cache_new(c->verify_cache_size, c->verify_cache_ttl);
+}
+
+static int mbedtls_set_verify_cache(tls_context *ctx, size_t max_entries, unsigned int ttl) {
+    struct mbedtls_context *c = ctx->ctx;
+    c->verify_cache_size = max_entries;
+    c->verify_cache_ttl = ttl;
+    tlsuv_verify_cache_free(c->verified);
+    c->verified = tlsuv_verify_cache_new(max_entries, ttl);
+    return 0;
 }
 
 static size_t mbedtls_sig_to_asn1(const char *sig, size_t siglen, unsigned char *asn1sig) {
@@ -404,22 +605,25 @@ static int mbedtls_verify_signature(void *cert, enum hash_algo md, const char* d
 
 static void mbedtls_free_ctx(tls_context *ctx) {
     struct mbedtls_context *c = ctx->ctx;
-    mbedtls_x509_crt_free(c->config.MBEDTLS_PRIVATE(ca_chain));
-    free(c->config.MBEDTLS_PRIVATE(ca_chain));
+    engine_pool_flush(c);
+    tlsuv_ca_store_release(c->config.MBEDTLS_PRIVATE(ca_chain));
     mbedtls_ctr_drbg_context *drbg = c->config.MBEDTLS_PRIVATE(p_rng);
     mbedtls_entropy_free(drbg->MBEDTLS_PRIVATE(p_entropy));
-    free(drbg->MBEDTLS_PRIVATE(p_entropy));
+    tlsuv__free(drbg->MBEDTLS_PRIVATE(p_entropy));
     mbedtls_ctr_drbg_free(drbg);
-    free(drbg);
+    tlsuv__free(drbg);
 
     if (c->alpn_protocols) {
         const char **p = c->alpn_protocols;
         while(*p) {
-            free((void*)*p);
+            tlsuv__free((void*)*p);
             p++;
         }
-        free(c->alpn_protocols);
+        tlsuv__free(c->alpn_protocols);
     }
+    tlsuv__free(c->alpn_key);
+    tlsuv_session_cache_free(c->sessions);
+    tlsuv_verify_cache_free(c->verified);
 
     if (c->own_key) {
         c->own_key->free((struct tlsuv_private_key_s *) c->own_key);
@@ -428,50 +632,204 @@ static void mbedtls_free_ctx(tls_context *ctx) {
 
     if (c->own_cert) {
         mbedtls_x509_crt_free(c->own_cert);
-        free(c->own_cert);
+        tlsuv__free(c->own_cert);
     }
 
     mbedtls_ssl_config_free(&c->config);
-    free(c);
-    free(ctx);
+    tlsuv__free(c);
+    tlsuv__free(ctx);
 }
 
-static int mbedtls_reset(void *engine) {
-    struct mbedtls_engine *e = engine;
-    if (e->session == NULL) {
-        e->session = calloc(1, sizeof(mbedtls_ssl_session));
+static void mbedtls_get_session_stats(tls_context *ctx, tls_session_stats *stats) {
+    struct mbedtls_context *c = ctx->ctx;
+    tlsuv_session_cache_stats(c->sessions, stats);
+}
+
+static int mbedtls_set_record_sizing(tls_context *ctx, const tls_record_sizing *sizing) {
+    struct mbedtls_context *c = ctx->ctx;
+    if (sizing) {
+        c->record_sizing = *sizing;
+    } else {
+        memset(&c->record_sizing, 0, sizeof(c->record_sizing));
     }
-    if (mbedtls_ssl_get_session(e->ssl, e->session) != 0) {
-        mbedtls_ssl_session_free(e->session);
-        free(e->session);
-        e->session = NULL;
+    return 0;
+}
+
+// suites not enabled in mbedtls build are skipped during handshake
+static const int aes_first_suites[] = {
+        MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+        MBEDTLS_TLS1_3_AES_256_GCM_SHA384,
+        MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,
+        MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+        MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+        MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+        0
+};
+
+static const int chacha_first_suites[] = {
+        MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,
+        MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+        MBEDTLS_TLS1_3_AES_256_GCM_SHA384,
+        MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+        MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+        MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+        MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+        0
+};
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03010000
+static const uint16_t default_groups[] = {
+        MBEDTLS_SSL_IANA_TLS_GROUP_X25519,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_X448,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP521R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+};
+
+static const uint16_t fast_groups[] = {
+        MBEDTLS_SSL_IANA_TLS_GROUP_X25519,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+};
+
+static const uint16_t compat_groups[] = {
+        MBEDTLS_SSL_IANA_TLS_GROUP_X25519,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_X448,
+        MBEDTLS_SSL_IANA_TLS_GROUP_SECP521R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_BP256R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_BP384R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_BP512R1,
+        MBEDTLS_SSL_IANA_TLS_GROUP_FFDHE2048,
+        MBEDTLS_SSL_IANA_TLS_GROUP_FFDHE3072,
+        MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+};
+#endif
+
+static int mbedtls_set_cipher_profile(tls_context *ctx, tls_cipher_profile profile) {
+    struct mbedtls_context *c = ctx->ctx;
+    const int *suites;
+    const uint16_t *groups = NULL;
+
+    if (profile == TLS_CIPHERS_AUTO) {
+        profile = tlsuv_cpu_has_aes() ? TLS_CIPHERS_THROUGHPUT : TLS_CIPHERS_LOW_CPU;
     }
+
+    switch (profile) {
+        case TLS_CIPHERS_DEFAULT:
+        case TLS_CIPHERS_COMPAT:
+            suites = mbedtls_ssl_list_ciphersuites();
+#if MBEDTLS_VERSION_NUMBER >= 0x03010000
+            groups = profile == TLS_CIPHERS_COMPAT ? compat_groups : default_groups;
+#endif
+            break;
+        case TLS_CIPHERS_THROUGHPUT:
+            suites = aes_first_suites;
+#if MBEDTLS_VERSION_NUMBER >= 0x03010000
+            groups = fast_groups;
+#endif
+            break;
+        case TLS_CIPHERS_LOW_CPU:
+            suites = chacha_first_suites;
+#if MBEDTLS_VERSION_NUMBER >= 0x03010000
+            groups = fast_groups;
+#endif
+            break;
+        default:
+            return UV_EINVAL;
+    }
+
+    mbedtls_ssl_conf_ciphersuites(&c->config, suites);
+#if MBEDTLS_VERSION_NUMBER >= 0x03010000
+    mbedtls_ssl_conf_groups(&c->config, groups);
+#endif
+    UM_LOG(VERB, "cipher profile[%d] set", profile);
+    return 0;
+}
+
+static int mbedtls_reset(void *engine) {
+    struct mbedtls_engine *e = engine;
+    record_sizer_reset(&e->sizer);
+    tlsuv__free(e->early_data);
+    e->early_data = NULL;
+    e->early_len = 0;
+    // session is picked up from the context cache on the next handshake
     return mbedtls_ssl_session_reset(e->ssl);
 }
 
+// prepares released engine for reuse by any host
+static int engine_scrub(struct mbedtls_engine *e) {
+    if (mbedtls_ssl_session_reset(e->ssl) != 0) {
+        return -1;
+    }
+    tlsuv_BIO_consume(e->in, tlsuv_BIO_available(e->in));
+    tlsuv_BIO_consume(e->out, tlsuv_BIO_available(e->out));
+    tlsuv__free(e->host);
+    e->host = NULL;
+    tlsuv__free(e->early_data);
+    e->early_data = NULL;
+    e->early_len = 0;
+    e->error = 0;
+    memset(&e->stats, 0, sizeof(e->stats));
+    return 0;
+}
+
 static void mbedtls_free(tls_engine *engine) {
     struct mbedtls_engine *e = engine->engine;
+    struct mbedtls_context *c = e->ctx;
+    if (c->idle_count < c->pool_max && engine_scrub(e) == 0) {
+        SLIST_INSERT_HEAD(&c->idle, e, _next);
+        c->idle_count++;
+        return;
+    }
+    engine_destroy(e);
+}
+
+static void engine_pool_flush(struct mbedtls_context *c) {
+    struct mbedtls_engine *e;
+    while ((e = SLIST_FIRST(&c->idle)) != NULL) {
+        SLIST_REMOVE_HEAD(&c->idle, _next);
+        engine_destroy(e);
+    }
+    c->idle_count = 0;
+}
+
+static int mbedtls_set_engine_pool(tls_context *ctx, size_t max_idle) {
+    struct mbedtls_context *c = ctx->ctx;
+    c->pool_max = max_idle;
+    engine_pool_flush(c);
+    return 0;
+}
+
+static void engine_destroy(struct mbedtls_engine *e) {
+    tls_engine *engine = e->self;
     tlsuv_BIO_free(e->in);
     tlsuv_BIO_free(e->out);
 
     mbedtls_ssl_free(e->ssl);
     if (e->ssl) {
-        free(e->ssl);
+        tlsuv__free(e->ssl);
         e->ssl = NULL;
     }
-    free(e->ssl);
-    if (e->session) {
-        mbedtls_ssl_session_free(e->session);
-        free(e->session);
-    }
-    free(e);
-    free(engine);
+    tlsuv__free(e->ssl);
+    tlsuv__free(e->host);
+    tlsuv__free(e->early_data);
+    tlsuv__free(e);
+    tlsuv__free(engine);
 }
 
 static void mbedtls_free_cert(tls_cert *cert) {
     mbedtls_x509_crt *c = *cert;
     mbedtls_x509_crt_free(c);
-    free(c);
+    tlsuv__free(c);
     *cert = NULL;
 }
 
@@ -480,16 +838,27 @@ static void mbedtls_set_alpn_protocols(void *ctx, const char** protos, int len)
     if (c->alpn_protocols) {
         const char **p = c->alpn_protocols;
         while(*p) {
-            free((char*)*p);
+            tlsuv__free((char*)*p);
             p++;
         }
-        free(c->alpn_protocols);
+        tlsuv__free(c->alpn_protocols);
     }
-    c->alpn_protocols = calloc(len + 1, sizeof(char*));
+    tlsuv__free(c->alpn_key);
+
+    size_t keylen = 1;
+    c->alpn_protocols = tlsuv__calloc(len + 1, sizeof(char*));
     for (int i = 0; i < len; i++) {
-        c->alpn_protocols[i] = strdup(protos[i]);
+        c->alpn_protocols[i] = tlsuv__strdup(protos[i]);
+        keylen += strlen(protos[i]) + 1;
     }
     mbedtls_ssl_conf_alpn_protocols(&c->config, c->alpn_protocols);
+
+    // session cache key: comma separated protocol list
+    c->alpn_key = tlsuv__calloc(1, keylen);
+    for (int i = 0; i < len; i++) {
+        if (i > 0) strcat(c->alpn_key, ",");
+        strcat(c->alpn_key, protos[i]);
+    }
 }
 
 static int mbedtls_set_own_key(void *ctx, tlsuv_private_key_t key) {
@@ -505,7 +874,7 @@ static int mbedtls_set_own_key(void *ctx, tlsuv_private_key_t key) {
 }
 
 static int mbedtls_load_cert(tls_cert *c, const char *cert_buf, size_t cert_len) {
-    mbedtls_x509_crt *cert = calloc(1, sizeof(mbedtls_x509_crt));
+    mbedtls_x509_crt *cert = tlsuv__calloc(1, sizeof(mbedtls_x509_crt));
     if (cert_buf[cert_len - 1] != '\0') {
         cert_len += 1;
     }
@@ -515,7 +884,7 @@ static int mbedtls_load_cert(tls_cert *c, const char *cert_buf, size_t cert_len)
         if (rc < 0) {
             UM_LOG(WARN, "failed to load certificate");
             mbedtls_x509_crt_free(cert);
-            free(cert);
+            tlsuv__free(cert);
             cert = NULL;
         }
     }
@@ -530,14 +899,14 @@ static int mbedtls_set_own_cert(void *ctx, const char *cert_buf, size_t cert_len
 //    if (rc != 0) return rc;
 //
 
-    c->own_cert = calloc(1, sizeof(mbedtls_x509_crt));
+    c->own_cert = tlsuv__calloc(1, sizeof(mbedtls_x509_crt));
     rc = mbedtls_x509_crt_parse(c->own_cert, (const unsigned char *)cert_buf, cert_len);
     if (rc < 0) {
         rc = mbedtls_x509_crt_parse_file(c->own_cert, cert_buf);
         if (rc < 0) {
             fprintf(stderr, "failed to load certificate");
             mbedtls_x509_crt_free(c->own_cert);
-            free(c->own_cert);
+            tlsuv__free(c->own_cert);
             c->own_cert = NULL;
 
             c->own_key->free((tlsuv_private_key_t)c->own_key);
@@ -556,24 +925,24 @@ static int mbedtls_set_own_cert_p11(void *ctx, const char *cert_buf, size_t cert
         const char *pkcs11_lib, const char *pin, const char *slot, const char *key_id) {
 
     struct mbedtls_context *c = ctx;
-    c->own_key = calloc(1, sizeof(*c->own_key));
+    c->own_key = tlsuv__calloc(1, sizeof(*c->own_key));
     int rc = mp11_load_key(&c->own_key->pkey, pkcs11_lib, pin, slot, key_id);
     if (rc != CKR_OK) {
         fprintf(stderr, "failed to load private key - %s", p11_strerror(rc));
         mbedtls_pk_free(&c->own_key->pkey);
-        free(c->own_key);
+        tlsuv__free(c->own_key);
         c->own_key = NULL;
         return TLS_ERR;
     }
 
-    c->own_cert = calloc(1, sizeof(mbedtls_x509_crt));
+    c->own_cert = tlsuv__calloc(1, sizeof(mbedtls_x509_crt));
     rc = mbedtls_x509_crt_parse(c->own_cert, (const unsigned char *)cert_buf, cert_len);
     if (rc < 0) {
         rc = mbedtls_x509_crt_parse_file(c->own_cert, cert_buf);
         if (rc < 0) {
             fprintf(stderr, "failed to load certificate");
             mbedtls_x509_crt_free(c->own_cert);
-            free(c->own_cert);
+            tlsuv__free(c->own_cert);
             c->own_cert = NULL;
 
             c->own_key->free((struct tlsuv_private_key_s *) c->own_key);
@@ -612,16 +981,34 @@ mbedtls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *
     if (in_bytes > 0) {
         tlsuv_BIO_put(eng->in, (const unsigned char *) in, in_bytes);
     }
-    if (eng->ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HELLO_REQUEST && eng->session) {
-        mbedtls_ssl_set_session(eng->ssl, eng->session);
-        mbedtls_ssl_session_free(eng->session);
+    if (eng->ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HELLO_REQUEST && eng->host) {
+        mbedtls_ssl_session *session = tlsuv_session_cache_get(eng->ctx->sessions, eng->host,
+                                                               session_alpn_key(eng->ctx));
+        if (session) {
+            // session is copied into SSL context
+            mbedtls_ssl_set_session(eng->ssl, session);
+        }
+    }
+#if defined(TLSUV_EARLY_DATA)
+    if (eng->early_len > 0) {
+        // writes ClientHello followed by early data, if resumed session allows it
+        int rc = mbedtls_ssl_write_early_data(eng->ssl, (const unsigned char *) eng->early_data, eng->early_len);
+        if (rc < 0 && rc != MBEDTLS_ERR_SSL_CANNOT_WRITE_EARLY_DATA) {
+            UM_LOG(WARN, "mbedTLS: failed to write early data: %0x", rc);
+        }
+        tlsuv__free(eng->early_data);
+        eng->early_data = NULL;
+        eng->early_len = 0;
     }
+#endif
     int state = mbedtls_ssl_handshake(eng->ssl);
     char err[1024];
     mbedtls_strerror(state, err, 1024);
     *out_bytes = tlsuv_BIO_read(eng->out, (unsigned char *) out, maxout);
 
     if (eng->ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HANDSHAKE_OVER) {
+        // TLS 1.2 session is available right away, TLS 1.3 tickets are saved as they arrive
+        save_session(eng);
         return TLS_HS_COMPLETE;
     }
     else if (state == MBEDTLS_ERR_SSL_WANT_READ || state == MBEDTLS_ERR_SSL_WANT_WRITE) {
@@ -633,18 +1020,135 @@ mbedtls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *
     }
 }
 
-static int mbedtls_write(void *engine, const char *data, size_t data_len, char *out, size_t *out_bytes, size_t maxout) {
+static int mbedtls_write_early_data(void *engine, const char *data, size_t len) {
+#if defined(TLSUV_EARLY_DATA)
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    if (eng->ssl->MBEDTLS_PRIVATE(state) != MBEDTLS_SSL_HELLO_REQUEST || eng->host == NULL ||
+        eng->early_len + len > MBEDTLS_SSL_MAX_EARLY_DATA_SIZE) {
+        return 0;
+    }
+
+    // whether resumed session permits early data is only known when ClientHello is written
+    char *buf = tlsuv__realloc(eng->early_data, eng->early_len + len);
+    if (buf == NULL) {
+        return UV_ENOMEM;
+    }
+    memcpy(buf + eng->early_len, data, len);
+    eng->early_data = buf;
+    eng->early_len += len;
+    return (int) len;
+#else
+    return 0;
+#endif
+}
+
+static tls_early_data_status mbedtls_early_data_status(void *engine) {
+#if defined(TLSUV_EARLY_DATA)
     struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    switch (mbedtls_ssl_get_early_data_status(eng->ssl)) {
+        case MBEDTLS_SSL_EARLY_DATA_STATUS_ACCEPTED: return TLS_EARLY_DATA_ACCEPTED;
+        case MBEDTLS_SSL_EARLY_DATA_STATUS_REJECTED: return TLS_EARLY_DATA_REJECTED;
+        default: return TLS_EARLY_DATA_NONE;
+    }
+#else
+    return TLS_EARLY_DATA_NONE;
+#endif
+}
+
+// buffers smaller than this are copied into a shared record instead of getting their own
+#define COALESCE_LIMIT 1024
+
+static int ssl_write_all(struct mbedtls_engine *eng, const char *data, size_t len) {
     size_t wrote = 0;
-    while (data_len > wrote) {
-        int rc = mbedtls_ssl_write(eng->ssl, (const unsigned char *)(data + wrote), data_len - wrote);
+    while (len > wrote) {
+        size_t chunk = record_sizer_next(&eng->sizer, len - wrote);
+        int rc = mbedtls_ssl_write(eng->ssl, (const unsigned char *)(data + wrote), chunk);
         if (rc < 0) {
             eng->error = rc;
             return rc;
         }
+        record_sizer_sent(&eng->sizer, rc);
         wrote += rc;
     }
+    return 0;
+}
+
+static void lean_release(struct mbedtls_engine *e) {
+    if (e->ctx->lean) {
+        tlsuv_BIO_shrink(e->in);
+        tlsuv_BIO_shrink(e->out);
+    }
+}
+
+static int mbedtls_set_idle_lean(tls_context *ctx, int enable) {
+    struct mbedtls_context *c = ctx->ctx;
+    c->lean = enable != 0;
+    return 0;
+}
+
+static int mbedtls_idle_lean(void *engine) {
+    struct mbedtls_engine *e = engine;
+    return e->ctx->lean;
+}
+
+static size_t mbedtls_mem_usage(void *engine) {
+    struct mbedtls_engine *e = engine;
+    // record buffers are allocated by mbedtls_ssl_setup() and kept for the life of the context
+    return tlsuv_BIO_mem(e->in) + tlsuv_BIO_mem(e->out) +
+           MBEDTLS_SSL_IN_CONTENT_LEN + MBEDTLS_SSL_OUT_CONTENT_LEN;
+}
+
+static int mbedtls_write(void *engine, const char *data, size_t data_len, char *out, size_t *out_bytes, size_t maxout) {
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    record_sizer_begin(&eng->sizer);
+
+    int rc = ssl_write_all(eng, data, data_len);
+    if (rc != 0) {
+        return rc;
+    }
     *out_bytes = tlsuv_BIO_read(eng->out, (unsigned char *) out, maxout);
+    lean_release(eng);
+    return (int) tlsuv_BIO_available(eng->out);
+}
+
+static int mbedtls_write_vec(void *engine, const uv_buf_t *bufs, unsigned int nbufs, uv_buf_t *out, unsigned int *nout) {
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    record_sizer_begin(&eng->sizer);
+
+    char stage[MBEDTLS_SSL_OUT_CONTENT_LEN];
+    size_t staged = 0;
+    int rc;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        if (bufs[i].len < COALESCE_LIMIT && staged + bufs[i].len <= sizeof(stage)) {
+            memcpy(stage + staged, bufs[i].base, bufs[i].len);
+            staged += bufs[i].len;
+            continue;
+        }
+
+        if (staged > 0) {
+            if ((rc = ssl_write_all(eng, stage, staged)) != 0) return rc;
+            staged = 0;
+        }
+
+        if (bufs[i].len < COALESCE_LIMIT) {
+            memcpy(stage, bufs[i].base, bufs[i].len);
+            staged = bufs[i].len;
+        } else if ((rc = ssl_write_all(eng, bufs[i].base, bufs[i].len)) != 0) {
+            return rc;
+        }
+    }
+    if (staged > 0 && (rc = ssl_write_all(eng, stage, staged)) != 0) {
+        return rc;
+    }
+
+    unsigned int used = 0;
+    while (used < *nout && tlsuv_BIO_available(eng->out) > 0) {
+        out[used].len = tlsuv_BIO_read(eng->out, (uint8_t *) out[used].base, out[used].len);
+        used++;
+    }
+    *nout = used;
+
+    lean_release(eng);
     return (int) tlsuv_BIO_available(eng->out);
 }
 
@@ -666,9 +1170,16 @@ mbedtls_read(void *engine, const char *ssl_in, size_t ssl_in_len, char *out, siz
             total_out += rc;
             writep += rc;
         }
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+        else if (rc == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            save_session(eng);
+            rc = 1;
+        }
+#endif
     } while(rc > 0 && (maxout - total_out) > 0);
 
     *out_bytes = total_out;
+    lean_release(eng);
 
     // this indicates that more bytes are needed to complete SSL frame
     if (rc == MBEDTLS_ERR_SSL_WANT_READ) {
@@ -736,7 +1247,7 @@ static int parse_pkcs7_certs(tls_cert *chain, const char *pkcs7, size_t pkcs7len
         UM_LOG(ERR, "base64 decoding parsing error: %d", rc);
         return rc;
     }
-    uint8_t *base64_decoded_pkcs7 = calloc(1, der_len + 1);
+    uint8_t *base64_decoded_pkcs7 = tlsuv__calloc(1, der_len + 1);
     rc = mbedtls_base64_decode(base64_decoded_pkcs7, der_len, &der_len, (const uint8_t *)pkcs7, pkcs7len);
     if (rc != 0) {
         UM_LOG(ERR, "base64 decoding parsing error: %d", rc);
@@ -823,14 +1334,14 @@ static int parse_pkcs7_certs(tls_cert *chain, const char *pkcs7, size_t pkcs7len
         }
 
         if (certs == NULL) {
-            certs = calloc(1, sizeof(mbedtls_x509_crt));
+            certs = tlsuv__calloc(1, sizeof(mbedtls_x509_crt));
         }
         cert_len += (cbp - cert_buf);
         rc = mbedtls_x509_crt_parse(certs, cert_buf, cert_len);
         if (rc != 0) {
             UM_LOG(ERR, "failed to parse cert: %d", rc);
             mbedtls_x509_crt_free(certs);
-            free(certs);
+            tlsuv__free(certs);
             *chain = NULL;
             return rc;
         }
@@ -838,7 +1349,7 @@ static int parse_pkcs7_certs(tls_cert *chain, const char *pkcs7, size_t pkcs7len
 
     } while (rc == 0);
 
-    free(der);
+    tlsuv__free(der);
     *chain = certs;
     return 0;
 }
@@ -857,6 +1368,7 @@ static int write_cert_pem(tls_cert cert, int full_chain, char **pem, size_t *pem
         c = c->next;
     }
 
+    // PEM output is released by the caller with free()
     uint8_t *pembuf = malloc(total_len + 1);
     uint8_t *p = pembuf;
     c = cert;
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <mbedtls/pk.h>
+#include <stdbool.h>
 #include <string.h>
 #include <tlsuv/tlsuv.h>
 
@@ -24,14 +25,20 @@
 #include "p11.h"
 #include "mbed_p11.h"
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "../alloc.h"
+
 static void pubkey_free(tlsuv_public_key_t k);
 static int pubkey_verify(tlsuv_public_key_t pk, enum hash_algo md, const char *data, size_t datalen, const char *sig, size_t siglen);
+static int pubkey_verify_many(tlsuv_public_key_t pk, enum hash_algo md,
+                              const tlsuv_verify_item *items, size_t count, int *results);
 static int pubkey_pem(tlsuv_public_key_t pk, char **pem, size_t *pemlen);
 
 static struct pub_key_s PUB_KEY_API = {
         .free = pubkey_free,
         .to_pem = pubkey_pem,
         .verify = pubkey_verify,
+        .verify_many = pubkey_verify_many,
 };
 
 
@@ -59,12 +66,13 @@ void priv_key_init(struct priv_key_s *privkey) {
 static void pubkey_free(tlsuv_public_key_t k) {
     struct pub_key_s *pub = (struct pub_key_s *) k;
     mbedtls_pk_free(&pub->pkey);
-    free(pub);
+    tlsuv__free(pub);
 }
 
 static int pubkey_pem(tlsuv_public_key_t pk, char **pem, size_t *pemlen) {
     struct pub_key_s *pub = (struct pub_key_s *) pk;
     size_t len = 1024;
+    // PEM output is released by the caller with free()
     char *buf = malloc(len);
     int rc;
     rc = mbedtls_pk_write_pubkey_pem(&pub->pkey, (unsigned char*)buf, len);
@@ -117,10 +125,51 @@ static int pubkey_verify(tlsuv_public_key_t pk, enum hash_algo md, const char *d
     return verify_signature(&pub->pkey, md, data, datalen, sig, siglen);
 }
 
+// digest context is set up once for the batch, only hashing is repeated for each signature
+static int pubkey_verify_many(tlsuv_public_key_t pk, enum hash_algo md,
+                              const tlsuv_verify_item *items, size_t count, int *results) {
+    struct pub_key_s *pub = (struct pub_key_s *) pk;
+    mbedtls_md_type_t type;
+    switch (md) {
+        case hash_SHA256: type = MBEDTLS_MD_SHA256; break;
+        case hash_SHA384: type = MBEDTLS_MD_SHA384; break;
+        case hash_SHA512: type = MBEDTLS_MD_SHA512; break;
+        default:
+            for (size_t i = 0; i < count; i++) results[i] = -1;
+            return -1;
+    }
+
+    const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(type);
+    size_t hash_len = mbedtls_md_get_size(md_info);
+    mbedtls_md_context_t md_ctx;
+    mbedtls_md_init(&md_ctx);
+    bool ready = mbedtls_md_setup(&md_ctx, md_info, 0) == 0;
+    int rc = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const tlsuv_verify_item *it = &items[i];
+        unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+        results[i] = -1;
+        if (ready) {
+            if (mbedtls_md_starts(&md_ctx) == 0 &&
+                mbedtls_md_update(&md_ctx, (const uint8_t *) it->data, it->datalen) == 0 &&
+                mbedtls_md_finish(&md_ctx, hash) == 0 &&
+                mbedtls_pk_verify(&pub->pkey, type, hash, hash_len, (const uint8_t *) it->sig, it->siglen) == 0) {
+                results[i] = 0;
+            }
+        }
+        if (results[i] != 0) {
+            rc = -1;
+        }
+    }
+    mbedtls_md_free(&md_ctx);
+    return rc;
+}
+
 static void privkey_free(tlsuv_private_key_t k) {
     struct priv_key_s *priv = (struct priv_key_s *) k;
     mbedtls_pk_free(&priv->pkey);
-    free(priv);
+    tlsuv__free(priv);
 }
 
 static int privkey_sign(tlsuv_private_key_t pk, enum hash_algo md, const char *data, size_t datalen, char *sig, size_t *siglen) {
@@ -172,7 +221,7 @@ static int privkey_sign(tlsuv_private_key_t pk, enum hash_algo md, const char *d
 
 static tlsuv_public_key_t privkey_pubkey(tlsuv_private_key_t pk) {
     struct priv_key_s *priv = (struct priv_key_s *) pk;
-    struct pub_key_s *pub = calloc(1, sizeof(*pub));
+    struct pub_key_s *pub = tlsuv__calloc(1, sizeof(*pub));
     pub_key_init(pub);
 
     // there is probably a more straight-forward way,
@@ -199,7 +248,7 @@ static int privkey_to_pem(tlsuv_private_key_t pk, char **pem, size_t *pemlen) {
 }
 
 int load_key(tlsuv_private_key_t *key, const char* keydata, size_t keydatalen) {
-    struct priv_key_s *privkey = calloc(1, sizeof(struct priv_key_s));
+    struct priv_key_s *privkey = tlsuv__calloc(1, sizeof(struct priv_key_s));
     priv_key_init(privkey);
     mbedtls_pk_init(&privkey->pkey);
 
@@ -213,7 +262,7 @@ int load_key(tlsuv_private_key_t *key, const char* keydata, size_t keydatalen) {
     int rc = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, NULL, 0);
     if (rc != 0) {
         mbedtls_pk_free(&privkey->pkey);
-        free(privkey);
+        tlsuv__free(privkey);
         *key = NULL;
         return rc;
     }
@@ -231,7 +280,7 @@ int load_key(tlsuv_private_key_t *key, const char* keydata, size_t keydatalen) {
         );
         if (rc < 0) {
             mbedtls_pk_free(&privkey->pkey);
-            free(privkey);
+            tlsuv__free(privkey);
             *key = NULL;
             return rc;
         }
@@ -249,7 +298,7 @@ int gen_key(tlsuv_private_key_t *key) {
     mbedtls_ecp_group_id ec_curve = MBEDTLS_ECP_DP_SECP256R1;
     mbedtls_pk_type_t pk_type = MBEDTLS_PK_ECKEY;
 
-    struct priv_key_s *private_key = calloc(1, sizeof(struct priv_key_s));
+    struct priv_key_s *private_key = tlsuv__calloc(1, sizeof(struct priv_key_s));
     *private_key = PRIV_KEY_API;
     mbedtls_pk_context *pk = &private_key->pkey;
     mbedtls_pk_init(pk);
@@ -277,7 +326,7 @@ int gen_key(tlsuv_private_key_t *key) {
     on_error:
     if (ret != 0) {
         mbedtls_pk_free(pk);
-        free(private_key);
+        tlsuv__free(private_key);
     } else {
         *key = (tlsuv_private_key_t)private_key;
     }
@@ -0,0 +1,83 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_MPSC_H
+#define TLSUV_MPSC_H
+
+#include <stddef.h>
+
+#include "atomics.h"
+
+/**
+ * Intrusive lock-free multi-producer single-consumer queue (Vyukov).
+ * Any thread can push, only one thread pops. Push is wait-free, pop may return NULL while
+ * a concurrent push is not linked yet, producers wake consumer after push to get it retried.
+ */
+
+struct mpsc_node {
+    struct mpsc_node *next;
+};
+
+struct mpsc_queue {
+    // last pushed node, updated by producers
+    struct mpsc_node *head;
+    // next node to pop, only used by consumer
+    struct mpsc_node *tail;
+    struct mpsc_node stub;
+};
+
+static inline void mpsc_init(struct mpsc_queue *q) {
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_push(struct mpsc_queue *q, struct mpsc_node *n) {
+    n->next = NULL;
+    struct mpsc_node *prev = tlsuv_atomic_xchg_ptr(&q->head, n);
+    tlsuv_atomic_store_ptr(&prev->next, n);
+}
+
+static inline struct mpsc_node *mpsc_pop(struct mpsc_queue *q) {
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = tlsuv_atomic_load_ptr(&tail->next);
+    if (tail == &q->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = tlsuv_atomic_load_ptr(&tail->next);
+    }
+
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+
+    // tail is the last node, unless a push is in progress
+    if (tail != tlsuv_atomic_load_ptr(&q->head)) {
+        return NULL;
+    }
+    mpsc_push(q, &q->stub);
+    next = tlsuv_atomic_load_ptr(&tail->next);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+#endif //TLSUV_MPSC_H
@@ -20,15 +20,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
 
 #include "../um_debug.h"
 #include <tlsuv/tlsuv.h>
+#include <tlsuv/queue.h>
 
 #include <openssl/x509.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/ocsp.h>
 
 #include "keys.h"
+#include "ring_bio.h"
+#include "ktls.h"
+#include "../session_cache.h"
+#include "../ca_store.h"
+#include "../trust_store.h"
+#include "../verify_cache.h"
+#include "../record_sizing.h"
+#include "../cpu_features.h"
+#include "../tls_trace.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "../alloc.h"
 
 // inspired by https://golang.org/src/crypto/x509/root_linux.go
 // Possible certificate files; stop after finding one.
@@ -42,16 +57,69 @@ const char *const caFiles[] = {
 };
 #define NUM_CAFILES (sizeof(caFiles) / sizeof(char *))
 
+struct ca_index_entry {
+    unsigned long subject_hash;
+    int chain;
+};
+
+// parsed trust store, with per-root chain stores used by verify_peer_cb
+struct ca_bundle {
+    X509_STORE *store;
+    X509_STORE **chains;
+    int chains_count;
+
+    // subject name hash of every cert in chain stores, sorted
+    struct ca_index_entry *index;
+    int index_count;
+
+    // precompiled trust store, certificates are decoded by store lookup on demand
+    tlsuv_trust_store *trust;
+    X509_LOOKUP_METHOD *lookup;
+};
+
 struct openssl_ctx {
     SSL_CTX *ctx;
     struct priv_key_s *own_key;
     X509 *own_cert;
     int (*cert_verify_f)(void *cert, void *v_ctx);
     void *verify_ctx;
+    tlsuv_verify_cache *verified;
+    size_t verify_cache_size;
+    unsigned int verify_cache_ttl;
+    tls_ocsp_config ocsp;
+    // validated OCSP responses, keyed by digest of certificate ID
+    tlsuv_verify_cache *ocsp_checked;
     unsigned char *alpn_protocols;
 
-    X509_STORE **ca_chains;
-    int ca_chains_count;
+    // shared with other contexts using the same bundle
+    struct ca_bundle *ca;
+
+    tlsuv_session_cache *sessions;
+    // guards caches above, handshakes of different engines may run on worker threads
+    uv_mutex_t lock;
+    bool async_hs;
+    bool async_crypto;
+
+    size_t io_buffer;
+    tls_record_sizing record_sizing;
+    bool ktls;
+    // keylog callback installed before kTLS was enabled, still gets every line
+    SSL_CTX_keylog_cb_func user_keylog;
+    bool lean;
+
+    // live engines and counters of freed ones, guarded by lock
+    LIST_HEAD(engines, openssl_engine) engines;
+    tls_traffic_stats retired;
+
+    // released engines kept for reuse, guarded by lock
+    LIST_HEAD(idle_engines, openssl_engine) idle;
+    size_t idle_count;
+    size_t pool_max;
+
+    // TLS_SERVER_* flags, 0 for client side engines
+    int server;
+    tls_context *(*sni_f)(const char *name, void *sni_ctx);
+    void *sni_ctx;
 };
 
 struct openssl_engine {
@@ -60,6 +128,28 @@ struct openssl_engine {
     BIO *in;
     BIO *out;
     unsigned long error;
+
+    char *host;
+    bool session_offered;
+    bool ring_io;
+
+    char *early_data;
+    size_t early_len;
+
+    struct record_sizer sizer;
+
+    // client application traffic secret, captured for kTLS hand off
+    uint8_t tx_secret[EVP_MAX_MD_SIZE];
+    size_t tx_secret_len;
+    bool app_written;
+    bool ktls_tx;
+
+    tls_traffic_stats stats;
+    // tracing generation hooks were last synced with
+    int64_t trace_gen;
+    struct openssl_ctx *ctx;
+    tls_engine *self;
+    LIST_ENTRY(openssl_engine) _next;
 };
 
 static void init_ssl_context(struct openssl_ctx *c, const char *cabuf, size_t cabuf_len);
@@ -74,8 +164,13 @@ static tls_handshake_state
 tls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *out_bytes, size_t maxout);
 
 static const char* tls_get_alpn(void *engine);
+static int tls_set_protocols(void *engine, const char **protos, int len);
 
 static int tls_write(void *engine, const char *data, size_t data_len, char *out, size_t *out_bytes, size_t maxout);
+static int tls_write_vec(void *engine, const uv_buf_t *bufs, unsigned int nbufs, uv_buf_t *out, unsigned int *nout);
+static int tls_write_early_data(void *engine, const char *data, size_t len);
+static tls_early_data_status tls_get_early_data_status(void *engine);
+static int tls_ktls_tx(void *engine, uv_os_fd_t fd);
 
 static int
 tls_read(void *engine, const char *ssl_in, size_t ssl_in_len, char *out, size_t *out_bytes, size_t maxout);
@@ -92,6 +187,26 @@ static void tls_free_ctx(tls_context *ctx);
 static void tls_free_cert(tls_cert *cert);
 
 static void tls_set_cert_verify(tls_context *ctx, int (*verify_f)(void *cert, void *v_ctx), void *v_ctx);
+static void tls_get_session_stats(tls_context *ctx, tls_session_stats *stats);
+static int tls_set_io_buffer(tls_context *ctx, size_t capacity);
+static int tls_set_record_sizing(tls_context *ctx, const tls_record_sizing *sizing);
+static int tls_set_ktls(tls_context *ctx, int enable);
+static int tls_set_verify_cache(tls_context *ctx, size_t max_entries, unsigned int ttl);
+static int tls_set_ocsp(tls_context *ctx, const tls_ocsp_config *cfg);
+static int tls_set_async_handshake(tls_context *ctx, int enable);
+static int tls_async_handshake(void *engine);
+static int tls_set_async_crypto(tls_context *ctx, int enable);
+static int tls_async_crypto(void *engine);
+static tls_traffic_stats *tls_engine_stats(void *engine);
+static void tls_get_traffic_stats(tls_context *ctx, tls_traffic_stats *stats);
+static int tls_set_cipher_profile(tls_context *ctx, tls_cipher_profile profile);
+static int tls_set_engine_pool(tls_context *ctx, size_t max_idle);
+static int tls_set_idle_lean(tls_context *ctx, int enable);
+static int tls_idle_lean(void *engine);
+static size_t tls_mem_usage(void *engine);
+static void engine_pool_flush(struct openssl_ctx *c);
+static int tls_set_server_mode(tls_context *ctx, int flags);
+static int tls_set_sni_cb(tls_context *ctx, tls_context *(*sni_f)(const char *name, void *sni_ctx), void *sni_ctx);
 
 static int tls_verify_signature(void *cert, enum hash_algo md, const char *data, size_t datalen, const char *sig,
                                     size_t siglen);
@@ -103,7 +218,7 @@ static int load_cert(tls_cert *cert, const char *buf, size_t buflen);
 
 static int generate_csr(tlsuv_private_key_t key, char **pem, size_t *pemlen, ...);
 
-static void msg_cb (int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg);
+static void msg_cb(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg);
 static void info_cb(const SSL *s, int where, int ret);
 
 #if _WIN32
@@ -130,6 +245,20 @@ static tls_context_api openssl_context_api = {
         .generate_pkcs11_key = gen_pkcs11_key,
         .load_cert = load_cert,
         .generate_csr_to_pem = generate_csr,
+        .get_session_stats = tls_get_session_stats,
+        .set_io_buffer = tls_set_io_buffer,
+        .set_record_sizing = tls_set_record_sizing,
+        .set_ktls = tls_set_ktls,
+        .set_verify_cache = tls_set_verify_cache,
+        .set_ocsp = tls_set_ocsp,
+        .set_async_handshake = tls_set_async_handshake,
+        .get_traffic_stats = tls_get_traffic_stats,
+        .set_cipher_profile = tls_set_cipher_profile,
+        .set_engine_pool = tls_set_engine_pool,
+        .set_idle_lean = tls_set_idle_lean,
+        .set_server_mode = tls_set_server_mode,
+        .set_sni_cb = tls_set_sni_cb,
+        .set_async_crypto = tls_set_async_crypto,
 };
 
 
@@ -141,7 +270,17 @@ static tls_engine_api openssl_engine_api = {
         .write = tls_write,
         .read = tls_read,
         .reset = tls_reset,
-        .strerror = tls_eng_error
+        .strerror = tls_eng_error,
+        .write_vec = tls_write_vec,
+        .write_early_data = tls_write_early_data,
+        .early_data_status = tls_get_early_data_status,
+        .ktls_tx = tls_ktls_tx,
+        .async_handshake = tls_async_handshake,
+        .stats = tls_engine_stats,
+        .idle_lean = tls_idle_lean,
+        .mem_usage = tls_mem_usage,
+        .set_protocols = tls_set_protocols,
+        .async_crypto = tls_async_crypto,
 };
 
 static const char* tls_lib_version() {
@@ -160,9 +299,9 @@ static const char *tls_eng_error(void *eng) {
 }
 
 tls_context *new_openssl_ctx(const char *ca, size_t ca_len) {
-    tls_context *ctx = calloc(1, sizeof(tls_context));
+    tls_context *ctx = tlsuv__calloc(1, sizeof(tls_context));
     ctx->api = &openssl_context_api;
-    struct openssl_ctx *c = calloc(1, sizeof(struct openssl_ctx));
+    struct openssl_ctx *c = tlsuv__calloc(1, sizeof(struct openssl_ctx));
     init_ssl_context(c, ca, ca_len);
     ctx->ctx = c;
 
@@ -222,35 +361,101 @@ static int load_cert(tls_cert *cert, const char *buf, size_t buflen) {
     return 0;
 }
 
+static int ca_index_cmp(const void *a, const void *b) {
+    const struct ca_index_entry *l = a;
+    const struct ca_index_entry *r = b;
+    if (l->subject_hash != r->subject_hash) {
+        return l->subject_hash < r->subject_hash ? -1 : 1;
+    }
+    return l->chain - r->chain;
+}
+
+static void ca_index_build(struct ca_bundle *b) {
+    int total = 0;
+    for (int i = 0; i < b->chains_count; i++) {
+        total += sk_X509_OBJECT_num(X509_STORE_get0_objects(b->chains[i]));
+    }
+
+    b->index = tlsuv__calloc(total > 0 ? total : 1, sizeof(struct ca_index_entry));
+    b->index_count = 0;
+    for (int i = 0; i < b->chains_count; i++) {
+        STACK_OF(X509_OBJECT) *objects = X509_STORE_get0_objects(b->chains[i]);
+        for (int j = 0; j < sk_X509_OBJECT_num(objects); j++) {
+            X509 *crt = X509_OBJECT_get0_X509(sk_X509_OBJECT_value(objects, j));
+            if (crt == NULL) continue;
+            b->index[b->index_count].subject_hash = X509_subject_name_hash(crt);
+            b->index[b->index_count].chain = i;
+            b->index_count++;
+        }
+    }
+    qsort(b->index, b->index_count, sizeof(struct ca_index_entry), ca_index_cmp);
+}
+
+// first index position with given hash, or position where it would be
+static int ca_index_find(const struct ca_bundle *b, unsigned long h) {
+    int lo = 0;
+    int hi = b->index_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (b->index[mid].subject_hash < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 static int verify_peer_cb(int pre_verify, X509_STORE_CTX *s) {
 
     if (pre_verify == 1) {
         return 1;
     }
 
-    int verified = 0;
     X509 *c = X509_STORE_CTX_get_current_cert(s);
     STACK_OF(X509) *untrusted = X509_STORE_CTX_get0_untrusted(s);
 
     SSL *ssl = X509_STORE_CTX_get_ex_data(s, SSL_get_ex_data_X509_STORE_CTX_idx());
     SSL_CTX *ssl_ctx = SSL_get_SSL_CTX(ssl);
     struct openssl_ctx *ctx = SSL_CTX_get_app_data(ssl_ctx);
+    if (ctx->ca == NULL) {
+        return 0;
+    }
 
-    for (int i = 0; i < ctx->ca_chains_count; i++) {
-        UM_LOG(INFO, "checking against bundle[%d]", i);
-        X509_STORE_CTX *verifier = X509_STORE_CTX_new();
-        X509_STORE_CTX_init(verifier, ctx->ca_chains[i], c, untrusted);
-        int is_good = X509_verify_cert(verifier);
+    // only chain stores holding an issuer of the presented certs can verify them
+    int tried[16];
+    int tried_count = 0;
+    int n_untrusted = untrusted ? sk_X509_num(untrusted) : 0;
+    for (int k = -1; k < n_untrusted; k++) {
+        X509 *cert = k < 0 ? c : sk_X509_value(untrusted, k);
+        unsigned long h = X509_issuer_name_hash(cert);
+
+        for (int idx = ca_index_find(ctx->ca, h);
+             idx < ctx->ca->index_count && ctx->ca->index[idx].subject_hash == h; idx++) {
+            int chain = ctx->ca->index[idx].chain;
+            int seen = 0;
+            for (int t = 0; t < tried_count; t++) {
+                seen |= tried[t] == chain;
+            }
+            if (seen) continue;
+            if (tried_count < (int) (sizeof(tried) / sizeof(tried[0]))) {
+                tried[tried_count++] = chain;
+            }
 
-        X509_STORE_CTX_free(verifier);
+            UM_LOG(VERB, "checking against bundle[%d]", chain);
+            X509_STORE_CTX *verifier = X509_STORE_CTX_new();
+            X509_STORE_CTX_init(verifier, ctx->ca->chains[chain], c, untrusted);
+            int is_good = X509_verify_cert(verifier);
 
-        if (is_good) {
-            ERR_clear_error();
-            verified = 1;
-            break;
+            X509_STORE_CTX_free(verifier);
+
+            if (is_good) {
+                ERR_clear_error();
+                return 1;
+            }
         }
     }
-    return verified;
+    return 0;
 }
 
 static int is_self_signed(X509 *cert) {
@@ -286,7 +491,7 @@ static X509_STORE** process_chains(X509_STORE *store, int *count) {
 
     idx = 0;
     int root_count = sk_X509_num(roots);
-    X509_STORE **stores = calloc(root_count, sizeof (X509_STORE*));
+    X509_STORE **stores = tlsuv__calloc(root_count, sizeof (X509_STORE*));
     while(sk_X509_num(roots) > 0) {
         X509 *r = sk_X509_pop(roots);
         X509_STORE *s = X509_STORE_new();
@@ -334,10 +539,149 @@ static X509_STORE** process_chains(X509_STORE *store, int *count) {
     return stores;
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#define LOOKUP_NAME_CONST const
+#else
+#define LOOKUP_NAME_CONST
+#endif
+
+// decodes certificates with requested subject from trust store, and caches them in X509_STORE
+static int trust_store_by_subject(X509_LOOKUP *lu, X509_LOOKUP_TYPE type, LOOKUP_NAME_CONST X509_NAME *name,
+                                  X509_OBJECT *ret) {
+    tlsuv_trust_store *ts = X509_LOOKUP_get_method_data(lu);
+    if (type != X509_LU_X509 || ts == NULL) {
+        return 0;
+    }
+
+    unsigned char *name_der = NULL;
+    int name_len = i2d_X509_NAME((X509_NAME *) name, &name_der);
+    if (name_len <= 0) {
+        return 0;
+    }
+    uint64_t h = tlsuv_trust_store_name_hash(name_der, (size_t) name_len);
+    OPENSSL_free(name_der);
+
+    X509_STORE *store = X509_LOOKUP_get_store(lu);
+    int added = 0;
+    uint64_t cert_hash;
+    size_t len;
+    const uint8_t *der;
+    for (size_t idx = tlsuv_trust_store_find(ts, h);
+         (der = tlsuv_trust_store_cert(ts, idx, &cert_hash, &len)) != NULL && cert_hash == h; idx++) {
+        X509 *crt = d2i_X509(NULL, &der, (long) len);
+        if (crt == NULL) {
+            continue;
+        }
+        if (X509_NAME_cmp(X509_get_subject_name(crt), name) == 0 && X509_STORE_add_cert(store, crt)) {
+            UM_LOG(VERB, "loaded CA[%d] from trust store", (int) idx);
+            added = 1;
+        }
+        X509_free(crt);
+    }
+    ERR_clear_error();
+    if (!added) {
+        return 0;
+    }
+
+    // like built-in lookups, result is borrowed from the store (concurrent lookup may have added it first),
+    // caller takes its own reference
+    X509_STORE_lock(store);
+    X509_OBJECT *obj = X509_OBJECT_retrieve_by_subject(X509_STORE_get0_objects(store), X509_LU_X509,
+                                                       (X509_NAME *) name);
+    int found = obj != NULL && X509_OBJECT_set1_X509(ret, X509_OBJECT_get0_X509(obj));
+    X509_STORE_unlock(store);
+    if (found) {
+        X509_free(X509_OBJECT_get0_X509(ret));
+    }
+    return found;
+}
+
+static X509_STORE *trust_store_lookup(struct ca_bundle *b) {
+    X509_STORE *store = X509_STORE_new();
+    b->lookup = X509_LOOKUP_meth_new("tlsuv trust store");
+    X509_LOOKUP_meth_set_get_by_subject(b->lookup, trust_store_by_subject);
+    X509_LOOKUP *lu = X509_STORE_add_lookup(store, b->lookup);
+    if (lu == NULL) {
+        X509_STORE_free(store);
+        return NULL;
+    }
+    X509_LOOKUP_set_method_data(lu, b->trust);
+    return store;
+}
+
+static void *load_ca_bundle(const char *cabuf, size_t cabuf_len) {
+    struct ca_bundle *b = tlsuv__calloc(1, sizeof(struct ca_bundle));
+    // only bundle files may be trust stores, PEM content is not a path
+    if (cabuf != NULL && tlsuv_ca_is_file(cabuf, cabuf_len, NULL) &&
+        (b->trust = tlsuv_trust_store_open(cabuf)) != NULL) {
+        // verification falls to the full store, there are no per-root chain stores
+        b->store = trust_store_lookup(b);
+    } else if (cabuf != NULL) {
+        b->store = load_certs(cabuf, cabuf_len);
+        b->chains = process_chains(b->store, &b->chains_count);
+        ca_index_build(b);
+    } else {
+        // try loading default CA stores
+#if _WIN32
+        b->store = load_system_certs();
+#else
+        b->store = X509_STORE_new();
+        X509_STORE_set_default_paths(b->store);
+#endif
+    }
+    return b;
+}
+
+static void free_ca_bundle(void *bundle) {
+    struct ca_bundle *b = bundle;
+    for (int i = 0; i < b->chains_count; i++) {
+        X509_STORE_free(b->chains[i]);
+    }
+    tlsuv__free(b->chains);
+    tlsuv__free(b->index);
+    X509_STORE_free(b->store);
+    if (b->lookup) {
+        X509_LOOKUP_meth_free(b->lookup);
+    }
+    tlsuv_trust_store_close(b->trust);
+    tlsuv__free(b);
+}
+
+static const char *session_alpn_key(struct openssl_ctx *c) {
+    return c->alpn_protocols ? (const char *) c->alpn_protocols : "";
+}
+
+static void free_session(void *s) {
+    SSL_SESSION_free((SSL_SESSION *) s);
+}
+
+static int new_session_cb(SSL *ssl, SSL_SESSION *session) {
+    struct openssl_engine *eng = SSL_get_app_data(ssl);
+    struct openssl_ctx *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+    if (eng == NULL || eng->host == NULL || !SSL_SESSION_is_resumable(session)) {
+        return 0;
+    }
+
+    // TLS 1.3 tickets may arrive at any time after handshake, the latest one replaces previous
+    uv_mutex_lock(&ctx->lock);
+    tlsuv_session_cache_put(ctx->sessions, eng->host, session_alpn_key(ctx), session);
+    uv_mutex_unlock(&ctx->lock);
+    return 1;
+}
+
+static int peer_verify_mode(const struct openssl_ctx *c) {
+    if (!c->server) {
+        return SSL_VERIFY_PEER;
+    }
+    return (c->server & TLS_SERVER_VERIFY_CLIENT) ? SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT : SSL_VERIFY_NONE;
+}
+
 static void init_ssl_context(struct openssl_ctx *c, const char *cabuf, size_t cabuf_len) {
     SSL_library_init();
 
-    const SSL_METHOD *method = TLS_client_method();
+    // side of the connection is set on every engine, context may be switched to server mode
+    const SSL_METHOD *method = TLS_method();
     SSL_CONF_CTX *conf = SSL_CONF_CTX_new();
     SSL_CONF_CTX_set_flags(conf, SSL_CONF_FLAG_CLIENT);
 
@@ -348,245 +692,289 @@ static void init_ssl_context(struct openssl_ctx *c, const char *cabuf, size_t ca
     SSL_CONF_CTX_finish(conf);
     SSL_CONF_CTX_free(conf);
 
-    if (cabuf != NULL) {
-        X509_STORE *ca = load_certs(cabuf, cabuf_len);
-        c->ca_chains = process_chains(ca, &c->ca_chains_count);
-        SSL_CTX_set0_verify_cert_store(ctx, ca);
-    } else {
-        // try loading default CA stores
-#if _WIN32
-        X509_STORE *ca = load_system_certs();
-        SSL_CTX_set0_verify_cert_store(ctx, ca);
-#else
-        SSL_CTX_set_default_verify_paths(ctx);
-#endif
+    c->ca = tlsuv_ca_store_acquire(cabuf, cabuf_len, load_ca_bundle, free_ca_bundle);
+    if (c->ca) {
+        SSL_CTX_set1_verify_cert_store(ctx, c->ca->store);
     }
     SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_peer_cb);
     SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
     SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION);
 
-    char *tls_debug = getenv("TLS_DEBUG");
-    if (tls_debug) {
-        SSL_CTX_set_msg_callback(ctx, msg_cb);
-        SSL_CTX_set_info_callback(ctx, info_cb);
-    }
+    c->sessions = tlsuv_session_cache_new(TLSUV_SESSION_CACHE_SIZE, free_session);
+    uv_mutex_init(&c->lock);
+    LIST_INIT(&c->engines);
+    LIST_INIT(&c->idle);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
 
     c->ctx = ctx;
 }
 
-typedef struct string_int_pair_st {
-    const char *name;
-    int retval;
-} OPT_PAIR, STRINT_PAIR;
-
-static const char *lookup(int val, const STRINT_PAIR* list, const char* def)
-{
-    for ( ; list->name; ++list)
-        if (list->retval == val)
-            return list->name;
-    return def;
-}
-
-static STRINT_PAIR handshakes[] = {
-    {", HelloRequest", SSL3_MT_HELLO_REQUEST},
-    {", ClientHello", SSL3_MT_CLIENT_HELLO},
-    {", ServerHello", SSL3_MT_SERVER_HELLO},
-    {", HelloVerifyRequest", DTLS1_MT_HELLO_VERIFY_REQUEST},
-    {", NewSessionTicket", SSL3_MT_NEWSESSION_TICKET},
-    {", EndOfEarlyData", SSL3_MT_END_OF_EARLY_DATA},
-    {", EncryptedExtensions", SSL3_MT_ENCRYPTED_EXTENSIONS},
-    {", Certificate", SSL3_MT_CERTIFICATE},
-    {", ServerKeyExchange", SSL3_MT_SERVER_KEY_EXCHANGE},
-    {", CertificateRequest", SSL3_MT_CERTIFICATE_REQUEST},
-    {", ServerHelloDone", SSL3_MT_SERVER_DONE},
-    {", CertificateVerify", SSL3_MT_CERTIFICATE_VERIFY},
-    {", ClientKeyExchange", SSL3_MT_CLIENT_KEY_EXCHANGE},
-    {", Finished", SSL3_MT_FINISHED},
-    {", CertificateUrl", SSL3_MT_CERTIFICATE_URL},
-    {", CertificateStatus", SSL3_MT_CERTIFICATE_STATUS},
-    {", SupplementalData", SSL3_MT_SUPPLEMENTAL_DATA},
-    {", KeyUpdate", SSL3_MT_KEY_UPDATE},
-#ifndef OPENSSL_NO_NEXTPROTONEG
-    {", NextProto", SSL3_MT_NEXT_PROTO},
-#endif
-    {", MessageHash", SSL3_MT_MESSAGE_HASH},
-    {NULL}
-};
+static void msg_cb(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg) {
+    struct openssl_engine *eng = arg;
+    const unsigned char *bp = buf;
+    tlsuv_trace_event ev = {
+            .type = tlsuv_TRACE_RECORD,
+            .host = eng->host,
+            .outgoing = write_p,
+            .version = version,
+            .content_type = content_type,
+            .length = len,
+    };
+
+    switch (content_type) {
+        case SSL3_RT_CHANGE_CIPHER_SPEC:
+        case SSL3_RT_APPLICATION_DATA:
+            break;
+        case SSL3_RT_ALERT:
+            if (len != 2) return;
+            ev.type = tlsuv_TRACE_ALERT;
+            ev.alert_level = bp[0];
+            ev.msg_type = bp[1];
+            break;
+        case SSL3_RT_HANDSHAKE:
+            ev.msg_type = len > 0 ? bp[0] : -1;
+            break;
+        default:
+            // record headers and TLS 1.3 inner content type
+            return;
+    }
+    tls_trace_emit(&ev);
+}
 
+static void info_cb(const SSL *s, int where, int ret) {
+    struct openssl_engine *eng = SSL_get_app_data(s);
+    char state[128];
+    const char *side = (where & SSL_ST_CONNECT) ? "SSL_connect" :
+                       (where & SSL_ST_ACCEPT) ? "SSL_accept" : "undefined";
 
-static STRINT_PAIR alert_types[] = {
-    {" close_notify", 0},
-    {" end_of_early_data", 1},
-    {" unexpected_message", 10},
-    {" bad_record_mac", 20},
-    {" decryption_failed", 21},
-    {" record_overflow", 22},
-    {" decompression_failure", 30},
-    {" handshake_failure", 40},
-    {" bad_certificate", 42},
-    {" unsupported_certificate", 43},
-    {" certificate_revoked", 44},
-    {" certificate_expired", 45},
-    {" certificate_unknown", 46},
-    {" illegal_parameter", 47},
-    {" unknown_ca", 48},
-    {" access_denied", 49},
-    {" decode_error", 50},
-    {" decrypt_error", 51},
-    {" export_restriction", 60},
-    {" protocol_version", 70},
-    {" insufficient_security", 71},
-    {" internal_error", 80},
-    {" inappropriate_fallback", 86},
-    {" user_canceled", 90},
-    {" no_renegotiation", 100},
-    {" missing_extension", 109},
-    {" unsupported_extension", 110},
-    {" certificate_unobtainable", 111},
-    {" unrecognized_name", 112},
-    {" bad_certificate_status_response", 113},
-    {" bad_certificate_hash_value", 114},
-    {" unknown_psk_identity", 115},
-    {" certificate_required", 116},
-    {NULL}
-};
+    if (where & SSL_CB_LOOP) {
+        snprintf(state, sizeof(state), "%s:%s", side, SSL_state_string_long(s));
+    } else if ((where & SSL_CB_EXIT) && ret <= 0) {
+        snprintf(state, sizeof(state), "%s:%s in %s", side, ret == 0 ? "failed" : "error", SSL_state_string_long(s));
+    } else {
+        // alerts are reported by msg_cb
+        return;
+    }
 
-static STRINT_PAIR ssl_versions[] = {
-    {"SSL 3.0", SSL3_VERSION},
-    {"TLS 1.0", TLS1_VERSION},
-    {"TLS 1.1", TLS1_1_VERSION},
-    {"TLS 1.2", TLS1_2_VERSION},
-    {"TLS 1.3", TLS1_3_VERSION},
-    {"DTLS 1.0", DTLS1_VERSION},
-    {"DTLS 1.0 (bad)", DTLS1_BAD_VER},
-    {NULL}
-};
+    tlsuv_trace_event ev = {
+            .type = tlsuv_TRACE_STATE,
+            .host = eng ? eng->host : NULL,
+            .version = SSL_version(s),
+            .state = state,
+    };
+    tls_trace_emit(&ev);
+}
 
-static void msg_cb (int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg) {
-    const char *str_write_p = write_p ? ">>>" : "<<<";
+// attaches or detaches protocol trace hooks after tracing settings changed
+static inline void trace_sync(struct openssl_engine *eng) {
+    int64_t gen = tls_trace_generation();
+    if (gen == eng->trace_gen) {
+        return;
+    }
 
-    const char *str_content_type = "", *str_details1 = "", *str_details2 = "";
-    const char *str_version = lookup(version, ssl_versions, "???");
+    eng->trace_gen = gen;
+    if (tls_trace_match(eng->host)) {
+        SSL_set_msg_callback(eng->ssl, msg_cb);
+        SSL_set_msg_callback_arg(eng->ssl, eng);
+        SSL_set_info_callback(eng->ssl, info_cb);
+    } else {
+        SSL_set_msg_callback(eng->ssl, NULL);
+        SSL_set_info_callback(eng->ssl, NULL);
+    }
+}
 
-    const unsigned char* bp = buf;
+// lean mode needs BIOs that can drop their storage when drained
+#define LEAN_IO_BUFFER 4096
 
-    if (version == SSL3_VERSION ||
-        version == TLS1_VERSION ||
-        version == TLS1_1_VERSION ||
-        version == TLS1_2_VERSION ||
-        version == TLS1_3_VERSION ||
-        version == DTLS1_VERSION || version == DTLS1_BAD_VER) {
-        switch (content_type) {
-        case 20:
-            str_content_type = ", ChangeCipherSpec";
-            break;
-        case 21:
-            str_content_type = ", Alert";
-            str_details1 = ", ???";
-            if (len == 2) {
-                switch (bp[0]) {
-                case 1:
-                    str_details1 = ", warning";
-                    break;
-                case 2:
-                    str_details1 = ", fatal";
-                    break;
-                }
-                str_details2 = lookup((int)bp[1], alert_types, " ???");
-            }
-            break;
-        case 22:
-            str_content_type = ", Handshake";
-            str_details1 = "???";
-            if (len > 0)
-                str_details1 = lookup((int)bp[0], handshakes, "???");
-            break;
-        case 23:
-            str_content_type = ", ApplicationData";
-            break;
-        }
-    } else if (version == 0 && content_type == SSL3_RT_HEADER) {
-        str_version = "";
-        str_content_type = "TLS Header";
+static bool use_ring_io(const struct openssl_ctx *c) {
+    return c->io_buffer > 0 || c->lean;
+}
+
+// rough size of a TLS record buffer held by SSL object (header, max payload, AEAD overhead)
+#define RECORD_BUFFER_EST (SSL3_RT_HEADER_LENGTH + SSL3_RT_MAX_PLAIN_LENGTH + 256)
+
+static void lean_release(struct openssl_engine *e) {
+    if (e->ctx->lean && e->ring_io) {
+        ring_bio_release(e->in);
+        ring_bio_release(e->out);
+    }
+}
+
+static int tls_set_idle_lean(tls_context *ctx, int enable) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->lean = enable != 0;
+    if (c->lean) {
+        SSL_CTX_set_mode(c->ctx, SSL_MODE_RELEASE_BUFFERS);
+    } else {
+        SSL_CTX_clear_mode(c->ctx, SSL_MODE_RELEASE_BUFFERS);
     }
+    engine_pool_flush(c);
+    return 0;
+}
 
-    UM_LOG(TRACE, "%s %s%s [length %04lx]%s%s", str_write_p, str_version,
-               str_content_type, (unsigned long)len, str_details1,
-               str_details2);
+static int tls_idle_lean(void *engine) {
+    struct openssl_engine *e = engine;
+    return e->ctx->lean;
+}
 
-//    if (len > 0) {
-//        size_t num, i;
-//
-//        fprintf(stderr, "   ");
-//        num = len;
-//        for (i = 0; i < num; i++) {
-//            if (i % 16 == 0 && i > 0)
-//                fprintf(stderr, "\n   ");
-//            fprintf(stderr, " %02x", ((const unsigned char *)buf)[i]);
-//        }
-//        if (i < len)
-//            fprintf(stderr, " ...");
-//        fprintf(stderr, "\n");
-//    }
-
-}
-
-void info_cb(const SSL *s, int where, int ret) {
-    const char *str;
-    int w = where & ~SSL_ST_MASK;
-
-    if (w & SSL_ST_CONNECT)
-        str = "SSL_connect";
-    else if (w & SSL_ST_ACCEPT)
-        str = "SSL_accept";
-    else
-        str = "undefined";
+static size_t tls_mem_usage(void *engine) {
+    struct openssl_engine *e = engine;
+    size_t total = 0;
+    if (e->ring_io) {
+        total += ring_bio_mem(e->in) + ring_bio_mem(e->out);
+    } else {
+        BUF_MEM *m;
+        if (BIO_get_mem_ptr(e->in, &m) > 0 && m) total += m->max;
+        if (BIO_get_mem_ptr(e->out, &m) > 0 && m) total += m->max;
+    }
 
-    if (where & SSL_CB_LOOP) {
-        UM_LOG(TRACE, "%s:%s", str, SSL_state_string_long(s));
-    } else if (where & SSL_CB_ALERT) {
-        str = (where & SSL_CB_READ) ? "read" : "write";
-        UM_LOG(VERB, "SSL3 alert %s:%s:%s",
-                   str,
-                   SSL_alert_type_string_long(ret),
-                   SSL_alert_desc_string_long(ret));
-    } else if (where & SSL_CB_EXIT) {
-        if (ret == 0)
-            UM_LOG(VERB, "%s:failed in %s", str, SSL_state_string_long(s));
-        else if (ret < 0)
-            UM_LOG(VERB, "%s:error in %s", str, SSL_state_string_long(s));
+    // SSL object does not expose its buffers: with RELEASE_BUFFERS they are freed once idle,
+    // otherwise read and write buffers stay allocated after first use
+    if (!SSL_in_before(e->ssl)) {
+        if ((SSL_get_mode(e->ssl) & SSL_MODE_RELEASE_BUFFERS) == 0) {
+            total += 2 * RECORD_BUFFER_EST;
+        } else if (SSL_pending(e->ssl) > 0 || SSL_in_init(e->ssl)) {
+            total += RECORD_BUFFER_EST;
+        }
     }
+    return total;
 }
 
 tls_engine *new_openssl_engine(void *ctx, const char *host) {
     struct openssl_ctx *context = ctx;
 
-    tls_engine *engine = calloc(1, sizeof(tls_engine));
-    struct openssl_engine *eng = calloc(1, sizeof(struct openssl_engine));
-    engine->engine = eng;
-    eng->ssl = SSL_new(context->ctx);
-    eng->in = BIO_new(BIO_s_mem());
-    eng->out = BIO_new(BIO_s_mem());
-    SSL_set_bio(eng->ssl, eng->in, eng->out);
-    SSL_set_tlsext_host_name(eng->ssl, host);
-    SSL_set1_host(eng->ssl, host);
-    SSL_set_connect_state(eng->ssl);
-    engine->api = &openssl_engine_api;
+    uv_mutex_lock(&context->lock);
+    struct openssl_engine *eng = LIST_FIRST(&context->idle);
+    if (eng) {
+        LIST_REMOVE(eng, _next);
+        context->idle_count--;
+    }
+    uv_mutex_unlock(&context->lock);
 
-    if (context->alpn_protocols) {
-        SSL_set_alpn_protos(eng->ssl, context->alpn_protocols, strlen((char*)context->alpn_protocols));
+    tls_engine *engine;
+    if (eng) {
+        // pooled engine was scrubbed on release, previous peer's session must not be offered to new host
+        engine = eng->self;
+        SSL_set_session(eng->ssl, NULL);
+    } else {
+        engine = tlsuv__calloc(1, sizeof(tls_engine));
+        eng = tlsuv__calloc(1, sizeof(struct openssl_engine));
+        engine->engine = eng;
+        eng->self = engine;
+        eng->ssl = SSL_new(context->ctx);
+        if (use_ring_io(context)) {
+            size_t cap = context->io_buffer > 0 ? context->io_buffer : LEAN_IO_BUFFER;
+            eng->ring_io = true;
+            eng->in = ring_bio_new(cap);
+            eng->out = ring_bio_new(cap);
+        } else {
+            eng->in = BIO_new(BIO_s_mem());
+            eng->out = BIO_new(BIO_s_mem());
+        }
+        SSL_set_bio(eng->ssl, eng->in, eng->out);
+        if (context->server) {
+            SSL_set_accept_state(eng->ssl);
+        } else {
+            SSL_set_connect_state(eng->ssl);
+        }
+        engine->api = &openssl_engine_api;
+        SSL_set_app_data(eng->ssl, eng);
+    }
+
+    if (context->server) {
+        // client's name is only known once its hello is received
+        host = NULL;
+    } else {
+        SSL_set_tlsext_host_name(eng->ssl, host);
+        SSL_set1_host(eng->ssl, host);
+        SSL_set_tlsext_status_type(eng->ssl, context->ocsp.mode != TLS_OCSP_OFF ?
+                                             TLSEXT_STATUSTYPE_ocsp : -1);
+
+        if (context->alpn_protocols) {
+            SSL_set_alpn_protos(eng->ssl, context->alpn_protocols, strlen((char *) context->alpn_protocols));
+        } else {
+            SSL_set_alpn_protos(eng->ssl, NULL, 0);
+        }
     }
 
-    SSL_set_app_data(eng->ssl, eng);
+    record_sizer_init(&eng->sizer, &context->record_sizing);
 
+    eng->ctx = context;
+    uv_mutex_lock(&context->lock);
+    LIST_INSERT_HEAD(&context->engines, eng, _next);
+    uv_mutex_unlock(&context->lock);
+
+    if (host) {
+        eng->host = tlsuv__strdup(host);
+        uv_mutex_lock(&context->lock);
+        SSL_SESSION *session = tlsuv_session_cache_get(context->sessions, host, session_alpn_key(context));
+        if (session && SSL_set_session(eng->ssl, session) == 1) {
+            eng->session_offered = true;
+        }
+        uv_mutex_unlock(&context->lock);
+    }
+
+    // pooled engine may have been traced for previous host
+    eng->trace_gen = -1;
+    trace_sync(eng);
     return engine;
 }
 
+// seconds until the first cert of the chain expires
+static int64_t chain_valid_for(X509 *crt, STACK_OF(X509) *chain) {
+    int64_t valid = INT64_MAX;
+    int n = chain ? sk_X509_num(chain) : 0;
+    for (int i = -1; i < n; i++) {
+        X509 *c = i < 0 ? crt : sk_X509_value(chain, i);
+        int days, secs;
+        if (!ASN1_TIME_diff(&days, &secs, NULL, X509_get0_notAfter(c))) {
+            return 0;
+        }
+        int64_t left = (int64_t) days * 86400 + secs;
+        if (left < valid) valid = left;
+    }
+    return valid;
+}
+
+// digest of peer host name and presented chain, result for one host does not apply to another
+static int chain_digest(const char *host, X509 *crt, STACK_OF(X509) *chain, uint8_t key[TLSUV_VERIFY_KEY_LEN]) {
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    int ok = EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    ok = ok && EVP_DigestUpdate(md, host ? host : "", host ? strlen(host) + 1 : 1);
+    int n = chain ? sk_X509_num(chain) : 0;
+    for (int i = -1; ok && i < n; i++) {
+        X509 *c = i < 0 ? crt : sk_X509_value(chain, i);
+        unsigned char *der = NULL;
+        int der_len = i2d_X509(c, &der);
+        ok = der_len > 0 && EVP_DigestUpdate(md, der, der_len);
+        OPENSSL_free(der);
+    }
+    ok = ok && EVP_DigestFinal_ex(md, key, NULL);
+    EVP_MD_CTX_free(md);
+    return ok ? 0 : -1;
+}
+
 static int cert_verify_cb(X509_STORE_CTX *certs, void *ctx) {
     struct openssl_ctx *c = ctx;
 
-    X509_STORE *store = X509_STORE_new();
     X509 *crt = X509_STORE_CTX_get0_cert(certs);
+    STACK_OF(X509) *chain = X509_STORE_CTX_get0_untrusted(certs);
+    // set from SSL_set1_host() before chain verification starts
+    const char *host = X509_VERIFY_PARAM_get0_host(X509_STORE_CTX_get0_param(certs), 0);
+
+    uint8_t key[TLSUV_VERIFY_KEY_LEN];
+    bool cacheable = c->verified != NULL && chain_digest(host, crt, chain, key) == 0;
+    if (cacheable) {
+        uv_mutex_lock(&c->lock);
+        bool verified = tlsuv_verify_cache_check(c->verified, key);
+        uv_mutex_unlock(&c->lock);
+        if (verified) {
+            return 1;
+        }
+    }
+
+    X509_STORE *store = X509_STORE_new();
     X509_STORE_add_cert(store, crt);
 
     char n[1024];
@@ -599,6 +987,12 @@ static int cert_verify_cb(X509_STORE_CTX *certs, void *ctx) {
         rc = 0;
     }
     X509_STORE_free(store);
+
+    if (rc == 1 && cacheable) {
+        uv_mutex_lock(&c->lock);
+        tlsuv_verify_cache_put(c->verified, key, chain_valid_for(crt, chain));
+        uv_mutex_unlock(&c->lock);
+    }
     return rc;
 }
 
@@ -608,7 +1002,14 @@ static void tls_set_cert_verify(tls_context *ctx, int (*verify_f)(void *cert, vo
     struct openssl_ctx *c = ctx->ctx;
     c->cert_verify_f = verify_f;
     c->verify_ctx = v_ctx;
-    SSL_CTX_set_verify(c->ctx, SSL_VERIFY_PEER, NULL);
+
+    // results of previous callback do not apply
+    uv_mutex_lock(&c->lock);
+    tlsuv_verify_cache_free(c->verified);
+    c->verified = tlsuv_verify_cache_new(c->verify_cache_size, c->verify_cache_ttl);
+    uv_mutex_unlock(&c->lock);
+
+    SSL_CTX_set_verify(c->ctx, peer_verify_mode(c), NULL);
     SSL_CTX_set_cert_verify_callback(c->ctx, cert_verify_cb, c);
 }
 
@@ -624,48 +1025,665 @@ static int tls_verify_signature(void *cert, enum hash_algo md, const char* data,
     return verify_signature(pk, md, data, datalen, sig, siglen);
 }
 
+static int tls_set_io_buffer(tls_context *ctx, size_t capacity) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->io_buffer = capacity;
+    engine_pool_flush(c);
+    return 0;
+}
+
+static int tls_set_record_sizing(tls_context *ctx, const tls_record_sizing *sizing) {
+    struct openssl_ctx *c = ctx->ctx;
+    if (sizing) {
+        c->record_sizing = *sizing;
+    } else {
+        memset(&c->record_sizing, 0, sizeof(c->record_sizing));
+    }
+    return 0;
+}
+
+static int hex_decode(const char *hex, uint8_t *out, size_t maxout) {
+    size_t n = 0;
+    while (hex[0] && hex[1] && n < maxout) {
+        int hi = OPENSSL_hexchar2int((unsigned char) hex[0]);
+        int lo = OPENSSL_hexchar2int((unsigned char) hex[1]);
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        out[n++] = (uint8_t) (hi << 4 | lo);
+        hex += 2;
+    }
+    return (int) n;
+}
+
+// key log lines are "<label> <client random> <secret>", only client application secret is kept
+static void keylog_cb(const SSL *ssl, const char *line) {
+    static const char label[] = "CLIENT_TRAFFIC_SECRET_0 ";
+    struct openssl_ctx *c = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (c != NULL && c->user_keylog != NULL) {
+        c->user_keylog(ssl, line);
+    }
+
+    struct openssl_engine *eng = SSL_get_app_data(ssl);
+    if (eng == NULL || strncmp(line, label, sizeof(label) - 1) != 0) {
+        return;
+    }
+
+    const char *secret = strrchr(line, ' ');
+    int len = secret ? hex_decode(secret + 1, eng->tx_secret, sizeof(eng->tx_secret)) : -1;
+    eng->tx_secret_len = len > 0 ? (size_t) len : 0;
+}
+
+static int tls_set_verify_cache(tls_context *ctx, size_t max_entries, unsigned int ttl) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->verify_cache_size = max_entries;
+    c->verify_cache_ttl = ttl;
+    uv_mutex_lock(&c->lock);
+    tlsuv_verify_cache_free(c->verified);
+    c->verified = tlsuv_verify_cache_new(max_entries, ttl);
+    uv_mutex_unlock(&c->lock);
+    return 0;
+}
+
+// allowed difference between local clock and OCSP response validity period
+#define OCSP_CLOCK_SKEW 300
+
+static int cert_id_digest(OCSP_CERTID *id, uint8_t key[TLSUV_VERIFY_KEY_LEN]) {
+    unsigned char *der = NULL;
+    int der_len = i2d_OCSP_CERTID(id, &der);
+    int ok = der_len > 0 && EVP_Digest(der, der_len, key, NULL, EVP_sha256(), NULL);
+    OPENSSL_free(der);
+    return ok ? 0 : -1;
+}
+
+// issuer is needed to identify certificate to responder, it may be a trust anchor that peer did not send
+static X509 *ocsp_find_issuer(struct openssl_ctx *c, SSL *ssl, X509 *leaf) {
+    STACK_OF(X509) *verified = SSL_get0_verified_chain(ssl);
+    if (verified && sk_X509_num(verified) > 1 && X509_check_issued(sk_X509_value(verified, 1), leaf) == X509_V_OK) {
+        X509 *issuer = sk_X509_value(verified, 1);
+        X509_up_ref(issuer);
+        return issuer;
+    }
+
+    STACK_OF(X509) *peer = SSL_get_peer_cert_chain(ssl);
+    for (int i = 1; peer && i < sk_X509_num(peer); i++) {
+        X509 *cand = sk_X509_value(peer, i);
+        if (X509_check_issued(cand, leaf) == X509_V_OK) {
+            X509_up_ref(cand);
+            return cand;
+        }
+    }
+
+    X509 *issuer = NULL;
+    X509_STORE *store = c->ca ? c->ca->store : SSL_CTX_get_cert_store(c->ctx);
+    X509_STORE_CTX *sctx = X509_STORE_CTX_new();
+    if (X509_STORE_CTX_init(sctx, store, leaf, NULL) == 1 &&
+        X509_STORE_CTX_get1_issuer(&issuer, sctx, leaf) != 1) {
+        issuer = NULL;
+    }
+    X509_STORE_CTX_free(sctx);
+    return issuer;
+}
+
+static OCSP_RESPONSE *ocsp_fetch(struct openssl_ctx *c, X509 *leaf, OCSP_CERTID *id) {
+    if (c->ocsp.fetch == NULL) {
+        return NULL;
+    }
+
+    STACK_OF(OPENSSL_STRING) *urls = X509_get1_ocsp(leaf);
+    const char *url = sk_OPENSSL_STRING_num(urls) > 0 ? sk_OPENSSL_STRING_value(urls, 0) : NULL;
+
+    OCSP_RESPONSE *resp = NULL;
+    OCSP_REQUEST *req = OCSP_REQUEST_new();
+    OCSP_CERTID *req_id = OCSP_CERTID_dup(id);
+    unsigned char *der = NULL;
+    int der_len = 0;
+    if (OCSP_request_add0_id(req, req_id) == NULL) {
+        OCSP_CERTID_free(req_id);
+    } else {
+        der_len = i2d_OCSP_REQUEST(req, &der);
+    }
+
+    if (der_len > 0) {
+        uint8_t *body = NULL;
+        size_t body_len = 0;
+        UM_LOG(VERB, "fetching OCSP response from %s", url ? url : "<no responder URL>");
+        int rc = c->ocsp.fetch(url, der, (size_t) der_len, &body, &body_len, c->ocsp.fetch_ctx);
+        if (rc == 0 && body != NULL) {
+            const unsigned char *p = body;
+            resp = d2i_OCSP_RESPONSE(NULL, &p, (long) body_len);
+        } else {
+            UM_LOG(WARN, "failed to fetch OCSP response: %d", rc);
+        }
+        free(body);
+    }
+
+    OPENSSL_free(der);
+    OCSP_REQUEST_free(req);
+    X509_email_free(urls);
+    return resp;
+}
+
+// returns V_OCSP_CERTSTATUS_* of the certificate, or -1 if response is not valid
+static int ocsp_check_response(struct openssl_ctx *c, SSL *ssl, OCSP_RESPONSE *resp, OCSP_CERTID *id,
+                               X509 *issuer, int64_t *valid_sec) {
+    OCSP_BASICRESP *bs = NULL;
+    if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL ||
+        (bs = OCSP_response_get1_basic(resp)) == NULL) {
+        UM_LOG(WARN, "OCSP response status: %s", OCSP_response_status_str(OCSP_response_status(resp)));
+        return -1;
+    }
+
+    // responder is usually the issuer, which may be missing from peer chain
+    STACK_OF(X509) *peer = SSL_get_peer_cert_chain(ssl);
+    STACK_OF(X509) *certs = peer ? sk_X509_dup(peer) : sk_X509_new_null();
+    sk_X509_push(certs, issuer);
+    X509_STORE *store = c->ca ? c->ca->store : SSL_CTX_get_cert_store(c->ctx);
+
+    int status = -1;
+    int cert_status, reason;
+    ASN1_GENERALIZEDTIME *revoked, *this_upd, *next_upd;
+    if (OCSP_basic_verify(bs, certs, store, 0) <= 0) {
+        unsigned long err = ERR_get_error();
+        UM_LOG(WARN, "OCSP response verification failed: %s", ERR_reason_error_string(err));
+    } else if (!OCSP_resp_find_status(bs, id, &cert_status, &reason, &revoked, &this_upd, &next_upd)) {
+        UM_LOG(WARN, "OCSP response does not cover peer certificate");
+    } else if (!OCSP_check_validity(this_upd, next_upd, OCSP_CLOCK_SKEW, -1)) {
+        UM_LOG(WARN, "OCSP response is outside of its validity period");
+    } else {
+        status = cert_status;
+        int days, secs;
+        *valid_sec = c->ocsp.max_age;
+        if (next_upd && ASN1_TIME_diff(&days, &secs, NULL, next_upd)) {
+            int64_t left = (int64_t) days * 86400 + secs;
+            if (*valid_sec == 0 || left < *valid_sec) *valid_sec = left;
+        }
+    }
+    ERR_clear_error();
+    sk_X509_free(certs);
+    OCSP_BASICRESP_free(bs);
+    return status;
+}
+
+static int ocsp_status_cb(SSL *ssl, void *arg) {
+    struct openssl_ctx *c = arg;
+    // servers do not staple responses
+    if (SSL_is_server(ssl)) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    // revocation was checked during full handshake of the session
+    if (SSL_session_reused(ssl) || c->ocsp.mode == TLS_OCSP_OFF) {
+        return 1;
+    }
+
+    int fail_rc = c->ocsp.mode == TLS_OCSP_REQUIRE ? 0 : 1;
+    STACK_OF(X509) *peer = SSL_get_peer_cert_chain(ssl);
+    X509 *leaf = peer && sk_X509_num(peer) > 0 ? sk_X509_value(peer, 0) : NULL;
+    X509 *issuer = leaf ? ocsp_find_issuer(c, ssl, leaf) : NULL;
+    OCSP_CERTID *id = issuer ? OCSP_cert_to_id(NULL, leaf, issuer) : NULL;
+    if (id == NULL) {
+        UM_LOG(WARN, "peer certificate issuer is not known, can't check revocation status");
+        X509_free(issuer);
+        return fail_rc;
+    }
+
+    uint8_t key[TLSUV_VERIFY_KEY_LEN];
+    bool cacheable = cert_id_digest(id, key) == 0;
+    bool cached = false;
+    if (cacheable) {
+        uv_mutex_lock(&c->lock);
+        cached = tlsuv_verify_cache_check(c->ocsp_checked, key);
+        uv_mutex_unlock(&c->lock);
+    }
+
+    int rc = 1;
+    if (!cached) {
+        const unsigned char *stapled = NULL;
+        long len = SSL_get_tlsext_status_ocsp_resp(ssl, &stapled);
+        OCSP_RESPONSE *resp = len > 0 ? d2i_OCSP_RESPONSE(NULL, &stapled, len) : NULL;
+        if (resp == NULL) {
+            UM_LOG(VERB, "no stapled OCSP response");
+            resp = ocsp_fetch(c, leaf, id);
+        }
+
+        int64_t valid = 0;
+        int status = resp ? ocsp_check_response(c, ssl, resp, id, issuer, &valid) : -1;
+        if (status == V_OCSP_CERTSTATUS_GOOD) {
+            if (cacheable) {
+                uv_mutex_lock(&c->lock);
+                tlsuv_verify_cache_put(c->ocsp_checked, key, valid);
+                uv_mutex_unlock(&c->lock);
+            }
+        } else if (status == V_OCSP_CERTSTATUS_REVOKED) {
+            UM_LOG(WARN, "peer certificate is revoked");
+            rc = 0;
+        } else {
+            UM_LOG(WARN, "revocation status of peer certificate is not known");
+            rc = fail_rc;
+        }
+        OCSP_RESPONSE_free(resp);
+    }
+
+    OCSP_CERTID_free(id);
+    X509_free(issuer);
+    return rc;
+}
+
+static int tls_set_ocsp(tls_context *ctx, const tls_ocsp_config *cfg) {
+    struct openssl_ctx *c = ctx->ctx;
+    if (cfg && (cfg->mode < TLS_OCSP_OFF || cfg->mode > TLS_OCSP_REQUIRE)) {
+        return UV_EINVAL;
+    }
+
+    uv_mutex_lock(&c->lock);
+    if (cfg) {
+        c->ocsp = *cfg;
+    } else {
+        memset(&c->ocsp, 0, sizeof(c->ocsp));
+    }
+    tlsuv_verify_cache_free(c->ocsp_checked);
+    c->ocsp_checked = c->ocsp.mode != TLS_OCSP_OFF ?
+                      tlsuv_verify_cache_new(c->ocsp.cache_size, c->ocsp.max_age ? c->ocsp.max_age : UINT_MAX) :
+                      NULL;
+    uv_mutex_unlock(&c->lock);
+
+    if (c->ocsp.mode != TLS_OCSP_OFF) {
+        SSL_CTX_set_tlsext_status_cb(c->ctx, ocsp_status_cb);
+        SSL_CTX_set_tlsext_status_arg(c->ctx, c);
+    } else {
+        SSL_CTX_set_tlsext_status_cb(c->ctx, NULL);
+    }
+    return 0;
+}
+
+struct cipher_profile_s {
+    const char *tls13;
+    const char *tls12;
+    const char *groups;
+};
+
+#define DEFAULT_GROUPS "X25519:P-256:X448:P-521:P-384"
+
+static const struct cipher_profile_s cipher_profiles[] = {
+        [TLS_CIPHERS_DEFAULT] = {
+                TLS_DEFAULT_CIPHERSUITES, "DEFAULT", DEFAULT_GROUPS,
+        },
+        [TLS_CIPHERS_THROUGHPUT] = {
+                "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256",
+                "ECDHE+AESGCM:ECDHE+CHACHA20:!aNULL",
+                "X25519:P-256:P-384",
+        },
+        [TLS_CIPHERS_LOW_CPU] = {
+                "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384",
+                "ECDHE+CHACHA20:ECDHE+AESGCM:!aNULL",
+                "X25519:P-256",
+        },
+        [TLS_CIPHERS_COMPAT] = {
+                TLS_DEFAULT_CIPHERSUITES,
+                "HIGH:!aNULL:!MD5:!RC4:!3DES",
+                DEFAULT_GROUPS ":ffdhe2048:ffdhe3072",
+        },
+};
+
+static int tls_set_cipher_profile(tls_context *ctx, tls_cipher_profile profile) {
+    struct openssl_ctx *c = ctx->ctx;
+
+    if (profile == TLS_CIPHERS_AUTO) {
+        profile = tlsuv_cpu_has_aes() ? TLS_CIPHERS_THROUGHPUT : TLS_CIPHERS_LOW_CPU;
+    }
+    if ((int) profile < 0 || profile >= sizeof(cipher_profiles) / sizeof(cipher_profiles[0]) ||
+        cipher_profiles[profile].tls12 == NULL) {
+        return UV_EINVAL;
+    }
+
+    const struct cipher_profile_s *p = &cipher_profiles[profile];
+    engine_pool_flush(c);
+    ERR_clear_error();
+    if (!SSL_CTX_set_ciphersuites(c->ctx, p->tls13) || !SSL_CTX_set_cipher_list(c->ctx, p->tls12)) {
+        UM_LOG(WARN, "failed to set cipher profile[%d]: %s", profile, tls_error(ERR_get_error()));
+        return UV_EINVAL;
+    }
+    if (!SSL_CTX_set1_groups_list(c->ctx, p->groups)) {
+        // finite field groups are not known to older OpenSSL versions
+        ERR_clear_error();
+        if (!SSL_CTX_set1_groups_list(c->ctx, DEFAULT_GROUPS)) {
+            UM_LOG(WARN, "failed to set key exchange groups: %s", tls_error(ERR_get_error()));
+            return UV_EINVAL;
+        }
+    }
+
+    UM_LOG(VERB, "cipher profile[%d] set", profile);
+    return 0;
+}
+
+static int tls_set_async_handshake(tls_context *ctx, int enable) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->async_hs = enable != 0;
+    return 0;
+}
+
+static int tls_async_handshake(void *engine) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+    struct openssl_ctx *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(eng->ssl));
+    return ctx->async_hs;
+}
+
+static int tls_set_async_crypto(tls_context *ctx, int enable) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->async_crypto = enable != 0;
+    return 0;
+}
+
+static int tls_async_crypto(void *engine) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+    struct openssl_ctx *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(eng->ssl));
+    return ctx->async_crypto;
+}
+
+static int tls_set_ktls(tls_context *ctx, int enable) {
+    struct openssl_ctx *c = ctx->ctx;
+    SSL_CTX_keylog_cb_func current = SSL_CTX_get_keylog_callback(c->ctx);
+    if (enable && current != keylog_cb) {
+        c->user_keylog = current;
+        SSL_CTX_set_keylog_callback(c->ctx, keylog_cb);
+    } else if (!enable && current == keylog_cb) {
+        SSL_CTX_set_keylog_callback(c->ctx, c->user_keylog);
+        c->user_keylog = NULL;
+    }
+    c->ktls = enable != 0;
+    return 0;
+}
+
+static int tls_ktls_tx(void *engine, uv_os_fd_t fd) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+
+    // records written so far were encrypted here, kernel sequence would not match
+    // (server has already sent session tickets)
+    if (eng->tx_secret_len == 0 || eng->app_written || eng->ktls_tx || SSL_is_server(eng->ssl) ||
+        SSL_version(eng->ssl) != TLS1_3_VERSION || !SSL_is_init_finished(eng->ssl) ||
+        BIO_ctrl_pending(eng->out) > 0) {
+        return UV_ENOTSUP;
+    }
+
+    int rc = ktls_install_tx(fd, SSL_get_current_cipher(eng->ssl), eng->tx_secret, eng->tx_secret_len);
+    OPENSSL_cleanse(eng->tx_secret, sizeof(eng->tx_secret));
+    eng->tx_secret_len = 0;
+
+    if (rc == 0) {
+        UM_LOG(DEBG, "kTLS: outbound records are encrypted by kernel");
+        eng->ktls_tx = true;
+    }
+    return rc;
+}
+
+static void tls_get_session_stats(tls_context *ctx, tls_session_stats *stats) {
+    struct openssl_ctx *c = ctx->ctx;
+    uv_mutex_lock(&c->lock);
+    tlsuv_session_cache_stats(c->sessions, stats);
+    uv_mutex_unlock(&c->lock);
+}
+
 static void tls_free_ctx(tls_context *ctx) {
     struct openssl_ctx *c = ctx->ctx;
+    engine_pool_flush(c);
+    tlsuv_session_cache_free(c->sessions);
+    c->sessions = NULL;
+    tlsuv_verify_cache_free(c->verified);
+    c->verified = NULL;
+    tlsuv_verify_cache_free(c->ocsp_checked);
+    c->ocsp_checked = NULL;
+    uv_mutex_destroy(&c->lock);
     if (c->alpn_protocols) {
-        free(c->alpn_protocols);
+        tlsuv__free(c->alpn_protocols);
     }
     if (c->own_key) {
         c->own_key->free((struct tlsuv_private_key_s *) c->own_key);
         c->own_key = NULL;
     }
 
-    if (c->ca_chains) {
-        for (int i = 0; i < c->ca_chains_count; i++) {
-            X509_STORE_free(c->ca_chains[i]);
-        }
-        free(c->ca_chains);
-    }
+    tlsuv_ca_store_release(c->ca);
+    c->ca = NULL;
     SSL_CTX_free(c->ctx);
-    free(c);
-    free(ctx);
+    tlsuv__free(c);
+    tlsuv__free(ctx);
+}
+
+// connections are released without waiting for close_notify exchange,
+// OpenSSL would mark session of a connection that was not shut down as not resumable
+static void session_keep(struct openssl_engine *e) {
+    if (e->error == 0 && SSL_is_init_finished(e->ssl)) {
+        SSL_set_shutdown(e->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
 }
 
 static int tls_reset(void *engine) {
     struct openssl_engine *e = engine;
     ERR_clear_error();
 
+    session_keep(e);
     if (!SSL_clear(e->ssl)) {
         int err = SSL_get_error(e->ssl, 0);
         UM_LOG(ERR, "error resetting TSL enging: %d(%s)", err, tls_error(err));
         return -1;
     }
+
+    e->session_offered = false;
+    tlsuv__free(e->early_data);
+    e->early_data = NULL;
+    e->early_len = 0;
+    record_sizer_reset(&e->sizer);
+    OPENSSL_cleanse(e->tx_secret, sizeof(e->tx_secret));
+    e->tx_secret_len = 0;
+    e->app_written = false;
+    e->ktls_tx = false;
+    if (e->host) {
+        SSL_CTX *ssl_ctx = SSL_get_SSL_CTX(e->ssl);
+        struct openssl_ctx *ctx = SSL_CTX_get_app_data(ssl_ctx);
+        uv_mutex_lock(&ctx->lock);
+        SSL_SESSION *session = tlsuv_session_cache_get(ctx->sessions, e->host, session_alpn_key(ctx));
+        if (session && SSL_set_session(e->ssl, session) == 1) {
+            e->session_offered = true;
+        }
+        uv_mutex_unlock(&ctx->lock);
+    }
     return 0;
 }
 
-static void tls_free(tls_engine *engine) {
-    struct openssl_engine *e = engine->engine;
+static void stats_add(tls_traffic_stats *total, const tls_traffic_stats *s) {
+    total->plain_in += s->plain_in;
+    total->plain_out += s->plain_out;
+    total->cipher_in += s->cipher_in;
+    total->cipher_out += s->cipher_out;
+    total->records_in += s->records_in;
+    total->records_out += s->records_out;
+    total->handshakes += s->handshakes;
+    total->handshake_failures += s->handshake_failures;
+    total->resumptions += s->resumptions;
+    total->has_write += s->has_write;
+    total->buffer_allocs += s->buffer_allocs;
+}
+
+static tls_traffic_stats *tls_engine_stats(void *engine) {
+    struct openssl_engine *e = engine;
+    return &e->stats;
+}
+
+static void tls_get_traffic_stats(tls_context *ctx, tls_traffic_stats *stats) {
+    struct openssl_ctx *c = ctx->ctx;
+    uv_mutex_lock(&c->lock);
+    *stats = c->retired;
+    struct openssl_engine *e;
+    LIST_FOREACH(e, &c->engines, _next) {
+        stats_add(stats, &e->stats);
+    }
+    uv_mutex_unlock(&c->lock);
+}
+
+// prepares released engine for reuse by any host
+static int engine_scrub(struct openssl_engine *e) {
+    ERR_clear_error();
+    // server name callback may have switched to another context
+    if (SSL_get_SSL_CTX(e->ssl) != e->ctx->ctx) {
+        SSL_set_SSL_CTX(e->ssl, e->ctx->ctx);
+    }
+    session_keep(e);
+    if (!SSL_clear(e->ssl)) {
+        return -1;
+    }
+    (void) BIO_reset(e->in);
+    (void) BIO_reset(e->out);
+
+    tlsuv__free(e->alpn);
+    e->alpn = NULL;
+    tlsuv__free(e->host);
+    e->host = NULL;
+    tlsuv__free(e->early_data);
+    e->early_data = NULL;
+    e->early_len = 0;
+    e->error = 0;
+    e->session_offered = false;
+    OPENSSL_cleanse(e->tx_secret, sizeof(e->tx_secret));
+    e->tx_secret_len = 0;
+    e->app_written = false;
+    e->ktls_tx = false;
+    memset(&e->stats, 0, sizeof(e->stats));
+    return 0;
+}
+
+static void engine_destroy(struct openssl_engine *e) {
+    tls_engine *engine = e->self;
+    session_keep(e);
     SSL_free(e->ssl);
 
     if (e->alpn) {
-        free(e->alpn);
+        tlsuv__free(e->alpn);
     }
-    free(e);
-    free(engine);
+    tlsuv__free(e->host);
+    tlsuv__free(e->early_data);
+    tlsuv__free(e);
+    tlsuv__free(engine);
+}
+
+static void tls_free(tls_engine *engine) {
+    struct openssl_engine *e = engine->engine;
+    struct openssl_ctx *c = e->ctx;
+    uv_mutex_lock(&c->lock);
+    LIST_REMOVE(e, _next);
+    stats_add(&c->retired, &e->stats);
+    bool reuse = c->idle_count < c->pool_max && e->ring_io == use_ring_io(c);
+    uv_mutex_unlock(&c->lock);
+
+    if (reuse && engine_scrub(e) == 0) {
+        uv_mutex_lock(&c->lock);
+        reuse = c->idle_count < c->pool_max;
+        if (reuse) {
+            LIST_INSERT_HEAD(&c->idle, e, _next);
+            c->idle_count++;
+        }
+        uv_mutex_unlock(&c->lock);
+        if (reuse) {
+            return;
+        }
+    }
+    engine_destroy(e);
+}
+
+// pooled engines carry SSL_CTX settings from the time they were created
+static void engine_pool_flush(struct openssl_ctx *c) {
+    struct idle_engines idle = LIST_HEAD_INITIALIZER(idle);
+    uv_mutex_lock(&c->lock);
+    struct openssl_engine *e;
+    while ((e = LIST_FIRST(&c->idle)) != NULL) {
+        LIST_REMOVE(e, _next);
+        LIST_INSERT_HEAD(&idle, e, _next);
+    }
+    c->idle_count = 0;
+    uv_mutex_unlock(&c->lock);
+
+    while ((e = LIST_FIRST(&idle)) != NULL) {
+        LIST_REMOVE(e, _next);
+        engine_destroy(e);
+    }
+}
+
+static int alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                          const unsigned char *in, unsigned int inlen, void *arg) {
+    struct openssl_ctx *c = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (c->alpn_protocols == NULL) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    unsigned char *proto;
+    if (SSL_select_next_proto(&proto, outlen, c->alpn_protocols, strlen((char *) c->alpn_protocols),
+                              in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = proto;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int servername_cb(SSL *ssl, int *alert, void *arg) {
+    struct openssl_ctx *c = arg;
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (name == NULL || c->sni_f == NULL) {
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    tls_context *alt = c->sni_f(name, c->sni_ctx);
+    if (alt == NULL || alt->ctx == c) {
+        return SSL_TLSEXT_ERR_OK;
+    }
+    if (alt->api != &openssl_context_api) {
+        UM_LOG(WARN, "context selected for server name[%s] is not OpenSSL context", name);
+        *alert = SSL_AD_INTERNAL_ERROR;
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+
+    UM_LOG(VERB, "using alternate context for server name[%s]", name);
+    struct openssl_ctx *alt_ctx = alt->ctx;
+    SSL_set_SSL_CTX(ssl, alt_ctx->ctx);
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int tls_set_server_mode(tls_context *ctx, int flags) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->server = (flags & TLS_SERVER_MODE) ? flags : 0;
+
+    if (c->server) {
+        static const unsigned char sid_ctx[] = "tlsuv";
+        // required for resumption when client certificates are verified
+        SSL_CTX_set_session_id_context(c->ctx, sid_ctx, sizeof(sid_ctx) - 1);
+        SSL_CTX_set_session_cache_mode(c->ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_alpn_select_cb(c->ctx, alpn_select_cb, NULL);
+    } else {
+        SSL_CTX_set_session_cache_mode(c->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_set_alpn_select_cb(c->ctx, NULL, NULL);
+    }
+    SSL_CTX_set_verify(c->ctx, peer_verify_mode(c), c->cert_verify_f ? NULL : verify_peer_cb);
+    engine_pool_flush(c);
+    return 0;
+}
+
+static int tls_set_sni_cb(tls_context *ctx, tls_context *(*sni_f)(const char *name, void *sni_ctx), void *sni_ctx) {
+    struct openssl_ctx *c = ctx->ctx;
+    c->sni_f = sni_f;
+    c->sni_ctx = sni_ctx;
+    if (sni_f) {
+        SSL_CTX_set_tlsext_servername_callback(c->ctx, servername_cb);
+        SSL_CTX_set_tlsext_servername_arg(c->ctx, c);
+    } else {
+        SSL_CTX_set_tlsext_servername_callback(c->ctx, NULL);
+    }
+    return 0;
+}
+
+static int tls_set_engine_pool(tls_context *ctx, size_t max_idle) {
+    struct openssl_ctx *c = ctx->ctx;
+    uv_mutex_lock(&c->lock);
+    c->pool_max = max_idle;
+    uv_mutex_unlock(&c->lock);
+    engine_pool_flush(c);
+    return 0;
 }
 
 static void tls_free_cert(tls_cert *cert) {
@@ -680,7 +1698,7 @@ static void tls_set_alpn_protocols(void *ctx, const char **protos, int len) {
     struct openssl_ctx *c = ctx;
 
     if (c->alpn_protocols) {
-        free(c->alpn_protocols);
+        tlsuv__free(c->alpn_protocols);
     }
 
     size_t protolen = 0;
@@ -688,7 +1706,7 @@ static void tls_set_alpn_protocols(void *ctx, const char **protos, int len) {
         protolen += strlen(protos[i]) + 1;
     }
 
-    c->alpn_protocols = malloc(protolen + 1);
+    c->alpn_protocols = tlsuv__malloc(protolen + 1);
     unsigned char *p = c->alpn_protocols;
     for (int i=0; i < len; i++) {
         size_t plen = strlen(protos[i]);
@@ -734,6 +1752,7 @@ static int tls_set_own_key(void *ctx, tlsuv_private_key_t key) {
         return -1;
     }
 
+    engine_pool_flush(c);
     if (c->own_key) {
         c->own_key->free((tlsuv_private_key_t) c->own_key);
     }
@@ -757,6 +1776,7 @@ static int tls_set_own_cert(void *ctx, const char *cert_buf, size_t cert_len) {
     struct openssl_ctx *c = ctx;
     SSL_CTX *ssl = c->ctx;
 
+    engine_pool_flush(c);
     X509_STORE *store = load_certs(cert_buf, cert_len);
 
     c->own_cert = tls_set_cert_internal(ssl, store);
@@ -769,12 +1789,21 @@ static int tls_set_own_cert(void *ctx, const char *cert_buf, size_t cert_len) {
 }
 
 
+static void feed_input(struct openssl_engine *eng, const char *in, size_t len) {
+    if (eng->ring_io) {
+        ring_bio_lend(eng->in, in, len);
+    } else {
+        BIO_write(eng->in, (const unsigned char *) in, (int) len);
+    }
+}
+
 static tls_handshake_state tls_hs_state(void *engine) {
     struct openssl_engine *eng = (struct openssl_engine *) engine;
     OSSL_HANDSHAKE_STATE state = SSL_get_state(eng->ssl);
     switch (state) {
         case TLS_ST_OK: return TLS_HS_COMPLETE;
-        case TLS_ST_BEFORE: return TLS_HS_BEFORE;
+        // server waiting for client hello has started handshake, but has not moved from initial state
+        case TLS_ST_BEFORE: return SSL_in_before(eng->ssl) ? TLS_HS_BEFORE : TLS_HS_CONTINUE;
         default: return TLS_HS_CONTINUE;
     }
 }
@@ -783,12 +1812,28 @@ static tls_handshake_state tls_hs_state(void *engine) {
 static tls_handshake_state
 tls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *out_bytes, size_t maxout) {
     struct openssl_engine *eng = (struct openssl_engine *) engine;
+    trace_sync(eng);
     if (in_bytes > 0) {
-        BIO_write(eng->in, (const unsigned char *)in, (int)in_bytes);
+        feed_input(eng, in, in_bytes);
     }
     ERR_clear_error();
 
+    if (eng->early_len > 0) {
+        // sends ClientHello followed by early data
+        size_t written = 0;
+        if (!SSL_write_early_data(eng->ssl, eng->early_data, eng->early_len, &written)) {
+            UM_LOG(WARN, "openssl: failed to write early data: %s", tls_error(ERR_get_error()));
+            ERR_clear_error();
+        }
+        tlsuv__free(eng->early_data);
+        eng->early_data = NULL;
+        eng->early_len = 0;
+    }
+
     int rc = SSL_do_handshake(eng->ssl);
+    if (eng->ring_io) {
+        ring_bio_unlend(eng->in);
+    }
 
     if (BIO_ctrl_pending(eng->out) > 0) {
         *out_bytes = BIO_read(eng->out, (unsigned char *) out, (int)maxout);
@@ -797,6 +1842,18 @@ tls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *out_
     }
 
     if (rc == 1) { // handshake completed
+        if (SSL_session_reused(eng->ssl)) {
+            eng->stats.resumptions++;
+        }
+        if (eng->session_offered && !SSL_session_reused(eng->ssl)) {
+            // server did not accept our session, no reason to offer it again
+            struct openssl_ctx *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(eng->ssl));
+            UM_LOG(VERB, "cached session for host[%s] was not accepted", eng->host);
+            uv_mutex_lock(&ctx->lock);
+            tlsuv_session_cache_remove(ctx->sessions, eng->host, session_alpn_key(ctx));
+            uv_mutex_unlock(&ctx->lock);
+        }
+        eng->session_offered = false;
         return TLS_HS_COMPLETE;
     }
 
@@ -817,46 +1874,172 @@ tls_continue_hs(void *engine, char *in, size_t in_bytes, char *out, size_t *out_
     }
 }
 
+static int tls_write_early_data(void *engine, const char *data, size_t len) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+    SSL_SESSION *session = SSL_get_session(eng->ssl);
+    if (!eng->session_offered || session == NULL || SSL_get_state(eng->ssl) != TLS_ST_BEFORE) {
+        return 0;
+    }
+
+    uint32_t max_early = SSL_SESSION_get_max_early_data(session);
+    if (eng->early_len + len > max_early) {
+        return 0;
+    }
+
+    if (eng->early_len == 0) {
+        // session objects captured from a live connection fail early traffic key setup (internal_error alert),
+        // offer a decoded copy of the session instead
+        unsigned char *der = NULL;
+        int der_len = i2d_SSL_SESSION(session, &der);
+        const unsigned char *p = der;
+        SSL_SESSION *copy = der_len > 0 ? d2i_SSL_SESSION(NULL, &p, der_len) : NULL;
+        OPENSSL_free(der);
+        if (copy == NULL || SSL_set_session(eng->ssl, copy) != 1) {
+            SSL_SESSION_free(copy);
+            return 0;
+        }
+        SSL_SESSION_free(copy);
+    }
+
+    char *buf = tlsuv__realloc(eng->early_data, eng->early_len + len);
+    if (buf == NULL) {
+        return UV_ENOMEM;
+    }
+    memcpy(buf + eng->early_len, data, len);
+    eng->early_data = buf;
+    eng->early_len += len;
+    return (int) len;
+}
+
+static tls_early_data_status tls_get_early_data_status(void *engine) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+    switch (SSL_get_early_data_status(eng->ssl)) {
+        case SSL_EARLY_DATA_ACCEPTED: return TLS_EARLY_DATA_ACCEPTED;
+        case SSL_EARLY_DATA_REJECTED: return TLS_EARLY_DATA_REJECTED;
+        default: return TLS_EARLY_DATA_NONE;
+    }
+}
+
 static const char* tls_get_alpn(void *engine) {
     struct openssl_engine *eng = (struct openssl_engine *) engine;
     const unsigned char *proto;
     unsigned int protolen;
     SSL_get0_alpn_selected(eng->ssl, &proto, &protolen);
 
-    eng->alpn = calloc(1, protolen + 1);
+    tlsuv__free(eng->alpn);
+    eng->alpn = tlsuv__calloc(1, protolen + 1);
     strncpy(eng->alpn, (const char*)proto, protolen);
     return eng->alpn;
 }
 
-static int tls_write(void *engine, const char *data, size_t data_len, char *out, size_t *out_bytes, size_t maxout) {
+static int tls_set_protocols(void *engine, const char **protos, int len) {
     struct openssl_engine *eng = (struct openssl_engine *) engine;
-    ERR_clear_error();
+    unsigned char wire[256];
+    size_t wire_len = 0;
+    for (int i = 0; i < len; i++) {
+        size_t plen = strlen(protos[i]);
+        if (plen == 0 || plen > 255 || wire_len + plen + 1 > sizeof(wire)) {
+            return UV_EINVAL;
+        }
+        wire[wire_len++] = (unsigned char) plen;
+        memcpy(wire + wire_len, protos[i], plen);
+        wire_len += plen;
+    }
 
+    // SSL_set_alpn_protos() returns 0 on success
+    return SSL_set_alpn_protos(eng->ssl, wire, (unsigned int) wire_len) == 0 ? 0 : UV_EINVAL;
+}
+
+// buffers smaller than this are copied into a shared record instead of getting their own
+#define COALESCE_LIMIT 1024
+#define MAX_RECORD_SIZE (16 * 1024)
+
+static int ssl_write_all(struct openssl_engine *eng, const char *data, size_t len) {
     size_t wrote = 0;
-    while (data_len > wrote) {
+    while (len > wrote) {
         size_t written;
-        if (!SSL_write_ex(eng->ssl, (const unsigned char *)(data + wrote), data_len - wrote, &written)) {
+        size_t chunk = record_sizer_next(&eng->sizer, len - wrote);
+        if (!SSL_write_ex(eng->ssl, (const unsigned char *)(data + wrote), chunk, &written)) {
             eng->error = ERR_get_error();
             UM_LOG(ERR, "openssl: write error: %s", tls_error(eng->error));
             return -1;
         }
+        record_sizer_sent(&eng->sizer, written);
         wrote += written;
     }
+    return 0;
+}
+
+static int tls_write(void *engine, const char *data, size_t data_len, char *out, size_t *out_bytes, size_t maxout) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+    trace_sync(eng);
+    ERR_clear_error();
+    record_sizer_begin(&eng->sizer);
+    eng->app_written = true;
+
+    if (ssl_write_all(eng, data, data_len) != 0) {
+        return -1;
+    }
 
     if (BIO_ctrl_pending(eng->out) > 0)
         *out_bytes = BIO_read(eng->out, (unsigned char *)out, (int)maxout);
     else
         *out_bytes = 0;
 
+    lean_release(eng);
     return (int)BIO_ctrl_pending(eng->out);
 }
 
+static int tls_write_vec(void *engine, const uv_buf_t *bufs, unsigned int nbufs, uv_buf_t *out, unsigned int *nout) {
+    struct openssl_engine *eng = (struct openssl_engine *) engine;
+    trace_sync(eng);
+    ERR_clear_error();
+    record_sizer_begin(&eng->sizer);
+    eng->app_written = true;
+
+    char stage[MAX_RECORD_SIZE];
+    size_t staged = 0;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        if (bufs[i].len < COALESCE_LIMIT && staged + bufs[i].len <= sizeof(stage)) {
+            memcpy(stage + staged, bufs[i].base, bufs[i].len);
+            staged += bufs[i].len;
+            continue;
+        }
+
+        if (staged > 0) {
+            if (ssl_write_all(eng, stage, staged) != 0) return -1;
+            staged = 0;
+        }
+
+        if (bufs[i].len < COALESCE_LIMIT) {
+            memcpy(stage, bufs[i].base, bufs[i].len);
+            staged = bufs[i].len;
+        } else if (ssl_write_all(eng, bufs[i].base, bufs[i].len) != 0) {
+            return -1;
+        }
+    }
+    if (staged > 0 && ssl_write_all(eng, stage, staged) != 0) {
+        return -1;
+    }
+
+    unsigned int used = 0;
+    while (used < *nout && BIO_ctrl_pending(eng->out) > 0) {
+        int n = BIO_read(eng->out, (unsigned char *) out[used].base, (int) out[used].len);
+        out[used].len = n > 0 ? n : 0;
+        used++;
+    }
+    *nout = used;
+
+    lean_release(eng);
+    return (int)BIO_ctrl_pending(eng->out);
+}
 
 static int
 tls_read(void *engine, const char *ssl_in, size_t ssl_in_len, char *out, size_t *out_bytes, size_t maxout) {
     struct openssl_engine *eng = (struct openssl_engine *) engine;
+    trace_sync(eng);
     if (ssl_in_len > 0 && ssl_in != NULL) {
-        BIO_write(eng->in, (const unsigned char *)ssl_in, (int)ssl_in_len);
+        feed_input(eng, ssl_in, ssl_in_len);
     }
 
     int err = SSL_ERROR_NONE;
@@ -876,8 +2059,21 @@ tls_read(void *engine, const char *ssl_in, size_t ssl_in_len, char *out, size_t
         writep += read_bytes;
     }
 
+    // keep whatever was not consumed, caller buffer is not ours after return
+    if (eng->ring_io) {
+        ring_bio_unlend(eng->in);
+    }
+    lean_release(eng);
+
     *out_bytes = total_out;
 
+    // post-handshake response (e.g. KeyUpdate) cannot be sent after outbound encryption moved to kernel
+    if (eng->ktls_tx && BIO_ctrl_pending(eng->out) > 0) {
+        UM_LOG(ERR, "openssl: peer requires response that cannot be sent with kTLS");
+        (void) BIO_reset(eng->out);
+        return TLS_ERR;
+    }
+
     // this indicates that more bytes are needed to complete SSL frame
     if (err == SSL_ERROR_WANT_READ) {
         return BIO_ctrl_pending(eng->out) > 0 ? TLS_HAS_WRITE : TLS_OK;
@@ -904,6 +2100,12 @@ static int tls_close(void *engine, char *out, size_t *out_bytes, size_t maxout)
     struct openssl_engine *eng = (struct openssl_engine *) engine;
     ERR_clear_error();
 
+    // close_notify would have to be sent as kernel control record
+    if (eng->ktls_tx) {
+        *out_bytes = 0;
+        return 0;
+    }
+
     int rc = SSL_shutdown(eng->ssl);
     if (rc < 0) {
         int err = SSL_get_error(eng->ssl, rc);
@@ -1009,6 +2211,7 @@ goto on_error;            \
         size_t len = BIO_ctrl_pending(b);
         *pem = calloc(1, len + 1);
         BIO_read(b, *pem, (int)len);
+        if (pemlen) *pemlen = len;
     }
 
     BIO_free(b);
@@ -14,6 +14,8 @@
 
 #define OPENSSL_SUPPRESS_DEPRECATED
 
+#include <stdbool.h>
+
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
@@ -21,17 +23,24 @@
 
 #include <tlsuv/tlsuv.h>
 
+#include "../atomics.h"
 #include "../p11.h"
 #include "../um_debug.h"
 #include "keys.h"
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "../alloc.h"
+
 static int pubkey_to_pem(tlsuv_public_key_t pub, char **pem, size_t *pemlen);
 static void pubkey_free(tlsuv_public_key_t k);
 static int pubkey_verify(tlsuv_public_key_t pk, enum hash_algo md, const char *data, size_t datalen, const char *sig, size_t siglen);
+static int pubkey_verify_many(tlsuv_public_key_t pk, enum hash_algo md,
+                              const tlsuv_verify_item *items, size_t count, int *results);
 
 static struct pub_key_s PUB_KEY_API = {
         .free = pubkey_free,
         .verify = pubkey_verify,
+        .verify_many = pubkey_verify_many,
         .to_pem = pubkey_to_pem,
 };
 
@@ -44,6 +53,7 @@ static int privkey_sign(tlsuv_private_key_t pk, enum hash_algo md,
 
 static int privkey_get_cert(tlsuv_private_key_t pk, tls_cert *cert);
 static int privkey_store_cert(tlsuv_private_key_t pk, tls_cert cert);
+static int privkey_refresh(tlsuv_private_key_t pk);
 
 static ECDSA_SIG *privkey_p11_sign_sig(const unsigned char *digest, int len, const BIGNUM *pSt, const BIGNUM *pBignumSt, EC_KEY *ec);
 static int privkey_p11_rsa_enc(int msglen, const unsigned char *msg,
@@ -57,6 +67,7 @@ static struct priv_key_s PRIV_KEY_API = {
         .sign = privkey_sign,
         .get_certificate = privkey_get_cert,
         .store_certificate = privkey_store_cert,
+        .refresh = privkey_refresh,
 };
 
 static EC_KEY_METHOD *p11_ec_method;
@@ -110,8 +121,11 @@ void priv_key_init(struct priv_key_s *privkey) {
 
 static void pubkey_free(tlsuv_public_key_t k) {
     struct pub_key_s *pub = (struct pub_key_s *) k;
+    for (int i = 0; i <= hash_SHA512; i++) {
+        EVP_MD_CTX_free(pub->verify_tmpl[i]);
+    }
     EVP_PKEY_free(pub->pkey);
-    free(pub);
+    tlsuv__free(pub);
 }
 
 static int verify_ecdsa_sig(EC_KEY *ec, const EVP_MD *hash, const char* data, size_t datalen, const char* sig, size_t siglen) {
@@ -181,15 +195,99 @@ int verify_signature (EVP_PKEY *pk, enum hash_algo md, const char* data, size_t
     return rc;
 }
 
-static int pubkey_verify(tlsuv_public_key_t pk, enum hash_algo md, const char *data, size_t datalen, const char *sig, size_t siglen) {
+static const EVP_MD *hash_md(enum hash_algo md) {
+    switch (md) {
+        case hash_SHA256: return EVP_sha256();
+        case hash_SHA384: return EVP_sha384();
+        case hash_SHA512: return EVP_sha512();
+        default: return NULL;
+    }
+}
+
+// DER encoded ECDSA-Sig-Value, checked without parsing it
+static bool ecdsa_sig_is_der(const uint8_t *sig, size_t siglen) {
+    if (siglen < 8 || sig[0] != 0x30) {
+        return false;
+    }
+    if (sig[1] < 0x80) {
+        return sig[1] == siglen - 2;
+    }
+    return sig[1] == 0x81 && sig[2] == siglen - 3;
+}
+
+// verify context with key and digest set up, created once per key and hash, shared by threads
+static EVP_MD_CTX *verify_template(struct pub_key_s *pub, enum hash_algo md) {
+    EVP_MD_CTX *t = tlsuv_atomic_load_ptr(&pub->verify_tmpl[md]);
+    if (t != NULL) {
+        return t;
+    }
+
+    t = EVP_MD_CTX_new();
+    if (!EVP_DigestVerifyInit(t, NULL, hash_md(md), NULL, pub->pkey)) {
+        unsigned long err = ERR_get_error();
+        UM_LOG(WARN, "failed to setup digest %ld/%s", err, ERR_lib_error_string(err));
+        EVP_MD_CTX_free(t);
+        return NULL;
+    }
+
+    // another thread may have set it up first
+    if (!tlsuv_atomic_init_ptr(&pub->verify_tmpl[md], t)) {
+        EVP_MD_CTX_free(t);
+        t = tlsuv_atomic_load_ptr(&pub->verify_tmpl[md]);
+    }
+    return t;
+}
+
+static int verify_item(struct pub_key_s *pub, enum hash_algo md, EVP_MD_CTX *ctx, const tlsuv_verify_item *it) {
+    EVP_MD_CTX *tmpl = NULL;
+    // raw (r|s) ECDSA signatures are verified separately
+    if (md >= hash_SHA256 && md <= hash_SHA512 &&
+        (EVP_PKEY_id(pub->pkey) != EVP_PKEY_EC || ecdsa_sig_is_der((const uint8_t *) it->sig, it->siglen))) {
+        tmpl = verify_template(pub, md);
+    }
+
+    if (tmpl == NULL || !EVP_MD_CTX_copy_ex(ctx, tmpl)) {
+        return verify_signature(pub->pkey, md, it->data, it->datalen, it->sig, it->siglen);
+    }
+
+    if (EVP_DigestVerify(ctx, (const uint8_t *) it->sig, it->siglen, (const uint8_t *) it->data, it->datalen) != 1) {
+        unsigned long err = ERR_get_error();
+        UM_LOG(WARN, "failed to verify digest %ld/%s", err, ERR_lib_error_string(err));
+        return -1;
+    }
+    return 0;
+}
+
+static int pubkey_verify_many(tlsuv_public_key_t pk, enum hash_algo md,
+                              const tlsuv_verify_item *items, size_t count, int *results) {
     struct pub_key_s *pub = (struct pub_key_s *) pk;
-    return verify_signature(pub->pkey, md, data, datalen, sig, siglen);
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int rc = 0;
+    for (size_t i = 0; i < count; i++) {
+        results[i] = verify_item(pub, md, ctx, &items[i]);
+        if (results[i] != 0) {
+            rc = -1;
+        }
+    }
+    EVP_MD_CTX_free(ctx);
+    return rc;
+}
+
+static int pubkey_verify(tlsuv_public_key_t pk, enum hash_algo md, const char *data, size_t datalen, const char *sig, size_t siglen) {
+    tlsuv_verify_item it = {
+            .data = data,
+            .datalen = datalen,
+            .sig = sig,
+            .siglen = siglen,
+    };
+    int result;
+    return pubkey_verify_many(pk, md, &it, 1, &result);
 }
 
 static void privkey_free(tlsuv_private_key_t k) {
     struct priv_key_s *priv = (struct priv_key_s *) k;
     EVP_PKEY_free(priv->pkey);
-    free(priv);
+    tlsuv__free(priv);
 }
 
 static int privkey_sign(tlsuv_private_key_t pk, enum hash_algo md, const char *data, size_t datalen, char *sig, size_t *siglen) {
@@ -224,7 +322,7 @@ static int privkey_sign(tlsuv_private_key_t pk, enum hash_algo md, const char *d
 
 static tlsuv_public_key_t privkey_pubkey(tlsuv_private_key_t pk) {
     struct priv_key_s *priv = (struct priv_key_s *) pk;
-    struct pub_key_s *pub = calloc(1, sizeof(*pub));
+    struct pub_key_s *pub = tlsuv__calloc(1, sizeof(*pub));
     *pub = PUB_KEY_API;
 
     // there is probably a more straight-forward way,
@@ -293,7 +391,7 @@ int load_key(tlsuv_private_key_t *key, const char* keydata, size_t keydatalen) {
     if (!PEM_read_bio_PrivateKey(kb, &pk, NULL, NULL)) {
         rc = -1;
     } else {
-        struct priv_key_s *privkey = calloc(1, sizeof(struct priv_key_s));
+        struct priv_key_s *privkey = tlsuv__calloc(1, sizeof(struct priv_key_s));
         priv_key_init(privkey);
         privkey->pkey = pk;
         *key = (tlsuv_private_key_t) privkey;
@@ -321,7 +419,7 @@ static int load_pkcs11_ec(EVP_PKEY *pkey, p11_key_ctx *p11_key, const char *id,
             goto error;
         }
 
-        free(value);
+        tlsuv__free(value);
         value = NULL;
     }
 
@@ -348,7 +446,7 @@ static int load_pkcs11_ec(EVP_PKEY *pkey, p11_key_ctx *p11_key, const char *id,
                 goto error;
             }
         }
-        free(value);
+        tlsuv__free(value);
         value = NULL;
     }
 
@@ -366,7 +464,7 @@ static int load_pkcs11_ec(EVP_PKEY *pkey, p11_key_ctx *p11_key, const char *id,
     error:
     if (os) ASN1_STRING_free(os);
     if (ec) EC_KEY_free(ec);
-    free(value);
+    tlsuv__free(value);
 
     return -1;
 }
@@ -384,14 +482,14 @@ static int load_pkcs11_rsa(EVP_PKEY *pkey, p11_key_ctx *p11_key, const char *id,
         goto error;
     }
     e = BN_bin2bn(value, (int)len, NULL);
-    free(value);
+    tlsuv__free(value);
     value = NULL;
 
     if (p11_get_key_attr(p11_key, CKA_MODULUS, (char**)&value, &len) != 0) {
         goto error;
     }
     n = BN_bin2bn(value, (int)len, NULL);
-    free(value);
+    tlsuv__free(value);
     value = NULL;
 
     RSA_set0_key(rsa, n, e, NULL);
@@ -403,23 +501,23 @@ static int load_pkcs11_rsa(EVP_PKEY *pkey, p11_key_ctx *p11_key, const char *id,
 error:
     BN_free(e);
     BN_free(n);
-    free(value);
+    tlsuv__free(value);
     return -1;
 }
 
 int gen_pkcs11_key(tlsuv_private_key_t *key, const char *pkcs11driver, const char *slot, const char *pin, const char *label) {
-    p11_context *p11 = calloc(1, sizeof(*p11));
+    p11_context *p11 = tlsuv__calloc(1, sizeof(*p11));
     p11_key_ctx *p11_key = NULL;
     EVP_PKEY *pkey = NULL;
 
     int rc = p11_init(p11, pkcs11driver, slot, pin);
     if (rc != 0) {
         UM_LOG(WARN, "failed to init pkcs#11 token driver[%s] slot[%s]: %d/%s", pkcs11driver, slot, rc, p11_strerror(rc));
-        free(p11);
+        tlsuv__free(p11);
         return rc;
     }
 
-    p11_key = calloc(1, sizeof(*p11_key));
+    p11_key = tlsuv__calloc(1, sizeof(*p11_key));
     if (p11_gen_key(p11, p11_key, label) != 0) {
         goto error;
     }
@@ -436,7 +534,7 @@ int gen_pkcs11_key(tlsuv_private_key_t *key, const char *pkcs11driver, const cha
             goto error;
     }
 
-    struct priv_key_s *private_key = calloc(1, sizeof(struct priv_key_s));
+    struct priv_key_s *private_key = tlsuv__calloc(1, sizeof(struct priv_key_s));
     *private_key = PRIV_KEY_API;
     private_key->pkey = pkey;
     *key = (tlsuv_private_key_t)private_key;
@@ -444,25 +542,25 @@ int gen_pkcs11_key(tlsuv_private_key_t *key, const char *pkcs11driver, const cha
     return 0;
 
     error:
-    free(p11_key);
-    free(p11);
+    tlsuv__free(p11_key);
+    tlsuv__free(p11);
     if(pkey) EVP_PKEY_free(pkey);
     return -1;
 }
 
 int load_pkcs11_key(tlsuv_private_key_t *key, const char *lib, const char *slot, const char *pin, const char *id, const char *label) {
-    p11_context *p11 = calloc(1, sizeof(*p11));
+    p11_context *p11 = tlsuv__calloc(1, sizeof(*p11));
     p11_key_ctx *p11_key = NULL;
     EVP_PKEY *pkey = NULL;
 
     int rc = p11_init(p11, lib, slot, pin);
     if (rc != 0) {
         UM_LOG(WARN, "failed to init pkcs#11 token driver[%s] slot[%s]: %d/%s", lib, slot, rc, p11_strerror(rc));
-        free(p11);
+        tlsuv__free(p11);
         return rc;
     }
 
-    p11_key = calloc(1, sizeof(*p11_key));
+    p11_key = tlsuv__calloc(1, sizeof(*p11_key));
     rc = p11_load_key(p11, p11_key, id, label);
     if (rc != 0) {
         UM_LOG(WARN, "failed to load pkcs#11 key id[%s] label[%s]: %d/%s", id, label, rc, p11_strerror(rc));
@@ -480,7 +578,7 @@ int load_pkcs11_key(tlsuv_private_key_t *key, const char *lib, const char *slot,
             goto error;
     }
 
-    struct priv_key_s *private_key = calloc(1, sizeof(struct priv_key_s));
+    struct priv_key_s *private_key = tlsuv__calloc(1, sizeof(struct priv_key_s));
     *private_key = PRIV_KEY_API;
     private_key->pkey = pkey;
     *key = (tlsuv_private_key_t)private_key;
@@ -488,8 +586,8 @@ int load_pkcs11_key(tlsuv_private_key_t *key, const char *lib, const char *slot,
     return 0;
 
 error:
-    free(p11_key);
-    free(p11);
+    tlsuv__free(p11_key);
+    tlsuv__free(p11);
     if(pkey) EVP_PKEY_free(pkey);
     return -1;
 }
@@ -511,7 +609,7 @@ int gen_key(tlsuv_private_key_t *key) {
     }
 
     if (rc == 0) {
-        struct priv_key_s *private_key = calloc(1, sizeof(struct priv_key_s));
+        struct priv_key_s *private_key = tlsuv__calloc(1, sizeof(struct priv_key_s));
         *private_key = PRIV_KEY_API;
         private_key->pkey = pk;
         *key = (tlsuv_private_key_t)private_key;
@@ -556,19 +654,29 @@ static int privkey_p11_rsa_enc(int msglen, const unsigned char *msg,
     return (int)siglen;
 }
 
-static int privkey_get_cert(tlsuv_private_key_t pk, tls_cert *cert) {
-    struct priv_key_s *key = (struct priv_key_s *) pk;
-
-    p11_key_ctx *p11_key = NULL;
+static p11_key_ctx *privkey_p11_ctx(struct priv_key_s *key) {
     switch (EVP_PKEY_id(key->pkey)) {
         case EVP_PKEY_EC:
-            p11_key = EC_KEY_get_ex_data(EVP_PKEY_get0_EC_KEY(key->pkey), p11_ec_idx);
-            break;
+            return EC_KEY_get_ex_data(EVP_PKEY_get0_EC_KEY(key->pkey), p11_ec_idx);
         case EVP_PKEY_RSA:
-            p11_key = RSA_get_ex_data(EVP_PKEY_get0_RSA(key->pkey), p11_rsa_idx);
-            break;
+            return RSA_get_ex_data(EVP_PKEY_get0_RSA(key->pkey), p11_rsa_idx);
     }
+    return NULL;
+}
 
+static int privkey_refresh(tlsuv_private_key_t pk) {
+    p11_key_ctx *p11_key = privkey_p11_ctx((struct priv_key_s *) pk);
+    if (p11_key == NULL) {
+        // nothing to refresh for in-memory keys
+        return 0;
+    }
+    return p11_key_refresh(p11_key);
+}
+
+static int privkey_get_cert(tlsuv_private_key_t pk, tls_cert *cert) {
+    struct priv_key_s *key = (struct priv_key_s *) pk;
+
+    p11_key_ctx *p11_key = privkey_p11_ctx(key);
     if (p11_key == NULL) {
         return -1;
     }
@@ -584,7 +692,7 @@ static int privkey_get_cert(tlsuv_private_key_t pk, tls_cert *cert) {
         X509_STORE_add_cert(store, c);
         X509_free(c);
         *cert = store;
-        free(der);
+        tlsuv__free(der);
         return 0;
     }
 
@@ -594,16 +702,7 @@ static int privkey_get_cert(tlsuv_private_key_t pk, tls_cert *cert) {
 static int privkey_store_cert(tlsuv_private_key_t pk, tls_cert cert) {
     struct priv_key_s *key = (struct priv_key_s *) pk;
 
-    p11_key_ctx *p11_key = NULL;
-    switch (EVP_PKEY_id(key->pkey)) {
-        case EVP_PKEY_EC:
-            p11_key = EC_KEY_get_ex_data(EVP_PKEY_get0_EC_KEY(key->pkey), p11_ec_idx);
-            break;
-        case EVP_PKEY_RSA:
-            p11_key = RSA_get_ex_data(EVP_PKEY_get0_RSA(key->pkey), p11_rsa_idx);
-            break;
-    }
-
+    p11_key_ctx *p11_key = privkey_p11_ctx(key);
     if (p11_key == NULL) {
         return -1;
     }
@@ -21,6 +21,8 @@
 struct pub_key_s {
     TLSUV_PUBKEY_API
     EVP_PKEY *pkey;
+    // verify contexts initialized with the key, one per hash_algo, copied for every verification
+    EVP_MD_CTX *verify_tmpl[hash_SHA512 + 1];
 };
 
 struct priv_key_s {
@@ -0,0 +1,159 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ktls.h"
+#include "../um_debug.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+// TLS 1.3 cipher suite IDs as reported by SSL_CIPHER_get_protocol_id()
+#define TLS13_AES_128_GCM_SHA256       0x1301
+#define TLS13_AES_256_GCM_SHA384       0x1302
+#define TLS13_CHACHA20_POLY1305_SHA256 0x1303
+
+// HKDF-Expand-Label(secret, label, "", out_len) from RFC 8446, section 7.1
+static int hkdf_expand_label(const EVP_MD *md, const uint8_t *secret, size_t secret_len,
+                             const char *label, uint8_t *out, size_t out_len) {
+    uint8_t info[2 + 1 + 6 + 32 + 1];
+    size_t label_len = strlen(label);
+    size_t n = 0;
+
+    info[n++] = (uint8_t) (out_len >> 8);
+    info[n++] = (uint8_t) out_len;
+    info[n++] = (uint8_t) (6 + label_len);
+    memcpy(info + n, "tls13 ", 6);
+    n += 6;
+    memcpy(info + n, label, label_len);
+    n += label_len;
+    info[n++] = 0; // empty context
+
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    int ok = pctx != NULL &&
+             EVP_PKEY_derive_init(pctx) > 0 &&
+             EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+             EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0 &&
+             EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, (int) secret_len) > 0 &&
+             EVP_PKEY_CTX_add1_hkdf_info(pctx, info, (int) n) > 0 &&
+             EVP_PKEY_derive(pctx, out, &out_len) > 0;
+    EVP_PKEY_CTX_free(pctx);
+    return ok ? 0 : -1;
+}
+
+int ktls_install_tx(uv_os_fd_t fd, const SSL_CIPHER *cipher, const uint8_t *secret, size_t secret_len) {
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes128;
+        struct tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+    } ci;
+    size_t ci_len;
+    size_t key_len;
+    uint8_t key[32];
+    uint8_t iv[12];
+
+    memset(&ci, 0, sizeof(ci));
+    ci.info.version = TLS_1_3_VERSION;
+    switch (SSL_CIPHER_get_protocol_id(cipher)) {
+        case TLS13_AES_128_GCM_SHA256:
+            ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+            ci_len = sizeof(ci.aes128);
+            key_len = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+            break;
+        case TLS13_AES_256_GCM_SHA384:
+            ci.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+            ci_len = sizeof(ci.aes256);
+            key_len = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+            break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        case TLS13_CHACHA20_POLY1305_SHA256:
+            ci.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+            ci_len = sizeof(ci.chacha);
+            key_len = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+            break;
+#endif
+        default:
+            UM_LOG(VERB, "kTLS: cipher[%s] is not supported", SSL_CIPHER_get_name(cipher));
+            return UV_ENOTSUP;
+    }
+
+    const EVP_MD *md = SSL_CIPHER_get_handshake_digest(cipher);
+    if (md == NULL ||
+        hkdf_expand_label(md, secret, secret_len, "key", key, key_len) != 0 ||
+        hkdf_expand_label(md, secret, secret_len, "iv", iv, sizeof(iv)) != 0) {
+        UM_LOG(WARN, "kTLS: failed to derive traffic keys");
+        return UV_ENOTSUP;
+    }
+
+    // GCM ciphers split 12 byte IV into implicit salt and explicit part, record sequence stays zero
+    switch (ci.info.cipher_type) {
+        case TLS_CIPHER_AES_GCM_128:
+            memcpy(ci.aes128.key, key, key_len);
+            memcpy(ci.aes128.salt, iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+            memcpy(ci.aes128.iv, iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+            break;
+        case TLS_CIPHER_AES_GCM_256:
+            memcpy(ci.aes256.key, key, key_len);
+            memcpy(ci.aes256.salt, iv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+            memcpy(ci.aes256.iv, iv + TLS_CIPHER_AES_GCM_256_SALT_SIZE, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+            break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        case TLS_CIPHER_CHACHA20_POLY1305:
+            memcpy(ci.chacha.key, key, key_len);
+            memcpy(ci.chacha.iv, iv, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+            break;
+#endif
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(iv, sizeof(iv));
+
+    int rc = 0;
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+        UM_LOG(VERB, "kTLS: not available: %d(%s)", errno, strerror(errno));
+        rc = UV_ENOTSUP;
+    } else if (setsockopt(fd, SOL_TLS, TLS_TX, &ci, (socklen_t) ci_len) != 0) {
+        // socket stays usable with TLS ULP but no keys installed
+        UM_LOG(VERB, "kTLS: failed to install TX keys: %d(%s)", errno, strerror(errno));
+        rc = UV_ENOTSUP;
+    }
+    OPENSSL_cleanse(&ci, sizeof(ci));
+    return rc;
+}
+
+#else
+
+int ktls_install_tx(uv_os_fd_t fd, const SSL_CIPHER *cipher, const uint8_t *secret, size_t secret_len) {
+    return UV_ENOTSUP;
+}
+
+#endif
@@ -0,0 +1,36 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_KTLS_H
+#define TLSUV_KTLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <uv.h>
+#include <openssl/ssl.h>
+
+/**
+ * Installs TLS 1.3 application traffic keys for outbound records into the socket (Linux kTLS).
+ * Key and IV are derived from the traffic secret, record sequence starts at zero.
+ *
+ * @param fd connected TCP socket
+ * @param cipher negotiated cipher suite
+ * @param secret client application traffic secret
+ * @param secret_len secret length
+ * @returns 0 on success, UV_ENOTSUP if cipher, platform, or kernel does not support it
+ */
+int ktls_install_tx(uv_os_fd_t fd, const SSL_CIPHER *cipher, const uint8_t *secret, size_t secret_len);
+
+#endif//TLSUV_KTLS_H
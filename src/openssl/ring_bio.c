@@ -0,0 +1,235 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <uv.h>
+#include <openssl/bio.h>
+
+#include "ring_bio.h"
+#include "../um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "../alloc.h"
+
+struct ring {
+    char *buf;
+    size_t cap;
+    size_t head;
+    size_t len;
+
+    // borrowed caller data, consumed after ring content
+    const char *lent;
+    size_t lent_len;
+};
+
+static BIO_METHOD *ring_method;
+static uv_once_t ring_method_once = UV_ONCE_INIT;
+
+static void ring_copy_out(struct ring *r, char *out, size_t n) {
+    size_t first = r->cap - r->head;
+    if (first > n) first = n;
+    memcpy(out, r->buf + r->head, first);
+    memcpy(out + first, r->buf, n - first);
+    r->head = (r->head + n) % r->cap;
+    r->len -= n;
+    if (r->len == 0) {
+        r->head = 0;
+    }
+}
+
+// storage is dropped by ring_bio_release() while BIO stays empty
+static int ring_ensure(struct ring *r) {
+    if (r->buf == NULL) {
+        r->buf = tlsuv__malloc(r->cap);
+        r->head = 0;
+    }
+    return r->buf != NULL ? 0 : -1;
+}
+
+static int ring_grow(struct ring *r, size_t need) {
+    size_t cap = r->cap;
+    while (cap < need) {
+        cap *= 2;
+    }
+    char *buf = tlsuv__malloc(cap);
+    if (buf == NULL) {
+        return -1;
+    }
+    size_t len = r->len;
+    ring_copy_out(r, buf, len);
+    tlsuv__free(r->buf);
+    r->buf = buf;
+    r->cap = cap;
+    r->head = 0;
+    r->len = len;
+    UM_LOG(VERB, "ring BIO grown to %zd bytes", cap);
+    return 0;
+}
+
+static void ring_copy_in(struct ring *r, const char *in, size_t n) {
+    size_t tail = (r->head + r->len) % r->cap;
+    size_t first = r->cap - tail;
+    if (first > n) first = n;
+    memcpy(r->buf + tail, in, first);
+    memcpy(r->buf, in + first, n - first);
+    r->len += n;
+}
+
+static int ring_write(BIO *b, const char *data, int dlen) {
+    struct ring *r = BIO_get_data(b);
+    BIO_clear_retry_flags(b);
+    if (dlen <= 0) {
+        return 0;
+    }
+
+    size_t n = (size_t) dlen;
+    if (ring_ensure(r) != 0) {
+        return -1;
+    }
+    if (r->len + n > r->cap && ring_grow(r, r->len + n) != 0) {
+        return -1;
+    }
+    ring_copy_in(r, data, n);
+    return dlen;
+}
+
+static int ring_read(BIO *b, char *out, int outlen) {
+    struct ring *r = BIO_get_data(b);
+    BIO_clear_retry_flags(b);
+    if (outlen <= 0) {
+        return 0;
+    }
+
+    size_t want = (size_t) outlen;
+    size_t got = r->len < want ? r->len : want;
+    if (got > 0) {
+        ring_copy_out(r, out, got);
+    }
+
+    if (got < want && r->lent_len > 0) {
+        size_t n = r->lent_len < want - got ? r->lent_len : want - got;
+        memcpy(out + got, r->lent, n);
+        r->lent += n;
+        r->lent_len -= n;
+        got += n;
+    }
+
+    if (got == 0) {
+        BIO_set_retry_read(b);
+        return -1;
+    }
+    return (int) got;
+}
+
+static long ring_ctrl(BIO *b, int cmd, long num, void *ptr) {
+    struct ring *r = BIO_get_data(b);
+    switch (cmd) {
+        case BIO_CTRL_PENDING:
+            return (long) (r->len + r->lent_len);
+        case BIO_CTRL_WPENDING:
+            return 0;
+        case BIO_CTRL_RESET:
+            r->head = 0;
+            r->len = 0;
+            r->lent = NULL;
+            r->lent_len = 0;
+            return 1;
+        case BIO_CTRL_EOF:
+            return r->len + r->lent_len == 0;
+        case BIO_CTRL_FLUSH:
+        case BIO_CTRL_DUP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int ring_create(BIO *b) {
+    BIO_set_init(b, 1);
+    return 1;
+}
+
+static int ring_destroy(BIO *b) {
+    struct ring *r = BIO_get_data(b);
+    if (r) {
+        tlsuv__free(r->buf);
+        tlsuv__free(r);
+        BIO_set_data(b, NULL);
+    }
+    return 1;
+}
+
+static void ring_method_init(void) {
+    ring_method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "tlsuv ring buffer");
+    BIO_meth_set_write(ring_method, ring_write);
+    BIO_meth_set_read(ring_method, ring_read);
+    BIO_meth_set_ctrl(ring_method, ring_ctrl);
+    BIO_meth_set_create(ring_method, ring_create);
+    BIO_meth_set_destroy(ring_method, ring_destroy);
+}
+
+BIO *ring_bio_new(size_t capacity) {
+    uv_once(&ring_method_once, ring_method_init);
+
+    BIO *b = BIO_new(ring_method);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    struct ring *r = tlsuv__calloc(1, sizeof(struct ring));
+    r->cap = capacity > 0 ? capacity : 1;
+    r->buf = tlsuv__malloc(r->cap);
+    BIO_set_data(b, r);
+    return b;
+}
+
+void ring_bio_lend(BIO *b, const char *data, size_t len) {
+    struct ring *r = BIO_get_data(b);
+    if (r->lent_len > 0) {
+        ring_bio_unlend(b);
+    }
+    r->lent = data;
+    r->lent_len = len;
+}
+
+void ring_bio_unlend(BIO *b) {
+    struct ring *r = BIO_get_data(b);
+    if (r->lent_len > 0) {
+        if (ring_ensure(r) != 0) {
+            UM_LOG(ERR, "failed to retain %zd bytes of input", r->lent_len);
+        } else if (r->len + r->lent_len <= r->cap || ring_grow(r, r->len + r->lent_len) == 0) {
+            ring_copy_in(r, r->lent, r->lent_len);
+        } else {
+            UM_LOG(ERR, "failed to retain %zd bytes of input", r->lent_len);
+        }
+    }
+    r->lent = NULL;
+    r->lent_len = 0;
+}
+
+void ring_bio_release(BIO *b) {
+    struct ring *r = BIO_get_data(b);
+    if (r->buf != NULL && r->len == 0 && r->lent_len == 0) {
+        tlsuv__free(r->buf);
+        r->buf = NULL;
+        r->head = 0;
+    }
+}
+
+size_t ring_bio_mem(BIO *b) {
+    struct ring *r = BIO_get_data(b);
+    return r->buf ? r->cap : 0;
+}
@@ -0,0 +1,44 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_RING_BIO_H
+#define TLSUV_RING_BIO_H
+
+#include <openssl/bio.h>
+
+/**
+ * Creates memory BIO backed by a ring buffer of given capacity.
+ * Ring only grows if a single write does not fit (e.g. full size record when capacity is set too small).
+ */
+BIO *ring_bio_new(size_t capacity);
+
+/**
+ * Lends caller buffer to the BIO: reads are served from it (after any buffered data) without copying.
+ * Caller must call ring_bio_unlend() before the buffer goes away, unconsumed bytes are copied into the ring.
+ */
+void ring_bio_lend(BIO *b, const char *data, size_t len);
+
+void ring_bio_unlend(BIO *b);
+
+/**
+ * Frees ring storage if BIO is empty, it is allocated again on the next write.
+ */
+void ring_bio_release(BIO *b);
+
+/**
+ * @return bytes of ring storage currently allocated
+ */
+size_t ring_bio_mem(BIO *b);
+
+#endif//TLSUV_RING_BIO_H
@@ -28,6 +28,9 @@
 #include "p11.h"
 #include "um_debug.h"
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
+
 
 #define P11(op) do {\
 int rc; rc = (op); \
@@ -56,9 +59,93 @@ if (rc != CKR_OK) { \
     } while (0)
 
 static int p11_get_obj_attr(p11_context *p11, CK_OBJECT_HANDLE h, CK_ATTRIBUTE_TYPE type, uint8_t **val, CK_ULONG *len);
+static int p11_fetch_key_cert(p11_key_ctx *key, char **val, size_t *len);
+static void p11_key_cache_load(p11_key_ctx *key);
+static void p11_key_cache_clear(p11_key_ctx *key);
+
+// no point in having more signing sessions than threads that could use them
+static size_t p11_default_sign_sessions(void) {
+    const char *tp_size = getenv("UV_THREADPOOL_SIZE");
+    long n = tp_size ? strtol(tp_size, NULL, 10) : 0;
+    return n > 0 ? (size_t) n : 4;
+}
+
+static void p11_sign_pool_init(p11_context *p11) {
+    p11->sign_max = p11_default_sign_sessions();
+
+    CK_TOKEN_INFO info;
+    if (p11->funcs->C_GetTokenInfo(p11->slot_id, &info) == CKR_OK &&
+        info.ulMaxSessionCount != CK_EFFECTIVELY_INFINITE &&
+        info.ulMaxSessionCount != CK_UNAVAILABLE_INFORMATION) {
+        // leave room for the main session
+        size_t token_max = info.ulMaxSessionCount > 1 ? (size_t) info.ulMaxSessionCount - 1 : 0;
+        if (token_max < p11->sign_max) {
+            p11->sign_max = token_max;
+        }
+    }
+    p11->sign_idle = tlsuv__calloc(p11->sign_max > 0 ? p11->sign_max : 1, sizeof(CK_SESSION_HANDLE));
+    UM_LOG(DEBG, "pkcs#11 slot[%lx] using up to %zd signing sessions", p11->slot_id, p11->sign_max);
+}
+
+// returns session to sign with, main session if pool is not available
+static CK_SESSION_HANDLE p11_sign_session_get(p11_context *p11) {
+    uv_mutex_lock(&p11->lock);
+    for (;;) {
+        if (p11->sign_idle_count > 0) {
+            CK_SESSION_HANDLE s = p11->sign_idle[--p11->sign_idle_count];
+            uv_mutex_unlock(&p11->lock);
+            return s;
+        }
+
+        if (p11->sign_open < p11->sign_max) {
+            CK_SESSION_HANDLE s;
+            // token login applies to all sessions of the application
+            CK_RV rc = p11->funcs->C_OpenSession(p11->slot_id, CKF_SERIAL_SESSION, NULL, NULL, &s);
+            if (rc == CKR_OK) {
+                p11->sign_open++;
+                uv_mutex_unlock(&p11->lock);
+                return s;
+            }
+            UM_LOG(WARN, "failed to open pkcs#11 signing session: %s", p11_strerror(rc));
+            // token is out of sessions, settle with what is open already
+            p11->sign_max = p11->sign_open;
+        }
+
+        if (p11->sign_open == 0) {
+            // keep lock, main session is used
+            return p11->session;
+        }
+
+        uv_cond_wait(&p11->sign_cond, &p11->lock);
+    }
+}
+
+static void p11_sign_session_put(p11_context *p11, CK_SESSION_HANDLE s) {
+    if (s == p11->session) {
+        uv_mutex_unlock(&p11->lock);
+        return;
+    }
+
+    uv_mutex_lock(&p11->lock);
+    p11->sign_idle[p11->sign_idle_count++] = s;
+    uv_cond_signal(&p11->sign_cond);
+    uv_mutex_unlock(&p11->lock);
+}
+
+static void p11_sign_pool_free(p11_context *p11) {
+    for (size_t i = 0; i < p11->sign_idle_count; i++) {
+        p11->funcs->C_CloseSession(p11->sign_idle[i]);
+    }
+    tlsuv__free(p11->sign_idle);
+    p11->sign_idle = NULL;
+    p11->sign_idle_count = 0;
+    p11->sign_open = 0;
+}
 
 int p11_init(p11_context *p11, const char *lib, const char *slot, const char *pin) {
     memset(p11, 0, sizeof(p11_context));
+    uv_mutex_init(&p11->lock);
+    uv_cond_init(&p11->sign_cond);
 
     CK_C_GetFunctionList f;
 
@@ -84,11 +171,11 @@ int p11_init(p11_context *p11, const char *lib, const char *slot, const char *pi
         CK_SLOT_ID_PTR slots;
         CK_ULONG slot_count;
         P11(p11->funcs->C_GetSlotList(CK_TRUE, NULL, &slot_count));
-        slots = calloc(slot_count, sizeof(CK_SLOT_ID));
+        slots = tlsuv__calloc(slot_count, sizeof(CK_SLOT_ID));
         P11(p11->funcs->C_GetSlotList(CK_TRUE, slots, &slot_count));
         slot_id = slots[0];
         /* WARNING: "slot id not specified. using the first slot[%lx] reported by driver", slot_id); */
-        free(slots);
+        tlsuv__free(slots);
     }
     else {
         slot_id = strtoul(slot, NULL, 16);
@@ -102,6 +189,7 @@ int p11_init(p11_context *p11, const char *lib, const char *slot, const char *pi
         return (int)err;
     }
 
+    p11_sign_pool_init(p11);
     return 0;
 }
 
@@ -232,6 +320,7 @@ int p11_gen_key(p11_context *p11, p11_key_ctx *p11_key, const char *label) {
     p11_key->priv_handle = privh;
     p11_key->pub_handle = pubh;
     p11_key->key_type = keytype;
+    p11_key_cache_load(p11_key);
 
     return 0;
 }
@@ -269,17 +358,45 @@ int p11_store_key_cert(p11_key_ctx *key, char *cert, size_t certlen, char *subj,
     CK_OBJECT_HANDLE h;
     CK_RV rc = p11->funcs->C_CreateObject(p11->session, certtemp, certidx, &h);
 
-    free(label);
-    free(id);
+    tlsuv__free(label);
+    tlsuv__free(id);
 
     if (rc != CKR_OK) {
         UM_LOG(WARN, "failed to store cert to pkcs#11 token: %d/%s", rc, p11_strerror(rc));
         return -1;
     }
+
+    tlsuv__free(key->cert);
+    key->cert = tlsuv__malloc(certlen);
+    memcpy(key->cert, cert, certlen);
+    key->cert_len = certlen;
+    key->cert_loaded = 1;
     return 0;
 }
 
 int p11_get_key_cert(p11_key_ctx *key, char **val, size_t *len) {
+    if (!key->cert_loaded) {
+        int rc = p11_fetch_key_cert(key, &key->cert, &key->cert_len);
+        if (rc != 0) {
+            return rc;
+        }
+        key->cert_loaded = 1;
+    }
+
+    if (key->cert == NULL) {
+        UM_LOG(WARN, "certificate not found");
+        *val = NULL;
+        *len = 0;
+        return -1;
+    }
+
+    *val = tlsuv__malloc(key->cert_len);
+    memcpy(*val, key->cert, key->cert_len);
+    *len = key->cert_len;
+    return 0;
+}
+
+static int p11_fetch_key_cert(p11_key_ctx *key, char **val, size_t *len) {
     p11_context *p11 = key->ctx;
     CK_ULONG cls = CKO_CERTIFICATE;
 
@@ -304,12 +421,13 @@ int p11_get_key_cert(p11_key_ctx *key, char **val, size_t *len) {
     P11(p11->funcs->C_FindObjects(p11->session, &cert_handle, 1, &objc));
     P11(p11->funcs->C_FindObjectsFinal(p11->session));
 
-    free(id);
+    tlsuv__free(id);
     if (objc == 0) {
-        UM_LOG(WARN, "certificate not found");
+        // not an error, key may not have certificate yet
+        UM_LOG(VERB, "certificate not found");
         *val = NULL;
         *len = 0;
-        return -1;
+        return 0;
     }
 
     CK_ULONG ck_len;
@@ -322,6 +440,16 @@ int p11_get_key_cert(p11_key_ctx *key, char **val, size_t *len) {
 
 
 int p11_get_key_attr(p11_key_ctx *key, CK_ATTRIBUTE_TYPE type, char **val, size_t *len) {
+    for (int i = 0; i < key->pub_attrs_count; i++) {
+        if (key->pub_attrs[i].type == type) {
+            // callers own returned value, keep it NUL terminated like token fetch does
+            *val = tlsuv__calloc(1, key->pub_attrs[i].len + 1);
+            memcpy(*val, key->pub_attrs[i].val, key->pub_attrs[i].len);
+            *len = key->pub_attrs[i].len;
+            return 0;
+        }
+    }
+
     CK_ULONG ck_len;
     int rc = p11_get_obj_attr(key->ctx, key->pub_handle, type, (uint8_t **)val, &ck_len);
     if (rc == 0) {
@@ -345,12 +473,12 @@ static int p11_get_obj_attr(p11_context *p11, CK_OBJECT_HANDLE h, CK_ATTRIBUTE_T
     }
 
     *len = attr[0].ulValueLen;
-    *val = calloc(1, *len + 1);
+    *val = tlsuv__calloc(1, *len + 1);
 
     attr[0].pValue = *val;
     rc = p11->funcs->C_GetAttributeValue(p11->session, h, attr, 1);
     if (rc != CKR_OK) {
-        free(*val);
+        tlsuv__free(*val);
         *val = NULL;
         *len = 0;
         return (int)rc;
@@ -413,6 +541,65 @@ int p11_load_key(p11_context *p11, p11_key_ctx *p11_key, const char *idstr, cons
 
     P11(p11->funcs->C_GetAttributeValue(p11->session, p11_key->priv_handle, &attr, 1));
     p11_key->ctx = p11;
+    p11_key_cache_load(p11_key);
+    return 0;
+}
+
+static void p11_key_cache_load(p11_key_ctx *key) {
+    CK_ATTRIBUTE_TYPE types[2];
+    int count = 0;
+    switch (key->key_type) {
+        case CKK_EC:
+            key->sign_mechanism = CKM_ECDSA;
+            types[count++] = CKA_EC_PARAMS;
+            types[count++] = CKA_EC_POINT;
+            break;
+        case CKK_RSA:
+            // padding mechanism is selected by caller for each operation
+            key->sign_mechanism = 0;
+            types[count++] = CKA_PUBLIC_EXPONENT;
+            types[count++] = CKA_MODULUS;
+            break;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct p11_attr_s *a = &key->pub_attrs[key->pub_attrs_count];
+        CK_ULONG len;
+        if (p11_get_obj_attr(key->ctx, key->pub_handle, types[i], (uint8_t **) &a->val, &len) == 0) {
+            a->type = types[i];
+            a->len = len;
+            key->pub_attrs_count++;
+        }
+    }
+
+    char *cert = NULL;
+    size_t cert_len = 0;
+    if (p11_fetch_key_cert(key, &cert, &cert_len) == 0) {
+        key->cert = cert;
+        key->cert_len = cert_len;
+        key->cert_loaded = 1;
+    }
+}
+
+static void p11_key_cache_clear(p11_key_ctx *key) {
+    for (int i = 0; i < key->pub_attrs_count; i++) {
+        tlsuv__free(key->pub_attrs[i].val);
+    }
+    memset(key->pub_attrs, 0, sizeof(key->pub_attrs));
+    key->pub_attrs_count = 0;
+
+    tlsuv__free(key->cert);
+    key->cert = NULL;
+    key->cert_len = 0;
+    key->cert_loaded = 0;
+}
+
+int p11_key_refresh(p11_key_ctx *key) {
+    if (key->ctx == NULL) {
+        return -1;
+    }
+    p11_key_cache_clear(key);
+    p11_key_cache_load(key);
     return 0;
 }
 
@@ -421,17 +608,21 @@ int p11_key_sign(p11_key_ctx *key, const uint8_t *digest, int digest_len, uint8_
 
     CK_MECHANISM mech = {0};
     switch (key->key_type) {
-        case CKK_EC: mech.mechanism = CKM_ECDSA; break;
+        case CKK_EC: mech.mechanism = key->sign_mechanism; break;
         case CKK_RSA: mech.mechanism = padding; break;
     }
 
-    CK_RV rc = p11->funcs->C_SignInit(p11->session, &mech, key->priv_handle);
+    // sign operation is stateful on the session, concurrent signers get their own
+    CK_SESSION_HANDLE session = p11_sign_session_get(p11);
+    CK_RV rc = p11->funcs->C_SignInit(session, &mech, key->priv_handle);
     if (rc != CKR_OK) {
+        p11_sign_session_put(p11, session);
         UM_LOG(WARN, "failed to init sign op: %s", p11_strerror(rc));
         return -1;
     }
     CK_ULONG ck_siglen = (CK_ULONG)*siglen;
-    rc = p11->funcs->C_Sign(p11->session, (CK_BYTE_PTR)digest, digest_len, (CK_BYTE_PTR) sig, &ck_siglen);
+    rc = p11->funcs->C_Sign(session, (CK_BYTE_PTR)digest, digest_len, (CK_BYTE_PTR) sig, &ck_siglen);
+    p11_sign_session_put(p11, session);
     if (rc != CKR_OK) {
         UM_LOG(WARN, "failed to perform sign op: %s", p11_strerror(rc));
         return -1;
@@ -442,8 +633,14 @@ int p11_key_sign(p11_key_ctx *key, const uint8_t *digest, int digest_len, uint8_
 
 void p11_key_free(p11_key_ctx *key) {
     if (key) {
-        free(key->ctx);
-        free(key);
+        p11_key_cache_clear(key);
+        if (key->ctx) {
+            p11_sign_pool_free(key->ctx);
+            uv_cond_destroy(&key->ctx->sign_cond);
+            uv_mutex_destroy(&key->ctx->lock);
+        }
+        tlsuv__free(key->ctx);
+        tlsuv__free(key);
     }
 }
 
@@ -39,6 +39,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <uv.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,6 +50,22 @@ struct p11_context_s {
     CK_FUNCTION_LIST *funcs;
     CK_SESSION_HANDLE session;
     CK_SLOT_ID slot_id;
+
+    // serializes operations on the session, signing may happen on worker threads
+    uv_mutex_t lock;
+
+    // sessions for concurrent signing, opened on demand up to sign_max
+    uv_cond_t sign_cond;
+    CK_SESSION_HANDLE *sign_idle;
+    size_t sign_idle_count;
+    size_t sign_open;
+    size_t sign_max;
+};
+
+struct p11_attr_s {
+    CK_ATTRIBUTE_TYPE type;
+    char *val;
+    size_t len;
 };
 
 struct p11_key_ctx_s {
@@ -59,6 +76,13 @@ struct p11_key_ctx_s {
 
     struct p11_context_s *ctx;
     void *pub; // mbedtls_rsa_context or mbedtls_ecdsa_context
+
+    // fetched from token when key is loaded, see p11_key_refresh()
+    struct p11_attr_s pub_attrs[2];
+    int pub_attrs_count;
+    char *cert; // DER, NULL if token has no certificate for the key
+    size_t cert_len;
+    int cert_loaded;
 };
 
 typedef struct p11_context_s p11_context;
@@ -71,6 +95,11 @@ int p11_get_key_attr(p11_key_ctx *key, CK_ATTRIBUTE_TYPE type, char **val, size_
 int p11_get_key_cert(p11_key_ctx *key, char **val, size_t *len);
 int p11_store_key_cert(p11_key_ctx *key, char *cert, size_t certlen, char *subj, size_t subjlen);
 
+/**
+ * Drops cached public key attributes and certificate, and fetches them from the token again.
+ */
+int p11_key_refresh(p11_key_ctx *key);
+
 int p11_key_sign(p11_key_ctx *key, const uint8_t *digest, int digest_len, uint8_t *sig, size_t *siglen, CK_MECHANISM_TYPE padding);
 void p11_key_free(p11_key_ctx *key);
 const char *p11_strerror(CK_RV rv);
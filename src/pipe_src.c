@@ -0,0 +1,185 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlsuv/pipe_src.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
+static int pipe_src_connect(tlsuv_src_t *sl, const char *host, const char *service, tlsuv_src_connect_cb cb, void *ctx);
+static void pipe_src_release(tlsuv_src_t *sl);
+static void pipe_src_cancel(tlsuv_src_t *sl);
+
+static void free_handle(uv_handle_t *h) {
+    tlsuv__free(h);
+}
+
+// pipe handle owned by the source, released by its own close callback
+struct pipe_conn_s {
+    uv_pipe_t pipe;
+    uv_link_close_cb close_cb;
+    uv_link_t *close_source;
+};
+
+int pipe_src_init(uv_loop_t *l, pipe_src_t *ps, const char *path) {
+    ps->loop = l;
+    ps->link = tlsuv__calloc(1, sizeof(uv_link_source_t));
+    ps->connect = pipe_src_connect;
+    ps->connect_cb = NULL;
+    ps->release = pipe_src_release;
+    ps->cancel = pipe_src_cancel;
+    ps->timing = NULL;
+    ps->path = path ? tlsuv__strdup(path) : NULL;
+    ps->conn_req = NULL;
+    ps->pipe = NULL;
+    return 0;
+}
+
+void pipe_src_free(pipe_src_t *ps) {
+    if (ps) {
+        tlsuv__free(ps->link);
+        ps->link = NULL;
+        tlsuv__free(ps->path);
+        ps->path = NULL;
+    }
+}
+
+static void pipe_conn_close_cb(uv_handle_t *h) {
+    struct pipe_conn_s *c = (struct pipe_conn_s *) h;
+    if (c->close_cb) {
+        c->close_cb(c->close_source);
+    }
+    tlsuv__free(c);
+}
+
+// detaches pipe from the source and closes it, cb (if any) is called once handle is closed
+static void close_pipe(pipe_src_t *ps, uv_link_close_cb cb, uv_link_t *source) {
+    struct pipe_conn_s *c = (struct pipe_conn_s *) ps->pipe;
+    ps->pipe = NULL;
+    ((uv_link_source_t *) ps->link)->stream = NULL;
+
+    c->close_cb = cb;
+    c->close_source = source;
+    uv_close((uv_handle_t *) &c->pipe, pipe_conn_close_cb);
+}
+
+// same as tcp link: closing the link closes the pipe it is currently attached to,
+// so that reconnecting while previous pipe is closing does not lose it
+static void pipe_link_close(uv_link_t *link, uv_link_t *source, uv_link_close_cb cb) {
+    pipe_src_t *ps = link->data;
+    if (ps && ps->pipe) {
+        close_pipe(ps, cb, source);
+    } else {
+        cb(source);
+    }
+}
+
+static uv_link_methods_t pipe_link_methods;
+static uv_once_t pipe_link_once = UV_ONCE_INIT;
+
+static void init_pipe_link_methods(void) {
+    uv_link_source_t s;
+    uv_pipe_t dummy;
+    uv_link_source_init(&s, (uv_stream_t *) &dummy);
+    pipe_link_methods = *s.methods;
+    pipe_link_methods.close = pipe_link_close;
+}
+
+static void pipe_connect_cb(uv_connect_t *req, int status) {
+    pipe_src_t *ps = req->data;
+
+    if (ps == NULL) {
+        UM_LOG(TRACE, "connect request was cancelled");
+        if (!uv_is_closing((const uv_handle_t *) req->handle))
+            uv_close((uv_handle_t *) req->handle, free_handle);
+        tlsuv__free(req);
+        return;
+    }
+
+    ps->conn_req = NULL;
+    if (status == 0) {
+        if (ps->timing) ps->timing->connect_end = uv_hrtime();
+        ps->pipe = (uv_pipe_t *) req->handle;
+        uv_once(&pipe_link_once, init_pipe_link_methods);
+        uv_link_source_init((uv_link_source_t *) ps->link, (uv_stream_t *) ps->pipe);
+        ps->link->methods = &pipe_link_methods;
+        ps->link->data = ps;
+    } else {
+        UM_LOG(ERR, "failed to connect: %d(%s)", status, uv_strerror(status));
+        ps->pipe = NULL;
+        uv_close((uv_handle_t *) req->handle, free_handle);
+    }
+
+    tlsuv__free(req);
+    ps->connect_cb((tlsuv_src_t *) ps, status, ps->connect_ctx);
+}
+
+static int pipe_src_connect(tlsuv_src_t *sl, const char *host, const char *service, tlsuv_src_connect_cb cb, void *ctx) {
+    pipe_src_t *ps = (pipe_src_t *) sl;
+    const char *path = ps->path ? ps->path : host;
+    if (path == NULL) {
+        return UV_EINVAL;
+    }
+
+    sl->connect_cb = cb;
+    sl->connect_ctx = ctx;
+
+    if (ps->pipe) {
+        close_pipe(ps, NULL, NULL);
+    }
+
+    // no name resolution
+    if (sl->timing) sl->timing->resolve_start = sl->timing->resolve_end = uv_hrtime();
+
+    struct pipe_conn_s *c = tlsuv__calloc(1, sizeof(*c));
+    uv_pipe_t *p = &c->pipe;
+    int rc = uv_pipe_init(sl->loop, p, 0);
+    if (rc != 0) {
+        tlsuv__free(c);
+        return rc;
+    }
+
+    UM_LOG(DEBG, "connecting to '%s'", path);
+    ps->conn_req = tlsuv__calloc(1, sizeof(uv_connect_t));
+    ps->conn_req->data = ps;
+    uv_pipe_connect(ps->conn_req, p, path, pipe_connect_cb);
+    return 0;
+}
+
+static void pipe_src_cancel(tlsuv_src_t *sl) {
+    pipe_src_t *ps = (pipe_src_t *) sl;
+
+    if (ps->conn_req) {
+        uv_close((uv_handle_t *) ps->conn_req->handle, free_handle);
+        ps->conn_req->data = NULL;
+        ps->conn_req = NULL;
+    }
+
+    if (ps->pipe) {
+        close_pipe(ps, NULL, NULL);
+    }
+}
+
+static void pipe_src_release(tlsuv_src_t *sl) {
+    pipe_src_t *ps = (pipe_src_t *) sl;
+
+    if (ps->pipe) {
+        close_pipe(ps, NULL, NULL);
+    }
+}
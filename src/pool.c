@@ -0,0 +1,305 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uv.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "pool.h"
+#include "tlsuv/tlsuv.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
+// smallest class is 64 bytes, largest is 64K
+#define POOL_MIN_SHIFT 6
+#define POOL_CLASSES 11
+#define POOL_LARGE POOL_CLASSES
+// read buffer shared by connections of the thread
+#define POOL_SHARED (POOL_CLASSES + 1)
+
+// max memory kept on free list of each size class
+#define POOL_MAX_CACHED (512 * 1024)
+
+#define POOL_MAGIC 0x706f6f6cU
+
+struct pool_hdr {
+    uint32_t cls;
+    uint32_t magic;
+    uint64_t _align;
+};
+
+struct free_block {
+    struct free_block *next;
+};
+
+struct size_class {
+    struct free_block *free_list;
+    size_t cached;
+    size_t in_use;
+    size_t high_water;
+    unsigned long allocs;
+    unsigned long reused;
+};
+
+struct pool {
+    struct size_class classes[POOL_CLASSES];
+
+    struct pool_hdr *shared;
+    size_t shared_size;
+    bool shared_busy;
+};
+
+static void pool_destroy(void *arg);
+
+// thread key with destructor (uv_key_t has none), pool is freed when its thread exits
+static uv_once_t pool_once = UV_ONCE_INIT;
+#if _WIN32
+static DWORD pool_key = FLS_OUT_OF_INDEXES;
+
+static void WINAPI pool_thread_exit(void *arg) {
+    if (arg) pool_destroy(arg);
+}
+
+static void pool_key_init(void) {
+    pool_key = FlsAlloc(pool_thread_exit);
+}
+#define pool_key_get() ((struct pool *) FlsGetValue(pool_key))
+#define pool_key_set(p) FlsSetValue(pool_key, p)
+#else
+static pthread_key_t pool_key;
+
+static void pool_key_init(void) {
+    pthread_key_create(&pool_key, pool_destroy);
+}
+#define pool_key_get() ((struct pool *) pthread_getspecific(pool_key))
+#define pool_key_set(p) pthread_setspecific(pool_key, p)
+#endif
+
+static struct pool *get_pool(void) {
+    uv_once(&pool_once, pool_key_init);
+    struct pool *p = pool_key_get();
+    if (p == NULL) {
+        p = tlsuv__calloc(1, sizeof(struct pool));
+        pool_key_set(p);
+    }
+    return p;
+}
+
+static inline size_t class_size(uint32_t cls) {
+    return (size_t)1 << (cls + POOL_MIN_SHIFT);
+}
+
+static inline uint32_t size_to_class(size_t size) {
+    uint32_t cls = 0;
+    while (cls < POOL_CLASSES && class_size(cls) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+void *tlsuv_pool_alloc(size_t size) {
+    uint32_t cls = size_to_class(size);
+    struct pool_hdr *h;
+
+    if (cls == POOL_LARGE) {
+        h = tlsuv__malloc(sizeof(struct pool_hdr) + size);
+    } else {
+        struct size_class *sc = &get_pool()->classes[cls];
+        sc->allocs++;
+        if (sc->free_list) {
+            struct free_block *b = sc->free_list;
+            sc->free_list = b->next;
+            sc->cached--;
+            sc->reused++;
+            h = (struct pool_hdr *) b - 1;
+        } else {
+            h = tlsuv__malloc(sizeof(struct pool_hdr) + class_size(cls));
+        }
+
+        if (h != NULL && ++sc->in_use > sc->high_water) {
+            sc->high_water = sc->in_use;
+        }
+    }
+
+    if (h == NULL) {
+        return NULL;
+    }
+    h->cls = cls;
+    h->magic = POOL_MAGIC;
+    return h + 1;
+}
+
+void *tlsuv_pool_calloc(size_t size) {
+    void *p = tlsuv_pool_alloc(size);
+    if (p) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void tlsuv_pool_free(void *p) {
+    if (p == NULL) {
+        return;
+    }
+
+    struct pool_hdr *h = (struct pool_hdr *) p - 1;
+    if (h->magic != POOL_MAGIC) {
+        UM_LOG(ERR, "attempt to release block[%p] not allocated from pool", p);
+        return;
+    }
+
+    if (h->cls == POOL_LARGE) {
+        h->magic = 0;
+        tlsuv__free(h);
+        return;
+    }
+
+    if (h->cls == POOL_SHARED) {
+        struct pool *pool = get_pool();
+        if (pool->shared == h) {
+            pool->shared_busy = false;
+        } else {
+            UM_LOG(ERR, "shared read buffer[%p] released by another thread", p);
+        }
+        return;
+    }
+
+    struct size_class *sc = &get_pool()->classes[h->cls];
+    if (sc->in_use > 0) {
+        sc->in_use--;
+    }
+
+    if ((sc->cached + 1) * class_size(h->cls) > POOL_MAX_CACHED) {
+        h->magic = 0;
+        tlsuv__free(h);
+        return;
+    }
+
+    struct free_block *b = p;
+    b->next = sc->free_list;
+    sc->free_list = b;
+    sc->cached++;
+}
+
+void *tlsuv_pool_read_alloc(size_t size, size_t *len) {
+    struct pool *p = get_pool();
+    if (p->shared != NULL && !p->shared_busy) {
+        p->shared_busy = true;
+        *len = p->shared_size;
+        return p->shared + 1;
+    }
+
+    void *b = tlsuv_pool_alloc(size);
+    *len = b ? size : 0;
+    return b;
+}
+
+bool tlsuv_pool_read_shared(void) {
+    return get_pool()->shared != NULL;
+}
+
+static void pool_drop_shared(struct pool *p) {
+    if (p->shared) {
+        if (p->shared_busy) {
+            // released with the read that is using it
+            p->shared->cls = POOL_LARGE;
+        } else {
+            p->shared->magic = 0;
+            tlsuv__free(p->shared);
+        }
+        p->shared = NULL;
+        p->shared_size = 0;
+        p->shared_busy = false;
+    }
+}
+
+int tlsuv_pool_set_shared_read(size_t size) {
+    struct pool *p = get_pool();
+    pool_drop_shared(p);
+
+    if (size == 0) {
+        return 0;
+    }
+
+    struct pool_hdr *h = tlsuv__malloc(sizeof(struct pool_hdr) + size);
+    if (h == NULL) {
+        return UV_ENOMEM;
+    }
+    h->cls = POOL_SHARED;
+    h->magic = POOL_MAGIC;
+    p->shared = h;
+    p->shared_size = size;
+    return 0;
+}
+
+int tlsuv_pool_get_stats(tlsuv_pool_stats *stats, int count) {
+    struct pool *p = get_pool();
+    int i;
+    for (i = 0; i < count && i < POOL_CLASSES; i++) {
+        struct size_class *sc = &p->classes[i];
+        stats[i].block_size = class_size(i);
+        stats[i].allocs = sc->allocs;
+        stats[i].reused = sc->reused;
+        stats[i].in_use = sc->in_use;
+        stats[i].high_water = sc->high_water;
+        stats[i].cached = sc->cached;
+    }
+    return i;
+}
+
+static void pool_trim(struct pool *p) {
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        struct size_class *sc = &p->classes[i];
+        while (sc->free_list) {
+            struct free_block *b = sc->free_list;
+            sc->free_list = b->next;
+            tlsuv__free((struct pool_hdr *) b - 1);
+        }
+        sc->cached = 0;
+    }
+}
+
+void tlsuv_pool_trim(void) {
+    pool_trim(get_pool());
+}
+
+// blocks in use are not owned by the pool, they are freed or cached by the pool of the thread releasing them
+static void pool_destroy(void *arg) {
+    struct pool *p = arg;
+    pool_trim(p);
+    pool_drop_shared(p);
+    tlsuv__free(p);
+}
+
+void tlsuv_pool_release(void) {
+    uv_once(&pool_once, pool_key_init);
+    struct pool *p = pool_key_get();
+    if (p == NULL) {
+        return;
+    }
+
+    pool_key_set(NULL);
+    pool_destroy(p);
+}
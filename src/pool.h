@@ -0,0 +1,56 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_POOL_H
+#define TLSUV_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Size-class buffer pool for hot path allocations (TLS records, write requests, frames).
+ *
+ * Each loop thread has its own pool, so no locking is needed. Pool is freed when its thread exits.
+ * Blocks can be released from any thread, they are recycled by the pool of the releasing thread.
+ * Requests larger than the biggest size class are passed to malloc() directly.
+ */
+
+void *tlsuv_pool_alloc(size_t size);
+
+void *tlsuv_pool_calloc(size_t size);
+
+void tlsuv_pool_free(void *p);
+
+/*
+ * Buffer for link read path. It is the shared read buffer of the calling thread if one is set up and not in use,
+ * otherwise pool block of [size]. [len] receives usable size. Data must be consumed before the read callback returns
+ * and buffer released with tlsuv_pool_free().
+ */
+void *tlsuv_pool_read_alloc(size_t size, size_t *len);
+
+// calling thread has shared read buffer, links should not keep read buffers between reads
+bool tlsuv_pool_read_shared(void);
+
+// releases pool of the calling thread now, pools of other threads are released when the thread exits
+void tlsuv_pool_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_POOL_H
@@ -0,0 +1,895 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlsuv/tlsuv.h"
+#include "tlsuv/proxy_src.h"
+#include "tlsuv/tcp_src.h"
+#include "tlsuv/tls_link.h"
+#include "tlsuv/timer_wheel.h"
+#include "tlsuv/queue.h"
+#include "um_debug.h"
+#include "win32_compat.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
+#define DEFAULT_MAX_IDLE 4
+#define DEFAULT_IDLE_TIMEOUT 30000
+// proxy response (HTTP headers or SOCKS5 replies) must fit
+#define MAX_RESP 4096
+
+enum proxy_conn_state {
+    // connecting to the proxy (TCP and optional TLS)
+    ST_CONNECTING,
+    // connected to the proxy, no tunnel request in flight
+    ST_READY,
+    // tunnel request sent, waiting for reply
+    ST_NEGOTIATING,
+    // tunnel is established, bytes are passed through
+    ST_TUNNEL,
+    // link was closed
+    ST_CLOSED,
+};
+
+struct tlsuv_proxy_s {
+    uv_loop_t *loop;
+    tlsuv_proxy_type type;
+    char *host;
+    char *port;
+    tls_context *tls;
+    char *user;
+    char *pass;
+    size_t max_idle;
+    unsigned int idle_timeout;
+    // endpoint handle, sources, and connections
+    int refs;
+    bool freed;
+    tlsuv_proxy_stats stats;
+    LIST_HEAD(proxy_spares, proxy_conn_s) spares;
+};
+
+struct proxy_conn_s {
+    // top of proxy connection chain, becomes the link of the source once tunnel is up
+    uv_link_t link;
+    tcp_src_t tcp;
+    tls_link_t tls;
+    tls_engine *engine;
+
+    tlsuv_proxy_t *proxy;
+    // NULL if connection is not used by a source (spare or orphaned)
+    proxy_src_t *src;
+    enum proxy_conn_state state;
+    bool chained;
+    bool reading;
+    bool spare;
+    tlsuv_timeout_t timer;
+
+    // proxy reply received so far
+    char *resp;
+    size_t resp_len;
+    // bytes of rejected CONNECT response body not yet received
+    size_t body_left;
+    int socks_step;
+
+    // bytes received after proxy reply, delivered as first tunnel data
+    char *pending;
+    size_t pending_len;
+
+    LIST_ENTRY(proxy_conn_s) _next;
+};
+
+static int proxy_src_connect(tlsuv_src_t *sl, const char *host, const char *port, tlsuv_src_connect_cb cb, void *ctx);
+static void proxy_src_cancel(tlsuv_src_t *sl);
+static void proxy_src_release(tlsuv_src_t *sl);
+
+static int proxy_read_start(uv_link_t *l);
+static void proxy_alloc_cb(uv_link_t *l, size_t suggested, uv_buf_t *buf);
+static void proxy_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *buf);
+static void proxy_link_close(uv_link_t *l, uv_link_t *source, uv_link_close_cb cb);
+
+static void send_request(struct proxy_conn_s *c);
+static void conn_close(struct proxy_conn_s *c);
+
+static const uv_link_methods_t proxy_link_methods = {
+        .read_start = proxy_read_start,
+        .read_stop = uv_link_default_read_stop,
+        .write = uv_link_default_write,
+        .try_write = uv_link_default_try_write,
+        .shutdown = uv_link_default_shutdown,
+        .close = proxy_link_close,
+        .strerror = uv_link_default_strerror,
+        .alloc_cb_override = proxy_alloc_cb,
+        .read_cb_override = proxy_read_cb,
+};
+
+static void proxy_unref(tlsuv_proxy_t *p) {
+    if (--p->refs > 0) {
+        return;
+    }
+    tlsuv__free(p->host);
+    tlsuv__free(p->port);
+    tlsuv__free(p->user);
+    tlsuv__free(p->pass);
+    tlsuv__free(p);
+}
+
+tlsuv_proxy_t *tlsuv_proxy_new(uv_loop_t *loop, tlsuv_proxy_type type, const char *host, const char *port) {
+    if (loop == NULL || host == NULL || port == NULL ||
+        (type != tlsuv_PROXY_HTTP && type != tlsuv_PROXY_SOCKS5)) {
+        return NULL;
+    }
+
+    tlsuv_proxy_t *p = tlsuv__calloc(1, sizeof(*p));
+    p->loop = loop;
+    p->type = type;
+    p->host = tlsuv__strdup(host);
+    p->port = tlsuv__strdup(port);
+    p->max_idle = DEFAULT_MAX_IDLE;
+    p->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    p->refs = 1;
+    LIST_INIT(&p->spares);
+    return p;
+}
+
+int tlsuv_proxy_tls(tlsuv_proxy_t *proxy, tls_context *tls) {
+    if (proxy == NULL || (tls != NULL && proxy->type != tlsuv_PROXY_HTTP)) {
+        return UV_EINVAL;
+    }
+    proxy->tls = tls;
+    return 0;
+}
+
+int tlsuv_proxy_auth(tlsuv_proxy_t *proxy, const char *user, const char *pass) {
+    if (proxy == NULL) {
+        return UV_EINVAL;
+    }
+    // RFC 1929 limits both to 255 bytes
+    if (proxy->type == tlsuv_PROXY_SOCKS5 && user &&
+        (strlen(user) > 255 || (pass && strlen(pass) > 255))) {
+        return UV_EINVAL;
+    }
+
+    tlsuv__free(proxy->user);
+    tlsuv__free(proxy->pass);
+    proxy->user = user ? tlsuv__strdup(user) : NULL;
+    proxy->pass = user ? tlsuv__strdup(pass ? pass : "") : NULL;
+    return 0;
+}
+
+int tlsuv_proxy_idle(tlsuv_proxy_t *proxy, size_t max_idle, unsigned int idle_timeout_ms) {
+    if (proxy == NULL) {
+        return UV_EINVAL;
+    }
+    proxy->max_idle = max_idle;
+    proxy->idle_timeout = idle_timeout_ms ? idle_timeout_ms : DEFAULT_IDLE_TIMEOUT;
+
+    while (proxy->stats.idle > proxy->max_idle) {
+        conn_close(LIST_FIRST(&proxy->spares));
+    }
+    return 0;
+}
+
+int tlsuv_proxy_get_stats(const tlsuv_proxy_t *proxy, tlsuv_proxy_stats *stats) {
+    if (proxy == NULL || stats == NULL) {
+        return UV_EINVAL;
+    }
+    *stats = proxy->stats;
+    return 0;
+}
+
+void tlsuv_proxy_free(tlsuv_proxy_t *proxy) {
+    if (proxy == NULL || proxy->freed) {
+        return;
+    }
+    proxy->freed = true;
+    while (!LIST_EMPTY(&proxy->spares)) {
+        conn_close(LIST_FIRST(&proxy->spares));
+    }
+    proxy_unref(proxy);
+}
+
+int proxy_src_init(uv_loop_t *l, proxy_src_t *ps, tlsuv_proxy_t *proxy) {
+    if (proxy == NULL || proxy->loop != l) {
+        return UV_EINVAL;
+    }
+
+    ps->loop = l;
+    ps->link = NULL;
+    ps->connect = proxy_src_connect;
+    ps->connect_cb = NULL;
+    ps->connect_ctx = NULL;
+    ps->cancel = proxy_src_cancel;
+    ps->release = proxy_src_release;
+    ps->timing = NULL;
+    ps->proxy = proxy;
+    ps->conn = NULL;
+    ps->target_host = NULL;
+    ps->target_port = NULL;
+    proxy->refs++;
+    return 0;
+}
+
+static void spare_remove(struct proxy_conn_s *c) {
+    if (c->spare) {
+        LIST_REMOVE(c, _next);
+        c->spare = false;
+        c->proxy->stats.idle--;
+    }
+}
+
+static void conn_free(struct proxy_conn_s *c) {
+    spare_remove(c);
+    tlsuv_timeout_close(&c->timer);
+    if (c->engine) {
+        c->proxy->tls->api->free_engine(c->engine);
+        c->engine = NULL;
+    }
+    tcp_src_free(&c->tcp);
+    tlsuv__free(c->resp);
+    tlsuv__free(c->pending);
+    proxy_unref(c->proxy);
+    tlsuv__free(c);
+}
+
+static void conn_closed_cb(uv_link_t *l) {
+    conn_free(l->data);
+}
+
+static void conn_close(struct proxy_conn_s *c) {
+    spare_remove(c);
+    tlsuv_timeout_stop(&c->timer);
+    if (c->state == ST_CLOSED) {
+        return;
+    }
+
+    if (c->chained) {
+        uv_link_close(&c->link, conn_closed_cb);
+    } else {
+        // still connecting to the proxy
+        c->tcp.cancel((tlsuv_src_t *) &c->tcp);
+        conn_free(c);
+    }
+}
+
+static void idle_timeout_cb(tlsuv_timeout_t *t) {
+    struct proxy_conn_s *c = t->data;
+    UM_LOG(VERB, "closing idle connection to proxy[%s:%s]", c->proxy->host, c->proxy->port);
+    conn_close(c);
+}
+
+static void orphan_free_cb(tlsuv_timeout_t *t) {
+    conn_free(t->data);
+}
+
+static void start_reading(struct proxy_conn_s *c) {
+    if (!c->reading) {
+        c->reading = true;
+        uv_link_read_start(&c->link);
+    }
+}
+
+// keeps connection for reuse by the next connect, or closes it
+static void conn_park(struct proxy_conn_s *c) {
+    tlsuv_proxy_t *p = c->proxy;
+    c->src = NULL;
+    if (p->freed || p->stats.idle >= p->max_idle) {
+        conn_close(c);
+        return;
+    }
+
+    UM_LOG(VERB, "keeping spare connection to proxy[%s:%s]", p->host, p->port);
+    c->spare = true;
+    LIST_INSERT_HEAD(&p->spares, c, _next);
+    p->stats.idle++;
+    if (c->state == ST_READY) {
+        // reading detects proxy closing the connection
+        start_reading(c);
+        tlsuv_timeout_start(&c->timer, idle_timeout_cb, p->idle_timeout);
+    }
+}
+
+static struct proxy_conn_s *spare_take(tlsuv_proxy_t *p) {
+    struct proxy_conn_s *c, *connecting = NULL;
+    LIST_FOREACH(c, &p->spares, _next) {
+        if (c->state == ST_READY) {
+            break;
+        }
+        if (connecting == NULL) {
+            connecting = c;
+        }
+    }
+    if (c == NULL) {
+        c = connecting;
+    }
+
+    if (c) {
+        spare_remove(c);
+        tlsuv_timeout_stop(&c->timer);
+        p->stats.reused++;
+    }
+    return c;
+}
+
+static void src_fail(struct proxy_conn_s *c, int err, bool reusable) {
+    proxy_src_t *ps = c->src;
+    if (ps) {
+        ps->conn = NULL;
+        c->proxy->stats.failures++;
+    }
+
+    if (reusable) {
+        c->state = ST_READY;
+        conn_park(c);
+    } else {
+        c->src = NULL;
+        conn_close(c);
+    }
+
+    if (ps) {
+        ps->connect_cb((tlsuv_src_t *) ps, err, ps->connect_ctx);
+    }
+}
+
+static void tunnel_up(struct proxy_conn_s *c, const char *extra, size_t extra_len) {
+    proxy_src_t *ps = c->src;
+    UM_LOG(DEBG, "tunnel to %s:%s is established", ps->target_host, ps->target_port);
+
+    c->state = ST_TUNNEL;
+    tlsuv__free(c->resp);
+    c->resp = NULL;
+    c->resp_len = 0;
+    if (extra_len > 0) {
+        c->pending = tlsuv__malloc(extra_len);
+        memcpy(c->pending, extra, extra_len);
+        c->pending_len = extra_len;
+    }
+
+    // like tcp_src, data is not delivered until upper layer starts reading
+    c->reading = false;
+    uv_link_read_stop(&c->link);
+
+    c->proxy->stats.tunnels++;
+    ps->link = &c->link;
+    if (ps->timing) ps->timing->connect_end = uv_hrtime();
+    ps->connect_cb((tlsuv_src_t *) ps, 0, ps->connect_ctx);
+}
+
+static void conn_up(struct proxy_conn_s *c) {
+    c->state = ST_READY;
+    if (c->src) {
+        send_request(c);
+    } else {
+        start_reading(c);
+        tlsuv_timeout_start(&c->timer, idle_timeout_cb, c->proxy->idle_timeout);
+    }
+}
+
+static void proxy_hs_cb(tls_link_t *tls, int status) {
+    struct proxy_conn_s *c = tls->data;
+    if (status == TLS_HS_COMPLETE) {
+        conn_up(c);
+    } else {
+        UM_LOG(WARN, "TLS handshake with proxy[%s:%s] failed", c->proxy->host, c->proxy->port);
+        src_fail(c, UV_ECONNABORTED, false);
+    }
+}
+
+static void proxy_connect_cb(tlsuv_src_t *tcp, int status, void *ctx) {
+    struct proxy_conn_s *c = ctx;
+    tlsuv_proxy_t *p = c->proxy;
+
+    if (status != 0) {
+        UM_LOG(WARN, "failed to connect to proxy[%s:%s]: %d(%s)", p->host, p->port, status, uv_strerror(status));
+        src_fail(c, status, false);
+        return;
+    }
+
+    c->chained = true;
+    if (p->tls) {
+        c->engine = p->tls->api->new_engine(p->tls->ctx, p->host);
+        tlsuv_tls_link_init(&c->tls, c->engine, proxy_hs_cb);
+        c->tls.data = c;
+        uv_link_chain(tcp->link, (uv_link_t *) &c->tls);
+        uv_link_chain((uv_link_t *) &c->tls, &c->link);
+        // starts handshake
+        start_reading(c);
+    } else {
+        uv_link_chain(tcp->link, &c->link);
+        conn_up(c);
+    }
+}
+
+static int conn_new(tlsuv_proxy_t *p, struct proxy_conn_s **out) {
+    struct proxy_conn_s *c = tlsuv__calloc(1, sizeof(*c));
+    c->proxy = p;
+    c->state = ST_CONNECTING;
+    tcp_src_init(p->loop, &c->tcp);
+    tcp_src_nodelay(&c->tcp, 1);
+    uv_link_init(&c->link, &proxy_link_methods);
+    c->link.data = c;
+    tlsuv_timeout_init(p->loop, &c->timer);
+    c->timer.data = c;
+
+    UM_LOG(DEBG, "connecting to proxy[%s:%s]", p->host, p->port);
+    int rc = c->tcp.connect((tlsuv_src_t *) &c->tcp, p->host, p->port, proxy_connect_cb, c);
+    if (rc != 0) {
+        tlsuv_timeout_close(&c->timer);
+        tcp_src_free(&c->tcp);
+        tlsuv__free(c);
+        return rc;
+    }
+
+    p->refs++;
+    p->stats.connects++;
+    *out = c;
+    return 0;
+}
+
+static void write_done(uv_link_t *l, int status, void *arg) {
+    // errors surface as read errors
+    tlsuv__free(arg);
+}
+
+static void send_socks_request(struct proxy_conn_s *c) {
+    tlsuv_proxy_t *p = c->proxy;
+    const char *host = c->src->target_host;
+    unsigned char addr[16];
+    size_t host_len = strlen(host);
+
+    unsigned char *req = tlsuv__malloc(3 + 3 + 255 * 2 + 6 + 1 + 255 + 2);
+    size_t n = 0;
+
+    // greeting, offering single method
+    req[n++] = 5;
+    req[n++] = 1;
+    req[n++] = p->user ? 2 : 0;
+
+    // RFC 1929 username/password, sent without waiting for method selection
+    if (p->user) {
+        size_t ulen = strlen(p->user);
+        size_t plen = strlen(p->pass);
+        req[n++] = 1;
+        req[n++] = (unsigned char) ulen;
+        memcpy(req + n, p->user, ulen);
+        n += ulen;
+        req[n++] = (unsigned char) plen;
+        memcpy(req + n, p->pass, plen);
+        n += plen;
+    }
+
+    req[n++] = 5;
+    req[n++] = 1; // CONNECT
+    req[n++] = 0;
+    if (uv_inet_pton(AF_INET, host, addr) == 0) {
+        req[n++] = 1;
+        memcpy(req + n, addr, 4);
+        n += 4;
+    } else if (uv_inet_pton(AF_INET6, host, addr) == 0) {
+        req[n++] = 4;
+        memcpy(req + n, addr, 16);
+        n += 16;
+    } else {
+        req[n++] = 3;
+        req[n++] = (unsigned char) host_len;
+        memcpy(req + n, host, host_len);
+        n += host_len;
+    }
+    int port = atoi(c->src->target_port);
+    req[n++] = (unsigned char) (port >> 8);
+    req[n++] = (unsigned char) port;
+
+    c->socks_step = 0;
+    uv_buf_t b = uv_buf_init((char *) req, (unsigned int) n);
+    uv_link_write(&c->link, &b, 1, NULL, write_done, req);
+}
+
+static void send_connect_request(struct proxy_conn_s *c) {
+    tlsuv_proxy_t *p = c->proxy;
+    const char *host = c->src->target_host;
+    const char *port = c->src->target_port;
+    bool ipv6 = strchr(host, ':') != NULL;
+
+    char *enc = NULL;
+    if (p->user) {
+        size_t ulen = strlen(p->user);
+        size_t plen = strlen(p->pass);
+        unsigned char *cred = tlsuv__malloc(ulen + 1 + plen);
+        memcpy(cred, p->user, ulen);
+        cred[ulen] = ':';
+        memcpy(cred + ulen + 1, p->pass, plen);
+
+        size_t enc_len = tlsuv_base64_encoded_len(ulen + 1 + plen, 0) + 1;
+        enc = tlsuv__malloc(enc_len);
+        tlsuv_base64_encode(cred, ulen + 1 + plen, enc, &enc_len, 0);
+        tlsuv__free(cred);
+    }
+
+    const char *fmt = ipv6 ?
+                      "CONNECT [%s]:%s HTTP/1.1\r\nHost: [%s]:%s\r\n%s%s%s\r\n" :
+                      "CONNECT %s:%s HTTP/1.1\r\nHost: %s:%s\r\n%s%s%s\r\n";
+    const char *auth_pre = enc ? "Proxy-Authorization: Basic " : "";
+    const char *auth_post = enc ? "\r\n" : "";
+    const char *auth = enc ? enc : "";
+    int len = snprintf(NULL, 0, fmt, host, port, host, port, auth_pre, auth, auth_post);
+    char *req = tlsuv__malloc(len + 1);
+    snprintf(req, len + 1, fmt, host, port, host, port, auth_pre, auth, auth_post);
+    tlsuv__free(enc);
+
+    uv_buf_t b = uv_buf_init(req, (unsigned int) len);
+    uv_link_write(&c->link, &b, 1, NULL, write_done, req);
+}
+
+static void send_request(struct proxy_conn_s *c) {
+    UM_LOG(VERB, "requesting tunnel to %s:%s", c->src->target_host, c->src->target_port);
+    c->state = ST_NEGOTIATING;
+    c->resp_len = 0;
+    if (c->proxy->type == tlsuv_PROXY_SOCKS5) {
+        send_socks_request(c);
+    } else {
+        send_connect_request(c);
+    }
+    start_reading(c);
+}
+
+static int socks_error(int rep) {
+    switch (rep) {
+        case 3: return UV_ENETUNREACH;
+        case 4: return UV_EHOSTUNREACH;
+        case 6: return UV_ETIMEDOUT;
+        case 7:
+        case 8: return UV_ENOTSUP;
+        default: return UV_ECONNREFUSED;
+    }
+}
+
+static void consume(struct proxy_conn_s *c, size_t n) {
+    memmove(c->resp, c->resp + n, c->resp_len - n);
+    c->resp_len -= n;
+}
+
+// processes SOCKS5 replies, @returns 0 if more data is needed
+static int socks_process(struct proxy_conn_s *c) {
+    const unsigned char *r = (const unsigned char *) c->resp;
+    bool auth = c->proxy->user != NULL;
+
+    if (c->socks_step == 0) {
+        if (c->resp_len < 2) return 0;
+        if (r[0] != 5) return UV_EPROTO;
+        if (r[1] == 0xff) return UV_EACCES;
+        if (r[1] != (auth ? 2 : 0)) return UV_EPROTO;
+        consume(c, 2);
+        c->socks_step = auth ? 1 : 2;
+    }
+
+    if (c->socks_step == 1) {
+        if (c->resp_len < 2) return 0;
+        // RFC 1929 sub-negotiation version
+        if (r[0] != 1) return UV_EPROTO;
+        if (r[1] != 0) {
+            UM_LOG(WARN, "proxy[%s:%s] rejected credentials", c->proxy->host, c->proxy->port);
+            return UV_EACCES;
+        }
+        consume(c, 2);
+        c->socks_step = 2;
+    }
+
+    if (c->resp_len < 5) return 0;
+    if (r[0] != 5) return UV_EPROTO;
+    if (r[1] != 0) {
+        UM_LOG(WARN, "proxy[%s:%s] failed to connect to %s:%s: rep[%d]", c->proxy->host, c->proxy->port,
+               c->src->target_host, c->src->target_port, r[1]);
+        return socks_error(r[1]);
+    }
+
+    size_t addr_len;
+    switch (r[3]) {
+        case 1: addr_len = 4; break;
+        case 4: addr_len = 16; break;
+        case 3: addr_len = 1 + r[4]; break;
+        default: return UV_EPROTO;
+    }
+    size_t reply_len = 4 + addr_len + 2;
+    if (c->resp_len < reply_len) return 0;
+
+    tunnel_up(c, c->resp + reply_len, c->resp_len - reply_len);
+    return 1;
+}
+
+static bool header_value(const char *hdrs, const char *name, char *val, size_t val_len) {
+    size_t name_len = strlen(name);
+    const char *line = strstr(hdrs, "\r\n");
+    while (line && line[2] != '\r') {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            size_t l = end - v;
+            if (l >= val_len) l = val_len - 1;
+            memcpy(val, v, l);
+            val[l] = '\0';
+            return true;
+        }
+        line = end;
+    }
+    return false;
+}
+
+// processes HTTP CONNECT response, @returns 0 if more data is needed
+static int http_process(struct proxy_conn_s *c) {
+    char *end = strstr(c->resp, "\r\n\r\n");
+    if (end == NULL) {
+        return c->resp_len < MAX_RESP - 1 ? 0 : UV_EPROTO;
+    }
+    size_t hdr_len = end + 4 - c->resp;
+
+    int minor, code;
+    if (sscanf(c->resp, "HTTP/1.%d %d", &minor, &code) != 2) {
+        return UV_EPROTO;
+    }
+
+    if (code >= 200 && code < 300) {
+        tunnel_up(c, c->resp + hdr_len, c->resp_len - hdr_len);
+        return 1;
+    }
+
+    UM_LOG(WARN, "proxy[%s:%s] CONNECT %s:%s failed: %.*s", c->proxy->host, c->proxy->port,
+           c->src->target_host, c->src->target_port, (int) (strstr(c->resp, "\r\n") - c->resp), c->resp);
+    int err = (code == 407 || code == 403) ? UV_EACCES : UV_ECONNREFUSED;
+
+    // connection remains usable if proxy keeps it open and body length is known
+    char val[32];
+    bool reusable = minor == 1;
+    if (header_value(c->resp, "Connection", val, sizeof(val)) ||
+        header_value(c->resp, "Proxy-Connection", val, sizeof(val))) {
+        reusable = reusable && strcasecmp(val, "close") != 0;
+    }
+    size_t body = 0;
+    if (header_value(c->resp, "Content-Length", val, sizeof(val))) {
+        body = strtoul(val, NULL, 10);
+    } else if (header_value(c->resp, "Transfer-Encoding", val, sizeof(val))) {
+        reusable = false;
+    }
+
+    size_t extra = c->resp_len - hdr_len;
+    if (extra > body) {
+        reusable = false;
+    }
+    c->body_left = body - (extra > body ? body : extra);
+    c->resp_len = 0;
+    src_fail(c, err, reusable);
+    return 1;
+}
+
+static void on_data(struct proxy_conn_s *c, const char *data, size_t len) {
+    // skip rest of rejected response body
+    size_t skip = c->body_left < len ? c->body_left : len;
+    c->body_left -= skip;
+    data += skip;
+    len -= skip;
+    if (len == 0) {
+        return;
+    }
+
+    if (c->state != ST_NEGOTIATING) {
+        UM_LOG(WARN, "unexpected data from proxy[%s:%s]", c->proxy->host, c->proxy->port);
+        conn_close(c);
+        return;
+    }
+
+    if (c->resp == NULL) {
+        c->resp = tlsuv__malloc(MAX_RESP);
+    }
+
+    while (len > 0 && c->state == ST_NEGOTIATING) {
+        size_t n = MAX_RESP - 1 - c->resp_len;
+        if (n > len) n = len;
+        memcpy(c->resp + c->resp_len, data, n);
+        c->resp_len += n;
+        c->resp[c->resp_len] = '\0';
+        data += n;
+        len -= n;
+
+        int rc = c->proxy->type == tlsuv_PROXY_SOCKS5 ? socks_process(c) : http_process(c);
+        if (rc < 0) {
+            src_fail(c, rc, false);
+            return;
+        }
+        if (rc == 0 && n == 0) {
+            src_fail(c, UV_EPROTO, false);
+            return;
+        }
+    }
+
+    // tunnel got established with more data than reply buffer could take
+    if (len > 0 && c->state == ST_TUNNEL) {
+        c->pending = tlsuv__realloc(c->pending, c->pending_len + len);
+        memcpy(c->pending + c->pending_len, data, len);
+        c->pending_len += len;
+    }
+}
+
+static void proxy_alloc_cb(uv_link_t *l, size_t suggested, uv_buf_t *buf) {
+    struct proxy_conn_s *c = l->data;
+    if (c->state == ST_TUNNEL && l->child) {
+        uv_link_propagate_alloc_cb(l, suggested, buf);
+        return;
+    }
+    buf->base = tlsuv__malloc(MAX_RESP);
+    buf->len = MAX_RESP;
+}
+
+static void proxy_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *buf) {
+    struct proxy_conn_s *c = l->data;
+    if (c->state == ST_TUNNEL && l->child) {
+        uv_link_propagate_read_cb(l, nread, buf);
+        return;
+    }
+
+    if (nread < 0) {
+        UM_LOG(VERB, "connection to proxy[%s:%s] closed: %zd(%s)", c->proxy->host, c->proxy->port,
+               nread, uv_strerror((int) nread));
+        if (c->src && c->state == ST_NEGOTIATING) {
+            src_fail(c, nread == UV_EOF ? UV_ECONNRESET : (int) nread, false);
+        } else if (c->state != ST_CLOSED && c->state != ST_TUNNEL) {
+            conn_close(c);
+        }
+    } else if (nread > 0) {
+        if (c->state == ST_TUNNEL) {
+            c->pending = tlsuv__realloc(c->pending, c->pending_len + nread);
+            memcpy(c->pending + c->pending_len, buf->base, nread);
+            c->pending_len += nread;
+        } else {
+            on_data(c, buf->base, (size_t) nread);
+        }
+    }
+    tlsuv__free(buf->base);
+}
+
+static void deliver_pending_cb(tlsuv_timeout_t *t) {
+    struct proxy_conn_s *c = t->data;
+    while (c->pending_len > 0 && c->state == ST_TUNNEL && c->link.child) {
+        uv_buf_t b;
+        uv_link_propagate_alloc_cb(&c->link, c->pending_len, &b);
+        if (b.base == NULL || b.len == 0) {
+            uv_link_propagate_read_cb(&c->link, UV_ENOBUFS, &b);
+            return;
+        }
+        size_t n = b.len < c->pending_len ? b.len : c->pending_len;
+        memcpy(b.base, c->pending, n);
+        memmove(c->pending, c->pending + n, c->pending_len - n);
+        c->pending_len -= n;
+        uv_link_propagate_read_cb(&c->link, (ssize_t) n, &b);
+    }
+}
+
+static int proxy_read_start(uv_link_t *l) {
+    struct proxy_conn_s *c = l->data;
+    if (c->state == ST_TUNNEL && c->pending_len > 0) {
+        // delivered after upper layers finish starting
+        tlsuv_timeout_start(&c->timer, deliver_pending_cb, 0);
+    }
+    return uv_link_default_read_start(l);
+}
+
+static void proxy_link_close(uv_link_t *l, uv_link_t *source, uv_link_close_cb cb) {
+    struct proxy_conn_s *c = l->data;
+    bool orphan = c->state == ST_TUNNEL && c->src == NULL;
+
+    c->state = ST_CLOSED;
+    tlsuv_timeout_stop(&c->timer);
+    cb(source);
+
+    // source let go of the tunnel before closing it, link may still be referenced by the close in progress
+    if (orphan) {
+        tlsuv_timeout_start(&c->timer, orphan_free_cb, 0);
+    }
+}
+
+// detaches source from its connection
+static void src_drop(proxy_src_t *ps) {
+    struct proxy_conn_s *c = ps->conn;
+    ps->link = NULL;
+    if (c == NULL) {
+        return;
+    }
+
+    ps->conn = NULL;
+    c->src = NULL;
+    switch (c->state) {
+        case ST_CONNECTING:
+        case ST_READY:
+            // connection to proxy is not wasted, next connect picks it up
+            conn_park(c);
+            break;
+        case ST_NEGOTIATING:
+            conn_close(c);
+            break;
+        case ST_TUNNEL:
+            // upper layers still use the link, connection is freed once they close it
+            if (c->link.child == NULL) {
+                conn_close(c);
+            }
+            break;
+        case ST_CLOSED:
+            conn_free(c);
+            break;
+    }
+}
+
+static int proxy_src_connect(tlsuv_src_t *sl, const char *host, const char *port, tlsuv_src_connect_cb cb, void *ctx) {
+    proxy_src_t *ps = (proxy_src_t *) sl;
+    tlsuv_proxy_t *p = ps->proxy;
+    if (host == NULL || port == NULL) {
+        return UV_EINVAL;
+    }
+    if (p->type == tlsuv_PROXY_SOCKS5) {
+        int port_num = atoi(port);
+        if (strlen(host) > 255 || port_num <= 0 || port_num > 65535) {
+            return UV_EINVAL;
+        }
+    }
+
+    src_drop(ps);
+
+    tlsuv__free(ps->target_host);
+    tlsuv__free(ps->target_port);
+    ps->target_host = tlsuv__strdup(host);
+    ps->target_port = tlsuv__strdup(port);
+    ps->connect_cb = cb;
+    ps->connect_ctx = ctx;
+
+    // target is resolved by the proxy
+    if (ps->timing) ps->timing->resolve_start = ps->timing->resolve_end = uv_hrtime();
+
+    struct proxy_conn_s *c = spare_take(p);
+    if (c == NULL) {
+        int rc = conn_new(p, &c);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    c->src = ps;
+    ps->conn = c;
+    if (c->state == ST_READY) {
+        send_request(c);
+    }
+    return 0;
+}
+
+static void proxy_src_cancel(tlsuv_src_t *sl) {
+    src_drop((proxy_src_t *) sl);
+}
+
+static void proxy_src_release(tlsuv_src_t *sl) {
+    src_drop((proxy_src_t *) sl);
+}
+
+void proxy_src_free(proxy_src_t *ps) {
+    if (ps && ps->proxy) {
+        src_drop(ps);
+        tlsuv__free(ps->target_host);
+        tlsuv__free(ps->target_port);
+        ps->target_host = NULL;
+        ps->target_port = NULL;
+        proxy_unref(ps->proxy);
+        ps->proxy = NULL;
+    }
+}
@@ -0,0 +1,54 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_READ_SIZING_H
+#define TLSUV_READ_SIZING_H
+
+#include <stddef.h>
+
+#include "tlsuv/tlsuv.h"
+
+/*
+ * Read buffer size follows recent reads: it grows to the next power of two after a read fills the buffer,
+ * and shrinks after two reads in a row that would fit into the smaller size.
+ */
+#define READ_SIZE_DEFAULT_SHIFT 13
+#define READ_SIZE_MIN_SHIFT 10
+#define READ_SIZE_MAX_SHIFT 16
+
+static inline size_t read_sizer_size(const struct tlsuv_read_sizer_s *rs) {
+    return (size_t) 1 << (READ_SIZE_DEFAULT_SHIFT + rs->step);
+}
+
+static inline void read_sizer_update(struct tlsuv_read_sizer_s *rs, ssize_t nread, size_t buf_len) {
+    if (nread <= 0) return;
+
+    size_t size = read_sizer_size(rs);
+    if ((size_t) nread >= buf_len) {
+        rs->small_reads = 0;
+        if (READ_SIZE_DEFAULT_SHIFT + rs->step < READ_SIZE_MAX_SHIFT && buf_len >= size) {
+            rs->step++;
+        }
+    } else if ((size_t) nread <= size / 2 && READ_SIZE_DEFAULT_SHIFT + rs->step > READ_SIZE_MIN_SHIFT) {
+        if (++rs->small_reads >= 2) {
+            rs->small_reads = 0;
+            rs->step--;
+        }
+    } else {
+        rs->small_reads = 0;
+    }
+}
+
+#endif//TLSUV_READ_SIZING_H
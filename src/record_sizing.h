@@ -0,0 +1,66 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_RECORD_SIZING_H
+#define TLSUV_RECORD_SIZING_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#include "tlsuv/tls_engine.h"
+
+// per-engine state of dynamic record sizing
+struct record_sizer {
+    tls_record_sizing opts;
+    size_t sent;
+    uint64_t last_write;
+};
+
+static inline void record_sizer_init(struct record_sizer *rs, const tls_record_sizing *opts) {
+    rs->opts = *opts;
+    rs->sent = 0;
+    rs->last_write = 0;
+}
+
+static inline void record_sizer_reset(struct record_sizer *rs) {
+    rs->sent = 0;
+    rs->last_write = 0;
+}
+
+// called once per engine write call, drops back to small records after idle period
+static inline void record_sizer_begin(struct record_sizer *rs) {
+    if (rs->opts.small_record == 0) return;
+
+    uint64_t now = uv_hrtime() / 1000000;
+    if (rs->opts.idle_ms > 0 && rs->last_write > 0 && now - rs->last_write >= rs->opts.idle_ms) {
+        rs->sent = 0;
+    }
+    rs->last_write = now;
+}
+
+// how much of `len` should go into the next record
+static inline size_t record_sizer_next(struct record_sizer *rs, size_t len) {
+    if (rs->opts.small_record == 0 || rs->sent >= rs->opts.ramp_bytes) {
+        return len;
+    }
+    return len < rs->opts.small_record ? len : rs->opts.small_record;
+}
+
+static inline void record_sizer_sent(struct record_sizer *rs, size_t len) {
+    if (rs->opts.small_record > 0 && rs->sent < rs->opts.ramp_bytes) {
+        rs->sent += len;
+    }
+}
+
+#endif//TLSUV_RECORD_SIZING_H
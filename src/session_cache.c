@@ -0,0 +1,154 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "session_cache.h"
+#include "tlsuv/queue.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
+
+struct session_entry {
+    char *host;
+    char *alpn;
+    void *session;
+
+    TAILQ_ENTRY(session_entry) _next;
+};
+
+struct tlsuv_session_cache_s {
+    size_t max_entries;
+    size_t count;
+    void (*free_session)(void *);
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+
+    // most recently used first
+    TAILQ_HEAD(session_list, session_entry) entries;
+};
+
+static void free_entry(tlsuv_session_cache *cache, struct session_entry *e) {
+    TAILQ_REMOVE(&cache->entries, e, _next);
+    cache->count--;
+    if (cache->free_session && e->session) {
+        cache->free_session(e->session);
+    }
+    tlsuv__free(e->host);
+    tlsuv__free(e->alpn);
+    tlsuv__free(e);
+}
+
+static struct session_entry *find_entry(tlsuv_session_cache *cache, const char *host, const char *alpn) {
+    if (alpn == NULL) alpn = "";
+
+    struct session_entry *e;
+    TAILQ_FOREACH(e, &cache->entries, _next) {
+        if (strcmp(e->host, host) == 0 && strcmp(e->alpn, alpn) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+tlsuv_session_cache *tlsuv_session_cache_new(size_t max_entries, void (*free_session)(void *session)) {
+    tlsuv_session_cache *cache = tlsuv__calloc(1, sizeof(tlsuv_session_cache));
+    cache->max_entries = max_entries > 0 ? max_entries : TLSUV_SESSION_CACHE_SIZE;
+    cache->free_session = free_session;
+    TAILQ_INIT(&cache->entries);
+    return cache;
+}
+
+void tlsuv_session_cache_free(tlsuv_session_cache *cache) {
+    if (cache == NULL) return;
+
+    while (!TAILQ_EMPTY(&cache->entries)) {
+        free_entry(cache, TAILQ_FIRST(&cache->entries));
+    }
+    tlsuv__free(cache);
+}
+
+void *tlsuv_session_cache_get(tlsuv_session_cache *cache, const char *host, const char *alpn) {
+    if (cache == NULL || host == NULL) return NULL;
+
+    struct session_entry *e = find_entry(cache, host, alpn);
+    if (e == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache->hits++;
+    if (e != TAILQ_FIRST(&cache->entries)) {
+        TAILQ_REMOVE(&cache->entries, e, _next);
+        TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+    }
+    UM_LOG(VERB, "found cached session for host[%s]", host);
+    return e->session;
+}
+
+void tlsuv_session_cache_put(tlsuv_session_cache *cache, const char *host, const char *alpn, void *session) {
+    if (cache == NULL || host == NULL) {
+        if (cache && cache->free_session) cache->free_session(session);
+        return;
+    }
+
+    struct session_entry *e = find_entry(cache, host, alpn);
+    if (e != NULL) {
+        if (e->session != session && cache->free_session) {
+            cache->free_session(e->session);
+        }
+        e->session = session;
+        TAILQ_REMOVE(&cache->entries, e, _next);
+        TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+        return;
+    }
+
+    while (cache->count >= cache->max_entries) {
+        free_entry(cache, TAILQ_LAST(&cache->entries, session_list));
+        cache->evictions++;
+    }
+
+    e = tlsuv__calloc(1, sizeof(struct session_entry));
+    e->host = tlsuv__strdup(host);
+    e->alpn = tlsuv__strdup(alpn ? alpn : "");
+    e->session = session;
+    TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+    cache->count++;
+    UM_LOG(VERB, "cached session for host[%s]", host);
+}
+
+void tlsuv_session_cache_remove(tlsuv_session_cache *cache, const char *host, const char *alpn) {
+    if (cache == NULL || host == NULL) return;
+
+    struct session_entry *e = find_entry(cache, host, alpn);
+    if (e) {
+        free_entry(cache, e);
+    }
+}
+
+void tlsuv_session_cache_stats(tlsuv_session_cache *cache, tls_session_stats *stats) {
+    if (stats == NULL) return;
+
+    memset(stats, 0, sizeof(*stats));
+    if (cache) {
+        stats->hits = cache->hits;
+        stats->misses = cache->misses;
+        stats->evictions = cache->evictions;
+        stats->entries = cache->count;
+    }
+}
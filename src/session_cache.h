@@ -0,0 +1,53 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_SESSION_CACHE_H
+#define TLSUV_SESSION_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tlsuv/tls_engine.h"
+
+#define TLSUV_SESSION_CACHE_SIZE 128
+
+/**
+ * LRU cache of TLS sessions keyed by (host, ALPN).
+ * Sessions are opaque to the cache, engine supplies function to release them.
+ */
+typedef struct tlsuv_session_cache_s tlsuv_session_cache;
+
+tlsuv_session_cache *tlsuv_session_cache_new(size_t max_entries, void (*free_session)(void *session));
+void tlsuv_session_cache_free(tlsuv_session_cache *cache);
+
+/**
+ * Finds session for host/alpn and updates hit/miss counters.
+ * Returned session is still owned by the cache.
+ */
+void *tlsuv_session_cache_get(tlsuv_session_cache *cache, const char *host, const char *alpn);
+
+/**
+ * Stores session for host/alpn, cache takes ownership of the session.
+ * Existing entry for the same key is replaced, least recently used entry is evicted if cache is full.
+ */
+void tlsuv_session_cache_put(tlsuv_session_cache *cache, const char *host, const char *alpn, void *session);
+
+/**
+ * Drops session for host/alpn (e.g. if server did not accept it).
+ */
+void tlsuv_session_cache_remove(tlsuv_session_cache *cache, const char *host, const char *alpn);
+
+void tlsuv_session_cache_stats(tlsuv_session_cache *cache, tls_session_stats *stats);
+
+#endif//TLSUV_SESSION_CACHE_H
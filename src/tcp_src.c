@@ -12,20 +12,43 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__linux__)
+#define TFO_SUPPORTED 1
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#endif
+
 #include "tlsuv/tcp_src.h"
 #include "tlsuv/http.h"
+#include "dns_cache.h"
+#include "pool.h"
 #include "um_debug.h"
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
 // connect and release method for um_http custom source link
 static int tcp_src_connect(tlsuv_src_t *sl, const char *host, const char *service, tlsuv_src_connect_cb cb, void *ctx);
 static void tcp_src_release(tlsuv_src_t *sl);
 static void tcp_src_cancel(tlsuv_src_t *sl);
 
-static void free_handle(uv_handle_t *h);
+static void close_conn(tcp_src_t *ts, uv_link_close_cb cb, uv_link_t *source);
+
+#define DEFAULT_ATTEMPT_DELAY 250
 
 int tcp_src_init(uv_loop_t *l, tcp_src_t *tl) {
     tl->loop = l;
-    tl->link = calloc(1, sizeof(uv_link_source_t));
+    memset(&tl->source, 0, sizeof(tl->source));
+    tl->link = (uv_link_t *) &tl->source;
     tl->conn = NULL;
     tl->connect = tcp_src_connect;
     tl->connect_cb = NULL;
@@ -33,14 +56,69 @@ int tcp_src_init(uv_loop_t *l, tcp_src_t *tl) {
     tl->cancel = tcp_src_cancel;
     tl->keepalive = 0;
     tl->nodelay = 0;
+    tl->timing = NULL;
+    tl->race = NULL;
+    tl->fast_open = 0;
+    tl->attempt_delay = DEFAULT_ATTEMPT_DELAY;
+    memset(&tl->sockopts, 0, sizeof(tl->sockopts));
+    tl->addrs = NULL;
+    tl->addr_count = 0;
     return 0;
 }
 
 void tcp_src_free(tcp_src_t *ts) {
     if (ts) {
-        free(ts->link);
+        if (ts->conn) {
+            close_conn(ts, NULL, NULL);
+        }
         ts->link = NULL;
+        tlsuv__free(ts->addrs);
+        ts->addrs = NULL;
+        ts->addr_count = 0;
+    }
+}
+
+int tcp_src_fast_open(tcp_src_t *ts, int on) {
+#if TFO_SUPPORTED
+    ts->fast_open = on;
+    return 0;
+#else
+    return on ? UV_ENOTSUP : 0;
+#endif
+}
+
+int tcp_src_fast_open_used(tcp_src_t *ts) {
+    if (ts->conn == NULL) {
+        return UV_ENOTCONN;
     }
+#if TFO_SUPPORTED && defined(TCPI_OPT_SYN_DATA)
+    uv_os_fd_t fd;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (uv_fileno((const uv_handle_t *) ts->conn, &fd) != 0 ||
+        getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        return UV_ENOTSUP;
+    }
+    return (info.tcpi_options & TCPI_OPT_SYN_DATA) ? 1 : 0;
+#else
+    return UV_ENOTSUP;
+#endif
+}
+
+int tcp_src_set_addr(tcp_src_t *ts, const struct addrinfo *addr) {
+    struct sockaddr_storage *addrs = NULL;
+    size_t count = 0;
+    if (addr != NULL) {
+        count = tlsuv_dns_addrs(addr, &addrs);
+        if (count == 0) {
+            return UV_EINVAL;
+        }
+    }
+
+    tlsuv__free(ts->addrs);
+    ts->addrs = addrs;
+    ts->addr_count = count;
+    return 0;
 }
 
 int tcp_src_nodelay(tcp_src_t *ts, int val) {
@@ -55,88 +133,384 @@ int tcp_src_keepalive(tcp_src_t *ts, int on, unsigned int val) {
     return ts->conn ? uv_tcp_keepalive(ts->conn, on, val) : 0;
 }
 
-static void tcp_connect_cb(uv_connect_t *req, int status) {
-    tcp_src_t *sl = req->data;
+static int set_opt(uv_os_fd_t fd, int level, int name, int val, const char *label) {
+    if (setsockopt((uv_os_sock_t) fd, level, name, (const char *) &val, sizeof(val)) != 0) {
+        UM_LOG(VERB, "failed to set %s=%d", label, val);
+        return UV_EINVAL;
+    }
+    return 0;
+}
+
+static int apply_sockopts(uv_tcp_t *conn, int family, const tcp_src_sockopts *opts) {
+    uv_os_fd_t fd;
+    int rc = uv_fileno((const uv_handle_t *) conn, &fd);
+    if (rc != 0) {
+        return rc;
+    }
+
+    int err = 0;
+    if (opts->send_buffer > 0) {
+        int val = opts->send_buffer;
+        if ((rc = uv_send_buffer_size((uv_handle_t *) conn, &val)) != 0) err = rc;
+    }
+    if (opts->recv_buffer > 0) {
+        int val = opts->recv_buffer;
+        if ((rc = uv_recv_buffer_size((uv_handle_t *) conn, &val)) != 0) err = rc;
+    }
+#if defined(TCP_NOTSENT_LOWAT)
+    if (opts->notsent_lowat > 0 &&
+        (rc = set_opt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, opts->notsent_lowat, "TCP_NOTSENT_LOWAT")) != 0) err = rc;
+#endif
+#if defined(SO_BUSY_POLL)
+    if (opts->busy_poll > 0 &&
+        (rc = set_opt(fd, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll, "SO_BUSY_POLL")) != 0) err = rc;
+#endif
+#if defined(TCP_USER_TIMEOUT)
+    if (opts->user_timeout > 0 &&
+        (rc = set_opt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, (int) opts->user_timeout, "TCP_USER_TIMEOUT")) != 0) err = rc;
+#endif
+    if (opts->tos > 0) {
+        if (family == AF_INET) {
+            if ((rc = set_opt(fd, IPPROTO_IP, IP_TOS, opts->tos, "IP_TOS")) != 0) err = rc;
+        }
+#if defined(IPV6_TCLASS)
+        else if (family == AF_INET6) {
+            if ((rc = set_opt(fd, IPPROTO_IPV6, IPV6_TCLASS, opts->tos, "IPV6_TCLASS")) != 0) err = rc;
+        }
+#endif
+    }
+    return err;
+}
+
+int tcp_src_sockopts_set(tcp_src_t *ts, const tcp_src_sockopts *opts) {
+    ts->sockopts = *opts;
+    if (ts->conn == NULL) {
+        return 0;
+    }
+
+    struct sockaddr_storage addr;
+    int len = sizeof(addr);
+    int rc = uv_tcp_getsockname(ts->conn, (struct sockaddr *) &addr, &len);
+    return rc != 0 ? rc : apply_sockopts(ts->conn, addr.ss_family, opts);
+}
+
+int tcp_src_attempt_delay(tcp_src_t *ts, unsigned int delay_ms) {
+    ts->attempt_delay = delay_ms > 0 ? delay_ms : DEFAULT_ATTEMPT_DELAY;
+    return 0;
+}
+
+// connection attempts to resolved addresses, raced against each other (RFC 8305)
+struct tcp_race_s {
+    // NULL once race is decided or cancelled
+    tcp_src_t *src;
+    uv_timer_t timer;
+
+    // both arrays are allocated with the race
+    struct sockaddr_storage *addrs;
+    struct tcp_attempt_s **attempts;
+    size_t addr_count;
+    size_t next;
+
+    // attempts in flight
+    int pending;
+    // attempts in flight and timer handle
+    int refs;
+    int last_err;
+};
+
+// connection attempt, the winner becomes tcp_src connection
+// freed only when its handle is closed
+struct tcp_attempt_s {
+    // must be first, close callback finds attempt by the handle
+    uv_tcp_t conn;
+    uv_connect_t req;
+    struct tcp_race_s *race;
+    size_t idx;
+
+    // link close in progress
+    uv_link_close_cb close_cb;
+    uv_link_t *close_source;
+};
+
+static void attempt_close_cb(uv_handle_t *h) {
+    struct tcp_attempt_s *a = (struct tcp_attempt_s *) h;
+    if (a->close_cb) {
+        a->close_cb(a->close_source);
+    }
+    tlsuv_pool_free(a);
+}
+
+// detaches connection from the source and closes it, cb (if any) is called once handle is closed
+static void close_conn(tcp_src_t *ts, uv_link_close_cb cb, uv_link_t *source) {
+    struct tcp_attempt_s *a = (struct tcp_attempt_s *) ts->conn;
+    ts->conn = NULL;
+    ts->source.stream = NULL;
+
+    a->close_cb = cb;
+    a->close_source = source;
+    uv_close((uv_handle_t *) &a->conn, attempt_close_cb);
+}
+
+// link source close closes the handle it owns and requires handle->data that is not ours,
+// tcp link closes the connection it is currently attached to instead
+static void tcp_link_close(uv_link_t *link, uv_link_t *source, uv_link_close_cb cb) {
+    tcp_src_t *ts = link->data;
+    if (ts && ts->conn) {
+        close_conn(ts, cb, source);
+    } else {
+        cb(source);
+    }
+}
+
+static uv_link_methods_t tcp_link_methods;
+static uv_once_t tcp_link_once = UV_ONCE_INIT;
+
+static void init_tcp_link_methods(void) {
+    uv_link_source_t s;
+    uv_tcp_t dummy;
+    uv_link_source_init(&s, (uv_stream_t *) &dummy);
+    tcp_link_methods = *s.methods;
+    tcp_link_methods.close = tcp_link_close;
+}
+
+// makes connected handle the source of the link
+static void attach_conn(tcp_src_t *sl, struct tcp_attempt_s *a) {
+    sl->conn = &a->conn;
+    uv_tcp_nodelay(sl->conn, 1);
+    uv_tcp_keepalive(sl->conn, sl->keepalive > 0, sl->keepalive);
+
+    uv_once(&tcp_link_once, init_tcp_link_methods);
+    uv_link_source_init(&sl->source, (uv_stream_t *) sl->conn);
+    sl->link->methods = &tcp_link_methods;
+    sl->link->data = sl;
+}
+
+static void race_unref(struct tcp_race_s *r) {
+    if (--r->refs == 0) {
+        tlsuv_pool_free(r);
+    }
+}
+
+static void race_timer_close_cb(uv_handle_t *h) {
+    race_unref(h->data);
+}
+
+// stops racing, attempts in flight (except the winner) are closed and complete with UV_ECANCELED
+static void race_end(struct tcp_race_s *r, struct tcp_attempt_s *winner) {
+    r->src = NULL;
+    uv_close((uv_handle_t *) &r->timer, race_timer_close_cb);
+    for (size_t i = 0; i < r->addr_count; i++) {
+        struct tcp_attempt_s *a = r->attempts[i];
+        if (a && a != winner && !uv_is_closing((const uv_handle_t *) &a->conn)) {
+            uv_close((uv_handle_t *) &a->conn, attempt_close_cb);
+        }
+    }
+}
+
+static void race_fail(struct tcp_race_s *r, int err) {
+    tcp_src_t *sl = r->src;
+    UM_LOG(ERR, "failed to connect: %d(%s)", err, uv_strerror(err));
+    sl->race = NULL;
+    race_end(r, NULL);
+    sl->connect_cb((tlsuv_src_t *) sl, err, sl->connect_ctx);
+}
+
+static void attempt_cb(uv_connect_t *req, int status);
+static void race_timer_cb(uv_timer_t *t);
+
+static int race_start_attempt(struct tcp_race_s *r, size_t idx) {
+    const struct sockaddr *sa = (const struct sockaddr *) &r->addrs[idx];
+    struct tcp_attempt_s *a = tlsuv_pool_calloc(sizeof(*a));
+    a->race = r;
+    a->idx = idx;
+    a->req.data = a;
+
+    int rc = uv_tcp_init_ex(r->timer.loop, &a->conn, sa->sa_family);
+    if (rc != 0) {
+        tlsuv_pool_free(a);
+        return rc;
+    }
+
+    // socket buffers have to be set before connect to affect window scaling
+    apply_sockopts(&a->conn, sa->sa_family, &r->src->sockopts);
+
+#if TFO_SUPPORTED
+    // TFO connect completes before SYN-ACK, it would make the first attempt win the race
+    // regardless of the address being reachable. Use it only if there is nothing to race against
+    if (r->src->fast_open && r->addr_count > 1) {
+        UM_LOG(VERB, "TCP Fast Open is not used with %zd addresses to race", r->addr_count);
+    } else if (r->src->fast_open) {
+        uv_os_fd_t fd;
+        int on = 1;
+        if (uv_fileno((const uv_handle_t *) &a->conn, &fd) != 0 ||
+            setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on)) != 0) {
+            // not fatal, connect goes through regular handshake
+            UM_LOG(VERB, "TCP Fast Open is not available");
+        }
+    }
+#endif
+
+    rc = uv_tcp_connect(&a->req, &a->conn, sa, attempt_cb);
+    if (rc != 0) {
+        uv_close((uv_handle_t *) &a->conn, attempt_close_cb);
+        return rc;
+    }
+
+    r->attempts[idx] = a;
+    r->pending++;
+    r->refs++;
+    return 0;
+}
+
+// starts attempt to the next address that accepts it, and arms the timer for the one after
+static int race_next(struct tcp_race_s *r) {
+    while (r->next < r->addr_count) {
+        size_t idx = r->next++;
+        int rc = race_start_attempt(r, idx);
+        if (rc == 0) {
+            UM_LOG(TRACE, "connection attempt %zd/%zd started", idx + 1, r->addr_count);
+            if (r->next < r->addr_count) {
+                uv_timer_start(&r->timer, race_timer_cb, r->src->attempt_delay, 0);
+            }
+            return 0;
+        }
+        UM_LOG(VERB, "connection attempt %zd/%zd failed to start: %d(%s)", idx + 1, r->addr_count, rc, uv_strerror(rc));
+        r->last_err = rc;
+    }
+    return r->last_err;
+}
+
+static void race_timer_cb(uv_timer_t *t) {
+    struct tcp_race_s *r = t->data;
+    if (race_next(r) != 0 && r->pending == 0) {
+        race_fail(r, r->last_err);
+    }
+}
+
+static void attempt_cb(uv_connect_t *req, int status) {
+    struct tcp_attempt_s *a = req->data;
+    struct tcp_race_s *r = a->race;
+    tcp_src_t *sl = r->src;
+
+    r->attempts[a->idx] = NULL;
+    r->pending--;
 
     if (sl == NULL) {
-        UM_LOG(TRACE, "connect requests was cancelled");
-        if (!uv_is_closing((const uv_handle_t *) req->handle))
-            uv_close((uv_handle_t *) req->handle, free_handle);
-        free(req);
+        UM_LOG(TRACE, "connect attempt was cancelled");
+        if (!uv_is_closing((const uv_handle_t *) &a->conn)) {
+            uv_close((uv_handle_t *) &a->conn, attempt_close_cb);
+        }
+        race_unref(r);
         return;
     }
 
-    sl->conn_req = NULL;
-    if (status == UV_ECANCELED) {
-        UM_LOG(TRACE, "connect was cancelled: handle(%p) closing(%d)", req->handle, uv_is_closing((const uv_handle_t *) req->handle));
-        uv_close((uv_handle_t *) req->handle, free_handle);
-        free(req);
+    if (status == 0) {
+        if (sl->timing) sl->timing->connect_end = uv_hrtime();
+        sl->race = NULL;
+        race_end(r, a);
+
+        attach_conn(sl, a);
+        race_unref(r);
+
+        sl->connect_cb((tlsuv_src_t *) sl, 0, sl->connect_ctx);
         return;
     }
 
-    if (status == 0) {
-        sl->conn = (uv_tcp_t *)req->handle;
-        uv_tcp_nodelay(sl->conn, 1);
-        uv_tcp_keepalive(sl->conn, sl->keepalive > 0, sl->keepalive);
+    UM_LOG(VERB, "connection attempt %zd/%zd failed: %d(%s)", a->idx + 1, r->addr_count, status, uv_strerror(status));
+    r->last_err = status;
+    uv_close((uv_handle_t *) &a->conn, attempt_close_cb);
 
-        uv_link_source_init((uv_link_source_t *) sl->link, (uv_stream_t *) sl->conn);
-        sl->link->data = sl;
-    } else {
-        UM_LOG(ERR, "failed to connect: %d(%s)", status, uv_strerror(status));
-        sl->conn = NULL;
-        uv_close((uv_handle_t *) req->handle, free_handle);
+    // do not wait for the timer if attempt failed
+    uv_timer_stop(&r->timer);
+    if (race_next(r) != 0 && r->pending == 0) {
+        race_fail(r, r->last_err);
+    }
+    race_unref(r);
+}
+
+// interleaves address families, starting with the family of the first result (RFC 8305, section 4)
+static void order_addrs(struct sockaddr_storage *ordered, const struct sockaddr_storage *addrs, size_t count) {
+    size_t next[2] = { 0, 0 };
+    int family[2];
+    family[0] = addrs[0].ss_family;
+    family[1] = family[0] == AF_INET6 ? AF_INET : AF_INET6;
+
+    size_t n = 0;
+    int turn = 0;
+    while (n < count) {
+        size_t i = next[turn];
+        while (i < count && addrs[i].ss_family != family[turn]) i++;
+        if (i < count) {
+            ordered[n++] = addrs[i];
+            i++;
+        }
+        next[turn] = i;
+        turn = 1 - turn;
+    }
+}
+
+static int race_start(tcp_src_t *sl, const struct sockaddr_storage *addrs, size_t count) {
+    if (count == 0) {
+        return UV_EAI_NODATA;
     }
 
-    sl->connect_cb((tlsuv_src_t *)sl, status, sl->connect_ctx);
-    free(req);
+    struct tcp_race_s *r = tlsuv_pool_calloc(sizeof(*r) + count * (sizeof(*r->addrs) + sizeof(*r->attempts)));
+    r->addr_count = count;
+    r->addrs = (struct sockaddr_storage *) (r + 1);
+    r->attempts = (struct tcp_attempt_s **) (r->addrs + count);
+    order_addrs(r->addrs, addrs, count);
+    r->src = sl;
+    r->refs = 1;
+    uv_timer_init(sl->loop, &r->timer);
+    r->timer.data = r;
+    sl->race = r;
+
+    int rc = race_next(r);
+    if (rc != 0 && r->pending == 0) {
+        sl->race = NULL;
+        race_end(r, NULL);
+        return rc;
+    }
+    return 0;
 }
 
+struct tcp_resolve_s {
+    uv_getaddrinfo_t req;
+    const char *service;
+    // host and service
+    char names[];
+};
+
 static void resolve_cb(uv_getaddrinfo_t *req, int status, struct addrinfo *addr) {
+    struct tcp_resolve_s *res = (struct tcp_resolve_s *) req;
     tcp_src_t *sl = req->data;
 
+    // result is worth caching even if connect was cancelled
+    tlsuv_dns_cache *cache = tlsuv_dns_cache_get(req->loop);
+    if (cache) {
+        tlsuv_dns_cache_put(cache, res->names, res->service, status, addr);
+    }
+
     if (sl != NULL) {
         UM_LOG(TRACE, "resolved status = %d", status);
-        uv_tcp_t *conn = NULL;
-        if (status == 0) {
-            conn = calloc(1, sizeof(uv_tcp_t));
-            status = uv_tcp_init_ex(req->loop, conn, addr->ai_family);
-        }
+        if (sl->timing) sl->timing->resolve_end = uv_hrtime();
+        sl->resolve_req = NULL;
 
         if (status == 0) {
-            sl->conn_req = calloc(1, sizeof(uv_connect_t));
-            sl->conn_req->data = sl;
-            status = uv_tcp_connect(sl->conn_req, conn, addr->ai_addr, tcp_connect_cb);
+            struct sockaddr_storage *addrs;
+            size_t count = tlsuv_dns_addrs(addr, &addrs);
+            status = race_start(sl, addrs, count);
+            tlsuv__free(addrs);
         }
 
         if (status != 0) {
             UM_LOG(ERR, "connect failed: %d(%s)", status, uv_strerror(status));
             sl->connect_cb((tlsuv_src_t *) sl, status, sl->connect_ctx);
-            if (sl->conn_req) {
-                free(sl->conn_req);
-                sl->conn_req = NULL;
-                if (conn) {
-                    uv_close((uv_handle_t *) conn, free_handle);
-                }
-            }
         }
-
-        sl->resolve_req = NULL;
     }
 
     uv_freeaddrinfo(addr);
-    free(req);
-}
-
-static void free_handle(uv_handle_t *h) {
-    free(h);
-}
-
-static void link_close_cb(uv_link_t *l) {
-    tcp_src_t *tcp = l->data;
-    if (tcp->conn) {
-        free_handle((uv_handle_t *) tcp->conn);
-        tcp->conn = NULL;
-    }
+    tlsuv_pool_free(res);
 }
 
 static int tcp_src_connect(tlsuv_src_t *sl, const char* host, const char *service, tlsuv_src_connect_cb cb, void *ctx) {
@@ -146,21 +520,56 @@ static int tcp_src_connect(tlsuv_src_t *sl, const char* host, const char *servic
     sl->connect_ctx = ctx;
 
     if (tcp->conn) {
-        if (!uv_is_closing((const uv_handle_t *) tcp->conn)) {
-            tcp->link->methods->close(tcp->link, tcp->link, link_close_cb);
-        } else {
-            tcp->conn = NULL;
+        close_conn(tcp, NULL, NULL);
+    }
+
+    if (tcp->race) {
+        struct tcp_race_s *r = tcp->race;
+        tcp->race = NULL;
+        race_end(r, NULL);
+    }
+
+    if (sl->timing) sl->timing->resolve_start = uv_hrtime();
+
+    if (tcp->addr_count > 0) {
+        UM_LOG(DEBG, "connecting to '%s' using %zd preset address(es)", host, tcp->addr_count);
+        if (sl->timing) sl->timing->resolve_end = sl->timing->resolve_start;
+        return race_start(tcp, tcp->addrs, tcp->addr_count);
+    }
+
+    tlsuv_dns_cache *cache = tlsuv_dns_cache_get(sl->loop);
+    if (cache) {
+        struct sockaddr_storage *addrs;
+        size_t count;
+        int rc = tlsuv_dns_cache_lookup(cache, host, service, &addrs, &count);
+        if (rc != UV_EAGAIN) {
+            UM_LOG(DEBG, "using cached resolver result for '%s:%s'", host, service);
+            if (sl->timing) sl->timing->resolve_end = sl->timing->resolve_start;
+            if (rc == 0) {
+                rc = race_start(tcp, addrs, count);
+                tlsuv__free(addrs);
+            }
+            return rc;
         }
     }
 
-    tcp->resolve_req = calloc(1, sizeof(uv_getaddrinfo_t));
+    size_t host_len = strlen(host);
+    struct tcp_resolve_s *res = tlsuv_pool_alloc(sizeof(*res) + host_len + strlen(service) + 2);
+    memset(&res->req, 0, sizeof(res->req));
+    strcpy(res->names, host);
+    res->service = strcpy(res->names + host_len + 1, service);
+    tcp->resolve_req = &res->req;
     tcp->resolve_req->data = tcp;
 
     UM_LOG(DEBG, "resolving '%s:%s'", host, service);
-    int rc = uv_getaddrinfo(sl->loop, tcp->resolve_req, resolve_cb, host, service, NULL);
+    struct addrinfo hints = {
+            .ai_family = AF_UNSPEC,
+            .ai_socktype = SOCK_STREAM,
+    };
+    int rc = uv_getaddrinfo(sl->loop, tcp->resolve_req, resolve_cb, host, service, &hints);
 
     if (rc != 0) {
-        free(tcp->resolve_req);
+        tlsuv_pool_free(res);
         tcp->resolve_req = NULL;
     }
     return rc;
@@ -168,27 +577,56 @@ static int tcp_src_connect(tlsuv_src_t *sl, const char* host, const char *servic
 
 static void tcp_src_cancel(tlsuv_src_t *sl) {
     tcp_src_t *tl = (tcp_src_t*)sl;
-    uv_link_source_t *ts = (uv_link_source_t *) tl->link;
 
     if (tl->resolve_req) {
         tl->resolve_req->data = NULL;
         tl->resolve_req = NULL;
     }
 
-    if (tl->conn_req) {
-        uv_close((uv_handle_t *) tl->conn_req->handle, free_handle);
-        tl->conn_req->data = NULL;
-        tl->conn_req = NULL;
+    if (tl->race) {
+        struct tcp_race_s *r = tl->race;
+        tl->race = NULL;
+        race_end(r, NULL);
     }
 
-    if (tl->conn && !uv_is_closing((const uv_handle_t *) tl->conn)) {
-        ts->methods->close((uv_link_t *) ts, (uv_link_t *) ts, link_close_cb);
+    if (tl->conn) {
+        close_conn(tl, NULL, NULL);
     }
 }
 
 static void tcp_src_release(tlsuv_src_t *sl) {
     tcp_src_t *tcp = (tcp_src_t *) sl;
 
-    free(tcp->conn);
-    tcp->conn = NULL;
+    if (tcp->conn) {
+        close_conn(tcp, NULL, NULL);
+    }
+}
+
+int tcp_src_accept(tcp_src_t *ts, uv_stream_t *server) {
+    if (ts->link == NULL) {
+        return UV_EINVAL;
+    }
+    tcp_src_cancel((tlsuv_src_t *) ts);
+
+    struct tcp_attempt_s *a = tlsuv_pool_calloc(sizeof(*a));
+    int rc = uv_tcp_init(ts->loop, &a->conn);
+    if (rc != 0) {
+        tlsuv_pool_free(a);
+        return rc;
+    }
+
+    rc = uv_accept(server, (uv_stream_t *) &a->conn);
+    if (rc != 0) {
+        uv_close((uv_handle_t *) &a->conn, attempt_close_cb);
+        return rc;
+    }
+
+    struct sockaddr_storage addr;
+    int len = sizeof(addr);
+    if (uv_tcp_getsockname(&a->conn, (struct sockaddr *) &addr, &len) == 0) {
+        apply_sockopts(&a->conn, addr.ss_family, &ts->sockopts);
+    }
+
+    attach_conn(ts, a);
+    return 0;
 }
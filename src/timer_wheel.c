@@ -0,0 +1,276 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdlib.h>
+
+#include "tlsuv/timer_wheel.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// 5 levels of 64 slots with 1ms ticks cover ~12 days, longer timeouts are re-inserted when they reach the last level
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5
+#define WHEEL_MAX_DELTA ((UINT64_C(1) << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+LIST_HEAD(timeout_list, tlsuv_timeout_s);
+
+struct tlsuv_wheel_s {
+    uv_loop_t *loop;
+    uv_timer_t timer;
+    // number of initialized timeouts
+    size_t users;
+    // last processed tick (loop time)
+    uint64_t now;
+    // occupied slots of each level
+    uint64_t occupied[WHEEL_LEVELS];
+    struct timeout_list slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    bool advancing;
+
+    LIST_ENTRY(tlsuv_wheel_s) _next;
+};
+
+static LIST_HEAD(wheels, tlsuv_wheel_s) wheels = LIST_HEAD_INITIALIZER(wheels);
+static uv_mutex_t wheels_lock;
+static uv_once_t wheels_once = UV_ONCE_INIT;
+
+static void init_wheels_lock(void) {
+    uv_mutex_init(&wheels_lock);
+}
+
+static inline int lowest_bit(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (int) i;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+static void wheel_schedule(struct tlsuv_wheel_s *w);
+
+static void wheel_insert(struct tlsuv_wheel_s *w, tlsuv_timeout_t *t) {
+    // timeouts due while cascading go to the current slot, that is processed next
+    uint64_t delta = t->expires > w->now ? t->expires - w->now : 0;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+    }
+    uint64_t expires = w->now + delta;
+
+    // level is picked by distance, slot by expiration tick at that level
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (UINT64_C(1) << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (int) ((expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+    LIST_INSERT_HEAD(&w->slots[level][slot], t, _next);
+    w->occupied[level] |= UINT64_C(1) << slot;
+    t->level = (uint8_t) level;
+    t->slot = (uint8_t) slot;
+}
+
+static void wheel_remove(struct tlsuv_wheel_s *w, tlsuv_timeout_t *t) {
+    LIST_REMOVE(t, _next);
+    if (LIST_EMPTY(&w->slots[t->level][t->slot])) {
+        w->occupied[t->level] &= ~(UINT64_C(1) << t->slot);
+    }
+}
+
+// next tick that needs processing: occupied slot of level 0, or boundary where occupied higher level slot cascades
+static uint64_t wheel_next(const struct tlsuv_wheel_s *w) {
+    uint64_t next = UINT64_MAX;
+    if (w->occupied[0]) {
+        int cur = (int) (w->now & WHEEL_MASK);
+        // slots after current one belong to this round, others to the next one
+        uint64_t ahead = cur == WHEEL_MASK ? 0 : w->occupied[0] & (~UINT64_C(0) << (cur + 1));
+        if (ahead) {
+            next = (w->now & ~(uint64_t) WHEEL_MASK) | lowest_bit(ahead);
+        } else {
+            next = ((w->now | WHEEL_MASK) + 1) | lowest_bit(w->occupied[0]);
+        }
+    }
+
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (w->occupied[level]) {
+            uint64_t mask = (UINT64_C(1) << (WHEEL_BITS * level)) - 1;
+            uint64_t boundary = (w->now | mask) + 1;
+            if (boundary < next) next = boundary;
+            break;
+        }
+    }
+    return next;
+}
+
+// moves timeouts of the current higher level slots down as lower level wraps around
+static void wheel_cascade(struct tlsuv_wheel_s *w) {
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int slot = (int) ((w->now >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        struct timeout_list *l = &w->slots[level][slot];
+        w->occupied[level] &= ~(UINT64_C(1) << slot);
+        while (!LIST_EMPTY(l)) {
+            tlsuv_timeout_t *t = LIST_FIRST(l);
+            LIST_REMOVE(t, _next);
+            wheel_insert(w, t);
+        }
+
+        // next level only wraps when this one does
+        if (slot != 0) break;
+    }
+}
+
+static void wheel_run_slot(struct tlsuv_wheel_s *w, int slot) {
+    struct timeout_list *l = &w->slots[0][slot];
+    while (!LIST_EMPTY(l)) {
+        tlsuv_timeout_t *t = LIST_FIRST(l);
+        wheel_remove(w, t);
+        if (t->expires > w->now) { // beyond wheel range when it was started
+            wheel_insert(w, t);
+            continue;
+        }
+        t->active = false;
+        t->cb(t);
+    }
+}
+
+static void wheel_advance(struct tlsuv_wheel_s *w, uint64_t target) {
+    w->advancing = true;
+    while (w->now < target) {
+        uint64_t next = wheel_next(w);
+        if (next > target) {
+            w->now = target;
+            break;
+        }
+
+        w->now = next;
+        if ((next & WHEEL_MASK) == 0) {
+            wheel_cascade(w);
+        }
+        wheel_run_slot(w, (int) (next & WHEEL_MASK));
+    }
+    w->advancing = false;
+}
+
+static void wheel_timer_cb(uv_timer_t *timer) {
+    struct tlsuv_wheel_s *w = timer->data;
+    wheel_advance(w, uv_now(w->loop));
+    wheel_schedule(w);
+}
+
+static void wheel_schedule(struct tlsuv_wheel_s *w) {
+    if (w->advancing) { // rescheduled once timer callback is done
+        return;
+    }
+
+    uint64_t next = wheel_next(w);
+    if (next == UINT64_MAX) {
+        uv_timer_stop(&w->timer);
+        return;
+    }
+
+    uint64_t now = uv_now(w->loop);
+    uv_timer_start(&w->timer, wheel_timer_cb, next > now ? next - now : 0, 0);
+}
+
+static struct tlsuv_wheel_s *wheel_get(uv_loop_t *loop) {
+    uv_once(&wheels_once, init_wheels_lock);
+
+    struct tlsuv_wheel_s *w;
+    uv_mutex_lock(&wheels_lock);
+    LIST_FOREACH(w, &wheels, _next) {
+        if (w->loop == loop) break;
+    }
+
+    if (w == NULL) {
+        w = tlsuv__calloc(1, sizeof(*w));
+        w->loop = loop;
+        w->now = uv_now(loop);
+        uv_timer_init(loop, &w->timer);
+        uv_unref((uv_handle_t *) &w->timer);
+        w->timer.data = w;
+        LIST_INSERT_HEAD(&wheels, w, _next);
+    }
+    uv_mutex_unlock(&wheels_lock);
+    return w;
+}
+
+int tlsuv_timeout_init(uv_loop_t *loop, tlsuv_timeout_t *t) {
+    t->wheel = wheel_get(loop);
+    t->wheel->users++;
+    t->cb = NULL;
+    t->active = false;
+    return 0;
+}
+
+int tlsuv_timeout_start(tlsuv_timeout_t *t, tlsuv_timeout_cb cb, uint64_t millis) {
+    struct tlsuv_wheel_s *w = t->wheel;
+    if (w == NULL || cb == NULL) {
+        return UV_EINVAL;
+    }
+
+    if (t->active) {
+        wheel_remove(w, t);
+    }
+
+    // wheel may lag behind loop time, it catches up before the timeout could fire
+    t->expires = uv_now(w->loop) + millis;
+    if (t->expires <= w->now) {
+        t->expires = w->now + 1;
+    }
+    t->cb = cb;
+    t->active = true;
+    wheel_insert(w, t);
+    wheel_schedule(w);
+    return 0;
+}
+
+void tlsuv_timeout_stop(tlsuv_timeout_t *t) {
+    if (t->wheel && t->active) {
+        wheel_remove(t->wheel, t);
+        t->active = false;
+    }
+}
+
+bool tlsuv_timeout_active(const tlsuv_timeout_t *t) {
+    return t->wheel && t->active;
+}
+
+static void wheel_closed(uv_handle_t *h) {
+    tlsuv__free(h->data);
+}
+
+void tlsuv_timeout_close(tlsuv_timeout_t *t) {
+    struct tlsuv_wheel_s *w = t->wheel;
+    if (w == NULL) {
+        return;
+    }
+
+    tlsuv_timeout_stop(t);
+    t->wheel = NULL;
+    if (--w->users == 0) {
+        uv_mutex_lock(&wheels_lock);
+        LIST_REMOVE(w, _next);
+        uv_mutex_unlock(&wheels_lock);
+        uv_close((uv_handle_t *) &w->timer, wheel_closed);
+    }
+}
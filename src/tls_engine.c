@@ -12,8 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+
 #include <tlsuv/tls_engine.h>
+#include <tlsuv/queue.h>
+#include "atomics.h"
+#include "tls_trace.h"
 #include "um_debug.h"
+#include "win32_compat.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
 
 #ifdef USE_MBEDTLS
 extern tls_context* new_mbedtls_ctx(const char* ca, size_t ca_len);
@@ -35,4 +46,480 @@ tls_context *default_tls_context(const char *ca, size_t ca_len) {
         return NULL;
     }
     return factory(ca, ca_len);
-}
\ No newline at end of file
+}
+enum async_op {
+    op_generate_key,
+    op_generate_pkcs11_key,
+    op_generate_csr,
+    op_parse_pkcs7,
+};
+
+struct tls_async_job_s {
+    uv_work_t req;
+    enum async_op op;
+    tls_context *ctx;
+    tlsuv_async_cb cb;
+    void *data;
+    int status;
+
+    // copied arguments
+    char *args[2 * TLSUV_CSR_MAX_SUBJECT + 1];
+    char *buf;
+    size_t buf_len;
+    tlsuv_private_key_t in_key;
+
+    // results, handed to the caller on the loop thread
+    tlsuv_private_key_t key;
+    char *pem;
+    size_t pem_len;
+    tls_cert chain;
+
+    // caller's output parameters
+    tlsuv_private_key_t *out_key;
+    char **out_pem;
+    size_t *out_pem_len;
+    tls_cert *out_chain;
+};
+
+static void job_free(struct tls_async_job_s *job) {
+    for (size_t i = 0; i < sizeof(job->args) / sizeof(job->args[0]); i++) {
+        tlsuv__free(job->args[i]);
+    }
+    tlsuv__free(job->buf);
+    tlsuv__free(job);
+}
+
+static void async_work(uv_work_t *req) {
+    struct tls_async_job_s *job = req->data;
+    tls_context_api *api = job->ctx->api;
+    char **a = job->args;
+
+    switch (job->op) {
+        case op_generate_key:
+            job->status = api->generate_key(&job->key);
+            break;
+        case op_generate_pkcs11_key:
+            job->status = api->generate_pkcs11_key(&job->key, a[0], a[1], a[2], a[3]);
+            break;
+        case op_generate_csr:
+            // unused pairs are NULL and terminate the list
+            job->status = api->generate_csr_to_pem(job->in_key, &job->pem, &job->pem_len,
+                                                   a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7],
+                                                   a[8], a[9], a[10], a[11], a[12], a[13], a[14], a[15],
+                                                   NULL);
+            break;
+        case op_parse_pkcs7:
+            job->status = api->parse_pkcs7_certs(&job->chain, job->buf, job->buf_len);
+            break;
+    }
+}
+
+static void async_done(uv_work_t *req, int status) {
+    struct tls_async_job_s *job = req->data;
+    if (status == UV_ECANCELED) {
+        job->status = UV_ECANCELED;
+    } else if (job->status == 0) {
+        if (job->out_key) *job->out_key = job->key;
+        if (job->out_pem) *job->out_pem = job->pem;
+        if (job->out_pem_len) *job->out_pem_len = job->pem_len;
+        if (job->out_chain) *job->out_chain = job->chain;
+    }
+
+    if (job->cb) {
+        job->cb(job->status, job->data);
+    }
+
+    job_free(job);
+}
+
+static struct tls_async_job_s *async_job(tls_context *ctx, enum async_op op, tlsuv_async_cb cb, void *data) {
+    struct tls_async_job_s *job = tlsuv__calloc(1, sizeof(*job));
+    job->req.data = job;
+    job->op = op;
+    job->ctx = ctx;
+    job->cb = cb;
+    job->data = data;
+    return job;
+}
+
+static int async_queue(uv_loop_t *loop, struct tls_async_job_s *job) {
+    int rc = uv_queue_work(loop, &job->req, async_work, async_done);
+    if (rc != 0) {
+        UM_LOG(WARN, "failed to queue TLS work: %d(%s)", rc, uv_strerror(rc));
+        job_free(job);
+    }
+    return rc;
+}
+
+int tlsuv_generate_key_async(uv_loop_t *loop, tls_context *ctx, tlsuv_private_key_t *pk,
+                             tlsuv_async_cb cb, void *data) {
+    if (loop == NULL || ctx == NULL || pk == NULL) {
+        return UV_EINVAL;
+    }
+    if (ctx->api->generate_key == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    struct tls_async_job_s *job = async_job(ctx, op_generate_key, cb, data);
+    job->out_key = pk;
+    return async_queue(loop, job);
+}
+
+int tlsuv_generate_pkcs11_key_async(uv_loop_t *loop, tls_context *ctx, tlsuv_private_key_t *pk,
+                                    const char *pkcs11driver, const char *slot, const char *pin, const char *label,
+                                    tlsuv_async_cb cb, void *data) {
+    if (loop == NULL || ctx == NULL || pk == NULL) {
+        return UV_EINVAL;
+    }
+    if (ctx->api->generate_pkcs11_key == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    struct tls_async_job_s *job = async_job(ctx, op_generate_pkcs11_key, cb, data);
+    job->out_key = pk;
+    job->args[0] = pkcs11driver ? tlsuv__strdup(pkcs11driver) : NULL;
+    job->args[1] = slot ? tlsuv__strdup(slot) : NULL;
+    job->args[2] = pin ? tlsuv__strdup(pin) : NULL;
+    job->args[3] = label ? tlsuv__strdup(label) : NULL;
+    return async_queue(loop, job);
+}
+
+int tlsuv_generate_csr_to_pem_async(uv_loop_t *loop, tls_context *ctx, tlsuv_private_key_t pk,
+                                    char **pem, size_t *pemlen, tlsuv_async_cb cb, void *data, ...) {
+    if (loop == NULL || ctx == NULL || pk == NULL || pem == NULL) {
+        return UV_EINVAL;
+    }
+    if (ctx->api->generate_csr_to_pem == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    struct tls_async_job_s *job = async_job(ctx, op_generate_csr, cb, data);
+    job->in_key = pk;
+    job->out_pem = pem;
+    job->out_pem_len = pemlen;
+
+    va_list va;
+    va_start(va, data);
+    size_t n = 0;
+    while (true) {
+        const char *id = va_arg(va, const char *);
+        if (id == NULL) break;
+        const char *val = va_arg(va, const char *);
+        if (val == NULL) break;
+
+        if (n == 2 * TLSUV_CSR_MAX_SUBJECT) {
+            va_end(va);
+            UM_LOG(WARN, "too many CSR subject entries, max is %d", TLSUV_CSR_MAX_SUBJECT);
+            job_free(job);
+            return UV_EINVAL;
+        }
+        job->args[n++] = tlsuv__strdup(id);
+        job->args[n++] = tlsuv__strdup(val);
+    }
+    va_end(va);
+    return async_queue(loop, job);
+}
+
+int tlsuv_parse_pkcs7_certs_async(uv_loop_t *loop, tls_context *ctx, tls_cert *chain,
+                                  const char *pkcs7, size_t pkcs7len, tlsuv_async_cb cb, void *data) {
+    if (loop == NULL || ctx == NULL || chain == NULL || pkcs7 == NULL) {
+        return UV_EINVAL;
+    }
+    if (ctx->api->parse_pkcs7_certs == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    struct tls_async_job_s *job = async_job(ctx, op_parse_pkcs7, cb, data);
+    job->out_chain = chain;
+    // NUL terminated copy, engines may read the input as a string
+    job->buf = tlsuv__malloc(pkcs7len + 1);
+    memcpy(job->buf, pkcs7, pkcs7len);
+    job->buf[pkcs7len] = '\0';
+    job->buf_len = pkcs7len;
+    return async_queue(loop, job);
+}
+
+// workers are started on demand and kept for later batches, thread start costs more than a signature check
+#define VERIFY_POOL_MAX 16
+
+struct verify_batch_s {
+    // chunks not finished yet, guarded by pool lock
+    size_t pending;
+    uv_cond_t done;
+};
+
+struct verify_chunk_s {
+    tlsuv_public_key_t pk;
+    enum hash_algo md;
+    const tlsuv_verify_item *items;
+    size_t count;
+    int *results;
+    int rc;
+
+    struct verify_batch_s *batch;
+    STAILQ_ENTRY(verify_chunk_s) _next;
+};
+
+static struct {
+    uv_once_t once;
+    uv_mutex_t lock;
+    uv_cond_t work;
+    STAILQ_HEAD(verify_queue_s, verify_chunk_s) queue;
+    unsigned int workers;
+    uv_thread_t threads[VERIFY_POOL_MAX];
+} verify_pool = {
+        .once = UV_ONCE_INIT,
+};
+
+static void verify_pool_init(void) {
+    uv_mutex_init(&verify_pool.lock);
+    uv_cond_init(&verify_pool.work);
+    STAILQ_INIT(&verify_pool.queue);
+}
+
+static void verify_chunk(struct verify_chunk_s *c) {
+    if (c->pk->verify_many) {
+        c->rc = c->pk->verify_many(c->pk, c->md, c->items, c->count, c->results);
+        return;
+    }
+
+    c->rc = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        const tlsuv_verify_item *it = &c->items[i];
+        c->results[i] = c->pk->verify(c->pk, c->md, it->data, it->datalen, it->sig, it->siglen) == 0 ? 0 : -1;
+        if (c->results[i] != 0) {
+            c->rc = -1;
+        }
+    }
+}
+
+// runs queued chunk, called and returns with pool lock held
+static void verify_run_next(void) {
+    struct verify_chunk_s *c = STAILQ_FIRST(&verify_pool.queue);
+    STAILQ_REMOVE_HEAD(&verify_pool.queue, _next);
+    uv_mutex_unlock(&verify_pool.lock);
+
+    verify_chunk(c);
+
+    uv_mutex_lock(&verify_pool.lock);
+    if (--c->batch->pending == 0) {
+        uv_cond_signal(&c->batch->done);
+    }
+}
+
+static void verify_worker(void *arg) {
+    uv_mutex_lock(&verify_pool.lock);
+    for (;;) {
+        while (STAILQ_EMPTY(&verify_pool.queue)) {
+            uv_cond_wait(&verify_pool.work, &verify_pool.lock);
+        }
+        verify_run_next();
+    }
+}
+
+int tlsuv_pubkey_verify_parallel(tlsuv_public_key_t pk, enum hash_algo md,
+                                 const tlsuv_verify_item *items, size_t count, int *results, unsigned int threads) {
+    if (pk == NULL || (items == NULL && count > 0) || (results == NULL && count > 0)) {
+        return -1;
+    }
+
+    size_t chunks = count / TLSUV_VERIFY_MIN_CHUNK;
+    if (chunks > threads) chunks = threads;
+    if (chunks > VERIFY_POOL_MAX + 1) chunks = VERIFY_POOL_MAX + 1;
+    if (chunks < 1) chunks = 1;
+
+    struct verify_chunk_s *work = tlsuv__calloc(chunks, sizeof(*work));
+    size_t per_chunk = count / chunks;
+    size_t off = 0;
+    for (size_t i = 0; i < chunks; i++) {
+        work[i].pk = pk;
+        work[i].md = md;
+        work[i].items = items + off;
+        work[i].count = (i == chunks - 1) ? count - off : per_chunk;
+        work[i].results = results + off;
+        off += work[i].count;
+    }
+
+    if (chunks > 1) {
+        struct verify_batch_s batch = { .pending = chunks - 1 };
+        uv_cond_init(&batch.done);
+
+        uv_once(&verify_pool.once, verify_pool_init);
+        uv_mutex_lock(&verify_pool.lock);
+        while (verify_pool.workers < chunks - 1) {
+            if (uv_thread_create(&verify_pool.threads[verify_pool.workers], verify_worker, NULL) != 0) {
+                UM_LOG(WARN, "failed to start verify thread, verifying on calling thread");
+                break;
+            }
+            verify_pool.workers++;
+        }
+        for (size_t i = 0; i < chunks - 1; i++) {
+            work[i].batch = &batch;
+            STAILQ_INSERT_TAIL(&verify_pool.queue, &work[i], _next);
+        }
+        uv_cond_broadcast(&verify_pool.work);
+        uv_mutex_unlock(&verify_pool.lock);
+
+        // last chunk runs on the calling thread, then it helps with queued chunks until its batch is done
+        verify_chunk(&work[chunks - 1]);
+
+        uv_mutex_lock(&verify_pool.lock);
+        while (batch.pending > 0) {
+            if (!STAILQ_EMPTY(&verify_pool.queue)) {
+                verify_run_next();
+            } else {
+                uv_cond_wait(&batch.done, &verify_pool.lock);
+            }
+        }
+        uv_mutex_unlock(&verify_pool.lock);
+        uv_cond_destroy(&batch.done);
+    } else {
+        verify_chunk(&work[0]);
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < chunks; i++) {
+        if (work[i].rc != 0) {
+            rc = -1;
+        }
+    }
+    tlsuv__free(work);
+    return rc;
+}
+
+static uv_once_t trace_once = UV_ONCE_INIT;
+static uv_mutex_t trace_lock;
+static int64_t trace_gen;
+static bool trace_on;
+static char *trace_filter;
+static tlsuv_trace_cb trace_cb;
+static void *trace_data;
+
+static void trace_init(void) {
+    uv_mutex_init(&trace_lock);
+    if (getenv("TLS_DEBUG")) {
+        trace_on = true;
+        trace_gen = 1;
+    }
+}
+
+int tlsuv_trace_enable(const char *host_filter, tlsuv_trace_cb cb, void *data) {
+    uv_once(&trace_once, trace_init);
+    uv_mutex_lock(&trace_lock);
+    tlsuv__free(trace_filter);
+    trace_filter = host_filter ? tlsuv__strdup(host_filter) : NULL;
+    trace_cb = cb;
+    trace_data = data;
+    trace_on = true;
+    tlsuv_atomic_add(&trace_gen, 1);
+    uv_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+void tlsuv_trace_disable(void) {
+    uv_once(&trace_once, trace_init);
+    uv_mutex_lock(&trace_lock);
+    tlsuv__free(trace_filter);
+    trace_filter = NULL;
+    trace_cb = NULL;
+    trace_data = NULL;
+    trace_on = false;
+    tlsuv_atomic_add(&trace_gen, 1);
+    uv_mutex_unlock(&trace_lock);
+}
+
+int64_t tls_trace_generation(void) {
+    uv_once(&trace_once, trace_init);
+    return tlsuv_atomic_load(&trace_gen);
+}
+
+static bool host_match(const char *filter, const char *host) {
+    if (filter == NULL) {
+        return true;
+    }
+    if (host == NULL) {
+        return false;
+    }
+    if (filter[0] == '*') {
+        size_t flen = strlen(filter + 1);
+        size_t hlen = strlen(host);
+        return hlen > flen && strcasecmp(host + hlen - flen, filter + 1) == 0;
+    }
+    return strcasecmp(filter, host) == 0;
+}
+
+bool tls_trace_match(const char *host) {
+    uv_once(&trace_once, trace_init);
+    uv_mutex_lock(&trace_lock);
+    bool match = trace_on && host_match(trace_filter, host);
+    uv_mutex_unlock(&trace_lock);
+    return match;
+}
+
+static const char *content_type_name(int t) {
+    switch (t) {
+        case 20: return "ChangeCipherSpec";
+        case 21: return "Alert";
+        case 22: return "Handshake";
+        case 23: return "ApplicationData";
+        default: return "Unknown";
+    }
+}
+
+static const char *handshake_name(int t) {
+    switch (t) {
+        case 0: return "HelloRequest";
+        case 1: return "ClientHello";
+        case 2: return "ServerHello";
+        case 4: return "NewSessionTicket";
+        case 5: return "EndOfEarlyData";
+        case 8: return "EncryptedExtensions";
+        case 11: return "Certificate";
+        case 12: return "ServerKeyExchange";
+        case 13: return "CertificateRequest";
+        case 14: return "ServerHelloDone";
+        case 15: return "CertificateVerify";
+        case 16: return "ClientKeyExchange";
+        case 20: return "Finished";
+        case 22: return "CertificateStatus";
+        case 24: return "KeyUpdate";
+        default: return "???";
+    }
+}
+
+static void trace_log(const tlsuv_trace_event *ev) {
+    const char *dir = ev->outgoing ? ">>>" : "<<<";
+    const char *host = ev->host ? ev->host : "-";
+    switch (ev->type) {
+        case tlsuv_TRACE_RECORD:
+            if (ev->content_type == 22) {
+                UM_LOG(TRACE, "tls[%s] %s %04x %s %s [length %zu]", host, dir, ev->version,
+                       content_type_name(ev->content_type), handshake_name(ev->msg_type), ev->length);
+            } else {
+                UM_LOG(TRACE, "tls[%s] %s %04x %s [length %zu]", host, dir, ev->version,
+                       content_type_name(ev->content_type), ev->length);
+            }
+            break;
+        case tlsuv_TRACE_ALERT:
+            UM_LOG(TRACE, "tls[%s] %s alert %s:%d", host, dir,
+                   ev->alert_level == 2 ? "fatal" : "warning", ev->msg_type);
+            break;
+        case tlsuv_TRACE_STATE:
+            UM_LOG(TRACE, "tls[%s] %s", host, ev->state ? ev->state : "");
+            break;
+    }
+}
+
+void tls_trace_emit(const tlsuv_trace_event *ev) {
+    uv_mutex_lock(&trace_lock);
+    tlsuv_trace_cb cb = trace_on ? trace_cb : NULL;
+    void *data = trace_data;
+    bool on = trace_on;
+    uv_mutex_unlock(&trace_lock);
+
+    if (cb) {
+        cb(ev, data);
+    } else if (on) {
+        trace_log(ev);
+    }
+}
@@ -13,10 +13,19 @@
 // limitations under the License.
 
 
+#include <stdlib.h>
+#include <string.h>
 #include <uv_link_t.h>
 #include <tlsuv/tls_engine.h>
 #include "tlsuv/tls_link.h"
+#include "tlsuv/timing.h"
 #include "um_debug.h"
+#include "pool.h"
+#include "read_sizing.h"
+#include "tlsuv/queue.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
 
 static int tls_read_start(uv_link_t *l);
 static void tls_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf);
@@ -28,6 +37,7 @@ static void tls_close(uv_link_t *link, uv_link_t *source, uv_link_close_cb cb);
 static const uv_link_methods_t tls_methods = {
         .close = tls_close,
         .read_start = tls_read_start,
+        .read_stop = uv_link_default_read_stop,
         .write = tls_write,
         .alloc_cb_override = tls_alloc,
         .read_cb_override = tls_read_cb
@@ -37,50 +47,174 @@ typedef struct tls_link_write_s {
     char *tls_buf;
     uv_link_write_cb cb;
     void *ctx;
+    // link the write came from, passed to `cb`
+    uv_link_t *source;
 
 } tls_link_write_t;
 
+// handshake step running on threadpool
+struct tls_hs_job_s {
+    uv_work_t req;
+    tls_link_t *tls;
+    tls_handshake_state st;
+
+    char *in;
+    size_t in_len;
+    uv_buf_t out;
+
+    // peer data and read error received while step was running
+    char *pending;
+    size_t pending_len;
+    ssize_t read_err;
+
+    // set if link was closed while step was running
+    uv_link_close_cb close_cb;
+    uv_link_t *close_source;
+};
+
+// write waiting for, or going through bulk encryption
+struct tls_crypto_write_s {
+    STAILQ_ENTRY(tls_crypto_write_s) next;
+    tls_link_write_t *wr;
+    uv_stream_t *send_handle;
+
+    // ciphertext segments, first one is part of `wr`
+    uv_buf_t out[2];
+    unsigned int nout;
+    int rc;
+    // set when encrypted by worker, otherwise done on the loop thread
+    int done;
+
+    // caller's buffers stay valid until write callback
+    unsigned int nbufs;
+    uv_buf_t bufs[];
+};
+
+// batch of bulk application data processed on threadpool
+struct tls_crypto_job_s {
+    uv_work_t req;
+    tls_link_t *tls;
+
+    // writes in submission order
+    STAILQ_HEAD(tls_crypto_writes_s, tls_crypto_write_s) writes;
+
+    // plaintext bytes of queued writes
+    size_t out_len;
+
+    // peer ciphertext, and plaintext it produced
+    char *in;
+    size_t in_len;
+    char *plain;
+    size_t plain_len;
+    size_t plain_cap;
+    enum TLS_RESULT read_rc;
+    // read error received after ciphertext
+    ssize_t read_err;
+
+    // set if link was closed while batch was running
+    uv_link_close_cb close_cb;
+    uv_link_t *close_source;
+};
+
 static const int TLS_BUF_SZ = 32 * 1024;
 
+static void scan_records(struct tls_record_scan_s *scan, unsigned long *count, const char *p, size_t len) {
+    while (len > 0) {
+        if (scan->left > 0) {
+            size_t n = len < scan->left ? len : scan->left;
+            scan->left -= n;
+            p += n;
+            len -= n;
+            continue;
+        }
+
+        scan->hdr[scan->hdr_len++] = (unsigned char) *p++;
+        len--;
+        if (scan->hdr_len == sizeof(scan->hdr)) {
+            scan->left = ((size_t) scan->hdr[3] << 8) | scan->hdr[4];
+            scan->hdr_len = 0;
+            (*count)++;
+        }
+    }
+}
+
+static void count_in(tls_link_t *tls, const char *p, size_t len) {
+    if (tls->stats) {
+        tls->stats->cipher_in += len;
+        scan_records(&tls->rec_in, &tls->stats->records_in, p, len);
+    }
+}
+
+static void count_out(tls_link_t *tls, const uv_buf_t *bufs, unsigned int nbufs) {
+    if (tls->stats) {
+        for (unsigned int i = 0; i < nbufs; i++) {
+            tls->stats->cipher_out += bufs[i].len;
+            scan_records(&tls->rec_out, &tls->stats->records_out, bufs[i].base, bufs[i].len);
+        }
+    }
+}
+
+static void *tls_buf_alloc(tls_link_t *tls, size_t len) {
+    if (tls->stats) {
+        tls->stats->buffer_allocs++;
+    }
+    return tlsuv_pool_alloc(len);
+}
+
+// max plaintext per TLS record, and upper bound of per record overhead (header, IV, MAC/tag, padding)
+#define TLS_RECORD_SZ (16 * 1024)
+#define TLS_RECORD_OVERHEAD 96
+
+/*
+ * Data from TLS peer is always read into link owned buffer.
+ * Application data is decrypted from it directly into buffer(s) provided by the child link,
+ * so the child never receives ciphertext in its buffers. Child buffer left empty (partial record) is passed back with nread == 0.
+ */
 void tls_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf) {
     tls_link_t *tls_link = (tls_link_t *) l;
-    tls_handshake_state st = tls_link->engine->api->handshake_state(tls_link->engine->engine);
-    switch (st) {
-        case TLS_HS_BEFORE:
-        case TLS_HS_CONTINUE:
-            buf->base = malloc(suggested);
-            buf->len = suggested;
-            break;
-        case TLS_HS_COMPLETE:
-            uv_link_propagate_alloc_cb(l, suggested, buf);
-            break;
-        default:
+    // engine must not be touched while handshake step or crypto batch is running
+    if (tls_link->hs_job == NULL && tls_link->crypto_job == NULL) {
+        tls_handshake_state st = tls_link->engine->api->handshake_state(tls_link->engine->engine);
+        if (st == TLS_HS_ERROR) {
             UM_LOG(ERR, "TLS(%p) in bad state", tls_link);
-            break;
+        }
+    }
+
+    if (tls_link->ssl_buf == NULL) {
+        if (tls_link->stats) {
+            tls_link->stats->buffer_allocs++;
+        }
+        tls_link->ssl_buf = tlsuv_pool_read_alloc(read_sizer_size(&tls_link->read_size), &tls_link->ssl_buf_len);
     }
+    buf->base = tls_link->ssl_buf;
+    buf->len = tls_link->ssl_buf ? tls_link->ssl_buf_len : 0;
 }
 
 static void tls_write_free_cb(uv_link_t *source, int status, void *arg) {
     if (arg)
-        free(arg);
+        tlsuv_pool_free(arg);
 }
 
 static void tls_write_cb(uv_link_t *source, int status, void *arg) {
     tls_link_write_t *wr = arg;
-    uv_link_t *tls_link = source->child;
     if (wr->cb) {
-        wr->cb(tls_link, status, wr->ctx);
+        wr->cb(wr->source, status, wr->ctx);
     }
 
     if (wr->tls_buf) {
-        free(wr->tls_buf);
+        tlsuv_pool_free(wr->tls_buf);
     }
-    free(wr);
+    tlsuv_pool_free(wr);
 }
 
 static int tls_read_start(uv_link_t *l) {
     tls_link_t *tls = (tls_link_t *) l;
 
+    if (tls->hs_started) {
+        UM_LOG(TRACE, "TLS(%p) resuming read", tls);
+        return uv_link_default_read_start(l);
+    }
+
     tls_handshake_state st = tls->engine->api->handshake_state(tls->engine->engine);
     UM_LOG(TRACE, "TLS(%p) starting handshake(st = %d)", tls, st);
     if (st == TLS_HS_CONTINUE) {
@@ -90,183 +224,798 @@ static int tls_read_start(uv_link_t *l) {
         }
     }
 
+    tls->ktls_tx = 0;
+    tls->hs_started = 1;
     uv_link_default_read_start(l);
 
     uv_buf_t buf;
-    buf.base = malloc(TLS_BUF_SZ);
+    buf.base = tls_buf_alloc(tls, TLS_BUF_SZ);
     st = tls->engine->api->handshake(tls->engine->engine, NULL, 0, buf.base, &buf.len,
                                                          TLS_BUF_SZ);
     UM_LOG(TRACE, "TLS(%p) starting handshake(sending %zd bytes, st = %d)", tls, buf.len, st);
+    count_out(tls, &buf, 1);
 
-    tls_link_write_t *wr = calloc(1, sizeof(tls_link_write_t));
+    tls_link_write_t *wr = tlsuv_pool_calloc(sizeof(tls_link_write_t));
     wr->tls_buf = buf.base;
     return uv_link_propagate_write(l->parent, l, &buf, 1, NULL, tls_write_cb, wr);
 }
 
+static void tls_flush_pending(tls_link_t *tls) {
+    uv_link_t *l = (uv_link_t *) tls;
+    uv_buf_t buf;
+    buf.base = tls_buf_alloc(tls, TLS_BUF_SZ);
+    tls->engine->api->write(tls->engine->engine, NULL, 0, buf.base, &buf.len, TLS_BUF_SZ);
+    if (buf.len == 0) {
+        tlsuv_pool_free(buf.base);
+        return;
+    }
+    count_out(tls, &buf, 1);
+    int rc = uv_link_propagate_write(l->parent, l, &buf, 1, NULL, tls_write_free_cb, buf.base);
+    if (rc != 0) {
+        UM_LOG(WARN, "TLS(%p) failed to write pending data: %d(%s)", tls, rc, uv_strerror(rc));
+    }
+}
+
+// decrypts application data, `inptr` may be NULL to process data already buffered in the engine
+static void tls_process_data(tls_link_t *tls, const char *inptr, size_t inlen) {
+    uv_link_t *l = (uv_link_t *) tls;
+    UM_LOG(TRACE, "TLS(%p) processing %zd bytes", tls, inlen);
+
+    // application data buffer from child link, filled up before passing it on
+    uv_buf_t out = uv_buf_init(NULL, 0);
+    size_t out_len = 0;
+
+    enum TLS_RESULT rc = TLS_MORE_AVAILABLE;
+    while(rc == TLS_MORE_AVAILABLE || rc == TLS_READ_AGAIN) {
+        if (out.base == NULL) {
+            uv_link_propagate_alloc_cb(l, TLS_BUF_SZ, &out);
+            if (out.base == NULL || out.len == 0) {
+                uv_link_propagate_read_cb(l, UV_ENOBUFS, &out);
+                return;
+            }
+            out_len = 0;
+        }
+
+        size_t out_bytes = 0;
+        rc = tls->engine->api->read(tls->engine->engine, inptr, inlen,
+                                    out.base + out_len, &out_bytes, out.len - out_len);
+        UM_LOG(TRACE, "TLS(%p) produced %zd application byte (rc=%d)", tls, out_bytes, rc);
+        inptr = NULL;
+        inlen = 0;
+        out_len += out_bytes;
+        if (tls->stats) {
+            tls->stats->plain_in += out_bytes;
+            if (rc == TLS_HAS_WRITE) {
+                tls->stats->has_write++;
+            }
+        }
+
+        switch (rc) {
+            case TLS_READ_AGAIN:
+            case TLS_MORE_AVAILABLE: {
+                if (out_len < out.len) {
+                    // keep filling current buffer
+                    break;
+                }
+                uv_link_propagate_read_cb(l, (ssize_t) out_len, &out);
+                out = uv_buf_init(NULL, 0);
+                if (l->child == NULL) { // closed by the reader
+                    return;
+                }
+                break;
+            }
+            case TLS_HAS_WRITE:
+                tls_flush_pending(tls);
+                // fall through
+            case TLS_OK: {
+                uv_link_propagate_read_cb(l, (ssize_t) out_len, &out);
+                break;
+            }
+            case TLS_EOF: {
+                if (out_len > 0) {
+                    uv_link_propagate_read_cb(l, (ssize_t) out_len, &out);
+                    out = uv_buf_init(NULL, 0);
+                }
+                uv_link_propagate_read_cb(l, UV_EOF, &out);
+                break;
+            }
+            case TLS_ERR:
+            default:
+                if (out_len > 0) {
+                    uv_link_propagate_read_cb(l, (ssize_t) out_len, &out);
+                    out = uv_buf_init(NULL, 0);
+                }
+                if (rc != TLS_ERR) {
+                    UM_LOG(ERR, "aborting after unexpected TLS engine result: %d", rc);
+                } else {
+                    UM_LOG(ERR, "aborting after TLS engine error: %s", tls->engine->api->strerror(tls->engine->engine));
+                }
+                uv_link_propagate_read_cb(l, UV_ECONNABORTED, &out);
+                break;
+        }
+    }
+}
+
+static void tls_hs_result(tls_link_t *tls, tls_handshake_state st, uv_buf_t *buf) {
+    uv_link_t *l = (uv_link_t *) tls;
+
+    if (tls->timing && st == TLS_HS_COMPLETE) {
+        tls->timing->hs_complete = uv_hrtime();
+    }
+
+    UM_LOG(TRACE, "TLS(%p) continuing handshake(sending %zd bytes, st = %d)", tls, buf->len, st);
+    if (tls->stats) {
+        if (st == TLS_HS_COMPLETE) tls->stats->handshakes++;
+        if (st == TLS_HS_ERROR) tls->stats->handshake_failures++;
+    }
+    if (buf->len > 0) {
+        count_out(tls, buf, 1);
+        tls_link_write_t *wr = tlsuv_pool_calloc(sizeof(tls_link_write_t));
+        wr->tls_buf = buf->base;
+        int rc = uv_link_propagate_write(l->parent, l, buf, 1, NULL, tls_write_cb, wr);
+        if (rc != 0) {
+            UM_LOG(WARN, "TLS(%p) failed to write during handshake %d(%s)", tls, rc, uv_strerror(rc));
+            tls_write_cb(l->parent, rc, wr);
+        }
+    }
+    else {
+        tlsuv_pool_free(buf->base);
+    }
+
+    if (st == TLS_HS_COMPLETE) {
+        UM_LOG(TRACE, "TLS(%p) handshake completed", tls);
+        tls->hs_cb(tls, TLS_HS_COMPLETE);
+
+        // peer data may follow its last handshake flight in the same read (e.g. response to early data)
+        if (l->child && tls->engine->api->handshake_state(tls->engine->engine) == TLS_HS_COMPLETE) {
+            tls_process_data(tls, NULL, 0);
+        }
+    }
+    else if (st == TLS_HS_ERROR) {
+        const char *err = NULL;
+        if (tls->engine->api->strerror) {
+            err = tls->engine->api->strerror(tls->engine->engine);
+        }
+        UM_LOG(ERR, "TLS(%p) handshake error %s", tls, err);
+        tls->hs_cb(tls, st);
+        uv_link_propagate_read_cb(l, UV_ECONNABORTED, NULL);
+    }
+}
+
+static void tls_hs_work(uv_work_t *req) {
+    struct tls_hs_job_s *job = req->data;
+    tls_engine *engine = job->tls->engine;
+    job->st = engine->api->handshake(engine->engine, job->in, job->in_len, job->out.base, &job->out.len, TLS_BUF_SZ);
+}
+
+static void tls_close_finish(tls_link_t *tls, uv_link_t *source, uv_link_close_cb close_cb);
+
+static void tls_hs_after_work(uv_work_t *req, int status) {
+    struct tls_hs_job_s *job = req->data;
+    tls_link_t *tls = job->tls;
+    uv_link_t *l = (uv_link_t *) tls;
+    tls->hs_job = NULL;
+    tlsuv__free(job->in);
+
+    if (job->close_cb) {
+        tlsuv_pool_free(job->out.base);
+        tlsuv__free(job->pending);
+        tls_close_finish(tls, job->close_source, job->close_cb);
+        tlsuv__free(job);
+        return;
+    }
+
+    tls_hs_result(tls, job->st, &job->out);
+    if (job->st == TLS_HS_ERROR) {
+        tlsuv__free(job->pending);
+        tlsuv__free(job);
+        return;
+    }
+
+    // replay what arrived in the meantime
+    if (job->pending_len > 0 && l->child) {
+        uv_buf_t b = uv_buf_init(job->pending, (unsigned int) job->pending_len);
+        tls_read_cb(l, (ssize_t) job->pending_len, &b);
+    }
+    if (job->read_err < 0 && l->child) {
+        uv_buf_t empty = uv_buf_init(NULL, 0);
+        tls_read_cb(l, job->read_err, &empty);
+    }
+    tlsuv__free(job->pending);
+    tlsuv__free(job);
+}
+
+static void tls_hs_submit(tls_link_t *tls, const char *data, size_t len) {
+    struct tls_hs_job_s *job = tlsuv__calloc(1, sizeof(struct tls_hs_job_s));
+    job->req.data = job;
+    job->tls = tls;
+    job->in = tlsuv__malloc(len);
+    memcpy(job->in, data, len);
+    job->in_len = len;
+    job->out.base = tls_buf_alloc(tls, TLS_BUF_SZ);
+
+    tls->hs_job = job;
+    int rc = uv_queue_work(tls->hs_loop, &job->req, tls_hs_work, tls_hs_after_work);
+    if (rc != 0) {
+        UM_LOG(WARN, "TLS(%p) failed to queue handshake step, running inline: %d(%s)", tls, rc, uv_strerror(rc));
+        tls_hs_work(&job->req);
+        tls_hs_after_work(&job->req, 0);
+    }
+}
+
+// called while handshake step is running, (engine cannot be used) peer data is kept until step is completed
+static void tls_hs_job_queue(struct tls_hs_job_s *job, ssize_t nread, const uv_buf_t *b) {
+    if (nread < 0) {
+        job->read_err = nread;
+        return;
+    }
+
+    char *p = tlsuv__realloc(job->pending, job->pending_len + nread);
+    if (p == NULL) {
+        job->read_err = UV_ENOMEM;
+        return;
+    }
+    memcpy(p + job->pending_len, b->base, nread);
+    job->pending = p;
+    job->pending_len += nread;
+}
+
+static void tls_read_data(tls_link_t *tls, ssize_t nread, const uv_buf_t *b);
+
+// collects ciphertext that did not fit into write estimate
+static int tls_wrap_rest(tls_link_t *tls, tls_link_write_t *wr, uv_buf_t out[2], unsigned int *nout, int tls_rc) {
+    if (tls_rc <= 0) {
+        return tls_rc;
+    }
+
+    wr->tls_buf = tls_buf_alloc(tls, tls_rc);
+    out[*nout] = uv_buf_init(wr->tls_buf, tls_rc);
+    unsigned int extra = 1;
+    tls_rc = tls->engine->api->write_vec(tls->engine->engine, NULL, 0, &out[*nout], &extra);
+    *nout += extra;
+    return tls_rc;
+}
+
+static struct tls_crypto_job_s *tls_crypto_next(tls_link_t *tls) {
+    if (tls->crypto_next == NULL) {
+        struct tls_crypto_job_s *job = tlsuv__calloc(1, sizeof(struct tls_crypto_job_s));
+        job->req.data = job;
+        job->tls = tls;
+        STAILQ_INIT(&job->writes);
+        tls->crypto_next = job;
+    }
+    return tls->crypto_next;
+}
+
+// writes that were not sent complete with `status`
+static void tls_crypto_free(tls_link_t *tls, struct tls_crypto_job_s *job, int status) {
+    struct tls_crypto_write_s *w;
+    while ((w = STAILQ_FIRST(&job->writes)) != NULL) {
+        STAILQ_REMOVE_HEAD(&job->writes, next);
+        if (w->wr->cb) {
+            w->wr->cb(w->wr->source, status, w->wr->ctx);
+        }
+        tlsuv_pool_free(w->wr->tls_buf);
+        tlsuv_pool_free(w->wr);
+        tlsuv__free(w);
+    }
+    tlsuv__free(job->in);
+    tlsuv__free(job->plain);
+    tlsuv__free(job);
+}
+
+static void tls_crypto_work(uv_work_t *req) {
+    struct tls_crypto_job_s *job = req->data;
+    tls_engine *engine = job->tls->engine;
+
+    struct tls_crypto_write_s *w;
+    STAILQ_FOREACH(w, &job->writes, next) {
+        w->rc = engine->api->write_vec(engine->engine, w->bufs, w->nbufs, w->out, &w->nout);
+        w->done = 1;
+        // rest of this write has to be collected before the next one is encrypted
+        if (w->rc != 0) {
+            break;
+        }
+    }
+
+    if (job->in_len == 0) {
+        return;
+    }
+
+    const char *in = job->in;
+    size_t in_len = job->in_len;
+    enum TLS_RESULT rc;
+    do {
+        size_t n = 0;
+        rc = engine->api->read(engine->engine, in, in_len, job->plain + job->plain_len, &n,
+                               job->plain_cap - job->plain_len);
+        in = NULL;
+        in_len = 0;
+        job->plain_len += n;
+    } while ((rc == TLS_MORE_AVAILABLE || rc == TLS_READ_AGAIN) && job->plain_len < job->plain_cap);
+    job->read_rc = rc;
+}
+
+static void tls_crypto_send(tls_link_t *tls, struct tls_crypto_write_s *w) {
+    uv_link_t *l = (uv_link_t *) tls;
+    tls_link_write_t *wr = w->wr;
+
+    if (!w->done) {
+        w->rc = tls->engine->api->write_vec(tls->engine->engine, w->bufs, w->nbufs, w->out, &w->nout);
+    }
+    int tls_rc = tls_wrap_rest(tls, wr, w->out, &w->nout, w->rc);
+
+    if (tls_rc < 0 || w->nout == 0 || w->out[0].len == 0) {
+        if (tls_rc < 0) {
+            UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, tls_rc, tls->engine->api->strerror(tls->engine->engine));
+        }
+        if (wr->cb) {
+            wr->cb(wr->source, tls_rc < 0 ? tls_rc : 0, wr->ctx);
+        }
+        tlsuv_pool_free(wr->tls_buf);
+        tlsuv_pool_free(wr);
+    } else {
+        count_out(tls, w->out, w->nout);
+        int rc = uv_link_propagate_write(l->parent, l, w->out, w->nout, w->send_handle, tls_write_cb, wr);
+        if (rc != 0) {
+            tls_write_cb(l->parent, rc, wr);
+        }
+    }
+    tlsuv__free(w);
+}
+
+static void tls_crypto_deliver(tls_link_t *tls, struct tls_crypto_job_s *job) {
+    uv_link_t *l = (uv_link_t *) tls;
+    uv_buf_t out = uv_buf_init(NULL, 0);
+
+    if (tls->stats) {
+        tls->stats->plain_in += job->plain_len;
+        if (job->in_len > 0 && job->read_rc == TLS_HAS_WRITE) {
+            tls->stats->has_write++;
+        }
+    }
+
+    const char *p = job->plain;
+    size_t left = job->plain_len;
+    while (left > 0) {
+        uv_link_propagate_alloc_cb(l, TLS_BUF_SZ, &out);
+        if (out.base == NULL || out.len == 0) {
+            uv_link_propagate_read_cb(l, UV_ENOBUFS, &out);
+            return;
+        }
+        size_t n = left < out.len ? left : out.len;
+        memcpy(out.base, p, n);
+        p += n;
+        left -= n;
+        uv_link_propagate_read_cb(l, (ssize_t) n, &out);
+        if (l->child == NULL || job->close_cb) { // closed by the reader
+            return;
+        }
+    }
+
+    out = uv_buf_init(NULL, 0);
+    if (job->in_len > 0) {
+        switch (job->read_rc) {
+            case TLS_READ_AGAIN:
+            case TLS_MORE_AVAILABLE:
+                // plaintext buffer filled up, rest is taken on the loop thread
+                tls_process_data(tls, NULL, 0);
+                break;
+            case TLS_HAS_WRITE:
+                tls_flush_pending(tls);
+                break;
+            case TLS_OK:
+                break;
+            case TLS_EOF:
+                uv_link_propagate_read_cb(l, UV_EOF, &out);
+                return;
+            case TLS_ERR:
+            default:
+                UM_LOG(ERR, "aborting after TLS engine error: %s", tls->engine->api->strerror(tls->engine->engine));
+                uv_link_propagate_read_cb(l, UV_ECONNABORTED, &out);
+                return;
+        }
+    }
+
+    if (job->read_err < 0 && l->child && !job->close_cb) {
+        UM_LOG(ERR, "TLS read %d(%s)", (int) job->read_err, uv_strerror((int) job->read_err));
+        uv_link_propagate_read_cb(l, job->read_err, &out);
+    }
+}
+
+static void tls_crypto_submit(tls_link_t *tls);
+
+// returns non-zero when next batch is ready to be submitted
+static int tls_crypto_finish(tls_link_t *tls, struct tls_crypto_job_s *job) {
+    uv_link_t *l = (uv_link_t *) tls;
+
+    // link stays busy while results are handed over, writes and reads from callbacks go into the next batch
+    struct tls_crypto_write_s *w;
+    while (!job->close_cb && (w = STAILQ_FIRST(&job->writes)) != NULL) {
+        STAILQ_REMOVE_HEAD(&job->writes, next);
+        tls_crypto_send(tls, w);
+    }
+    if (!job->close_cb && l->child) {
+        tls_crypto_deliver(tls, job);
+    }
+    tls->crypto_job = NULL;
+
+    struct tls_crypto_job_s *next = tls->crypto_next;
+    if (job->close_cb) {
+        tls->crypto_next = NULL;
+        if (next) {
+            tls_crypto_free(tls, next, UV_ECANCELED);
+        }
+        uv_link_close_cb close_cb = job->close_cb;
+        uv_link_t *close_source = job->close_source;
+        tls_crypto_free(tls, job, UV_ECANCELED);
+        tls_close_finish(tls, close_source, close_cb);
+        return 0;
+    }
+    tls_crypto_free(tls, job, UV_ECANCELED);
+
+    if (next == NULL) {
+        return 0;
+    }
+    if (!STAILQ_EMPTY(&next->writes) || next->in_len > 0) {
+        return 1;
+    }
+
+    // only read error arrived in the meantime
+    tls->crypto_next = NULL;
+    ssize_t err = next->read_err;
+    tls_crypto_free(tls, next, UV_ECANCELED);
+    if (err < 0 && l->child) {
+        uv_buf_t empty = uv_buf_init(NULL, 0);
+        tls_read_data(tls, err, &empty);
+    }
+    return 0;
+}
+
+static void tls_crypto_after_work(uv_work_t *req, int status) {
+    struct tls_crypto_job_s *job = req->data;
+    tls_link_t *tls = job->tls;
+
+    if (tls_crypto_finish(tls, job)) {
+        tls_crypto_submit(tls);
+    }
+}
+
+static void tls_crypto_submit(tls_link_t *tls) {
+    struct tls_crypto_job_s *job;
+    do {
+        job = tls->crypto_next;
+        tls->crypto_next = NULL;
+
+        if (job->in_len > 0) {
+            // plaintext is never longer than ciphertext, headroom covers what engine already buffered
+            job->plain_cap = job->in_len + TLS_BUF_SZ;
+            job->plain = tlsuv__malloc(job->plain_cap);
+            if (job->plain == NULL) {
+                // ciphertext is still fed to the engine, plaintext is taken on the loop thread
+                job->plain_cap = 0;
+            }
+        }
+
+        tls->crypto_job = job;
+        // short writes and reads that queued up behind previous batch are not worth the threadpool round trip,
+        // they run here and callbacks queueing more are picked up by the loop instead of recursing
+        if (job->out_len + job->in_len >= TLSUV_BULK_CRYPTO_MIN) {
+            int rc = uv_queue_work(tls->crypto_loop, &job->req, tls_crypto_work, tls_crypto_after_work);
+            if (rc == 0) {
+                tls->crypto_batches++;
+                return;
+            }
+            UM_LOG(WARN, "TLS(%p) failed to queue crypto batch, running inline: %d(%s)", tls, rc, uv_strerror(rc));
+        }
+        tls_crypto_work(&job->req);
+    } while (tls_crypto_finish(tls, job));
+}
+
+static int tls_crypto_queue_write(tls_link_t *tls, uv_link_t *source, const uv_buf_t bufs[], unsigned int nbufs,
+                                  size_t total, uv_stream_t *send_handle, uv_link_write_cb cb, void *arg) {
+    struct tls_crypto_write_s *w = tlsuv__malloc(sizeof(struct tls_crypto_write_s) + nbufs * sizeof(uv_buf_t));
+    if (w == NULL) {
+        return UV_ENOMEM;
+    }
+
+    size_t est = total + (total / TLS_RECORD_SZ + nbufs + 1) * TLS_RECORD_OVERHEAD;
+    w->wr = tls_buf_alloc(tls, sizeof(tls_link_write_t) + est);
+    if (w->wr == NULL) {
+        tlsuv__free(w);
+        return UV_ENOMEM;
+    }
+    w->wr->tls_buf = NULL;
+    w->wr->cb = cb;
+    w->wr->ctx = arg;
+    w->wr->source = source;
+    w->send_handle = send_handle;
+    w->out[0] = uv_buf_init((char *) (w->wr + 1), est);
+    w->nout = 1;
+    w->rc = 0;
+    w->done = 0;
+    w->nbufs = nbufs;
+    memcpy(w->bufs, bufs, nbufs * sizeof(uv_buf_t));
+
+    if (tls->stats) {
+        tls->stats->plain_out += total;
+    }
+
+    struct tls_crypto_job_s *job = tls_crypto_next(tls);
+    STAILQ_INSERT_TAIL(&job->writes, w, next);
+    job->out_len += total;
+    if (tls->crypto_job == NULL) {
+        tls_crypto_submit(tls);
+    }
+    return 0;
+}
+
+static void tls_crypto_queue_read(tls_link_t *tls, ssize_t nread, const uv_buf_t *b) {
+    struct tls_crypto_job_s *job = tls_crypto_next(tls);
+    if (nread < 0) {
+        job->read_err = nread;
+        return;
+    }
+
+    char *p = tlsuv__realloc(job->in, job->in_len + nread);
+    if (p == NULL) {
+        if (tls->crypto_job) {
+            job->read_err = UV_ENOMEM;
+            return;
+        }
+
+        // nothing is running that would deliver the error later
+        tls->crypto_next = NULL;
+        tls_crypto_free(tls, job, UV_ECANCELED);
+        UM_LOG(ERR, "TLS(%p) failed to queue %zd bytes for decryption", tls, nread);
+        uv_buf_t empty = uv_buf_init(NULL, 0);
+        uv_link_propagate_read_cb((uv_link_t *) tls, UV_ENOMEM, &empty);
+        return;
+    }
+    memcpy(p + job->in_len, b->base, nread);
+    job->in = p;
+    job->in_len += nread;
+
+    if (tls->crypto_job == NULL) {
+        tls_crypto_submit(tls);
+    }
+}
+
 static void tls_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
     tls_link_t *tls = (tls_link_t *) l;
 
+    // engine copies what it does not consume, so buffer can go back to the pool right after
+    char *read_buf = NULL;
+    if (b && b->base != NULL && b->base == tls->ssl_buf) {
+        read_sizer_update(&tls->read_size, nread, tls->ssl_buf_len);
+        // kept buffer is also dropped when recent reads call for another size
+        if (tls->lean || tlsuv_pool_read_shared() || read_sizer_size(&tls->read_size) != tls->ssl_buf_len) {
+            read_buf = tls->ssl_buf;
+            tls->ssl_buf = NULL;
+            tls->ssl_buf_len = 0;
+        }
+    }
+    tls_read_data(tls, nread, b);
+    tlsuv_pool_free(read_buf);
+}
+
+static void tls_read_data(tls_link_t *tls, ssize_t nread, const uv_buf_t *b) {
+    uv_link_t *l = (uv_link_t *) tls;
+
+    if (tls->hs_job) {
+        UM_LOG(TRACE, "TLS(%p) handshake step is running, queueing %zd", tls, nread);
+        tls_hs_job_queue(tls->hs_job, nread, b);
+        return;
+    }
+
+    if (tls->crypto_job) {
+        UM_LOG(TRACE, "TLS(%p) crypto batch is running, queueing %zd", tls, nread);
+        if (nread > 0) {
+            count_in(tls, b->base, (size_t) nread);
+        }
+        tls_crypto_queue_read(tls, nread, b);
+        return;
+    }
+
     tls_handshake_state hs_state = tls->engine->api->handshake_state(tls->engine->engine);
     UM_LOG(TRACE, "TLS(%p)[%d]: %zd", tls, hs_state, nread);
 
     if (nread < 0) {
         UM_LOG(ERR, "TLS read %d(%s)", nread, uv_strerror(nread));
         if (hs_state == TLS_HS_CONTINUE) {
+            if (tls->stats) tls->stats->handshake_failures++;
             tls->engine->api->reset(tls->engine->engine);
             tls->hs_cb(tls, TLS_HS_ERROR);
-            free(b->base);
         } else {
-            uv_link_propagate_read_cb(l, nread, b);
+            uv_buf_t empty = uv_buf_init(NULL, 0);
+            uv_link_propagate_read_cb(l, nread, &empty);
         }
         return;
     }
 
+    if (nread == 0) {
+        return;
+    }
+    count_in(tls, b->base, (size_t) nread);
+
     if (hs_state == TLS_HS_CONTINUE) {
-        if (nread == 0) {
-            UM_LOG(ERR, "should not be here");
+        UM_LOG(TRACE, "TLS(%p) continuing handshake(%zd bytes received)", tls, nread);
+        // marked on arrival, before processing (which may wait for the threadpool)
+        if (tls->timing && tls->timing->hs_flight_count < TLSUV_TIMING_MAX_FLIGHTS) {
+            tls->timing->hs_flights[tls->timing->hs_flight_count++] = uv_hrtime();
+        }
+        if (tls->hs_loop) {
+            tls_hs_submit(tls, b->base, (size_t) nread);
             return;
         }
 
-        UM_LOG(TRACE, "TLS(%p) continuing handshake(%zd bytes received)", tls, nread);
         uv_buf_t buf;
-        buf.base = malloc(TLS_BUF_SZ);
+        buf.base = tls_buf_alloc(tls, TLS_BUF_SZ);
         tls_handshake_state st =
                 tls->engine->api->handshake(tls->engine->engine, b->base, nread, buf.base, &buf.len, TLS_BUF_SZ);
-
-        UM_LOG(TRACE, "TLS(%p) continuing handshake(sending %zd bytes, st = %d)", tls, buf.len, st);
-        if (buf.len > 0) {
-            tls_link_write_t *wr = calloc(1, sizeof(tls_link_write_t));
-            wr->tls_buf = buf.base;
-            int rc = uv_link_propagate_write(l->parent, l, &buf, 1, NULL, tls_write_cb, wr);
-            if (rc != 0) {
-                UM_LOG(WARN, "TLS(%p) failed to write during handshake %d(%s)", tls, rc, uv_strerror(rc));
-                tls_write_cb(l->parent, rc, wr);
-            }
-        }
-        else {
-            free(buf.base);
-        }
-
-        if (st == TLS_HS_COMPLETE) {
-            UM_LOG(TRACE, "TLS(%p) handshake completed", tls);
-            tls->hs_cb(tls, TLS_HS_COMPLETE);
-        }
-        else if (st == TLS_HS_ERROR) {
-            const char *err = NULL;
-            if (tls->engine->api->strerror) {
-                err = tls->engine->api->strerror(tls->engine->engine);
-            }
-            UM_LOG(ERR, "TLS(%p) handshake error %s", tls, err);
-            tls->hs_cb(tls, st);
-            uv_link_propagate_read_cb(l, UV_ECONNABORTED, NULL);
-        }
-        if (b->base) free(b->base);
+        tls_hs_result(tls, st, &buf);
     } else if (hs_state == TLS_HS_COMPLETE) {
-        UM_LOG(TRACE, "TLS(%p) processing %zd bytes", tls, nread);
-
-        size_t bufsize = b->len;
-        char *inptr = b->base;
-        size_t inlen = nread;
-        enum TLS_RESULT rc = TLS_MORE_AVAILABLE;
-        while(rc == TLS_MORE_AVAILABLE || rc == TLS_READ_AGAIN) {
-            ssize_t out_bytes = 0;
-            rc = tls->engine->api->read(tls->engine->engine, inptr, inlen, b->base, (size_t *)&out_bytes, b->len);
-            UM_LOG(TRACE, "TLS(%p) produced %zd application byte (rc=%d)", tls, out_bytes, rc);
-
-            switch (rc) {
-                case TLS_OK: {
-                    uv_link_propagate_read_cb(l, out_bytes, b);
-                    break;
-                }
-                case TLS_EOF: {
-                    if (out_bytes > 0) {
-                        uv_link_propagate_read_cb(l, out_bytes, b);
-                        uv_link_propagate_alloc_cb(l, bufsize, (uv_buf_t *)b);
-                    }
-                    uv_link_propagate_read_cb(l, UV_EOF, b);
-                    break;
-                }
-                case TLS_READ_AGAIN:
-                case TLS_MORE_AVAILABLE: {
-                    uv_link_propagate_read_cb(l, out_bytes, b);
-                    inlen = 0;
-                    inptr = NULL;
-                    uv_link_propagate_alloc_cb(l, bufsize, (uv_buf_t *)b);
-                    if (b->base == NULL || b->len == 0) {
-                        uv_link_propagate_read_cb(l, UV_ENOBUFS, b);
-                        return;
-                    }
-                    break;
-                }
-                case TLS_HAS_WRITE: {
-                    uv_buf_t buf;
-                    buf.base = malloc(TLS_BUF_SZ);
-                    int tls_rc = tls->engine->api->write(tls->engine->engine, NULL, 0, buf.base, &buf.len, TLS_BUF_SZ);
-                    uv_link_propagate_write(l->parent, l, &buf, 1, NULL, tls_write_free_cb, buf.base);
-                    break;
-                }
-                case TLS_ERR:
-                default:
-                    if (out_bytes > 0) {
-                        uv_link_propagate_read_cb(l, out_bytes, b);
-                        uv_link_propagate_alloc_cb(l, bufsize, (uv_buf_t*)b);
-                    }
-                    if (rc != TLS_ERR) {
-                        UM_LOG(ERR, "aborting after unexpected TLS engine result: %d", rc);
-                    } else {
-                        UM_LOG(ERR, "aborting after TLS engine error: %s", tls->engine->api->strerror(tls->engine->engine));
-                    }
-                    uv_link_propagate_read_cb(l, UV_ECONNABORTED, b);
-                    break;
-            }
+        if (tls->crypto_loop && nread >= TLSUV_BULK_CRYPTO_MIN) {
+            tls_crypto_queue_read(tls, nread, b);
+            return;
         }
+        tls_process_data(tls, b->base, (size_t) nread);
     }
     else {
         UM_LOG(VERB, "hs_state = %d", hs_state);
     }
 }
 
+static int tls_write_vec(tls_link_t *tls, uv_link_t *source, const uv_buf_t bufs[], unsigned int nbufs,
+                         uv_stream_t *send_handle, uv_link_write_cb cb, void *arg) {
+    uv_link_t *l = (uv_link_t *) tls;
+
+    size_t total = 0;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        total += bufs[i].len;
+    }
+
+    if (total == 0) { // nothing to send
+        if (cb) cb(source, 0, arg);
+        return 0;
+    }
+    if (tls->stats) {
+        tls->stats->plain_out += total;
+    }
+
+    // write request and its ciphertext buffer share single allocation
+    size_t est = total + (total / TLS_RECORD_SZ + nbufs + 1) * TLS_RECORD_OVERHEAD;
+    tls_link_write_t *wr = tls_buf_alloc(tls, sizeof(tls_link_write_t) + est);
+    wr->tls_buf = NULL;
+    wr->cb = cb;
+    wr->ctx = arg;
+    wr->source = source;
+
+    uv_buf_t out[2];
+    out[0] = uv_buf_init((char *) (wr + 1), est);
+    unsigned int nout = 1;
+    int tls_rc = tls->engine->api->write_vec(tls->engine->engine, bufs, nbufs, out, &nout);
+
+    // estimate was too low, collect the rest
+    tls_rc = tls_wrap_rest(tls, wr, out, &nout, tls_rc);
+
+    if (tls_rc < 0) {
+        UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, tls_rc, tls->engine->api->strerror(tls->engine->engine));
+        tlsuv_pool_free(wr->tls_buf);
+        tlsuv_pool_free(wr);
+        return tls_rc;
+    }
+
+    if (nout == 0 || out[0].len == 0) {
+        tlsuv_pool_free(wr->tls_buf);
+        tlsuv_pool_free(wr);
+        if (cb) cb(source, 0, arg);
+        return 0;
+    }
+
+    count_out(tls, out, nout);
+    int rc = uv_link_propagate_write(l->parent, l, out, nout, send_handle, tls_write_cb, wr);
+    if (rc != 0) {
+        tlsuv_pool_free(wr->tls_buf);
+        tlsuv_pool_free(wr);
+    }
+    return rc;
+}
+
 static int tls_write(uv_link_t *l, uv_link_t *source, const uv_buf_t bufs[],
                      unsigned int nbufs, uv_stream_t *send_handle, uv_link_write_cb cb, void *arg) {
     tls_link_t *tls = (tls_link_t *) l;
+    if (tls->hs_job) {
+        return UV_EAGAIN;
+    }
+
+    if (tls->ktls_tx) {
+        // kernel does the framing, only application bytes are known
+        if (tls->stats) {
+            for (unsigned int i = 0; i < nbufs; i++) {
+                tls->stats->plain_out += bufs[i].len;
+            }
+        }
+        return uv_link_propagate_write(l->parent, source, bufs, nbufs, send_handle, cb, arg);
+    }
+
+    if (tls->crypto_loop) {
+        size_t total = 0;
+        for (unsigned int i = 0; i < nbufs; i++) {
+            total += bufs[i].len;
+        }
+        // once a batch is running everything goes through the queue to keep records in order
+        if (tls->crypto_job || total >= TLSUV_BULK_CRYPTO_MIN) {
+            return tls_crypto_queue_write(tls, source, bufs, nbufs, total, send_handle, cb, arg);
+        }
+    }
+
+    if (tls->engine->api->write_vec) {
+        return tls_write_vec(tls, source, bufs, nbufs, send_handle, cb, arg);
+    }
+
     uv_buf_t buf = uv_buf_init(NULL, 0);
     int tls_rc = 0;
     for (int i = 0; i < nbufs; i++) {
+        if (tls->stats) tls->stats->plain_out += bufs[i].len;
         tls_rc = tls->engine->api->write(tls->engine->engine, bufs[i].base, bufs[i].len, NULL, &buf.len, 0);
         if (tls_rc < 0) {
             UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, tls_rc, tls->engine->api->strerror(tls->engine->engine));
-            free(buf.base);
+            tlsuv_pool_free(buf.base);
             return tls_rc;
         }
     }
     
 
     if (tls_rc > 0) {
-        buf.base = malloc(tls_rc);
+        buf.base = tls_buf_alloc(tls, tls_rc);
         tls_rc = tls->engine->api->write(tls->engine->engine, NULL, 0, buf.base, &buf.len, tls_rc);
         if (tls_rc < 0) {
             UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, tls_rc, tls->engine->api->strerror(tls->engine->engine));
-            free(buf.base);
+            tlsuv_pool_free(buf.base);
             return tls_rc;
         }
     } else if (tls_rc == 0) { // nothing to send
-        tls_write_cb(l, 0, arg);
+        if (cb) cb(source, 0, arg);
         return 0;
     }
     
-    tls_link_write_t *wr = calloc(1, sizeof(tls_link_write_t));
+    tls_link_write_t *wr = tlsuv_pool_calloc(sizeof(tls_link_write_t));
     wr->tls_buf = buf.base;
     wr->cb = cb;
     wr->ctx = arg;
+    wr->source = source;
+    count_out(tls, &buf, 1);
     return uv_link_propagate_write(l->parent, l, &buf, 1, send_handle, tls_write_cb, wr);
 }
 
 static void tls_close(uv_link_t *l, uv_link_t *source, uv_link_close_cb close_cb) {
     UM_LOG(TRACE, "closing TLS link");
     tls_link_t *tls = (tls_link_t *) l;
+    if (tls->hs_job) {
+        // engine is in use by worker thread, finish when it is done
+        tls->hs_job->close_cb = close_cb;
+        tls->hs_job->close_source = source;
+        return;
+    }
+    if (tls->crypto_job) {
+        tls->crypto_job->close_cb = close_cb;
+        tls->crypto_job->close_source = source;
+        return;
+    }
+    tls_close_finish(tls, source, close_cb);
+}
+
+static void tls_close_finish(tls_link_t *tls, uv_link_t *source, uv_link_close_cb close_cb) {
     if (tls->engine->api->reset) {
         tls->engine->api->reset(tls->engine->engine);
     }
+    tls->ktls_tx = 0;
+    if (tls->ssl_buf) {
+        tlsuv_pool_free(tls->ssl_buf);
+        tls->ssl_buf = NULL;
+        tls->ssl_buf_len = 0;
+    }
     close_cb(source);
 }
 
@@ -274,5 +1023,78 @@ int tlsuv_tls_link_init(tls_link_t *tls, tls_engine *engine, tls_handshake_cb cb
     uv_link_init((uv_link_t *) tls, &tls_methods);
     tls->engine = engine;
     tls->hs_cb = cb;
+    tls->ssl_buf = NULL;
+    tls->ssl_buf_len = 0;
+    memset(&tls->read_size, 0, sizeof(tls->read_size));
+    tls->ktls_tx = 0;
+    tls->hs_started = 0;
+    tls->lean = engine->api->idle_lean ? engine->api->idle_lean(engine->engine) : 0;
+    tls->hs_loop = NULL;
+    tls->hs_job = NULL;
+    tls->crypto_loop = NULL;
+    tls->crypto_job = NULL;
+    tls->crypto_next = NULL;
+    tls->crypto_batches = 0;
+    tls->timing = NULL;
+    tls->stats = engine->api->stats ? engine->api->stats(engine->engine) : NULL;
+    memset(&tls->rec_in, 0, sizeof(tls->rec_in));
+    memset(&tls->rec_out, 0, sizeof(tls->rec_out));
+    return 0;
+}
+
+size_t tlsuv_tls_link_mem_usage(tls_link_t *tls) {
+    size_t total = 0;
+    if (tls->ssl_buf) {
+        total += tls->ssl_buf_len;
+    }
+    if (tls->hs_job) {
+        total += sizeof(*tls->hs_job) + TLS_BUF_SZ + tls->hs_job->in_len + tls->hs_job->pending_len;
+    }
+    if (tls->crypto_job) {
+        total += sizeof(*tls->crypto_job) + tls->crypto_job->in_len + tls->crypto_job->plain_cap;
+    }
+    if (tls->crypto_next) {
+        total += sizeof(*tls->crypto_next) + tls->crypto_next->in_len;
+    }
+    // engine buffers are not counted while a worker is using them
+    if (tls->hs_job == NULL && tls->crypto_job == NULL && tls->engine && tls->engine->api->mem_usage) {
+        total += tls->engine->api->mem_usage(tls->engine->engine);
+    }
+    return total;
+}
+
+int tlsuv_tls_link_async_handshake(tls_link_t *tls, uv_loop_t *loop) {
+    if (tls->engine->api->async_handshake == NULL || !tls->engine->api->async_handshake(tls->engine->engine)) {
+        tls->hs_loop = NULL;
+        return UV_ENOTSUP;
+    }
+    tls->hs_loop = loop;
+    return 0;
+}
+
+int tlsuv_tls_link_ktls(tls_link_t *tls, uv_stream_t *sock) {
+    if (tls->engine->api->ktls_tx == NULL || sock == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    // queued handshake records must reach the socket before kernel starts encrypting
+    uv_os_fd_t fd;
+    if (uv_stream_get_write_queue_size(sock) > 0 || uv_fileno((uv_handle_t *) sock, &fd) != 0) {
+        return UV_ENOTSUP;
+    }
+
+    int rc = tls->engine->api->ktls_tx(tls->engine->engine, fd);
+    tls->ktls_tx = rc == 0;
+    UM_LOG(TRACE, "TLS(%p) kTLS offload: %d", tls, rc);
+    return rc;
+}
+
+int tlsuv_tls_link_async_crypto(tls_link_t *tls, uv_loop_t *loop) {
+    if (tls->engine->api->async_crypto == NULL || tls->engine->api->write_vec == NULL ||
+        !tls->engine->api->async_crypto(tls->engine->engine)) {
+        tls->crypto_loop = NULL;
+        return UV_ENOTSUP;
+    }
+    tls->crypto_loop = loop;
     return 0;
 }
@@ -0,0 +1,35 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_TLS_TRACE_H
+#define TLSUV_TLS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <tlsuv/tls_engine.h>
+
+/**
+ * Changes every time tracing is enabled or disabled, engines compare it with
+ * the value seen when they last attached/detached their hooks.
+ */
+int64_t tls_trace_generation(void);
+
+/**
+ * @return true if connection to [host] should be traced with current settings
+ */
+bool tls_trace_match(const char *host);
+
+void tls_trace_emit(const tlsuv_trace_event *ev);
+
+#endif //TLSUV_TLS_TRACE_H
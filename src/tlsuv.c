@@ -18,6 +18,9 @@
 #include <string.h>
 #include <uv.h>
 
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_CORE
+#include "alloc.h"
+
 #if _WIN32
 #include "win32_compat.h"
 #endif
@@ -38,6 +41,7 @@ static int mbed_ssl_send(void* ctx, const uint8_t *buf, size_t len);
 static const uv_link_methods_t mbed_methods = {
         .close = uv_link_default_close,
         .read_start = uv_link_default_read_start,
+        .read_stop = uv_link_default_read_stop,
         .write = uv_link_default_write,
         .alloc_cb_override = uv_link_default_alloc_cb_override,
         .read_cb_override = uv_link_default_read_cb_override,
@@ -67,7 +71,7 @@ const char* tlsuv_version() {
 int tlsuv_stream_init(uv_loop_t *l, tlsuv_stream_t *clt, tls_context *tls) {
     clt->loop = l;
 
-    clt->socket = calloc(1, sizeof(*clt->socket));
+    clt->socket = &clt->default_src;
     tcp_src_init(l, clt->socket);
 
     uv_link_init((uv_link_t *) clt, &mbed_methods);
@@ -76,23 +80,30 @@ int tlsuv_stream_init(uv_loop_t *l, tlsuv_stream_t *clt, tls_context *tls) {
     clt->host = NULL;
     clt->conn_req = NULL;
     clt->close_cb = NULL;
+    clt->timing_cb = NULL;
+    clt->timing_ctx = NULL;
+    clt->corked = 0;
+    clt->corked_count = 0;
+    STAILQ_INIT(&clt->corked_writes);
 
     return 0;
 }
 
+static void cancel_corked(tlsuv_stream_t *clt, int err);
+
 static void on_mbed_close(uv_link_t *l) {
     tlsuv_stream_t *mbed = (tlsuv_stream_t *) l;
+    mbed->corked = 0;
+    cancel_corked(mbed, UV_ECANCELED);
     if (mbed->conn_req) {
         uv_connect_t *cr = mbed->conn_req;
         mbed->conn_req = NULL;
         cr->cb(cr, UV_ECANCELED);
     }
+    // socket is kept (with its settings) for reconnect
     if (mbed->socket) {
         mbed->socket->cancel((tlsuv_src_t *) mbed->socket);
         mbed->socket->release((tlsuv_src_t *) mbed->socket);
-        tcp_src_free(mbed->socket);
-        free(mbed->socket);
-        mbed->socket = NULL;
     }
     if(mbed->close_cb) mbed->close_cb((uv_handle_t *) mbed);
 }
@@ -111,6 +122,30 @@ int tlsuv_stream_nodelay(tlsuv_stream_t *clt, int nodelay) {
     return tcp_src_nodelay(clt->socket, nodelay);
 }
 
+int tlsuv_stream_sockopts(tlsuv_stream_t *clt, const tcp_src_sockopts *opts) {
+    return tcp_src_sockopts_set(clt->socket, opts);
+}
+
+int tlsuv_stream_set_timing(tlsuv_stream_t *clt, tlsuv_timing_cb cb, void *ctx) {
+    clt->timing_cb = cb;
+    clt->timing_ctx = ctx;
+    return 0;
+}
+
+int tlsuv_stream_stats(tlsuv_stream_t *clt, tls_traffic_stats *stats) {
+    if (clt->tls_engine == NULL || clt->tls_engine->api->stats == NULL) {
+        return UV_ENOTSUP;
+    }
+    *stats = *clt->tls_engine->api->stats(clt->tls_engine->engine);
+    return 0;
+}
+
+static void report_timing(tlsuv_stream_t *clt) {
+    if (clt->timing_cb) {
+        clt->timing_cb(&clt->timing, clt->timing_ctx);
+    }
+}
+
 static void on_tls_hs(tls_link_t *tls_link, int status) {
     tlsuv_stream_t *stream = tls_link->data;
 
@@ -118,17 +153,23 @@ static void on_tls_hs(tls_link_t *tls_link, int status) {
     if (req == NULL) {
         return;
     }
+    // callback may close the stream
+    stream->conn_req = NULL;
 
     if (status == TLS_HS_COMPLETE) {
+        if (stream->socket && stream->socket->conn) {
+            tlsuv_tls_link_ktls(tls_link, (uv_stream_t *) stream->socket->conn);
+        }
+        report_timing(stream);
         req->cb(req, 0);
     } else if (status == TLS_HS_ERROR) {
         UM_LOG(WARN, "handshake failed: %s", tls_link->engine->api->strerror(tls_link->engine->engine));
+        report_timing(stream);
         req->cb(req, UV_ECONNABORTED);
     } else {
         UM_LOG(WARN, "unexpected handshake status[%d]", status);
         req->cb(req, UV_EINVAL);
     }
-    stream->conn_req = NULL;
 }
 
 static void on_src_connect(tlsuv_src_t *src, int status, void *ctx) {
@@ -141,6 +182,11 @@ static void on_src_connect(tlsuv_src_t *src, int status, void *ctx) {
         void *data = clt->data;
         clt->tls_engine = clt->tls->api->new_engine(clt->tls->ctx, clt->host);
         tlsuv_tls_link_init(&clt->tls_link, clt->tls_engine, on_tls_hs);
+        tlsuv_tls_link_async_handshake(&clt->tls_link, clt->loop);
+        tlsuv_tls_link_async_crypto(&clt->tls_link, clt->loop);
+        if (clt->timing_cb) {
+            clt->tls_link.timing = &clt->timing;
+        }
         uv_link_init((uv_link_t *) clt, &mbed_methods);
         clt->data = data;
 
@@ -150,12 +196,15 @@ static void on_src_connect(tlsuv_src_t *src, int status, void *ctx) {
         uv_link_read_start((uv_link_t *) clt);
     } else {
         UM_LOG(WARN, "failed to connect");
-        clt->conn_req->cb(clt->conn_req, status);
+        report_timing(clt);
+        uv_connect_t *req = clt->conn_req;
         clt->conn_req = NULL;
+        req->cb(req, status);
     }
 }
 
-int tlsuv_stream_connect(uv_connect_t *req, tlsuv_stream_t *clt, const char *host, int port, uv_connect_cb cb) {
+static int stream_connect(uv_connect_t *req, tlsuv_stream_t *clt, const char *host, int port,
+                          const struct addrinfo *addr, uv_connect_cb cb) {
     if (!req) {
         return UV_EINVAL;
     }
@@ -166,43 +215,315 @@ int tlsuv_stream_connect(uv_connect_t *req, tlsuv_stream_t *clt, const char *hos
         return UV_EALREADY;
     }
 
+    if (!clt->socket) {
+        return UV_EINVAL;
+    }
+
+    int rc = tcp_src_set_addr(clt->socket, addr);
+    if (rc != 0) {
+        return rc;
+    }
+
     char portstr[6];
     snprintf(portstr, sizeof(portstr), "%d", port);
 
     req->handle = (uv_stream_t *) clt;
     req->cb = cb;
-    if (clt->host) free (clt->host);
-    clt->host = strdup(host);
+    if (clt->host) tlsuv__free(clt->host);
+    clt->host = tlsuv__strdup(host);
     clt->conn_req = req;
 
-    if (!clt->socket) {
-        clt->socket = calloc(1, sizeof(*clt->socket));
-        tcp_src_init(clt->loop, clt->socket);
-    }
+    memset(&clt->timing, 0, sizeof(clt->timing));
+    clt->socket->timing = clt->timing_cb ? &clt->timing : NULL;
 
     return clt->socket->connect((tlsuv_src_t *) clt->socket, host, portstr, on_src_connect, clt);
 }
 
+int tlsuv_stream_connect(uv_connect_t *req, tlsuv_stream_t *clt, const char *host, int port, uv_connect_cb cb) {
+    return stream_connect(req, clt, host, port, NULL, cb);
+}
+
+int tlsuv_stream_connect_addr(uv_connect_t *req, tlsuv_stream_t *clt, const struct addrinfo *addr, uv_connect_cb cb) {
+    if (addr == NULL || addr->ai_addr == NULL) {
+        return UV_EINVAL;
+    }
+
+    int port;
+    char ip[INET6_ADDRSTRLEN] = "";
+    if (addr->ai_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) addr->ai_addr;
+        port = ntohs(sin->sin_port);
+        uv_ip4_name(sin, ip, sizeof(ip));
+    } else if (addr->ai_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) addr->ai_addr;
+        port = ntohs(sin6->sin6_port);
+        uv_ip6_name(sin6, ip, sizeof(ip));
+    } else {
+        return UV_EAI_FAMILY;
+    }
+
+    // name to verify server against: canonical name, host from previous connect, or the address itself
+    const char *host = addr->ai_canonname ? addr->ai_canonname : clt->host ? clt->host : ip;
+    char *name = tlsuv__strdup(host);
+    int rc = stream_connect(req, clt, name, port, addr, cb);
+    tlsuv__free(name);
+    return rc;
+}
+
+int tlsuv_server_init(uv_loop_t *l, tlsuv_server_t *srv, tls_context *tls) {
+    if (tls == NULL) {
+        return UV_EINVAL;
+    }
+    if (tls->api->set_server_mode == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    srv->loop = l;
+    srv->tls = tls;
+    srv->connection_cb = NULL;
+    srv->close_cb = NULL;
+    // listening socket is created on bind
+    memset(&srv->listener, 0, sizeof(srv->listener));
+    return 0;
+}
+
+int tlsuv_server_bind(tlsuv_server_t *srv, const struct sockaddr *addr, unsigned int flags) {
+    if (srv->listener.loop != NULL) {
+        return UV_EALREADY;
+    }
+
+    // socket options have to be set before bind
+    int rc = uv_tcp_init_ex(srv->loop, &srv->listener, addr->sa_family);
+    if (rc != 0) {
+        memset(&srv->listener, 0, sizeof(srv->listener));
+        return rc;
+    }
+    srv->listener.data = srv;
+
+    if (flags & TLSUV_SERVER_REUSEPORT) {
+#if defined(SO_REUSEPORT)
+        uv_os_fd_t fd;
+        int on = 1;
+        if (uv_fileno((const uv_handle_t *) &srv->listener, &fd) != 0 ||
+            setsockopt((uv_os_sock_t) fd, SOL_SOCKET, SO_REUSEPORT, (const char *) &on, sizeof(on)) != 0) {
+            UM_LOG(WARN, "failed to set SO_REUSEPORT");
+            return UV_ENOTSUP;
+        }
+#else
+        return UV_ENOTSUP;
+#endif
+    }
+    return uv_tcp_bind(&srv->listener, addr, 0);
+}
+
+static void on_server_connection(uv_stream_t *l, int status) {
+    tlsuv_server_t *srv = l->data;
+    if (status != 0) {
+        UM_LOG(WARN, "listener failed: %d(%s)", status, uv_strerror(status));
+    }
+    srv->connection_cb(srv, status);
+}
+
+int tlsuv_server_listen(tlsuv_server_t *srv, int backlog, tlsuv_connection_cb cb) {
+    if (cb == NULL) {
+        return UV_EINVAL;
+    }
+    if (srv->listener.loop == NULL) {
+        return UV_EINVAL;
+    }
+    srv->connection_cb = cb;
+    return uv_listen((uv_stream_t *) &srv->listener, backlog, on_server_connection);
+}
+
+int tlsuv_server_accept(tlsuv_server_t *srv, tlsuv_stream_t *clt, uv_connect_t *req, uv_connect_cb cb) {
+    if (!req || !clt->socket) {
+        return UV_EINVAL;
+    }
+    if (clt->conn_req != NULL) {
+        return UV_EALREADY;
+    }
+
+    int rc = tcp_src_accept(clt->socket, (uv_stream_t *) &srv->listener);
+    if (rc != 0) {
+        return rc;
+    }
+
+    req->handle = (uv_stream_t *) clt;
+    req->cb = cb;
+    clt->tls = srv->tls;
+    tlsuv__free(clt->host);
+    clt->host = NULL;
+    clt->conn_req = req;
+
+    memset(&clt->timing, 0, sizeof(clt->timing));
+    clt->socket->timing = NULL;
+
+    // accepted socket is connected, handshake waits for client hello
+    on_src_connect((tlsuv_src_t *) clt->socket, 0, clt);
+    return 0;
+}
+
+static void on_server_close(uv_handle_t *h) {
+    tlsuv_server_t *srv = h->data;
+    if (srv->close_cb) {
+        srv->close_cb((uv_handle_t *) srv);
+    }
+}
+
+int tlsuv_server_close(tlsuv_server_t *srv, uv_close_cb close_cb) {
+    srv->close_cb = close_cb;
+    if (srv->listener.loop == NULL) {
+        if (close_cb) close_cb((uv_handle_t *) srv);
+        return 0;
+    }
+    uv_close((uv_handle_t *) &srv->listener, on_server_close);
+    return 0;
+}
+
 int tlsuv_stream_read(tlsuv_stream_t *clt, uv_alloc_cb alloc_cb, uv_read_cb read_cb) {
     clt->alloc_cb = (uv_link_alloc_cb) alloc_cb;
     clt->read_cb = (uv_link_read_cb) read_cb;
     return 0;
 }
 
+int tlsuv_stream_read_stop(tlsuv_stream_t *clt) {
+    uv_link_t *l = (uv_link_t *) clt;
+    if (l->parent == NULL || clt->conn_req != NULL) {
+        return UV_ENOTCONN;
+    }
+    return uv_link_read_stop(l);
+}
+
+int tlsuv_stream_read_start(tlsuv_stream_t *clt) {
+    uv_link_t *l = (uv_link_t *) clt;
+    if (l->parent == NULL || clt->conn_req != NULL) {
+        return UV_ENOTCONN;
+    }
+    return uv_link_read_start(l);
+}
+
 static void on_mbed_link_write(uv_link_t* l, int status, void *ctx) {
     uv_write_t *wr = ctx;
     wr->cb(wr, status);
 }
 
+struct tlsuv_stream_write_s {
+    uv_write_t *req;
+    STAILQ_ENTRY(tlsuv_stream_write_s) _next;
+    unsigned int nbufs;
+    uv_buf_t bufs[];
+};
+
+// corked writes submitted as single link write
+typedef struct corked_batch_s {
+    struct corked_q writes;
+    uv_buf_t bufs[];
+} corked_batch_t;
+
+static void complete_corked(struct corked_q *writes, int status) {
+    while (!STAILQ_EMPTY(writes)) {
+        struct tlsuv_stream_write_s *w = STAILQ_FIRST(writes);
+        STAILQ_REMOVE_HEAD(writes, _next);
+        uv_write_t *req = w->req;
+        tlsuv__free(w);
+        if (req->cb) req->cb(req, status);
+    }
+}
+
+static void cancel_corked(tlsuv_stream_t *clt, int err) {
+    struct corked_q writes = STAILQ_HEAD_INITIALIZER(writes);
+    STAILQ_CONCAT(&writes, &clt->corked_writes);
+    clt->corked_count = 0;
+    complete_corked(&writes, err);
+}
+
+static void on_corked_write(uv_link_t *l, int status, void *ctx) {
+    corked_batch_t *batch = ctx;
+    complete_corked(&batch->writes, status);
+    tlsuv__free(batch);
+}
+
 int tlsuv_stream_write(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_write_cb cb) {
+    return tlsuv_stream_writev(req, clt, buf, 1, cb);
+}
+
+int tlsuv_stream_writev(uv_write_t *req, tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs, uv_write_cb cb) {
+    if (nbufs == 0 || bufs == NULL) {
+        return UV_EINVAL;
+    }
+
     req->handle = (uv_stream_t *) clt;
     req->cb = cb;
-    return uv_link_write((uv_link_t *) clt, buf, 1, NULL, on_mbed_link_write, req);
+    if (clt->corked) {
+        struct tlsuv_stream_write_s *w = tlsuv__malloc(sizeof(*w) + nbufs * sizeof(uv_buf_t));
+        if (w == NULL) {
+            return UV_ENOMEM;
+        }
+        w->req = req;
+        w->nbufs = nbufs;
+        memcpy(w->bufs, bufs, nbufs * sizeof(uv_buf_t));
+        STAILQ_INSERT_TAIL(&clt->corked_writes, w, _next);
+        clt->corked_count += nbufs;
+        return 0;
+    }
+    return uv_link_write((uv_link_t *) clt, bufs, nbufs, NULL, on_mbed_link_write, req);
+}
+
+int tlsuv_stream_cork(tlsuv_stream_t *clt) {
+    clt->corked = 1;
+    return 0;
+}
+
+int tlsuv_stream_uncork(tlsuv_stream_t *clt) {
+    clt->corked = 0;
+    if (STAILQ_EMPTY(&clt->corked_writes)) {
+        return 0;
+    }
+
+    corked_batch_t *batch = tlsuv__malloc(sizeof(*batch) + clt->corked_count * sizeof(uv_buf_t));
+    if (batch == NULL) {
+        cancel_corked(clt, UV_ENOMEM);
+        return UV_ENOMEM;
+    }
+
+    STAILQ_INIT(&batch->writes);
+    STAILQ_CONCAT(&batch->writes, &clt->corked_writes);
+    unsigned int nbufs = 0;
+    struct tlsuv_stream_write_s *w;
+    STAILQ_FOREACH(w, &batch->writes, _next) {
+        memcpy(batch->bufs + nbufs, w->bufs, w->nbufs * sizeof(uv_buf_t));
+        nbufs += w->nbufs;
+    }
+    clt->corked_count = 0;
+
+    UM_LOG(TRACE, "flushing %u corked buffers", nbufs);
+    int rc = uv_link_write((uv_link_t *) clt, batch->bufs, nbufs, NULL, on_corked_write, batch);
+    if (rc != 0) {
+        // writes were already accepted, report failure through their callbacks
+        complete_corked(&batch->writes, rc);
+        tlsuv__free(batch);
+    }
+    return rc;
+}
+
+size_t tlsuv_stream_mem_usage(tlsuv_stream_t *clt) {
+    size_t total = 0;
+    if (clt->socket && clt->socket->conn) {
+        total += sizeof(uv_tcp_t) + sizeof(uv_connect_t);
+    }
+    if (clt->tls_engine) {
+        total += tlsuv_tls_link_mem_usage(&clt->tls_link);
+    }
+    struct tlsuv_stream_write_s *w;
+    STAILQ_FOREACH(w, &clt->corked_writes, _next) {
+        total += sizeof(*w) + w->nbufs * sizeof(uv_buf_t);
+    }
+    return total;
 }
 
 int tlsuv_stream_free(tlsuv_stream_t *clt) {
     if (clt->host) {
-        free(clt->host);
+        tlsuv__free(clt->host);
         clt->host = NULL;
     }
     if (clt->tls_engine) {
@@ -211,7 +532,6 @@ int tlsuv_stream_free(tlsuv_stream_t *clt) {
     }
     if (clt->socket) {
         tcp_src_free(clt->socket);
-        free(clt->socket);
         clt->socket = NULL;
     }
     return 0;
@@ -0,0 +1,415 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <tlsuv/tlsuv.h>
+#include "portable_endian.h"
+#include "trust_store.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE 16
+
+#define PEM_BEGIN "-----BEGIN CERTIFICATE-----"
+#define PEM_END "-----END CERTIFICATE-----"
+
+struct tlsuv_trust_store_s {
+    const uint8_t *base;
+    size_t size;
+    size_t count;
+#if _WIN32
+    HANDLE mapping;
+#endif
+};
+
+struct ts_entry {
+    uint64_t hash;
+    size_t order;
+    uint8_t *der;
+    size_t len;
+};
+
+uint64_t tlsuv_trust_store_name_hash(const uint8_t *name, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void read_entry(const tlsuv_trust_store *ts, size_t idx, uint64_t *hash, uint32_t *off, uint32_t *len) {
+    const uint8_t *e = ts->base + HEADER_SIZE + idx * ENTRY_SIZE;
+    uint64_t h;
+    uint32_t o, l;
+    memcpy(&h, e, sizeof(h));
+    memcpy(&o, e + 8, sizeof(o));
+    memcpy(&l, e + 12, sizeof(l));
+    *hash = le64toh(h);
+    *off = le32toh(o);
+    *len = le32toh(l);
+}
+
+// index and certificate bounds are checked once, lookups trust them afterwards
+static int check_index(tlsuv_trust_store *ts) {
+    uint32_t count;
+    memcpy(&count, ts->base + 8, sizeof(count));
+    count = le32toh(count);
+    if ((ts->size - HEADER_SIZE) / ENTRY_SIZE < count) {
+        return -1;
+    }
+
+    size_t data_start = HEADER_SIZE + (size_t) count * ENTRY_SIZE;
+    uint64_t prev = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t h;
+        uint32_t off, len;
+        read_entry(ts, i, &h, &off, &len);
+        if (off < data_start || off > ts->size || len > ts->size - off || (i > 0 && h < prev)) {
+            return -1;
+        }
+        prev = h;
+    }
+    ts->count = count;
+    return 0;
+}
+
+tlsuv_trust_store *tlsuv_trust_store_open(const char *path) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    tlsuv_trust_store ts = {0};
+#if _WIN32
+    HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(f, &size) || size.QuadPart < HEADER_SIZE) {
+        CloseHandle(f);
+        return NULL;
+    }
+    ts.size = (size_t) size.QuadPart;
+    ts.mapping = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(f);
+    if (ts.mapping == NULL) {
+        return NULL;
+    }
+    ts.base = MapViewOfFile(ts.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (ts.base == NULL || memcmp(ts.base, TLSUV_TRUST_STORE_MAGIC, 8) != 0) {
+        if (ts.base) UnmapViewOfFile(ts.base);
+        CloseHandle(ts.mapping);
+        return NULL;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    // PEM bundles are rejected by the magic before anything is mapped
+    struct stat st;
+    char magic[8];
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < HEADER_SIZE ||
+        read(fd, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, TLSUV_TRUST_STORE_MAGIC, 8) != 0) {
+        close(fd);
+        return NULL;
+    }
+    ts.size = (size_t) st.st_size;
+    void *map = mmap(NULL, ts.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        UM_LOG(WARN, "failed to map trust store[%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    ts.base = map;
+#endif
+
+    if (check_index(&ts) != 0) {
+        UM_LOG(WARN, "trust store[%s] is corrupted", path);
+#if _WIN32
+        UnmapViewOfFile(ts.base);
+        CloseHandle(ts.mapping);
+#else
+        munmap((void *) ts.base, ts.size);
+#endif
+        return NULL;
+    }
+
+    tlsuv_trust_store *res = tlsuv__malloc(sizeof(*res));
+    *res = ts;
+    UM_LOG(DEBG, "mapped trust store[%s] with %zd certificates", path, res->count);
+    return res;
+}
+
+void tlsuv_trust_store_close(tlsuv_trust_store *ts) {
+    if (ts == NULL) return;
+
+#if _WIN32
+    UnmapViewOfFile(ts->base);
+    CloseHandle(ts->mapping);
+#else
+    munmap((void *) ts->base, ts->size);
+#endif
+    tlsuv__free(ts);
+}
+
+size_t tlsuv_trust_store_count(const tlsuv_trust_store *ts) {
+    return ts->count;
+}
+
+size_t tlsuv_trust_store_find(const tlsuv_trust_store *ts, uint64_t subject_hash) {
+    size_t lo = 0;
+    size_t hi = ts->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t h;
+        uint32_t off, len;
+        read_entry(ts, mid, &h, &off, &len);
+        if (h < subject_hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const uint8_t *tlsuv_trust_store_cert(const tlsuv_trust_store *ts, size_t idx, uint64_t *subject_hash, size_t *len) {
+    if (idx >= ts->count) {
+        return NULL;
+    }
+
+    uint64_t h;
+    uint32_t off, l;
+    read_entry(ts, idx, &h, &off, &l);
+    if (subject_hash) *subject_hash = h;
+    *len = l;
+    return ts->base + off;
+}
+
+// DER tag and length at p, returns start of content
+static const uint8_t *der_item(const uint8_t *p, const uint8_t *end, uint8_t *tag, size_t *len) {
+    if (end - p < 2) {
+        return NULL;
+    }
+    *tag = *p++;
+    size_t l = *p++;
+    if (l & 0x80) {
+        int n = (int) (l & 0x7f);
+        if (n == 0 || n > 4 || end - p < n) {
+            return NULL;
+        }
+        for (l = 0; n > 0; n--) {
+            l = (l << 8) | *p++;
+        }
+    }
+    if ((size_t) (end - p) < l) {
+        return NULL;
+    }
+    *len = l;
+    return p;
+}
+
+// encoded certificate length and subject name (with its tag and length)
+static int cert_subject(const uint8_t *der, size_t der_len, size_t *cert_len, const uint8_t **name, size_t *name_len) {
+    const uint8_t *end = der + der_len;
+    uint8_t tag;
+    size_t len;
+
+    const uint8_t *p = der_item(der, end, &tag, &len);
+    if (p == NULL || tag != 0x30) {
+        return -1;
+    }
+    *cert_len = (size_t) (p - der) + len;
+    end = p + len;
+
+    // TBSCertificate
+    p = der_item(p, end, &tag, &len);
+    if (p == NULL || tag != 0x30) {
+        return -1;
+    }
+    end = p + len;
+
+    const uint8_t *c = der_item(p, end, &tag, &len);
+    if (c != NULL && tag == 0xa0) {
+        p = c + len;
+    }
+    // serial, signature algorithm, issuer, validity
+    for (int i = 0; i < 4; i++) {
+        if ((c = der_item(p, end, &tag, &len)) == NULL) {
+            return -1;
+        }
+        p = c + len;
+    }
+
+    c = der_item(p, end, &tag, &len);
+    if (c == NULL || tag != 0x30) {
+        return -1;
+    }
+    *name = p;
+    *name_len = (size_t) (c - p) + len;
+    return 0;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    const struct ts_entry *l = a;
+    const struct ts_entry *r = b;
+    if (l->hash != r->hash) {
+        return l->hash < r->hash ? -1 : 1;
+    }
+    return l->order < r->order ? -1 : l->order > r->order;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    size_t cap = 64 * 1024;
+    size_t size = 0;
+    char *buf = tlsuv__malloc(cap + 1);
+    size_t n;
+    while ((n = fread(buf + size, 1, cap - size, f)) > 0) {
+        size += n;
+        if (size == cap) {
+            cap *= 2;
+            buf = tlsuv__realloc(buf, cap + 1);
+        }
+    }
+    fclose(f);
+    buf[size] = 0;
+    *len = size;
+    return buf;
+}
+
+static int write_store(const char *path, struct ts_entry *entries, size_t count) {
+    size_t total = HEADER_SIZE + count * ENTRY_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        total += entries[i].len;
+    }
+    if (total > UINT32_MAX) {
+        return UV_E2BIG;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return uv_translate_sys_error(errno);
+    }
+
+    uint8_t hdr[HEADER_SIZE] = {0};
+    uint32_t n = htole32((uint32_t) count);
+    memcpy(hdr, TLSUV_TRUST_STORE_MAGIC, 8);
+    memcpy(hdr + 8, &n, sizeof(n));
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1;
+
+    uint32_t off = (uint32_t) (HEADER_SIZE + count * ENTRY_SIZE);
+    for (size_t i = 0; ok && i < count; i++) {
+        uint8_t e[ENTRY_SIZE];
+        uint64_t h = htole64(entries[i].hash);
+        uint32_t o = htole32(off);
+        uint32_t l = htole32((uint32_t) entries[i].len);
+        memcpy(e, &h, sizeof(h));
+        memcpy(e + 8, &o, sizeof(o));
+        memcpy(e + 12, &l, sizeof(l));
+        ok = fwrite(e, sizeof(e), 1, f) == 1;
+        off += (uint32_t) entries[i].len;
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = fwrite(entries[i].der, entries[i].len, 1, f) == 1;
+    }
+
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : UV_EIO;
+}
+
+int tlsuv_trust_store_compile(const char *pem_file, const char *out_file) {
+    size_t pem_len;
+    char *pem = read_file(pem_file, &pem_len);
+    if (pem == NULL) {
+        return uv_translate_sys_error(errno);
+    }
+
+    struct ts_entry *entries = NULL;
+    size_t count = 0, cap = 0;
+    const char *p = pem;
+    const char *b;
+    while ((b = strstr(p, PEM_BEGIN)) != NULL) {
+        b += strlen(PEM_BEGIN);
+        const char *e = strstr(b, PEM_END);
+        if (e == NULL) {
+            break;
+        }
+        p = e + strlen(PEM_END);
+
+        size_t der_len = tlsuv_base64_decoded_len((size_t) (e - b));
+        uint8_t *der = tlsuv__malloc(der_len > 0 ? der_len : 1);
+        const uint8_t *name;
+        size_t name_len, cert_len;
+        if (tlsuv_base64_decode(b, (size_t) (e - b), der, &der_len, 0) != 0 ||
+            cert_subject(der, der_len, &cert_len, &name, &name_len) != 0) {
+            UM_LOG(WARN, "skipping malformed certificate in [%s]", pem_file);
+            tlsuv__free(der);
+            continue;
+        }
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            entries = tlsuv__realloc(entries, cap * sizeof(*entries));
+        }
+        entries[count].hash = tlsuv_trust_store_name_hash(name, name_len);
+        entries[count].order = count;
+        entries[count].der = der;
+        entries[count].len = cert_len;
+        count++;
+    }
+    tlsuv__free(pem);
+
+    int rc = UV_EINVAL;
+    if (count > 0) {
+        qsort(entries, count, sizeof(*entries), entry_cmp);
+        rc = write_store(out_file, entries, count);
+    }
+    for (size_t i = 0; i < count; i++) {
+        tlsuv__free(entries[i].der);
+    }
+    tlsuv__free(entries);
+
+    if (rc != 0) {
+        UM_LOG(WARN, "failed to compile trust store[%s]: %d/%s", out_file, rc, uv_strerror(rc));
+        return rc;
+    }
+    UM_LOG(DEBG, "compiled %zd certificates from [%s] into [%s]", count, pem_file, out_file);
+    return (int) count;
+}
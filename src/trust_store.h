@@ -0,0 +1,71 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_TRUST_STORE_H
+#define TLSUV_TRUST_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Precompiled trust store, see tlsuv_trust_store_compile().
+ *
+ * File is mapped read-only: header, index sorted by subject hash, then DER certificates.
+ * Nothing is decoded on open, engines parse certificates they need straight from the mapping.
+ *
+ *   0   magic "TLSUVCA1"
+ *   8   uint32 certificate count
+ *   12  uint32 reserved
+ *   16  index: uint64 subject hash, uint32 offset, uint32 length (little-endian)
+ *
+ * Subject hash is FNV-1a of DER encoded subject name, so it does not depend on TLS library.
+ */
+
+#define TLSUV_TRUST_STORE_MAGIC "TLSUVCA1"
+
+typedef struct tlsuv_trust_store_s tlsuv_trust_store;
+
+/**
+ * Maps precompiled trust store.
+ * @return NULL if file is missing or not a trust store
+ */
+tlsuv_trust_store *tlsuv_trust_store_open(const char *path);
+
+void tlsuv_trust_store_close(tlsuv_trust_store *ts);
+
+size_t tlsuv_trust_store_count(const tlsuv_trust_store *ts);
+
+uint64_t tlsuv_trust_store_name_hash(const uint8_t *name, size_t len);
+
+/**
+ * First index of certificate with the given subject hash, or tlsuv_trust_store_count() if there is none.
+ * Certificates with the same hash follow it.
+ */
+size_t tlsuv_trust_store_find(const tlsuv_trust_store *ts, uint64_t subject_hash);
+
+/**
+ * DER encoding of certificate at index (inside the mapping), NULL if index is out of range.
+ */
+const uint8_t *tlsuv_trust_store_cert(const tlsuv_trust_store *ts, size_t idx, uint64_t *subject_hash, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_TRUST_STORE_H
@@ -17,22 +17,33 @@
 #include <stdarg.h>
 
 #include "um_debug.h"
+#include "async_log.h"
 #include <tlsuv/tlsuv.h>
 
 int um_log_level = ERR;
 static tlsuv_log_func log_func = NULL;
 
 void um_log(int lvl, const char* file, unsigned int line, const char *fmt,  ...) {
-    static char logbuf[1024];
     if (log_func) {
         va_list argp;
         va_start(argp, fmt);
-        vsnprintf(logbuf, sizeof(logbuf), fmt, argp);
-        log_func(lvl, file, line, logbuf);
+        if (!async_log_active() || async_log_record(lvl, file, line, fmt, argp) != 0) {
+            char logbuf[1024];
+            vsnprintf(logbuf, sizeof(logbuf), fmt, argp);
+            log_func(lvl, file, line, logbuf);
+        }
+        va_end(argp);
+    }
+}
+
+void um_log_output(int lvl, const char *file, unsigned int line, const char *msg) {
+    tlsuv_log_func f = log_func;
+    if (f) {
+        f(lvl, file, line, msg);
     }
 }
 
 void tlsuv_set_debug(int level, tlsuv_log_func output_f) {
     um_log_level = level;
     log_func = output_f;
-}
\ No newline at end of file
+}
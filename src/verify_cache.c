@@ -0,0 +1,125 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include "verify_cache.h"
+#include "tlsuv/queue.h"
+#include "um_debug.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_TLS
+#include "alloc.h"
+
+struct verify_entry {
+    uint8_t key[TLSUV_VERIFY_KEY_LEN];
+    uint64_t expires; // uv_hrtime() based
+
+    TAILQ_ENTRY(verify_entry) _next;
+};
+
+struct tlsuv_verify_cache_s {
+    size_t max_entries;
+    size_t count;
+    uint64_t ttl;
+
+    // most recently used first
+    TAILQ_HEAD(verify_list, verify_entry) entries;
+};
+
+#define NS_PER_SEC 1000000000ULL
+
+static void free_entry(tlsuv_verify_cache *cache, struct verify_entry *e) {
+    TAILQ_REMOVE(&cache->entries, e, _next);
+    cache->count--;
+    tlsuv__free(e);
+}
+
+static struct verify_entry *find_entry(tlsuv_verify_cache *cache, const uint8_t *key) {
+    struct verify_entry *e;
+    TAILQ_FOREACH(e, &cache->entries, _next) {
+        if (memcmp(e->key, key, TLSUV_VERIFY_KEY_LEN) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+tlsuv_verify_cache *tlsuv_verify_cache_new(size_t max_entries, unsigned int ttl_sec) {
+    if (max_entries == 0) {
+        return NULL;
+    }
+
+    tlsuv_verify_cache *cache = tlsuv__calloc(1, sizeof(tlsuv_verify_cache));
+    cache->max_entries = max_entries;
+    cache->ttl = (uint64_t) ttl_sec * NS_PER_SEC;
+    TAILQ_INIT(&cache->entries);
+    return cache;
+}
+
+void tlsuv_verify_cache_free(tlsuv_verify_cache *cache) {
+    if (cache == NULL) return;
+
+    while (!TAILQ_EMPTY(&cache->entries)) {
+        free_entry(cache, TAILQ_FIRST(&cache->entries));
+    }
+    tlsuv__free(cache);
+}
+
+bool tlsuv_verify_cache_check(tlsuv_verify_cache *cache, const uint8_t key[TLSUV_VERIFY_KEY_LEN]) {
+    if (cache == NULL) return false;
+
+    struct verify_entry *e = find_entry(cache, key);
+    if (e == NULL) {
+        return false;
+    }
+
+    if (e->expires <= uv_hrtime()) {
+        free_entry(cache, e);
+        return false;
+    }
+
+    if (e != TAILQ_FIRST(&cache->entries)) {
+        TAILQ_REMOVE(&cache->entries, e, _next);
+        TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+    }
+    UM_LOG(VERB, "using cached verification result");
+    return true;
+}
+
+void tlsuv_verify_cache_put(tlsuv_verify_cache *cache, const uint8_t key[TLSUV_VERIFY_KEY_LEN], int64_t valid_sec) {
+    if (cache == NULL || valid_sec <= 0) return;
+
+    uint64_t ttl = (uint64_t) valid_sec * NS_PER_SEC;
+    if (ttl > cache->ttl) {
+        ttl = cache->ttl;
+    }
+
+    struct verify_entry *e = find_entry(cache, key);
+    if (e == NULL) {
+        while (cache->count >= cache->max_entries) {
+            free_entry(cache, TAILQ_LAST(&cache->entries, verify_list));
+        }
+        e = tlsuv__calloc(1, sizeof(struct verify_entry));
+        memcpy(e->key, key, TLSUV_VERIFY_KEY_LEN);
+        cache->count++;
+    } else {
+        TAILQ_REMOVE(&cache->entries, e, _next);
+    }
+    e->expires = uv_hrtime() + ttl;
+    TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+}
@@ -0,0 +1,54 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_VERIFY_CACHE_H
+#define TLSUV_VERIFY_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// digest of the presented certificate chain (SHA-256)
+#define TLSUV_VERIFY_KEY_LEN 32
+
+/**
+ * LRU cache of successful certificate verification outcomes, keyed by digest of presented chain.
+ * Entries expire after TTL, or when any certificate of the chain expires, whichever comes first.
+ */
+typedef struct tlsuv_verify_cache_s tlsuv_verify_cache;
+
+tlsuv_verify_cache *tlsuv_verify_cache_new(size_t max_entries, unsigned int ttl_sec);
+void tlsuv_verify_cache_free(tlsuv_verify_cache *cache);
+
+/**
+ * Checks if chain was verified recently, expired entry is dropped.
+ */
+bool tlsuv_verify_cache_check(tlsuv_verify_cache *cache, const uint8_t key[TLSUV_VERIFY_KEY_LEN]);
+
+/**
+ * Records successful verification.
+ * @param valid_sec seconds until the first certificate in the chain expires
+ */
+void tlsuv_verify_cache_put(tlsuv_verify_cache *cache, const uint8_t key[TLSUV_VERIFY_KEY_LEN], int64_t valid_sec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_VERIFY_CACHE_H
@@ -16,32 +16,49 @@
 #include "http_req.h"
 #include "portable_endian.h"
 #include "um_debug.h"
+#include "pool.h"
+#include "read_sizing.h"
 #include "win32_compat.h"
+#include "ws_parser.h"
+#include "ws_mask.h"
+#include "ws_deflate.h"
 
+#include <inttypes.h>
 #include <string.h>
 #include <tlsuv/http.h>
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_WEBSOCKET
+#include "alloc.h"
 static const char *DEFAULT_PATH = "/";
 
-#define WS_FIN 0x80U
-#define WS_OP_BITS 0xFU
-#define WS_MASK 0x80U
+// header bytes: 2 + 8 (extended length) + 4 (mask)
+#define WS_HDR_MAX 14
 
-enum OpCode {
-    OpCode_TXT = 0x1U,
-    OpCode_BIN = 0x2U,
-    OpCode_Close = 0x8U,
-    OpCode_Ping = 0x9U,
-    OpCode_Pong = 0xAU
-};
+// batched frames are submitted early once they reach this size
+#define WS_BATCH_MAX (64 * 1024)
+
+// close status: message is too big to process (RFC 6455, 7.4.1)
+#define WS_CLOSE_TOO_BIG 1009
 
 typedef struct ws_write_s {
     uv_write_t *wr;
     uv_write_cb cb;
-    uv_buf_t *bufs;
-    int nbufs;
-
+    // separately allocated data (handshake), masked frame payload is stored after the request
+    char *data;
+    uv_buf_t bufs[2];
+    unsigned int nbufs;
+    // bytes counted in write queue size
+    size_t size;
+    STAILQ_ENTRY(ws_write_s) _next;
+    char header[WS_HDR_MAX];
 } ws_write_t;
 
+// batched frames submitted as single link write
+typedef struct ws_batch_s {
+    struct ws_batch_q writes;
+    uv_buf_t bufs[];
+} ws_batch_t;
+
 extern tls_context *get_default_tls();
 
 static void src_connect_cb(tlsuv_src_t *sl, int status, void *connect_ctx);
@@ -49,37 +66,55 @@ static void ws_read_cb(uv_link_t* link,
                                 ssize_t nread,
                                 const uv_buf_t* buf);
 static void ws_write_cb(uv_link_t *l, int nwrote, void *data);
+static void ws_write_done(tlsuv_websocket_t *ws, ws_write_t *ws_wreq, int status);
+static void ws_flush(tlsuv_websocket_t *ws);
 static void send_pong(tlsuv_websocket_t *ws, const char* ping_data, int len);
+static void send_close(tlsuv_websocket_t *ws, uint16_t code);
+static void on_pong(tlsuv_websocket_t *ws, const char *data, size_t len);
+static void ws_keepalive_start(tlsuv_websocket_t *ws);
+static int ws_on_frame(void *ctx, unsigned int op, char *data, size_t len);
 static void tls_hs_cb(tls_link_t *tls, int status);
 
 static int ws_read_start(uv_link_t *l);
+static void ws_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf);
 
 static const uv_link_methods_t ws_methods = {
         .close = uv_link_default_close,
         .read_start = ws_read_start,
         .write = uv_link_default_write,
-        .alloc_cb_override = uv_link_default_alloc_cb_override,
+        .alloc_cb_override = ws_alloc,
         .read_cb_override = ws_read_cb
 };
 
+// read buffers are sized by recent reads and released to the pool by ws_read_cb
+static void ws_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf) {
+    tlsuv_websocket_t *ws = l->data;
+    size_t len;
+    buf->base = tlsuv_pool_read_alloc(read_sizer_size(&ws->read_size), &len);
+    buf->len = len;
+}
+
 
 int tlsuv_websocket_init_with_src(uv_loop_t *loop, tlsuv_websocket_t *ws, tlsuv_src_t *src) {
     ws->loop = loop;
     ws->type = UV_IDLE;
     ws->src = src;
-    ws->req = calloc(1, sizeof(tlsuv_http_req_t));
+    ws->req = tlsuv__calloc(1, sizeof(tlsuv_http_req_t));
+    ws->parser = tlsuv__calloc(1, sizeof(*ws->parser));
+    ws_parser_init(ws->parser);
+    ws->parser->max_msg = TLSUV_WS_DEFAULT_MAX_MESSAGE;
+    ws->mask_state = ws_mask_seed(ws);
+    STAILQ_INIT(&ws->batch);
 
-    time_t t;
-    srand(time(&t));
     char key[25];
     for (int i = 0; i < 22; i++) {
-        int v = rand() & 0x3f;
+        int v = (int)(ws_mask_next(&ws->mask_state) & 0x3f);
         if (v < 26) {
             key[i] = (char)('A' + v);
         } else if (v < 52) {
             key[i] = (char)('a' + v - 26);
         } else if (v < 62) {
-            key[i] = (char)('a' + v - 52);
+            key[i] = (char)('0' + v - 52);
         } else if (v == 62){
             key[i] = '+';
         } else {
@@ -89,10 +124,10 @@ int tlsuv_websocket_init_with_src(uv_loop_t *loop, tlsuv_websocket_t *ws, tlsuv_
     key[22] = '=';
     key[23] = '=';
     key[24] = 0;
-    set_http_header(&ws->req->req_headers, "Upgrade", "websocket");
-    set_http_header(&ws->req->req_headers, "Connection", "Upgrade");
-    set_http_header(&ws->req->req_headers, "Sec-WebSocket-Key", key);
-    set_http_header(&ws->req->req_headers, "Sec-WebSocket-Version", "13");
+    http_req_set_header(ws->req, &ws->req->req_headers, "Upgrade", "websocket");
+    http_req_set_header(ws->req, &ws->req->req_headers, "Connection", "Upgrade");
+    http_req_set_header(ws->req, &ws->req->req_headers, "Sec-WebSocket-Key", key);
+    http_req_set_header(ws->req, &ws->req->req_headers, "Sec-WebSocket-Version", "13");
 
     return 0;
 }
@@ -104,7 +139,28 @@ int tlsuv_websocket_init(uv_loop_t *loop, tlsuv_websocket_t *ws) {
 }
 
 void tlsuv_websocket_set_header(tlsuv_websocket_t *ws, const char *name, const char *value) {
-    set_http_header(&ws->req->req_headers, name, value);
+    http_req_set_header(ws->req, &ws->req->req_headers, name, value);
+}
+
+int tlsuv_websocket_set_deflate(tlsuv_websocket_t *ws, int client_max_window_bits, int server_max_window_bits, int flags) {
+    if (ws->req == NULL || ws->host != NULL ||
+        client_max_window_bits < 0 || server_max_window_bits < 0) {
+        return UV_EINVAL;
+    }
+    if ((client_max_window_bits != 0 && (client_max_window_bits < 9 || client_max_window_bits > 15)) ||
+        (server_max_window_bits != 0 && (server_max_window_bits < 8 || server_max_window_bits > 15))) {
+        return UV_EINVAL;
+    }
+
+    ws_deflate_t *d = ws_deflate_new(client_max_window_bits, server_max_window_bits, flags);
+    if (d == NULL) {
+        return UV_ENOTSUP;
+    }
+    ws_deflate_free(ws->deflate);
+    ws->deflate = d;
+    ws_deflate_set_max_output(d, (size_t) ws->parser->max_msg);
+    http_req_set_header(ws->req, &ws->req->req_headers, "Sec-WebSocket-Extensions", ws_deflate_offer(d));
+    return 0;
 }
 
 int tlsuv_websocket_connect(uv_connect_t *req, tlsuv_websocket_t *ws, const char *url, uv_connect_cb conn_cb, uv_read_cb data_cb) {
@@ -142,7 +198,7 @@ int tlsuv_websocket_connect(uv_connect_t *req, tlsuv_websocket_t *ws, const char
     }
 
     if (u.hostname != NULL) {
-        host = strndup(u.hostname, u.hostname_len);
+        host = tlsuv__strndup(u.hostname, u.hostname_len);
     }
     else {
         UM_LOG(ERR, "invalid URL: no host");
@@ -160,18 +216,23 @@ int tlsuv_websocket_connect(uv_connect_t *req, tlsuv_websocket_t *ws, const char
 
     if (ws->tls != NULL) {
         tlsuv_tls_link_init(&ws->tls_link, ws->tls->api->new_engine(ws->tls->ctx, host), tls_hs_cb);
+        tlsuv_tls_link_async_handshake(&ws->tls_link, ws->loop);
+        tlsuv_tls_link_async_crypto(&ws->tls_link, ws->loop);
     }
 
     const char *path = DEFAULT_PATH;
     if (u.path != NULL) {
-        path = strndup(u.path, u.path_len);
+        path = tlsuv__strndup(u.path, u.path_len);
     }
 
+    // headers set since init are kept in the request arena
+    struct tlsuv_http_hdr_arena_s *arena = ws->req->hdr_arena;
     http_req_init(ws->req, "GET", path);
+    ws->req->hdr_arena = arena;
     if (path != DEFAULT_PATH) {
-        free((char*)path);
+        tlsuv__free((char*)path);
     }
-    set_http_header(&ws->req->req_headers, "host", host);
+    http_req_set_header(ws->req, &ws->req->req_headers, "host", host);
 
     ws->host = host;
     ws->read_cb = data_cb;
@@ -179,57 +240,260 @@ int tlsuv_websocket_connect(uv_connect_t *req, tlsuv_websocket_t *ws, const char
     return ws->src->connect(ws->src, host, portstr, src_connect_cb, req);
 }
 
+/*
+ * Frame is written as two buffers: header kept inline in the write request and
+ * payload masked into space allocated together with the request.
+ * Masking needs a copy (caller's buffer must not be modified), this is the only one made here.
+ */
+static ws_write_t *ws_frame_new(tlsuv_websocket_t *ws, unsigned int hdr0, const char *payload, size_t len) {
+    ws_write_t *ws_wreq = tlsuv_pool_alloc(sizeof(ws_write_t) + len);
+    ws_wreq->wr = NULL;
+    ws_wreq->cb = NULL;
+    ws_wreq->data = NULL;
+
+    char *hdr = ws_wreq->header;
+    char *ptr = hdr;
+    *ptr++ = (char)hdr0;
+    if (len < 126) {
+        *ptr++ = (char)(WS_MASK | (uint8_t)len);
+    } else if (len <= 0xffff) {
+        uint16_t v = htobe16(len);
+        *ptr++ = (char)(WS_MASK | 126U);
+        memcpy(ptr, &v, sizeof(v));
+        ptr += sizeof(v);
+    } else {
+        uint64_t v = htobe64(len);
+        *ptr++ = (char)(WS_MASK | 127U);
+        memcpy(ptr, &v, sizeof(v));
+        ptr += sizeof(v);
+    }
+
+    uint8_t mask[4];
+    uint32_t mask_key = ws_mask_next(&ws->mask_state);
+    memcpy(mask, &mask_key, sizeof(mask));
+    memcpy(ptr, mask, sizeof(mask));
+    ptr += sizeof(mask);
+
+    ws_wreq->bufs[0] = uv_buf_init(hdr, (unsigned int)(ptr - hdr));
+    ws_wreq->nbufs = 1;
+    if (len > 0) {
+        char *body = (char *) (ws_wreq + 1);
+        ws_mask(body, payload, len, mask, 0);
+        ws_wreq->bufs[1] = uv_buf_init(body, len);
+        ws_wreq->nbufs = 2;
+    }
+    ws_wreq->size = ws_wreq->bufs[0].len + len;
+    ws->write_queue_size += ws_wreq->size;
+    return ws_wreq;
+}
+
+static void ws_batch_cb(uv_link_t *l, int status, void *ctx) {
+    ws_batch_t *batch = ctx;
+    while (!STAILQ_EMPTY(&batch->writes)) {
+        ws_write_t *ws_wreq = STAILQ_FIRST(&batch->writes);
+        STAILQ_REMOVE_HEAD(&batch->writes, _next);
+        ws_write_done(l->data, ws_wreq, status);
+    }
+    tlsuv_pool_free(batch);
+}
+
+static void ws_flush_cb(uv_timer_t *t) {
+    ws_flush(t->data);
+}
+
+// submits batched frames, failures are reported through write callbacks
+static void ws_flush(tlsuv_websocket_t *ws) {
+    if (ws->flush_timer) {
+        uv_timer_stop(ws->flush_timer);
+    }
+    if (STAILQ_EMPTY(&ws->batch)) {
+        return;
+    }
+
+    int rc;
+    ws_write_t *first = STAILQ_FIRST(&ws->batch);
+    if (STAILQ_NEXT(first, _next) == NULL) {
+        STAILQ_INIT(&ws->batch);
+        ws->batch_bufs = 0;
+        ws->batch_size = 0;
+        rc = uv_link_write(&ws->ws_link, first->bufs, first->nbufs, NULL, ws_write_cb, first);
+        if (rc != 0) {
+            ws_write_done(ws, first, rc);
+        }
+        return;
+    }
+
+    ws_batch_t *batch = tlsuv_pool_alloc(sizeof(*batch) + ws->batch_bufs * sizeof(uv_buf_t));
+    STAILQ_INIT(&batch->writes);
+    STAILQ_CONCAT(&batch->writes, &ws->batch);
+    unsigned int nbufs = 0;
+    ws_write_t *w;
+    STAILQ_FOREACH(w, &batch->writes, _next) {
+        memcpy(batch->bufs + nbufs, w->bufs, w->nbufs * sizeof(uv_buf_t));
+        nbufs += w->nbufs;
+    }
+    UM_LOG(TRACE, "flushing %u buffers(%zu bytes) of batched frames", nbufs, ws->batch_size);
+    ws->batch_bufs = 0;
+    ws->batch_size = 0;
+
+    rc = uv_link_write(&ws->ws_link, batch->bufs, nbufs, NULL, ws_batch_cb, batch);
+    if (rc != 0) {
+        ws_batch_cb(&ws->ws_link, rc, batch);
+    }
+}
+
+// frames are batched until the next loop iteration unless `nodelay` is set
+static int ws_frame_write(tlsuv_websocket_t *ws, ws_write_t *ws_wreq) {
+    if (ws->nodelay && STAILQ_EMPTY(&ws->batch)) {
+        int rc = uv_link_write(&ws->ws_link, ws_wreq->bufs, ws_wreq->nbufs, NULL, ws_write_cb, ws_wreq);
+        if (rc != 0) {
+            ws->write_queue_size -= ws_wreq->size;
+            tlsuv_pool_free(ws_wreq);
+        }
+        return rc;
+    }
+
+    if (ws->flush_timer == NULL) {
+        ws->flush_timer = tlsuv__calloc(1, sizeof(*ws->flush_timer));
+        uv_timer_init(ws->loop, ws->flush_timer);
+        ws->flush_timer->data = ws;
+    }
+    if (STAILQ_EMPTY(&ws->batch)) {
+        uv_timer_start(ws->flush_timer, ws_flush_cb, 0, 0);
+    }
+    STAILQ_INSERT_TAIL(&ws->batch, ws_wreq, _next);
+    ws->batch_bufs += ws_wreq->nbufs;
+    ws->batch_size += ws_wreq->size;
+    if (ws->nodelay || ws->batch_size >= WS_BATCH_MAX) {
+        ws_flush(ws);
+    }
+    return 0;
+}
+
+// sends data frame, `op` is message type for the first frame of message or OpCode_Cont
+// errors are returned without calling `cb`, it is only called for frames that were queued
+static int ws_send(uv_write_t *req, tlsuv_websocket_t *ws, unsigned int op, bool fin,
+                   const char *data, size_t data_len, uv_write_cb cb) {
+    unsigned int hdr0 = op | (fin ? WS_FIN : 0);
+    const char *payload = data;
+    size_t len = data_len;
+    if (ws->deflate) {
+        int rc = ws_deflate_compress(ws->deflate, data, data_len, fin, &payload, &len);
+        if (rc != 0) {
+            UM_LOG(WARN, "failed to compress message: %d", rc);
+            return rc;
+        }
+        // compressed bit is only set on the first frame of message
+        if (op != OpCode_Cont) {
+            hdr0 |= WS_RSV1;
+        }
+    }
+
+    ws_write_t *ws_wreq = ws_frame_new(ws, hdr0, payload, len);
+    ws_wreq->wr = req;
+    ws_wreq->cb = cb;
+    return ws_frame_write(ws, ws_wreq);
+}
+
 int tlsuv_websocket_write(uv_write_t *req, tlsuv_websocket_t *ws, uv_buf_t *buf, uv_write_cb cb) {
     if (ws->closed) {
         cb(req, UV_ECONNRESET);
         return UV_ECONNRESET;
     }
+    if (ws->send_msg) {
+        UM_LOG(WARN, "streamed message is in progress");
+        return UV_EBUSY;
+    }
+
+    return ws_send(req, ws, OpCode_BIN, true, buf->base, buf->len, cb);
+}
 
-    uv_buf_t bufs;
-    int headerlen = 6;
-    if (buf->len > 125) {
-        headerlen += 2;
+int tlsuv_websocket_msg_begin(tlsuv_websocket_t *ws, tlsuv_ws_msg_type type) {
+    if (ws->closed) {
+        return UV_ECONNRESET;
     }
-    if (buf->len > 0xffff) {
-        headerlen += 6;
+    if (type != TLSUV_WS_TEXT && type != TLSUV_WS_BINARY) {
+        return UV_EINVAL;
     }
-    uint8_t mask[4];
-    *(int*)&mask = rand();
-    char *frame = malloc(headerlen + buf->len);
-
-    frame[0] = WS_FIN | OpCode_BIN;
-    char *ptr = frame + 1;
-    if (buf->len < 126) {
-        *ptr++ = WS_MASK | (uint8_t)buf->len;
-    } else if (buf->len <= 0xffff) {
-        uint16_t v = htobe16(buf->len);
-        *ptr++ = WS_MASK | 126U;
-        memcpy(frame + 2, &v, sizeof(v));
-        ptr += sizeof(v);
-    } else {
-        uint64_t v = htobe64(buf->len);
-        *ptr++ = WS_MASK | 127U;
-        memcpy(frame + 2, &v, sizeof(v));
-        ptr += sizeof(v);
+    if (ws->send_msg) {
+        return UV_EBUSY;
     }
-    memcpy(ptr, mask, sizeof(mask));
-    ptr += sizeof(mask);
+    ws->send_msg = true;
+    ws->send_op = type == TLSUV_WS_TEXT ? OpCode_TXT : OpCode_BIN;
+    return 0;
+}
 
-    for (size_t i = 0; i < buf->len; i++) {
-        *((char*)ptr + i) = (char)(mask[i % 4] ^ buf->base[i]);
+static int ws_msg_send(uv_write_t *req, tlsuv_websocket_t *ws, const uv_buf_t *buf, bool fin, uv_write_cb cb) {
+    if (ws->closed) {
+        cb(req, UV_ECONNRESET);
+        return UV_ECONNRESET;
+    }
+    if (!ws->send_msg) {
+        return UV_EINVAL;
     }
 
-    bufs.len = headerlen + buf->len;
-    bufs.base = frame;
+    unsigned int op = ws->send_op;
+    ws->send_op = OpCode_Cont;
+    ws->send_msg = !fin;
+    return ws_send(req, ws, op, fin, buf ? buf->base : NULL, buf ? buf->len : 0, cb);
+}
 
-    ws_write_t *ws_wreq = calloc(1, sizeof(ws_write_t));
-    ws_wreq->wr = req;
-    ws_wreq->bufs = malloc(sizeof(uv_buf_t));
-    ws_wreq->bufs[0] = bufs;
-    ws_wreq->nbufs = 1;
-    ws_wreq->cb = cb;
+int tlsuv_websocket_msg_write(uv_write_t *req, tlsuv_websocket_t *ws, const uv_buf_t *buf, uv_write_cb cb) {
+    return ws_msg_send(req, ws, buf, false, cb);
+}
+
+int tlsuv_websocket_msg_end(uv_write_t *req, tlsuv_websocket_t *ws, const uv_buf_t *buf, uv_write_cb cb) {
+    return ws_msg_send(req, ws, buf, true, cb);
+}
+
+int tlsuv_websocket_set_nodelay(tlsuv_websocket_t *ws, bool nodelay) {
+    ws->nodelay = nodelay;
+    if (nodelay) {
+        ws_flush(ws);
+    }
+    return 0;
+}
+
+int tlsuv_websocket_set_keepalive(tlsuv_websocket_t *ws, unsigned int interval_ms, unsigned int pong_timeout_ms) {
+    ws->ping_interval = interval_ms;
+    ws->pong_timeout = pong_timeout_ms ? pong_timeout_ms : interval_ms;
+    if (ws->ping_timer.wheel == NULL) {
+        tlsuv_timeout_init(ws->loop, &ws->ping_timer);
+        ws->ping_timer.data = ws;
+    }
+
+    ws->ping_sent = 0;
+    tlsuv_timeout_stop(&ws->ping_timer);
+    // connected already
+    if (ws->ws_link.data != NULL && ws->conn_req == NULL) {
+        ws_keepalive_start(ws);
+    }
+    return 0;
+}
+
+int tlsuv_websocket_ping_stats(const tlsuv_websocket_t *ws, tlsuv_ws_ping_stats *stats) {
+    if (ws == NULL || stats == NULL) {
+        return UV_EINVAL;
+    }
+    *stats = ws->ping_stats;
+    return 0;
+}
 
-    return uv_link_write(&ws->ws_link, &bufs, 1, NULL, ws_write_cb, ws_wreq);
+size_t tlsuv_websocket_write_queue_size(const tlsuv_websocket_t *ws) {
+    return ws->write_queue_size;
+}
+
+void tlsuv_websocket_set_fragment_cb(tlsuv_websocket_t *ws, tlsuv_ws_fragment_cb cb) {
+    ws->fragment_cb = cb;
+    ws->parser->stream = cb != NULL;
+}
+
+int tlsuv_websocket_set_max_message(tlsuv_websocket_t *ws, size_t max_size) {
+    ws->parser->max_msg = max_size;
+    if (ws->deflate) {
+        ws_deflate_set_max_output(ws->deflate, max_size);
+    }
+    return 0;
 }
 
 
@@ -259,24 +523,25 @@ static void src_connect_cb(tlsuv_src_t *sl, int status, void *connect_ctx) {
     }
 }
 
-static void ws_write_cb(uv_link_t *l, int nwrote, void *data) {
-    ws_write_t *ws_wreq = data;
-    UM_LOG(VERB, "write complete rc = %d", nwrote);
-
-    if (nwrote < 0) {
-        tlsuv_websocket_t *ws = l->data;
+static void ws_write_done(tlsuv_websocket_t *ws, ws_write_t *ws_wreq, int status) {
+    if (ws) {
+        ws->write_queue_size -= ws_wreq->size;
+    }
+    if (status < 0 && ws) {
         ws->closed = true;
     }
 
     if (ws_wreq->wr) {
         uv_write_t *wr = ws_wreq->wr;
-        ws_wreq->cb(wr, nwrote);
-    }
-    for (int i=0; i < ws_wreq->nbufs; i++) {
-        free(ws_wreq->bufs[i].base);
+        ws_wreq->cb(wr, status);
     }
-    free(ws_wreq->bufs);
-    free(ws_wreq);
+    tlsuv_pool_free(ws_wreq->data);
+    tlsuv_pool_free(ws_wreq);
+}
+
+static void ws_write_cb(uv_link_t *l, int nwrote, void *data) {
+    UM_LOG(VERB, "write complete rc = %d", nwrote);
+    ws_write_done(l->data, data, nwrote);
 }
 
 int ws_read_start(uv_link_t *l) {
@@ -285,17 +550,19 @@ int ws_read_start(uv_link_t *l) {
 
     tlsuv_websocket_t *ws = l->data;
     uv_buf_t buf;
-    buf.base = malloc(8196);
-    buf.len = http_req_write(ws->req, buf.base, 8196);
+    http_req_wire *w = http_req_serialize(ws->req);
+    buf.base = http_req_wire_flatten(w);
+    buf.len = w->len;
+    http_req_wire_free(w);
 
     UM_LOG(VERB, "starting WebSocket handshake(sending %zd bytes)[%.*s]", buf.len, buf.len, buf.base);
 
-    ws_write_t *ws_wreq = calloc(1, sizeof(ws_write_t));
-    ws_wreq->bufs = malloc(sizeof(uv_buf_t));
+    ws_write_t *ws_wreq = tlsuv_pool_calloc(sizeof(ws_write_t));
+    ws_wreq->data = buf.base;
     ws_wreq->bufs[0] = buf;
     ws_wreq->nbufs = 1;
 
-    return uv_link_propagate_write(l->parent, l, &buf, 1, NULL, ws_write_cb, ws_wreq);
+    return uv_link_propagate_write(l->parent, l, ws_wreq->bufs, ws_wreq->nbufs, NULL, ws_write_cb, ws_wreq);
 }
 
 void ws_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *buf) {
@@ -309,8 +576,12 @@ void ws_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *buf) {
         } else {
             ws->read_cb((uv_stream_t *) ws, nread, buf);
         }
+        if (buf && buf->base) {
+            tlsuv_pool_free(buf->base);
+        }
         return;
     }
+    read_sizer_update(&ws->read_size, nread, buf->len);
 
     ssize_t processed = 0;
     bool failed = false;
@@ -320,14 +591,31 @@ void ws_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *buf) {
             UM_LOG(ERR, "failed to parse connect/upgrade response");
             ws->conn_req->cb(ws->conn_req, -1);
             http_req_free(ws->req);
-            free(ws->req);
+            tlsuv__free(ws->req);
             ws->req = NULL;
             failed = true;
         } else {
             UM_LOG(VERB, "processed %zd out of %zd", processed, nread);
             if (ws->req->state == completed) {
-                if (ws->req->resp.code == 101) {
-                    UM_LOG(VERB, "websocket connected");
+                int ext = 0;
+                if (ws->req->resp.code == 101 && ws->deflate) {
+                    ext = ws_deflate_accept(ws->deflate,
+                                            tlsuv_http_resp_header(&ws->req->resp, "Sec-WebSocket-Extensions"));
+                    if (ext == 1) {
+                        ws->parser->rsv1_ok = true;
+                    } else {
+                        ws_deflate_free(ws->deflate);
+                        ws->deflate = NULL;
+                    }
+                }
+
+                if (ws->req->resp.code == 101 && ext < 0) {
+                    UM_LOG(ERR, "failed to negotiate websocket extensions");
+                    ws->conn_req->cb(ws->conn_req, UV_EPROTO);
+                    failed = true;
+                } else if (ws->req->resp.code == 101) {
+                    UM_LOG(VERB, "websocket connected%s", ext == 1 ? " (permessage-deflate)" : "");
+                    ws_keepalive_start(ws);
                     ws->conn_req->cb(ws->conn_req, 0);
                 } else {
                     UM_LOG(ERR, "failed to connect to websocket: %s(%d)", ws->req->resp.status, ws->req->resp.code);
@@ -336,118 +624,204 @@ void ws_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *buf) {
                 }
                 ws->conn_req = NULL;
                 http_req_free(ws->req);
-                free(ws->req);
+                tlsuv__free(ws->req);
                 ws->req = NULL;
             }
         }
     }
 
     if (failed || processed == nread) {
-        free(buf->base);
+        tlsuv_pool_free(buf->base);
         return;
     }
 
-    char *frame = buf->base + processed;
-    char op = (char)(frame[0] & WS_OP_BITS);
-    bool masked = (frame[1] & WS_MASK) != 0;
-    size_t len = frame[1] & (~WS_MASK);
-    char *dp = frame + 2;
-    if (len == 126) {
-        len = be16toh(*(uint16_t *)(&frame[2]));
-        dp += 2;
-    } else if (len == 127) {
-        len = be64toh(*(uint64_t*)&frame[2]);
-        dp += 8;
+    // every frame of the buffer is delivered, partial frame is kept by the parser until the next read
+    ssize_t rc = ws_parser_execute(ws->parser, buf->base + processed, nread - processed, ws_on_frame, ws);
+    if (rc >= 0 && ws->parser->err) { // frame handler failed
+        rc = ws->parser->err;
     }
-
-    uint8_t mask[4];
-    if (masked) {
-        memcpy(mask, dp, sizeof(mask));
-        dp += sizeof(mask);
-    } else {
-        memset(mask, 0, sizeof(mask));
+    if (rc == UV_E2BIG) {
+        UM_LOG(WARN, "received message exceeds limit of %" PRIu64 " bytes", ws->parser->max_msg);
+        send_close(ws, WS_CLOSE_TOO_BIG);
+    }
+    if (rc < 0) {
+        UM_LOG(WARN, "invalid websocket frame: %zd/%s", rc, uv_strerror((int) rc));
+        uv_buf_t b = uv_buf_init(NULL, 0);
+        ws->read_cb((uv_stream_t *) ws, rc, &b);
     }
 
+    tlsuv_pool_free(buf->base);
+}
+
+static int ws_on_frame(void *ctx, unsigned int op, char *data, size_t len) {
+    tlsuv_websocket_t *ws = ctx;
+    uv_buf_t b = uv_buf_init(data, (unsigned int) len);
     switch (op) {
         case OpCode_TXT:
         case OpCode_BIN:
-            UM_LOG(TRACE, "got data %zd masked=%d", len, masked);
-            for (size_t i=0; i<len; i++) {
-                buf->base[i] = (char)(*dp ^ mask[i % 4]);
-                dp++;
+            UM_LOG(TRACE, "got data %zd", len);
+            // whole messages are delivered unless receiver wants fragments
+            bool fin = ws->fragment_cb == NULL || ws->parser->msg_end;
+            if (ws->parser->compressed) {
+                char *msg;
+                size_t msg_len;
+                int rc = ws_deflate_decompress(ws->deflate, data, len, fin, &msg, &msg_len);
+                if (rc != 0) {
+                    // compression context is lost, stream cannot continue
+                    ws->parser->err = rc;
+                    return 1;
+                }
+                data = msg;
+                len = msg_len;
+            }
+            if (ws->fragment_cb) {
+                ws->fragment_cb(ws, op == OpCode_TXT ? TLSUV_WS_TEXT : TLSUV_WS_BINARY, data, len, fin);
+            } else {
+                b = uv_buf_init(data, (unsigned int) len);
+                ws->read_cb((uv_stream_t *) ws, (ssize_t) len, &b);
             }
-            ws->read_cb((uv_stream_t *) ws, (ssize_t)len, buf);
             break;
         case OpCode_Close:
             UM_LOG(TRACE, "got close");
-            ws->read_cb((uv_stream_t *) ws, UV_EOF, buf);
-            break;
+            ws->read_cb((uv_stream_t *) ws, UV_EOF, &b);
+            return 1;
         case OpCode_Ping:
-            UM_LOG(TRACE, "got ping masked=%d len=%zd", masked, len);
-            send_pong(ws, dp, (int)len);
+            UM_LOG(TRACE, "got ping len=%zd", len);
+            send_pong(ws, data, (int) len);
             break;
         case OpCode_Pong:
             UM_LOG(TRACE, "got pong");
+            on_pong(ws, data, len);
             break;
-        default:
-            UM_LOG(INFO, "got unsupported frame %h", op);
     }
+    return 0;
+}
 
-    free(buf->base);
+static void send_close(tlsuv_websocket_t *ws, uint16_t code) {
+    if (ws->closed) {
+        return;
+    }
+    uint16_t payload = htobe16(code);
+    ws_write_t *ws_wreq = ws_frame_new(ws, WS_FIN | OpCode_Close, (const char *) &payload, sizeof(payload));
+    if (ws_frame_write(ws, ws_wreq) == 0) {
+        ws_flush(ws);
+    }
 }
 
 static void send_pong(tlsuv_websocket_t *ws, const char* ping_data, int len) {
     UM_LOG(TRACE, "send_pong len=%d", len);
-    uint8_t mask[4];
-    uv_buf_t buf;
-    buf.len = 2 + sizeof(mask) + len;
-    buf.base = malloc(buf.len);
+    ws_write_t *ws_wreq = ws_frame_new(ws, WS_FIN | OpCode_Pong, ping_data, ping_data ? (size_t) len : 0);
+    ws_frame_write(ws, ws_wreq);
+}
 
-    buf.base[0] = WS_FIN | OpCode_Pong;
-    buf.base[1] = (char)(WS_MASK | (0x7f & len));
+static void ping_timer_cb(tlsuv_timeout_t *t) {
+    tlsuv_websocket_t *ws = t->data;
+    if (ws->ping_sent != 0) {
+        UM_LOG(WARN, "no pong received in %u ms", ws->pong_timeout);
+        ws->ping_sent = 0;
+        uv_buf_t b = uv_buf_init(NULL, 0);
+        ws->read_cb((uv_stream_t *) ws, UV_ETIMEDOUT, &b);
+        return;
+    }
 
-    char *ptr = buf.base + 2;
-    *(int*)&mask = rand();
-    memcpy(ptr, mask, sizeof(mask));
-    ptr += sizeof(mask);
+    // payload carries send time, so that pong can be matched to it
+    ws->ping_sent = uv_hrtime();
+    uint64_t payload = htobe64(ws->ping_sent);
+    ws_write_t *ws_wreq = ws_frame_new(ws, WS_FIN | OpCode_Ping, (const char *) &payload, sizeof(payload));
+    if (ws_frame_write(ws, ws_wreq) == 0) {
+        // do not let batching add to measured RTT
+        ws_flush(ws);
+    }
+    ws->ping_stats.pings_sent++;
+    tlsuv_timeout_start(t, ping_timer_cb, ws->pong_timeout);
+}
 
-    if (ping_data != NULL && len > 0) {
-        for (size_t i = 0; i < buf.len; i++) {
-            *((char*)ptr + i) = (char)(mask[i % 4] ^ *(ping_data + i));
-        }
+static void ws_keepalive_start(tlsuv_websocket_t *ws) {
+    if (ws->ping_interval == 0 || ws->closed) {
+        return;
     }
+    ws->ping_sent = 0;
+    tlsuv_timeout_start(&ws->ping_timer, ping_timer_cb, ws->ping_interval);
+}
 
-    ws_write_t *ws_wreq = calloc(1, sizeof(ws_write_t));
-    ws_wreq->bufs = malloc(sizeof(uv_buf_t));
-    ws_wreq->bufs[0] = buf;
-    ws_wreq->nbufs = 1;
+static void on_pong(tlsuv_websocket_t *ws, const char *data, size_t len) {
+    uint64_t payload;
+    // unsolicited pong, or reply to a ping that timed out
+    if (ws->ping_sent == 0 || len != sizeof(payload)) {
+        return;
+    }
+    memcpy(&payload, data, sizeof(payload));
+    if (be64toh(payload) != ws->ping_sent) {
+        return;
+    }
 
-    uv_link_write(&ws->ws_link, &buf, 1, NULL, ws_write_cb, ws_wreq);
+    uint64_t rtt = uv_hrtime() - ws->ping_sent;
+    tlsuv_ws_ping_stats *st = &ws->ping_stats;
+    st->pongs_received++;
+    st->rtt_last = rtt;
+    if (st->rtt_min == 0 || rtt < st->rtt_min) {
+        st->rtt_min = rtt;
+    }
+    if (st->rtt_ewma == 0) {
+        st->rtt_ewma = rtt;
+    } else {
+        st->rtt_ewma = st->rtt_ewma - st->rtt_ewma / 8 + rtt / 8;
+    }
+    UM_LOG(TRACE, "ping rtt=%" PRIu64 "us srtt=%" PRIu64 "us", rtt / 1000, st->rtt_ewma / 1000);
+
+    ws_keepalive_start(ws);
 }
 
 static void on_ws_close(tlsuv_websocket_t *ws) {
     if (ws == NULL) return;
 
-    if (!ws->closed && ws->close_cb) {
+    bool notify = !ws->closed && ws->close_cb;
+    // frames written after close was requested
+    while (!STAILQ_EMPTY(&ws->batch)) {
+        ws_write_t *ws_wreq = STAILQ_FIRST(&ws->batch);
+        STAILQ_REMOVE_HEAD(&ws->batch, _next);
+        ws_write_done(ws, ws_wreq, UV_ECANCELED);
+    }
+    ws->batch_bufs = 0;
+    ws->batch_size = 0;
+    tlsuv_timeout_close(&ws->ping_timer);
+    if (ws->flush_timer) {
+        uv_close((uv_handle_t *) ws->flush_timer, (uv_close_cb) tlsuv__free);
+        ws->flush_timer = NULL;
+    }
+
+    if (notify) {
         ws->close_cb((uv_handle_t *) ws);
     }
 
     if (ws->req) {
         http_req_free(ws->req);
-        free(ws->req);
+        tlsuv__free(ws->req);
         ws->req = NULL;
     }
     if (ws->host) {
-        free(ws->host);
+        tlsuv__free(ws->host);
         ws->host = NULL;
     }
+    if (ws->parser) {
+        ws_parser_free(ws->parser);
+        tlsuv__free(ws->parser);
+        ws->parser = NULL;
+    }
+    if (ws->deflate) {
+        ws_deflate_free(ws->deflate);
+        ws->deflate = NULL;
+    }
     if (ws->tls && ws->tls_link.engine) {
         ws->tls->api->free_engine(ws->tls_link.engine);
         ws->tls_link.engine = NULL;
     }
     if (ws->src) {
         ws->src->cancel(ws->src);
-        tcp_src_free((tcp_src_t *) ws->src);
+        // custom source is owned by the caller
+        if (ws->src == (tlsuv_src_t *) &ws->default_src) {
+            tcp_src_free(&ws->default_src);
+        }
         ws->src = NULL;
     }
     ws->closed = true;
@@ -461,6 +835,8 @@ static void ws_close_cb(uv_link_t *l) {
 int tlsuv_websocket_close(tlsuv_websocket_t *ws, uv_close_cb cb) {
     ws->close_cb = cb;
     if (ws->ws_link.data != NULL) {
+        // batched frames go out ahead of link shutdown
+        ws_flush(ws);
         uv_link_close(&ws->ws_link, ws_close_cb);
     }
     else {
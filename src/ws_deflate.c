@@ -0,0 +1,297 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include <tlsuv/websocket.h>
+
+#include "ws_deflate.h"
+#include "compression.h"
+#include "um_debug.h"
+#include "win32_compat.h"
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_WEBSOCKET
+#include "alloc.h"
+
+#define EXT_NAME "permessage-deflate"
+
+// deflate output for messages larger than this is not kept between messages
+#define OUT_KEEP_MAX (64 * 1024)
+
+static const char DEFLATE_TRAILER[] = { 0x00, 0x00, (char)0xff, (char)0xff };
+
+struct ws_deflate_s {
+    int offer_client_bits;
+    int offer_server_bits;
+    int offer_flags;
+    char offer[128];
+
+    // negotiated
+    int client_bits;
+    bool client_reset;
+    bool server_reset;
+
+    http_deflater_t *deflater;
+    http_inflater_t *inflater;
+
+    // separate outputs: received message may still be in use by reader while it writes
+    struct out_buf {
+        char *data;
+        size_t len;
+        size_t cap;
+        // 0 for no limit
+        size_t max;
+        int err;
+    } compressed, plain;
+};
+
+static void out_append(void *ctx, const char *data, ssize_t len) {
+    struct out_buf *o = ctx;
+    if (len <= 0 || o->err) return;
+
+    // decompression bomb, rest of the output is dropped
+    if (o->max > 0 && (size_t)len > o->max - o->len) {
+        o->err = UV_E2BIG;
+        return;
+    }
+
+    if (o->len + (size_t)len > o->cap) {
+        size_t cap = o->cap ? o->cap : 1024;
+        while (cap < o->len + (size_t)len) cap *= 2;
+        char *m = tlsuv__realloc(o->data, cap);
+        if (m == NULL) {
+            o->err = UV_ENOMEM;
+            return;
+        }
+        o->data = m;
+        o->cap = cap;
+    }
+    memcpy(o->data + o->len, data, (size_t)len);
+    o->len += (size_t)len;
+}
+
+static void out_reset(struct out_buf *o) {
+    if (o->cap > OUT_KEEP_MAX) {
+        tlsuv__free(o->data);
+        o->data = NULL;
+        o->cap = 0;
+    }
+    o->len = 0;
+    o->err = 0;
+}
+
+ws_deflate_t *ws_deflate_new(int client_bits, int server_bits, int flags) {
+    if ((client_bits != 0 && (client_bits < 9 || client_bits > 15)) ||
+        (server_bits != 0 && (server_bits < 8 || server_bits > 15))) {
+        return NULL;
+    }
+
+    const char *enc = um_available_encoding();
+    if (enc == NULL || strstr(enc, "deflate") == NULL) {
+        UM_LOG(WARN, "permessage-deflate is not available: zlib is not loaded");
+        return NULL;
+    }
+
+    ws_deflate_t *d = tlsuv__calloc(1, sizeof(*d));
+    d->offer_client_bits = client_bits;
+    d->offer_server_bits = server_bits;
+    d->offer_flags = flags;
+
+    // bare client_max_window_bits tells server that it may limit our window
+    int n = snprintf(d->offer, sizeof(d->offer), EXT_NAME "; client_max_window_bits");
+    if (client_bits) {
+        n += snprintf(d->offer + n, sizeof(d->offer) - n, "=%d", client_bits);
+    }
+    if (server_bits) {
+        n += snprintf(d->offer + n, sizeof(d->offer) - n, "; server_max_window_bits=%d", server_bits);
+    }
+    if (flags & TLSUV_WS_CLIENT_NO_CONTEXT_TAKEOVER) {
+        n += snprintf(d->offer + n, sizeof(d->offer) - n, "; client_no_context_takeover");
+    }
+    if (flags & TLSUV_WS_SERVER_NO_CONTEXT_TAKEOVER) {
+        snprintf(d->offer + n, sizeof(d->offer) - n, "; server_no_context_takeover");
+    }
+    return d;
+}
+
+void ws_deflate_free(ws_deflate_t *d) {
+    if (d == NULL) return;
+
+    if (d->deflater) um_free_deflater(d->deflater);
+    if (d->inflater) um_free_inflater(d->inflater);
+    tlsuv__free(d->compressed.data);
+    tlsuv__free(d->plain.data);
+    tlsuv__free(d);
+}
+
+const char *ws_deflate_offer(ws_deflate_t *d) {
+    return d->offer;
+}
+
+static int parse_bits(const char *val, size_t len, int min) {
+    if (len == 0 || len > 2) return -1;
+    int v = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)val[i])) return -1;
+        v = v * 10 + (val[i] - '0');
+    }
+    return v >= min && v <= 15 ? v : -1;
+}
+
+static void trim(const char **s, const char **e) {
+    while (*s < *e && isspace((unsigned char)**s)) (*s)++;
+    while (*e > *s && isspace((unsigned char)(*e)[-1])) (*e)--;
+}
+
+int ws_deflate_accept(ws_deflate_t *d, const char *ext) {
+    if (ext == NULL) {
+        return 0;
+    }
+
+    const char *end = ext + strlen(ext);
+    const char *s = ext;
+    const char *e = strchr(s, ';');
+    if (e == NULL) e = end;
+    trim(&s, &e);
+    if ((size_t)(e - s) != strlen(EXT_NAME) || strncasecmp(s, EXT_NAME, e - s) != 0 || strchr(ext, ',') != NULL) {
+        // only one extension was offered
+        UM_LOG(WARN, "server responded with extension that was not offered: %s", ext);
+        return UV_EPROTO;
+    }
+
+    int client_bits = d->offer_client_bits ? d->offer_client_bits : 15;
+    bool client_reset = (d->offer_flags & TLSUV_WS_CLIENT_NO_CONTEXT_TAKEOVER) != 0;
+    bool server_reset = false;
+
+    while (e < end) {
+        s = e + 1;
+        e = strchr(s, ';');
+        if (e == NULL) e = end;
+
+        const char *pe = e;
+        trim(&s, &pe);
+        const char *eq = memchr(s, '=', pe - s);
+        const char *ne = eq ? eq : pe;
+        trim(&s, &ne);
+        size_t nlen = ne - s;
+        const char *val = NULL;
+        size_t vlen = 0;
+        if (eq) {
+            const char *ve = pe;
+            val = eq + 1;
+            trim(&val, &ve);
+            vlen = ve - val;
+            if (vlen >= 2 && val[0] == '"' && ve[-1] == '"') {
+                val++;
+                vlen -= 2;
+            }
+        }
+
+#define PARAM(n) (nlen == strlen(n) && strncasecmp(s, n, nlen) == 0)
+        if (PARAM("server_no_context_takeover") && !eq) {
+            server_reset = true;
+        } else if (PARAM("client_no_context_takeover") && !eq) {
+            client_reset = true;
+        } else if (PARAM("server_max_window_bits") && eq && parse_bits(val, vlen, 8) > 0) {
+            // decompression always uses the largest window, it covers any smaller one
+        } else if (PARAM("client_max_window_bits") && eq && parse_bits(val, vlen, 8) > 0) {
+            int bits = parse_bits(val, vlen, 8);
+            if (bits > client_bits) {
+                UM_LOG(WARN, "server asked for larger client window than offered: %d", bits);
+                return UV_EPROTO;
+            }
+            // zlib cannot produce raw deflate with 256 byte window
+            if (bits < 9) {
+                UM_LOG(WARN, "client_max_window_bits=%d is not supported", bits);
+                return UV_EPROTO;
+            }
+            client_bits = bits;
+        } else {
+            UM_LOG(WARN, "invalid permessage-deflate parameter: %.*s", (int)(pe - s), s);
+            return UV_EPROTO;
+        }
+#undef PARAM
+    }
+
+    d->client_bits = client_bits;
+    d->client_reset = client_reset;
+    d->server_reset = server_reset;
+    d->deflater = um_get_raw_deflater(client_bits);
+    d->inflater = um_get_raw_inflater(15, out_append, &d->plain);
+    if (d->deflater == NULL || d->inflater == NULL) {
+        UM_LOG(WARN, "failed to create permessage-deflate streams");
+        return UV_EPROTO;
+    }
+    UM_LOG(VERB, "permessage-deflate: client window=%d reset=%d/%d", client_bits, client_reset, server_reset);
+    return 1;
+}
+
+int ws_deflate_compress(ws_deflate_t *d, const char *data, size_t len, bool fin, const char **out, size_t *out_len) {
+    struct out_buf *o = &d->compressed;
+    out_reset(o);
+    if (um_deflate_flush(d->deflater, data, len, out_append, o) != 0 || o->err) {
+        return UV_EPROTO;
+    }
+
+    if (fin) {
+        // sync flush always ends with empty stored block, it is implied on the wire at the end of message
+        if (o->len >= sizeof(DEFLATE_TRAILER) &&
+            memcmp(o->data + o->len - sizeof(DEFLATE_TRAILER), DEFLATE_TRAILER, sizeof(DEFLATE_TRAILER)) == 0) {
+            o->len -= sizeof(DEFLATE_TRAILER);
+        }
+        // zlib has nothing to flush for empty message, it is sent as empty stored block (RFC 7692, 7.2.3.6)
+        if (o->len == 0) {
+            out_append(o, "", 1);
+        }
+        if (d->client_reset) {
+            um_reset_raw_deflater(d->deflater);
+        }
+    }
+    *out = o->data;
+    *out_len = o->len;
+    return 0;
+}
+
+void ws_deflate_set_max_output(ws_deflate_t *d, size_t max_size) {
+    d->plain.max = max_size;
+}
+
+int ws_deflate_decompress(ws_deflate_t *d, const char *data, size_t len, bool fin, char **out, size_t *out_len) {
+    struct out_buf *o = &d->plain;
+    out_reset(o);
+    if (um_inflate(d->inflater, data, len) < 0 || o->err == UV_E2BIG ||
+        (fin && um_inflate_state(d->inflater) == 0 &&
+         um_inflate(d->inflater, DEFLATE_TRAILER, sizeof(DEFLATE_TRAILER)) < 0) ||
+        um_inflate_state(d->inflater) < 0 || o->err) {
+        if (o->err == UV_E2BIG) {
+            UM_LOG(WARN, "inflated message exceeds limit of %zu bytes", o->max);
+            return UV_E2BIG;
+        }
+        UM_LOG(WARN, "failed to inflate message");
+        return UV_EPROTO;
+    }
+
+    // sender may end the stream with final block, next message starts a new one
+    if (fin && (d->server_reset || um_inflate_state(d->inflater) == 1)) {
+        um_reset_raw_inflater(d->inflater);
+    }
+    *out = o->data;
+    *out_len = o->len;
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_WS_DEFLATE_H
+#define TLSUV_WS_DEFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if __cplusplus
+extern "C" {
+#endif
+
+/**
+ * permessage-deflate extension state (RFC 7692).
+ * Outgoing messages are compressed with raw deflate, sync flushed, and sent without the trailing 00 00 FF FF,
+ * incoming messages get the trailer back before they are inflated.
+ */
+typedef struct ws_deflate_s ws_deflate_t;
+
+/**
+ * Creates extension state with offered parameters.
+ * @param client_bits window for outgoing messages (9-15), 0 lets server choose
+ * @param server_bits window requested for incoming messages (8-15), 0 for default
+ * @param flags TLSUV_WS_*_NO_CONTEXT_TAKEOVER
+ * @return NULL if parameters are invalid or zlib is not available
+ */
+ws_deflate_t *ws_deflate_new(int client_bits, int server_bits, int flags);
+
+void ws_deflate_free(ws_deflate_t *d);
+
+/** Sec-WebSocket-Extensions header value offered in handshake */
+const char *ws_deflate_offer(ws_deflate_t *d);
+
+/**
+ * Applies parameters accepted by the server.
+ * @param ext Sec-WebSocket-Extensions header of handshake response, may be NULL
+ * @return 1 if extension is in use, 0 if server did not accept it, UV_EPROTO if response is invalid
+ */
+int ws_deflate_accept(ws_deflate_t *d, const char *ext);
+
+/**
+ * Compresses message, or its fragment, output is valid until the next call.
+ * @param fin data is the end of message
+ * @return 0 or UV_EPROTO
+ */
+int ws_deflate_compress(ws_deflate_t *d, const char *data, size_t len, bool fin, const char **out, size_t *out_len);
+
+/**
+ * Limits decompressed output of a single decompress() call.
+ * @param max_size limit in bytes, 0 for no limit
+ */
+void ws_deflate_set_max_output(ws_deflate_t *d, size_t max_size);
+
+/**
+ * Decompresses message, or its fragment, output is valid until the next call.
+ * @param fin data is the end of message
+ * @return 0, UV_EPROTO, or UV_E2BIG if output exceeds the limit
+ */
+int ws_deflate_decompress(ws_deflate_t *d, const char *data, size_t len, bool fin, char **out, size_t *out_len);
+
+#if __cplusplus
+}
+#endif
+
+#endif//TLSUV_WS_DEFLATE_H
@@ -0,0 +1,188 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "ws_mask.h"
+#include "cpu_features.h"
+#include "um_debug.h"
+
+#include <string.h>
+#include <uv.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define WS_MASK_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define WS_MASK_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#define WS_MASK_AVX2 1
+#define AVX2_TARGET
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define WS_MASK_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef size_t (*mask_kernel)(char *dst, const char *src, size_t len, uint32_t key);
+
+void ws_mask_bytes(char *dst, const char *src, size_t len, const uint8_t mask[4], uint64_t offset) {
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = (char) (src[i] ^ mask[(offset + i) & 3]);
+    }
+}
+
+// kernels process a multiple of 4 bytes and return how many were done,
+// so the key phase for remaining bytes is unchanged
+static size_t mask_word(char *dst, const char *src, size_t len, uint32_t key) {
+    uint64_t k = ((uint64_t) key << 32) | key;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, sizeof(w));
+        w ^= k;
+        memcpy(dst + i, &w, sizeof(w));
+    }
+    return i;
+}
+
+#if WS_MASK_SSE2
+static size_t mask_sse2(char *dst, const char *src, size_t len, uint32_t key) {
+    __m128i k = _mm_set1_epi32((int) key);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src + i + 48));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(a, k));
+        _mm_storeu_si128((__m128i *) (dst + i + 16), _mm_xor_si128(b, k));
+        _mm_storeu_si128((__m128i *) (dst + i + 32), _mm_xor_si128(c, k));
+        _mm_storeu_si128((__m128i *) (dst + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(a, k));
+    }
+    return i;
+}
+#endif
+
+#if WS_MASK_AVX2
+AVX2_TARGET
+static size_t mask_avx2(char *dst, const char *src, size_t len, uint32_t key) {
+    __m256i k = _mm256_set1_epi32((int) key);
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (src + i + 96));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256((__m256i *) (dst + i + 32), _mm256_xor_si256(b, k));
+        _mm256_storeu_si256((__m256i *) (dst + i + 64), _mm256_xor_si256(c, k));
+        _mm256_storeu_si256((__m256i *) (dst + i + 96), _mm256_xor_si256(d, k));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(a, k));
+    }
+    return i;
+}
+#endif
+
+#if WS_MASK_NEON
+static size_t mask_neon(char *dst, const char *src, size_t len, uint32_t key) {
+    uint8x16_t k = vreinterpretq_u8_u32(vdupq_n_u32(key));
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint8x16_t a = vld1q_u8((const uint8_t *) src + i);
+        uint8x16_t b = vld1q_u8((const uint8_t *) src + i + 16);
+        uint8x16_t c = vld1q_u8((const uint8_t *) src + i + 32);
+        uint8x16_t d = vld1q_u8((const uint8_t *) src + i + 48);
+        vst1q_u8((uint8_t *) dst + i, veorq_u8(a, k));
+        vst1q_u8((uint8_t *) dst + i + 16, veorq_u8(b, k));
+        vst1q_u8((uint8_t *) dst + i + 32, veorq_u8(c, k));
+        vst1q_u8((uint8_t *) dst + i + 48, veorq_u8(d, k));
+    }
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t a = vld1q_u8((const uint8_t *) src + i);
+        vst1q_u8((uint8_t *) dst + i, veorq_u8(a, k));
+    }
+    return i;
+}
+#endif
+
+static mask_kernel kernel = mask_word;
+static const char *kernel_name = "word";
+static uv_once_t kernel_once = UV_ONCE_INIT;
+
+static void select_kernel(void) {
+#if WS_MASK_SSE2
+    kernel = mask_sse2;
+    kernel_name = "sse2";
+#endif
+#if WS_MASK_AVX2
+    if (tlsuv_cpu_has_avx2()) {
+        kernel = mask_avx2;
+        kernel_name = "avx2";
+    }
+#endif
+#if WS_MASK_NEON
+    kernel = mask_neon;
+    kernel_name = "neon";
+#endif
+    UM_LOG(VERB, "websocket masking: %s", kernel_name);
+}
+
+const char *ws_mask_impl(void) {
+    uv_once(&kernel_once, select_kernel);
+    return kernel_name;
+}
+
+// short payloads (control frames, small messages) are not worth the dispatch
+#define MASK_BYTES_MAX 16
+
+void ws_mask(char *dst, const char *src, size_t len, const uint8_t mask[4], uint64_t offset) {
+    if (len < MASK_BYTES_MAX) {
+        ws_mask_bytes(dst, src, len, mask, offset);
+        return;
+    }
+
+    uv_once(&kernel_once, select_kernel);
+
+    // rotate key so that it starts at the current payload position,
+    // kernels then work on any alignment without a byte-wise prologue
+    uint8_t rot[4];
+    for (int i = 0; i < 4; i++) {
+        rot[i] = mask[(offset + i) & 3];
+    }
+    uint32_t key;
+    memcpy(&key, rot, sizeof(key));
+
+    size_t done = kernel(dst, src, len, key);
+    done += mask_word(dst + done, src + done, len - done, key);
+    ws_mask_bytes(dst + done, src + done, len - done, rot, 0);
+}
+
+uint64_t ws_mask_seed(const void *salt) {
+    uint64_t seed;
+    if (uv_random(NULL, NULL, &seed, sizeof(seed), 0, NULL) != 0) {
+        UM_LOG(WARN, "system entropy not available, seeding mask generator from clock");
+        seed = uv_hrtime() ^ ((uint64_t) (uintptr_t) salt << 16);
+    }
+    return seed;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_WS_MASK_H
+#define TLSUV_WS_MASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * XORs `len` bytes of `src` with websocket masking key into `dst`.
+ * `dst` and `src` may be the same buffer, neither needs to be aligned.
+ * @param offset position of `src[0]` within the frame payload, selects the starting key byte
+ */
+void ws_mask(char *dst, const char *src, size_t len, const uint8_t mask[4], uint64_t offset);
+
+/**
+ * Reference byte-at-a-time implementation, used for tests and benchmarks.
+ */
+void ws_mask_bytes(char *dst, const char *src, size_t len, const uint8_t mask[4], uint64_t offset);
+
+/**
+ * Name of the masking implementation selected for this CPU ("avx2", "sse2", "neon", "word").
+ */
+const char *ws_mask_impl(void);
+
+/**
+ * Seeds per-connection masking key generator from system entropy.
+ */
+uint64_t ws_mask_seed(const void *salt);
+
+/**
+ * Generates next masking key (splitmix64).
+ * Masking keys only need to be unpredictable to intermediaries (RFC 6455, 10.3),
+ * a fast generator seeded from system entropy is sufficient.
+ */
+static inline uint32_t ws_mask_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t) ((z ^ (z >> 31)) >> 32);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//TLSUV_WS_MASK_H
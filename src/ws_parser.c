@@ -0,0 +1,232 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "ws_parser.h"
+#include "ws_mask.h"
+#include "portable_endian.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TLSUV_ALLOC_SUBSYS TLSUV_MEM_WEBSOCKET
+#include "alloc.h"
+
+void ws_parser_init(ws_parser_t *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+void ws_parser_free(ws_parser_t *p) {
+    tlsuv__free(p->msg);
+    memset(p, 0, sizeof(*p));
+}
+
+static size_t header_size(const uint8_t *hdr) {
+    size_t n = 2;
+    uint8_t len = hdr[1] & ~WS_MASK;
+    if (len == 126) {
+        n += 2;
+    } else if (len == 127) {
+        n += 8;
+    }
+    if (hdr[1] & WS_MASK) {
+        n += 4;
+    }
+    return n;
+}
+
+static int frame_start(ws_parser_t *p) {
+    const uint8_t *hdr = p->hdr;
+    const uint8_t *ptr = hdr + 2;
+    uint64_t len = hdr[1] & ~WS_MASK;
+    if (len == 126) {
+        uint16_t v;
+        memcpy(&v, ptr, sizeof(v));
+        len = be16toh(v);
+        ptr += sizeof(v);
+    } else if (len == 127) {
+        uint64_t v;
+        memcpy(&v, ptr, sizeof(v));
+        len = be64toh(v);
+        ptr += sizeof(v);
+    }
+
+    p->fin = (hdr[0] & WS_FIN) != 0;
+    p->op = hdr[0] & WS_OP_BITS;
+    p->masked = (hdr[1] & WS_MASK) != 0;
+    if (p->masked) {
+        memcpy(p->mask, ptr, sizeof(p->mask));
+    }
+    p->payload_len = len;
+    p->payload_read = 0;
+
+    uint8_t rsv = hdr[0] & WS_RSV_BITS;
+    bool data_start = p->op == OpCode_TXT || p->op == OpCode_BIN;
+    if (rsv == WS_RSV1 && p->rsv1_ok && data_start) {
+        p->compressed = true;
+    } else if (rsv != 0) {
+        return UV_EPROTO;
+    } else if (data_start) {
+        p->compressed = false;
+    }
+    switch (p->op) {
+        case OpCode_Close:
+        case OpCode_Ping:
+        case OpCode_Pong:
+            return p->fin && len <= WS_MAX_CONTROL ? 0 : UV_EPROTO;
+        case OpCode_Cont:
+            // continuation of nothing
+            if (p->msg_op == 0) {
+                return UV_EPROTO;
+            }
+            break;
+        case OpCode_TXT:
+        case OpCode_BIN:
+            // previous message is not finished
+            if (p->msg_op != 0) {
+                return UV_EPROTO;
+            }
+            break;
+        default:
+            return UV_EPROTO;
+    }
+
+    // claimed length is checked before any of it is buffered
+    if (!p->stream && p->max_msg > 0 && (len > p->max_msg || p->msg_len > p->max_msg - len)) {
+        return UV_E2BIG;
+    }
+    return 0;
+}
+
+// buffer grows with received data, not with length claimed by frame header
+static int msg_append(ws_parser_t *p, const char *data, size_t len) {
+    if (p->msg_len + len > p->msg_cap) {
+        size_t need = p->msg_len + len;
+        size_t cap = p->msg_cap * 2 > need ? p->msg_cap * 2 : need;
+        if (p->max_msg > 0 && cap > p->max_msg && need <= p->max_msg) {
+            cap = (size_t) p->max_msg;
+        }
+        char *m = tlsuv__realloc(p->msg, cap);
+        if (m == NULL) {
+            return UV_ENOMEM;
+        }
+        p->msg = m;
+        p->msg_cap = cap;
+    }
+    memcpy(p->msg + p->msg_len, data, len);
+    p->msg_len += len;
+    return 0;
+}
+
+ssize_t ws_parser_execute(ws_parser_t *p, char *buf, size_t len, ws_frame_cb cb, void *ctx) {
+    if (p->err) {
+        return p->err;
+    }
+    size_t pos = 0;
+    while (pos < len) {
+        if (p->hdr_need == 0 || p->hdr_len < p->hdr_need) {
+            size_t need = p->hdr_need ? p->hdr_need : 2;
+            size_t n = need - p->hdr_len < len - pos ? need - p->hdr_len : len - pos;
+            memcpy(p->hdr + p->hdr_len, buf + pos, n);
+            p->hdr_len += n;
+            pos += n;
+            if (p->hdr_need == 0 && p->hdr_len == 2) {
+                p->hdr_need = header_size(p->hdr);
+            }
+            if (p->hdr_need == 0 || p->hdr_len < p->hdr_need) {
+                continue;
+            }
+            int rc = frame_start(p);
+            if (rc != 0) {
+                return p->err = rc;
+            }
+        }
+
+        uint64_t left = p->payload_len - p->payload_read;
+        size_t n = left < len - pos ? (size_t) left : len - pos;
+        if (n == 0 && left > 0) {
+            break;
+        }
+        char *data = buf + pos;
+        if (p->masked) {
+            // mask position continues from payload bytes already read in earlier buffers
+            ws_mask(data, data, n, p->mask, p->payload_read);
+        }
+        // frame payload is all in this buffer
+        bool whole = p->payload_read == 0 && n == p->payload_len;
+        p->payload_read += n;
+        pos += n;
+
+        unsigned int op = p->op;
+        size_t data_len = n;
+        if (p->stream && op < OpCode_Close) {
+            if (op != OpCode_Cont) {
+                p->msg_op = op;
+            }
+            bool frame_done = p->payload_read == p->payload_len;
+            op = p->msg_op;
+            p->msg_end = frame_done && p->fin;
+            if (frame_done) {
+                p->hdr_len = p->hdr_need = 0;
+            }
+            if (p->msg_end) {
+                p->msg_op = 0;
+            }
+            if (cb(ctx, op, data, n) != 0) {
+                break;
+            }
+            continue;
+        }
+
+        if (op >= OpCode_Close) {
+            if (!whole) {
+                memcpy(p->ctl + p->ctl_len, data, n);
+                p->ctl_len += n;
+                data = p->ctl;
+                data_len = p->ctl_len;
+            }
+        } else if (!whole || !p->fin || op == OpCode_Cont) {
+            if (op != OpCode_Cont) {
+                p->msg_op = op;
+            }
+            int rc = msg_append(p, data, n);
+            if (rc != 0) {
+                return p->err = rc;
+            }
+            if (p->payload_read < p->payload_len || !p->fin) {
+                if (p->payload_read == p->payload_len) {
+                    p->hdr_len = p->hdr_need = 0;
+                }
+                continue;
+            }
+            op = p->msg_op;
+            data = p->msg;
+            data_len = p->msg_len;
+            p->msg_op = 0;
+            p->msg_len = 0;
+        }
+
+        if (p->payload_read < p->payload_len) {
+            continue;
+        }
+
+        // frame is complete
+        p->hdr_len = p->hdr_need = 0;
+        p->ctl_len = 0;
+        if (cb(ctx, op, data, data_len) != 0) {
+            break;
+        }
+    }
+    return (ssize_t) pos;
+}
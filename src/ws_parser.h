@@ -0,0 +1,110 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TLSUV_WS_PARSER_H
+#define TLSUV_WS_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+
+#define WS_FIN 0x80U
+#define WS_RSV_BITS 0x70U
+#define WS_RSV1 0x40U
+#define WS_OP_BITS 0xFU
+#define WS_MASK 0x80U
+
+enum OpCode {
+    OpCode_Cont = 0x0U,
+    OpCode_TXT = 0x1U,
+    OpCode_BIN = 0x2U,
+    OpCode_Close = 0x8U,
+    OpCode_Ping = 0x9U,
+    OpCode_Pong = 0xAU
+};
+
+#define WS_MAX_CONTROL 125
+
+#if __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Called with every complete message or control frame, data is unmasked.
+ * In stream mode data messages are delivered with their type in one or more calls, see ws_parser_t.msg_end.
+ * Returns 0 to continue parsing, anything else stops at the end of the frame.
+ */
+typedef int (*ws_frame_cb)(void *ctx, unsigned int op, char *data, size_t len);
+
+/**
+ * Incremental frame parser, keeps state of partial frame across reads.
+ * Payload of a frame that is complete in the read buffer is unmasked and delivered in place,
+ * only frames split across reads and fragmented messages are copied.
+ */
+typedef struct ws_parser_s {
+    // frame header, collected across reads if it is split
+    uint8_t hdr[14];
+    size_t hdr_len;
+    size_t hdr_need;
+
+    unsigned int op;
+    bool fin;
+    bool masked;
+    uint8_t mask[4];
+    uint64_t payload_len;
+    uint64_t payload_read;
+
+    // RSV1 marks compressed messages, set when permessage-deflate is negotiated
+    bool rsv1_ok;
+    // current message has RSV1 set on its first frame
+    bool compressed;
+    // data frames are delivered in pieces as they arrive, instead of whole messages
+    bool stream;
+    // (stream mode) delivered piece is the last of its message
+    bool msg_end;
+
+    // largest data message collected in memory, 0 for no limit (stream mode does not collect messages)
+    uint64_t max_msg;
+
+    // message of continuation frames, or data frame split across reads
+    unsigned int msg_op;
+    char *msg;
+    size_t msg_len;
+    size_t msg_cap;
+
+    // control frames can arrive between fragments of a message
+    char ctl[WS_MAX_CONTROL];
+    size_t ctl_len;
+
+    // stream cannot be parsed after an error
+    int err;
+} ws_parser_t;
+
+void ws_parser_init(ws_parser_t *p);
+void ws_parser_free(ws_parser_t *p);
+
+/**
+ * Parses frames in `buf`, which may be modified.
+ * @return number of bytes consumed (less than `len` if callback stopped parsing), or UV_EPROTO/UV_ENOMEM,
+ * or UV_E2BIG if message is larger than `max_msg`
+ */
+ssize_t ws_parser_execute(ws_parser_t *p, char *buf, size_t len, ws_frame_cb cb, void *ctx);
+
+#if __cplusplus
+}
+#endif
+
+#endif //TLSUV_WS_PARSER_H
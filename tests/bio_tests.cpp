@@ -0,0 +1,58 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "catch.hpp"
+#include "bio.h"
+
+#include <cstring>
+#include <vector>
+
+TEST_CASE("bio segments", "[engine]") {
+    tlsuv_BIO *bio = tlsuv_BIO_new();
+
+    std::vector<uint8_t> data(3 * TLSUV_BIO_SEG_SIZE + 100);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t) i;
+    }
+
+    CHECK(tlsuv_BIO_put(bio, data.data(), data.size()) == 0);
+    CHECK(tlsuv_BIO_available(bio) == data.size());
+    CHECK(bio->qlen == 4);
+
+    const uint8_t *p;
+    CHECK(tlsuv_BIO_peek(bio, &p) == TLSUV_BIO_SEG_SIZE);
+    CHECK(memcmp(p, data.data(), TLSUV_BIO_SEG_SIZE) == 0);
+
+    tlsuv_BIO_consume(bio, 10);
+    CHECK(tlsuv_BIO_peek(bio, &p) == TLSUV_BIO_SEG_SIZE - 10);
+    CHECK(p[0] == data[10]);
+
+    std::vector<uint8_t> out(data.size());
+    size_t rest = data.size() - 10;
+    CHECK(tlsuv_BIO_read(bio, out.data(), out.size()) == (int) rest);
+    CHECK(memcmp(out.data(), data.data() + 10, rest) == 0);
+    CHECK(tlsuv_BIO_available(bio) == 0);
+    CHECK(tlsuv_BIO_peek(bio, &p) == 0);
+
+    // drained segments are recycled, not freed
+    CHECK(bio->qlen == 1);
+    CHECK(bio->spare_count == 3);
+
+    CHECK(tlsuv_BIO_put(bio, data.data(), data.size()) == 0);
+    CHECK(bio->spare_count == 0);
+    CHECK(tlsuv_BIO_read(bio, out.data(), out.size()) == (int) data.size());
+    CHECK(out == data);
+
+    tlsuv_BIO_free(bio);
+}
@@ -149,6 +149,15 @@ TEST_CASE("gzip", "[http]") {
     CHECK(um_inflate(inflater, (const char*)packet_bytes + (inputLen/2), inputLen - inputLen / 2 ) == 1);
     CHECK(um_inflate_state(inflater) == 1);
     CHECK_THAT(res.str, Catch::Equals(expected));
+
+    // reused for next stream
+    res.str = "";
+    CHECK(um_reset_inflater(inflater, "gzip", cb, &res) == 0);
+    CHECK(um_inflate_state(inflater) == 0);
+    CHECK(um_inflate(inflater, (const char*)packet_bytes, sizeof(packet_bytes)) == 1);
+    CHECK(um_inflate_state(inflater) == 1);
+    CHECK_THAT(res.str, Catch::Equals(expected));
+    CHECK(um_reset_inflater(inflater, "br", cb, &res) == -1);
     um_free_inflater(inflater);
 }
 
@@ -208,3 +217,109 @@ TEST_CASE("gzip invalid", "[http]") {
     CHECK(um_inflate_state(inflater) == -1);
     um_free_inflater(inflater);
 }
+
+static std::string expected_text() {
+    std::string s;
+    for (int i = 0; i < 40; i++) s.append("tlsuv brotli and zstd test payload. ");
+    return s;
+}
+
+TEST_CASE("brotli", "[http]") {
+    unsigned char packet_bytes[] = {
+            0x1b, 0x9f, 0x05, 0xf8, 0x45, 0xdd, 0x96, 0xea, 0x42, 0x7a, 0xec, 0x93, 0x1b, 0x84,
+            0xe3, 0xc5, 0x4f, 0x41, 0xc3, 0xc4, 0x98, 0x41, 0x6c, 0x52, 0xd4, 0xb9, 0x68, 0x3b,
+            0x15, 0x03, 0x9c, 0x8e, 0x5f, 0x72, 0xa8, 0x97, 0xb0, 0xf8, 0x22, 0xe9, 0x06
+    };
+
+    std::string encodings = um_available_encoding();
+    if (encodings.find("br") == std::string::npos) {
+        WARN("brotli decoder is not available");
+        return;
+    }
+
+    std::string expected = expected_text(), res;
+    auto cb = [](void *ctx, const char *b, ssize_t len) {
+        if (len > 0) ((std::string *)ctx)->append(b, len);
+    };
+
+    auto inflater = um_get_inflater("br", cb, &res);
+    size_t inputLen = sizeof(packet_bytes);
+    CHECK(um_inflate(inflater, (const char*)packet_bytes, inputLen / 2 ) == 0);
+    CHECK(um_inflate_state(inflater) == 0);
+    CHECK(um_inflate(inflater, (const char*)packet_bytes + (inputLen/2), inputLen - inputLen / 2 ) == 1);
+    CHECK(um_inflate_state(inflater) == 1);
+    CHECK(res == expected);
+    um_free_inflater(inflater);
+
+    inflater = um_get_inflater("br", cb, &res);
+    CHECK(um_inflate(inflater, "this is not brotli", 18) == -1);
+    CHECK(um_inflate_state(inflater) == -1);
+    um_free_inflater(inflater);
+}
+
+TEST_CASE("zstd", "[http]") {
+    unsigned char packet_bytes[] = {
+            0x28, 0xb5, 0x2f, 0xfd, 0x04, 0x68, 0x6d, 0x01, 0x00, 0x44, 0x02, 0x74, 0x6c, 0x73,
+            0x75, 0x76, 0x20, 0x62, 0x72, 0x6f, 0x74, 0x6c, 0x69, 0x20, 0x61, 0x6e, 0x64, 0x20,
+            0x7a, 0x73, 0x74, 0x64, 0x20, 0x74, 0x65, 0x73, 0x74, 0x20, 0x70, 0x61, 0x79, 0x6c,
+            0x6f, 0x61, 0x64, 0x2e, 0x20, 0x01, 0x00, 0xcc, 0xeb, 0xfc, 0xea, 0x09, 0xac, 0x75,
+            0x1e, 0x2d
+    };
+
+    std::string encodings = um_available_encoding();
+    if (encodings.find("zstd") == std::string::npos) {
+        WARN("zstd decoder is not available");
+        return;
+    }
+
+    std::string expected = expected_text(), res;
+    auto cb = [](void *ctx, const char *b, ssize_t len) {
+        if (len > 0) ((std::string *)ctx)->append(b, len);
+    };
+
+    auto inflater = um_get_inflater("zstd", cb, &res);
+    size_t inputLen = sizeof(packet_bytes);
+    CHECK(um_inflate(inflater, (const char*)packet_bytes, inputLen / 2 ) == 0);
+    CHECK(um_inflate_state(inflater) == 0);
+    CHECK(um_inflate(inflater, (const char*)packet_bytes + (inputLen/2), inputLen - inputLen / 2 ) == 1);
+    CHECK(um_inflate_state(inflater) == 1);
+    CHECK(res == expected);
+    um_free_inflater(inflater);
+
+    inflater = um_get_inflater("zstd", cb, &res);
+    CHECK(um_inflate(inflater, "this is not zstd", 16) == -1);
+    CHECK(um_inflate_state(inflater) == -1);
+    um_free_inflater(inflater);
+}
+
+TEST_CASE("request body encoding", "[http]") {
+    auto enc = GENERATE(as<std::string>{}, "gzip", "zstd");
+
+    auto deflater = um_get_deflater(enc.c_str());
+    if (deflater == nullptr) {
+        WARN(enc << " encoder is not available");
+        return;
+    }
+
+    std::string input;
+    for (int i = 0; i < 1000; i++) input.append(R"({"log": "request body line"})" "\n");
+
+    std::string compressed;
+    auto cb = [](void *ctx, const char *b, ssize_t len) {
+        if (len > 0) ((std::string *)ctx)->append(b, len);
+    };
+    // feed in pieces, like body chunks
+    for (size_t i = 0; i < input.size(); i += 1000) {
+        CHECK(um_deflate(deflater, input.data() + i, std::min<size_t>(1000, input.size() - i), 0, cb, &compressed) == 0);
+    }
+    CHECK(um_deflate(deflater, nullptr, 0, 1, cb, &compressed) == 0);
+    um_free_deflater(deflater);
+    CHECK(compressed.size() < input.size() / 10);
+
+    std::string output;
+    auto inflater = um_get_inflater(enc.c_str(), cb, &output);
+    REQUIRE(inflater != nullptr);
+    CHECK(um_inflate(inflater, compressed.data(), compressed.size()) == 1);
+    CHECK(output == input);
+    um_free_inflater(inflater);
+}
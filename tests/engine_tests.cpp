@@ -17,10 +17,27 @@ limitations under the License.
 #include "catch.hpp"
 #include "tlsuv/tlsuv.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <tlsuv/tls_engine.h>
 #include <uv.h>
 
+#include "ca_store.h"
+#include "cpu_features.h"
+#include "verify_cache.h"
+#include "pool.h"
+#include "read_sizing.h"
+#include "trust_store.h"
+
+#if defined(TEST_openssl)
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+#endif
+
 #if !defined(_WIN32)
 #define SOCKET int
 #include <netdb.h>
@@ -169,6 +186,108 @@ rzqUvKOfg8HVwOSngZyPa4zgd5ieZfxcFnDc2IK4fnI=
     tls->api->free_ctx(tls);
 }
 
+static std::string ref_base64(const std::string &in, bool url, bool pad) {
+    const char *chars = url ? "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+                            : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    uint32_t acc = 0;
+    int bits = 0;
+    for (unsigned char c : in) {
+        acc = acc << 8 | c;
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out += chars[(acc >> bits) & 0x3f];
+        }
+    }
+    if (bits > 0) out += chars[(acc << (6 - bits)) & 0x3f];
+    while (pad && out.size() % 4 != 0) out += '=';
+    return out;
+}
+
+TEST_CASE("base64 codec", "[engine]") {
+    char enc[1024];
+    char dec[1024];
+    size_t len;
+
+    len = sizeof(enc);
+    REQUIRE(tlsuv_base64_encode("foobar", 6, enc, &len, 0) == 0);
+    CHECK(std::string(enc) == "Zm9vYmFy");
+    len = sizeof(enc);
+    REQUIRE(tlsuv_base64_encode("fooba", 5, enc, &len, 0) == 0);
+    CHECK(std::string(enc, len) == "Zm9vYmE=");
+    len = sizeof(enc);
+    REQUIRE(tlsuv_base64_encode("foob", 4, enc, &len, TLSUV_BASE64_NOPAD) == 0);
+    CHECK(std::string(enc, len) == "Zm9vYg");
+
+    // round trip over lengths that hit all SIMD block sizes and tails
+    std::string data;
+    for (int i = 0; i < 600; i++) data += (char) ((i * 131 + 7) & 0xff);
+    for (int flags = 0; flags < 4; flags++) {
+        bool url = (flags & TLSUV_BASE64_URL) != 0;
+        bool pad = (flags & TLSUV_BASE64_NOPAD) == 0;
+        for (size_t n = 0; n < 600; n += (n < 100 ? 1 : 7)) {
+            std::string in = data.substr(0, n);
+            std::string expected = ref_base64(in, url, pad);
+
+            len = sizeof(enc);
+            REQUIRE(tlsuv_base64_encode(in.data(), n, enc, &len, flags) == 0);
+            REQUIRE(len == tlsuv_base64_encoded_len(n, flags));
+            REQUIRE(std::string(enc, len) == expected);
+
+            size_t dlen = sizeof(dec);
+            REQUIRE(tlsuv_base64_decode(enc, len, dec, &dlen, flags) == 0);
+            REQUIRE(std::string(dec, dlen) == in);
+            // exact sized output buffer
+            dlen = n;
+            std::vector<char> exact(n + 1);
+            REQUIRE(tlsuv_base64_decode(enc, len, exact.data(), &dlen, flags) == 0);
+            REQUIRE(dlen == n);
+        }
+    }
+
+    WHEN("input has line breaks") {
+        std::string b64 = ref_base64(data, false, true);
+        std::string pem;
+        for (size_t i = 0; i < b64.size(); i += 64) pem += b64.substr(i, 64) + "\r\n";
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode(pem.data(), pem.size(), dec, &len, 0) == 0);
+        CHECK(std::string(dec, len) == data);
+    }
+
+    WHEN("input is malformed") {
+        std::string b64 = ref_base64(data, false, true);
+        std::string bad = b64;
+        bad[100] = '-';
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode(bad.data(), bad.size(), dec, &len, 0) == UV_EINVAL);
+        bad = b64;
+        bad[200] = '\x80';
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode(bad.data(), bad.size(), dec, &len, 0) == UV_EINVAL);
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode(b64.data(), b64.size(), dec, &len, TLSUV_BASE64_URL) == UV_EINVAL);
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode("Zg=a", 4, dec, &len, 0) == UV_EINVAL);
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode("Z", 1, dec, &len, 0) == UV_EINVAL);
+        len = sizeof(dec);
+        CHECK(tlsuv_base64_decode("Zm9v=", 5, dec, &len, 0) == UV_EINVAL);
+    }
+
+    WHEN("output buffer is too small") {
+        len = 8;
+        CHECK(tlsuv_base64_encode("foobar", 6, enc, &len, 0) == 0);
+        len = 7;
+        CHECK(tlsuv_base64_encode("foobar", 6, enc, &len, 0) == UV_ENOBUFS);
+        len = 5;
+        CHECK(tlsuv_base64_decode("Zm9vYmFy", 8, dec, &len, 0) == UV_ENOBUFS);
+        std::string b64 = ref_base64(data, true, false);
+        len = data.size() - 1;
+        CHECK(tlsuv_base64_decode(b64.data(), b64.size(), dec, &len, TLSUV_BASE64_URL) == UV_ENOBUFS);
+    }
+}
+
 TEST_CASE("ALPN negotiation", "[engine]") {
 
     const char *host = "google.com";
@@ -239,4 +358,1288 @@ TEST_CASE("ALPN negotiation", "[engine]") {
     freeaddrinfo(addr);
     tls->api->free_engine(engine);
     tls->api->free_ctx(tls);
-}
\ No newline at end of file
+}
+static void engine_handshake(tls_engine *engine, SOCKET sock) {
+    char ssl_in[32 * 1024];
+    char ssl_out[32 * 1024];
+    size_t in_bytes = 0;
+    size_t out_bytes = 0;
+
+    do {
+        tls_handshake_state state = engine->api->handshake(engine->engine, ssl_in, in_bytes, ssl_out, &out_bytes,
+                                                           sizeof(ssl_out));
+        REQUIRE(state != TLS_HS_ERROR);
+        if (out_bytes > 0) {
+            send(sock, ssl_out, out_bytes, 0);
+        }
+        if (state == TLS_HS_COMPLETE) {
+            break;
+        }
+        in_bytes = recv(sock, ssl_in, sizeof(ssl_in), 0);
+    } while (true);
+}
+
+// returns true if handshake resumed cached session
+static bool engine_connect(tls_context *tls, const char *host, struct addrinfo *addr) {
+    tls_engine *engine = tls->api->new_engine(tls->ctx, host);
+
+    SOCKET sock = socket(addr->ai_family, SOCK_STREAM, 0);
+    REQUIRE(connect(sock, addr->ai_addr, addr->ai_addrlen) == 0);
+
+    engine_handshake(engine, sock);
+
+    char ssl_in[32 * 1024];
+    char ssl_out[32 * 1024];
+    size_t out_bytes = 0;
+
+    // TLS 1.3 session tickets are only delivered after handshake
+    std::string req = std::string("GET / HTTP/1.1\r\nHost: ") + host + "\r\nConnection: close\r\n\r\n";
+    engine->api->write(engine->engine, req.c_str(), req.length(), ssl_out, &out_bytes, sizeof(ssl_out));
+    send(sock, ssl_out, out_bytes, 0);
+
+    char body[32 * 1024];
+    size_t body_len = 0;
+    int rc;
+    do {
+        ssize_t n = recv(sock, ssl_in, sizeof(ssl_in), 0);
+        if (n <= 0) break;
+        rc = engine->api->read(engine->engine, ssl_in, n, body, &body_len, sizeof(body));
+        while (rc == TLS_MORE_AVAILABLE) {
+            rc = engine->api->read(engine->engine, nullptr, 0, body, &body_len, sizeof(body));
+        }
+    } while (rc == TLS_OK && body_len == 0);
+
+#if _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+    bool resumed = engine->api->stats && engine->api->stats(engine->engine)->resumptions > 0;
+    tls->api->free_engine(engine);
+    return resumed;
+}
+
+TEST_CASE("session resumption", "[engine]") {
+    const char *host = "google.com";
+    struct addrinfo *addr;
+    int rc;
+    if ((rc = getaddrinfo(host, "443", nullptr, &addr)) != 0) {
+        printf("getaddrinfo: %d(%s)\n", rc, strerror(rc));
+        return;
+    }
+
+    tls_context *tls = default_tls_context(nullptr, 0);
+    REQUIRE(tls->api->get_session_stats != nullptr);
+    REQUIRE(tls->api->get_traffic_stats != nullptr);
+
+    tls_session_stats stats;
+    CHECK_FALSE(engine_connect(tls, host, addr));
+    tls->api->get_session_stats(tls, &stats);
+    CHECK(stats.misses == 1);
+    CHECK(stats.hits == 0);
+    CHECK(stats.entries == 1);
+
+    // cache hit only means the session was offered, server has to accept it
+    CHECK(engine_connect(tls, host, addr));
+    tls->api->get_session_stats(tls, &stats);
+    CHECK(stats.misses == 1);
+    CHECK(stats.hits == 1);
+
+    tls_traffic_stats traffic;
+    tls->api->get_traffic_stats(tls, &traffic);
+    CHECK(traffic.handshakes == 2);
+    CHECK(traffic.resumptions == 1);
+
+    freeaddrinfo(addr);
+    tls->api->free_ctx(tls);
+}
+
+TEST_CASE("dynamic record sizing", "[engine]") {
+    const char *host = "google.com";
+    struct addrinfo *addr;
+    int rc;
+    if ((rc = getaddrinfo(host, "443", nullptr, &addr)) != 0) {
+        printf("getaddrinfo: %d(%s)\n", rc, strerror(rc));
+        return;
+    }
+
+    tls_context *tls = default_tls_context(nullptr, 0);
+    REQUIRE(tls->api->set_record_sizing != nullptr);
+    tls_record_sizing sizing = { 1000, 4000, 0 };
+    REQUIRE(tls->api->set_record_sizing(tls, &sizing) == 0);
+
+    tls_engine *engine = tls->api->new_engine(tls->ctx, host);
+    SOCKET sock = socket(addr->ai_family, SOCK_STREAM, 0);
+    REQUIRE(connect(sock, addr->ai_addr, addr->ai_addrlen) == 0);
+    engine_handshake(engine, sock);
+
+    // first 4000 bytes go out in small records, the rest in a single record
+    std::string data(8000, 'x');
+    unsigned char ssl_out[32 * 1024];
+    size_t out_bytes = 0;
+    CHECK(engine->api->write(engine->engine, data.c_str(), data.length(), (char *) ssl_out, &out_bytes, sizeof(ssl_out)) == 0);
+
+    std::vector<size_t> records;
+    for (size_t off = 0; off + 5 <= out_bytes; off += 5 + ((ssl_out[off + 3] << 8) | ssl_out[off + 4])) {
+        records.push_back((ssl_out[off + 3] << 8) | ssl_out[off + 4]);
+    }
+    REQUIRE(records.size() == 5);
+    for (int i = 0; i < 4; i++) {
+        CHECK(records[i] < 1100);
+    }
+    CHECK(records[4] > 4000);
+
+#if _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+    freeaddrinfo(addr);
+    tls->api->free_engine(engine);
+    tls->api->free_ctx(tls);
+}
+
+static void collect_trace(const tlsuv_trace_event *ev, void *data) {
+    auto events = (std::vector<tlsuv_trace_event> *) data;
+    events->push_back(*ev);
+}
+
+TEST_CASE("protocol trace", "[engine]") {
+    tls_context *tls = default_tls_context(nullptr, 0);
+    std::vector<tlsuv_trace_event> events;
+    unsigned char out[16 * 1024];
+    size_t out_bytes;
+
+    // engine created before tracing is enabled picks it up on next step
+    tls_engine *before = tls->api->new_engine(tls->ctx, "before.example.com");
+    REQUIRE(tlsuv_trace_enable("*.example.com", collect_trace, &events) == 0);
+
+    tls_engine *traced = tls->api->new_engine(tls->ctx, "api.EXAMPLE.com");
+    tls_engine *other = tls->api->new_engine(tls->ctx, "example.org");
+
+    other->api->handshake(other->engine, nullptr, 0, (char *) out, &out_bytes, sizeof(out));
+    CHECK(out_bytes > 0);
+    CHECK(events.empty());
+
+    traced->api->handshake(traced->engine, nullptr, 0, (char *) out, &out_bytes, sizeof(out));
+    CHECK(out_bytes > 0);
+    auto hello = std::find_if(events.begin(), events.end(), [](const tlsuv_trace_event &e) {
+        return e.type == tlsuv_TRACE_RECORD && e.content_type == 22 && e.msg_type == 1;
+    });
+    REQUIRE(hello != events.end());
+    CHECK(hello->outgoing == 1);
+    CHECK(hello->length > 0);
+    CHECK_THAT(hello->host, Catch::Matchers::Equals("api.EXAMPLE.com"));
+
+    events.clear();
+    before->api->handshake(before->engine, nullptr, 0, (char *) out, &out_bytes, sizeof(out));
+    CHECK_FALSE(events.empty());
+
+    tlsuv_trace_disable();
+    events.clear();
+    tls_engine *after = tls->api->new_engine(tls->ctx, "after.example.com");
+    after->api->handshake(after->engine, nullptr, 0, (char *) out, &out_bytes, sizeof(out));
+    CHECK(out_bytes > 0);
+    CHECK(events.empty());
+
+    tls->api->free_engine(before);
+    tls->api->free_engine(traced);
+    tls->api->free_engine(other);
+    tls->api->free_engine(after);
+    tls->api->free_ctx(tls);
+}
+
+static int ca_loads;
+static void *test_ca_load(const char *buf, size_t len) {
+    ca_loads++;
+    return new std::string(buf ? std::string(buf, len) : "system");
+}
+static void test_ca_free(void *store) {
+    delete (std::string *) store;
+}
+
+TEST_CASE("shared CA store", "[engine]") {
+    ca_loads = 0;
+    const char bundle1[] = "-----BEGIN CERTIFICATE-----\nbundle1\n-----END CERTIFICATE-----\n";
+    const char bundle2[] = "-----BEGIN CERTIFICATE-----\nbundle2\n-----END CERTIFICATE-----\n";
+
+    void *s1 = tlsuv_ca_store_acquire(bundle1, sizeof(bundle1), test_ca_load, test_ca_free);
+    void *s2 = tlsuv_ca_store_acquire(bundle1, sizeof(bundle1), test_ca_load, test_ca_free);
+    CHECK(s1 == s2);
+    CHECK(ca_loads == 1);
+
+    void *s3 = tlsuv_ca_store_acquire(bundle2, sizeof(bundle2), test_ca_load, test_ca_free);
+    CHECK(s3 != s1);
+    CHECK(ca_loads == 2);
+
+    tlsuv_ca_store_release(s1);
+    CHECK(*(std::string *) s2 == std::string(bundle1, sizeof(bundle1)));
+    tlsuv_ca_store_release(s2);
+    tlsuv_ca_store_release(s3);
+
+    // all references dropped, bundle is parsed again
+    void *s4 = tlsuv_ca_store_acquire(bundle1, sizeof(bundle1), test_ca_load, test_ca_free);
+    CHECK(ca_loads == 3);
+    tlsuv_ca_store_release(s4);
+}
+
+TEST_CASE("verify cache", "[engine]") {
+    tlsuv_verify_cache *cache = tlsuv_verify_cache_new(2, 60);
+    uint8_t k1[TLSUV_VERIFY_KEY_LEN] = {1};
+    uint8_t k2[TLSUV_VERIFY_KEY_LEN] = {2};
+    uint8_t k3[TLSUV_VERIFY_KEY_LEN] = {3};
+
+    CHECK_FALSE(tlsuv_verify_cache_check(cache, k1));
+    tlsuv_verify_cache_put(cache, k1, 3600);
+    CHECK(tlsuv_verify_cache_check(cache, k1));
+
+    // expired certificate is not cached
+    tlsuv_verify_cache_put(cache, k2, 0);
+    CHECK_FALSE(tlsuv_verify_cache_check(cache, k2));
+
+    // least recently used entry is evicted
+    tlsuv_verify_cache_put(cache, k2, 3600);
+    CHECK(tlsuv_verify_cache_check(cache, k1));
+    tlsuv_verify_cache_put(cache, k3, 3600);
+    CHECK(tlsuv_verify_cache_check(cache, k1));
+    CHECK(tlsuv_verify_cache_check(cache, k3));
+    CHECK_FALSE(tlsuv_verify_cache_check(cache, k2));
+
+    tlsuv_verify_cache_free(cache);
+
+    CHECK(tlsuv_verify_cache_new(0, 60) == nullptr);
+}
+
+static void pool_thread(void *) {
+    void *blocks[16];
+    for (auto &b : blocks) b = tlsuv_pool_alloc(1024);
+    for (auto &b : blocks) tlsuv_pool_free(b);
+    tlsuv_pool_set_shared_read(16 * 1024);
+}
+
+TEST_CASE("buffer pool is freed on thread exit", "[engine]") {
+    tlsuv_mem_stats before{}, after{};
+    if (tlsuv_mem_get_stats(TLSUV_MEM_CORE, &before) == UV_ENOTSUP) {
+        WARN("memory stats are not available");
+        return;
+    }
+
+    uv_thread_t t;
+    REQUIRE(uv_thread_create(&t, pool_thread, nullptr) == 0);
+    uv_thread_join(&t);
+
+    REQUIRE(tlsuv_mem_get_stats(TLSUV_MEM_CORE, &after) == 0);
+    CHECK(after.allocs > before.allocs);
+    CHECK(after.bytes_in_use == before.bytes_in_use);
+}
+
+TEST_CASE("read buffer pool", "[engine]") {
+    struct tlsuv_read_sizer_s rs{};
+    size_t initial = read_sizer_size(&rs);
+
+    // full read grows buffer
+    read_sizer_update(&rs, (ssize_t) initial, initial);
+    CHECK(read_sizer_size(&rs) == initial * 2);
+
+    // two small reads in a row shrink it
+    read_sizer_update(&rs, 100, initial * 2);
+    CHECK(read_sizer_size(&rs) == initial * 2);
+    read_sizer_update(&rs, 100, initial * 2);
+    CHECK(read_sizer_size(&rs) == initial);
+
+    for (int i = 0; i < 64; i++) read_sizer_update(&rs, 1, read_sizer_size(&rs));
+    CHECK(read_sizer_size(&rs) == (1 << READ_SIZE_MIN_SHIFT));
+    for (int i = 0; i < 64; i++) read_sizer_update(&rs, (ssize_t) read_sizer_size(&rs), read_sizer_size(&rs));
+    CHECK(read_sizer_size(&rs) == (1 << READ_SIZE_MAX_SHIFT));
+
+    size_t len;
+    CHECK_FALSE(tlsuv_pool_read_shared());
+    void *b1 = tlsuv_pool_read_alloc(1024, &len);
+    CHECK(len == 1024);
+    tlsuv_pool_free(b1);
+
+    REQUIRE(tlsuv_pool_set_shared_read(64 * 1024) == 0);
+    CHECK(tlsuv_pool_read_shared());
+    void *shared = tlsuv_pool_read_alloc(1024, &len);
+    CHECK(len == 64 * 1024);
+
+    // shared buffer is in use
+    void *b2 = tlsuv_pool_read_alloc(1024, &len);
+    CHECK(b2 != shared);
+    CHECK(len == 1024);
+    tlsuv_pool_free(b2);
+
+    tlsuv_pool_free(shared);
+    CHECK(tlsuv_pool_read_alloc(1024, &len) == shared);
+
+    // buffer in use is released after the read that holds it
+    REQUIRE(tlsuv_pool_set_shared_read(0) == 0);
+    CHECK_FALSE(tlsuv_pool_read_shared());
+    tlsuv_pool_free(shared);
+}
+
+static std::atomic<int> test_allocs;
+static std::atomic<int> test_frees;
+
+static void *count_malloc(size_t size) {
+    test_allocs++;
+    return malloc(size);
+}
+
+static void *count_realloc(void *p, size_t size) {
+    if (p == nullptr) test_allocs++;
+    return realloc(p, size);
+}
+
+static void *count_calloc(size_t count, size_t size) {
+    test_allocs++;
+    return calloc(count, size);
+}
+
+static void count_free(void *p) {
+    if (p) test_frees++;
+    free(p);
+}
+
+TEST_CASE("custom allocator", "[engine]") {
+    CHECK(tlsuv_set_allocator(nullptr, realloc, calloc, free) == UV_EINVAL);
+    REQUIRE(tlsuv_set_allocator(count_malloc, count_realloc, count_calloc, count_free) == 0);
+
+    tls_context *tls = default_tls_context(nullptr, 0);
+    tls_engine *engine = tls->api->new_engine(tls->ctx, "localhost");
+    CHECK(test_allocs > 0);
+
+    tls->api->free_engine(engine);
+    tls->api->free_ctx(tls);
+    CHECK(test_frees > 0);
+
+    tlsuv_mem_stats stats = {};
+    int rc = tlsuv_mem_get_stats(TLSUV_MEM_TLS, &stats);
+    if (rc == 0) {
+        CHECK(stats.allocs > 0);
+        CHECK(stats.frees > 0);
+        CHECK(tlsuv_mem_get_stats(TLSUV_MEM_CRYPTO, nullptr) == UV_EINVAL);
+    } else {
+        CHECK(rc == UV_ENOTSUP);
+    }
+
+    tlsuv_set_allocator(malloc, realloc, calloc, free);
+}
+
+#define to_str_(x) #x
+#define to_str(x) to_str_(x)
+
+struct ocsp_fetch_s {
+    int calls;
+    size_t req_len;
+    bool reply;
+};
+
+static int test_ocsp_fetch(const char *url, const uint8_t *req, size_t req_len,
+                           uint8_t **resp, size_t *resp_len, void *ctx) {
+    auto f = (ocsp_fetch_s *) ctx;
+    f->calls++;
+    f->req_len = req_len;
+    if (!f->reply) {
+        return -1;
+    }
+    // not a valid OCSP response
+    *resp = (uint8_t *) strdup("garbage");
+    *resp_len = 7;
+    return 0;
+}
+
+// client and server engines connected in memory
+struct mem_pair {
+    tls_engine *clt;
+    tls_engine *srv;
+    // server output the client did not consume during handshake (e.g. session tickets)
+    std::string to_clt;
+    tls_handshake_state state;
+};
+
+static void mem_pair_connect(mem_pair *p, tls_context *clt_tls, tls_context *srv_tls, const char *host = "localhost") {
+    static char c2s[32 * 1024];
+    static char s2c[32 * 1024];
+    p->clt = clt_tls->api->new_engine(clt_tls->ctx, host);
+    p->srv = srv_tls->api->new_engine(srv_tls->ctx, nullptr);
+    p->to_clt.clear();
+
+    size_t c_len = 0, s_len = 0;
+    tls_handshake_state cs = p->clt->api->handshake(p->clt->engine, nullptr, 0, c2s, &c_len, sizeof(c2s));
+    tls_handshake_state ss = TLS_HS_BEFORE;
+    for (int i = 0; i < 16 && cs != TLS_HS_ERROR && ss != TLS_HS_ERROR; i++) {
+        if (cs == TLS_HS_COMPLETE && ss == TLS_HS_COMPLETE) break;
+        if (ss != TLS_HS_COMPLETE) {
+            ss = p->srv->api->handshake(p->srv->engine, c2s, c_len, s2c, &s_len, sizeof(s2c));
+            c_len = 0;
+        }
+        if (cs != TLS_HS_COMPLETE) {
+            cs = p->clt->api->handshake(p->clt->engine, s2c, s_len, c2s, &c_len, sizeof(c2s));
+            s_len = 0;
+        }
+    }
+    p->to_clt.assign(s2c, s_len);
+    p->state = cs;
+}
+
+static void mem_pair_free(mem_pair *p, tls_context *clt_tls, tls_context *srv_tls) {
+    clt_tls->api->free_engine(p->clt);
+    srv_tls->api->free_engine(p->srv);
+}
+
+// application data from TLS bytes received by the engine
+static std::string mem_read(tls_engine *eng, const std::string &in) {
+    std::string plain;
+    static char buf[16 * 1024];
+    const char *inp = in.data();
+    size_t in_len = in.size();
+    int rc;
+    do {
+        size_t n = 0;
+        rc = eng->api->read(eng->engine, inp, in_len, buf, &n, sizeof(buf));
+        inp = nullptr;
+        in_len = 0;
+        plain.append(buf, n);
+    } while (rc == TLS_MORE_AVAILABLE);
+    return plain;
+}
+
+// TLS bytes for application data written by the engine
+static std::string mem_write(tls_engine *eng, const std::string &data) {
+    static char buf[64 * 1024];
+    std::string out;
+    size_t n = 0;
+    eng->api->write(eng->engine, data.data(), data.size(), buf, &n, sizeof(buf));
+    out.append(buf, n);
+    // rest of the records still pending in the engine
+    do {
+        n = 0;
+        eng->api->write(eng->engine, nullptr, 0, buf, &n, sizeof(buf));
+        out.append(buf, n);
+    } while (n > 0);
+    return out;
+}
+
+static tls_handshake_state mem_handshake(tls_context *clt_tls, tls_context *srv_tls, const char *host = "localhost") {
+    mem_pair p;
+    mem_pair_connect(&p, clt_tls, srv_tls, host);
+    mem_pair_free(&p, clt_tls, srv_tls);
+    return p.state;
+}
+
+
+static tls_context *test_server_tls(const char *cert, const char *key) {
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    tlsuv_private_key_t pk;
+    REQUIRE(srv_tls->api->load_key(&pk, key, strlen(key)) == 0);
+    REQUIRE(srv_tls->api->set_own_cert(srv_tls->ctx, cert, strlen(cert)) == 0);
+    REQUIRE(srv_tls->api->set_own_key(srv_tls->ctx, pk) == 0);
+    REQUIRE(srv_tls->api->set_server_mode(srv_tls, TLS_SERVER_MODE) == 0);
+    return srv_tls;
+}
+
+struct verify_count_s {
+    int calls;
+    bool reject;
+};
+
+TEST_CASE("cached cert verification", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    const char *ca_key = to_str(TEST_SERVER_CA_KEY);
+
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    if (tls->api->set_verify_cache == nullptr || srv_tls->api->set_server_mode == nullptr) {
+        WARN("verify cache is not supported by TLS library");
+        tls->api->free_ctx(tls);
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+    srv_tls->api->free_ctx(srv_tls);
+    srv_tls = test_server_tls(to_str(TEST_SERVER_CERT), to_str(TEST_SERVER_KEY));
+    // server presenting a different chain
+    tls_context *other_tls = test_server_tls(ca, ca_key);
+
+    verify_count_s vc{};
+    REQUIRE(tls->api->set_verify_cache(tls, 16, 60) == 0);
+    tls->api->set_cert_verify(tls, [](void *, void *ctx) -> int {
+        auto vc = (verify_count_s *) ctx;
+        vc->calls++;
+        return vc->reject ? -1 : 0;
+    }, &vc);
+
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    CHECK(vc.calls == 1);
+
+    // same chain and host
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    CHECK(vc.calls == 1);
+
+    // same chain, different host
+    CHECK(mem_handshake(tls, srv_tls, "127.0.0.1") == TLS_HS_COMPLETE);
+    CHECK(vc.calls == 2);
+    CHECK(mem_handshake(tls, srv_tls, "127.0.0.1") == TLS_HS_COMPLETE);
+    CHECK(vc.calls == 2);
+
+    // different chain, same host
+    mem_handshake(tls, other_tls);
+    CHECK(vc.calls == 3);
+
+    // failed verification is not cached
+    vc.reject = true;
+    CHECK(mem_handshake(tls, other_tls, "127.0.0.1") == TLS_HS_ERROR);
+    CHECK(vc.calls == 4);
+    CHECK(mem_handshake(tls, other_tls, "127.0.0.1") == TLS_HS_ERROR);
+    CHECK(vc.calls == 5);
+
+    // earlier successful outcome still applies, callback is not asked
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    CHECK(vc.calls == 5);
+
+    vc.reject = false;
+    mem_handshake(tls, other_tls, "127.0.0.1");
+    CHECK(vc.calls == 6);
+
+    tls_traffic_stats traffic;
+    tls->api->get_traffic_stats(tls, &traffic);
+    CHECK(traffic.resumptions == 0);
+
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+    other_tls->api->free_ctx(other_tls);
+}
+
+#if defined(TEST_openssl)
+// test PKI built in memory
+struct test_pki_cert {
+    EVP_PKEY *key = nullptr;
+    X509 *cert = nullptr;
+};
+
+static EVP_PKEY *test_pki_key() {
+    EVP_PKEY *key = nullptr;
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY_keygen_init(kctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(kctx, &key);
+    EVP_PKEY_CTX_free(kctx);
+    return key;
+}
+
+static void test_pki_ext(X509 *crt, X509 *issuer, int nid, const char *value) {
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, issuer, crt, nullptr, nullptr, 0);
+    X509_EXTENSION *ext = X509V3_EXT_conf_nid(nullptr, &ctx, nid, value);
+    X509_add_ext(crt, ext, -1);
+    X509_EXTENSION_free(ext);
+}
+
+// self-signed if `issuer` is NULL, leaf certs are issued for localhost
+static test_pki_cert test_pki_issue(const std::string &cn, const test_pki_cert *issuer, bool ca) {
+    static long serial = 1;
+    test_pki_cert c;
+    c.key = test_pki_key();
+    c.cert = X509_new();
+    X509_set_version(c.cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(c.cert), serial++);
+    X509_gmtime_adj(X509_getm_notBefore(c.cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(c.cert), 86400);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(c.cert), "CN", MBSTRING_ASC,
+                               (const unsigned char *) cn.c_str(), -1, -1, 0);
+    X509 *issuer_crt = issuer ? issuer->cert : c.cert;
+    X509_set_issuer_name(c.cert, X509_get_subject_name(issuer_crt));
+    X509_set_pubkey(c.cert, c.key);
+    if (ca) {
+        test_pki_ext(c.cert, issuer_crt, NID_basic_constraints, "critical,CA:TRUE");
+        test_pki_ext(c.cert, issuer_crt, NID_key_usage, "critical,keyCertSign,cRLSign");
+    } else {
+        test_pki_ext(c.cert, issuer_crt, NID_subject_alt_name, "DNS:localhost");
+        test_pki_ext(c.cert, issuer_crt, NID_ext_key_usage, "serverAuth");
+    }
+    X509_sign(c.cert, issuer ? issuer->key : c.key, EVP_sha256());
+    return c;
+}
+
+static std::string test_pki_pem(X509 *crt) {
+    BIO *b = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(b, crt);
+    char *data;
+    long len = BIO_get_mem_data(b, &data);
+    std::string pem(data, len);
+    BIO_free(b);
+    return pem;
+}
+
+static std::string test_pki_key_pem(EVP_PKEY *key) {
+    BIO *b = BIO_new(BIO_s_mem());
+    PEM_write_bio_PrivateKey(b, key, nullptr, nullptr, 0, nullptr, nullptr);
+    char *data;
+    long len = BIO_get_mem_data(b, &data);
+    std::string pem(data, len);
+    BIO_free(b);
+    return pem;
+}
+
+static void test_pki_free(test_pki_cert &c) {
+    X509_free(c.cert);
+    EVP_PKEY_free(c.key);
+}
+
+static tls_context *test_pki_server(const test_pki_cert &leaf, const test_pki_cert *inter = nullptr) {
+    std::string chain = test_pki_pem(leaf.cert);
+    if (inter) {
+        chain += test_pki_pem(inter->cert);
+    }
+    return test_server_tls(chain.c_str(), test_pki_key_pem(leaf.key).c_str());
+}
+
+// trust bundle of `count` roots, one intermediate, and a root sharing subject name with another one
+struct test_pki_bundle {
+    std::vector<test_pki_cert> roots;
+    test_pki_cert inter;
+    test_pki_cert dup_root;
+    std::string pem;
+
+    explicit test_pki_bundle(int count) {
+        for (int i = 0; i < count; i++) {
+            roots.push_back(test_pki_issue("Test Root " + std::to_string(i), nullptr, true));
+            pem += test_pki_pem(roots.back().cert);
+        }
+        inter = test_pki_issue("Test Intermediate", &roots[count / 2], true);
+        dup_root = test_pki_issue("Test Root 0", nullptr, true);
+        pem += test_pki_pem(inter.cert);
+        pem += test_pki_pem(dup_root.cert);
+    }
+
+    ~test_pki_bundle() {
+        for (auto &r: roots) test_pki_free(r);
+        test_pki_free(inter);
+        test_pki_free(dup_root);
+    }
+};
+
+TEST_CASE("CA bundle chain lookup", "[engine]") {
+    auto count = GENERATE(as<int>{}, 1, 50, 500);
+    INFO("roots: " << count);
+    test_pki_bundle pki(count);
+    tls_context *tls = default_tls_context(pki.pem.c_str(), pki.pem.size());
+
+    // same outcome as trying every chain store
+    struct {
+        const char *name;
+        const test_pki_cert *issuer;
+        bool send_issuer;
+        tls_handshake_state expected;
+    } cases[] = {
+            {"first root", &pki.roots[0], false, TLS_HS_COMPLETE},
+            {"last root", &pki.roots[count - 1], false, TLS_HS_COMPLETE},
+            {"intermediate", &pki.inter, false, TLS_HS_COMPLETE},
+            {"intermediate sent by peer", &pki.inter, true, TLS_HS_COMPLETE},
+            {"root with duplicate name", &pki.dup_root, false, TLS_HS_COMPLETE},
+            {"unknown root", nullptr, false, TLS_HS_ERROR},
+    };
+    test_pki_cert unknown = test_pki_issue("Unknown Root", nullptr, true);
+    for (auto &c: cases) {
+        INFO(c.name);
+        test_pki_cert leaf = test_pki_issue("localhost", c.issuer ? c.issuer : &unknown, false);
+        tls_context *srv = test_pki_server(leaf, c.send_issuer ? c.issuer : nullptr);
+        CHECK(mem_handshake(tls, srv) == c.expected);
+        srv->api->free_ctx(srv);
+        test_pki_free(leaf);
+    }
+    test_pki_free(unknown);
+
+    tls->api->free_ctx(tls);
+}
+
+TEST_CASE("CA bundle chain lookup benchmark", "[.][engine]") {
+    for (int count: {1, 50, 500}) {
+        test_pki_bundle pki(count);
+
+        uint64_t start = uv_hrtime();
+        tls_context *tls = default_tls_context(pki.pem.c_str(), pki.pem.size());
+        uint64_t build = uv_hrtime() - start;
+
+        // peer issued by unknown CA goes through chain store lookup
+        test_pki_cert unknown = test_pki_issue("Unknown Root", nullptr, true);
+        test_pki_cert leaf = test_pki_issue("localhost", &unknown, false);
+        tls_context *srv = test_pki_server(leaf);
+        const int rounds = 50;
+        start = uv_hrtime();
+        for (int i = 0; i < rounds; i++) {
+            CHECK(mem_handshake(tls, srv) == TLS_HS_ERROR);
+        }
+        uint64_t failed = (uv_hrtime() - start) / rounds;
+
+        printf("%4d roots: bundle load %8.3f ms, failed handshake %6.3f ms\n",
+               count, (double) build / 1e6, (double) failed / 1e6);
+
+        srv->api->free_ctx(srv);
+        test_pki_free(leaf);
+        test_pki_free(unknown);
+        tls->api->free_ctx(tls);
+    }
+}
+#endif
+
+TEST_CASE("vectored engine write", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tls_context *srv_tls = test_server_tls(to_str(TEST_SERVER_CERT), to_str(TEST_SERVER_KEY));
+
+    mem_pair p;
+    mem_pair_connect(&p, tls, srv_tls);
+    REQUIRE(p.state == TLS_HS_COMPLETE);
+    if (p.clt->api->write_vec == nullptr) {
+        WARN("vectored write is not supported by TLS library");
+        mem_pair_free(&p, tls, srv_tls);
+        tls->api->free_ctx(tls);
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+
+    std::vector<std::string> parts;
+    for (int i = 0; i < 100; i++) {
+        parts.emplace_back(10, (char) ('a' + i % 26));
+    }
+    std::vector<uv_buf_t> bufs;
+    std::string expected;
+    for (auto &part: parts) {
+        bufs.push_back(uv_buf_init(&part[0], (unsigned int) part.size()));
+        expected += part;
+    }
+
+    static char seg_mem[4][8 * 1024];
+    uv_buf_t out[4];
+    WHEN("small buffers") {
+        for (int i = 0; i < 4; i++) out[i] = uv_buf_init(seg_mem[i], sizeof(seg_mem[i]));
+        unsigned int nout = 4;
+        CHECK(p.clt->api->write_vec(p.clt->engine, bufs.data(), (unsigned int) bufs.size(), out, &nout) == 0);
+        CHECK(nout == 1);
+        // coalesced into shared record(s), not one record per buffer
+        CHECK(out[0].len < expected.size() + 10 * 22);
+        CHECK(mem_read(p.srv, std::string(out[0].base, out[0].len)) == expected);
+    }
+
+    WHEN("records do not fit into output segments") {
+        std::string big(40000, 'x');
+        bufs.push_back(uv_buf_init(&big[0], (unsigned int) big.size()));
+        expected += big;
+
+        for (int i = 0; i < 4; i++) out[i] = uv_buf_init(seg_mem[i], 4 * 1024);
+        unsigned int nout = 3;
+        int pending = p.clt->api->write_vec(p.clt->engine, bufs.data(), (unsigned int) bufs.size(), out, &nout);
+        CHECK(pending > 0);
+        CHECK(nout == 3);
+
+        std::string cipher;
+        for (unsigned int i = 0; i < nout; i++) {
+            CHECK(out[i].len == 4 * 1024);
+            cipher.append(out[i].base, out[i].len);
+        }
+        // pending records are drained with empty write
+        cipher += mem_write(p.clt, "");
+        CHECK(cipher.size() == 3 * 4 * 1024 + (size_t) pending);
+        CHECK(mem_read(p.srv, cipher) == expected);
+    }
+
+    mem_pair_free(&p, tls, srv_tls);
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+TEST_CASE("ring buffer I/O", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tls_context *srv_tls = test_server_tls(to_str(TEST_SERVER_CERT), to_str(TEST_SERVER_KEY));
+    if (tls->api->set_io_buffer == nullptr) {
+        WARN("ring buffer I/O is not supported by TLS library");
+        tls->api->free_ctx(tls);
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+
+    // smaller than server handshake flight and full size records, ring has to grow for them
+    REQUIRE(tls->api->set_io_buffer(tls, 1024) == 0);
+    REQUIRE(srv_tls->api->set_io_buffer(srv_tls, 1024) == 0);
+
+    mem_pair p;
+    mem_pair_connect(&p, tls, srv_tls);
+    REQUIRE(p.state == TLS_HS_COMPLETE);
+
+    std::string data;
+    for (int i = 0; i < 100 * 1024; i++) {
+        data += (char) (i % 251);
+    }
+    std::string cipher = mem_write(p.clt, data);
+
+    size_t chunk = 0;
+    WHEN("records arrive whole") {
+        chunk = cipher.size();
+    }
+    WHEN("records arrive split") {
+        // unconsumed tail of every chunk is kept by the ring
+        chunk = 1000;
+    }
+
+    std::string plain;
+    for (size_t off = 0; off < cipher.size(); off += chunk) {
+        plain += mem_read(p.srv, cipher.substr(off, chunk));
+    }
+    CHECK(plain == data);
+
+    // other direction, starting with what server sent after handshake
+    std::string reply = p.to_clt + mem_write(p.srv, "reply");
+    CHECK(mem_read(p.clt, reply) == "reply");
+    mem_pair_free(&p, tls, srv_tls);
+
+    // default memory buffers are restored
+    REQUIRE(tls->api->set_io_buffer(tls, 0) == 0);
+    mem_pair_connect(&p, tls, srv_tls);
+    CHECK(p.state == TLS_HS_COMPLETE);
+    CHECK(mem_read(p.srv, mem_write(p.clt, "hello")) == "hello");
+    mem_pair_free(&p, tls, srv_tls);
+
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+#if defined(TEST_openssl)
+// OpenSSL server that takes TLS 1.3 early data, engine server mode does not enable it
+struct early_server {
+    SSL_CTX *ctx;
+    SSL *ssl;
+    std::string early;
+    // server output after handshake (session tickets)
+    std::string tickets;
+};
+
+static void early_server_init(early_server *s) {
+    s->ctx = SSL_CTX_new(TLS_server_method());
+    REQUIRE(SSL_CTX_use_certificate_file(s->ctx, to_str(TEST_SERVER_CERT), SSL_FILETYPE_PEM) == 1);
+    REQUIRE(SSL_CTX_use_PrivateKey_file(s->ctx, to_str(TEST_SERVER_KEY), SSL_FILETYPE_PEM) == 1);
+    SSL_CTX_set_max_early_data(s->ctx, 16 * 1024);
+    // single use tickets are not tracked by this server
+    SSL_CTX_set_options(s->ctx, SSL_OP_NO_ANTI_REPLAY);
+    s->ssl = nullptr;
+}
+
+static void early_server_free(early_server *s) {
+    SSL_free(s->ssl);
+    SSL_CTX_free(s->ctx);
+}
+
+static std::string early_server_output(early_server *s) {
+    char buf[32 * 1024];
+    int n = BIO_read(SSL_get_wbio(s->ssl), buf, sizeof(buf));
+    return n > 0 ? std::string(buf, n) : std::string();
+}
+
+static tls_handshake_state early_server_connect(early_server *s, tls_engine *clt) {
+    SSL_free(s->ssl);
+    s->ssl = SSL_new(s->ctx);
+    SSL_set_bio(s->ssl, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+    SSL_set_accept_state(s->ssl);
+    s->early.clear();
+
+    static char c2s[32 * 1024];
+    size_t c_len = 0;
+    bool early_done = false;
+    tls_handshake_state cs = clt->api->handshake(clt->engine, nullptr, 0, c2s, &c_len, sizeof(c2s));
+    for (int i = 0; i < 16 && cs != TLS_HS_ERROR; i++) {
+        BIO_write(SSL_get_rbio(s->ssl), c2s, (int) c_len);
+        c_len = 0;
+        while (!early_done) {
+            char buf[1024];
+            size_t n = 0;
+            int rc = SSL_read_early_data(s->ssl, buf, sizeof(buf), &n);
+            if (rc == SSL_READ_EARLY_DATA_SUCCESS) {
+                s->early.append(buf, n);
+                continue;
+            }
+            early_done = rc == SSL_READ_EARLY_DATA_FINISH;
+            break;
+        }
+        if (early_done) {
+            SSL_do_handshake(s->ssl);
+        }
+        std::string s2c = early_server_output(s);
+        if (cs == TLS_HS_COMPLETE) {
+            s->tickets = s2c;
+            break;
+        }
+        cs = clt->api->handshake(clt->engine, &s2c[0], s2c.size(), c2s, &c_len, sizeof(c2s));
+    }
+    return cs;
+}
+
+static std::string early_server_read(early_server *s, const std::string &cipher) {
+    BIO_write(SSL_get_rbio(s->ssl), cipher.data(), (int) cipher.size());
+    std::string plain;
+    char buf[1024];
+    size_t n;
+    while (SSL_read_ex(s->ssl, buf, sizeof(buf), &n) == 1) {
+        plain.append(buf, n);
+    }
+    return plain;
+}
+
+TEST_CASE("early data", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    REQUIRE(tls->api->new_engine != nullptr);
+
+    early_server srv{};
+    early_server_init(&srv);
+    const std::string req = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    // no session to resume, early data is not possible
+    tls_engine *clt = tls->api->new_engine(tls->ctx, "localhost");
+    CHECK(clt->api->write_early_data(clt->engine, req.data(), req.size()) == 0);
+    REQUIRE(early_server_connect(&srv, clt) == TLS_HS_COMPLETE);
+    CHECK(clt->api->early_data_status(clt->engine) == TLS_EARLY_DATA_NONE);
+    mem_read(clt, srv.tickets);
+    tls->api->free_engine(clt);
+
+    WHEN("server accepts early data") {
+        clt = tls->api->new_engine(tls->ctx, "localhost");
+        CHECK(clt->api->write_early_data(clt->engine, req.data(), req.size()) == (int) req.size());
+        REQUIRE(early_server_connect(&srv, clt) == TLS_HS_COMPLETE);
+        CHECK(SSL_session_reused(srv.ssl) == 1);
+        CHECK(srv.early == req);
+        CHECK(clt->api->early_data_status(clt->engine) == TLS_EARLY_DATA_ACCEPTED);
+        tls->api->free_engine(clt);
+    }
+
+    WHEN("server rejects early data") {
+        // restarted server cannot resume the session
+        early_server_free(&srv);
+        early_server_init(&srv);
+
+        clt = tls->api->new_engine(tls->ctx, "localhost");
+        CHECK(clt->api->write_early_data(clt->engine, req.data(), req.size()) == (int) req.size());
+        REQUIRE(early_server_connect(&srv, clt) == TLS_HS_COMPLETE);
+        CHECK(srv.early.empty());
+        CHECK(clt->api->early_data_status(clt->engine) == TLS_EARLY_DATA_REJECTED);
+
+        // rejected data is sent again as regular application data
+        CHECK(early_server_read(&srv, mem_write(clt, req)) == req);
+        tls->api->free_engine(clt);
+    }
+
+    early_server_free(&srv);
+    tls->api->free_ctx(tls);
+}
+#endif
+
+#if defined(TEST_openssl) && defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static int keylog_lines;
+static void test_keylog(const SSL *, const char *) {
+    keylog_lines++;
+}
+
+// connected loopback TCP sockets
+static void tcp_socket_pair(int fds[2]) {
+    int srv = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(bind(srv, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    REQUIRE(listen(srv, 1) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(srv, (struct sockaddr *) &addr, &len);
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(connect(fds[0], (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    fds[1] = accept(srv, nullptr, nullptr);
+    REQUIRE(fds[1] >= 0);
+    close(srv);
+}
+
+TEST_CASE("kTLS transmit offload", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tls_context *srv_tls = test_server_tls(to_str(TEST_SERVER_CERT), to_str(TEST_SERVER_KEY));
+    REQUIRE(tls->api->set_ktls != nullptr);
+
+    // native context is the first member of engine context
+    SSL_CTX *ssl_ctx = *(SSL_CTX **) tls->ctx;
+    SSL_CTX_set_keylog_callback(ssl_ctx, test_keylog);
+    keylog_lines = 0;
+    REQUIRE(tls->api->set_ktls(tls, 1) == 0);
+
+    mem_pair p;
+    mem_pair_connect(&p, tls, srv_tls);
+    REQUIRE(p.state == TLS_HS_COMPLETE);
+    // application callback still sees the secrets
+    CHECK(keylog_lines > 0);
+
+    int fds[2];
+    tcp_socket_pair(fds);
+    int rc = p.clt->api->ktls_tx(p.clt->engine, fds[0]);
+    if (rc == 0) {
+        // kernel encrypts what is written to the socket
+        CHECK(write(fds[0], "hello", 5) == 5);
+        char buf[1024];
+        ssize_t n = read(fds[1], buf, sizeof(buf));
+        REQUIRE(n > 5);
+        CHECK(mem_read(p.srv, std::string(buf, n)) == "hello");
+    } else {
+        WARN("kTLS is not available: " << uv_strerror(rc));
+        CHECK(mem_read(p.srv, mem_write(p.clt, "hello")) == "hello");
+    }
+    // already offloaded or records were written by the engine
+    CHECK(p.clt->api->ktls_tx(p.clt->engine, fds[0]) == UV_ENOTSUP);
+    close(fds[0]);
+    close(fds[1]);
+    mem_pair_free(&p, tls, srv_tls);
+
+    REQUIRE(tls->api->set_ktls(tls, 0) == 0);
+    CHECK(SSL_CTX_get_keylog_callback(ssl_ctx) == test_keylog);
+    mem_pair_connect(&p, tls, srv_tls);
+    CHECK(p.clt->api->ktls_tx(p.clt->engine, -1) == UV_ENOTSUP);
+    mem_pair_free(&p, tls, srv_tls);
+
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+#endif
+
+TEST_CASE("cipher profiles", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tls_context *srv_tls = test_server_tls(to_str(TEST_SERVER_CERT), to_str(TEST_SERVER_KEY));
+    REQUIRE(tls->api->set_cipher_profile != nullptr);
+
+    CHECK(tls->api->set_cipher_profile(tls, (tls_cipher_profile) 42) == UV_EINVAL);
+    CHECK(tls->api->set_cipher_profile(tls, (tls_cipher_profile) -1) == UV_EINVAL);
+
+    tls_cipher_profile profile = GENERATE(TLS_CIPHERS_DEFAULT, TLS_CIPHERS_AUTO, TLS_CIPHERS_THROUGHPUT,
+                                          TLS_CIPHERS_LOW_CPU, TLS_CIPHERS_COMPAT);
+    REQUIRE(tls->api->set_cipher_profile(tls, profile) == 0);
+
+    mem_pair p;
+    mem_pair_connect(&p, tls, srv_tls);
+    CHECK(p.state == TLS_HS_COMPLETE);
+    CHECK(mem_read(p.srv, mem_write(p.clt, "hello")) == "hello");
+
+#if defined(TEST_openssl)
+    // server follows client preference
+    std::string cipher = SSL_CIPHER_get_name(SSL_get_current_cipher(*(SSL **) p.clt->engine));
+    if (profile == TLS_CIPHERS_AUTO) {
+        profile = tlsuv_cpu_has_aes() ? TLS_CIPHERS_THROUGHPUT : TLS_CIPHERS_LOW_CPU;
+    }
+    if (profile == TLS_CIPHERS_THROUGHPUT) {
+        CHECK(cipher == "TLS_AES_128_GCM_SHA256");
+    } else if (profile == TLS_CIPHERS_LOW_CPU) {
+        CHECK(cipher == "TLS_CHACHA20_POLY1305_SHA256");
+    }
+#endif
+
+    mem_pair_free(&p, tls, srv_tls);
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+static unsigned long tls_allocs() {
+    tlsuv_mem_stats st = {};
+    return tlsuv_mem_get_stats(TLSUV_MEM_TLS, &st) == 0 ? st.allocs : 0;
+}
+
+TEST_CASE("engine pool", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tls_context *srv_tls = test_server_tls(to_str(TEST_SERVER_CERT), to_str(TEST_SERVER_KEY));
+    if (tls->api->set_engine_pool == nullptr) {
+        WARN("engine pool is not supported by TLS library");
+        tls->api->free_ctx(tls);
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+    REQUIRE(tls->api->set_engine_pool(tls, 2) == 0);
+
+    tls_engine *e[4];
+    for (auto &eng: e) {
+        eng = tls->api->new_engine(tls->ctx, "localhost");
+    }
+    for (auto eng: e) {
+        tls->api->free_engine(eng);
+    }
+
+    // only [max_idle] engines are kept, others were destroyed
+    unsigned long before = tls_allocs();
+    tls_engine *n0 = tls->api->new_engine(tls->ctx, "localhost");
+    tls_engine *n1 = tls->api->new_engine(tls->ctx, "localhost");
+    unsigned long pooled_allocs = tls_allocs() - before;
+    CHECK(((n0 == e[0] && n1 == e[1]) || (n0 == e[1] && n1 == e[0])));
+
+    before = tls_allocs();
+    tls_engine *n2 = tls->api->new_engine(tls->ctx, "localhost");
+    unsigned long fresh_allocs = tls_allocs() - before;
+    if (fresh_allocs > 0) {
+        CHECK(pooled_allocs / 2 < fresh_allocs);
+    }
+    tls->api->free_engine(n0);
+    tls->api->free_engine(n1);
+    tls->api->free_engine(n2);
+
+    WHEN("pooled engine connects to other host") {
+        mem_pair p;
+        mem_pair_connect(&p, tls, srv_tls, "127.0.0.1");
+        THEN("it is bound to the new host") {
+            CHECK(p.state == TLS_HS_COMPLETE);
+#if defined(TEST_openssl)
+            const char *sni = SSL_get_servername(*(SSL **) p.srv->engine, TLSEXT_NAMETYPE_host_name);
+            REQUIRE(sni != nullptr);
+            CHECK(std::string(sni) == "127.0.0.1");
+#endif
+            CHECK(mem_read(p.srv, mem_write(p.clt, "hello")) == "hello");
+        }
+        mem_pair_free(&p, tls, srv_tls);
+    }
+
+    WHEN("pooling is disabled") {
+        REQUIRE(tls->api->set_engine_pool(tls, 0) == 0);
+        tls_engine *eng = tls->api->new_engine(tls->ctx, "localhost");
+        tls->api->free_engine(eng);
+
+        before = tls_allocs();
+        eng = tls->api->new_engine(tls->ctx, "localhost");
+        if (fresh_allocs > 0) {
+            CHECK(tls_allocs() - before == fresh_allocs);
+        }
+        tls->api->free_engine(eng);
+    }
+
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+TEST_CASE("CA source detection", "[engine]") {
+    const char *ca = to_str(TEST_SERVER_CA);
+    CHECK(tlsuv_ca_is_file(ca, strlen(ca), nullptr));
+    CHECK(tlsuv_ca_is_file(ca, strlen(ca) + 1, nullptr));
+    CHECK_FALSE(tlsuv_ca_is_file(ca, strlen(ca) - 1, nullptr));
+
+    // PEM without terminating NUL is never read past its length
+    const char pem[] = "-----BEGIN CERTIFICATE-----\nMIIB\n-----END CERTIFICATE-----\n";
+    std::vector<char> unterminated(pem, pem + strlen(pem));
+    CHECK_FALSE(tlsuv_ca_is_file(unterminated.data(), unterminated.size(), nullptr));
+
+    std::vector<char> dir(ca, ca + (strrchr(ca, '/') - ca));
+    CHECK_FALSE(tlsuv_ca_is_file(dir.data(), dir.size(), nullptr));
+}
+
+TEST_CASE("OCSP status check", "[engine]") {
+    const char *cert = to_str(TEST_SERVER_CERT);
+    const char *key = to_str(TEST_SERVER_KEY);
+    const char *ca = to_str(TEST_SERVER_CA);
+
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    if (tls->api->set_ocsp == nullptr || srv_tls->api->set_server_mode == nullptr) {
+        WARN("OCSP is not supported by TLS library");
+        tls->api->free_ctx(tls);
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+
+    tlsuv_private_key_t pk;
+    REQUIRE(srv_tls->api->load_key(&pk, key, strlen(key)) == 0);
+    REQUIRE(srv_tls->api->set_own_cert(srv_tls->ctx, cert, strlen(cert)) == 0);
+    REQUIRE(srv_tls->api->set_own_key(srv_tls->ctx, pk) == 0);
+    REQUIRE(srv_tls->api->set_server_mode(srv_tls, TLS_SERVER_MODE) == 0);
+
+    ocsp_fetch_s fetch{};
+    tls_ocsp_config cfg{};
+    cfg.cache_size = 16;
+    cfg.fetch = test_ocsp_fetch;
+    cfg.fetch_ctx = &fetch;
+
+    // test server does not staple, status can only be fetched
+    cfg.mode = TLS_OCSP_REQUIRE;
+    REQUIRE(tls->api->set_ocsp(tls, &cfg) == 0);
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_ERROR);
+    CHECK(fetch.calls == 1);
+    CHECK(fetch.req_len > 0);
+
+    fetch.reply = true;
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_ERROR);
+    CHECK(fetch.calls == 2);
+
+    // invalid response is not cached
+    cfg.mode = TLS_OCSP_SOFT_FAIL;
+    REQUIRE(tls->api->set_ocsp(tls, &cfg) == 0);
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    CHECK(fetch.calls == 4);
+
+    cfg.mode = (tls_ocsp_mode) 42;
+    CHECK(tls->api->set_ocsp(tls, &cfg) == UV_EINVAL);
+
+    REQUIRE(tls->api->set_ocsp(tls, nullptr) == 0);
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    CHECK(fetch.calls == 4);
+
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+TEST_CASE("precompiled trust store", "[engine]") {
+    const char *cert = to_str(TEST_SERVER_CERT);
+    const char *key = to_str(TEST_SERVER_KEY);
+    const char *ca = to_str(TEST_SERVER_CA);
+
+    char tmp[1024];
+    size_t tmp_len = sizeof(tmp);
+    REQUIRE(uv_os_tmpdir(tmp, &tmp_len) == 0);
+    std::string ca_store = std::string(tmp) + "/tlsuv-ca-" + std::to_string(getpid()) + ".bin";
+    std::string leaf_store = std::string(tmp) + "/tlsuv-leaf-" + std::to_string(getpid()) + ".bin";
+
+    CHECK(tlsuv_trust_store_compile(key, ca_store.c_str()) == UV_EINVAL);
+    CHECK(tlsuv_trust_store_compile("/no/such/bundle.pem", ca_store.c_str()) == UV_ENOENT);
+    REQUIRE(tlsuv_trust_store_compile(ca, ca_store.c_str()) == 1);
+    REQUIRE(tlsuv_trust_store_compile(cert, leaf_store.c_str()) == 1);
+
+    // PEM bundle is not mistaken for trust store
+    CHECK(tlsuv_trust_store_open(ca) == nullptr);
+    tlsuv_trust_store *ts = tlsuv_trust_store_open(ca_store.c_str());
+    REQUIRE(ts != nullptr);
+    CHECK(tlsuv_trust_store_count(ts) == 1);
+    size_t der_len = 0;
+    const uint8_t *der = tlsuv_trust_store_cert(ts, 0, nullptr, &der_len);
+    REQUIRE(der != nullptr);
+    CHECK(der[0] == 0x30);
+    CHECK(tlsuv_trust_store_cert(ts, 1, nullptr, &der_len) == nullptr);
+    tlsuv_trust_store_close(ts);
+
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    if (srv_tls->api->set_server_mode == nullptr) {
+        WARN("server mode is not supported by TLS library");
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+    tlsuv_private_key_t pk;
+    REQUIRE(srv_tls->api->load_key(&pk, key, strlen(key)) == 0);
+    REQUIRE(srv_tls->api->set_own_cert(srv_tls->ctx, cert, strlen(cert)) == 0);
+    REQUIRE(srv_tls->api->set_own_key(srv_tls->ctx, pk) == 0);
+    REQUIRE(srv_tls->api->set_server_mode(srv_tls, TLS_SERVER_MODE) == 0);
+
+    tls_context *tls = default_tls_context(ca_store.c_str(), ca_store.size());
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_COMPLETE);
+    tls->api->free_ctx(tls);
+
+    // server certificate is not a trust anchor
+    tls = default_tls_context(leaf_store.c_str(), leaf_store.size());
+    CHECK(mem_handshake(tls, srv_tls) == TLS_HS_ERROR);
+    tls->api->free_ctx(tls);
+
+    srv_tls->api->free_ctx(srv_tls);
+    unlink(ca_store.c_str());
+    unlink(leaf_store.c_str());
+}
@@ -22,10 +22,17 @@ limitations under the License.
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 #include <tlsuv/http.h>
+#include <tlsuv/http_group.h>
+#include <tlsuv/pipe_src.h>
+#include <tlsuv/proxy_src.h>
 #include <tlsuv/tls_engine.h>
 #include <tlsuv/tlsuv.h>
 
+#include "http_req.h"
+#include "pool.h"
+
 extern tlsuv_log_func test_log;
 using namespace std;
 using namespace Catch::Matchers;
@@ -559,6 +566,197 @@ TEST_CASE("basic_test", "[http]") {
     tlsuv_http_close(&clt, nullptr);
 }
 
+TEST_CASE("response header filter", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    resp_capture resp(resp_body_cb);
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    const char *names[] = {"X-Keep", nullptr};
+    CHECK(tlsuv_http_resp_headers(&clt, names) == 0);
+
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "GET", "/response-headers?X-Keep=1&X-Drop=2",
+                                           resp_capture_cb, &resp);
+    static map<string, string, ci_less> dropped;
+    dropped.clear();
+    CHECK(tlsuv_http_req_resp_headers(req, nullptr, [](tlsuv_http_resp_t *, const char *name, size_t namelen,
+                                                        const char *value, size_t vallen) {
+        dropped[string(name, namelen)] = string(value, vallen);
+    }) == 0);
+
+    test.run();
+
+    CHECK(resp.code == HTTP_STATUS_OK);
+    CHECK(resp.headers["X-Keep"] == "1");
+    CHECK(resp.headers.count("X-Drop") == 0);
+    CHECK(resp.headers.count("Content-Type") == 1);
+    CHECK(dropped["X-Drop"] == "2");
+    CHECK(resp.resp_body_end_called == 1);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+static void add_resp_header(tlsuv_http_req_t *req, const char *name, const string &value) {
+    http_req_resp_header(req, name, strlen(name), value.c_str(), value.size());
+}
+
+TEST_CASE("request header arena", "[http]") {
+    tlsuv_http_req_t req{};
+    http_req_init(&req, "GET", "/");
+
+    add_resp_header(&req, "Content-Type", "text/plain");
+    // more than first arena block holds
+    for (int i = 0; i < 100; i++) {
+        add_resp_header(&req, ("X-Header-" + std::to_string(i)).c_str(), string(40, (char) ('a' + i % 26)));
+    }
+    add_resp_header(&req, "content-type", "application/json");
+    add_resp_header(&req, "Location", "/next");
+
+    for (int i = 0; i < 100; i++) {
+        const char *v = tlsuv_http_resp_header(&req.resp, ("x-header-" + std::to_string(i)).c_str());
+        REQUIRE(v != nullptr);
+        CHECK(v == string(40, (char) ('a' + i % 26)));
+    }
+    // index points to the last received header of the name
+    CHECK_THAT(tlsuv_http_resp_header(&req.resp, "Content-Type"), Equals("application/json"));
+    CHECK_THAT(tlsuv_http_resp_header(&req.resp, "location"), Equals("/next"));
+    CHECK(tlsuv_http_resp_header(&req.resp, "Content-Length") == nullptr);
+
+    WHEN("indexed header is removed") {
+        http_req_set_header(&req, &req.resp.headers, "Content-Type", nullptr);
+        THEN("earlier header of the same name is found") {
+            CHECK_THAT(tlsuv_http_resp_header(&req.resp, "content-type"), Equals("text/plain"));
+            http_req_set_header(&req, &req.resp.headers, "content-type", nullptr);
+            CHECK(tlsuv_http_resp_header(&req.resp, "Content-Type") == nullptr);
+        }
+    }
+
+    WHEN("indexed header is replaced") {
+        http_req_set_header(&req, &req.resp.headers, "Location", "/other");
+        CHECK_THAT(tlsuv_http_resp_header(&req.resp, "Location"), Equals("/other"));
+        int count = 0;
+        tlsuv_http_hdr *h;
+        LIST_FOREACH(h, &req.resp.headers, _next) {
+            count += strcasecmp(h->name, "location") == 0;
+        }
+        CHECK(count == 1);
+    }
+
+    WHEN("request header of known name is set") {
+        http_req_set_header(&req, &req.req_headers, "Content-Type", "text/html");
+        THEN("response index is not affected") {
+            CHECK_THAT(tlsuv_http_resp_header(&req.resp, "Content-Type"), Equals("application/json"));
+        }
+    }
+
+    WHEN("headers are cleared") {
+        http_req_clear_headers(&req, &req.resp.headers);
+        CHECK(tlsuv_http_resp_header(&req.resp, "Content-Type") == nullptr);
+        CHECK(tlsuv_http_resp_header(&req.resp, "X-Header-1") == nullptr);
+        add_resp_header(&req, "Content-Type", "text/csv");
+        CHECK_THAT(tlsuv_http_resp_header(&req.resp, "Content-Type"), Equals("text/csv"));
+    }
+
+    http_req_free(&req);
+}
+
+static string wire_string(const http_req_wire *w) {
+    string s;
+    for (unsigned int i = 0; i < w->nbufs; i++) {
+        s.append(w->bufs[i].base, w->bufs[i].len);
+    }
+    return s;
+}
+
+TEST_CASE("request serialize", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, "http://local.test");
+    tlsuv_http_set_path_prefix(&clt, "/api");
+    tlsuv_http_header(&clt, "X-Client", "client-value");
+    tlsuv_http_header(&clt, "Accept", "*/*");
+
+    tlsuv_http_req_t r1{}, r2{};
+    http_req_init(&r1, "GET", "/a b");
+    r1.client = &clt;
+    http_req_init(&r2, "GET", "/b");
+    r2.client = &clt;
+    http_req_set_header(&r2, &r2.req_headers, "X-Request", "r2");
+
+    http_req_wire *w1 = http_req_serialize(&r1);
+    http_req_wire *w2 = http_req_serialize(&r2);
+
+    THEN("client headers block is shared") {
+        REQUIRE(w1->nbufs == 3);
+        REQUIRE(w2->nbufs == 3);
+        CHECK(w1->block == w2->block);
+        CHECK(w1->block == clt.hdr_block);
+        CHECK(w1->block->refs == 3);
+    }
+
+    THEN("head has exact size") {
+        for (auto w: {w1, w2}) {
+            string head = wire_string(w);
+            CHECK(head.size() == w->len);
+            char *flat = http_req_wire_flatten(w);
+            CHECK(string(flat, w->len) == head);
+            tlsuv_pool_free(flat);
+            CHECK_THAT(head, EndsWith("\r\n\r\n"));
+            CHECK(head.find("\r\n\r\n") == head.size() - 4);
+            CHECK_THAT(head, Contains("X-Client: client-value\r\n"));
+        }
+        CHECK_THAT(wire_string(w1), StartsWith("GET /api/a%20b HTTP/1.1\r\n"));
+        CHECK_THAT(wire_string(w2), StartsWith("GET /api/b HTTP/1.1\r\n"));
+        CHECK_THAT(wire_string(w2), Contains("X-Request: r2\r\n"));
+    }
+
+    WHEN("request header replaces client header") {
+        tlsuv_http_req_t r3{};
+        http_req_init(&r3, "GET", "/c");
+        r3.client = &clt;
+        http_req_set_header(&r3, &r3.req_headers, "x-client", "override");
+        http_req_wire *w3 = http_req_serialize(&r3);
+
+        REQUIRE(w3->nbufs == 1);
+        CHECK(w3->block == nullptr);
+        CHECK(w1->block->refs == 3);
+        string head = wire_string(w3);
+        CHECK(head.size() == w3->len);
+        CHECK_THAT(head, EndsWith("\r\n\r\n"));
+        CHECK_THAT(head, Contains("x-client: override\r\n"));
+        CHECK_THAT(head, !Contains("client-value"));
+        CHECK_THAT(head, Contains("Accept: */*\r\n"));
+
+        http_req_wire_free(w3);
+        http_req_free(&r3);
+    }
+
+    WHEN("client header changes") {
+        struct http_hdr_block_s *old = w1->block;
+        tlsuv_http_header(&clt, "X-Client", "changed");
+        CHECK(clt.hdr_block == nullptr);
+        http_req_wire *w3 = http_req_serialize(&r1);
+        REQUIRE(w3->nbufs == 3);
+        CHECK(w3->block != old);
+        CHECK_THAT(wire_string(w3), Contains("X-Client: changed\r\n"));
+        THEN("written requests keep old block") {
+            CHECK(old->refs == 2);
+            CHECK_THAT(wire_string(w1), Contains("X-Client: client-value\r\n"));
+        }
+        http_req_wire_free(w3);
+    }
+
+    http_req_wire_free(w1);
+    http_req_wire_free(w2);
+    http_req_free(&r1);
+    http_req_free(&r2);
+
+    tlsuv_http_close(&clt, nullptr);
+    test.run();
+}
+
 TEST_CASE("invalid CA", "[http]") {
     UvLoopTest test;
 
@@ -772,6 +970,93 @@ TEST_CASE("large POST(GH-87)", "[http][gh-87]") {
     free(buf);
 }
 
+static ssize_t counting_body(tlsuv_http_req_t *, char *buf, size_t len, void *ctx) {
+    auto count = (int *)ctx;
+    if (*count == 0) return 0;
+    (*count)--;
+    return snprintf(buf, len, "part%d,", *count);
+}
+
+TEST_CASE("POST body source", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    resp_capture resp(resp_body_cb);
+
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "POST", "/anything", resp_capture_cb, &resp);
+    tlsuv_http_req_header(req, "Content-Type", "application/octet-stream");
+
+    FILE *f = nullptr;
+    int parts = 3;
+    SECTION("file") {
+        f = tmpfile();
+        string content(200 * 1024, 'Z');
+        content.replace(0, 6, "header");
+        fwrite(content.data(), 1, content.size(), f);
+        fflush(f);
+        // skip "header"
+        CHECK(tlsuv_http_req_body_file(req, fileno(f), 6, (int64_t)content.size() - 6) == 0);
+        // body can only come from one place
+        CHECK(tlsuv_http_req_body_source(req, -1, counting_body, &parts) == UV_EINVAL);
+    }
+    SECTION("generator") {
+        CHECK(tlsuv_http_req_body_source(req, -1, counting_body, &parts) == 0);
+    }
+
+    test.run();
+
+    CHECK(resp.code == 200);
+    if (f) {
+        CHECK_THAT(resp.body, Contains("ZZZZZZZZ") && !Contains("header"));
+        fclose(f);
+    } else {
+        CHECK(parts == 0);
+        CHECK_THAT(resp.body, Contains("part2,part1,part0,"));
+    }
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("response body sink", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+
+    struct sink_result {
+        FILE *f;
+        int code;
+        int status;
+        uint64_t written;
+    } result = { tmpfile(), 0, 1, 0 };
+
+    tlsuv_http_req(&clt, "GET", "/bytes/65536", [](tlsuv_http_resp_t *resp, void *ctx){
+        auto r = (sink_result *)ctx;
+        r->code = resp->code;
+        // small window makes reads pause while writes are pending
+        tlsuv_http_resp_sink(resp, fileno(r->f), 0, 4096, [](void *ctx, int status, uint64_t written){
+            auto r = (sink_result *)ctx;
+            r->status = status;
+            r->written = written;
+        }, r);
+    }, &result);
+
+    test.run();
+
+    CHECK(result.code == 200);
+    CHECK(result.status == 0);
+    CHECK(result.written == 65536);
+    fseek(result.f, 0, SEEK_END);
+    CHECK(ftell(result.f) == 65536);
+    fclose(result.f);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
 TEST_CASE("TLS verify with JWT", "[http]") {
     INFO("skipping JWT test");
     return;
@@ -922,6 +1207,1124 @@ TEST_CASE("HTTP deflate", "[http]") {
     tlsuv_http_close(&clt, nullptr);
 }
 
+TEST_CASE("HTTP connection pool", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    CHECK(tlsuv_http_max_connections(&clt, 0) == UV_EINVAL);
+    CHECK(tlsuv_http_max_connections(&clt, 3) == 0);
+
+    resp_capture resp1(resp_body_cb), resp2(resp_body_cb), resp3(resp_body_cb);
+    tlsuv_http_req(&clt, "GET", "/delay/1", resp_capture_cb, &resp1);
+    tlsuv_http_req(&clt, "GET", "/delay/1", resp_capture_cb, &resp2);
+    tlsuv_http_req(&clt, "GET", "/delay/1", resp_capture_cb, &resp3);
+
+    uint64_t start = uv_now(test.loop);
+    test.run();
+    uint64_t elapsed = uv_now(test.loop) - start;
+
+    CHECK(resp1.code == HTTP_STATUS_OK);
+    CHECK(resp2.code == HTTP_STATUS_OK);
+    CHECK(resp3.code == HTTP_STATUS_OK);
+    // requests ran in parallel
+    CHECK(elapsed < 2500);
+    CHECK(clt.conn_count == 3);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP preconnect", "[http]") {
+    UvLoopTest test;
+
+    struct warm_test {
+        tlsuv_http_t clt;
+        resp_capture resp[2];
+        tls_traffic_stats before;
+        size_t conns;
+    } t{};
+
+    tlsuv_http_init(test.loop, &t.clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&t.clt, testServerTLS());
+    tlsuv_http_idle_keepalive(&t.clt, 100);
+    CHECK(tlsuv_http_max_connections(&t.clt, 2) == 0);
+    CHECK(tlsuv_http_preconnect(&t.clt, 2, 0x80) == UV_EINVAL);
+    CHECK(tlsuv_http_preconnect(&t.clt, 3, TLSUV_HTTP_PRECONNECT_KEEP) == 0);
+
+    // requests are sent well past idle timeout, on connections opened ahead of time
+    uv_timer_t later;
+    uv_timer_init(test.loop, &later);
+    later.data = &t;
+    uv_timer_start(&later, [](uv_timer_t *h) {
+        auto t = (warm_test *) h->data;
+        CHECK(tlsuv_http_stats(&t->clt, &t->before) == 0);
+        t->conns = t->clt.conn_count;
+        for (auto &r: t->resp) {
+            tlsuv_http_req(&t->clt, "GET", "/json", resp_capture_cb, &r);
+        }
+        // warm connections keep the loop running, close client once responses are in
+        uv_timer_start(h, [](uv_timer_t *h) {
+            auto t = (warm_test *) h->data;
+            if (t->resp[0].code != -666 && t->resp[1].code != -666) {
+                uv_close((uv_handle_t *) h, nullptr);
+                tlsuv_http_close(&t->clt, nullptr);
+            }
+        }, 10, 10);
+    }, 1000, 0);
+
+    test.run();
+
+    CHECK(t.resp[0].code == HTTP_STATUS_OK);
+    CHECK(t.resp[1].code == HTTP_STATUS_OK);
+    // capped by connection limit
+    CHECK(t.before.handshakes == 2);
+    CHECK(t.conns == 2);
+}
+
+TEST_CASE("HTTP response cache", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    CHECK(tlsuv_http_cache(&clt, 64 * 1024) == 0);
+
+    struct cache_capture : resp_capture {
+        cache_capture() : resp_capture(resp_body_cb) {}
+        bool from_cache{};
+    };
+    auto cache_resp_cb = [](tlsuv_http_resp_t *resp, void *data) {
+        static_cast<cache_capture *>(data)->from_cache = resp->req->conn == nullptr;
+        resp_capture_cb(resp, data);
+    };
+
+    WHEN("fresh response is cached") {
+        cache_capture resp1, resp2;
+        tlsuv_http_req(&clt, "GET", "/cache/60", cache_resp_cb, &resp1);
+        test.run();
+        tlsuv_http_req(&clt, "GET", "/cache/60", cache_resp_cb, &resp2);
+        test.run();
+
+        CHECK(resp1.code == HTTP_STATUS_OK);
+        CHECK_FALSE(resp1.from_cache);
+        CHECK(resp2.code == HTTP_STATUS_OK);
+        CHECK(resp2.from_cache);
+        CHECK(resp2.resp_body_end_called == 1);
+        CHECK(resp2.body == resp1.body);
+    }
+
+    WHEN("response with ETag is revalidated") {
+        cache_capture resp1, resp2;
+        tlsuv_http_req(&clt, "GET", "/etag/tlsuv", cache_resp_cb, &resp1);
+        test.run();
+        tlsuv_http_req(&clt, "GET", "/etag/tlsuv", cache_resp_cb, &resp2);
+        test.run();
+
+        CHECK(resp1.code == HTTP_STATUS_OK);
+        // 304 is answered with cached response
+        CHECK(resp2.code == HTTP_STATUS_OK);
+        CHECK_FALSE(resp2.from_cache);
+        CHECK(resp2.headers["ETag"] == resp1.headers["ETag"]);
+        CHECK(resp2.body == resp1.body);
+    }
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP request timeouts", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    tlsuv_http_max_connections(&clt, 2);
+
+    resp_capture total(resp_body_cb), inactive(resp_body_cb);
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "GET", "/delay/3", resp_capture_cb, &total);
+    CHECK(tlsuv_http_req_timeout(req, 500) == 0);
+    req = tlsuv_http_req(&clt, "GET", "/delay/3", resp_capture_cb, &inactive);
+    CHECK(tlsuv_http_req_read_timeout(req, 500) == 0);
+
+    uint64_t start = uv_now(test.loop);
+    test.run();
+    uint64_t elapsed = uv_now(test.loop) - start;
+
+    CHECK(total.code == UV_ETIMEDOUT);
+    CHECK(inactive.code == UV_ETIMEDOUT);
+    CHECK(elapsed < 2500);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+struct submit_test {
+    tlsuv_http_t *clt;
+    tlsuv_http_reply_q_t *reply_q;
+    int expected;
+    int ok;
+    int done;
+};
+
+static void submit_result_cb(tlsuv_http_result_t *res) {
+    auto t = (submit_test *) res->ctx;
+    if (res->code == HTTP_STATUS_OK && res->body_len > 0) t->ok++;
+    t->done++;
+    tlsuv_http_result_free(res);
+}
+
+static void submit_worker(void *arg) {
+    auto t = (submit_test *) arg;
+    const char *headers[] = {"X-Submitter", "worker", nullptr};
+    for (int i = 0; i < 10; i++) {
+        tlsuv_http_submit_t sub = {};
+        sub.method = "GET";
+        sub.path = "/json";
+        sub.headers = headers;
+        sub.cb = submit_result_cb;
+        sub.reply_q = i % 2 ? t->reply_q : nullptr;
+        sub.ctx = t;
+        CHECK(tlsuv_http_req_submit(t->clt, &sub) == 0);
+    }
+}
+
+TEST_CASE("HTTP cross-thread submit", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+
+    submit_test t{&clt, tlsuv_http_reply_q_new(nullptr, nullptr), 20, 0, 0};
+
+    // results posted to reply queue are consumed on the loop thread here
+    uv_timer_t check;
+    uv_timer_init(test.loop, &check);
+    check.data = &t;
+    uv_timer_start(&check, [](uv_timer_t *h) {
+        auto t = (submit_test *) h->data;
+        tlsuv_http_result_t *res;
+        while ((res = tlsuv_http_reply_q_pop(t->reply_q)) != nullptr) {
+            submit_result_cb(res);
+        }
+        if (t->done == t->expected) {
+            uv_close((uv_handle_t *) h, nullptr);
+            tlsuv_http_close(t->clt, nullptr);
+        }
+    }, 10, 10);
+
+    uv_thread_t th[2];
+    for (auto &thr : th) {
+        uv_thread_create(&thr, submit_worker, &t);
+    }
+
+    test.run();
+    for (auto &thr : th) {
+        uv_thread_join(&thr);
+    }
+
+    CHECK(t.done == t.expected);
+    CHECK(t.ok == t.expected);
+    tlsuv_http_reply_q_free(t.reply_q);
+}
+
+TEST_CASE("HTTP client group", "[http]") {
+    std::string url = testServerURL("https");
+    tlsuv_http_group_opts_t opts = {};
+    opts.url = url.c_str();
+    opts.shards = 3;
+    opts.new_tls = [](void *) -> tls_context * {
+        return default_tls_context(test_server_CA, strlen(test_server_CA));
+    };
+
+    tlsuv_http_group_t *g = tlsuv_http_group_new(&opts);
+    REQUIRE(g != nullptr);
+
+    tlsuv_http_reply_q_t *q = tlsuv_http_reply_q_new(nullptr, nullptr);
+    const int count = 12;
+    for (int i = 0; i < count; i++) {
+        tlsuv_http_submit_t sub = {};
+        sub.method = "GET";
+        sub.path = "/json";
+        sub.reply_q = q;
+        CHECK(tlsuv_http_group_submit(g, i % 2 ? "affinity" : nullptr, &sub) == 0);
+    }
+
+    int done = 0, ok = 0;
+    uint64_t start = uv_hrtime();
+    while (done < count && uv_hrtime() - start < 15000000000ULL) {
+        tlsuv_http_result_t *res = tlsuv_http_reply_q_pop(q);
+        if (res == nullptr) {
+            uv_sleep(10);
+            continue;
+        }
+        if (res->code == HTTP_STATUS_OK) ok++;
+        done++;
+        tlsuv_http_result_free(res);
+    }
+    CHECK(ok == count);
+
+    tlsuv_http_group_stats_t stats;
+    CHECK(tlsuv_http_group_stats(g, &stats) == 0);
+    CHECK(stats.shards == 3);
+    CHECK(stats.submitted == count);
+    CHECK(stats.completed == count);
+    CHECK(stats.outstanding == 0);
+    CHECK(stats.traffic.handshakes > 0);
+
+    tlsuv_http_group_free(g);
+    tlsuv_http_reply_q_free(q);
+}
+
+TEST_CASE("HTTP shared connections", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt1, clt2;
+    for (auto c : {&clt1, &clt2}) {
+        tlsuv_http_init(test.loop, c, testServerURL("https").c_str());
+        tlsuv_http_set_ssl(c, testServerTLS());
+        tlsuv_http_idle_keepalive(c, 5000);
+        CHECK(tlsuv_http_share_connections(c, 2) == 0);
+    }
+
+    resp_capture resp1(resp_body_cb);
+    tlsuv_http_req(&clt1, "GET", "/json", resp_capture_cb, &resp1);
+    test.run();
+    CHECK(resp1.code == HTTP_STATUS_OK);
+    CHECK(clt1.conn_count == 1);
+
+    // second client takes idle connection of the first one
+    resp_capture resp2(resp_body_cb);
+    tlsuv_http_req(&clt2, "GET", "/json", resp_capture_cb, &resp2);
+    test.run();
+    CHECK(resp2.code == HTTP_STATUS_OK);
+    CHECK(clt1.conn_count == 0);
+    CHECK(clt2.conn_count == 1);
+
+    tlsuv_http_close(&clt1, nullptr);
+    tlsuv_http_close(&clt2, nullptr);
+}
+
+TEST_CASE("HTTP retry policy", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, "http://localhost:1222");
+    tlsuv_http_retry_policy_t policy = {};
+    policy.max_retries = 2;
+    policy.backoff = 10;
+    policy.max_backoff = 20;
+    CHECK(tlsuv_http_retry_policy(&clt, &policy) == 0);
+
+    resp_capture get(resp_body_cb), post(resp_body_cb);
+    tlsuv_http_req(&clt, "GET", "/", resp_capture_cb, &get);
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "POST", "/", resp_capture_cb, &post);
+    const char *msg = "this is a message";
+    tlsuv_http_req_data(req, msg, strlen(msg), nullptr);
+
+    test.run();
+
+    CHECK(get.code == UV_ECONNREFUSED);
+    // request with body is not retried
+    CHECK(post.code == UV_ECONNREFUSED);
+    tlsuv_http_retry_stats_t stats;
+    tlsuv_http_retry_stats(&clt, &stats);
+    CHECK(stats.retries == 2);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP hedged requests", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    tlsuv_http_max_connections(&clt, 2);
+    tlsuv_http_retry_policy_t policy = {};
+    policy.hedge_delay = 100;
+    CHECK(tlsuv_http_retry_policy(&clt, &policy) == 0);
+
+    resp_capture resp(resp_body_cb);
+    tlsuv_http_req(&clt, "GET", "/delay/1", resp_capture_cb, &resp);
+
+    test.run();
+
+    // only one response is delivered
+    CHECK(resp.code == HTTP_STATUS_OK);
+    tlsuv_http_retry_stats_t stats;
+    tlsuv_http_retry_stats(&clt, &stats);
+    CHECK(stats.hedges == 1);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP request priority", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+
+    resp_capture bulk(resp_body_cb), normal(resp_body_cb), urgent(resp_body_cb);
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "POST", "/post", resp_capture_cb, &bulk);
+    CHECK(tlsuv_http_req_priority(req, TLSUV_HTTP_PRIO_BULK) == 0);
+    tlsuv_http_req(&clt, "GET", "/json", resp_capture_cb, &normal);
+    req = tlsuv_http_req(&clt, "GET", "/anything/heartbeat", resp_capture_cb, &urgent);
+    CHECK(tlsuv_http_req_priority(req, TLSUV_HTTP_PRIO_URGENT) == 0);
+
+    // urgent request jumps ahead, bulk one goes last
+    std::vector<void*> order;
+    STAILQ_FOREACH(req, &clt.requests, _next) {
+        order.push_back(req->data);
+    }
+    CHECK(order == std::vector<void*>{&urgent, &normal, &bulk});
+
+    test.run();
+    CHECK(urgent.code == HTTP_STATUS_OK);
+    CHECK(normal.code == HTTP_STATUS_OK);
+    CHECK(bulk.code == HTTP_STATUS_OK);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP expect continue", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    CHECK(tlsuv_http_expect_continue(&clt, 1, 2000) == 0);
+
+    string body("this is a test message");
+    resp_capture resp(resp_body_cb);
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "POST", "/post", resp_capture_cb, &resp);
+    tlsuv_http_req_data(req, body.c_str(), body.length(), req_body_cb);
+    test.run();
+
+    CHECK(resp.code == HTTP_STATUS_OK);
+    CHECK_THAT(resp.body, Contains(body));
+
+    // rejected upload is not sent
+    resp_capture denied(resp_body_cb);
+    req = tlsuv_http_req(&clt, "POST", "/status/401", resp_capture_cb, &denied);
+    tlsuv_http_req_data(req, body.c_str(), body.length(), req_body_cb);
+    test.run();
+
+    CHECK(denied.code == HTTP_STATUS_UNAUTHORIZED);
+    CHECK(denied.req_body_cb_called);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP pipelining", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    tlsuv_http_pipelining(&clt, 4);
+
+    resp_capture resp1(resp_body_cb), resp2(resp_body_cb), resp3(resp_body_cb);
+    tlsuv_http_req(&clt, "GET", "/json", resp_capture_cb, &resp1);
+    tlsuv_http_req(&clt, "GET", "/anything/2", resp_capture_cb, &resp2);
+    tlsuv_http_req(&clt, "GET", "/anything/3", resp_capture_cb, &resp3);
+
+    test.run();
+
+    CHECK(resp1.code == HTTP_STATUS_OK);
+    CHECK(resp2.code == HTTP_STATUS_OK);
+    CHECK(resp3.code == HTTP_STATUS_OK);
+    // responses are matched to requests in order
+    CHECK_THAT(resp2.body, Contains("/anything/2"));
+    CHECK_THAT(resp3.body, Contains("/anything/3"));
+    CHECK(clt.conn_count == 1);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+TEST_CASE("HTTP/2 multiplexing", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    if (tlsuv_http_set_http2(&clt, true) == UV_ENOTSUP) {
+        tlsuv_http_close(&clt, nullptr);
+        test.run();
+        WARN("built without HTTP/2 support");
+        return;
+    }
+    tlsuv_http_max_connections(&clt, 4);
+
+    resp_capture resp1(resp_body_cb), resp2(resp_body_cb), resp3(resp_body_cb);
+    tlsuv_http_req(&clt, "GET", "/delay/1", resp_capture_cb, &resp1);
+    tlsuv_http_req(&clt, "GET", "/anything/2", resp_capture_cb, &resp2);
+    auto post = tlsuv_http_req(&clt, "POST", "/anything/3", resp_capture_cb, &resp3);
+    tlsuv_http_req_data(post, "hello", 5, nullptr);
+
+    test.run();
+
+    CHECK(resp1.code == HTTP_STATUS_OK);
+    CHECK(resp2.code == HTTP_STATUS_OK);
+    CHECK(resp3.code == HTTP_STATUS_OK);
+    CHECK_THAT(resp1.http_version, Equals("2"));
+    CHECK_THAT(resp2.body, Contains("/anything/2"));
+    CHECK_THAT(resp3.body, Contains("hello"));
+    // all requests shared one connection
+    CHECK(clt.conn_count == 1);
+
+    tlsuv_http_close(&clt, nullptr);
+}
+
+// in-process proxy: answers CONNECT (or SOCKS5 request) itself and then serves fixed HTTP response in the tunnel
+struct fake_proxy {
+    uv_tcp_t srv;
+    uv_timer_t done;
+    uv_timer_t again;
+    bool socks;
+    // tunnel requests to reject with 407 before accepting
+    int reject;
+    int accepted;
+    string target;
+    // Proxy-Authorization value from CONNECT, or user:pass from SOCKS5 sub-negotiation
+    string auth;
+    // version byte of SOCKS5 username/password reply
+    char auth_version;
+    void *next;
+};
+
+struct fake_proxy_conn {
+    uv_tcp_t h;
+    fake_proxy *proxy;
+    string in;
+    bool tunnel;
+};
+
+static void fake_proxy_write(fake_proxy_conn *pc, const string &data) {
+    auto req = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t) + data.size()));
+    auto buf = reinterpret_cast<char *>(req + 1);
+    memcpy(buf, data.data(), data.size());
+    uv_buf_t b = uv_buf_init(buf, (unsigned int) data.size());
+    uv_write(req, (uv_stream_t *) &pc->h, &b, 1, [](uv_write_t *r, int) { free(r); });
+}
+
+static void fake_proxy_process(fake_proxy_conn *pc) {
+    auto p = pc->proxy;
+    if (pc->tunnel) {
+        if (pc->in.find("\r\n\r\n") != string::npos) {
+            pc->in.clear();
+            fake_proxy_write(pc, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nproxy");
+        }
+        return;
+    }
+
+    if (p->socks) {
+        auto &in = pc->in;
+        auto at = [&in](size_t i) { return (size_t) (unsigned char) in[i]; };
+        if (in.size() < 3 || in.size() < 2 + at(1)) return;
+        size_t req = 2 + at(1);
+        string reply("\x05\x00", 2);
+        if (in[2] == 2) {
+            // RFC 1929 username/password
+            if (in.size() < req + 2 || in.size() < req + 3 + at(req + 1)) return;
+            size_t ulen = at(req + 1);
+            size_t plen = at(req + 2 + ulen);
+            if (in.size() < req + 3 + ulen + plen) return;
+            p->auth = in.substr(req + 2, ulen) + ":" + in.substr(req + 3 + ulen, plen);
+            reply = string("\x05\x02", 2) + p->auth_version + '\0';
+            req += 3 + ulen + plen;
+        }
+        if (in.size() < req + 5) return;
+        size_t host_len = at(req + 4);
+        if (in.size() < req + 5 + host_len + 2) return;
+        auto port = at(req + 5 + host_len) << 8 | at(req + 5 + host_len + 1);
+        p->target = in.substr(req + 5, host_len) + ":" + std::to_string(port);
+        in.clear();
+        pc->tunnel = true;
+        fake_proxy_write(pc, reply + string("\x05\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10));
+        return;
+    }
+
+    auto end = pc->in.find("\r\n\r\n");
+    if (end == string::npos) return;
+    auto head = pc->in.substr(0, end + 2);
+    pc->in.erase(0, end + 4);
+    auto line = head.substr(0, head.find("\r\n"));
+    p->target = line.substr(8, line.find(" HTTP/") - 8);
+    auto auth_hdr = string("\r\nProxy-Authorization: Basic ");
+    auto auth = head.find(auth_hdr);
+    if (auth != string::npos) {
+        auth += auth_hdr.size();
+        p->auth = head.substr(auth, head.find("\r\n", auth) - auth);
+    }
+    if (p->reject > 0) {
+        p->reject--;
+        fake_proxy_write(pc, "HTTP/1.1 407 Proxy Authentication Required\r\nContent-Length: 4\r\n\r\ndeny");
+    } else {
+        pc->tunnel = true;
+        fake_proxy_write(pc, "HTTP/1.1 200 Connection established\r\n\r\n");
+    }
+}
+
+static void fake_proxy_on_conn(uv_stream_t *s, int status) {
+    auto p = static_cast<fake_proxy *>(s->data);
+    auto pc = new fake_proxy_conn{};
+    pc->proxy = p;
+    pc->h.data = pc;
+    uv_tcp_init(s->loop, &pc->h);
+    REQUIRE(uv_accept(s, (uv_stream_t *) &pc->h) == 0);
+    p->accepted++;
+
+    uv_read_start((uv_stream_t *) &pc->h,
+                  [](uv_handle_t *, size_t len, uv_buf_t *b) {
+                      b->base = static_cast<char *>(malloc(len));
+                      b->len = len;
+                  },
+                  [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+                      auto pc = static_cast<fake_proxy_conn *>(h->data);
+                      if (nread > 0) {
+                          pc->in.append(b->base, nread);
+                          fake_proxy_process(pc);
+                      } else if (nread < 0) {
+                          uv_close((uv_handle_t *) h, [](uv_handle_t *h) {
+                              delete static_cast<fake_proxy_conn *>(h->data);
+                          });
+                      }
+                      free(b->base);
+                  });
+}
+
+static void proxy_body_cb(tlsuv_http_req_t *req, const char *chunk, ssize_t len) {
+    resp_body_cb(req, chunk, len);
+    if (len == UV_EOF) {
+        // client and proxy are closed outside of response processing
+        auto p = static_cast<fake_proxy *>(req->client->data);
+        p->done.data = req->client;
+        uv_timer_start(&p->done, [](uv_timer_t *t) {
+            auto p = static_cast<fake_proxy *>(t->loop->data);
+            tlsuv_http_close(static_cast<tlsuv_http_t *>(t->data), nullptr);
+            uv_close((uv_handle_t *) &p->srv, nullptr);
+            uv_close((uv_handle_t *) t, nullptr);
+        }, 0, 0);
+    }
+}
+
+TEST_CASE("HTTP proxy source", "[http]") {
+    UvLoopTest test;
+
+    fake_proxy fp{};
+    fp.srv.data = &fp;
+    test.loop->data = &fp;
+    uv_timer_init(test.loop, &fp.done);
+    uv_timer_init(test.loop, &fp.again);
+    struct sockaddr_in addr{};
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    uv_tcp_init(test.loop, &fp.srv);
+    REQUIRE(uv_tcp_bind(&fp.srv, (const struct sockaddr *) &addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &fp.srv, 8, fake_proxy_on_conn) == 0);
+    int addr_len = sizeof(addr);
+    uv_tcp_getsockname(&fp.srv, (struct sockaddr *) &addr, &addr_len);
+    auto port = std::to_string(ntohs(addr.sin_port));
+
+    tlsuv_proxy_t *proxy = nullptr;
+    string expected_target = "example.com:8080";
+    string expected_auth;
+    WHEN("HTTP CONNECT") {
+        proxy = tlsuv_proxy_new(test.loop, tlsuv_PROXY_HTTP, "127.0.0.1", port.c_str());
+    }
+    WHEN("HTTP CONNECT with long credentials") {
+        proxy = tlsuv_proxy_new(test.loop, tlsuv_PROXY_HTTP, "127.0.0.1", port.c_str());
+        // encoded credentials are well over any fixed header buffer
+        expected_auth = string(400, 'u') + ":" + string(400, 'p');
+        REQUIRE(tlsuv_proxy_auth(proxy, string(400, 'u').c_str(), string(400, 'p').c_str()) == 0);
+    }
+    WHEN("SOCKS5") {
+        fp.socks = true;
+        proxy = tlsuv_proxy_new(test.loop, tlsuv_PROXY_SOCKS5, "127.0.0.1", port.c_str());
+    }
+    WHEN("SOCKS5 with credentials") {
+        fp.socks = true;
+        fp.auth_version = 1;
+        expected_auth = "user:secret";
+        proxy = tlsuv_proxy_new(test.loop, tlsuv_PROXY_SOCKS5, "127.0.0.1", port.c_str());
+        REQUIRE(tlsuv_proxy_auth(proxy, "user", "secret") == 0);
+    }
+    WHEN("rejected CONNECT keeps proxy connection") {
+        fp.reject = 1;
+        proxy = tlsuv_proxy_new(test.loop, tlsuv_PROXY_HTTP, "127.0.0.1", port.c_str());
+    }
+    REQUIRE(proxy != nullptr);
+
+    proxy_src_t src;
+    REQUIRE(proxy_src_init(test.loop, &src, proxy) == 0);
+
+    tlsuv_http_t clt;
+    REQUIRE(tlsuv_http_init_with_src(test.loop, &clt, "http://example.com:8080", (tlsuv_src_t *) &src) == 0);
+    clt.data = &fp;
+
+    resp_capture rejected(resp_body_cb);
+    resp_capture resp(proxy_body_cb);
+    fp.next = &resp;
+    bool rejecting = fp.reject > 0;
+    if (rejecting) {
+        // failed connect fails queued requests too, next request is sent after this one fails
+        tlsuv_http_req(&clt, "GET", "/", [](tlsuv_http_resp_t *r, void *data) {
+            resp_capture_cb(r, data);
+            auto p = static_cast<fake_proxy *>(r->req->client->data);
+            p->again.data = r->req->client;
+            uv_timer_start(&p->again, [](uv_timer_t *t) {
+                auto p = static_cast<fake_proxy *>(t->loop->data);
+                tlsuv_http_req(static_cast<tlsuv_http_t *>(t->data), "GET", "/", resp_capture_cb, p->next);
+                uv_close((uv_handle_t *) t, nullptr);
+            }, 0, 0);
+        }, &rejected);
+    } else {
+        uv_close((uv_handle_t *) &fp.again, nullptr);
+        tlsuv_http_req(&clt, "GET", "/", resp_capture_cb, &resp);
+    }
+    test.run();
+
+    CHECK(fp.target == expected_target);
+    CHECK(resp.code == HTTP_STATUS_OK);
+    CHECK(resp.body == "proxy");
+    if (fp.socks) {
+        CHECK(fp.auth == expected_auth);
+    } else if (!expected_auth.empty()) {
+        string decoded(tlsuv_base64_decoded_len(fp.auth.size()), '\0');
+        size_t decoded_len = decoded.size();
+        REQUIRE(tlsuv_base64_decode(fp.auth.data(), fp.auth.size(), &decoded[0], &decoded_len, 0) == 0);
+        decoded.resize(decoded_len);
+        CHECK(decoded == expected_auth);
+    }
+
+    tlsuv_proxy_stats stats{};
+    tlsuv_proxy_get_stats(proxy, &stats);
+    CHECK(stats.tunnels == 1);
+    CHECK(stats.connects == 1);
+    CHECK(fp.accepted == 1);
+    if (!rejecting) {
+        CHECK(stats.reused == 0);
+    } else {
+        CHECK(rejected.code == UV_EACCES);
+        CHECK(stats.failures == 1);
+        CHECK(stats.reused == 1);
+    }
+
+    proxy_src_free(&src);
+    tlsuv_proxy_free(proxy);
+}
+
+TEST_CASE("SOCKS5 proxy rejects bad auth reply version", "[http]") {
+    UvLoopTest test;
+
+    fake_proxy fp{};
+    fp.srv.data = &fp;
+    fp.socks = true;
+    // RFC 1929 reply must carry version 1
+    fp.auth_version = 5;
+    test.loop->data = &fp;
+    uv_timer_init(test.loop, &fp.done);
+    struct sockaddr_in addr{};
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    uv_tcp_init(test.loop, &fp.srv);
+    REQUIRE(uv_tcp_bind(&fp.srv, (const struct sockaddr *) &addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &fp.srv, 8, fake_proxy_on_conn) == 0);
+    int addr_len = sizeof(addr);
+    uv_tcp_getsockname(&fp.srv, (struct sockaddr *) &addr, &addr_len);
+    auto port = std::to_string(ntohs(addr.sin_port));
+
+    tlsuv_proxy_t *proxy = tlsuv_proxy_new(test.loop, tlsuv_PROXY_SOCKS5, "127.0.0.1", port.c_str());
+    REQUIRE(tlsuv_proxy_auth(proxy, "user", "secret") == 0);
+    proxy_src_t src;
+    REQUIRE(proxy_src_init(test.loop, &src, proxy) == 0);
+
+    tlsuv_http_t clt;
+    REQUIRE(tlsuv_http_init_with_src(test.loop, &clt, "http://example.com:8080", (tlsuv_src_t *) &src) == 0);
+    clt.data = &fp;
+
+    resp_capture resp(resp_body_cb);
+    tlsuv_http_req(&clt, "GET", "/", [](tlsuv_http_resp_t *r, void *data) {
+        resp_capture_cb(r, data);
+        auto p = static_cast<fake_proxy *>(r->req->client->data);
+        p->done.data = r->req->client;
+        uv_timer_start(&p->done, [](uv_timer_t *t) {
+            auto p = static_cast<fake_proxy *>(t->loop->data);
+            tlsuv_http_close(static_cast<tlsuv_http_t *>(t->data), nullptr);
+            uv_close((uv_handle_t *) &p->srv, nullptr);
+            uv_close((uv_handle_t *) t, nullptr);
+        }, 0, 0);
+    }, &resp);
+    test.run();
+
+    CHECK(fp.auth == "user:secret");
+    CHECK(resp.code == UV_EPROTO);
+
+    tlsuv_proxy_stats stats{};
+    tlsuv_proxy_get_stats(proxy, &stats);
+    CHECK(stats.tunnels == 0);
+    CHECK(stats.failures == 1);
+
+    proxy_src_free(&src);
+    tlsuv_proxy_free(proxy);
+}
+
+// local socket server answering every HTTP request with fixed response, keeping connection open
+struct pipe_server {
+    char path[128];
+    uv_pipe_t srv;
+    uv_timer_t done;
+    int accepted;
+    std::vector<string> requests;
+    // chunked request bodies, without last chunk
+    std::vector<string> bodies;
+    // requests client sends after the first one, each when previous response is complete
+    int more;
+    resp_capture *resp;
+};
+
+struct pipe_server_conn {
+    uv_pipe_t h;
+    pipe_server *server;
+    string in;
+};
+
+static void pipe_server_on_conn(uv_stream_t *s, int status) {
+    auto ps = static_cast<pipe_server *>(s->data);
+    auto pc = new pipe_server_conn{};
+    pc->server = ps;
+    pc->h.data = pc;
+    uv_pipe_init(s->loop, &pc->h, 0);
+    REQUIRE(uv_accept(s, (uv_stream_t *) &pc->h) == 0);
+    ps->accepted++;
+
+    uv_read_start((uv_stream_t *) &pc->h,
+                  [](uv_handle_t *, size_t len, uv_buf_t *b) {
+                      b->base = static_cast<char *>(malloc(len));
+                      b->len = len;
+                  },
+                  [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+                      auto pc = static_cast<pipe_server_conn *>(h->data);
+                      if (nread > 0) {
+                          pc->in.append(b->base, nread);
+                          size_t end;
+                          while ((end = pc->in.find("\r\n\r\n")) != string::npos) {
+                              string head = pc->in.substr(0, end);
+                              size_t consumed = end + 4;
+                              if (head.find("Transfer-Encoding: chunked") != string::npos) {
+                                  // wait for last chunk
+                                  size_t last = pc->in.find("\r\n0\r\n\r\n", end + 2);
+                                  if (last == string::npos) break;
+                                  pc->server->bodies.push_back(pc->in.substr(end + 4, last + 2 - (end + 4)));
+                                  consumed = last + 7;
+                              }
+                              pc->server->requests.push_back(head);
+                              pc->in.erase(0, consumed);
+                              static char resp[] = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\npipe";
+                              auto req = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+                              uv_buf_t buf = uv_buf_init(resp, sizeof(resp) - 1);
+                              uv_write(req, h, &buf, 1, [](uv_write_t *r, int) { free(r); });
+                          }
+                      } else if (nread < 0) {
+                          uv_close((uv_handle_t *) h, [](uv_handle_t *h) {
+                              delete static_cast<pipe_server_conn *>(h->data);
+                          });
+                      }
+                      free(b->base);
+                  });
+}
+
+static void pipe_server_start(uv_loop_t *loop, pipe_server *ps) {
+#if _WIN32
+    snprintf(ps->path, sizeof(ps->path), "\\\\.\\pipe\\tlsuv-test-%d", (int) uv_os_getpid());
+#else
+    snprintf(ps->path, sizeof(ps->path), "/tmp/tlsuv-test-%d.sock", (int) uv_os_getpid());
+    uv_fs_t unlink_req;
+    uv_fs_unlink(nullptr, &unlink_req, ps->path, nullptr);
+    uv_fs_req_cleanup(&unlink_req);
+#endif
+
+    ps->srv.data = ps;
+    loop->data = ps;
+    uv_timer_init(loop, &ps->done);
+    uv_pipe_init(loop, &ps->srv, 0);
+    REQUIRE(uv_pipe_bind(&ps->srv, ps->path) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &ps->srv, 8, pipe_server_on_conn) == 0);
+}
+
+static void pipe_server_cleanup(pipe_server *ps) {
+#if !_WIN32
+    uv_fs_t unlink_req;
+    uv_fs_unlink(nullptr, &unlink_req, ps->path, nullptr);
+    uv_fs_req_cleanup(&unlink_req);
+#endif
+}
+
+// sends next request once response is complete, or closes client and server, outside of response processing
+static void pipe_body_cb(tlsuv_http_req_t *req, const char *chunk, ssize_t len) {
+    resp_body_cb(req, chunk, len);
+    if (len != UV_EOF) {
+        return;
+    }
+
+    auto ps = static_cast<pipe_server *>(req->client->data);
+    ps->done.data = req->client;
+    uv_timer_start(&ps->done, [](uv_timer_t *t) {
+        auto ps = static_cast<pipe_server *>(t->loop->data);
+        auto clt = static_cast<tlsuv_http_t *>(t->data);
+        if (ps->more > 0) {
+            ps->more--;
+            tlsuv_http_req(clt, "GET", "/status", resp_capture_cb, ps->resp);
+            return;
+        }
+        tlsuv_http_close(clt, nullptr);
+        uv_close((uv_handle_t *) &ps->srv, nullptr);
+        uv_close((uv_handle_t *) t, nullptr);
+    }, 0, 0);
+}
+
+TEST_CASE("HTTP over local socket", "[http]") {
+    UvLoopTest test;
+
+    pipe_server ps{};
+    pipe_server_start(test.loop, &ps);
+
+    pipe_src_t src;
+    REQUIRE(pipe_src_init(test.loop, &src, ps.path) == 0);
+
+    tlsuv_http_t clt;
+    REQUIRE(tlsuv_http_init_with_src(test.loop, &clt, "http://local.test", (tlsuv_src_t *) &src) == 0);
+    clt.data = &ps;
+
+    resp_capture resp(pipe_body_cb);
+    tlsuv_http_req(&clt, "GET", "/status", resp_capture_cb, &resp);
+    test.run();
+
+    CHECK(ps.accepted == 1);
+    REQUIRE(ps.requests.size() == 1);
+    CHECK_THAT(ps.requests[0], Catch::StartsWith("GET /status HTTP/1.1\r\n"));
+    CHECK_THAT(ps.requests[0], Catch::Contains("Host: local.test"));
+    CHECK(resp.code == HTTP_STATUS_OK);
+    CHECK(resp.body == "pipe");
+    CHECK(resp.resp_body_end_called == 1);
+
+    pipe_src_free(&src);
+    pipe_server_cleanup(&ps);
+}
+
+TEST_CASE("HTTP keep-alive connection reuse", "[http]") {
+    UvLoopTest test;
+
+    pipe_server ps{};
+    pipe_server_start(test.loop, &ps);
+
+    pipe_src_t src;
+    REQUIRE(pipe_src_init(test.loop, &src, ps.path) == 0);
+
+    tlsuv_http_t clt;
+    REQUIRE(tlsuv_http_init_with_src(test.loop, &clt, "http://local.test", (tlsuv_src_t *) &src) == 0);
+    clt.data = &ps;
+
+    // second request is sent after first response is complete
+    resp_capture resp(pipe_body_cb);
+    ps.resp = &resp;
+    ps.more = 1;
+    tlsuv_http_req(&clt, "GET", "/status", resp_capture_cb, &resp);
+    test.run();
+
+    CHECK(ps.requests.size() == 2);
+    CHECK(ps.accepted == 1);
+    CHECK(resp.code == HTTP_STATUS_OK);
+    CHECK(resp.resp_body_end_called == 2);
+
+    pipe_src_free(&src);
+    pipe_server_cleanup(&ps);
+}
+
+TEST_CASE("HTTP chunked request body", "[http]") {
+    UvLoopTest test;
+
+    pipe_server ps{};
+    pipe_server_start(test.loop, &ps);
+
+    pipe_src_t src;
+    REQUIRE(pipe_src_init(test.loop, &src, ps.path) == 0);
+
+    tlsuv_http_t clt;
+    REQUIRE(tlsuv_http_init_with_src(test.loop, &clt, "http://local.test", (tlsuv_src_t *) &src) == 0);
+    clt.data = &ps;
+
+    resp_capture resp(pipe_body_cb);
+    tlsuv_http_req_t *req = tlsuv_http_req(&clt, "POST", "/upload", resp_capture_cb, &resp);
+    REQUIRE(tlsuv_http_req_header(req, "Transfer-Encoding", "chunked") == 0);
+
+    // more chunks than single write takes
+    std::vector<string> chunks;
+    for (int i = 0; i < 40; i++) {
+        chunks.push_back("line " + std::to_string(i) + string(i % 7, '.') + "\n");
+    }
+
+    static struct {
+        std::vector<int> codes;
+        std::vector<const char *> order;
+    } progress;
+    progress.codes.clear();
+    progress.order.clear();
+    for (auto &c: chunks) {
+        tlsuv_http_req_data(req, c.data(), c.size(), [](tlsuv_http_req_t *, const char *chunk, ssize_t status) {
+            progress.codes.push_back((int) status);
+            progress.order.push_back(chunk);
+        });
+    }
+    tlsuv_http_req_end(req);
+    test.run();
+
+    CHECK(resp.code == HTTP_STATUS_OK);
+    CHECK(resp.body == "pipe");
+    REQUIRE(ps.requests.size() == 1);
+    CHECK_THAT(ps.requests[0], Catch::StartsWith("POST /upload HTTP/1.1\r\n"));
+    CHECK_THAT(ps.requests[0], !Catch::Contains("Content-Length"));
+
+    string expected;
+    for (auto &c: chunks) {
+        char size[20];
+        snprintf(size, sizeof(size), "%zx\r\n", c.size());
+        expected += size + c + "\r\n";
+    }
+    REQUIRE(ps.bodies.size() == 1);
+    CHECK(ps.bodies[0] == expected);
+
+    THEN("chunk callbacks are called in order") {
+        REQUIRE(progress.order.size() == chunks.size());
+        for (size_t i = 0; i < chunks.size(); i++) {
+            CHECK(progress.order[i] == chunks[i].data());
+            CHECK(progress.codes[i] == 0);
+        }
+    }
+
+    pipe_src_free(&src);
+    pipe_server_cleanup(&ps);
+}
+
+static int count_handles(uv_loop_t *loop, uv_handle_type type) {
+    std::pair<uv_handle_type, int> count{type, 0};
+    uv_walk(loop, [](uv_handle_t *h, void *arg) {
+        auto c = static_cast<std::pair<uv_handle_type, int> *>(arg);
+        if (h->type == c->first && !uv_is_closing(h)) c->second++;
+    }, &count);
+    return count.second;
+}
+
+struct sched_test {
+    uv_loop_t *loop;
+    pipe_server *ps;
+    std::vector<tlsuv_http_t> clients;
+    int expected;
+    int ok;
+    int done;
+};
+
+static void sched_test_done(sched_test *t) {
+    if (++t->done < t->expected) {
+        return;
+    }
+    t->ps->done.data = t;
+    uv_timer_start(&t->ps->done, [](uv_timer_t *h) {
+        auto t = static_cast<sched_test *>(h->data);
+        for (auto &c: t->clients) {
+            tlsuv_http_close(&c, nullptr);
+        }
+        uv_close((uv_handle_t *) &t->ps->srv, nullptr);
+        uv_close((uv_handle_t *) h, nullptr);
+    }, 0, 0);
+}
+
+static void sched_submit_worker(void *arg) {
+    auto t = static_cast<sched_test *>(arg);
+    for (int i = 4; i < 8; i++) {
+        tlsuv_http_submit_t sub = {};
+        sub.method = "GET";
+        sub.path = "/remote";
+        sub.cb = [](tlsuv_http_result_t *res) {
+            auto t = static_cast<sched_test *>(res->ctx);
+            if (res->code == HTTP_STATUS_OK) t->ok++;
+            tlsuv_http_result_free(res);
+            sched_test_done(t);
+        };
+        sub.ctx = t;
+        CHECK(tlsuv_http_req_submit(&t->clients[i], &sub) == 0);
+    }
+}
+
+TEST_CASE("HTTP clients share loop scheduler", "[http]") {
+    UvLoopTest test;
+
+    pipe_server ps{};
+    pipe_server_start(test.loop, &ps);
+
+    int checks = count_handles(test.loop, UV_CHECK);
+    int idles = count_handles(test.loop, UV_IDLE);
+    int asyncs = count_handles(test.loop, UV_ASYNC);
+
+    sched_test t{test.loop, &ps, std::vector<tlsuv_http_t>(64), 8, 0, 0};
+    // first clients connect to local server, the rest stay idle
+    std::vector<pipe_src_t> srcs(8);
+    for (size_t i = 0; i < t.clients.size(); i++) {
+        tlsuv_http_t *clt = &t.clients[i];
+        if (i < srcs.size()) {
+            REQUIRE(pipe_src_init(test.loop, &srcs[i], ps.path) == 0);
+            REQUIRE(tlsuv_http_init_with_src(test.loop, clt, "http://local.test", (tlsuv_src_t *) &srcs[i]) == 0);
+        } else {
+            REQUIRE(tlsuv_http_init(test.loop, clt, "http://local.test") == 0);
+        }
+        clt->data = &t;
+    }
+
+    THEN("one set of loop handles serves all clients") {
+        CHECK(count_handles(test.loop, UV_CHECK) == checks + 1);
+        CHECK(count_handles(test.loop, UV_IDLE) == idles + 1);
+        CHECK(count_handles(test.loop, UV_ASYNC) == asyncs + 1);
+        for (auto &c: t.clients) {
+            CHECK(c.sched == t.clients[0].sched);
+            CHECK(c.remote != nullptr);
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        tlsuv_http_req(&t.clients[i], "GET", "/local", [](tlsuv_http_resp_t *r, void *) {
+            auto t = static_cast<sched_test *>(r->req->client->data);
+            if (r->code == HTTP_STATUS_OK) t->ok++;
+            r->body_cb = [](tlsuv_http_req_t *req, const char *, ssize_t len) {
+                if (len == UV_EOF) {
+                    sched_test_done(static_cast<sched_test *>(req->client->data));
+                }
+            };
+        }, nullptr);
+        CHECK(t.clients[i].sched_queued);
+    }
+
+    uv_thread_t worker;
+    uv_thread_create(&worker, sched_submit_worker, &t);
+    uv_thread_join(&worker);
+
+    test.run();
+
+    CHECK(t.ok == 8);
+    CHECK(t.done == 8);
+    CHECK(ps.accepted == 8);
+    CHECK(ps.requests.size() == 8);
+
+    THEN("loop handles are released with the last client") {
+        CHECK(count_handles(test.loop, UV_CHECK) == checks);
+        CHECK(count_handles(test.loop, UV_IDLE) == idles);
+        CHECK(count_handles(test.loop, UV_ASYNC) == asyncs);
+    }
+
+    for (auto &src: srcs) {
+        pipe_src_free(&src);
+    }
+    pipe_server_cleanup(&ps);
+}
+
 TEST_CASE("URL encode", "[http]") {
     UvLoopTest test;
 
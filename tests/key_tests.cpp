@@ -13,9 +13,13 @@
 // limitations under the License.
 
 #include "catch.hpp"
+#include "fixtures.h"
 #include "p11.h"
 
+#include <algorithm>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <tlsuv/tls_engine.h>
 
 #define xstr(s) str__(s)
@@ -162,6 +166,106 @@ TEST_CASE("gen csr", "[engine]") {
     free(pem);
 }
 
+struct async_result {
+    int status = 1;
+    int called = 0;
+};
+
+static void async_result_cb(int status, void *data) {
+    auto r = static_cast<async_result *>(data);
+    r->status = status;
+    r->called++;
+}
+
+TEST_CASE("async key gen and csr", "[key]") {
+    UvLoopTest test;
+    tls_context *ctx = default_tls_context(nullptr, 0);
+
+    tlsuv_private_key_t key = nullptr;
+    async_result key_res;
+    REQUIRE(tlsuv_generate_key_async(test.loop, ctx, &key, async_result_cb, &key_res) == 0);
+    // output is only written on completion
+    CHECK(key == nullptr);
+    test.run();
+    CHECK(key_res.called == 1);
+    REQUIRE(key_res.status == 0);
+    REQUIRE(key != nullptr);
+
+    char *pem = nullptr;
+    size_t pemlen = 0;
+    async_result csr_res;
+    REQUIRE(tlsuv_generate_csr_to_pem_async(test.loop, ctx, key, &pem, &pemlen, async_result_cb, &csr_res,
+                                            "C", "US",
+                                            "O", "OpenZiti",
+                                            "CN", "async CSR test",
+                                            NULL) == 0);
+    test.run();
+    CHECK(csr_res.called == 1);
+    REQUIRE(csr_res.status == 0);
+    REQUIRE(pem != nullptr);
+    CHECK_THAT(pem, Catch::Matchers::StartsWith("-----BEGIN CERTIFICATE REQUEST-----"));
+
+    CHECK(tlsuv_generate_csr_to_pem_async(test.loop, ctx, key, &pem, &pemlen, async_result_cb, &csr_res,
+                                          "1", "1", "2", "2", "3", "3", "4", "4", "5", "5",
+                                          "6", "6", "7", "7", "8", "8", "9", "9", NULL) == UV_EINVAL);
+
+    free(pem);
+    key->free(key);
+    ctx->api->free_ctx(ctx);
+}
+
+TEST_CASE("batch signature verify", "[key]") {
+    tls_context *ctx = default_tls_context(nullptr, 0);
+    tlsuv_private_key_t key = nullptr;
+    REQUIRE(ctx->api->generate_key(&key) == 0);
+    auto pub = key->pubkey(key);
+    REQUIRE(pub != nullptr);
+
+    const size_t count = 3 * TLSUV_VERIFY_MIN_CHUNK + 5;
+    std::vector<std::string> msgs(count);
+    std::vector<std::string> sigs(count);
+    std::vector<tlsuv_verify_item> items(count);
+    for (size_t i = 0; i < count; i++) {
+        msgs[i] = "message #" + std::to_string(i);
+        char sig[256];
+        size_t siglen = sizeof(sig);
+        REQUIRE(0 == key->sign(key, hash_SHA256, msgs[i].data(), msgs[i].size(), sig, &siglen));
+        sigs[i].assign(sig, siglen);
+    }
+    for (size_t i = 0; i < count; i++) {
+        items[i] = {msgs[i].data(), msgs[i].size(), sigs[i].data(), sigs[i].size()};
+    }
+
+    std::vector<int> results(count, -1);
+    CHECK(0 == pub->verify_many(pub, hash_SHA256, items.data(), count, results.data()));
+    CHECK(std::count(results.begin(), results.end(), 0) == count);
+
+    std::fill(results.begin(), results.end(), -1);
+    CHECK(0 == tlsuv_pubkey_verify_parallel(pub, hash_SHA256, items.data(), count, results.data(), 4));
+    CHECK(std::count(results.begin(), results.end(), 0) == count);
+
+    // signature of a different message
+    const size_t bad = 2 * TLSUV_VERIFY_MIN_CHUNK + 1;
+    items[bad].sig = sigs[0].data();
+    items[bad].siglen = sigs[0].size();
+    CHECK(-1 == pub->verify_many(pub, hash_SHA256, items.data(), count, results.data()));
+    CHECK(results[bad] == -1);
+    CHECK(std::count(results.begin(), results.end(), 0) == count - 1);
+
+    std::fill(results.begin(), results.end(), 0);
+    CHECK(-1 == tlsuv_pubkey_verify_parallel(pub, hash_SHA256, items.data(), count, results.data(), 4));
+    CHECK(results[bad] == -1);
+    CHECK(std::count(results.begin(), results.end(), 0) == count - 1);
+
+    // wrong digest, then cached template is still usable
+    CHECK(-1 == pub->verify_many(pub, hash_SHA384, items.data(), 1, results.data()));
+    CHECK(0 == pub->verify(pub, hash_SHA256, msgs[1].data(), msgs[1].size(), sigs[1].data(), sigs[1].size()));
+
+    pub->free(pub);
+    key->free(key);
+    ctx->api->free_ctx(ctx);
+}
+
 #if defined(HSM_CONFIG)
 #define HSM_DRIVER xstr(HSM_LIB)
 
@@ -259,6 +363,187 @@ TEST_CASE("pkcs11 valid pkcs#11 key", "[key]") {
     ctx->api->free_ctx(ctx);
 }
 
+struct sign_worker {
+    tlsuv_private_key_t key;
+    const char *data;
+    std::vector<std::string> sigs;
+    int errors;
+};
+
+static void sign_worker_run(void *arg) {
+    auto w = (sign_worker *) arg;
+    for (int i = 0; i < 16; i++) {
+        char sig[512];
+        size_t siglen = sizeof(sig);
+        if (w->key->sign(w->key, hash_SHA256, w->data, strlen(w->data), sig, &siglen) != 0) {
+            w->errors++;
+            continue;
+        }
+        w->sigs.emplace_back(sig, siglen);
+    }
+}
+
+TEST_CASE("pkcs11 concurrent signing", "[key]") {
+    tls_context *ctx = default_tls_context(nullptr, 0);
+    std::string keyType = GENERATE("ec", "rsa");
+    std::string keyLabel = "test-" + keyType;
+
+    tlsuv_private_key_t key = nullptr;
+    REQUIRE(ctx->api->load_pkcs11_key(&key, HSM_DRIVER, nullptr, "2222", nullptr, keyLabel.c_str()) == 0);
+    auto pub = key->pubkey(key);
+    REQUIRE(pub != nullptr);
+
+    const char *data = "signed by many threads at once";
+    sign_worker workers[8];
+    uv_thread_t threads[8];
+    for (int i = 0; i < 8; i++) {
+        workers[i].key = key;
+        workers[i].data = data;
+        workers[i].errors = 0;
+        REQUIRE(uv_thread_create(&threads[i], sign_worker_run, &workers[i]) == 0);
+    }
+    for (auto &t: threads) {
+        uv_thread_join(&t);
+    }
+
+    for (auto &w: workers) {
+        CHECK(w.errors == 0);
+        CHECK(w.sigs.size() == 16);
+        for (auto &sig: w.sigs) {
+            CHECK(pub->verify(pub, hash_SHA256, data, strlen(data), (char *) sig.data(), sig.size()) == 0);
+        }
+    }
+
+    pub->free(pub);
+    key->free(key);
+    ctx->api->free_ctx(ctx);
+}
+
+struct p11_sign_worker {
+    p11_key_ctx *key;
+    int errors;
+};
+
+static void p11_sign_worker_run(void *arg) {
+    auto w = (p11_sign_worker *) arg;
+    uint8_t digest[32];
+    memset(digest, 0x5a, sizeof(digest));
+    for (int i = 0; i < 16; i++) {
+        uint8_t sig[512];
+        size_t siglen = sizeof(sig);
+        if (p11_key_sign(w->key, digest, sizeof(digest), sig, &siglen, 0) != 0) {
+            w->errors++;
+        }
+    }
+}
+
+TEST_CASE("pkcs11 signing session pool", "[key]") {
+    p11_context p11 = {};
+    p11_key_ctx key = {};
+    REQUIRE(p11_init(&p11, HSM_DRIVER, nullptr, "2222") == 0);
+    REQUIRE(p11_load_key(&p11, &key, nullptr, "test-ec") == 0);
+
+    REQUIRE(p11.sign_max > 0);
+    CHECK(p11.sign_open == 0);
+
+    p11_sign_worker workers[8];
+    uv_thread_t threads[8];
+    for (int i = 0; i < 8; i++) {
+        workers[i].key = &key;
+        workers[i].errors = 0;
+        REQUIRE(uv_thread_create(&threads[i], p11_sign_worker_run, &workers[i]) == 0);
+    }
+    for (auto &t: threads) {
+        uv_thread_join(&t);
+    }
+
+    for (auto &w: workers) {
+        CHECK(w.errors == 0);
+    }
+    // sessions are opened on demand, never past the limit, and all returned to the pool
+    CHECK(p11.sign_open > 0);
+    CHECK(p11.sign_open <= p11.sign_max);
+    CHECK(p11.sign_idle_count == p11.sign_open);
+}
+
+TEST_CASE("pkcs11 key attribute cache", "[key]") {
+    p11_context p11 = {};
+    p11_key_ctx key = {};
+    REQUIRE(p11_init(&p11, HSM_DRIVER, nullptr, "2222") == 0);
+    REQUIRE(p11_load_key(&p11, &key, nullptr, "test-ec") == 0);
+
+    // public key parameters are fetched once at load
+    REQUIRE(key.pub_attrs_count == 2);
+    char *point = nullptr;
+    size_t point_len = 0;
+    REQUIRE(p11_get_key_attr(&key, CKA_EC_POINT, &point, &point_len) == 0);
+    std::string cached_point(point, point_len);
+    free(point);
+
+    CHECK(key.cert_loaded);
+    char *cert = nullptr;
+    size_t cert_len = 0;
+    REQUIRE(p11_get_key_cert(&key, &cert, &cert_len) == 0);
+    std::string cached_cert(cert, cert_len);
+    free(cert);
+
+    WHEN("refreshed") {
+        REQUIRE(p11_key_refresh(&key) == 0);
+        THEN("cache is reloaded from token") {
+            CHECK(key.pub_attrs_count == 2);
+            CHECK(key.cert_loaded);
+
+            REQUIRE(p11_get_key_attr(&key, CKA_EC_POINT, &point, &point_len) == 0);
+            CHECK(std::string(point, point_len) == cached_point);
+            free(point);
+
+            REQUIRE(p11_get_key_cert(&key, &cert, &cert_len) == 0);
+            CHECK(std::string(cert, cert_len) == cached_cert);
+            free(cert);
+        }
+    }
+
+    WHEN("attribute is not cached") {
+        char *label = nullptr;
+        size_t label_len = 0;
+        THEN("it is fetched from token") {
+            REQUIRE(p11_get_key_attr(&key, CKA_LABEL, &label, &label_len) == 0);
+            CHECK(std::string(label, label_len) == "test-ec");
+            free(label);
+        }
+    }
+}
+
+TEST_CASE("pkcs11 key refresh", "[key]") {
+    tls_context *ctx = default_tls_context(nullptr, 0);
+    tlsuv_private_key_t key = nullptr;
+    REQUIRE(ctx->api->load_pkcs11_key(&key, HSM_DRIVER, nullptr, "2222", nullptr, "test-ec") == 0);
+    REQUIRE(key->refresh != nullptr);
+
+    auto pub = key->pubkey(key);
+    char *pem = nullptr;
+    size_t pemlen = 0;
+    REQUIRE(pub->to_pem(pub, &pem, &pemlen) == 0);
+    std::string before(pem, pemlen);
+    free(pem);
+    pub->free(pub);
+
+    CHECK(key->refresh(key) == 0);
+
+    pub = key->pubkey(key);
+    REQUIRE(pub->to_pem(pub, &pem, &pemlen) == 0);
+    CHECK(std::string(pem, pemlen) == before);
+    free(pem);
+    pub->free(pub);
+
+    tls_cert cert = nullptr;
+    CHECK(key->get_certificate(key, &cert) == 0);
+    ctx->api->free_cert(&cert);
+
+    key->free(key);
+    ctx->api->free_ctx(ctx);
+}
+
 TEST_CASE("gen-pkcs11-key-internals", "[key]") {
     p11_context p11;
     p11_key_ctx key;
@@ -14,13 +14,36 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <atomic>
 #include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <tlsuv/tcp_src.h>
 #include <tlsuv/tlsuv.h>
 #include <uv.h>
 
 #include "fixtures.h"
 #include "catch.hpp"
 
+#include "alloc.h"
+#include "dns_cache.h"
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#endif
+
+extern tlsuv_log_func test_log;
+// um_debug.h conflicts with Catch macros
+extern "C" int um_log_level;
+extern "C" void um_log(int lvl, const char *file, unsigned int line, const char *fmt, ...);
+#define LOG_TRACE(fmt, ...) um_log(6, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+
 TEST_CASE("uv-mbed connect fail", "[uv-mbed]") {
     UvLoopTest test;
 
@@ -109,6 +132,199 @@ static void test_alloc(uv_handle_t *s, size_t req, uv_buf_t* b) {
     b->len = req;
 }
 
+TEST_CASE("connection attempt race", "[uv-mbed]") {
+    UvLoopTest test;
+
+    struct race_ctx {
+        // never accepts: libuv holds the first connection, the second takes the only queue slot,
+        // so further SYNs are dropped
+        uv_tcp_t blackhole;
+        bool held;
+        uv_tcp_t filler[2];
+        int filled;
+        uv_tcp_t server;
+        uv_tcp_t peer;
+        int accepted;
+
+        tcp_src_t src;
+        uint64_t start;
+        uint64_t elapsed;
+        int status;
+        int stray;
+        struct sockaddr_in connected;
+    } ctx{};
+    ctx.status = 1;
+
+    struct sockaddr_in hole_addr, srv_addr;
+    uv_ip4_addr("127.0.0.1", 0, &hole_addr);
+    uv_ip4_addr("127.0.0.1", 0, &srv_addr);
+    int len = sizeof(hole_addr);
+
+    uv_tcp_init(test.loop, &ctx.blackhole);
+    ctx.blackhole.data = &ctx;
+    REQUIRE(uv_tcp_bind(&ctx.blackhole, (const sockaddr *) &hole_addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &ctx.blackhole, 0, [](uv_stream_t *s, int) {
+        ((race_ctx *) s->data)->held = true;
+    }) == 0);
+    REQUIRE(uv_tcp_getsockname(&ctx.blackhole, (sockaddr *) &hole_addr, &len) == 0);
+
+    for (auto &f : ctx.filler) {
+        uv_tcp_init(test.loop, &f);
+        f.data = &ctx;
+        auto req = t_alloc<uv_connect_t>();
+        REQUIRE(uv_tcp_connect(req, &f, (const sockaddr *) &hole_addr, [](uv_connect_t *r, int status) {
+            auto ctx = (race_ctx *) r->handle->data;
+            if (status == 0) ctx->filled++;
+            free(r);
+        }) == 0);
+        // second connection has to wait until the first one leaves the queue
+        int filled = ctx.filled + 1;
+        while ((ctx.filled < filled || !ctx.held) && uv_run(test.loop, UV_RUN_ONCE) != 0);
+    }
+    REQUIRE(ctx.held);
+    REQUIRE(ctx.filled == 2);
+
+    uv_tcp_init(test.loop, &ctx.server);
+    ctx.server.data = &ctx;
+    REQUIRE(uv_tcp_bind(&ctx.server, (const sockaddr *) &srv_addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &ctx.server, 8, [](uv_stream_t *s, int status) {
+        auto ctx = (race_ctx *) s->data;
+        uv_tcp_init(s->loop, &ctx->peer);
+        if (uv_accept(s, (uv_stream_t *) &ctx->peer) == 0) {
+            ctx->accepted++;
+        }
+    }) == 0);
+    len = sizeof(srv_addr);
+    REQUIRE(uv_tcp_getsockname(&ctx.server, (sockaddr *) &srv_addr, &len) == 0);
+
+    // unreachable address first
+    struct addrinfo ai[2] = {};
+    ai[0].ai_family = AF_INET;
+    ai[0].ai_socktype = SOCK_STREAM;
+    ai[0].ai_addr = (sockaddr *) &hole_addr;
+    ai[0].ai_addrlen = sizeof(hole_addr);
+    ai[0].ai_next = &ai[1];
+    ai[1] = ai[0];
+    ai[1].ai_addr = (sockaddr *) &srv_addr;
+    ai[1].ai_next = nullptr;
+
+    tcp_src_init(test.loop, &ctx.src);
+    REQUIRE(tcp_src_set_addr(&ctx.src, ai) == 0);
+    REQUIRE(tcp_src_attempt_delay(&ctx.src, 100) == 0);
+
+    ctx.start = uv_hrtime();
+    REQUIRE(ctx.src.connect((tlsuv_src_t *) &ctx.src, "localhost", "0", [](tlsuv_src_t *sl, int status, void *data) {
+        auto ctx = (race_ctx *) data;
+        ctx->status = status;
+        ctx->elapsed = (uv_hrtime() - ctx->start) / 1000000;
+        if (status == 0) {
+            int len = sizeof(ctx->connected);
+            uv_tcp_getpeername(ctx->src.conn, (sockaddr *) &ctx->connected, &len);
+        }
+
+        // losing attempt is closed with the race
+        uv_walk(sl->loop, [](uv_handle_t *h, void *arg) {
+            auto ctx = (race_ctx *) arg;
+            if (h->type == UV_TCP && !uv_is_closing(h) &&
+                h != (uv_handle_t *) &ctx->blackhole &&
+                h != (uv_handle_t *) &ctx->filler[0] && h != (uv_handle_t *) &ctx->filler[1] &&
+                h != (uv_handle_t *) &ctx->server && h != (uv_handle_t *) &ctx->peer &&
+                h != (uv_handle_t *) ctx->src.conn) {
+                ctx->stray++;
+            }
+        }, ctx);
+
+        ctx->src.release(sl);
+        uv_close((uv_handle_t *) &ctx->blackhole, nullptr);
+        uv_close((uv_handle_t *) &ctx->filler[0], nullptr);
+        uv_close((uv_handle_t *) &ctx->filler[1], nullptr);
+        uv_close((uv_handle_t *) &ctx->server, nullptr);
+    }, &ctx) == 0);
+
+    test.run();
+
+    CHECK(ctx.status == 0);
+    CHECK(ctx.elapsed >= 100);
+    CHECK(ctx.elapsed < 5000);
+    CHECK(ctx.stray == 0);
+    CHECK(ctx.connected.sin_port == srv_addr.sin_port);
+    CHECK(ctx.src.race == nullptr);
+    CHECK(ctx.src.conn == nullptr);
+
+    if (ctx.accepted) {
+        uv_close((uv_handle_t *) &ctx.peer, nullptr);
+    }
+    tcp_src_free(&ctx.src);
+}
+
+static int dns_cache_port(tlsuv_dns_cache *cache, const char *host, const char *service) {
+    struct sockaddr_storage *addrs = nullptr;
+    size_t count = 0;
+    int rc = tlsuv_dns_cache_lookup(cache, host, service, &addrs, &count);
+    if (rc != 0) {
+        return rc;
+    }
+    int port = count == 1 ? ntohs(((struct sockaddr_in *) addrs)->sin_port) : -1;
+    tlsuv__free(addrs);
+    return port;
+}
+
+TEST_CASE("DNS cache", "[uv-mbed]") {
+    UvLoopTest test;
+    REQUIRE(tcp_src_dns_cache(test.loop, 1, 1, 0) == 0);
+    tlsuv_dns_cache *cache = tlsuv_dns_cache_get(test.loop);
+    REQUIRE(cache != nullptr);
+
+    struct sockaddr_in sin;
+    uv_ip4_addr("127.0.0.1", 443, &sin);
+    struct addrinfo ai = {};
+    ai.ai_family = AF_INET;
+    ai.ai_socktype = SOCK_STREAM;
+    ai.ai_addr = (struct sockaddr *) &sin;
+    ai.ai_addrlen = sizeof(sin);
+
+    tlsuv_dns_cache_put(cache, "a.test", "443", 0, &ai);
+    CHECK(dns_cache_port(cache, "a.test", "443") == 443);
+    CHECK(dns_cache_port(cache, "a.test", "80") == UV_EAGAIN);
+
+    // resolver failures are served from cache, transient ones are not stored
+    tlsuv_dns_cache_put(cache, "b.test", "443", UV_EAI_NONAME, nullptr);
+    CHECK(dns_cache_port(cache, "b.test", "443") == UV_EAI_NONAME);
+    tlsuv_dns_cache_put(cache, "c.test", "443", UV_EAI_AGAIN, nullptr);
+    CHECK(dns_cache_port(cache, "c.test", "443") == UV_EAGAIN);
+
+    WHEN("entries expire") {
+        uv_sleep(1100);
+        uv_update_time(test.loop);
+        CHECK(dns_cache_port(cache, "a.test", "443") == UV_EAGAIN);
+        CHECK(dns_cache_port(cache, "b.test", "443") == UV_EAGAIN);
+    }
+
+    WHEN("cache is full") {
+        char host[32];
+        for (int i = 2; i < TLSUV_DNS_CACHE_SIZE; i++) {
+            snprintf(host, sizeof(host), "host-%d.test", i);
+            tlsuv_dns_cache_put(cache, host, "443", 0, &ai);
+        }
+        // lookup makes entry most recently used, least recently used one is evicted
+        CHECK(dns_cache_port(cache, "a.test", "443") == 443);
+        tlsuv_dns_cache_put(cache, "new.test", "443", 0, &ai);
+        CHECK(dns_cache_port(cache, "b.test", "443") == UV_EAGAIN);
+        CHECK(dns_cache_port(cache, "a.test", "443") == 443);
+        CHECK(dns_cache_port(cache, "new.test", "443") == 443);
+        CHECK(dns_cache_port(cache, "host-2.test", "443") == 443);
+    }
+
+    WHEN("negative caching is off") {
+        REQUIRE(tcp_src_dns_cache(test.loop, 1, 0, 0) == 0);
+        tlsuv_dns_cache_put(cache, "d.test", "443", UV_EAI_NONAME, nullptr);
+        CHECK(dns_cache_port(cache, "d.test", "443") == UV_EAGAIN);
+    }
+
+    REQUIRE(tcp_src_dns_cache(test.loop, 0, 0, 0) == 0);
+    CHECK(tlsuv_dns_cache_get(test.loop) == nullptr);
+}
+
 TEST_CASE("read/write","[uv-mbed]") {
     UvLoopTest test;
 
@@ -168,4 +384,1557 @@ accept: application/dns-json
     tlsuv_stream_free(&mbed);
 
     tls->api->free_ctx(tls);
-}
\ No newline at end of file
+}
+#define to_str_(x) #x
+#define to_str(x) to_str_(x)
+
+static void echo_read(uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+    auto c = (tlsuv_stream_t *) s;
+    if (status < 0) {
+        tlsuv_stream_close(c, nullptr);
+    } else if (status > 0) {
+        // echo
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        wr->data = b->base;
+        uv_buf_t buf = uv_buf_init(b->base, (unsigned int) status);
+        tlsuv_stream_write(wr, c, &buf, [](uv_write_t *wr, int rc) {
+            free(wr->data);
+            free(wr);
+        });
+        return;
+    }
+    free(b->base);
+}
+
+// loopback TLS server, every accepted peer echoes what it receives
+struct echo_server {
+    tls_context *tls;
+    tlsuv_server_t srv;
+    std::vector<tlsuv_stream_t *> peers;
+    int port;
+};
+
+static bool echo_server_start(uv_loop_t *l, echo_server *es) {
+    const char *server_cert = to_str(TEST_SERVER_CERT);
+    const char *server_key = to_str(TEST_SERVER_KEY);
+
+    es->tls = default_tls_context(nullptr, 0);
+    if (es->tls->api->set_server_mode == nullptr) {
+        es->tls->api->free_ctx(es->tls);
+        es->tls = nullptr;
+        return false;
+    }
+    tlsuv_private_key_t pk;
+    REQUIRE(es->tls->api->load_key(&pk, server_key, strlen(server_key)) == 0);
+    REQUIRE(es->tls->api->set_own_cert(es->tls->ctx, server_cert, strlen(server_cert)) == 0);
+    REQUIRE(es->tls->api->set_own_key(es->tls->ctx, pk) == 0);
+    REQUIRE(es->tls->api->set_server_mode(es->tls, TLS_SERVER_MODE) == 0);
+
+    REQUIRE(tlsuv_server_init(l, &es->srv, es->tls) == 0);
+    es->srv.data = es;
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(tlsuv_server_bind(&es->srv, (const struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    REQUIRE(uv_tcp_getsockname(&es->srv.listener, (struct sockaddr *) &addr, &len) == 0);
+    es->port = ntohs(addr.sin_port);
+
+    REQUIRE(tlsuv_server_listen(&es->srv, 8, [](tlsuv_server_t *srv, int status) {
+        REQUIRE(status == 0);
+        auto es = (echo_server *) srv->data;
+        auto peer = new tlsuv_stream_t{};
+        es->peers.push_back(peer);
+        tlsuv_stream_init(srv->loop, peer, srv->tls);
+        auto req = new uv_connect_t{};
+        CHECK(tlsuv_server_accept(srv, peer, req, [](uv_connect_t *r, int status) {
+            if (status != 0) {
+                tlsuv_stream_close((tlsuv_stream_t *) r->handle, nullptr);
+            }
+            delete r;
+        }) == 0);
+        tlsuv_stream_read(peer, test_alloc, echo_read);
+    }) == 0);
+    return true;
+}
+
+// peers close when their client disconnects
+static void echo_server_close(echo_server *es) {
+    tlsuv_server_close(&es->srv, nullptr);
+}
+
+static void echo_server_free(echo_server *es) {
+    for (auto peer: es->peers) {
+        tlsuv_stream_free(peer);
+        delete peer;
+    }
+    es->peers.clear();
+    if (es->tls) {
+        es->tls->api->free_ctx(es->tls);
+    }
+}
+
+// client of echo_server: sends [sent] once connected, closes after whole echo has been read
+struct echo_client {
+    echo_server *es;
+    tls_context *tls;
+    tlsuv_stream_t stream;
+    uv_connect_t connect_req;
+    int connect_status;
+    std::string sent;
+    std::string reply;
+    int reads;
+    // replaces default single write of [sent]
+    void (*on_connected)(echo_client *ec);
+    void *data;
+};
+
+static void echo_client_init(uv_loop_t *l, echo_client *ec) {
+    const char *ca = to_str(TEST_SERVER_CA);
+    ec->tls = default_tls_context(ca, strlen(ca));
+    tlsuv_stream_init(l, &ec->stream, ec->tls);
+    ec->stream.data = ec;
+    ec->connect_status = 1;
+}
+
+static void echo_client_done(echo_client *ec) {
+    tlsuv_stream_close(&ec->stream, nullptr);
+    echo_server_close(ec->es);
+}
+
+static void echo_client_read(uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+    auto ec = (echo_client *) ((tlsuv_stream_t *) s)->data;
+    if (status > 0) {
+        ec->reads++;
+        ec->reply.append(b->base, status);
+    }
+    if (status < 0 || ec->reply.size() >= ec->sent.size()) {
+        echo_client_done(ec);
+    }
+    free(b->base);
+}
+
+static void echo_client_connected(uv_connect_t *r, int status) {
+    auto ec = (echo_client *) ((tlsuv_stream_t *) r->handle)->data;
+    ec->connect_status = status;
+    if (status != 0) {
+        echo_client_done(ec);
+        return;
+    }
+    tlsuv_stream_read(&ec->stream, test_alloc, echo_client_read);
+    if (ec->on_connected) {
+        ec->on_connected(ec);
+        return;
+    }
+    auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+    uv_buf_t buf = uv_buf_init(&ec->sent[0], (unsigned int) ec->sent.size());
+    tlsuv_stream_write(wr, &ec->stream, &buf, [](uv_write_t *wr, int) {
+        free(wr);
+    });
+}
+
+static int echo_client_connect(echo_client *ec, echo_server *es) {
+    ec->es = es;
+    return tlsuv_stream_connect(&ec->connect_req, &ec->stream, "127.0.0.1", es->port, echo_client_connected);
+}
+
+static void echo_client_free(echo_client *ec) {
+    tlsuv_stream_free(&ec->stream);
+    ec->tls->api->free_ctx(ec->tls);
+}
+
+TEST_CASE("server accept", "[uv-mbed]") {
+    UvLoopTest test;
+
+    const char *server_cert = to_str(TEST_SERVER_CERT);
+    const char *server_key = to_str(TEST_SERVER_KEY);
+    const char *ca = to_str(TEST_SERVER_CA);
+    const char *protos[] = {"foo", "test"};
+
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    if (srv_tls->api->set_server_mode == nullptr) {
+        WARN("server mode is not supported by TLS library");
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+    tlsuv_private_key_t pk;
+    REQUIRE(srv_tls->api->load_key(&pk, server_key, strlen(server_key)) == 0);
+    REQUIRE(srv_tls->api->set_own_cert(srv_tls->ctx, server_cert, strlen(server_cert)) == 0);
+    REQUIRE(srv_tls->api->set_own_key(srv_tls->ctx, pk) == 0);
+    srv_tls->api->set_alpn_protocols(srv_tls->ctx, protos, 2);
+
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tls->api->set_alpn_protocols(tls->ctx, protos + 1, 1);
+
+    struct test_ctx {
+        tlsuv_server_t srv;
+        tlsuv_stream_t peer;
+        bool peer_init;
+        uv_connect_t accept_req;
+        int accept_status;
+        std::string alpn;
+
+        tlsuv_stream_t client;
+        uv_connect_t connect_req;
+        int connect_status;
+        std::string reply;
+    } ctx{};
+    ctx.accept_status = 1;
+    ctx.connect_status = 1;
+
+    REQUIRE(tlsuv_server_init(test.loop, &ctx.srv, srv_tls) == 0);
+    ctx.srv.data = &ctx;
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(tlsuv_server_bind(&ctx.srv, (const struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    REQUIRE(uv_tcp_getsockname(&ctx.srv.listener, (struct sockaddr *) &addr, &len) == 0);
+
+    int flags = TLS_SERVER_MODE;
+    WHEN("client connects") {
+    }
+    WHEN("client certificate is required") {
+        flags |= TLS_SERVER_VERIFY_CLIENT;
+    }
+    REQUIRE(srv_tls->api->set_server_mode(srv_tls, flags) == 0);
+
+    REQUIRE(tlsuv_server_listen(&ctx.srv, 8, [](tlsuv_server_t *srv, int status) {
+        REQUIRE(status == 0);
+        auto ctx = (struct test_ctx *) srv->data;
+        tlsuv_stream_init(srv->loop, &ctx->peer, srv->tls);
+        ctx->peer_init = true;
+        ctx->peer.data = ctx;
+        CHECK(tlsuv_server_accept(srv, &ctx->peer, &ctx->accept_req, [](uv_connect_t *r, int status) {
+            auto c = (tlsuv_stream_t *) r->handle;
+            auto ctx = (struct test_ctx *) c->data;
+            ctx->accept_status = status;
+            if (status != 0) {
+                tlsuv_stream_close(c, nullptr);
+                return;
+            }
+            const char *alpn = c->tls_engine->api->get_alpn(c->tls_engine->engine);
+            ctx->alpn = alpn ? alpn : "";
+        }) == 0);
+        tlsuv_stream_read(&ctx->peer, test_alloc, echo_read);
+    }) == 0);
+
+    tlsuv_stream_init(test.loop, &ctx.client, tls);
+    ctx.client.data = &ctx;
+    REQUIRE(tlsuv_stream_connect(&ctx.connect_req, &ctx.client, "127.0.0.1", ntohs(addr.sin_port),
+                                 [](uv_connect_t *r, int status) {
+        auto c = (tlsuv_stream_t *) r->handle;
+        auto ctx = (struct test_ctx *) c->data;
+        ctx->connect_status = status;
+        if (status != 0) {
+            tlsuv_stream_close(c, nullptr);
+            tlsuv_server_close(&ctx->srv, nullptr);
+            return;
+        }
+        tlsuv_stream_read(c, test_alloc, [](uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+            auto c = (tlsuv_stream_t *) s;
+            auto ctx = (struct test_ctx *) c->data;
+            if (status > 0) {
+                ctx->reply.append(b->base, status);
+            }
+            if (status < 0 || ctx->reply == "hello") {
+                tlsuv_stream_close(c, nullptr);
+                tlsuv_server_close(&ctx->srv, nullptr);
+            }
+            free(b->base);
+        });
+
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        uv_buf_t buf = uv_buf_init((char *) "hello", 5);
+        tlsuv_stream_write(wr, c, &buf, [](uv_write_t *wr, int rc) {
+            free(wr);
+        });
+    }) == 0);
+
+    test.run();
+
+    if (flags & TLS_SERVER_VERIFY_CLIENT) {
+        // TLS 1.3 client completes handshake before server rejects it
+        CHECK(ctx.accept_status == UV_ECONNABORTED);
+        CHECK(ctx.reply.empty());
+    } else {
+        CHECK(ctx.connect_status == 0);
+        CHECK(ctx.accept_status == 0);
+        CHECK(ctx.alpn == "test");
+        CHECK(ctx.reply == "hello");
+    }
+
+    tlsuv_stream_free(&ctx.client);
+    if (ctx.peer_init) {
+        tlsuv_stream_free(&ctx.peer);
+    }
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+TEST_CASE("bulk crypto offload", "[uv-mbed]") {
+    UvLoopTest test;
+
+    const char *server_cert = to_str(TEST_SERVER_CERT);
+    const char *server_key = to_str(TEST_SERVER_KEY);
+    const char *ca = to_str(TEST_SERVER_CA);
+
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    if (srv_tls->api->set_server_mode == nullptr || srv_tls->api->set_async_crypto == nullptr) {
+        WARN("bulk crypto offload is not supported by TLS library");
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+    tlsuv_private_key_t pk;
+    REQUIRE(srv_tls->api->load_key(&pk, server_key, strlen(server_key)) == 0);
+    REQUIRE(srv_tls->api->set_own_cert(srv_tls->ctx, server_cert, strlen(server_cert)) == 0);
+    REQUIRE(srv_tls->api->set_own_key(srv_tls->ctx, pk) == 0);
+    REQUIRE(srv_tls->api->set_server_mode(srv_tls, TLS_SERVER_MODE) == 0);
+    REQUIRE(srv_tls->api->set_async_crypto(srv_tls, 1) == 0);
+
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    REQUIRE(tls->api->set_async_crypto(tls, 1) == 0);
+
+    struct test_ctx {
+        tlsuv_server_t srv;
+        tlsuv_stream_t peer;
+        bool peer_init;
+        uv_connect_t accept_req;
+
+        tlsuv_stream_t client;
+        uv_connect_t connect_req;
+        int connect_status;
+        bool offloaded;
+        bool close_early;
+        bool small_tail;
+        std::vector<size_t> sizes;
+        std::string sent;
+        std::string reply;
+        std::string received;
+        unsigned long batches;
+        int writes;
+        int write_ok;
+        int write_cancelled;
+    } ctx{};
+    ctx.connect_status = 1;
+
+    REQUIRE(tlsuv_server_init(test.loop, &ctx.srv, srv_tls) == 0);
+    ctx.srv.data = &ctx;
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(tlsuv_server_bind(&ctx.srv, (const struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    REQUIRE(uv_tcp_getsockname(&ctx.srv.listener, (struct sockaddr *) &addr, &len) == 0);
+
+    WHEN("data is echoed") {
+    }
+    WHEN("client closes with writes in flight") {
+        ctx.close_early = true;
+    }
+    WHEN("small writes queue behind a large one") {
+        ctx.small_tail = true;
+    }
+
+    for (int i = 0; i < 64; i++) {
+        if (ctx.small_tail) {
+            // everything after the first write is one batch below TLSUV_BULK_CRYPTO_MIN
+            ctx.sizes.push_back(i == 0 ? 64 * 1024 : 100);
+        } else {
+            // large writes interleaved with small ones that would otherwise overtake them
+            ctx.sizes.push_back(i % 4 == 3 ? 100 : 64 * 1024 + i);
+        }
+        ctx.sent.append(ctx.sizes.back(), (char) ('a' + i % 26));
+    }
+
+    REQUIRE(tlsuv_server_listen(&ctx.srv, 8, [](tlsuv_server_t *srv, int status) {
+        REQUIRE(status == 0);
+        auto ctx = (struct test_ctx *) srv->data;
+        tlsuv_stream_init(srv->loop, &ctx->peer, srv->tls);
+        ctx->peer_init = true;
+        ctx->peer.data = ctx;
+        CHECK(tlsuv_server_accept(srv, &ctx->peer, &ctx->accept_req, [](uv_connect_t *r, int status) {
+            if (status != 0) {
+                tlsuv_stream_close((tlsuv_stream_t *) r->handle, nullptr);
+            }
+        }) == 0);
+        if (!ctx->small_tail) {
+            tlsuv_stream_read(&ctx->peer, test_alloc, echo_read);
+            return;
+        }
+        // no echo, so client only counts its write batches
+        tlsuv_stream_read(&ctx->peer, test_alloc, [](uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+            auto p = (tlsuv_stream_t *) s;
+            auto ctx = (struct test_ctx *) p->data;
+            if (status < 0) {
+                tlsuv_stream_close(p, nullptr);
+            } else if (status > 0) {
+                ctx->received.append(b->base, status);
+                if (ctx->received.size() == ctx->sent.size()) {
+                    ctx->batches = ctx->client.tls_link.crypto_batches;
+                    tlsuv_stream_close(&ctx->client, nullptr);
+                    tlsuv_server_close(&ctx->srv, nullptr);
+                }
+            }
+            free(b->base);
+        });
+    }) == 0);
+
+    tlsuv_stream_init(test.loop, &ctx.client, tls);
+    ctx.client.data = &ctx;
+    REQUIRE(tlsuv_stream_connect(&ctx.connect_req, &ctx.client, "127.0.0.1", ntohs(addr.sin_port),
+                                 [](uv_connect_t *r, int status) {
+        auto c = (tlsuv_stream_t *) r->handle;
+        auto ctx = (struct test_ctx *) c->data;
+        ctx->connect_status = status;
+        if (status != 0) {
+            tlsuv_stream_close(c, nullptr);
+            tlsuv_server_close(&ctx->srv, nullptr);
+            return;
+        }
+        ctx->offloaded = c->tls_link.crypto_loop != nullptr;
+        tlsuv_stream_read(c, test_alloc, [](uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+            auto c = (tlsuv_stream_t *) s;
+            auto ctx = (struct test_ctx *) c->data;
+            if (status > 0) {
+                ctx->reply.append(b->base, status);
+            }
+            if (status < 0 || ctx->reply.size() >= ctx->sent.size()) {
+                tlsuv_stream_close(c, nullptr);
+                tlsuv_server_close(&ctx->srv, nullptr);
+            }
+            free(b->base);
+        });
+
+        size_t off = 0;
+        for (size_t n : ctx->sizes) {
+            auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+            wr->data = ctx;
+            uv_buf_t buf = uv_buf_init(&ctx->sent[off], (unsigned int) n);
+            off += n;
+            REQUIRE(tlsuv_stream_write(wr, c, &buf, [](uv_write_t *wr, int rc) {
+                auto ctx = (struct test_ctx *) wr->data;
+                if (rc == 0) ctx->write_ok++;
+                if (rc == UV_ECANCELED) ctx->write_cancelled++;
+                free(wr);
+            }) == 0);
+            ctx->writes++;
+        }
+
+        if (ctx->close_early) {
+            tlsuv_stream_close(c, nullptr);
+            tlsuv_server_close(&ctx->srv, nullptr);
+        }
+    }) == 0);
+
+    test.run();
+
+    CHECK(ctx.connect_status == 0);
+    CHECK(ctx.offloaded);
+    CHECK(ctx.writes == 64);
+    CHECK(ctx.write_ok + ctx.write_cancelled == 64);
+    if (ctx.close_early) {
+        CHECK(ctx.reply.size() < ctx.sent.size());
+    } else if (ctx.small_tail) {
+        CHECK(ctx.write_ok == 64);
+        CHECK(ctx.received == ctx.sent);
+        CHECK(ctx.batches == 1);
+    } else {
+        CHECK(ctx.write_ok == 64);
+        CHECK(ctx.reply.size() == ctx.sent.size());
+        CHECK(ctx.reply == ctx.sent);
+        CHECK(ctx.client.tls_link.crypto_batches > 0);
+    }
+
+    tlsuv_stream_free(&ctx.client);
+    if (ctx.peer_init) {
+        tlsuv_stream_free(&ctx.peer);
+    }
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+TEST_CASE("async handshake", "[uv-mbed]") {
+    UvLoopTest test;
+
+    const char *server_cert = to_str(TEST_SERVER_CERT);
+    const char *server_key = to_str(TEST_SERVER_KEY);
+
+    tls_context *srv_tls = default_tls_context(nullptr, 0);
+    if (srv_tls->api->set_server_mode == nullptr || srv_tls->api->set_async_handshake == nullptr) {
+        WARN("async handshake is not supported by TLS library");
+        srv_tls->api->free_ctx(srv_tls);
+        return;
+    }
+    tlsuv_private_key_t pk;
+    REQUIRE(srv_tls->api->load_key(&pk, server_key, strlen(server_key)) == 0);
+    REQUIRE(srv_tls->api->set_own_cert(srv_tls->ctx, server_cert, strlen(server_cert)) == 0);
+    REQUIRE(srv_tls->api->set_own_key(srv_tls->ctx, pk) == 0);
+    REQUIRE(srv_tls->api->set_server_mode(srv_tls, TLS_SERVER_MODE) == 0);
+
+    struct test_ctx {
+        tlsuv_server_t srv;
+        tlsuv_stream_t peer;
+        bool peer_init;
+        uv_connect_t accept_req;
+
+        uv_thread_t loop_thread;
+        // signals the loop that verification started
+        uv_async_t verifying;
+        std::atomic<int> verify_calls;
+        std::atomic<bool> verify_on_loop;
+        bool close_in_handshake;
+        bool closed_in_step;
+
+        tlsuv_stream_t client;
+        uv_connect_t connect_req;
+        int connect_status;
+        bool client_closed;
+    } ctx{};
+    ctx.connect_status = 1;
+    ctx.loop_thread = uv_thread_self();
+
+    tls_context *tls = default_tls_context(nullptr, 0);
+    REQUIRE(tls->api->set_async_handshake(tls, 1) == 0);
+    tls->api->set_cert_verify(tls, [](tls_cert, void *v_ctx) -> int {
+        auto ctx = (struct test_ctx *) v_ctx;
+        uv_thread_t self = uv_thread_self();
+        ctx->verify_on_loop = uv_thread_equal(&self, &ctx->loop_thread) != 0;
+        ctx->verify_calls++;
+        uv_async_send(&ctx->verifying);
+        // keep handshake step running while the loop acts on the signal
+        uv_sleep(100);
+        return 0;
+    }, &ctx);
+
+    REQUIRE(uv_async_init(test.loop, &ctx.verifying, [](uv_async_t *a) {
+        auto ctx = (struct test_ctx *) a->data;
+        uv_close((uv_handle_t *) a, nullptr);
+        if (ctx->close_in_handshake) {
+            ctx->closed_in_step = ctx->client.tls_link.hs_job != nullptr;
+            tlsuv_stream_close(&ctx->client, [](uv_handle_t *h) {
+                auto ctx = (struct test_ctx *) ((tlsuv_stream_t *) h)->data;
+                ctx->client_closed = true;
+            });
+            tlsuv_server_close(&ctx->srv, nullptr);
+        }
+    }) == 0);
+    ctx.verifying.data = &ctx;
+
+    REQUIRE(tlsuv_server_init(test.loop, &ctx.srv, srv_tls) == 0);
+    ctx.srv.data = &ctx;
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(tlsuv_server_bind(&ctx.srv, (const struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    REQUIRE(uv_tcp_getsockname(&ctx.srv.listener, (struct sockaddr *) &addr, &len) == 0);
+
+    WHEN("handshake completes") {
+    }
+    WHEN("client closes during handshake") {
+        ctx.close_in_handshake = true;
+    }
+
+    REQUIRE(tlsuv_server_listen(&ctx.srv, 8, [](tlsuv_server_t *srv, int status) {
+        REQUIRE(status == 0);
+        auto ctx = (struct test_ctx *) srv->data;
+        tlsuv_stream_init(srv->loop, &ctx->peer, srv->tls);
+        ctx->peer_init = true;
+        ctx->peer.data = ctx;
+        CHECK(tlsuv_server_accept(srv, &ctx->peer, &ctx->accept_req, [](uv_connect_t *r, int status) {
+            if (status != 0) {
+                tlsuv_stream_close((tlsuv_stream_t *) r->handle, nullptr);
+            }
+        }) == 0);
+        // peer closes when client goes away
+        tlsuv_stream_read(&ctx->peer, test_alloc, echo_read);
+    }) == 0);
+
+    tlsuv_stream_init(test.loop, &ctx.client, tls);
+    ctx.client.data = &ctx;
+    REQUIRE(tlsuv_stream_connect(&ctx.connect_req, &ctx.client, "127.0.0.1", ntohs(addr.sin_port),
+                                 [](uv_connect_t *r, int status) {
+        auto c = (tlsuv_stream_t *) r->handle;
+        auto ctx = (struct test_ctx *) c->data;
+        ctx->connect_status = status;
+        if (status == 0) {
+            tlsuv_stream_close(c, [](uv_handle_t *h) {
+                auto ctx = (struct test_ctx *) ((tlsuv_stream_t *) h)->data;
+                ctx->client_closed = true;
+            });
+            tlsuv_server_close(&ctx->srv, nullptr);
+        }
+    }) == 0);
+
+    test.run();
+
+    CHECK(ctx.verify_calls == 1);
+    CHECK_FALSE(ctx.verify_on_loop);
+    CHECK(ctx.client_closed);
+    if (ctx.close_in_handshake) {
+        CHECK(ctx.closed_in_step);
+        CHECK(ctx.connect_status == UV_ECANCELED);
+    } else {
+        CHECK(ctx.connect_status == 0);
+    }
+
+    tlsuv_stream_free(&ctx.client);
+    if (ctx.peer_init) {
+        tlsuv_stream_free(&ctx.peer);
+    }
+    tls->api->free_ctx(tls);
+    srv_tls->api->free_ctx(srv_tls);
+}
+
+TEST_CASE("bulk read into child buffers", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct test_ctx {
+        echo_server *es;
+        tlsuv_stream_t client;
+        uv_connect_t connect_req;
+        int connect_status;
+        bool close_in_read;
+        std::string sent;
+        std::string reply;
+        int reads;
+    } ctx{};
+    ctx.es = &es;
+    ctx.connect_status = 1;
+    for (int i = 0; i < 1024; i++) {
+        ctx.sent.append(1024, (char) ('a' + i % 26));
+    }
+
+    WHEN("all data is read") {
+    }
+    WHEN("reader closes from read callback") {
+        ctx.close_in_read = true;
+    }
+
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tlsuv_stream_init(test.loop, &ctx.client, tls);
+    ctx.client.data = &ctx;
+    REQUIRE(tlsuv_stream_connect(&ctx.connect_req, &ctx.client, "127.0.0.1", es.port,
+                                 [](uv_connect_t *r, int status) {
+        auto c = (tlsuv_stream_t *) r->handle;
+        auto ctx = (struct test_ctx *) c->data;
+        ctx->connect_status = status;
+        if (status != 0) {
+            tlsuv_stream_close(c, nullptr);
+            echo_server_close(ctx->es);
+            return;
+        }
+        tlsuv_stream_read(c, test_alloc, [](uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+            auto c = (tlsuv_stream_t *) s;
+            auto ctx = (struct test_ctx *) c->data;
+            if (status > 0) {
+                ctx->reads++;
+                ctx->reply.append(b->base, status);
+            }
+            // after close from here remaining records must not be delivered
+            if (status < 0 || ctx->reply.size() >= ctx->sent.size() || (ctx->close_in_read && ctx->reads == 1)) {
+                tlsuv_stream_close(c, nullptr);
+                echo_server_close(ctx->es);
+            }
+            free(b->base);
+        });
+
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        uv_buf_t buf = uv_buf_init(&ctx->sent[0], (unsigned int) ctx->sent.size());
+        tlsuv_stream_write(wr, c, &buf, [](uv_write_t *wr, int rc) {
+            free(wr);
+        });
+    }) == 0);
+
+    test.run();
+
+    CHECK(ctx.connect_status == 0);
+    if (ctx.close_in_read) {
+        CHECK(ctx.reads == 1);
+        CHECK(ctx.reply.size() < ctx.sent.size());
+    } else {
+        CHECK(ctx.reply == ctx.sent);
+        // several records are decrypted into one child buffer
+        CHECK(ctx.reads < (int) (ctx.sent.size() / (16 * 1024)));
+    }
+
+    tlsuv_stream_free(&ctx.client);
+    tls->api->free_ctx(tls);
+    echo_server_free(&es);
+}
+
+TEST_CASE("connection timing", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct timing_rec {
+        int count;
+        tlsuv_timing_t timing;
+    } rec{};
+
+    echo_client ec{};
+    ec.sent = "timing check";
+    echo_client_init(test.loop, &ec);
+    CHECK(tlsuv_stream_set_timing(&ec.stream, [](const tlsuv_timing_t *t, void *ctx) {
+        auto rec = (timing_rec *) ctx;
+        rec->count++;
+        rec->timing = *t;
+    }, &rec) == 0);
+
+    uint64_t start = uv_hrtime();
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    CHECK(ec.reply == ec.sent);
+
+    // reported once, before connect callback
+    REQUIRE(rec.count == 1);
+    auto &t = rec.timing;
+    CHECK(t.resolve_start >= start);
+    CHECK(t.resolve_end >= t.resolve_start);
+    CHECK(t.connect_end >= t.resolve_end);
+    REQUIRE(t.hs_flight_count > 0);
+    CHECK(t.hs_flight_count <= TLSUV_TIMING_MAX_FLIGHTS);
+    CHECK(t.hs_flights[0] >= t.connect_end);
+    for (int i = 1; i < t.hs_flight_count; i++) {
+        CHECK(t.hs_flights[i] >= t.hs_flights[i - 1]);
+    }
+    CHECK(t.hs_complete >= t.hs_flights[t.hs_flight_count - 1]);
+    // not stream phases
+    CHECK(t.req_written == 0);
+    CHECK(t.first_byte == 0);
+    CHECK(t.body_complete == 0);
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("connection timing on failure", "[uv-mbed]") {
+    UvLoopTest test;
+
+    // grab a free port and close it, nothing listens there
+    uv_tcp_t sock;
+    uv_tcp_init(test.loop, &sock);
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(uv_tcp_bind(&sock, (const struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    REQUIRE(uv_tcp_getsockname(&sock, (struct sockaddr *) &addr, &len) == 0);
+    uv_close((uv_handle_t *) &sock, nullptr);
+
+    struct test_ctx {
+        int count;
+        tlsuv_timing_t timing;
+        int status;
+    } ctx{};
+    ctx.status = 1;
+
+    const char *ca = to_str(TEST_SERVER_CA);
+    tls_context *tls = default_tls_context(ca, strlen(ca));
+    tlsuv_stream_t clt;
+    tlsuv_stream_init(test.loop, &clt, tls);
+    clt.data = &ctx;
+    tlsuv_stream_set_timing(&clt, [](const tlsuv_timing_t *t, void *c) {
+        auto ctx = (test_ctx *) c;
+        // connect callback has not been called yet
+        CHECK(ctx->status == 1);
+        ctx->count++;
+        ctx->timing = *t;
+    }, &ctx);
+
+    uv_connect_t req;
+    REQUIRE(tlsuv_stream_connect(&req, &clt, "127.0.0.1", ntohs(addr.sin_port), [](uv_connect_t *r, int status) {
+        auto c = (tlsuv_stream_t *) r->handle;
+        ((test_ctx *) c->data)->status = status;
+        tlsuv_stream_close(c, nullptr);
+    }) == 0);
+    test.run();
+
+    CHECK(ctx.status == UV_ECONNREFUSED);
+    CHECK(ctx.count == 1);
+    CHECK(ctx.timing.resolve_start != 0);
+    CHECK(ctx.timing.hs_flight_count == 0);
+    CHECK(ctx.timing.hs_complete == 0);
+
+    tlsuv_stream_free(&clt);
+    tls->api->free_ctx(tls);
+}
+
+TEST_CASE("traffic counters", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    echo_client ec{};
+    ec.sent.assign(100 * 1024, 'x');
+    echo_client_init(test.loop, &ec);
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+    REQUIRE(ec.reply == ec.sent);
+
+    tls_traffic_stats st{};
+    if (tlsuv_stream_stats(&ec.stream, &st) == UV_ENOTSUP) {
+        WARN("TLS engine does not keep counters");
+    } else {
+        CHECK(st.plain_out == ec.sent.size());
+        CHECK(st.plain_in == ec.reply.size());
+        // record framing, handshake and tags on top of application data
+        CHECK(st.cipher_out > st.plain_out);
+        CHECK(st.cipher_in > st.plain_in);
+        CHECK(st.records_out >= ec.sent.size() / (16 * 1024));
+        CHECK(st.records_in >= ec.reply.size() / (16 * 1024));
+        CHECK(st.handshakes == 1);
+        CHECK(st.handshake_failures == 0);
+        CHECK(st.buffer_allocs > 0);
+
+        if (ec.tls->api->get_traffic_stats) {
+            WHEN("connection is re-established") {
+                // first server was closed with the connection
+                ec.reply.clear();
+                echo_server_free(&es);
+                es = {};
+                REQUIRE(echo_server_start(test.loop, &es));
+                REQUIRE(echo_client_connect(&ec, &es) == 0);
+                test.run();
+                REQUIRE(ec.reply == ec.sent);
+
+                THEN("context keeps totals of released engines") {
+                    tls_traffic_stats total{};
+                    ec.tls->api->get_traffic_stats(ec.tls, &total);
+                    CHECK(total.plain_out == 2 * ec.sent.size());
+                    CHECK(total.plain_in == 2 * ec.sent.size());
+                    CHECK(total.handshakes == 2);
+
+                    tls_traffic_stats last{};
+                    REQUIRE(tlsuv_stream_stats(&ec.stream, &last) == 0);
+                    CHECK(last.plain_out == ec.sent.size());
+                    CHECK(last.handshakes == 1);
+                }
+            }
+        }
+    }
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("corked writes", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct cork_ctx {
+        uv_write_t reqs[50];
+        int done;
+        int status;
+        int done_before_uncork;
+        size_t corked_mem;
+        bool close_corked;
+    } ctx{};
+
+    WHEN("uncorked") {
+    }
+    WHEN("closed while corked") {
+        ctx.close_corked = true;
+    }
+
+    echo_client ec{};
+    ec.data = &ctx;
+    for (int i = 0; i < 50; i++) {
+        ec.sent.append(100, (char) ('a' + i % 26));
+    }
+    echo_client_init(test.loop, &ec);
+    ec.on_connected = [](echo_client *ec) {
+        auto ctx = (cork_ctx *) ec->data;
+        size_t before = tlsuv_stream_mem_usage(&ec->stream);
+        CHECK(tlsuv_stream_cork(&ec->stream) == 0);
+        for (int i = 0; i < 50; i++) {
+            uv_buf_t b = uv_buf_init(&ec->sent[i * 100], 100);
+            CHECK(tlsuv_stream_write(&ctx->reqs[i], &ec->stream, &b, [](uv_write_t *r, int status) {
+                auto ec = (echo_client *) ((tlsuv_stream_t *) r->handle)->data;
+                auto ctx = (cork_ctx *) ec->data;
+                // callbacks in write order
+                CHECK(r == &ctx->reqs[ctx->done]);
+                ctx->done++;
+                ctx->status = status;
+            }) == 0);
+        }
+        ctx->done_before_uncork = ctx->done;
+        ctx->corked_mem = tlsuv_stream_mem_usage(&ec->stream) - before;
+
+        if (ctx->close_corked) {
+            echo_client_done(ec);
+        } else {
+            CHECK(tlsuv_stream_uncork(&ec->stream) == 0);
+        }
+    };
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    CHECK(ctx.done_before_uncork == 0);
+    CHECK(ctx.corked_mem >= 50 * sizeof(uv_buf_t));
+    CHECK(ctx.done == 50);
+
+    if (ctx.close_corked) {
+        CHECK(ctx.status == UV_ECANCELED);
+        CHECK(ec.reply.empty());
+    } else {
+        CHECK(ctx.status == 0);
+        CHECK(ec.reply == ec.sent);
+
+        tls_traffic_stats st{};
+        if (tlsuv_stream_stats(&ec.stream, &st) == 0) {
+            // 50 writes packed into one record, plus the few handshake records
+            CHECK(st.records_out < 10);
+        }
+    }
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("gather write", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct gather_ctx {
+        uv_write_t req;
+        int done;
+        int status;
+    } ctx{};
+    ctx.status = 1;
+
+    echo_client ec{};
+    ec.data = &ctx;
+    for (int i = 0; i < 64; i++) {
+        ec.sent.append(1000, (char) ('a' + i % 26));
+    }
+    echo_client_init(test.loop, &ec);
+    ec.on_connected = [](echo_client *ec) {
+        auto ctx = (gather_ctx *) ec->data;
+        CHECK(tlsuv_stream_writev(&ctx->req, &ec->stream, nullptr, 0, nullptr) == UV_EINVAL);
+
+        auto bufs = new uv_buf_t[64];
+        for (int i = 0; i < 64; i++) {
+            bufs[i] = uv_buf_init(&ec->sent[i * 1000], 1000);
+        }
+        CHECK(tlsuv_stream_writev(&ctx->req, &ec->stream, bufs, 64, [](uv_write_t *r, int status) {
+            auto ec = (echo_client *) ((tlsuv_stream_t *) r->handle)->data;
+            auto ctx = (gather_ctx *) ec->data;
+            ctx->done++;
+            ctx->status = status;
+        }) == 0);
+        // buffer array is not needed after the call
+        memset(bufs, 0, 64 * sizeof(uv_buf_t));
+        delete[] bufs;
+    };
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    CHECK(ctx.done == 1);
+    CHECK(ctx.status == 0);
+    CHECK(ec.reply == ec.sent);
+
+    tls_traffic_stats st{};
+    if (tlsuv_stream_stats(&ec.stream, &st) == 0) {
+        CHECK(st.plain_out == ec.sent.size());
+        // buffers are packed into full records, not one record each
+        CHECK(st.records_out < 16);
+    }
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("read backpressure", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct pause_ctx {
+        uv_timer_t timer;
+        bool paused;
+        size_t at_stop;
+        size_t at_resume;
+    } ctx{};
+    uv_timer_init(test.loop, &ctx.timer);
+
+    echo_client ec{};
+    ec.data = &ctx;
+    ec.sent.assign(2 * 1024 * 1024, 'b');
+    echo_client_init(test.loop, &ec);
+    CHECK(tlsuv_stream_read_stop(&ec.stream) == UV_ENOTCONN);
+
+    ec.on_connected = [](echo_client *ec) {
+        tlsuv_stream_read(&ec->stream, test_alloc, [](uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+            auto ec = (echo_client *) ((tlsuv_stream_t *) s)->data;
+            auto ctx = (pause_ctx *) ec->data;
+            if (status > 0 && !ctx->paused && ctx->at_stop == 0) {
+                ctx->paused = true;
+                CHECK(tlsuv_stream_read_stop(&ec->stream) == 0);
+                ctx->at_stop = ec->reply.size() + status;
+                ctx->timer.data = ec;
+                uv_timer_start(&ctx->timer, [](uv_timer_t *t) {
+                    auto ec = (echo_client *) t->data;
+                    auto ctx = (pause_ctx *) ec->data;
+                    ctx->at_resume = ec->reply.size();
+                    ctx->paused = false;
+                    CHECK(tlsuv_stream_read_start(&ec->stream) == 0);
+                    uv_close((uv_handle_t *) t, nullptr);
+                }, 200, 0);
+            }
+            echo_client_read(s, status, b);
+        });
+
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        uv_buf_t buf = uv_buf_init(&ec->sent[0], (unsigned int) ec->sent.size());
+        tlsuv_stream_write(wr, &ec->stream, &buf, [](uv_write_t *wr, int) {
+            free(wr);
+        });
+    };
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    REQUIRE(ctx.at_stop > 0);
+    // only data already read from socket is delivered while stopped
+    CHECK(ctx.at_resume >= ctx.at_stop);
+    CHECK(ctx.at_resume - ctx.at_stop <= 128 * 1024);
+    CHECK(ctx.at_resume < ec.sent.size());
+    // nothing lost after resume
+    CHECK(ec.reply == ec.sent);
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("idle-lean connection memory", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct mem_ctx {
+        uv_timer_t timer;
+        size_t connected;
+        size_t idle;
+        int lean;
+    } ctx{};
+    uv_timer_init(test.loop, &ctx.timer);
+
+    echo_client ec{};
+    ec.data = &ctx;
+    ec.sent.assign(256 * 1024, 'm');
+    echo_client_init(test.loop, &ec);
+    if (ec.tls->api->set_idle_lean == nullptr) {
+        WARN("idle-lean mode is not supported by TLS library");
+        uv_close((uv_handle_t *) &ctx.timer, nullptr);
+        echo_server_close(&es);
+        test.run();
+        echo_client_free(&ec);
+        echo_server_free(&es);
+        return;
+    }
+
+    bool lean = GENERATE(false, true);
+    REQUIRE(ec.tls->api->set_idle_lean(ec.tls, lean) == 0);
+    CHECK(tlsuv_stream_mem_usage(&ec.stream) == 0);
+
+    ec.on_connected = [](echo_client *ec) {
+        auto ctx = (mem_ctx *) ec->data;
+        ctx->connected = tlsuv_stream_mem_usage(&ec->stream);
+        ctx->lean = ec->stream.tls_engine->api->idle_lean(ec->stream.tls_engine->engine);
+        tlsuv_stream_read(&ec->stream, test_alloc, [](uv_stream_t *s, ssize_t status, const uv_buf_t *b) {
+            auto ec = (echo_client *) ((tlsuv_stream_t *) s)->data;
+            auto ctx = (mem_ctx *) ec->data;
+            if (status > 0) {
+                ec->reply.append(b->base, status);
+            }
+            free(b->base);
+            if (status < 0) {
+                echo_client_done(ec);
+            } else if (ec->reply.size() == ec->sent.size()) {
+                // measure once read callback returned the buffers
+                ctx->timer.data = ec;
+                uv_timer_start(&ctx->timer, [](uv_timer_t *t) {
+                    auto ec = (echo_client *) t->data;
+                    auto ctx = (mem_ctx *) ec->data;
+                    ctx->idle = tlsuv_stream_mem_usage(&ec->stream);
+                    uv_close((uv_handle_t *) t, nullptr);
+                    echo_client_done(ec);
+                }, 10, 0);
+            }
+        });
+
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        uv_buf_t buf = uv_buf_init(&ec->sent[0], (unsigned int) ec->sent.size());
+        tlsuv_stream_write(wr, &ec->stream, &buf, [](uv_write_t *wr, int) {
+            free(wr);
+        });
+    };
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+
+    REQUIRE(ec.reply == ec.sent);
+    CHECK(ctx.lean == (int) lean);
+    CHECK(ctx.connected > 0);
+    REQUIRE(ctx.idle > 0);
+    if (lean) {
+        // socket objects only, TLS and read buffers were released
+        CHECK(ctx.idle < 4 * 1024);
+    } else {
+        // record and read buffers stay allocated
+        CHECK(ctx.idle > 16 * 1024);
+    }
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("connect to pre-resolved addresses", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    // nothing listens on the first address, second one is the server
+    uv_tcp_t sock;
+    uv_tcp_init(test.loop, &sock);
+    struct sockaddr_in closed_addr;
+    uv_ip4_addr("127.0.0.1", 0, &closed_addr);
+    REQUIRE(uv_tcp_bind(&sock, (const struct sockaddr *) &closed_addr, 0) == 0);
+    int len = sizeof(closed_addr);
+    REQUIRE(uv_tcp_getsockname(&sock, (struct sockaddr *) &closed_addr, &len) == 0);
+    uv_close((uv_handle_t *) &sock, nullptr);
+
+    struct sockaddr_in srv_addr;
+    uv_ip4_addr("127.0.0.1", es.port, &srv_addr);
+
+    struct addrinfo second{};
+    second.ai_family = AF_INET;
+    second.ai_socktype = SOCK_STREAM;
+    second.ai_addr = (struct sockaddr *) &srv_addr;
+    second.ai_addrlen = sizeof(srv_addr);
+
+    struct addrinfo first = second;
+    first.ai_addr = (struct sockaddr *) &closed_addr;
+    first.ai_next = &second;
+
+    std::string expected_host;
+    WHEN("canonical name is set") {
+        first.ai_canonname = (char *) "localhost";
+        expected_host = "localhost";
+    }
+    WHEN("no name is given") {
+        expected_host = "127.0.0.1";
+    }
+
+    echo_client ec{};
+    ec.sent = "pre-resolved";
+    echo_client_init(test.loop, &ec);
+    tlsuv_timing_t timing{};
+    tlsuv_stream_set_timing(&ec.stream, [](const tlsuv_timing_t *t, void *ctx) {
+        *(tlsuv_timing_t *) ctx = *t;
+    }, &timing);
+
+    uv_connect_t *req = &ec.connect_req;
+    CHECK(tlsuv_stream_connect_addr(req, &ec.stream, nullptr, echo_client_connected) == UV_EINVAL);
+
+    ec.es = &es;
+    REQUIRE(tlsuv_stream_connect_addr(req, &ec.stream, &first, echo_client_connected) == 0);
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    CHECK(ec.reply == ec.sent);
+    // server was verified against this name
+    REQUIRE(ec.stream.host != nullptr);
+    CHECK(std::string(ec.stream.host) == expected_host);
+    // no name resolution
+    CHECK(timing.resolve_end == timing.resolve_start);
+    CHECK(timing.connect_end != 0);
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+#if defined(__linux__)
+// socket option of connected stream, -1 if it can't be read
+static int stream_sockopt(tlsuv_stream_t *s, int level, int opt) {
+    uv_os_fd_t fd;
+    int val = -1;
+    socklen_t len = sizeof(val);
+    if (s->socket->conn == nullptr || uv_fileno((uv_handle_t *) s->socket->conn, &fd) != 0 ||
+        getsockopt(fd, level, opt, &val, &len) != 0) {
+        return -1;
+    }
+    return val;
+}
+
+TEST_CASE("TCP Fast Open", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct tfo_ctx {
+        int option;
+        int used;
+    } ctx{};
+    ctx.option = -1;
+
+    echo_client ec{};
+    ec.data = &ctx;
+    ec.sent = "fast open";
+    echo_client_init(test.loop, &ec);
+    CHECK(tcp_src_fast_open_used(ec.stream.socket) == UV_ENOTCONN);
+    REQUIRE(tcp_src_fast_open(ec.stream.socket, 1) == 0);
+
+    ec.on_connected = [](echo_client *ec) {
+        auto ctx = (tfo_ctx *) ec->data;
+        ctx->option = stream_sockopt(&ec->stream, IPPROTO_TCP, TCP_FASTOPEN_CONNECT);
+        ctx->used = tcp_src_fast_open_used(ec->stream.socket);
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        uv_buf_t buf = uv_buf_init(&ec->sent[0], (unsigned int) ec->sent.size());
+        tlsuv_stream_write(wr, &ec->stream, &buf, [](uv_write_t *wr, int) {
+            free(wr);
+        });
+    };
+
+    struct sockaddr_in srv_addr;
+    uv_ip4_addr("127.0.0.1", es.port, &srv_addr);
+    struct addrinfo second{};
+    second.ai_family = AF_INET;
+    second.ai_socktype = SOCK_STREAM;
+    second.ai_addr = (struct sockaddr *) &srv_addr;
+    second.ai_addrlen = sizeof(srv_addr);
+    struct addrinfo first = second;
+    first.ai_next = &second;
+
+    int expected;
+    WHEN("single address") {
+        expected = 1;
+        REQUIRE(echo_client_connect(&ec, &es) == 0);
+    }
+    WHEN("addresses are raced") {
+        expected = 0;
+        ec.es = &es;
+        REQUIRE(tlsuv_stream_connect_addr(&ec.connect_req, &ec.stream, &first, echo_client_connected) == 0);
+    }
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    CHECK(ec.reply == ec.sent);
+    if (ctx.option == -1) {
+        WARN("TCP_FASTOPEN_CONNECT is not available");
+    } else {
+        CHECK(ctx.option == expected);
+    }
+    // first connect has no TFO cookie, but query must work
+    CHECK((ctx.used == 0 || ctx.used == 1));
+    if (expected == 0) {
+        CHECK(ctx.used == 0);
+    }
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+
+TEST_CASE("socket options", "[uv-mbed]") {
+    UvLoopTest test;
+
+    echo_server es{};
+    if (!echo_server_start(test.loop, &es)) {
+        WARN("server mode is not supported by TLS library");
+        return;
+    }
+
+    struct opt_ctx {
+        int sndbuf;
+        int rcvbuf;
+        int tos;
+        int user_timeout;
+        int lowat;
+        int lowat_updated;
+        int update_rc;
+    } ctx{};
+
+    echo_client ec{};
+    ec.data = &ctx;
+    ec.sent = "socket options";
+    echo_client_init(test.loop, &ec);
+
+    tcp_src_sockopts opts{};
+    opts.send_buffer = 64 * 1024;
+    opts.recv_buffer = 128 * 1024;
+    opts.tos = 0x28;
+    opts.user_timeout = 5000;
+    opts.notsent_lowat = 16 * 1024;
+    // stored until connect
+    REQUIRE(tlsuv_stream_sockopts(&ec.stream, &opts) == 0);
+
+    ec.on_connected = [](echo_client *ec) {
+        auto ctx = (opt_ctx *) ec->data;
+        ctx->sndbuf = stream_sockopt(&ec->stream, SOL_SOCKET, SO_SNDBUF);
+        ctx->rcvbuf = stream_sockopt(&ec->stream, SOL_SOCKET, SO_RCVBUF);
+        ctx->tos = stream_sockopt(&ec->stream, IPPROTO_IP, IP_TOS);
+        ctx->user_timeout = stream_sockopt(&ec->stream, IPPROTO_TCP, TCP_USER_TIMEOUT);
+        ctx->lowat = stream_sockopt(&ec->stream, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+
+        // applied to live connection right away
+        tcp_src_sockopts update = ec->stream.socket->sockopts;
+        update.notsent_lowat = 32 * 1024;
+        ctx->update_rc = tlsuv_stream_sockopts(&ec->stream, &update);
+        ctx->lowat_updated = stream_sockopt(&ec->stream, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+
+        auto wr = static_cast<uv_write_t *>(calloc(1, sizeof(uv_write_t)));
+        uv_buf_t buf = uv_buf_init(&ec->sent[0], (unsigned int) ec->sent.size());
+        tlsuv_stream_write(wr, &ec->stream, &buf, [](uv_write_t *wr, int) {
+            free(wr);
+        });
+    };
+    REQUIRE(echo_client_connect(&ec, &es) == 0);
+    test.run();
+
+    CHECK(ec.connect_status == 0);
+    CHECK(ec.reply == ec.sent);
+    // kernel doubles buffer sizes for bookkeeping
+    CHECK(ctx.sndbuf >= opts.send_buffer);
+    CHECK(ctx.rcvbuf >= opts.recv_buffer);
+    CHECK(ctx.tos == opts.tos);
+    CHECK(ctx.user_timeout == (int) opts.user_timeout);
+    CHECK(ctx.lowat == opts.notsent_lowat);
+    CHECK(ctx.update_rc == 0);
+    CHECK(ctx.lowat_updated == 32 * 1024);
+
+    echo_client_free(&ec);
+    echo_server_free(&es);
+}
+#endif
+
+// blocks of loop thread buffer pool, in use and allocated so far
+static size_t pool_blocks(unsigned long *allocs = nullptr) {
+    tlsuv_pool_stats st[16];
+    int n = tlsuv_pool_get_stats(st, 16);
+    size_t total = 0;
+    if (allocs) *allocs = 0;
+    for (int i = 0; i < n; i++) {
+        total += st[i].in_use;
+        if (allocs) *allocs += st[i].allocs;
+    }
+    return total;
+}
+
+TEST_CASE("tcp source reconnect", "[uv-mbed]") {
+    UvLoopTest test;
+
+    // plain TCP listener, accepted connections are dropped right away
+    uv_tcp_t srv;
+    uv_tcp_init(test.loop, &srv);
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(uv_tcp_bind(&srv, (const struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    REQUIRE(uv_tcp_getsockname(&srv, (struct sockaddr *) &addr, &len) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &srv, 16, [](uv_stream_t *s, int status) {
+        auto peer = new uv_tcp_t;
+        uv_tcp_init(s->loop, peer);
+        uv_accept(s, (uv_stream_t *) peer);
+        uv_close((uv_handle_t *) peer, [](uv_handle_t *h) { delete (uv_tcp_t *) h; });
+    }) == 0);
+
+    struct test_ctx {
+        tcp_src_t src;
+        uv_tcp_t *srv;
+        std::string port;
+        int connects;
+        int errors;
+        bool release_first;
+    } ctx{};
+    ctx.srv = &srv;
+    ctx.port = std::to_string(ntohs(addr.sin_port));
+
+    WHEN("connect replaces live connection") {
+    }
+    WHEN("connect right after release") {
+        ctx.release_first = true;
+    }
+
+    unsigned long allocs_before, allocs_after;
+    size_t in_use = pool_blocks(&allocs_before);
+    tcp_src_init(test.loop, &ctx.src);
+    tcp_src_nodelay(&ctx.src, 1);
+
+    static tlsuv_src_connect_cb on_connect = [](tlsuv_src_t *sl, int status, void *c) {
+        auto ctx = (test_ctx *) c;
+        if (status != 0) {
+            ctx->errors++;
+        } else {
+            ctx->connects++;
+        }
+        auto src = (tcp_src_t *) sl;
+        CHECK(src->conn != nullptr);
+        if (ctx->connects + ctx->errors < 5) {
+            // old handle is still closing when new connection starts
+            if (ctx->release_first) {
+                sl->release(sl);
+            }
+            CHECK(sl->connect(sl, "127.0.0.1", ctx->port.c_str(), on_connect, ctx) == 0);
+        } else {
+            sl->release(sl);
+            uv_close((uv_handle_t *) ctx->srv, nullptr);
+        }
+    };
+    REQUIRE(ctx.src.connect((tlsuv_src_t *) &ctx.src, "127.0.0.1", ctx.port.c_str(), on_connect, &ctx) == 0);
+    test.run();
+
+    CHECK(ctx.connects == 5);
+    CHECK(ctx.errors == 0);
+    CHECK(ctx.src.conn == nullptr);
+    // each attempt is one pooled block, returned when its handle is closed
+    CHECK(pool_blocks(&allocs_after) == in_use);
+    CHECK(allocs_after - allocs_before >= 5);
+    // settings survive reconnects
+    CHECK(ctx.src.nodelay != 0);
+
+    tcp_src_free(&ctx.src);
+}
+
+static std::mutex log_lock;
+static std::vector<std::string> log_msgs;
+
+static void collect_log(int, const char *, unsigned int, const char *msg) {
+    std::lock_guard<std::mutex> g(log_lock);
+    log_msgs.emplace_back(msg);
+}
+
+static void log_thread(void *arg) {
+    int id = *(int *) arg;
+    for (int i = 0; i < 200; i++) {
+        LOG_TRACE("thread[%d] msg[%d]", id, i);
+    }
+}
+
+TEST_CASE("async logging", "[log]") {
+    int level = um_log_level;
+    tlsuv_set_debug(6, collect_log);
+    REQUIRE(tlsuv_log_async_start(0) == 0);
+    CHECK(tlsuv_log_async_start(0) == UV_EALREADY);
+
+    std::string part = "partial string";
+    char expected[3][256];
+    snprintf(expected[0], sizeof(expected[0]), "int[%d] unsigned[%u] long[%ld] size[%zd] hex[%08x]",
+             -5, 7u, 123456789L, (size_t) 4096, 0xbeefu);
+    snprintf(expected[1], sizeof(expected[1]), "str[%s] prec[%.*s] width[%-6s|%*d] pct[100%%]",
+             "hello", 7, part.c_str(), "ab", 5, 42);
+    snprintf(expected[2], sizeof(expected[2]), "double[%.3f] ll[%lld] ptr[%p] char[%c]",
+             3.14159, -1234567890123LL, (void *) &level, 'x');
+
+    LOG_TRACE("int[%d] unsigned[%u] long[%ld] size[%zd] hex[%08x]",
+              -5, 7u, 123456789L, (size_t) 4096, 0xbeefu);
+    LOG_TRACE("str[%s] prec[%.*s] width[%-6s|%*d] pct[100%%]",
+              "hello", 7, part.c_str(), "ab", 5, 42);
+    // captured string must not depend on caller's buffer
+    part = "changed";
+    LOG_TRACE("double[%.3f] ll[%lld] ptr[%p] char[%c]",
+              3.14159, -1234567890123LL, (void *) &level, 'x');
+    tlsuv_log_flush();
+    {
+        std::lock_guard<std::mutex> g(log_lock);
+        REQUIRE(log_msgs.size() == 3);
+        CHECK(log_msgs[0] == expected[0]);
+        CHECK(log_msgs[1] == expected[1]);
+        CHECK(log_msgs[2] == expected[2]);
+        log_msgs.clear();
+    }
+
+    WHEN("multiple threads log") {
+        uv_thread_t threads[4];
+        int ids[4];
+        for (int i = 0; i < 4; i++) {
+            ids[i] = i;
+            REQUIRE(uv_thread_create(&threads[i], log_thread, &ids[i]) == 0);
+        }
+        for (auto &t: threads) {
+            uv_thread_join(&t);
+        }
+        tlsuv_log_flush();
+
+        std::lock_guard<std::mutex> g(log_lock);
+        int next[4] = {0, 0, 0, 0};
+        for (auto &m: log_msgs) {
+            int id, n;
+            REQUIRE(sscanf(m.c_str(), "thread[%d] msg[%d]", &id, &n) == 2);
+            CHECK(n == next[id]++);
+        }
+        for (int n: next) CHECK(n == 200);
+    }
+
+    WHEN("ring overflows") {
+        tlsuv_log_async_stop();
+        REQUIRE(tlsuv_log_async_start(4096) == 0);
+        tlsuv_log_stats before{};
+        REQUIRE(tlsuv_log_get_stats(&before) == 0);
+
+        uv_thread_t t;
+        int id = 0;
+        // new thread gets small ring
+        REQUIRE(uv_thread_create(&t, log_thread, &id) == 0);
+        uv_thread_join(&t);
+        tlsuv_log_flush();
+
+        tlsuv_log_stats stats{};
+        REQUIRE(tlsuv_log_get_stats(&stats) == 0);
+        CHECK(stats.threads == before.threads + 1);
+        CHECK(stats.records + stats.dropped - before.records - before.dropped == 200);
+        std::lock_guard<std::mutex> g(log_lock);
+        if (stats.dropped > before.dropped) {
+            CHECK(log_msgs.size() == stats.records - before.records + 1);
+            CHECK_THAT(log_msgs[0], Catch::Matchers::EndsWith("log records dropped"));
+        }
+    }
+
+    tlsuv_log_async_stop();
+    tlsuv_set_debug(level, getenv("TLSUV_TEST_LOG") ? test_log : nullptr);
+    log_msgs.clear();
+}
@@ -16,10 +16,18 @@ limitations under the License.
 
 #include "catch.hpp"
 #include "fixtures.h"
+#include <algorithm>
 #include <cstring>
 #include <tlsuv/tlsuv.h>
 #include <tlsuv/websocket.h>
 #include <uv.h>
+#include <string>
+#include <vector>
+
+#include "pool.h"
+#include "ws_parser.h"
+#include "ws_mask.h"
+#include "ws_deflate.h"
 
 static void test_timeout(uv_timer_t *t) {
     printf("timeout stopping loop\n");
@@ -162,4 +170,650 @@ TEST_CASE("websocket echo tests", "[websocket]") {
     }
 
     tlsuv_websocket_close(&clt, on_close_cb);
-}
\ No newline at end of file
+}
+static std::string ws_frame(uint8_t hdr0, const std::string &data, bool masked) {
+    const uint8_t mask[4] = {0x11, 0x22, 0x33, 0x44};
+    std::string f(1, (char) hdr0);
+    uint8_t m = masked ? WS_MASK : 0;
+    if (data.size() < 126) {
+        f += (char) (m | data.size());
+    } else {
+        f += (char) (m | 126);
+        f += (char) (data.size() >> 8);
+        f += (char) (data.size() & 0xff);
+    }
+    if (masked) {
+        f.append((const char *) mask, sizeof(mask));
+    }
+    for (size_t i = 0; i < data.size(); i++) {
+        f += masked ? (char) (data[i] ^ mask[i % 4]) : data[i];
+    }
+    return f;
+}
+
+static int capture_frame(void *ctx, unsigned int op, char *data, size_t len) {
+    auto frames = static_cast<std::vector<std::pair<unsigned int, std::string>> *>(ctx);
+    frames->emplace_back(op, std::string(data, len));
+    return 0;
+}
+
+TEST_CASE("websocket frame parser", "[websocket]") {
+    std::string big(1000, 'x');
+    std::string stream = ws_frame(WS_FIN | OpCode_BIN, "hello", false) +
+                         ws_frame(WS_FIN | OpCode_TXT, "world", true) +
+                         ws_frame(OpCode_TXT, "part1-", true) +
+                         ws_frame(WS_FIN | OpCode_Ping, "ping", true) +
+                         ws_frame(WS_FIN | OpCode_Cont, "part2", false) +
+                         ws_frame(WS_FIN | OpCode_BIN, big, true) +
+                         ws_frame(WS_FIN | OpCode_Close, "", true);
+
+    // whole stream in one read, and split at every possible read size
+    auto step = GENERATE(0, 1, 2, 3, 7, 100, 999);
+    INFO("read size " << step);
+    std::string buf = stream;
+    size_t read_size = step == 0 ? buf.size() : step;
+
+    ws_parser_t p;
+    ws_parser_init(&p);
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    for (size_t off = 0; off < buf.size(); off += read_size) {
+        size_t len = std::min(read_size, buf.size() - off);
+        CHECK(ws_parser_execute(&p, &buf[off], len, capture_frame, &frames) == (ssize_t) len);
+    }
+    ws_parser_free(&p);
+
+    REQUIRE(frames.size() == 6);
+    CHECK(frames[0] == std::make_pair((unsigned int) OpCode_BIN, std::string("hello")));
+    CHECK(frames[1] == std::make_pair((unsigned int) OpCode_TXT, std::string("world")));
+    // control frame between fragments is delivered first
+    CHECK(frames[2].first == OpCode_Ping);
+    CHECK(frames[3] == std::make_pair((unsigned int) OpCode_TXT, std::string("part1-part2")));
+    CHECK(frames[4] == std::make_pair((unsigned int) OpCode_BIN, big));
+    CHECK(frames[5].first == OpCode_Close);
+}
+
+TEST_CASE("websocket frame parser errors", "[websocket]") {
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    ws_parser_t p;
+    ws_parser_init(&p);
+
+    std::string buf;
+    WHEN("continuation without message") {
+        buf = ws_frame(WS_FIN | OpCode_Cont, "x", false);
+    }
+    WHEN("fragmented control frame") {
+        buf = ws_frame(OpCode_Ping, "x", false);
+    }
+    WHEN("new message before previous one is finished") {
+        buf = ws_frame(OpCode_TXT, "x", false) + ws_frame(WS_FIN | OpCode_TXT, "y", false);
+    }
+    WHEN("compressed message without negotiated extension") {
+        buf = ws_frame(WS_FIN | WS_RSV1 | OpCode_TXT, "x", false);
+    }
+    WHEN("compressed control frame") {
+        p.rsv1_ok = true;
+        buf = ws_frame(WS_FIN | WS_RSV1 | OpCode_Ping, "x", false);
+    }
+    CHECK(ws_parser_execute(&p, &buf[0], buf.size(), capture_frame, &frames) == UV_EPROTO);
+    // parser stays failed
+    CHECK(ws_parser_execute(&p, &buf[0], buf.size(), capture_frame, &frames) == UV_EPROTO);
+    CHECK(frames.empty());
+    ws_parser_free(&p);
+}
+
+TEST_CASE("websocket frame parser message limit", "[websocket]") {
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    ws_parser_t p;
+    ws_parser_init(&p);
+    p.max_msg = 1000;
+
+    std::string buf;
+    WHEN("frame claims huge length") {
+        // header only, 2^40 byte payload would follow
+        const uint8_t hdr[] = {WS_FIN | OpCode_BIN, 127, 0, 0, 1, 0, 0, 0, 0, 0};
+        buf.assign((const char *) hdr, sizeof(hdr));
+    }
+    WHEN("fragments add up over the limit") {
+        buf = ws_frame(OpCode_BIN, std::string(600, 'a'), false) +
+              ws_frame(WS_FIN | OpCode_Cont, std::string(600, 'b'), false);
+    }
+    CHECK(ws_parser_execute(&p, &buf[0], buf.size(), capture_frame, &frames) == UV_E2BIG);
+    CHECK(frames.empty());
+    // nothing was allocated for the claimed length
+    CHECK(p.msg_cap <= 1000);
+    ws_parser_free(&p);
+
+    // message at the limit is fine
+    ws_parser_init(&p);
+    p.max_msg = 1000;
+    buf = ws_frame(OpCode_BIN, std::string(500, 'a'), false) +
+          ws_frame(WS_FIN | OpCode_Cont, std::string(500, 'b'), false);
+    CHECK(ws_parser_execute(&p, &buf[0], buf.size(), capture_frame, &frames) == (ssize_t) buf.size());
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0].second.size() == 1000);
+    ws_parser_free(&p);
+}
+
+TEST_CASE("websocket masking", "[websocket]") {
+    const uint8_t mask[4] = { 0x5a, 0xc3, 0x0f, 0x96 };
+    std::vector<char> src(600), expected(src.size() + 8), actual(src.size() + 8);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = (char) (i * 7 + 3);
+    }
+
+    INFO("masking implementation: " << ws_mask_impl());
+    for (size_t align = 0; align < 8; align++) {
+        for (uint64_t offset = 0; offset < 4; offset++) {
+            for (size_t len = 0; len + align <= src.size(); len += (len < 80 ? 1 : 37)) {
+                ws_mask_bytes(expected.data(), src.data() + align, len, mask, offset);
+
+                // copy into a differently aligned buffer
+                ws_mask(actual.data() + 3, src.data() + align, len, mask, offset);
+                CHECK(memcmp(actual.data() + 3, expected.data(), len) == 0);
+
+                // in place
+                std::vector<char> in_place(src);
+                ws_mask(in_place.data() + align, in_place.data() + align, len, mask, offset);
+                CHECK(memcmp(in_place.data() + align, expected.data(), len) == 0);
+            }
+        }
+    }
+}
+
+TEST_CASE("websocket permessage-deflate", "[websocket]") {
+    ws_deflate_t *d = ws_deflate_new(0, 12, 0);
+    REQUIRE(d != nullptr);
+    CHECK_THAT(ws_deflate_offer(d), Catch::Equals("permessage-deflate; client_max_window_bits; server_max_window_bits=12"));
+    CHECK(ws_deflate_new(8, 0, 0) == nullptr);
+    CHECK(ws_deflate_new(0, 16, 0) == nullptr);
+
+    WHEN("server responds with invalid parameters") {
+        auto resp = GENERATE(as<std::string>{},
+                             "x-webkit-deflate-frame",
+                             "permessage-deflate; foo",
+                             "permessage-deflate; client_max_window_bits=8",
+                             "permessage-deflate; client_max_window_bits",
+                             "permessage-deflate; server_max_window_bits=16",
+                             "permessage-deflate, permessage-deflate");
+        INFO(resp);
+        CHECK(ws_deflate_accept(d, resp.c_str()) == UV_EPROTO);
+    }
+
+    WHEN("server does not accept") {
+        CHECK(ws_deflate_accept(d, nullptr) == 0);
+    }
+
+    WHEN("messages are compressed") {
+        auto resp = GENERATE(as<std::string>{},
+                             "permessage-deflate",
+                             "permessage-deflate; client_max_window_bits=\"10\"",
+                             "permessage-deflate; client_no_context_takeover");
+        INFO(resp);
+        REQUIRE(ws_deflate_accept(d, resp.c_str()) == 1);
+
+        // what we send is decoded by inflater of the same state, its context follows our deflater
+        size_t plain = 0, compressed = 0;
+        for (int i = 0; i < 20; i++) {
+            std::string msg = i == 3 ? "" :
+                              "{\"event\":\"session.update\",\"id\":" + std::to_string(i) +
+                              ",\"status\":\"connected\",\"tags\":[\"alpha\",\"beta\"]}";
+            const char *out;
+            size_t out_len;
+            REQUIRE(ws_deflate_compress(d, msg.data(), msg.size(), true, &out, &out_len) == 0);
+            CHECK(out_len > 0);
+            plain += msg.size();
+            compressed += out_len;
+
+            std::string wire(out, out_len);
+            char *in;
+            size_t in_len;
+            REQUIRE(ws_deflate_decompress(d, &wire[0], wire.size(), true, &in, &in_len) == 0);
+            CHECK(std::string(in, in_len) == msg);
+        }
+        // independently compressed short messages do not shrink much
+        if (resp.find("no_context_takeover") == std::string::npos) {
+            CHECK(compressed < plain / 2);
+        }
+
+        char junk[] = "\x01\x02\x03 not deflate";
+        char *in;
+        size_t in_len;
+        CHECK(ws_deflate_decompress(d, junk, sizeof(junk), true, &in, &in_len) == UV_EPROTO);
+    }
+
+    WHEN("inflated message is over the limit") {
+        REQUIRE(ws_deflate_accept(d, "permessage-deflate") == 1);
+        // few KB of zeros inflate to 4MB
+        std::string bomb(4 * 1024 * 1024, '\0');
+        const char *out;
+        size_t out_len;
+        REQUIRE(ws_deflate_compress(d, bomb.data(), bomb.size(), true, &out, &out_len) == 0);
+        CHECK(out_len < 16 * 1024);
+        std::string wire(out, out_len);
+
+        ws_deflate_set_max_output(d, 1024 * 1024);
+        char *in;
+        size_t in_len;
+        CHECK(ws_deflate_decompress(d, &wire[0], wire.size(), true, &in, &in_len) == UV_E2BIG);
+    }
+
+    ws_deflate_free(d);
+}
+
+TEST_CASE("websocket compressed message flag", "[websocket]") {
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    ws_parser_t p;
+    ws_parser_init(&p);
+    p.rsv1_ok = true;
+
+    std::string buf = ws_frame(WS_RSV1 | OpCode_TXT, "a", true) +
+                      ws_frame(WS_FIN | OpCode_Cont, "b", true);
+    CHECK(ws_parser_execute(&p, &buf[0], buf.size(), capture_frame, &frames) == (ssize_t) buf.size());
+    CHECK(p.compressed);
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0].second == "ab");
+
+    buf = ws_frame(WS_FIN | OpCode_BIN, "c", false);
+    CHECK(ws_parser_execute(&p, &buf[0], buf.size(), capture_frame, &frames) == (ssize_t) buf.size());
+    CHECK(!p.compressed);
+    ws_parser_free(&p);
+}
+
+TEST_CASE("websocket frame parser stream mode", "[websocket]") {
+    struct piece {
+        unsigned int op;
+        std::string data;
+        bool end;
+    };
+    std::vector<piece> pieces;
+    ws_parser_t p;
+    ws_parser_init(&p);
+    p.stream = true;
+
+    std::string big(1000, 'y');
+    std::string buf = ws_frame(OpCode_TXT, "part1-", true) +
+                      ws_frame(WS_FIN | OpCode_Ping, "ping", true) +
+                      ws_frame(WS_FIN | OpCode_Cont, big, true) +
+                      ws_frame(WS_FIN | OpCode_BIN, "whole", false);
+
+    auto on_piece = [](void *ctx, unsigned int op, char *data, size_t len) -> int {
+        auto pp = static_cast<std::pair<ws_parser_t *, std::vector<piece> *> *>(ctx);
+        pp->second->push_back(piece{op, std::string(data, len), pp->first->msg_end});
+        return 0;
+    };
+    std::pair<ws_parser_t *, std::vector<piece> *> ctx(&p, &pieces);
+
+    // frame split across reads is delivered as it arrives
+    size_t split = buf.size() - 600;
+    CHECK(ws_parser_execute(&p, &buf[0], split, on_piece, &ctx) == (ssize_t) split);
+    CHECK(ws_parser_execute(&p, &buf[split], buf.size() - split, on_piece, &ctx) == (ssize_t) (buf.size() - split));
+    ws_parser_free(&p);
+
+    REQUIRE(pieces.size() == 5);
+    CHECK(pieces[0].op == OpCode_TXT);
+    CHECK(pieces[0].data == "part1-");
+    CHECK(!pieces[0].end);
+    CHECK(pieces[1].op == OpCode_Ping);
+    std::string rest;
+    for (int i = 2; i < 4; i++) {
+        CHECK(pieces[i].op == OpCode_TXT);
+        rest += pieces[i].data;
+    }
+    CHECK(rest == big);
+    CHECK(!pieces[2].end);
+    CHECK(pieces[3].end);
+    CHECK(pieces[4].op == OpCode_BIN);
+    CHECK(pieces[4].data == "whole");
+    CHECK(pieces[4].end);
+}
+
+TEST_CASE("websocket permessage-deflate fragments", "[websocket]") {
+    ws_deflate_t *d = ws_deflate_new(0, 0, 0);
+    REQUIRE(d != nullptr);
+    REQUIRE(ws_deflate_accept(d, "permessage-deflate") == 1);
+
+    std::string msg;
+    for (int i = 0; i < 200; i++) {
+        msg += "{\"seq\":" + std::to_string(i) + ",\"payload\":\"fragmented message\"}";
+    }
+
+    // compress in three fragments, inflate fragment by fragment
+    std::string result;
+    size_t step = msg.size() / 3 + 1;
+    for (size_t off = 0; off < msg.size(); off += step) {
+        size_t len = std::min(step, msg.size() - off);
+        bool fin = off + len == msg.size();
+        const char *out;
+        size_t out_len;
+        REQUIRE(ws_deflate_compress(d, msg.data() + off, len, fin, &out, &out_len) == 0);
+
+        std::string wire(out, out_len);
+        char *in;
+        size_t in_len;
+        REQUIRE(ws_deflate_decompress(d, &wire[0], wire.size(), fin, &in, &in_len) == 0);
+        result.append(in, in_len);
+    }
+    CHECK(result == msg);
+    ws_deflate_free(d);
+}
+
+// source link capturing frames written by websocket, and feeding it server data
+struct ws_capture {
+    uv_link_methods_t methods{};
+    uv_link_t link;
+    tcp_src_t src{};
+    int writes = 0;
+    std::string data;
+    // buffer lengths of each write
+    std::vector<std::vector<size_t>> bufs;
+
+    explicit ws_capture(uv_loop_t *loop);
+
+    // delivers bytes as if they were read from the socket, websocket releases buffer to the pool
+    void feed(const std::string &in) {
+        uv_buf_t b = uv_buf_init((char *) tlsuv_pool_alloc(in.size()), (unsigned int) in.size());
+        memcpy(b.base, in.data(), in.size());
+        uv_link_propagate_read_cb(&link, (ssize_t) in.size(), &b);
+    }
+};
+
+static int capture_write(uv_link_t *l, uv_link_t *source, const uv_buf_t bufs[], unsigned int nbufs,
+                         uv_stream_t *send_handle, uv_link_write_cb cb, void *arg) {
+    auto cap = static_cast<ws_capture *>(l->data);
+    cap->writes++;
+    cap->bufs.emplace_back();
+    for (unsigned int i = 0; i < nbufs; i++) {
+        cap->data.append(bufs[i].base, bufs[i].len);
+        cap->bufs.back().push_back(bufs[i].len);
+    }
+    cb(source, 0, arg);
+    return 0;
+}
+
+static int capture_read_start(uv_link_t *l) {
+    return 0;
+}
+
+static int capture_connect(tlsuv_src_t *sl, const char *host, const char *port, tlsuv_src_connect_cb cb, void *ctx) {
+    cb(sl, 0, ctx);
+    return 0;
+}
+
+static void capture_cancel(tlsuv_src_t *sl) {}
+
+ws_capture::ws_capture(uv_loop_t *loop) {
+    methods.read_start = capture_read_start;
+    methods.write = capture_write;
+    methods.close = uv_link_default_close;
+    methods.alloc_cb_override = uv_link_default_alloc_cb_override;
+    methods.read_cb_override = uv_link_default_read_cb_override;
+    uv_link_init(&link, &methods);
+    link.data = this;
+
+    src.link = &link;
+    src.loop = loop;
+    src.connect = capture_connect;
+    src.cancel = capture_cancel;
+}
+
+static void count_write(uv_write_t *req, int status) {
+    CHECK(status == 0);
+    (*static_cast<int *>(req->data))++;
+}
+
+TEST_CASE("websocket write batching", "[websocket]") {
+    UvLoopTest lt;
+    ws_capture cap(lt.loop);
+
+    tlsuv_websocket_t ws;
+    memset(&ws, 0, sizeof(ws));
+    tlsuv_websocket_init_with_src(lt.loop, &ws, (tlsuv_src_t *) &cap.src);
+    uv_connect_t cr;
+    REQUIRE(tlsuv_websocket_connect(&cr, &ws, "ws://localhost/batch", nullptr, nullptr) == 0);
+    // handshake request
+    REQUIRE(cap.writes == 1);
+    size_t hs_len = cap.data.size();
+
+    const int count = 100;
+    std::vector<uv_write_t> reqs(count);
+    std::vector<std::string> msgs;
+    for (int i = 0; i < count; i++) {
+        msgs.push_back("message-" + std::to_string(i));
+    }
+    int done = 0;
+
+    WHEN("frames are batched") {
+        for (int i = 0; i < count; i++) {
+            uv_buf_t b = uv_buf_init(&msgs[i][0], (unsigned int) msgs[i].size());
+            reqs[i].data = &done;
+            CHECK(tlsuv_websocket_write(&reqs[i], &ws, &b, count_write) == 0);
+        }
+        CHECK(cap.writes == 1);
+        CHECK(done == 0);
+        CHECK(tlsuv_websocket_write_queue_size(&ws) > 0);
+
+        lt.run();
+        CHECK(cap.writes == 2);
+    }
+
+    WHEN("batching is disabled") {
+        CHECK(tlsuv_websocket_set_nodelay(&ws, true) == 0);
+        for (int i = 0; i < count; i++) {
+            uv_buf_t b = uv_buf_init(&msgs[i][0], (unsigned int) msgs[i].size());
+            reqs[i].data = &done;
+            CHECK(tlsuv_websocket_write(&reqs[i], &ws, &b, count_write) == 0);
+        }
+        CHECK(cap.writes == 1 + count);
+    }
+
+    CHECK(done == count);
+    CHECK(tlsuv_websocket_write_queue_size(&ws) == 0);
+
+    ws_parser_t p;
+    ws_parser_init(&p);
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    std::string wire = cap.data.substr(hs_len);
+    CHECK(ws_parser_execute(&p, &wire[0], wire.size(), capture_frame, &frames) == (ssize_t) wire.size());
+    ws_parser_free(&p);
+    REQUIRE(frames.size() == count);
+    for (int i = 0; i < count; i++) {
+        CHECK(frames[i].first == OpCode_BIN);
+        CHECK(frames[i].second == msgs[i]);
+    }
+
+    tlsuv_websocket_close(&ws, nullptr);
+}
+
+TEST_CASE("websocket frame header and payload buffers", "[websocket]") {
+    UvLoopTest lt;
+    ws_capture cap(lt.loop);
+
+    tlsuv_websocket_t ws;
+    memset(&ws, 0, sizeof(ws));
+    tlsuv_websocket_init_with_src(lt.loop, &ws, (tlsuv_src_t *) &cap.src);
+    CHECK(tlsuv_websocket_set_nodelay(&ws, true) == 0);
+    uv_connect_t cr;
+    REQUIRE(tlsuv_websocket_connect(&cr, &ws, "ws://localhost/frames", nullptr, nullptr) == 0);
+    REQUIRE(cap.writes == 1);
+
+    // payload length encodings: 7 bit, 16 bit, 64 bit
+    auto len = GENERATE(as<size_t>{}, 1, 125, 126, 0xffff, 0x10000, 100000);
+    std::string msg(len, 0);
+    for (size_t i = 0; i < len; i++) {
+        msg[i] = (char) (i * 7);
+    }
+    const std::string orig = msg;
+    size_t hdr_len = len < 126 ? 2 + 4 : len <= 0xffff ? 4 + 4 : 10 + 4;
+
+    size_t start = cap.data.size();
+    int done = 0;
+    uv_write_t wr;
+    wr.data = &done;
+    uv_buf_t b = uv_buf_init(&msg[0], (unsigned int) msg.size());
+    REQUIRE(tlsuv_websocket_write(&wr, &ws, &b, count_write) == 0);
+    CHECK(done == 1);
+
+    REQUIRE(cap.writes == 2);
+    REQUIRE(cap.bufs[1].size() == 2);
+    CHECK(cap.bufs[1][0] == hdr_len);
+    CHECK(cap.bufs[1][1] == len);
+    // payload is masked into a copy
+    CHECK(msg == orig);
+    CHECK(cap.data.substr(start + hdr_len) != orig);
+
+    ws_parser_t p;
+    ws_parser_init(&p);
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    std::string wire = cap.data.substr(start);
+    CHECK(ws_parser_execute(&p, &wire[0], wire.size(), capture_frame, &frames) == (ssize_t) wire.size());
+    ws_parser_free(&p);
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0].first == OpCode_BIN);
+    CHECK(frames[0].second == orig);
+
+    tlsuv_websocket_close(&ws, nullptr);
+}
+
+TEST_CASE("websocket control frame buffers", "[websocket]") {
+    UvLoopTest lt;
+    ws_capture cap(lt.loop);
+
+    tlsuv_websocket_t ws;
+    memset(&ws, 0, sizeof(ws));
+    tlsuv_websocket_init_with_src(lt.loop, &ws, (tlsuv_src_t *) &cap.src);
+    CHECK(tlsuv_websocket_set_nodelay(&ws, true) == 0);
+    uv_connect_t cr;
+    REQUIRE(tlsuv_websocket_connect(&cr, &ws, "ws://localhost/control",
+                                    [](uv_connect_t *, int status) { CHECK(status == 0); },
+                                    [](uv_stream_t *, ssize_t, const uv_buf_t *) {}) == 0);
+    cap.feed("HTTP/1.1 101 Switching Protocols\r\n"
+             "Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "\r\n");
+    size_t start = cap.data.size();
+    int writes = cap.writes;
+
+    WHEN("ping has payload") {
+        cap.feed(ws_frame(WS_FIN | OpCode_Ping, "ping-data", false));
+        REQUIRE(cap.writes == writes + 1);
+        REQUIRE(cap.bufs.back().size() == 2);
+        CHECK(cap.bufs.back()[0] == 6);
+        CHECK(cap.bufs.back()[1] == 9);
+    }
+
+    WHEN("ping is empty") {
+        cap.feed(ws_frame(WS_FIN | OpCode_Ping, "", false));
+        REQUIRE(cap.writes == writes + 1);
+        // header only
+        REQUIRE(cap.bufs.back().size() == 1);
+        CHECK(cap.bufs.back()[0] == 6);
+    }
+
+    ws_parser_t p;
+    ws_parser_init(&p);
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    std::string wire = cap.data.substr(start);
+    CHECK(ws_parser_execute(&p, &wire[0], wire.size(), capture_frame, &frames) == (ssize_t) wire.size());
+    ws_parser_free(&p);
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0].first == OpCode_Pong);
+
+    tlsuv_websocket_close(&ws, nullptr);
+}
+
+struct ws_keepalive_test {
+    ws_capture *cap;
+    tlsuv_websocket_t *ws;
+    size_t hs_len = 0;
+    bool answer = true;
+    bool answered = false;
+    ssize_t read_status = 0;
+};
+
+static void keepalive_data(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    auto t = static_cast<ws_keepalive_test *>(((tlsuv_websocket_t *) s)->data);
+    if (nread < 0) {
+        t->read_status = nread;
+    }
+}
+
+static void keepalive_check(uv_timer_t *timer) {
+    auto t = static_cast<ws_keepalive_test *>(timer->data);
+    tlsuv_ws_ping_stats stats;
+    tlsuv_websocket_ping_stats(t->ws, &stats);
+    if (stats.pongs_received > 0 || t->read_status != 0) {
+        uv_close((uv_handle_t *) timer, nullptr);
+        return;
+    }
+
+    if (!t->answer || t->answered) {
+        return;
+    }
+
+    ws_parser_t p;
+    ws_parser_init(&p);
+    std::vector<std::pair<unsigned int, std::string>> frames;
+    std::string wire = t->cap->data.substr(t->hs_len);
+    ws_parser_execute(&p, &wire[0], wire.size(), capture_frame, &frames);
+    ws_parser_free(&p);
+    for (auto &f: frames) {
+        if (f.first == OpCode_Ping) {
+            t->answered = true;
+            t->cap->feed(ws_frame(WS_FIN | OpCode_Pong, "unsolicited", false));
+            t->cap->feed(ws_frame(WS_FIN | OpCode_Pong, f.second, false));
+        }
+    }
+}
+
+TEST_CASE("websocket keepalive", "[websocket]") {
+    UvLoopTest lt;
+    ws_capture cap(lt.loop);
+
+    tlsuv_websocket_t ws;
+    memset(&ws, 0, sizeof(ws));
+    tlsuv_websocket_init_with_src(lt.loop, &ws, (tlsuv_src_t *) &cap.src);
+    ws_keepalive_test test;
+    test.cap = &cap;
+    test.ws = &ws;
+    ws.data = &test;
+    CHECK(tlsuv_websocket_set_keepalive(&ws, 20, 100) == 0);
+
+    uv_connect_t cr;
+    cr.data = &test;
+    REQUIRE(tlsuv_websocket_connect(&cr, &ws, "ws://localhost/keepalive", [](uv_connect_t *r, int status) {
+        CHECK(status == 0);
+    }, keepalive_data) == 0);
+    cap.feed("HTTP/1.1 101 Switching Protocols\r\n"
+             "Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "\r\n");
+    test.hs_len = cap.data.size();
+
+    uv_timer_t check;
+    uv_timer_init(lt.loop, &check);
+    check.data = &test;
+    uv_timer_start(&check, keepalive_check, 5, 5);
+
+    tlsuv_ws_ping_stats stats;
+    WHEN("pong is received") {
+        lt.run();
+        CHECK(test.read_status == 0);
+        REQUIRE(tlsuv_websocket_ping_stats(&ws, &stats) == 0);
+        CHECK(stats.pings_sent == 1);
+        CHECK(stats.pongs_received == 1);
+        CHECK(stats.rtt_last > 0);
+        CHECK(stats.rtt_min == stats.rtt_last);
+        CHECK(stats.rtt_ewma == stats.rtt_last);
+    }
+
+    WHEN("pong is missed") {
+        test.answer = false;
+        lt.run();
+        CHECK(test.read_status == UV_ETIMEDOUT);
+        REQUIRE(tlsuv_websocket_ping_stats(&ws, &stats) == 0);
+        CHECK(stats.pings_sent == 1);
+        CHECK(stats.pongs_received == 0);
+    }
+
+    tlsuv_websocket_close(&ws, nullptr);
+}